@@ -1,6 +1,12 @@
 from torch._dynamo.backends.common import aot_autograd
 from torch._functorch.aot_autograd import make_boxed_func
+from .decompositions import select_decompositions
+from .dedup import dedup_graphs, get_shared_graph, share_graph, structural_key
 from .graph import GraphTransformer
+from .partition import compile_partitioned, unsupported_nodes
+from .stream_schedule import schedule_streams
+import concurrent.futures
+import copy
 import functools
 import itertools
 import logging
@@ -32,6 +38,54 @@ dynamo_utils = import_module("torch._dynamo.utils")
 
 count_calls = dynamo_utils.count_calls
 
+# DICP_ASYNC_COMPILE=1 compiles the graphs in the background, running them
+# eagerly until their kernels are ready
+async_compile = os.environ.get("DICP_ASYNC_COMPILE", "0") == "1"
+_compile_pool = None
+
+
+def get_compile_pool():
+    global _compile_pool
+    if _compile_pool is None:
+        workers = int(os.environ.get("DICP_COMPILE_THREADS",
+                                     min(8, os.cpu_count() or 1)))
+        # the backend compilers run as subprocesses, threads are enough
+        _compile_pool = concurrent.futures.ThreadPoolExecutor(
+            max_workers=workers, thread_name_prefix="dicp_compile")
+    return _compile_pool
+
+
+def submit_compile(fn):
+    # Loading the compiled graph makes device resources, e.g. the Ascend
+    # model, which need the device of the caller current on the pool thread.
+    from torch_dipu import dipu
+    device = dipu.current_device()
+
+    def compile_on_device():
+        dipu.set_device(device)
+        return fn()
+    return get_compile_pool().submit(compile_on_device)
+
+
+class AsyncCompiledFn:
+    r"""Runs ``eager_fn`` until ``future`` has the compiled function, then
+    switches to it. Compile errors are raised by the first call after the
+    compilation failed."""
+
+    def __init__(self, future, eager_fn):
+        self.future = future
+        self.eager_fn = eager_fn
+        self.compiled_fn = None
+        self._boxed_call = True
+
+    def __call__(self, args):
+        if self.compiled_fn is None:
+            if not self.future.done():
+                return self.eager_fn(args)
+            self.compiled_fn = self.future.result()
+            self.eager_fn = None
+        return self.compiled_fn(args)
+
 
 def get_fake_mode_from_tensors(input_tensors):
     if is_torch_200:
@@ -67,7 +121,8 @@ def compile_fx_inner(
     num_fixed=0,
     is_backward=False,
     graph_id=None,
-    backend=None
+    backend=None,
+    options=None,
 ):
     if dynamo_utils.count_calls(gm.graph) == 0:
         return make_boxed_func(gm.forward)
@@ -80,13 +135,43 @@ def compile_fx_inner(
     # to adapt large/deep models
     sys.setrecursionlimit(max(sys.getrecursionlimit(), 2000))
 
-    gt = GraphTransformer(gm, backend)
+    targets = get_supported_targets(backend)
+    if targets is not None and unsupported_nodes(gm, targets):
+        compile_subgraph = functools.partial(
+            compile_fx_inner, example_inputs=[], backend=backend, options=options)
+        partitioned = compile_partitioned(gm, targets, compile_subgraph)
+        # side streams running independent subgraphs, 0 runs all in order
+        num_streams = int((options or {}).get(
+            "multi_stream", os.environ.get("DICP_MULTI_STREAM", "0")))
+        return make_boxed_func(schedule_streams(partitioned, num_streams).forward)
+
+    # graphs of the same structure as one compiled before skip the
+    # conversion and the compilation, and run its compiled graph
+    config = get_backend_config(backend)
+    shared_key, bound_targets = structural_key(
+        gm, backend, options, config) if dedup_graphs else (None, None)
+    shared = get_shared_graph(shared_key)
+    if shared is not None:
+        compiled = shared.bind(gm, bound_targets)
+        if isinstance(compiled, concurrent.futures.Future):
+            return AsyncCompiledFn(compiled, make_boxed_func(gm.forward))
+        return compiled
+
+    if async_compile:
+        # the transform below rewrites the graph of gm
+        eager_gm = torch.fx.GraphModule(gm, copy.deepcopy(gm.graph))
+    gt = GraphTransformer(gm, backend, options)
     gt.transform()
     gt.infer_shape_dtype()
+    if async_compile:
+        future = submit_compile(gt.compile_to_fn)
+        share_graph(shared_key, bound_targets, gt.gm, future, config)
+        return AsyncCompiledFn(future, make_boxed_func(eager_gm.forward))
     compiled_fn = gt.compile_to_fn()
 
     # aot autograd needs to know to pass in inputs as a list
     compiled_fn._boxed_call = True
+    share_graph(shared_key, bound_targets, gt.gm, compiled_fn, config)
     return compiled_fn
 
 
@@ -98,11 +183,12 @@ def compile_fx(
     example_inputs_: List[torch.Tensor],
     backend: str,
     inner_compile=compile_fx_inner,
+    options=None,
 ):
     if torch.__version__.startswith("2.0"):
-        return compile_fx_200(model_, example_inputs_, backend, inner_compile)
+        return compile_fx_200(model_, example_inputs_, backend, inner_compile, options)
     elif torch.__version__.startswith("2.1"):
-        return compile_fx_210(model_, example_inputs_, backend, inner_compile)
+        return compile_fx_210(model_, example_inputs_, backend, inner_compile, options)
     else:
         raise ValueError(
             f"unsupported dicp torch version: {torch.__version__}")
@@ -113,6 +199,8 @@ def compile_fx_200(
     example_inputs_: List[torch.Tensor],
     backend: str,
     inner_compile=compile_fx_inner,
+
+    options=None,
 ):
     """Main entrypoint to a compile given FX graph"""
     functorch.compile.config.use_functionalize = True
@@ -145,7 +233,7 @@ def compile_fx_200(
             backend=backend,
         )
 
-    decompositions = get_decompositions(backend=backend)
+    decompositions = get_decompositions(backend=backend, options=options)
     return aot_autograd(
         fw_compiler=fw_compiler,
         bw_compiler=bw_compiler,
@@ -158,13 +246,15 @@ def compile_fx_210(
     example_inputs_: List[torch.Tensor],
     backend: str,
     inner_compile=compile_fx_inner,
+
+    options=None,
 ):
     import torch._dynamo.config as dynamo_config
     from torch._inductor.compile_fx import flatten_graph_inputs, graph_returns_tuple, \
         make_graph_return_tuple, pre_grad_passes, joint_graph_passes, min_cut_rematerialization_partition, \
         _PyTreeCodeGen, handle_dynamo_export_graph
 
-    decompositions = get_decompositions(backend=backend)
+    decompositions = get_decompositions(backend=backend, options=options)
 
     recursive_compile_fx = functools.partial(
         compile_fx,
@@ -280,16 +370,27 @@ def count_tangents(fx_g: torch.fx.GraphModule):
     return len(static_arg_idxs)
 
 
-def get_decompositions(backend):
-    decompositions = {}
+def get_backend_config(backend):
     folder_list = os.listdir(os.path.dirname(
         os.path.dirname(__file__)) + '/vendor')
-    found_decomp = False
     for folder in folder_list:
         if backend.lower() == folder.lower():
-            config = importlib.import_module(
+            return importlib.import_module(
                 "dicp.vendor." + folder + ".config")
-            decompositions = config.decomp
-            found_decomp = True
-    assert found_decomp, "Not found decomp table!"
-    return decompositions
+    return None
+
+
+def get_decompositions(backend, options=None):
+    config = get_backend_config(backend)
+    assert config is not None, "Not found decomp table!"
+    return select_decompositions(
+        config.decomp, getattr(config, "native_ops", ()), options)
+
+
+def get_supported_targets(backend):
+    r"""The aten ops ``backend`` lowers, None if it doesn't tell, which
+    compiles graphs whole."""
+    config = get_backend_config(backend)
+    if config is None or not hasattr(config, "supported_targets"):
+        return None
+    return config.supported_targets()
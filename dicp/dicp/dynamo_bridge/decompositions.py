@@ -1,8 +1,10 @@
+import os
+import time
 from collections import defaultdict
 from typing import Callable, Dict, Sequence, Union
 
 import torch
-from torch._decomp import register_decomposition
+from torch._decomp import decomposition_table, register_decomposition
 from torch._ops import OpOverload, OpOverloadPacket
 
 dicp_decomposition_table = {}
@@ -36,3 +38,74 @@ def get_decompositions(
         elif isinstance(op, OpOverload) and op in registry:
             decompositions[op] = registry[op]
     return decompositions
+
+
+def _resolve_ops(ops):
+    r"""OpOverloads of ``ops``, given as OpOverloads, OpOverloadPackets or
+    their names, e.g. "aten.gelu" or "aten.native_layer_norm.default"."""
+    if isinstance(ops, str):
+        ops = [op for op in ops.split(",") if op.strip()]
+    overloads = []
+    for op in ops:
+        if isinstance(op, str):
+            namespace, *names = op.strip().split(".")
+            op = getattr(getattr(torch.ops, namespace), names[0])
+            if len(names) > 1:
+                op = getattr(op, names[1])
+        if isinstance(op, OpOverloadPacket):
+            overloads.extend(getattr(op, name) for name in op.overloads())
+        else:
+            overloads.append(op)
+    return overloads
+
+
+def select_decompositions(
+    decompositions: Dict[OpOverload, Callable],
+    native_ops: Sequence[Union[OpOverload, OpOverloadPacket]] = (),
+    options: Dict = None,
+) -> Dict[OpOverload, Callable]:
+    r"""The ``decompositions`` of a backend without those of its
+    ``native_ops``, the aten ops it lowers to efficient ops of its own.
+    The "keep_ops" of the options of torch.compile, else DICP_KEEP_OPS, keep
+    more ops intact, its "decompose_ops", else DICP_DECOMPOSE_OPS, decompose
+    ops by the decompositions of torch instead, comma separated names if
+    strings. See benchmark_decomposition to decide between them."""
+    options = options or {}
+    keep_ops = options.get("keep_ops", os.environ.get("DICP_KEEP_OPS", ""))
+    decompose_ops = options.get("decompose_ops",
+                                os.environ.get("DICP_DECOMPOSE_OPS", ""))
+    kept = set(_resolve_ops(native_ops)) | set(_resolve_ops(keep_ops))
+    selected = {op: fn for op, fn in decompositions.items() if op not in kept}
+    for op in _resolve_ops(decompose_ops):
+        fn = decompositions.get(op, decomposition_table.get(op))
+        assert fn is not None, f"no decomposition of {op}"
+        selected[op] = fn
+    return selected
+
+
+def benchmark_decomposition(backend, op, args, kwargs=None, iterations=20):
+    r"""Seconds a call of ``op`` compiled by ``backend`` takes kept intact
+    and decomposed, as {"kept": ..., "decomposed": ...}, which tells whether
+    to add it to the "keep_ops" or "decompose_ops" of a model."""
+    import torch_dipu
+
+    kwargs = kwargs or {}
+
+    def fn(*args):
+        return op(*args, **kwargs)
+
+    times = {}
+    for mode, option in (("kept", "keep_ops"), ("decomposed", "decompose_ops")):
+        torch._dynamo.reset()
+        compiled = torch.compile(fn, backend=backend, dynamic=False,
+                                 options={option: [op]})
+        # compiles and warms up
+        compiled(*args)
+        torch_dipu.dipu.synchronize()
+        start = time.perf_counter()
+        for _ in range(iterations):
+            compiled(*args)
+        torch_dipu.dipu.synchronize()
+        times[mode] = (time.perf_counter() - start) / iterations
+    torch._dynamo.reset()
+    return times
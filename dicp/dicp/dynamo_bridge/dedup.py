@@ -0,0 +1,153 @@
+import concurrent.futures
+import functools
+import hashlib
+import os
+
+import torch
+import torch.fx
+
+# DICP_DEDUP_GRAPHS=0 compiles each graph, even one of the same structure as
+# a graph compiled before, e.g. the next decoder layer of an LLM
+dedup_graphs = os.environ.get("DICP_DEDUP_GRAPHS", "1") == "1"
+
+_shared_graphs = {}
+
+
+def _fetch(gm, target):
+    return functools.reduce(getattr, target.split('.'), gm)
+
+
+def _describe(value):
+    if isinstance(value, torch.Tensor):
+        stride = value.stride() if value.layout == torch.strided else ()
+        return (str(value.dtype), str(value.layout), value.device.type,
+                tuple(map(str, value.shape)), tuple(map(str, stride)))
+    return (type(value).__name__, str(value))
+
+
+def _content_hash(tensor):
+    data = tensor.detach().cpu().contiguous().reshape(-1).view(torch.uint8)
+    return hashlib.sha256(data.numpy().tobytes()).hexdigest()
+
+
+def _describe_arg(arg, index):
+    if isinstance(arg, torch.fx.Node):
+        return f'%{index[arg]}'
+    if isinstance(arg, torch.Tensor):
+        # the repr of a tensor elides most of its values
+        return ('tensor',) + _describe(arg) + (_content_hash(arg),)
+    return arg
+
+
+def _target_name(target):
+    if isinstance(target, str) or isinstance(target, torch._ops.OpOverload):
+        return str(target)
+    return f"{getattr(target, '__module__', '')}." \
+        f"{getattr(target, '__qualname__', repr(target))}"
+
+
+def _may_fold(node):
+    # a user computed from constants only may be folded into the graph
+    return any(user.op == 'call_function' and
+               all(n.op == 'get_attr' for n in user.all_input_nodes)
+               for user in node.users)
+
+
+def structural_key(gm: torch.fx.GraphModule, backend, options, config):
+    r"""The key of the compiled graph of ``gm``, made of its ops, how they
+    connect, its input shapes and dtypes, and its constants, and the targets
+    of the constants bound to the compiled graph as inputs, which are keyed
+    by shape and dtype only. Graphs of the same structure, e.g. the decoder
+    layers of an LLM, share a key and differ in the bound constants only.
+    None if ``gm`` calls modules or methods, which may hold state, or lacks
+    the shapes of its inputs."""
+    is_bound = getattr(config, "is_bound_constant", None)
+    index = {}
+    bound = []
+    items = [backend, repr(options)]
+    for i, node in enumerate(gm.graph.nodes):
+        index[node] = i
+        args = torch.fx.node.map_aggregate((node.args, node.kwargs),
+                                           lambda a: _describe_arg(a, index))
+        if node.op == 'placeholder':
+            if 'val' not in node.meta:
+                return None, None
+            desc = _describe(node.meta['val'])
+        elif node.op == 'get_attr':
+            attr = _fetch(gm, node.target)
+            if not isinstance(attr, torch.Tensor):
+                return None, None
+            if is_bound is not None and is_bound(attr) and not _may_fold(node):
+                bound.append(node.target)
+                desc = ('bound',) + _describe(attr)
+            else:
+                desc = ('const',) + _describe(attr) + (_content_hash(attr),)
+        elif node.op in ('call_function', 'output'):
+            desc = _target_name(node.target)
+        else:
+            return None, None
+        items.append((node.op, desc, repr(args)))
+    key = hashlib.sha256(repr(items).encode('utf-8')).hexdigest()
+    return key, bound
+
+
+def _with_constants(fn, constants):
+    if not constants:
+        return fn
+    bound = functools.partial(fn, graph_constants=constants)
+    bound._boxed_call = True
+    return bound
+
+
+class _SharedGraph:
+    def __init__(self, compiled, plan, bind_constant):
+        # the compiled function of the first graph, or its future
+        self.compiled = compiled
+        # the index in the bound targets of each constant it takes
+        self.plan = plan
+        self.bind_constant = bind_constant
+
+    def bind(self, gm, targets):
+        r"""The compiled function of the first graph, taking the constants
+        of ``gm``, or its future if the first is still being compiled."""
+        constants = [self.bind_constant(_fetch(gm, targets[i]))
+                     for i in self.plan]
+        if not isinstance(self.compiled, concurrent.futures.Future):
+            return _with_constants(self.compiled, constants)
+        result = concurrent.futures.Future()
+
+        def done(future):
+            try:
+                result.set_result(_with_constants(future.result(), constants))
+            except BaseException as e:
+                result.set_exception(e)
+        self.compiled.add_done_callback(done)
+        return result
+
+
+def get_shared_graph(key):
+    return _shared_graphs.get(key) if key is not None else None
+
+
+def share_graph(key, targets, converted: torch.fx.GraphModule, compiled,
+                config):
+    r"""Shares ``compiled``, the function or future compiled from
+    ``converted``, with the graphs of ``key``, if all the constants keyed by
+    shape, ``targets``, were bound to it as inputs, and only those."""
+    if key is None or not getattr(config, "share_graphs", True):
+        return
+    is_bound = getattr(config, "is_bound_constant", None)
+    converted_targets = []
+    for node in converted.graph.nodes:
+        if node.op != 'get_attr':
+            continue
+        attr = _fetch(converted, node.target)
+        if is_bound is not None and isinstance(attr, torch.Tensor) and \
+                is_bound(attr):
+            converted_targets.append(node.target)
+    if set(converted_targets) != set(targets):
+        # folded or embedded after all, or derived by the conversion
+        return
+    plan = [targets.index(target) for target in converted_targets]
+    _shared_graphs[key] = _SharedGraph(
+        compiled, plan, getattr(config, "bind_constant", None))
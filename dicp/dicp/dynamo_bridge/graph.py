@@ -1,3 +1,4 @@
+import functools
 import logging
 import os
 import torch
@@ -6,7 +7,7 @@ from typing import List, Optional, Tuple
 from torch._dynamo.utils import dynamo_timed
 from torch._subclasses import FakeTensor, FakeTensorMode
 from torch._inductor.codecache import cache_dir
-from dicp.dynamo_bridge.utils import save_cpu_gm
+from dicp.dynamo_bridge.utils import save_cpu_gm, save_node_sources
 from torch.fx.passes.shape_prop import _extract_tensor_metadata, TensorMetadata
 
 log = logging.getLogger(__name__)
@@ -17,6 +18,7 @@ class GraphTransformer:
         self,
         gm: torch.fx.GraphModule,
         backend: str,
+        options: Optional[dict] = None,
     ):
         self.gm = gm
         self.backend = backend
@@ -26,12 +28,12 @@ class GraphTransformer:
             from dicp.vendor.TopsGraph.opset_transform import topsgraph_opset_transform
             self.backend_opset_transform = topsgraph_opset_transform
             from dicp.vendor.TopsGraph.codegen.enflame import EnflameCodegen
-            self.backend_codegen = EnflameCodegen
+            self.backend_codegen = functools.partial(EnflameCodegen, options=options)
         elif backend == 'ascendgraph':
             from dicp.vendor.AscendGraph.opset_convert import ascendgraph_opset_convert
             self.backend_opset_transform = ascendgraph_opset_convert
             from dicp.vendor.AscendGraph.codegen.ascend import AscendCodegen
-            self.backend_codegen = AscendCodegen
+            self.backend_codegen = functools.partial(AscendCodegen, options=options)
 
     def transform(self):
         self.gm = self.backend_opset_transform(self.gm)
@@ -79,6 +81,9 @@ class GraphTransformer:
                 n.meta["tensor_meta"] = make_tensor_meta(n.meta['val'])
 
     def codegen(self):
+        # names the vendor ops in profiles after the model code, see
+        # dicp/tools/profile_sources.py
+        save_node_sources(self.gm, self.folder, self.graph_key)
         return self.backend_codegen(self.gm, self.cpu_gm, self.folder, self.graph_key).codegen()
 
     @dynamo_timed
@@ -0,0 +1,93 @@
+import logging
+import operator
+
+import torch
+import torch.fx
+from torch._ops import OpOverload
+from torch.fx.passes.infra.partitioner import CapabilityBasedPartitioner
+from torch.fx.passes.operator_support import OperatorSupportBase
+
+log = logging.getLogger(__name__)
+
+
+def pattern_targets(patterns_cls_list):
+    r"""The ops the patterns of ``patterns_cls_list`` match, which a backend
+    lowers once the patterns replaced them."""
+    targets = set()
+    for pattern in patterns_cls_list:
+        graph = torch.fx.symbolic_trace(pattern.pattern).graph
+        targets.update(node.target for node in graph.nodes
+                       if node.op == 'call_function')
+    return targets
+
+
+def _is_supported(node, targets):
+    if node.target is operator.getitem and isinstance(node.args[0], torch.fx.Node):
+        # goes with the op whose outputs it picks
+        return node.args[0].op != 'call_function' or _is_supported(node.args[0], targets)
+    # python ops on symbolic sizes are lowered by every backend
+    return not isinstance(node.target, OpOverload) or node.target in targets
+
+
+class _TargetSupport(OperatorSupportBase):
+    def __init__(self, targets):
+        self.targets = targets
+
+    def is_node_supported(self, submodules, node):
+        return _is_supported(node, self.targets)
+
+
+def unsupported_nodes(gm: torch.fx.GraphModule, targets):
+    return [node for node in gm.graph.nodes
+            if node.op == 'call_function' and not _is_supported(node, targets)]
+
+
+class _CompiledSubgraph(torch.nn.Module):
+    def __init__(self, compiled_fn, single_output):
+        super().__init__()
+        self.compiled_fn = compiled_fn
+        self.single_output = single_output
+
+    def forward(self, *args):
+        if getattr(self.compiled_fn, '_boxed_call', False):
+            outputs = self.compiled_fn(list(args))
+        else:
+            outputs = self.compiled_fn(*args)
+        return outputs[0] if self.single_output else outputs
+
+
+def _prepare_subgraph(sub: torch.fx.GraphModule, call: torch.fx.Node):
+    placeholders = [node for node in sub.graph.nodes if node.op == 'placeholder']
+    for placeholder, arg in zip(placeholders, call.args):
+        if isinstance(arg, torch.fx.Node):
+            placeholder.meta = dict(arg.meta)
+    # the backends compile graphs returning a tuple
+    output = next(node for node in sub.graph.nodes if node.op == 'output')
+    single_output = not isinstance(output.args[0], (tuple, list))
+    if single_output:
+        output.args = ((output.args[0],),)
+        sub.recompile()
+    return single_output
+
+
+def compile_partitioned(gm: torch.fx.GraphModule, targets, compile_subgraph):
+    r"""Compiles the largest subgraphs of ``gm`` whose ops the backend lowers
+    by ``compile_subgraph`` and runs the ops between them eagerly on the
+    device, which their inputs stay on. Fusing whole partitions keeps the
+    tensors crossing between compiled and eager ops few."""
+    log.warning("dicp runs %s eagerly",
+                sorted({str(node.target) for node in unsupported_nodes(gm, targets)}))
+    # a lone op runs eagerly rather than as a graph of its own
+    partitioner = CapabilityBasedPartitioner(
+        gm, _TargetSupport(targets), allows_single_node_partition=False,
+        non_compute_ops=["_operator.getitem"])
+    fused = partitioner.fuse_partitions(partitioner.propose_partitions())
+    for node in fused.graph.nodes:
+        if node.op != 'call_module':
+            continue
+        sub = getattr(fused, node.target)
+        single_output = _prepare_subgraph(sub, node)
+        setattr(fused, node.target,
+                _CompiledSubgraph(compile_subgraph(sub), single_output))
+    fused.recompile()
+    return fused
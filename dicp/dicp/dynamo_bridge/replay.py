@@ -0,0 +1,121 @@
+import collections
+import functools
+import os
+
+import torch
+from torch.utils._pytree import tree_flatten, tree_unflatten
+
+
+def _key(flat_args):
+    key = []
+    for arg in flat_args:
+        if isinstance(arg, torch.Tensor):
+            key.append((tuple(arg.shape), arg.stride(), arg.dtype, arg.device))
+        else:
+            key.append(arg)
+    try:
+        hash(tuple(key))
+    except TypeError:
+        return None
+    return tuple(key)
+
+
+class _Graph:
+    def __init__(self, graph, static_inputs, static_outputs):
+        self.graph = graph
+        self.static_inputs = static_inputs
+        self.static_outputs = static_outputs
+
+
+def replayed(fn=None, *, warmup=None, max_graphs=8):
+    r"""Captures a function running dicp compiled graphs and the eager ops
+    between them into a DIPUGraph once its input shapes are stable, and
+    replays the graph afterwards, so that the eager ops of models with graph
+    breaks skip their python, dispatch and launch costs.
+
+    A graph is kept per shapes, strides and dtypes of the tensor arguments
+    and the values of the others, captured after ``warmup`` eager calls of
+    those, DICP_REPLAY_WARMUP or 2 by default. Up to ``max_graphs`` graphs
+    are kept, other shapes run eagerly, as does everything if the vendor
+    can't capture streams or a capture fails.
+
+    Replays run neither python nor the guards of dynamo: the function must
+    do the same device work for the same argument shapes, which holds for
+    the inference step of most models. Call ``reset()`` of the wrapper after
+    changing what the function reads besides its arguments. The outputs are
+    the tensors of the graph, overwritten by the next call of the same
+    shapes, clone what must outlive it. Graphs share one memory pool and
+    can't run backward, calls with grad enabled run eagerly.
+
+    Example::
+
+        @replayed
+        def step(input_ids, attention_mask):
+            return compiled_model(input_ids, attention_mask).logits
+    """
+    if fn is None:
+        return functools.partial(replayed, warmup=warmup, max_graphs=max_graphs)
+    if warmup is None:
+        warmup = int(os.environ.get("DICP_REPLAY_WARMUP", "2"))
+
+    from torch_dipu.dipu import graphs, synchronize
+
+    if not graphs.is_graph_supported():
+        return fn
+
+    calls = collections.Counter()
+    captured = {}
+    # shapes whose capture failed
+    eager = set()
+    pool = []
+
+    def capture(flat_args, spec):
+        static_inputs = [arg.clone() if isinstance(arg, torch.Tensor) else None
+                         for arg in flat_args]
+        static_args, static_kwargs = tree_unflatten(
+            [arg if static is None else static
+             for static, arg in zip(static_inputs, flat_args)], spec)
+        graph = graphs.DIPUGraph()
+        if not pool:
+            pool.append(graphs.graph_pool_handle())
+        # the capture stream must not read the static inputs before the
+        # current stream wrote them
+        synchronize()
+        with graphs.graph(graph, pool=pool[0]):
+            static_outputs = fn(*static_args, **static_kwargs)
+        return _Graph(graph, static_inputs, static_outputs)
+
+    @functools.wraps(fn)
+    def wrapper(*args, **kwargs):
+        if torch.is_grad_enabled():
+            return fn(*args, **kwargs)
+        flat_args, spec = tree_flatten((args, kwargs))
+        key = _key(flat_args)
+        if key is None or key in eager:
+            return fn(*args, **kwargs)
+        entry = captured.get(key)
+        if entry is None:
+            calls[key] += 1
+            if calls[key] <= warmup or len(captured) >= max_graphs:
+                return fn(*args, **kwargs)
+            try:
+                entry = capture(flat_args, spec)
+            except Exception:
+                eager.add(key)
+                return fn(*args, **kwargs)
+            captured[key] = entry
+        for static, arg in zip(entry.static_inputs, flat_args):
+            if static is not None and static.data_ptr() != arg.data_ptr():
+                static.copy_(arg)
+        entry.graph.replay()
+        return entry.static_outputs
+
+    def reset():
+        for entry in captured.values():
+            entry.graph.reset()
+        captured.clear()
+        calls.clear()
+        eager.clear()
+
+    wrapper.reset = reset
+    return wrapper
@@ -0,0 +1,135 @@
+import operator
+
+import torch
+import torch.fx
+from torch.utils._pytree import tree_flatten
+
+
+class StreamSchedule(torch.nn.Module):
+    r"""Side streams of the device the compiled subgraphs of a partitioned
+    graph run on, see schedule_streams."""
+
+    def __init__(self, num_streams):
+        super().__init__()
+        self.num_streams = num_streams
+        self.streams = None
+
+    def _side_stream(self, index):
+        from torch_dipu import dipu
+        if self.streams is None:
+            # streams of the pool of the current device
+            self.streams = [dipu.Stream() for _ in range(self.num_streams)]
+        return self.streams[index]
+
+    def forward(self, index, fn, *args):
+        r"""Runs ``fn`` on side stream ``index`` after the work queued on the
+        current stream so far. Returns its outputs and the event of their
+        completion."""
+        from torch_dipu import dipu
+        current = dipu.current_stream()
+        stream = self._side_stream(index)
+        stream.wait_stream(current)
+        for arg in args:
+            if isinstance(arg, torch.Tensor):
+                # not reused by the allocator before the side stream is done
+                arg.record_stream(stream)
+        with dipu.stream(stream):
+            outputs = fn(*args)
+        return outputs, stream.record_event()
+
+
+def _join(outputs_and_event):
+    from torch_dipu import dipu
+    outputs, event = outputs_and_event
+    current = dipu.current_stream()
+    current.wait_event(event)
+    for tensor in tree_flatten(outputs)[0]:
+        if isinstance(tensor, torch.Tensor):
+            tensor.record_stream(current)
+    return outputs
+
+
+def _producers(node):
+    producers = set()
+    for arg in node.all_input_nodes:
+        # outputs of a subgraph are picked by getitem
+        while arg.op == 'call_function' and arg.target is operator.getitem:
+            arg = arg.args[0]
+        producers.add(arg)
+    return producers
+
+
+def schedule_streams(gm: torch.fx.GraphModule, num_streams):
+    r"""Runs the compiled subgraphs of ``gm``, its call_module nodes, that
+    don't depend on the one run before them on ``num_streams`` side streams,
+    each with the subgraphs depending on it only. The eager ops between
+    them stay on the current stream, which waits for a side stream just
+    before using what it computed."""
+    compiled = [node for node in gm.graph.nodes if node.op == 'call_module']
+    if num_streams <= 0 or len(compiled) < 2:
+        return gm
+
+    ancestors = {}
+    for node in gm.graph.nodes:
+        ancestors[node] = set()
+        for producer in _producers(node):
+            ancestors[node] |= ancestors[producer] | {producer}
+
+    # the side stream of a subgraph, None for the current stream
+    stream_of = {}
+    tail = {}
+    last = None
+    next_stream = 0
+    for node in compiled:
+        stream = None
+        chained = [p for p in _producers(node)
+                   if stream_of.get(p) is not None and tail[stream_of[p]] is p]
+        if chained:
+            stream = stream_of[chained[0]]
+        elif last is not None and last not in ancestors[node]:
+            stream = next_stream
+            next_stream = (next_stream + 1) % num_streams
+        stream_of[node] = stream
+        if stream is not None:
+            tail[stream] = node
+        last = node
+    if all(stream is None for stream in stream_of.values()):
+        return gm
+
+    gm.add_submodule("dicp_stream_schedule", StreamSchedule(num_streams))
+    graph = gm.graph
+    order = {node: i for i, node in enumerate(graph.nodes)}
+    for node, stream in stream_of.items():
+        if stream is None:
+            continue
+        with graph.inserting_before(node):
+            fn = graph.get_attr(node.target)
+            run = graph.call_module("dicp_stream_schedule", (stream, fn, *node.args))
+            outputs = graph.call_function(operator.getitem, (run, 0))
+        getitems = [user for user in node.users
+                    if user.op == 'call_function' and user.target is operator.getitem]
+        # the nodes reading the outputs, and the node they read them by
+        reads = [(user, outputs) for user in node.users if user not in getitems]
+        reads += [(user, getitem) for getitem in getitems for user in getitem.users]
+        node.replace_all_uses_with(outputs)
+        graph.erase_node(node)
+        # nodes on the same side stream read the outputs directly, others
+        # once the current stream waited for them, which orders later side
+        # streams after them too
+        elsewhere = [(user, value) for user, value in reads
+                     if stream_of.get(user) != stream]
+        if not elsewhere:
+            continue
+        first = min((user for user, _ in elsewhere), key=order.__getitem__)
+        with graph.inserting_before(first):
+            joined = graph.call_function(_join, (run,))
+        for user, value in elsewhere:
+            if value is outputs:
+                user.replace_input_with(outputs, joined)
+                continue
+            with graph.inserting_before(user):
+                picked = graph.call_function(operator.getitem, (joined, value.args[1]))
+            user.replace_input_with(value, picked)
+    graph.lint()
+    gm.recompile()
+    return gm
@@ -1,4 +1,7 @@
+import contextlib
 import copy
+import fcntl
+import json
 from pathlib import Path
 from typing import Any, Dict, Tuple, Union
 
@@ -7,6 +10,17 @@ from torch._inductor.codecache import code_hash
 from torch.fx.node import Argument, Target
 
 
+@contextlib.contextmanager
+def file_lock(path):
+    # a POSIX lock, which NFS servers honor too
+    with open(path, 'a') as f:
+        fcntl.lockf(f, fcntl.LOCK_EX)
+        try:
+            yield
+        finally:
+            fcntl.lockf(f, fcntl.LOCK_UN)
+
+
 def symint_in_shape(shape):
     for elem in shape:
         if isinstance(elem, torch.SymInt):
@@ -23,6 +37,37 @@ def save_cpu_gm(gm: torch.fx.GraphModule, folder: str):
     return cpu_gm, graph_key
 
 
+def node_sources(gm: torch.fx.GraphModule):
+    r"""The aten op, module and source line the nodes of a graph lowered
+    from, by node name, which is the name of the vendor op built from it."""
+    sources = {}
+    for node in gm.graph.nodes:
+        if node.op != 'call_function':
+            continue
+        meta = node.meta
+        source = {"target": str(meta.get('original_aten', node.target))}
+        module_stack = meta.get('nn_module_stack')
+        if module_stack:
+            # (qualified name, type) of the innermost module
+            module = list(module_stack.values())[-1]
+            source["module"] = module[0] if isinstance(module, tuple) else str(module)
+        stack_trace = meta.get('stack_trace')
+        if stack_trace:
+            # the innermost frame, "File ..., line ..., in ..." and its code
+            lines = [line.strip() for line in stack_trace.strip().splitlines()]
+            frames = [i for i, line in enumerate(lines) if line.startswith('File ')]
+            if frames:
+                source["source"] = ' '.join(lines[frames[-1]:frames[-1] + 2])
+        sources[node.name] = source
+    return sources
+
+
+def save_node_sources(gm: torch.fx.GraphModule, folder: str, graph_key: str):
+    path = Path(folder) / graph_key[:4] / f"{graph_key}.nodes.json"
+    path.parent.mkdir(parents=True, exist_ok=True)
+    path.write_text(json.dumps(node_sources(gm), indent=1))
+
+
 def copy_gm_to_cpu(gm: torch.fx.GraphModule):
     cpu_gm = copy.deepcopy(gm).cpu()
     return DeviceParamToCpu(cpu_gm).transform()
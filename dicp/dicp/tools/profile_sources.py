@@ -0,0 +1,102 @@
+r"""Attributes the time of the ops of a vendor profile to the model code the
+dicp compiled graphs lowered them from.
+
+Compiling a graph saves the aten op, module and source line of its nodes in
+``<cache dir>/<key[:4]>/<key>.nodes.json``. The ops GE builds carry the node
+names, fused ops the names of the nodes they fused, which this matches the op
+names of a per-op profile against, e.g. the op_summary csv of msprof.
+
+Usage:
+    python -m dicp.tools.profile_sources op_summary.csv --top 30
+    python -m dicp.tools.profile_sources op_summary.csv --graph-key ab12 \
+        --output op_summary_sources.csv
+"""
+import argparse
+import collections
+import csv
+import json
+import re
+from pathlib import Path
+
+
+def load_node_sources(cache_dir, graph_key=""):
+    r"""The sources of the nodes of all graphs compiled into ``cache_dir``,
+    or of those whose key starts with ``graph_key``. Nodes of the same name
+    from different sources keep all of them."""
+    sources = collections.defaultdict(list)
+    for path in sorted(Path(cache_dir).glob(f"*/{graph_key}*.nodes.json")):
+        for name, source in json.loads(path.read_text()).items():
+            if source not in sources[name]:
+                sources[name].append(source)
+    return sources
+
+
+def describe(sources):
+    return " | ".join(source.get("source") or source.get("module") or
+                      source["target"] for source in sources)
+
+
+class OpMatcher:
+    def __init__(self, sources):
+        self.sources = sources
+        # the longest node name wins, "add_10" before "add_1"
+        self.names = sorted(sources, key=len, reverse=True)
+        self.cache = {}
+
+    def match(self, op_name):
+        if op_name not in self.cache:
+            self.cache[op_name] = self._match(op_name)
+        return self.cache[op_name]
+
+    def _match(self, op_name):
+        if op_name in self.sources:
+            return op_name
+        for name in self.names:
+            if re.search(rf"(?<![A-Za-z0-9]){re.escape(name)}(?![A-Za-z0-9])",
+                         op_name):
+                return name
+        return None
+
+
+def main():
+    from torch._inductor.codecache import cache_dir
+
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("profile", help="csv of the ops of a vendor profile")
+    parser.add_argument("--cache-dir", default=cache_dir())
+    parser.add_argument("--graph-key", default="",
+                        help="prefix of the keys of the graphs to match")
+    parser.add_argument("--name-column", default="Op Name")
+    parser.add_argument("--time-column", default="Task Duration(us)")
+    parser.add_argument("--output", help="the profile with a source column")
+    parser.add_argument("--top", type=int, default=20)
+    args = parser.parse_args()
+
+    matcher = OpMatcher(load_node_sources(args.cache_dir, args.graph_key))
+    with open(args.profile, newline="") as f:
+        rows = list(csv.DictReader(f))
+
+    totals = collections.Counter()
+    for row in rows:
+        name = matcher.match(row[args.name_column].strip())
+        row["dicp_node"] = name or ""
+        row["dicp_source"] = describe(matcher.sources[name]) if name else ""
+        try:
+            time = float(row[args.time_column])
+        except (KeyError, ValueError):
+            continue
+        totals[row["dicp_source"] or "<unmatched>"] += time
+
+    if args.output and rows:
+        with open(args.output, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(rows[0]))
+            writer.writeheader()
+            writer.writerows(rows)
+
+    total = sum(totals.values()) or 1
+    for source, time in totals.most_common(args.top):
+        print(f"{time:12.1f} {100 * time / total:5.1f}%  {source}")
+
+
+if __name__ == "__main__":
+    main()
@@ -24,7 +24,8 @@ compiled_model = compile_model(model, args.backend, args.dynamic)
 class TestAddmm():
     @pytest.mark.parametrize("dtype", [torch.float32])
     @pytest.mark.parametrize("sizes", [Size(((5, 3), (5, 2), (2, 3)), ((5, 3), (5, 2), (2, 3))),
-                                       Size(((2, 4), (2, 5), (5, 4)), ((2, 4), (2, 5), (5, 4)))])
+                                       Size(((2, 4), (2, 5), (5, 4)), ((2, 4), (2, 5), (5, 4))),
+                                       Size(((4,), (2, 5), (5, 4)), ((4,), (2, 5), (5, 4)))])
     @pytest.mark.parametrize("compiled_model", compiled_model)
     def test_torch_addmm(self, sizes, dtype, compiled_model):
         device = get_device()
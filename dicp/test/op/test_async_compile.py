@@ -0,0 +1,21 @@
+import threading
+from unittest import mock
+
+from torch_dipu import dipu
+from dicp.dynamo_bridge.compile_fx import submit_compile
+
+
+class TestAsyncCompile():
+    def test_compile_on_caller_device(self):
+        calls = []
+
+        def compile_fn():
+            # the model is loaded here, on a pool thread
+            return threading.current_thread(), calls[:]
+
+        with mock.patch.object(dipu, "current_device", return_value=1), \
+                mock.patch.object(dipu, "set_device",
+                                  side_effect=calls.append):
+            thread, devices = submit_compile(compile_fn).result()
+        assert thread is not threading.current_thread()
+        assert devices == [1]
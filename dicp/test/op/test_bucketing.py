@@ -0,0 +1,57 @@
+from unittest import mock
+
+import torch
+
+from dicp.vendor.AscendGraph.bucketing import bucketed, default_buckets, pick_bucket
+
+
+class TestBucketing():
+    def test_pick_bucket(self):
+        assert pick_bucket(100, [128, 256]) == 128
+        assert pick_bucket(128, [128, 256]) == 128
+        # past the largest bucket the size runs unpadded
+        assert pick_bucket(300, [128, 256]) == 300
+
+    def test_default_buckets(self):
+        with mock.patch.dict("os.environ", {"DICP_ASCEND_SHAPE_BUCKETS": "256, 128"}):
+            assert default_buckets() == [128, 256]
+        with mock.patch.dict("os.environ", {"DICP_ASCEND_SHAPE_BUCKETS": ""}):
+            assert default_buckets() == []
+
+    def test_pad_and_narrow(self):
+        seen = []
+
+        @bucketed({0: 1, 1: 1}, {0: 1}, buckets=[8, 16], pad_values={1: -1})
+        def step(input_ids, mask):
+            seen.append((input_ids.clone(), mask.clone()))
+            return input_ids * 2, mask.sum()
+
+        input_ids = torch.arange(10).view(2, 5)
+        mask = torch.ones(2, 5)
+        out, mask_sum = step(input_ids, mask)
+        padded_ids, padded_mask = seen[-1]
+        # the fn sees the bucket size, padded with the value of each argument
+        assert padded_ids.shape == (2, 8) and padded_mask.shape == (2, 8)
+        assert torch.equal(padded_ids[:, 5:], torch.zeros(2, 3, dtype=torch.long))
+        assert torch.equal(padded_mask[:, 5:], torch.full((2, 3), -1.0))
+        # only the outputs named in output_dims are narrowed back
+        assert torch.equal(out, input_ids * 2)
+        assert mask_sum.item() == 10 - 6
+
+        # sizes matching a bucket, or past the largest one, are not padded
+        step(torch.zeros(1, 16), torch.zeros(1, 16))
+        assert seen[-1][0].shape == (1, 16)
+        step(torch.zeros(1, 20), torch.zeros(1, 20))
+        assert seen[-1][0].shape == (1, 20)
+
+    def test_mismatched_dims(self):
+        @bucketed({0: 0, 1: 0}, buckets=[8])
+        def step(a, b):
+            return a + b
+
+        try:
+            step(torch.zeros(3), torch.zeros(4))
+        except AssertionError as e:
+            assert "differ in size" in str(e)
+        else:
+            assert False, "bucketed dims of different sizes should fail"
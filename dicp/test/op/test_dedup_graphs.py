@@ -0,0 +1,68 @@
+from unittest import mock
+
+from torch.fx.experimental.proxy_tensor import make_fx
+from dicp.dynamo_bridge import compile_fx
+from dicp.dynamo_bridge.dedup import structural_key
+from dicp.dynamo_bridge.graph import GraphTransformer
+from ..common.utils import (
+    torch,
+    parse_args,
+    get_device,
+)
+
+args = parse_args()
+
+
+def layer(w1, w2):
+    # a decoder-like layer, its weights are large enough to be bound to the
+    # compiled graph as inputs rather than embedded
+    def forward(x):
+        h = torch.ops.aten.mm.default(x, w1)
+        h = torch.ops.aten.relu.default(h)
+        out = torch.ops.aten.mm.default(h, w2)
+        return (torch.ops.aten.add.Tensor(out, x),)
+    return forward
+
+
+class TestDedupGraphs():
+    def test_dedup_graphs(self):
+        device = get_device()
+        x = torch.randn(8, 128)
+        layers = [layer(torch.randn(128, 256), torch.randn(256, 128))
+                  for _ in range(2)]
+        graphs = [make_fx(forward)(x) for forward in layers]
+
+        original = GraphTransformer.compile_to_fn
+        with mock.patch.object(GraphTransformer, "compile_to_fn",
+                               autospec=True, side_effect=original) as compile:
+            compiled = [compile_fx.compile_fx_inner(gm, [x], backend=args.backend)
+                        for gm in graphs]
+
+        config = compile_fx.get_backend_config(args.backend)
+        sharing = getattr(config, "is_bound_constant", None) is not None and \
+            getattr(config, "share_graphs", True)
+        assert compile.call_count == (1 if sharing else 2)
+        # each layer runs with its own weights, in the order it binds them
+        for forward, fn in zip(layers, compiled):
+            (output,) = forward(x)
+            (dicp_output,) = fn([x.to(device)])
+            assert torch.allclose(output, dicp_output.cpu(), rtol=1e-03,
+                                  atol=1e-03, equal_nan=True)
+
+    def test_tensor_args_keyed_by_value(self):
+        def graph(other):
+            graph = torch.fx.Graph()
+            x = graph.placeholder("x")
+            x.meta["val"] = torch.empty(2000)
+            # a large tensor, whose repr elides most of its values
+            out = graph.call_function(torch.ops.aten.add.Tensor, (x, other))
+            graph.output((out,))
+            return torch.fx.GraphModule(torch.nn.Module(), graph)
+
+        other = torch.zeros(2000)
+        changed = other.clone()
+        changed[1000] = 1
+        keys = [structural_key(graph(t), args.backend, None, None)[0]
+                for t in (other, other.clone(), changed)]
+        assert keys[0] == keys[1]
+        assert keys[0] != keys[2]
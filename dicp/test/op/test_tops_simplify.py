@@ -0,0 +1,117 @@
+import torch
+import torch.fx
+
+from dicp.vendor.TopsGraph import tops_op
+from dicp.vendor.TopsGraph.opset_transform import SimplifyPass
+
+
+class GraphBuilder():
+    def __init__(self):
+        self.graph = torch.fx.Graph()
+
+    def input(self, shape, dtype=torch.float32):
+        node = self.graph.placeholder(f"x{len(self.graph.nodes)}")
+        node.meta["val"] = torch.empty(shape, dtype=dtype)
+        return node
+
+    def op(self, cls, *args, val=None):
+        node = self.graph.call_function(cls.get_singleton(), args)
+        node.meta["val"] = val
+        return node
+
+    def simplify(self, *outputs):
+        self.graph.output(outputs)
+        gm = torch.fx.GraphModule(torch.nn.Module(), self.graph)
+        return SimplifyPass().transform(gm)
+
+
+def ops(gm, cls):
+    return [node for node in gm.graph.nodes
+            if node.op == "call_function" and isinstance(node.target, cls)]
+
+
+class TestTopsSimplify():
+    def test_transpose_pair(self):
+        b = GraphBuilder()
+        x = b.input((2, 3, 4))
+        t = b.op(tops_op.Transpose, x, (1, 2, 0), val=torch.empty(3, 4, 2))
+        t = b.op(tops_op.Transpose, t, (2, 0, 1), val=torch.empty(2, 3, 4))
+        out = b.op(tops_op.Abs, t, val=torch.empty(2, 3, 4))
+        gm = b.simplify(out)
+        assert not ops(gm, tops_op.Transpose)
+        assert out.args[0] is x
+
+    def test_transpose1_chain(self):
+        b = GraphBuilder()
+        x = b.input((2, 3, 4))
+        t = b.op(tops_op.Transpose1, x, 0, 1, val=torch.empty(3, 2, 4))
+        t = b.op(tops_op.Transpose1, t, 1, 2, val=torch.empty(3, 4, 2))
+        t = b.op(tops_op.Transpose1, t, 0, -1, val=torch.empty(2, 4, 3))
+        out = b.op(tops_op.Abs, t, val=torch.empty(2, 4, 3))
+        gm = b.simplify(out)
+        # one permute of the input, doing what the chain did
+        (transpose,) = ops(gm, (tops_op.Transpose, tops_op.Transpose1))
+        assert transpose.args[0] is x and out.args[0] is transpose
+        values = torch.arange(24).reshape(2, 3, 4)
+        expected = values.transpose(0, 1).transpose(1, 2).transpose(0, -1)
+        assert torch.equal(values.permute(transpose.args[1]), expected)
+
+    def test_identity_transpose1(self):
+        b = GraphBuilder()
+        x = b.input((2, 3))
+        t = b.op(tops_op.Transpose1, x, 1, -1, val=torch.empty(2, 3))
+        out = b.op(tops_op.Abs, t, val=torch.empty(2, 3))
+        gm = b.simplify(out)
+        assert not ops(gm, tops_op.Transpose1)
+        assert out.args[0] is x
+
+    def test_lossy_cast_pair_kept(self):
+        b = GraphBuilder()
+        x = b.input((4,))
+        half = b.op(tops_op.Convert, x, torch.float16,
+                    val=torch.empty(4, dtype=torch.float16))
+        back = b.op(tops_op.Convert, half, torch.float32, val=torch.empty(4))
+        out = b.op(tops_op.Abs, back, val=torch.empty(4))
+        gm = b.simplify(out)
+        # fp32 -> fp16 -> fp32 rounds, it is not the input
+        assert len(ops(gm, tops_op.Convert)) == 2
+        assert out.args[0] is back and back.args[0] is half
+
+    def test_lossless_cast_pair_dropped(self):
+        b = GraphBuilder()
+        x = b.input((4,), torch.float16)
+        wide = b.op(tops_op.Convert, x, torch.float32, val=torch.empty(4))
+        back = b.op(tops_op.Convert, wide, torch.float16,
+                    val=torch.empty(4, dtype=torch.float16))
+        out = b.op(tops_op.Abs, back, val=torch.empty(4, dtype=torch.float16))
+        gm = b.simplify(out)
+        assert not ops(gm, tops_op.Convert)
+        assert out.args[0] is x
+
+    def test_noop_slice_and_expand(self):
+        b = GraphBuilder()
+        x = b.input((2, 3))
+        whole = b.op(tops_op.SliceInDim, x, 0, 0, 2, 1, val=torch.empty(2, 3))
+        expand = b.op(tops_op.Expand, whole, [2, 3], val=torch.empty(2, 3))
+        part = b.op(tops_op.SliceInDim, expand, 0, 0, 1, 1,
+                    val=torch.empty(1, 3))
+        out = b.op(tops_op.Abs, part, val=torch.empty(1, 3))
+        gm = b.simplify(out)
+        assert not ops(gm, tops_op.Expand)
+        # the slice taking a row is kept, the one taking all is not
+        assert ops(gm, tops_op.SliceInDim) == [part]
+        assert part.args[0] is x
+
+    def test_impure_ops_survive_dce(self):
+        b = GraphBuilder()
+        x = b.input((4,))
+        y = b.input((4,))
+        dropout = b.op(tops_op.NativeDropout, x, 0.5, True,
+                       val=torch.empty(4))
+        copy = b.op(tops_op.Copy_, y, x, val=torch.empty(4))
+        unused = b.op(tops_op.Abs, x, val=torch.empty(4))
+        out = b.op(tops_op.Abs, y, val=torch.empty(4))
+        gm = b.simplify(out)
+        assert ops(gm, tops_op.NativeDropout) == [dropout]
+        assert ops(gm, tops_op.Copy_) == [copy]
+        assert unused not in gm.graph.nodes
@@ -0,0 +1,54 @@
+import pytest
+
+from dicp.vendor.AscendGraph import ext_ops
+from ..common.utils import (
+    torch,
+    dynamo,
+    parse_args,
+    compile_model,
+    get_device,
+    Size,
+    update_dynamo_config,
+)
+
+
+class OpModule(torch.nn.Module):
+    def forward(self, q, k, v, cu_seqlens, max_seqlen, causal):
+        res = torch.ops.dipu.varlen_attention.default(
+            q, k, v, cu_seqlens, cu_seqlens, max_seqlen, max_seqlen, None,
+            causal)
+        return res
+
+
+model = OpModule()
+args = parse_args()
+compiled_model = compile_model(model, args.backend, args.dynamic)
+
+
+class TestVarlenAttention():
+    @pytest.mark.parametrize("dtype", [torch.float16])
+    @pytest.mark.parametrize("sizes", [Size(((16, 4, 64), (16, 2, 64)), ((16, 4, 64), (16, 2, 64))), Size(((32, 8, 128), (32, 8, 128)), ((32, 8, 128), (32, 8, 128)))])
+    @pytest.mark.parametrize("causal", [False, True])
+    @pytest.mark.parametrize("compiled_model", compiled_model)
+    def test_varlen_attention(self, sizes, dtype, causal, compiled_model):
+        device = get_device()
+        size = sizes.dynamic if compiled_model.dynamic else sizes.static
+        tokens = size[0][0]
+        # three sequences of different lengths packed back to back
+        cu_seqlens = torch.tensor([0, 3, tokens // 2, tokens], dtype=torch.int32)
+        max_seqlen = int((cu_seqlens[1:] - cu_seqlens[:-1]).max())
+        q = torch.randn(size[0], dtype=dtype)
+        k = torch.randn(size[1], dtype=dtype)
+        v = torch.randn(size[1], dtype=dtype)
+
+        dicp_q = q.to(device)
+        dicp_k = k.to(device)
+        dicp_v = v.to(device)
+        dicp_cu_seqlens = cu_seqlens.to(device)
+
+        output = model(q, k, v, cu_seqlens, max_seqlen, causal)
+        dynamo.reset()
+        update_dynamo_config(compiled_model.dynamic)
+        dicp_output = compiled_model.model(dicp_q, dicp_k, dicp_v, dicp_cu_seqlens, max_seqlen, causal)
+
+        assert torch.allclose(output, dicp_output.cpu(), rtol=1e-02, atol=1e-02, equal_nan=True)
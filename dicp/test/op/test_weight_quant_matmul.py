@@ -0,0 +1,53 @@
+import pytest
+
+from dicp.vendor.AscendGraph import ext_ops
+from ..common.utils import (
+    torch,
+    dynamo,
+    parse_args,
+    compile_model,
+    get_device,
+    Size,
+    update_dynamo_config,
+)
+
+
+class OpModule(torch.nn.Module):
+    def forward(self, x, weight, scale, offset, group_size):
+        res = torch.ops.dipu.weight_quant_matmul.default(
+            x, weight, scale, offset, None, group_size, 8)
+        return res
+
+
+model = OpModule()
+args = parse_args()
+compiled_model = compile_model(model, args.backend, args.dynamic)
+
+
+class TestWeightQuantMatmul():
+    @pytest.mark.parametrize("dtype", [torch.float16])
+    @pytest.mark.parametrize("sizes", [Size(((4, 128), (256, 128)), ((4, 128), (256, 128))), Size(((2, 8, 256), (64, 256)), ((2, 8, 256), (64, 256)))])
+    @pytest.mark.parametrize("group_size", [0, 64])
+    @pytest.mark.parametrize("compiled_model", compiled_model)
+    def test_weight_quant_matmul(self, sizes, dtype, group_size, compiled_model):
+        device = get_device()
+        size = sizes.dynamic if compiled_model.dynamic else sizes.static
+        n, k = size[1]
+        groups = k // group_size if group_size > 0 else 1
+        params_size = (n, groups) if group_size > 0 else (n,)
+        input1 = torch.randn(size[0], dtype=dtype)
+        weight = torch.randint(-128, 128, size[1], dtype=torch.int8)
+        scale = (torch.rand(params_size) / 64).to(dtype)
+        offset = torch.randint(-4, 4, params_size).to(dtype)
+
+        dicp_input1 = input1.to(device)
+        dicp_weight = weight.to(device)
+        dicp_scale = scale.to(device)
+        dicp_offset = offset.to(device)
+
+        output = model(input1, weight, scale, offset, group_size)
+        dynamo.reset()
+        update_dynamo_config(compiled_model.dynamic)
+        dicp_output = compiled_model.model(dicp_input1, dicp_weight, dicp_scale, dicp_offset, group_size)
+
+        assert torch.allclose(output, dicp_output.cpu(), rtol=1e-02, atol=1e-02, equal_nan=True)
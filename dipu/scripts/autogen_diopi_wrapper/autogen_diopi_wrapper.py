@@ -8,12 +8,15 @@ from typing import Mapping, Match, Optional, Sequence
 from diopi_wrapper_template import (
     diopi_wrapper_file_template_content,
     diopi_wrapper_function_template_content,
+    diopi_wrapper_async_function_template_content,
     op_no_customfallback_with_autocompare_register_template_content,
     op_no_customfallback_no_autocompare_register_template_content,
     custom_autograd_template_content,
     autocompare_template_content,
     op_with_customfallback_with_autocompare_register_template_content,
     op_with_customfallback_no_autocompare_register_template_content,
+    library_def_template_content,
+    library_register_template_content,
 )
 
 
@@ -83,15 +86,21 @@ def get_fun_name_from_cppsignature(cppnature):
 
 def get_op_name_from_schema(schema):
     op_name = schema[0 : schema.find("(")]
-    op_name = re.sub("aten::", "", op_name)
+    # aten:: or the library of an extension, see --library
+    op_name = re.sub(r"^\s*\w+::", "", op_name)
     return op_name
 
 
+def get_namespace_from_schema(schema, default):
+    namespace = re.match(r"\s*(\w+)::", schema)
+    return namespace.group(1) if namespace else default
+
+
 def create_fun_name_from_schema(schema):
     schema = schema.strip()
     op_name = schema[0 : schema.find("(")]
     op_name = op_name.replace(".", "_")
-    op_name = "dipu_" + re.sub("aten::", "", op_name)
+    op_name = "dipu_" + re.sub(r"^\w+::", "", op_name)
     op_name = op_name.lower()
     return op_name
 
@@ -349,7 +358,7 @@ def get_function_return_param_from_schema(schema):
 
 
 def create_call_diop_interface_code_from_schema(schema):
-    schema = schema.replace("aten::", "").strip()
+    schema = re.sub(r"^\s*\w+::", "", schema).strip()
     schema = schema.replace("_.", "Inp")
     schema = schema.replace(".", "")
 
@@ -566,6 +575,53 @@ def create_result_compare_code(fun_config):
     return code
 
 
+def create_sampled_compare_code(fun_config, cpu_code):
+    # The CPU reference runs on a background thread after the wrapper returned,
+    # so it captures the CPU copies of the tensors and owning copies of the
+    # other arguments it uses.
+    schema = fun_config["schema"]
+    op_name = get_op_name_from_schema(schema)
+    captures = []
+    for arg in create_args_name_list_from_schema(schema).split(", "):
+        if re.search(R"\b" + arg + R"_cpu\b", cpu_code) is not None:
+            captures.append(f"{arg}_cpu")
+        elif re.search(R"\b" + arg + R"\b", cpu_code) is not None:
+            captures.append(f"{arg} = ::dipu::native::autocompare::own({arg})")
+
+    code = ""
+    compare_code = ""
+    return_names = get_function_return_param_from_schema(schema)
+    return_num = len(return_names)
+    if return_num > 0:
+        code += "auto result_device_cpu = ::dipu::native::autocompare::snapshot(result_device);\n"
+        captures.append("result_device_cpu = std::move(result_device_cpu)")
+    if return_num == 1:
+        compare_code += f'report.compare("{op_name}", "{return_names[0]}", result_cpu, result_device_cpu);\n'
+    elif return_num > 1:
+        for i in range(return_num):
+            compare_code += f'report.compare("{op_name}", "{return_names[i]}", std::get<{i}>(result_cpu), std::get<{i}>(result_device_cpu));\n'
+
+    inputs = re.findall("Tensor +([\w\d_]+)", schema[: schema.find("->")])
+    inputs += re.findall(
+        "Tensor *\([a-z]!\) *\[ *\] +([\w\d_]+)", schema[: schema.find("->")]
+    )
+    for input in inputs:
+        code += f"auto {input}_device_cpu = ::dipu::native::autocompare::snapshot({input});\n"
+        captures.append(f"{input}_device_cpu = std::move({input}_device_cpu)")
+        if f"{input}_cpu" not in captures:
+            captures.append(f"{input}_cpu")
+        compare_code += f'report.compare("{op_name}", "{input}", {input}_cpu, {input}_device_cpu);\n'
+
+    code += (
+        "sampler.enqueue([" + ", ".join(captures) + "]"
+        "(::dipu::native::autocompare::Report& report) mutable {\n"
+    )
+    code += cpu_code + "\n" + compare_code + "});\n"
+    if return_num > 0:
+        code += "return result_device;\n"
+    return code
+
+
 def create_code_to_print_fun_call_info_from_schema(fun_config):
     op_name = get_op_name_from_schema(fun_config["schema"])
     diopi_func = fun_config.get("interface", "")
@@ -581,13 +637,11 @@ def create_code_to_print_fun_call_info_from_schema(fun_config):
 def create_int_array_process_code(int_array_list):
     if len(int_array_list) <= 0:
         return ""
-    code = (
-        R"auto symIntToInt = [](const c10::SymInt& t)-> int64_t {return t.expect_int();};"
-        + "\n"
-    )
+    # `{name}Vector` views the ints of the SymInt array in place, no copy is
+    # made; custom code in diopi_functions.yaml refers to it by this name.
+    code = ""
     for int_array in int_array_list:
-        code += f"std::vector<int64_t> {int_array}Vector({int_array}.size());\n"
-        code += f"std::transform({int_array}.cbegin(), {int_array}.cend(), {int_array}Vector.begin(), symIntToInt);\n"
+        code += f"const at::IntArrayRef {int_array}Vector = dipu::diopi_helper::asIntArrayRef({int_array});\n"
         code += f"::diopiSize_t {int_array}DiopiSize{{{int_array}Vector.data(), static_cast<int64_t>({int_array}Vector.size())}};\n"
     return code
 
@@ -661,7 +715,44 @@ def create_device_check_code(fun_config):
     return code
 
 
-def create_optional_generator_process_code(arg_name):
+def check_async_launch_config(fun_config, custom_code_at_the_beginning):
+    # the launch copies the arguments, array refs would dangle, and code
+    # around the call can't see its results
+    schema = fun_config["schema"]
+    unsupported = {
+        "autograd": fun_config.get("autograd", False) == True,
+        "dummy_call_diopi": fun_config.get("dummy_call_diopi", False)
+        in [True, "True"],
+        "custom_code_before_call_diopi": "custom_code_before_call_diopi"
+        in fun_config,
+        "custom_code_before_return": "custom_code_before_return" in fun_config,
+        "size_attr": len(fun_config.get("size_attr", [])) > 0,
+        "int[] arguments": len(get_function_int_array_args_from_schema(schema)) > 0,
+        "Generator arguments": len(
+            get_function_optional_generator_args_from_schema(schema)
+        )
+        > 0,
+        "ctx in custom code": re.search(r"\bctx\b", custom_code_at_the_beginning)
+        is not None,
+    }
+    for reason, found in unsupported.items():
+        if found:
+            raise ValueError(f"async_launch of {schema} does not support {reason}")
+
+
+def create_optional_generator_process_code(arg_name, philox_increment=None):
+    if philox_increment is not None:
+        # the kernel draws at a Philox offset reserved for it alone
+        process_template = CodeTemplate(
+            """
+::dipu::PhiloxCallGenerator ${arg_name}Philox((${arg_name}.has_value() && ${arg_name}.value().defined()) ? ${arg_name}.value() : getDefaultDIPUGenerator(), ${philox_increment});
+::diopiGeneratorHandle_t ${arg_name}DiopiGenerator = toDiopiGeneratorHandle(${arg_name}Philox.get());
+"""
+        )
+        return process_template.substitute(
+            arg_name=[arg_name],
+            philox_increment=[philox_increment],
+        )
     process_template = CodeTemplate(
         """
 ::diopiGeneratorHandle_t ${arg_name}DiopiGenerator = (${arg_name}.has_value() && ${arg_name}.value().defined()) ? toDiopiGeneratorHandle(${arg_name}) : toDiopiGeneratorHandle(getDefaultDIPUGenerator());
@@ -675,8 +766,14 @@ def create_optional_generator_process_code(arg_name):
 
 file_template = CodeTemplate(diopi_wrapper_file_template_content)
 
+library_def_code_template = CodeTemplate(library_def_template_content)
+
+library_register_code_template = CodeTemplate(library_register_template_content)
+
 fun_template = CodeTemplate(diopi_wrapper_function_template_content)
 
+async_fun_template = CodeTemplate(diopi_wrapper_async_function_template_content)
+
 op_no_customfallback_with_autocompare_register_template = CodeTemplate(
     op_no_customfallback_with_autocompare_register_template_content
 )
@@ -777,7 +874,9 @@ def functions_code_gen(fun_config):
     for generator_param in get_function_optional_generator_args_from_schema(
         fun_config["schema"]
     ):
-        attrs_process_code += create_optional_generator_process_code(generator_param)
+        attrs_process_code += create_optional_generator_process_code(
+            generator_param, fun_config.get("philox_increment", None)
+        )
         diopi_fun_call_code = re.sub(
             "([,\(] *&? *)" + generator_param.strip() + "( *[,\)])",
             R"\1" + f"{generator_param}DiopiGenerator" + R"\2",
@@ -800,9 +899,18 @@ def functions_code_gen(fun_config):
         )
 
     if fun_config.get("print_op_args", False) == True:
-        fun_config["custom_code_before_call_diopi"] = fun_config.get(
-            "custom_code_before_call_diopi", ""
-        ) + create_print_op_args_code(fun_config)
+        # queued launches have no code before the call, their args are
+        # dumped before queueing them
+        print_code_key = (
+            "custom_code_at_the_beginning"
+            if fun_config.get("async_launch", False) == True
+            else "custom_code_before_call_diopi"
+        )
+        fun_config[print_code_key] = (
+            fun_config.get(print_code_key, "")
+            + "\n"
+            + create_print_op_args_code(fun_config)
+        )
 
     if fun_config.get("use_diopi_adapter", False) == True:
         diopi_fun_call_code = "diopiadaptor::" + diopi_fun_call_code
@@ -835,7 +943,11 @@ def functions_code_gen(fun_config):
     custom_code_at_the_beginning = re.sub(";\s*$", ";\n", custom_code_at_the_beginning)
 
     interface_name = re.sub(R".*::(.*?)\(.*", R"\1", diopi_fun_call_code)
-    fbody = fun_template.substitute(
+    template = fun_template
+    if fun_config.get("async_launch", False) == True:
+        check_async_launch_config(fun_config, custom_code_at_the_beginning)
+        template = async_fun_template
+    fbody = template.substitute(
         comment=[fun_config["schema"]],
         cppsignautre=[create_cpp_signature_from_schema(fun_config["schema"])],
         custom_code_at_the_beginning=[custom_code_at_the_beginning],
@@ -852,6 +964,7 @@ def functions_code_gen(fun_config):
         ],
         return_code=[return_code],
         interface_name=[interface_name],
+        op_name=[get_op_name_from_schema(fun_config["schema"])],
     )
     diopi_interface = fun_config.get(
         "interface", create_call_diop_interface_code_from_schema(fun_config["schema"])
@@ -926,6 +1039,12 @@ def functions_code_gen(fun_config):
         "register_op", True
     ) in [True, "True"]:
         auto_compare_fun_name = fun_name + "_autocompare"
+        execute_op_on_cpu_code = create_call_aten_cpu_cpp_function_code_from_config(
+            fun_config
+        )
+        execute_op_on_device_code = create_call_dipu_cpp_function_code_from_schema(
+            fun_config["schema"]
+        ).replace(raw_fun_name, fun_name)
         autocompare_code = autocompare_template.substitute(
             cppsignautre=[
                 create_cpp_signature_from_schema(fun_config["schema"]).replace(
@@ -935,15 +1054,18 @@ def functions_code_gen(fun_config):
             transform_input_to_cpu_code=[
                 create_transform_input_to_cpu_code(fun_config)
             ],
-            execute_op_on_cpu_code=[
-                create_call_aten_cpu_cpp_function_code_from_config(fun_config)
-            ],
+            execute_op_on_cpu_code=[execute_op_on_cpu_code],
             comment=[fun_config["schema"]],
-            execute_op_on_device_code=[
-                create_call_dipu_cpp_function_code_from_schema(
+            op_name=[get_op_name_from_schema(fun_config["schema"])],
+            call_device_op_code=[
+                create_call_cpp_function_code_from_schema(
                     fun_config["schema"]
                 ).replace(raw_fun_name, fun_name)
             ],
+            execute_op_on_device_code=[execute_op_on_device_code],
+            sampled_compare_code=[
+                create_sampled_compare_code(fun_config, execute_op_on_cpu_code)
+            ],
             transform_result_to_cpu_code=[],
             result_compare_code=[
                 create_result_compare_code(fun_config)
@@ -1041,6 +1163,49 @@ def functions_code_gen(fun_config):
     return fbody, register_body
 
 
+def load_op_allowlist(path):
+    r"""Op names, e.g. ``add.out`` or ``add`` for all its overloads, from a file
+    with one per line (``#`` starts a comment) or from the csv written by
+    op_capture.py, whose fallback entries are kept too."""
+    with open(path) as allowlist_file:
+        lines = allowlist_file.read().splitlines()
+    if lines and lines[0].split(",")[0].strip() == "aten_name":
+        lines = [line.split(",")[0] for line in lines[1:]]
+    allowlist = set()
+    for line in lines:
+        name = line.split("#")[0].strip()
+        if name:
+            allowlist.add(re.sub("aten::", "", name))
+    return allowlist
+
+
+def filter_by_op_allowlist(merged_fun_configs, allowlist):
+    # Wrappers may call other wrappers in their custom code, which are kept too.
+    def in_allowlist(fun_config):
+        op_name = get_op_name_from_schema(fun_config["schema"])
+        return op_name in allowlist or op_name.split(".")[0] in allowlist
+
+    def code_of(fun_config):
+        return "\n".join(
+            value
+            for key, value in fun_config.items()
+            if key != "schema" and isinstance(value, str)
+        )
+
+    fun_names = [
+        create_fun_name_from_schema(config["schema"]) for _, config in merged_fun_configs
+    ]
+    kept = [in_allowlist(config) for _, config in merged_fun_configs]
+    pending = [i for i, keep in enumerate(kept) if keep]
+    while pending:
+        code = code_of(merged_fun_configs[pending.pop()][1])
+        for i, fun_name in enumerate(fun_names):
+            if not kept[i] and re.search(rf"\b{fun_name}(_wrapper)?\(", code):
+                kept[i] = True
+                pending.append(i)
+    return [item for item, keep in zip(merged_fun_configs, kept) if keep]
+
+
 def boolean_string(s):
     if s.lower() in ["true", "on"]:
         return True
@@ -1109,6 +1274,28 @@ def parse_args():
         default=dict(),
         help="fun config for all ops",
     )  # --fun_config_dict '{"register_op": "False", "dummy_call_diopi":"True"}'
+    parser.add_argument(
+        "--op_allowlist",
+        type=str,
+        default="",
+        help="path to the ops to generate, one per line or the csv of op_capture.py, "
+        "all ops if empty",
+    )
+    parser.add_argument(
+        "--library",
+        type=str,
+        default="aten",
+        help="namespace of the ops whose schema has none, ops of other namespaces "
+        "than aten are defined from their schema, e.g. for extensions",
+    )
+    parser.add_argument(
+        "--include",
+        type=str,
+        action="append",
+        default=[],
+        help="header to include in the generated code, e.g. the one declaring the "
+        "diopi functions of an extension, may be repeated",
+    )
 
     args = parser.parse_args()
     return args
@@ -1126,7 +1313,6 @@ def main():
     memory_format_converter = OpMemoryFormatConverter(args.convert_config)
 
     functions_code = ""
-    op_register_code = ""
     header_include_code = ""
 
     if args.use_diopi_adapter == True:
@@ -1138,8 +1324,10 @@ def main():
                 f'#include "{os.path.abspath(args.diopi_adapter_header)}"'
             )
 
-    autograd_op_register_code = ""
+    for header in args.include:
+        header_include_code += f'#include "{os.path.abspath(header)}"\n'
 
+    merged_fun_configs = []
     for fun_config in funcs_config:
         merged_fun_config = dict(args.fun_config_dict)
         merged_fun_config.update(vars(args))
@@ -1169,22 +1357,64 @@ def main():
         if in_torch_vers is not None and cur_torch_ver not in in_torch_vers:
             continue
 
+        # The CPU reference of autocompare is at::<op>, ops outside aten have
+        # only their custom fallback
+        namespace = get_namespace_from_schema(fun_config["schema"], args.library)
+        if namespace != "aten" and merged_fun_config.get(
+            "custom_fallback", False
+        ) not in [True, "True"]:
+            merged_fun_config["autocompare"] = "disable"
+
+        merged_fun_configs.append((fun_config, merged_fun_config))
+
+    if args.op_allowlist:
+        allowlist = load_op_allowlist(args.op_allowlist)
+        merged_fun_configs = filter_by_op_allowlist(merged_fun_configs, allowlist)
+        print(
+            f"Generate {len(merged_fun_configs)} ops according to the allowlist {args.op_allowlist}"
+        )
+
+    # Ops without namespace in their schema go to --library, ops outside aten
+    # are defined from their schema
+    libraries = OrderedDict()
+    for fun_config, merged_fun_config in merged_fun_configs:
         fun_code, register_code = functions_code_gen(merged_fun_config)
 
         # The class object memory_format_converter will replace the prefered memory format placeholder to the prefered memory format based on the device's convert_config.yaml
         fun_code = memory_format_converter.convert(fun_code, fun_config)
 
         functions_code += fun_code
+        schema = merged_fun_config["schema"]
+        namespace = get_namespace_from_schema(schema, args.library)
+        library = libraries.setdefault(
+            namespace, {"def": "", "register": "", "autograd": ""}
+        )
+        if namespace != "aten":
+            schema = re.sub(r"^\s*\w+::", "", schema).strip()
+            library["def"] += f'm.def(R"({schema})");\n'
         if merged_fun_config.get("register_op", True) in [True, "True"]:
             if merged_fun_config.get("autograd", False) == True:
-                autograd_op_register_code += register_code
-            op_register_code += register_code
+                library["autograd"] += register_code
+            library["register"] += register_code
+
+    library_def_code = ""
+    library_register_code = ""
+    for namespace, library in libraries.items():
+        if library["def"]:
+            library_def_code += library_def_code_template.substitute(
+                library=[namespace], library_def_code=[library["def"]]
+            )
+        library_register_code += library_register_code_template.substitute(
+            library=[namespace],
+            op_register_code=[library["register"]],
+            autograd_op_register_code=[library["autograd"]],
+        )
 
     autogened_file = file_template.substitute(
         functions_code=[functions_code],
         header_include_code=[header_include_code],
-        op_register_code=[op_register_code],
-        autograd_op_register_code=[autograd_op_register_code],
+        library_def_code=[library_def_code],
+        library_register_code=[library_register_code],
     )
     autogened_file = re.sub(R"\n{3,}", R"\n\n", autogened_file)
     autogened_file = re.sub("[ ]*,[ ]*", ", ", autogened_file)
@@ -10,6 +10,8 @@ Torch_VERSION=${2:-2.1.0}
 GENERATED_KERNELS_SCRIPT=${3:-$AUTOGEN_DIOPI_WRAPPER/autogen_diopi_wrapper.py}
 GENERATED_KERNELS_CONFIG=${4:-$AUTOGEN_DIOPI_WRAPPER/diopi_functions.yaml}
 GENERATED_KERNELS=${5:-$DIPU_DIR/torch_dipu/csrc_dipu/aten/ops/AutoGenedKernels.cpp}
+# Ops to generate, one per line or the csv of op_capture.py, all ops if empty
+OP_ALLOWLIST=${6:-}
 
 GENERATED_KERNELS_VENDOR=${DIPU_DIR}/third_party/DIOPI/impl/${UsedVendor}/convert_config.yaml
 
@@ -21,4 +23,8 @@ if [ -f "$GENERATED_KERNELS_VENDOR" ]; then
     PYTHON_CMD="$PYTHON_CMD --convert_config=${GENERATED_KERNELS_VENDOR}"
 fi
 
+if [ -n "$OP_ALLOWLIST" ]; then
+    PYTHON_CMD="$PYTHON_CMD --op_allowlist=${OP_ALLOWLIST}"
+fi
+
 eval "$PYTHON_CMD"
@@ -46,20 +46,28 @@ diopi_wrapper_file_template_content = """// autogened file
 #include <diopi/diopirt.h>
 #include <diopi/functions.h>
 
+#include "csrc_dipu/aten/OpLatency.h"
 #include "csrc_dipu/aten/RegisterDIPU.hpp"
 #include "csrc_dipu/aten/ops/AutoCompareUtils.hpp"
 #include "csrc_dipu/aten/ops/DIPUCopy.hpp"
+#include "csrc_dipu/aten/ops/DIPUFill.h"
 #include "csrc_dipu/aten/ops/NodispatchUtils.hpp"
 #include "csrc_dipu/aten/ops/OpUtils.hpp"
 #include "csrc_dipu/aten/ops/DIPUOpInferrer.h"
+#include "csrc_dipu/aten/ops/DIPUScalarCache.h"
+#include "csrc_dipu/aten/ops/DIPUFp8.h"
+#include "csrc_dipu/aten/ops/DIPUVarlenAttention.h"
+#include "csrc_dipu/aten/ops/DIPUWeightQuant.h"
 #include "csrc_dipu/aten/ops/OpRegexMatch.hpp"
 #include "csrc_dipu/base/basedef.h"
 #include "csrc_dipu/diopirt/diopirt_impl.h"
 #include "csrc_dipu/profiler/profiler.h"
 #include "csrc_dipu/runtime/core/DIPUGeneratorImpl.h"
+#include "csrc_dipu/runtime/core/DIPUGuard.h"
+#include "csrc_dipu/runtime/core/DIPULaunchQueue.h"
 #include "csrc_dipu/runtime/core/DIPUStream.h"
 
-#include "CustomFallbackFunctions.hpp"
+#include "csrc_dipu/aten/ops/CustomFallbackFunctions.hpp"
 
 $header_include_code
 
@@ -84,15 +92,11 @@ $functions_code
 
 // NOLINTEND(readability-redundant-control-flow)
 
-namespace at {
+$library_def_code
 
-DIPU_LIBRARY_IMPL(aten, DIPU_DEVICE_TYPE_MACRO, m) {
-  $op_register_code
-}
+namespace at {
 
-DIPU_LIBRARY_IMPL(aten, DIPU_AUTOGRAD_DEVICE_TYPE_MACRO, m) {
-  $autograd_op_register_code
-}
+$library_register_code
 
 }  // namespace at
 
@@ -102,6 +106,10 @@ diopi_wrapper_function_template_content = """
 //  $comment
 $cppsignautre {
   dipu::profile::RecordBlockCreator _(__FUNCTION__);
+  static ::dipu::OpLatencySite latencySite("$op_name");
+  ::dipu::OpLatencyTimer latencyTimer(latencySite);
+  // launches on the stream after the queued ones, which may produce its inputs
+  ::dipu::launchQueueBarrier();
   $custom_code_at_the_beginning
 
   ::diopiContext context(dipu::getCurrentDIPUStream().rawstream());
@@ -117,10 +125,13 @@ $cppsignautre {
 
   $custom_code_before_call_diopi
 
+  latencyTimer.beginCall();
   dipu::profile::RecordBlockCreator dipuRecorder(R"($interface_name)");
   ::diopiError_t ret = $diopi_fun_call_code
   dipuRecorder.end();
+  latencyTimer.endCall();
   TORCH_CHECK(ret == ::diopiSuccess, __FILE__, ":", __LINE__, R"($diopi_fun_call_code)", " error, error code is ", ret, "error message is ", diopiGetLastErrorString());
+  recordOpMarkerIfEnable(R"($interface_name)");
 
   $custom_code_before_return
 
@@ -130,6 +141,61 @@ $cppsignautre {
 }
 """
 
+# Ops marked async_launch, the launch may run on the launch thread after the
+# wrapper returns, so it copies the arguments it uses
+diopi_wrapper_async_function_template_content = """
+//  $comment
+$cppsignautre {
+  dipu::profile::RecordBlockCreator _(__FUNCTION__);
+  static ::dipu::OpLatencySite latencySite("$op_name");
+  ::dipu::OpLatencyTimer latencyTimer(latencySite);
+  $custom_code_at_the_beginning
+
+  $device_check_code
+
+  auto launch = [=, stream = dipu::getCurrentDIPUStream()]() mutable {
+    ::dipu::DIPUStreamGuard streamGuard(stream.unwrap());
+    ::diopiContext context(stream.rawstream());
+    auto ctx = &context;
+
+    $input_process_code
+
+    $output_process_code
+
+    $attrs_process_code
+
+    dipu::profile::RecordBlockCreator dipuRecorder(R"($interface_name)");
+    ::diopiError_t ret = $diopi_fun_call_code
+    dipuRecorder.end();
+    TORCH_CHECK(ret == ::diopiSuccess, __FILE__, ":", __LINE__, R"($diopi_fun_call_code)", " error, error code is ", ret, "error message is ", diopiGetLastErrorString());
+    recordOpMarkerIfEnable(R"($interface_name)");
+  };
+  latencyTimer.beginCall();
+  ::dipu::enqueueLaunch(std::move(launch));
+  latencyTimer.endCall();
+
+  synchronizeIfEnable();
+
+  $return_code
+}
+"""
+
+library_def_template_content = """
+TORCH_LIBRARY_FRAGMENT($library, m) {
+  $library_def_code
+}
+"""
+
+library_register_template_content = """
+DIPU_LIBRARY_IMPL($library, DIPU_DEVICE_TYPE_MACRO, m) {
+  $op_register_code
+}
+
+DIPU_LIBRARY_IMPL($library, DIPU_AUTOGRAD_DEVICE_TYPE_MACRO, m) {
+  $autograd_op_register_code
+}
+"""
+
 op_no_customfallback_with_autocompare_register_template_content = """
 NO_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER("$register_name", $diopi_fun_name, $aten_fun_name);
 """
@@ -179,6 +245,18 @@ $cppsignautre {
 autocompare_template_content = """
 //  $comment
 $cppsignautre {
+  if (::dipu::native::autocompare::sampling()) {
+    static ::dipu::native::autocompare::OpSampler sampler("$op_name");
+    if (!sampler.sample()) {
+      return $call_device_op_code
+    }
+    $transform_input_to_cpu_code
+
+    $execute_op_on_device_code
+
+    $sampled_compare_code
+  }
+
   std::cout << std::endl << __FUNCTION__ << std::endl;
   $transform_input_to_cpu_code
 
@@ -1,5 +1,7 @@
 import os
+import re
 import sys
+import json
 import random
 from multiprocessing import Pool
 import subprocess as sp
@@ -22,6 +24,16 @@ def run_cmd(cmd: str) -> None:
         raise Exception(error)
 
 
+def benchmark_cmd(cmd: str, report: str) -> str:
+    # Run the training script itself instead of the one iter tool, the
+    # benchmark hook in torch_dipu stops it after the timed steps
+    cmd = re.sub(r"\b(?:ba)?sh (\S*)SMART/tools/one_iter_tool/run_one_iter\.sh ", r"python \1", cmd)
+    return cmd.replace(
+        "export ONE_ITER_TOOL_STORAGE_PATH=",
+        f"export DIPU_BENCHMARK_REPORT={report} && export ONE_ITER_TOOL_STORAGE_PATH=",
+    )
+
+
 def process_one_iter(log_file, clear_log, model_info: dict) -> None:
     begin_time = time.time()
 
@@ -135,11 +147,22 @@ def process_one_iter(log_file, clear_log, model_info: dict) -> None:
     elif device == "kunlunxin":
         cmd_run_one_iter = f"bash SMART/tools/one_iter_tool/run_one_iter.sh {train_path} {config_path} {work_dir} {opt_arg}"
         cmd_cp_one_iter = f"bash SMART/tools/one_iter_tool/compare_one_iter.sh {package_name} {atol} {rtol} {metric}"
+    if benchmark:
+        # Inference models have no optimizer steps to time
+        if "run_one_iter.sh" not in cmd_run_one_iter:
+            logging.info(f"skip benchmark of {p2}")
+            return
+        report = f"{storage_path}/benchmark.json"
+        os.environ["DIPU_BENCHMARK_REPORT"] = report
+        os.environ["DIPU_BENCHMARK_BATCH_SIZE"] = str(model_info.get("batch_size", 0))
+        cmd_run_one_iter = benchmark_cmd(cmd_run_one_iter, report)
+        cmd_cp_one_iter = ""
     if clear_log:
         run_cmd(cmd_run_one_iter + f" 2>&1 > {log_file}")
     else:
         run_cmd(cmd_run_one_iter + f" 2>&1 >> {log_file}")
-    run_cmd(cmd_cp_one_iter + f" 2>&1 >> {log_file}")
+    if cmd_cp_one_iter:
+        run_cmd(cmd_cp_one_iter + f" 2>&1 >> {log_file}")
 
     end_time = time.time()
     run_time = round(end_time - begin_time)
@@ -163,6 +186,50 @@ def print_file(file_name):
         logging.info(lines)
 
 
+def collect_benchmark_reports(model_list) -> dict:
+    reports = {}
+    for model_info in model_list:
+        name = model_info["model_cfg"].split()[2]
+        report = f"one_iter_data/{name}/benchmark.json"
+        if os.path.exists(report):
+            with open(report) as f:
+                reports[name] = json.load(f)
+    return reports
+
+
+def compare_benchmark(reports: dict, baseline: dict, args) -> list:
+    # (metric, larger is better, allowed relative change)
+    checks = [
+        ("steps_per_s", True, args.max_slowdown),
+        ("step_time_p90_s", False, args.max_slowdown),
+        ("peak_allocated_bytes", False, args.max_memory_growth),
+        ("peak_reserved_bytes", False, args.max_memory_growth),
+        ("compile_s", False, args.max_compile_growth),
+    ]
+    regressions = []
+    for name, report in reports.items():
+        base = baseline.get(name)
+        if base is None:
+            logging.warning(f"no benchmark baseline of {name}")
+            continue
+        for metric, larger_better, tolerance in checks:
+            old, new = base.get(metric), report.get(metric)
+            if not old or new is None:
+                continue
+            change = (new - old) / old
+            if (-change if larger_better else change) > tolerance:
+                regressions.append(f"{name}: {metric} {old} -> {new} ({change:+.1%})")
+        # Any new fallback means an op lost its device implementation
+        if report["fallback_calls"] > base.get("fallback_calls", 0):
+            regressions.append(
+                f"{name}: fallback_calls {base.get('fallback_calls', 0)} -> {report['fallback_calls']}"
+            )
+    for name in baseline:
+        if name not in reports:
+            regressions.append(f"{name}: no benchmark report")
+    return regressions
+
+
 if __name__ == "__main__":
     # set some params
     max_parall = 8
@@ -179,7 +246,31 @@ if __name__ == "__main__":
         choices=["traditional", "llm"],
         help="the selection of model list",
     )
+    parser.add_argument(
+        "--benchmark",
+        action="store_true",
+        help="time training steps instead of comparing one iteration",
+    )
+    parser.add_argument("--warmup", type=int, default=3, help="untimed steps per model")
+    parser.add_argument("--iters", type=int, default=20, help="timed steps per model")
+    parser.add_argument(
+        "--report", type=str, default="benchmark_report.json", help="the merged benchmark report"
+    )
+    parser.add_argument("--baseline", type=str, default="", help="the benchmark report to compare with")
+    parser.add_argument(
+        "--update-baseline", action="store_true", help="write the report to the baseline instead of comparing"
+    )
+    parser.add_argument(
+        "--max-slowdown", type=float, default=0.05, help="allowed relative loss of throughput and p90 step time"
+    )
+    parser.add_argument(
+        "--max-memory-growth", type=float, default=0.05, help="allowed relative growth of peak memory"
+    )
+    parser.add_argument(
+        "--max-compile-growth", type=float, default=0.5, help="allowed relative growth of compile time"
+    )
     args = parser.parse_args()
+    benchmark = args.benchmark
 
     device = args.device
     job_name = args.job_name
@@ -212,6 +303,9 @@ if __name__ == "__main__":
     os.environ["DIPU_DUMP_OP_ARGS"] = "0"
     os.environ["DIPU_DEBUG_ALLOCATOR"] = "0"
     os.environ["ONE_ITER_TOOL_DEVICE"] = "dipu"
+    if benchmark:
+        os.environ["DIPU_BENCHMARK_WARMUP"] = str(args.warmup)
+        os.environ["DIPU_BENCHMARK_ITERS"] = str(args.iters)
     # For traditional models, the baseline data is generated on the CPU. However, for large language models, the baseline data needs to be generated
     # on the GPU due to the limitation of the fp16 dtype.
     if "traditional" in selected_model_list:
@@ -276,6 +370,22 @@ if __name__ == "__main__":
             if error_flag.value != 0:
                 exit(1)
             logging.info("All subprocesses done.")
+            if benchmark:
+                reports = collect_benchmark_reports(selected_list)
+                with open(args.report, "w") as f:
+                    json.dump(reports, f, indent=2)
+                logging.info(f"benchmark report: {json.dumps(reports, indent=2)}")
+                if args.baseline and args.update_baseline:
+                    with open(args.baseline, "w") as f:
+                        json.dump(reports, f, indent=2)
+                elif args.baseline:
+                    with open(args.baseline) as f:
+                        baseline = json.load(f)
+                    regressions = compare_benchmark(reports, baseline, args)
+                    for regression in regressions:
+                        logging.error(f"benchmark regression: {regression}")
+                    if regressions:
+                        exit(1)
         except Exception as e:
             logging.error(e)
             exit(1)
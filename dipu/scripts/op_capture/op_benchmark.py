@@ -0,0 +1,237 @@
+# Copyright (c) 2024, DeepLink.
+# Times the op calls captured by op_capture.py one by one through the DIPU
+# wrappers: host time of the call, device time between events, and host time
+# of the DIOPI calls inside from the op latency timers, to find the ops whose
+# time goes to the framework rather than to the vendor.
+import ast
+import csv
+import re
+import time
+
+import torch
+import torch_dipu
+from torch_dipu import dipu
+
+# Names printed for tensor dtypes (caffe2::TypeMeta) and for dtype args
+# (c10::ScalarType) by DIPU_DUMP_OP_ARGS
+_TENSOR_DTYPES = {
+    "float": torch.float32,
+    "double": torch.float64,
+    "c10::Half": torch.float16,
+    "c10::BFloat16": torch.bfloat16,
+    "long": torch.int64,
+    "long int": torch.int64,
+    "int": torch.int32,
+    "short": torch.int16,
+    "short int": torch.int16,
+    "signed char": torch.int8,
+    "unsigned char": torch.uint8,
+    "bool": torch.bool,
+}
+_ENUM_VALUES = {
+    "Float": torch.float32,
+    "Double": torch.float64,
+    "Half": torch.float16,
+    "BFloat16": torch.bfloat16,
+    "Long": torch.int64,
+    "Int": torch.int32,
+    "Short": torch.int16,
+    "Char": torch.int8,
+    "Byte": torch.uint8,
+    "Bool": torch.bool,
+    "Strided": torch.strided,
+    "Contiguous": torch.contiguous_format,
+    "ChannelsLast": torch.channels_last,
+    "ChannelsLast3d": torch.channels_last_3d,
+    "Preserve": torch.preserve_format,
+}
+
+
+def parase_args():
+    import argparse
+
+    parser = argparse.ArgumentParser(description="dipu op benchmark tool")
+    parser.add_argument(
+        "--ops",
+        type=str,
+        default="dipu_ops.csv",
+        help="The operator information captured by op_capture.py",
+    )
+    parser.add_argument(
+        "--out",
+        type=str,
+        default="dipu_op_benchmark.csv",
+        help="The file to save the timing of each operator call",
+    )
+    parser.add_argument(
+        "--warmup", type=int, default=5, help="Untimed calls of each operator"
+    )
+    parser.add_argument(
+        "--iters", type=int, default=50, help="Timed calls of each operator"
+    )
+    args = parser.parse_args()
+    return args
+
+
+def parse_captured_args(args):
+    # op_capture.py saves them as str(list) of "name:[value] "
+    result = dict()
+    for arg in ast.literal_eval(args):
+        index = arg.find(":")
+        value = arg[index + 1 :].strip()
+        result[arg[0:index].strip()] = value[1:-1]
+    return result
+
+
+def _int_list(text):
+    return [int(v) for v in re.findall(r"-?\d+", text)]
+
+
+def make_tensor(attrs, device):
+    if attrs in ("", "undefined"):
+        return None
+    sizes = _int_list(re.search(r"sizes: \[([^\]]*)\]", attrs).group(1))
+    strides = _int_list(re.search(r"stride: \[([^\]]*)\]", attrs).group(1))
+    dtype = _TENSOR_DTYPES[re.search("dtype: ([^,]+)", attrs).group(1).strip()]
+    offset = re.search(r"storage_offset: (\d+)", attrs)
+    offset = int(offset.group(1)) if offset else 0
+    numel = 0
+    if all(size > 0 for size in sizes):
+        numel = offset + 1
+        numel += sum((size - 1) * stride for size, stride in zip(sizes, strides))
+    base = torch.empty(numel, dtype=dtype)
+    # Positive values keep ops like log and sqrt finite, small integers are
+    # mostly valid indices
+    if dtype.is_floating_point:
+        base.uniform_(0.5, 1.5)
+    else:
+        base.random_(0, 2)
+    return base.to(device).as_strided(sizes, strides, offset)
+
+
+def make_arg(jit_type, value, device):
+    text = str(jit_type)
+    optional = text.startswith("Optional[")
+    if optional:
+        text = text[len("Optional[") : -1]
+    if value == "" and optional:
+        return None
+    if value in _ENUM_VALUES:
+        return _ENUM_VALUES[value]
+    if text == "Tensor":
+        return make_tensor(value, device)
+    if text in ("List[Tensor]", "List[Optional[Tensor]]"):
+        items = [attrs.strip(" ,") for attrs in re.split("(?=numel:)", value)]
+        return [make_tensor(attrs, device) for attrs in items if attrs]
+    if text in ("List[int]", "List[SymInt]"):
+        return _int_list(value)
+    if text == "bool":
+        return value in ("1", "true", "True")
+    if text in ("int", "SymInt", "float", "Scalar"):
+        return ast.literal_eval(value)
+    if text == "str":
+        return value
+    raise ValueError(f"unsupported argument type {jit_type}")
+
+
+def get_op(aten_name):
+    name, _, overload = aten_name.partition(".")
+    return getattr(getattr(torch.ops.aten, name), overload or "default")
+
+
+def bench_op(aten_name, args, device, warmup, iters):
+    op = get_op(aten_name)
+    captured = parse_captured_args(args)
+    kwargs = dict()
+    for arg in op._schema.arguments:
+        if arg.name in captured:
+            kwargs[arg.name] = make_arg(arg.type, captured[arg.name], device)
+        elif not arg.has_default_value():
+            raise ValueError(f"argument {arg.name} was not captured")
+    # In-place ops keep changing their inputs, that does not change the time
+    # of most ops
+    for _ in range(warmup):
+        op(**kwargs)
+    dipu.synchronize()
+    dipu.reset_op_latency_stats()
+    start = dipu.Event(enable_timing=True)
+    end = dipu.Event(enable_timing=True)
+    start.record()
+    begin = time.perf_counter()
+    for _ in range(iters):
+        op(**kwargs)
+    host_us = (time.perf_counter() - begin) * 1e6 / iters
+    end.record()
+    end.synchronize()
+    # The wrapper may call other ops, their DIOPI calls count as well
+    stats = dipu.op_latency_stats()
+    diopi_us = sum(item["call"]["mean_us"] * item["calls"] for item in stats) / iters
+    return {
+        "host_us": host_us,
+        "device_us": start.elapsed_time(end) * 1e3 / iters,
+        "diopi_us": diopi_us,
+        # Share of the host time spent outside of DIOPI, in the dispatcher
+        # and the wrapper
+        "overhead_ratio": 1 - diopi_us / host_us if diopi_us > 0 else 1.0,
+    }
+
+
+def main():
+    args = parase_args()
+    device = torch.device(torch_dipu.dipu.diputype)
+    dipu.set_op_latency_enabled(True)
+    results = []
+    with open(args.ops, newline="") as f:
+        for op_info in csv.DictReader(f):
+            if op_info["diopi_fun"] == "fallback":
+                continue
+            result = {
+                "aten_name": op_info["aten_name"],
+                "diopi_fun": op_info["diopi_fun"],
+                "args": op_info["args"],
+            }
+            try:
+                timing = bench_op(
+                    op_info["aten_name"],
+                    op_info["args"],
+                    device,
+                    args.warmup,
+                    args.iters,
+                )
+                result.update(timing)
+                result["status"] = "ok"
+            except Exception as e:
+                result["status"] = f"skipped: {e}"
+            results.append(result)
+
+    header = [
+        "aten_name",
+        "diopi_fun",
+        "host_us",
+        "device_us",
+        "diopi_us",
+        "overhead_ratio",
+        "status",
+        "args",
+    ]
+    with open(args.out, "w", encoding="utf-8", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=header)
+        writer.writeheader()
+        writer.writerows(results)
+
+    timed = [r for r in results if r["status"] == "ok"]
+    timed.sort(key=lambda r: r["host_us"] - r["diopi_us"], reverse=True)
+    print(
+        f"{'op':<40} {'host_us':>10} {'device_us':>10} {'diopi_us':>10} "
+        f"{'overhead':>9}"
+    )
+    for r in timed:
+        print(
+            f"{r['aten_name']:<40} {r['host_us']:>10.2f} {r['device_us']:>10.2f} "
+            f"{r['diopi_us']:>10.2f} {r['overhead_ratio']:>9.1%}"
+        )
+    print(f"{len(timed)} of {len(results)} op calls timed, see {args.out}")
+
+
+if __name__ == "__main__":
+    main()
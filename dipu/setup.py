@@ -67,11 +67,15 @@ def torch_dipu_headers():
     headers_pattern = list()
     headers_pattern.append("csrc_dipu/*.h")
     headers_pattern.append("csrc_dipu/aten/*.h")
+    headers_pattern.append("csrc_dipu/aten/*.hpp")
+    headers_pattern.append("csrc_dipu/aten/ops/*.h")
+    headers_pattern.append("csrc_dipu/aten/ops/*.hpp")
     headers_pattern.append("csrc_dipu/base/*.h")
     headers_pattern.append("csrc_dipu/binding/*.h")
     headers_pattern.append("csrc_dipu/diopirt/*.h")
     headers_pattern.append("csrc_dipu/profiler/*.h")
     headers_pattern.append("csrc_dipu/utils/*.h")
+    headers_pattern.append("csrc_dipu/utils/*.hpp")
     headers_pattern.append("csrc_dipu/runtime/*.h")
     headers_pattern.append("csrc_dipu/runtime/core/*.h")
     headers_pattern.append("csrc_dipu/runtime/core/allocator/*.h")
@@ -96,6 +100,7 @@ setup(
             "*.lib",
             "*.so",
             "*.pylib",
+            "share/cmake/TorchDipu/*.cmake",
             "../third_party/DIOPI/impl/lib/*.lib",
             "../third_party/DIOPI/impl/lib/*.so",
             "../third_party/DIOPI/impl/lib/*.pylib",
@@ -0,0 +1,294 @@
+// Copyright (c) 2024, DeepLink.
+// Replays an allocation trace, or a synthetic one, against the device caching
+// allocator chosen by DIPU_DEVICE_MEMCACHING_ALGORITHM, so that BF, BS and RAW
+// compare on the same workload without running a model. Each stream of the
+// trace is replayed by a thread of its own on a stream of its own, and blocks
+// are freed by the thread which allocated them. Reports the throughput and
+// latency of allocate and free, the peak reserved memory and fragmentation.
+// usage: bench_allocator [trace_file|synthetic] [threads] [ops_per_thread]
+// Traces are written by torch_dipu.dipu.memory._dump_allocation_trace, the
+// thread and op counts only apply to synthetic workloads. To compare:
+//   for algo in BF BS RAW; do
+//     DIPU_DEVICE_MEMCACHING_ALGORITHM=$algo bench_allocator trace.txt
+//   done
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <csrc_dipu/runtime/core/DIPUStream.h>
+#include <csrc_dipu/runtime/core/allocator/DIPUCachingAllocator.h>
+#include <csrc_dipu/runtime/devproxy/deviceproxy.h>
+
+using namespace dipu;
+
+namespace {
+
+struct Op {
+  bool alloc;
+  // Index of the block among all blocks of the workload
+  size_t slot;
+  // Requested size of the block, also for frees
+  size_t size;
+};
+
+struct Workload {
+  // Ops of each thread, in order
+  std::vector<std::vector<Op>> threads;
+  size_t slots = 0;
+};
+
+// Frees of blocks allocated before the recording started are dropped, blocks
+// still alive at the end are freed after the replay
+bool loadTrace(const std::string& path, Workload& workload) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::unordered_map<int64_t, size_t> thread_of_stream;
+  // Live blocks by address, with their slot and thread
+  std::unordered_map<uintptr_t, std::pair<size_t, size_t>> live;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string action;
+    fields >> action;
+    if (action == "alloc") {
+      int64_t stream = 0;
+      uintptr_t addr = 0;
+      size_t size = 0;
+      fields >> stream >> addr >> size;
+      auto found = thread_of_stream.emplace(stream, workload.threads.size());
+      if (found.second) {
+        workload.threads.emplace_back();
+      }
+      size_t thread = found.first->second;
+      size_t slot = workload.slots++;
+      live[addr] = {slot, thread};
+      workload.threads[thread].push_back({true, slot, size});
+    } else if (action == "free") {
+      uintptr_t addr = 0;
+      fields >> addr;
+      auto it = live.find(addr);
+      if (it == live.end()) {
+        continue;
+      }
+      workload.threads[it->second.second].push_back(
+          {false, it->second.first, 0});
+      live.erase(it);
+    }
+  }
+  return true;
+}
+
+// Sizes are log-uniform from 512B to 64MB, each thread keeps up to 256
+// blocks alive and frees a random one of them
+Workload synthetic(int threads, int ops) {
+  constexpr size_t kMaxLive = 256;
+  Workload workload;
+  for (int t = 0; t < threads; ++t) {
+    std::mt19937_64 rng(t);
+    std::uniform_real_distribution<double> log_size(9, 26);
+    std::vector<size_t> live;
+    std::vector<Op> thread_ops;
+    for (int i = 0; i < ops; ++i) {
+      bool alloc = live.empty() || (live.size() < kMaxLive && rng() % 2 == 0);
+      if (alloc) {
+        auto size = static_cast<size_t>(std::exp2(log_size(rng)));
+        live.push_back(workload.slots);
+        thread_ops.push_back({true, workload.slots++, size});
+      } else {
+        size_t index = rng() % live.size();
+        thread_ops.push_back({false, live[index], 0});
+        live[index] = live.back();
+        live.pop_back();
+      }
+    }
+    workload.threads.push_back(std::move(thread_ops));
+  }
+  return workload;
+}
+
+// The bytes in use at the peaks of the allocated and the reserved memory
+class Peaks {
+ public:
+  void sample(size_t requested, const CacheAllocator& cache) {
+    size_t allocated = cache.memory_allocated();
+    size_t reserved = cache.memory_reserved();
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (allocated > allocated_) {
+      allocated_ = allocated;
+      requested_ = requested;
+    }
+    if (reserved > reserved_) {
+      reserved_ = reserved;
+      allocated_at_reserved_ = allocated;
+    }
+  }
+
+  size_t reserved() const { return reserved_; }
+
+  // Share of the allocated bytes which were not requested, from rounding and
+  // splitting blocks
+  double internal() const {
+    return allocated_ == 0 ? 0 : 1.0 - static_cast<double>(requested_) /
+                                           static_cast<double>(allocated_);
+  }
+
+  // Share of the reserved bytes which were not allocated
+  double external() const {
+    return reserved_ == 0 ? 0
+                          : 1.0 - static_cast<double>(allocated_at_reserved_) /
+                                      static_cast<double>(reserved_);
+  }
+
+ private:
+  std::mutex mutex_;
+  size_t allocated_ = 0;
+  size_t requested_ = 0;
+  size_t reserved_ = 0;
+  size_t allocated_at_reserved_ = 0;
+};
+
+struct Latencies {
+  std::vector<double> alloc_us;
+  std::vector<double> free_us;
+};
+
+double percentile(std::vector<double>& sorted, double q) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto index = std::min(
+      static_cast<size_t>(q * static_cast<double>(sorted.size())),
+      sorted.size() - 1);
+  return sorted[index];
+}
+
+void replay(const std::vector<Op>& ops, const DIPUStream& stream,
+            CacheAllocator& cache, std::vector<c10::DataPtr>& blocks,
+            std::atomic<size_t>& requested, Peaks& peaks, Latencies& result) {
+  devproxy::setDevice(0);
+  setCurrentDIPUStream(stream);
+  for (const auto& op : ops) {
+    auto start = std::chrono::steady_clock::now();
+    if (op.alloc) {
+      blocks[op.slot] = cache.allocate(op.size);
+    } else {
+      blocks[op.slot].clear();
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    (op.alloc ? result.alloc_us : result.free_us).push_back(elapsed.count());
+    if (op.alloc) {
+      requested.fetch_add(op.size, std::memory_order_relaxed);
+    } else {
+      requested.fetch_sub(op.size, std::memory_order_relaxed);
+    }
+    peaks.sample(requested.load(std::memory_order_relaxed), cache);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::string source = argc > 1 ? argv[1] : "synthetic";
+  const int threads = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 4;
+  const int ops = argc > 3 ? std::max(std::atoi(argv[3]), 1) : 100000;
+  Workload workload;
+  if (source == "synthetic") {
+    workload = synthetic(threads, ops);
+  } else if (!loadTrace(source, workload)) {
+    fprintf(stderr, "can't read trace %s\n", source.c_str());
+    return 1;
+  }
+
+  devproxy::setDevice(0);
+  auto* cache =
+      dynamic_cast<CacheAllocator*>(getAllocator(dipu::DIPU_DEVICE_TYPE));
+  if (cache == nullptr) {
+    fprintf(stderr, "the device allocator is not a caching allocator\n");
+    return 1;
+  }
+  // The first stream replays on the default stream
+  std::vector<DIPUStream> streams;
+  for (size_t t = 0; t < workload.threads.size(); ++t) {
+    streams.push_back(t == 0 ? getDefaultDIPUStream()
+                             : getDIPUStreamFromPool());
+  }
+
+  // Traces don't keep the size of frees
+  std::vector<size_t> sizes(workload.slots);
+  for (const auto& thread_ops : workload.threads) {
+    for (const auto& op : thread_ops) {
+      if (op.alloc) {
+        sizes[op.slot] = op.size;
+      }
+    }
+  }
+  for (auto& thread_ops : workload.threads) {
+    for (auto& op : thread_ops) {
+      if (!op.alloc) {
+        op.size = sizes[op.slot];
+      }
+    }
+  }
+
+  std::vector<c10::DataPtr> blocks(workload.slots);
+  std::vector<Latencies> latencies(workload.threads.size());
+  std::atomic<size_t> requested{0};
+  Peaks peaks;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < workload.threads.size(); ++t) {
+    workers.emplace_back([&, t] {
+      replay(workload.threads[t], streams[t], *cache, blocks, requested, peaks,
+             latencies[t]);
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  blocks.clear();
+  devproxy::syncDevice();
+  cache->empty_cache();
+
+  Latencies all;
+  for (auto& thread_latencies : latencies) {
+    all.alloc_us.insert(all.alloc_us.end(), thread_latencies.alloc_us.begin(),
+                        thread_latencies.alloc_us.end());
+    all.free_us.insert(all.free_us.end(), thread_latencies.free_us.begin(),
+                       thread_latencies.free_us.end());
+  }
+  std::sort(all.alloc_us.begin(), all.alloc_us.end());
+  std::sort(all.free_us.begin(), all.free_us.end());
+  const size_t total_ops = all.alloc_us.size() + all.free_us.size();
+  const char* algorithm = std::getenv("DIPU_DEVICE_MEMCACHING_ALGORITHM");
+
+  printf("%-10s %7s %10s %10s %9s %9s %9s %9s %12s %8s %8s\n", "algorithm",
+         "threads", "ops", "Mops/s", "alloc_p50", "alloc_p99", "free_p50",
+         "free_p99", "peak_resv_MB", "int_frag", "ext_frag");
+  printf("%-10s %7zu %10zu %10.3f %7.2fus %7.2fus %7.2fus %7.2fus %12.1f "
+         "%7.1f%% %7.1f%%\n",
+         algorithm != nullptr ? algorithm : "BF", workload.threads.size(),
+         total_ops, static_cast<double>(total_ops) / elapsed.count() / 1e6,
+         percentile(all.alloc_us, 0.5), percentile(all.alloc_us, 0.99),
+         percentile(all.free_us, 0.5), percentile(all.free_us, 0.99),
+         static_cast<double>(peaks.reserved()) / (1 << 20),
+         peaks.internal() * 100, peaks.external() * 100);
+  return 0;
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2024, DeepLink.
+// Bandwidth of copy_ and the DIPUCopyInplace paths it takes, for D2Self, H2D,
+// D2H and D2OtherD copies of several sizes, layouts and dtypes.
+// usage: bench_copy [iterations]
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include <csrc_dipu/aten/ops/DIPUCopy.hpp>
+#include <csrc_dipu/runtime/devproxy/deviceproxy.h>
+
+using namespace dipu;
+
+namespace {
+
+// All layouts have the logical shape {4, 16, side, side}
+struct Layout {
+  const char* name;
+  std::function<at::Tensor(int64_t side, const at::TensorOptions& options)>
+      make;
+  bool srcOnly = false;
+};
+
+const std::vector<Layout>& layouts() {
+  static const std::vector<Layout> list = {
+      {"contiguous",
+       [](int64_t side, const at::TensorOptions& options) {
+         return at::empty({4, 16, side, side}, options);
+       }},
+      {"channels_last",
+       [](int64_t side, const at::TensorOptions& options) {
+         return at::empty({4, 16, side, side}, options,
+                          at::MemoryFormat::ChannelsLast);
+       }},
+      {"permuted",
+       [](int64_t side, const at::TensorOptions& options) {
+         return at::empty({side, side, 16, 4}, options).permute({3, 2, 0, 1});
+       }},
+      {"sliced",
+       [](int64_t side, const at::TensorOptions& options) {
+         return at::empty({4, 16, side, 2 * side}, options)
+             .slice(3, 0, 2 * side, 2);
+       }},
+      {"broadcast",
+       [](int64_t side, const at::TensorOptions& options) {
+         return at::empty({1, 16, side, side}, options)
+             .expand({4, 16, side, side});
+       },
+       true},
+  };
+  return list;
+}
+
+struct Direction {
+  const char* name;
+  at::Device src;
+  at::Device dst;
+};
+
+std::string pathsTaken(const std::vector<uint64_t>& before, int iterations) {
+  std::string result;
+  for (size_t i = 0; i < before.size(); ++i) {
+    auto path = static_cast<DIPUCopyPath>(i);
+    auto count = getCopyPathCount(path) - before[i];
+    if (count == 0) {
+      continue;
+    }
+    if (!result.empty()) {
+      result += ",";
+    }
+    result += copyPathName(path);
+    if (count != static_cast<uint64_t>(iterations)) {
+      // taken several times, or not every time, per copy_
+      char times[32];
+      snprintf(times, sizeof(times), "x%.2f",
+               static_cast<double>(count) / iterations);
+      result += times;
+    }
+  }
+  return result.empty() ? "-" : result;
+}
+
+void benchCopy(const Direction& direction, const Layout& srcLayout,
+               const Layout& dstLayout, at::ScalarType srcDtype,
+               at::ScalarType dstDtype, int64_t side, int iterations) {
+  auto src = srcLayout.make(
+      side, at::TensorOptions().dtype(srcDtype).device(direction.src));
+  auto dst = dstLayout.make(
+      side, at::TensorOptions().dtype(dstDtype).device(direction.dst));
+  src.fill_(1);
+  // warm up caches and lazy initialization
+  dst.copy_(src);
+  devproxy::syncDevice();
+
+  std::vector<uint64_t> before;
+  for (size_t i = 0; i < static_cast<size_t>(DIPUCopyPath::kCount); ++i) {
+    before.push_back(getCopyPathCount(static_cast<DIPUCopyPath>(i)));
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    dst.copy_(src);
+  }
+  devproxy::syncDevice();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  auto bytes = static_cast<double>(dst.nbytes()) * iterations;
+  printf("%-9s %-14s %-14s %-9s %-9s %10" PRId64 " %9.2f GB/s  %s\n",
+         direction.name, srcLayout.name, dstLayout.name,
+         c10::toString(srcDtype), c10::toString(dstDtype), dst.numel(),
+         bytes / elapsed.count() / 1e9, pathsTaken(before, iterations).c_str());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 10;
+  const at::Device host(at::kCPU);
+  const at::Device device0(DIPU_DEVICE_TYPE, 0);
+  const at::Device device1(DIPU_DEVICE_TYPE, 1);
+
+  std::vector<Direction> directions = {
+      {"D2Self", device0, device0},
+      {"H2D", host, device0},
+      {"D2H", device0, host},
+  };
+  if (devproxy::getDeviceCount() > 1) {
+    directions.push_back({"D2OtherD", device0, device1});
+  }
+  const std::vector<std::pair<at::ScalarType, at::ScalarType>> dtypes = {
+      {at::kFloat, at::kFloat},
+      {at::kFloat, at::kHalf},
+  };
+  // 1K, 64K, 1M and 16M elements
+  const std::vector<int64_t> sides = {4, 32, 128, 512};
+
+  printf("%-9s %-14s %-14s %-9s %-9s %10s %14s  %s\n", "type", "src", "dst",
+         "src_dtype", "dst_dtype", "numel", "bandwidth", "paths");
+  for (const auto& direction : directions) {
+    for (const auto& srcLayout : layouts()) {
+      for (const auto& dstLayout : layouts()) {
+        if (dstLayout.srcOnly) {
+          continue;
+        }
+        for (const auto& dtype : dtypes) {
+          for (auto side : sides) {
+            benchCopy(direction, srcLayout, dstLayout, dtype.first,
+                      dtype.second, side, iterations);
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
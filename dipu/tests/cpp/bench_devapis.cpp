@@ -0,0 +1,317 @@
+// Copyright (c) 2024, DeepLink.
+// Checks the devapis of the vendor behave as deviceapis.h describes and times
+// them: event create / record / query, mallocDevice by size, memcpy and
+// memSetAsync bandwidth by direction and size, and the latency of one stream
+// waiting for another. The required apis are called directly, bypassing the
+// caches and pools of devproxy, so reports of different vendors compare.
+// usage: bench_devapis [iterations]
+// Exits with 1 if any check fails.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <csrc_dipu/runtime/devproxy/deviceproxy.h>
+
+using namespace dipu;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* name, const std::string& detail = "") {
+  printf("%-6s %s%s%s\n", ok ? "ok" : "FAIL", name, detail.empty() ? "" : ": ",
+         detail.c_str());
+  failures += ok ? 0 : 1;
+}
+
+// Seconds per call of `fn` averaged over `iterations` calls, after `finish`
+// waited for the work they queued
+double timeIt(int iterations, const std::function<void()>& fn,
+              const std::function<void()>& finish = [] {}) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    fn();
+  }
+  finish();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+std::string sizeName(size_t bytes) {
+  char name[32];
+  if (bytes >= (size_t{1} << 20)) {
+    snprintf(name, sizeof(name), "%zuM", bytes >> 20);
+  } else {
+    snprintf(name, sizeof(name), "%zuK", bytes >> 10);
+  }
+  return name;
+}
+
+void printLatency(const char* name, const std::string& size, double seconds) {
+  printf("%-28s %8s %12.2f us\n", name, size.c_str(), seconds * 1e6);
+}
+
+void printBandwidth(const char* name, size_t bytes, double seconds) {
+  printf("%-28s %8s %12.2f GB/s\n", name, sizeName(bytes).c_str(),
+         static_cast<double>(bytes) / seconds / 1e9);
+}
+
+struct Buffers {
+  size_t bytes = 0;
+  void* device = nullptr;
+  void* device2 = nullptr;
+  void* pinned = nullptr;
+  std::vector<uint8_t> pageable;
+
+  explicit Buffers(size_t nbytes) : bytes(nbytes), pageable(nbytes, 0) {
+    devapis::mallocDevice(&device, bytes);
+    devapis::mallocDevice(&device2, bytes);
+    devapis::mallocHost(&pinned, bytes);
+  }
+
+  ~Buffers() {
+    devapis::freeDevice(device);
+    devapis::freeDevice(device2);
+    devapis::freeHost(pinned);
+  }
+
+  Buffers(const Buffers&) = delete;
+  Buffers& operator=(const Buffers&) = delete;
+};
+
+void checkDevice() {
+  int count = devapis::getDeviceCount();
+  check(count > 0, "getDeviceCount", std::to_string(count));
+  devapis::setDevice(0);
+  check(devapis::current_device() == 0, "setDevice / current_device");
+  auto props = devapis::getDeviceProperties(0);
+  check(props.totalGlobalMem > 0, "getDeviceProperties",
+        props.name + ", " + sizeName(props.totalGlobalMem));
+  int driver = 0;
+  int runtime = 0;
+  devapis::getDriverVersion(&driver);
+  devapis::getRuntimeVersion(&runtime);
+  printf("       driver %d, runtime %d\n", driver, runtime);
+
+  const auto& caps = devproxy::vendorCapabilities();
+  printf(
+      "       capabilities: pinned detection %d, async H2D %d, peer access "
+      "%d, virtual memory %d, host callbacks %d\n",
+      caps.pinnedPtrDetection, caps.asyncMemCopyH2D, caps.peerAccess,
+      caps.virtualMem, caps.hostFunc);
+}
+
+void checkMemory(deviceStream_t stream) {
+  constexpr size_t kBytes = 1 << 20;
+  Buffers buffers(kBytes);
+
+  if (devproxy::vendorCapabilities().pinnedPtrDetection) {
+    check(devapis::isPinnedPtr(buffers.pinned), "isPinnedPtr of mallocHost");
+    check(!devapis::isPinnedPtr(buffers.pageable.data()),
+          "isPinnedPtr of pageable memory");
+  }
+
+  devapis::memSetAsync(stream, buffers.device, 0x5a, kBytes);
+  devapis::memCopyD2HAsync(stream, kBytes, buffers.pinned, buffers.device);
+  devapis::syncStream(stream);
+  auto* pinned = static_cast<uint8_t*>(buffers.pinned);
+  check(std::all_of(pinned, pinned + kBytes,
+                    [](uint8_t value) { return value == 0x5a; }),
+        "memSetAsync / memCopyD2HAsync");
+
+  for (size_t i = 0; i < kBytes; ++i) {
+    buffers.pageable[i] = static_cast<uint8_t>(i * 7);
+  }
+  devapis::memCopyH2D(kBytes, buffers.device, buffers.pageable.data());
+  devapis::memCopyD2D(kBytes, 0, buffers.device2, 0, buffers.device);
+  std::vector<uint8_t> result(kBytes, 0);
+  devapis::memCopyD2H(kBytes, result.data(), buffers.device2);
+  check(result == buffers.pageable, "memCopyH2D / memCopyD2D / memCopyD2H");
+
+  std::memset(buffers.pinned, 0, kBytes);
+  devapis::memCopyH2DAsync(stream, kBytes, buffers.device,
+                           buffers.pageable.data());
+  devapis::memCopyD2DAsync(stream, kBytes, 0, buffers.device2, 0,
+                           buffers.device);
+  devapis::memCopyD2HAsync(stream, kBytes, buffers.pinned, buffers.device2);
+  devapis::syncStream(stream);
+  check(std::memcmp(buffers.pinned, buffers.pageable.data(), kBytes) == 0,
+        "memCopy*Async round trip");
+}
+
+void checkEvents(deviceStream_t stream, deviceStream_t other) {
+  constexpr size_t kBytes = 64 << 20;
+  Buffers buffers(kBytes);
+  deviceEvent_t start = nullptr;
+  deviceEvent_t end = nullptr;
+  devapis::createEvent(&start);
+  devapis::createEvent(&end);
+
+  devapis::recordEvent(start, stream);
+  devapis::memSetAsync(stream, buffers.device, 1, kBytes);
+  devapis::recordEvent(end, stream);
+  devapis::waitEvent(end);
+  check(devapis::getEventStatus(end) == devapis::EventStatus::READY,
+        "getEventStatus after waitEvent");
+  float ms = 0;
+  devapis::eventElapsedTime(&ms, start, end);
+  check(ms > 0, "eventElapsedTime", std::to_string(ms) + " ms");
+
+  devapis::syncStream(stream);
+  check(devapis::isStreamEmpty(stream), "isStreamEmpty after syncStream");
+
+  // `other` reads what `stream` writes only after waiting for it
+  devapis::memSetAsync(stream, buffers.device, 2, kBytes);
+  devapis::recordEvent(end, stream);
+  devapis::streamWaitEvent(other, end);
+  devapis::memCopyD2HAsync(other, kBytes, buffers.pinned, buffers.device);
+  devapis::syncStream(other);
+  auto* pinned = static_cast<uint8_t*>(buffers.pinned);
+  check(pinned[0] == 2 && pinned[kBytes - 1] == 2, "streamWaitEvent ordering");
+
+  devapis::destroyEvent(start);
+  devapis::destroyEvent(end);
+}
+
+void benchEvents(deviceStream_t stream, int iterations) {
+  std::vector<deviceEvent_t> events(iterations, nullptr);
+  int index = 0;
+  printLatency("createEvent", "-", timeIt(iterations, [&] {
+                 devapis::createEvent(&events[index++]);
+               }));
+  index = 0;
+  printLatency("recordEvent", "-", timeIt(iterations, [&] {
+                 devapis::recordEvent(events[index++], stream);
+               }));
+  devapis::syncStream(stream);
+  index = 0;
+  printLatency("getEventStatus", "-", timeIt(iterations, [&] {
+                 devapis::getEventStatus(events[index++]);
+               }));
+  index = 0;
+  printLatency("destroyEvent", "-", timeIt(iterations, [&] {
+                 devapis::destroyEvent(events[index++]);
+               }));
+}
+
+void benchMalloc(int iterations) {
+  for (size_t bytes : {size_t{4} << 10, size_t{1} << 20, size_t{64} << 20}) {
+    std::vector<void*> ptrs(iterations, nullptr);
+    int index = 0;
+    printLatency("mallocDevice", sizeName(bytes), timeIt(iterations, [&] {
+                   devapis::mallocDevice(&ptrs[index++], bytes);
+                 }));
+    index = 0;
+    printLatency("freeDevice", sizeName(bytes), timeIt(iterations, [&] {
+                   devapis::freeDevice(ptrs[index++]);
+                 }));
+  }
+}
+
+void benchCopies(deviceStream_t stream, int iterations) {
+  auto sync = [stream] { devapis::syncStream(stream); };
+  for (size_t bytes : {size_t{64} << 10, size_t{1} << 20, size_t{64} << 20}) {
+    Buffers b(bytes);
+    printBandwidth("memCopyH2DAsync pageable", bytes,
+                   timeIt(
+                       iterations,
+                       [&] {
+                         devapis::memCopyH2DAsync(stream, bytes, b.device,
+                                                  b.pageable.data());
+                       },
+                       sync));
+    printBandwidth("memCopyH2DAsync pinned", bytes,
+                   timeIt(
+                       iterations,
+                       [&] {
+                         devapis::memCopyH2DAsync(stream, bytes, b.device,
+                                                  b.pinned);
+                       },
+                       sync));
+    printBandwidth("memCopyD2HAsync pinned", bytes,
+                   timeIt(
+                       iterations,
+                       [&] {
+                         devapis::memCopyD2HAsync(stream, bytes, b.pinned,
+                                                  b.device);
+                       },
+                       sync));
+    printBandwidth("memCopyD2DAsync", bytes,
+                   timeIt(
+                       iterations,
+                       [&] {
+                         devapis::memCopyD2DAsync(stream, bytes, 0, b.device2,
+                                                  0, b.device);
+                       },
+                       sync));
+    printBandwidth("memCopyH2D", bytes, timeIt(iterations, [&] {
+                     devapis::memCopyH2D(bytes, b.device, b.pageable.data());
+                   }));
+    printBandwidth("memCopyD2H", bytes, timeIt(iterations, [&] {
+                     devapis::memCopyD2H(bytes, b.pageable.data(), b.device);
+                   }));
+    printBandwidth("memSetAsync", bytes,
+                   timeIt(
+                       iterations,
+                       [&] {
+                         devapis::memSetAsync(stream, b.device, 0, bytes);
+                       },
+                       sync));
+  }
+}
+
+// One round: `stream` records, `other` waits for it and records, the host
+// waits for `other`
+void benchStreamWait(deviceStream_t stream, deviceStream_t other,
+                     int iterations) {
+  deviceEvent_t event = nullptr;
+  deviceEvent_t done = nullptr;
+  devapis::createEvent(&event);
+  devapis::createEvent(&done);
+  printLatency("streamWaitEvent round trip", "-", timeIt(iterations, [&] {
+                 devapis::recordEvent(event, stream);
+                 devapis::streamWaitEvent(other, event);
+                 devapis::recordEvent(done, other);
+                 devapis::waitEvent(done);
+               }));
+  printLatency("syncStream of empty stream", "-", timeIt(iterations, [&] {
+                 devapis::syncStream(stream);
+               }));
+  devapis::destroyEvent(event);
+  devapis::destroyEvent(done);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 100;
+  devproxy::initializeVendor();
+
+  printf("== checks\n");
+  checkDevice();
+  deviceStream_t stream = nullptr;
+  deviceStream_t other = nullptr;
+  devapis::createStream(&stream);
+  devapis::createStream(&other);
+  check(devapis::streamNotNull(stream), "createStream");
+  checkMemory(stream);
+  checkEvents(stream, other);
+
+  printf("== latency and bandwidth, %d iterations\n", iterations);
+  benchEvents(stream, iterations);
+  benchMalloc(std::min(iterations, 16));
+  benchCopies(stream, iterations);
+  benchStreamWait(stream, other, iterations);
+
+  devapis::destroyStream(stream);
+  devapis::destroyStream(other);
+  devproxy::finalizeVendor();
+  printf("== %d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
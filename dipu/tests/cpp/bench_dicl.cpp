@@ -0,0 +1,296 @@
+// Copyright (c) 2024, DeepLink.
+// Bandwidth of DICL collectives through ProcessGroupDICL and directly through
+// devproxy::dicl* on a communicator of our own, for several sizes and dtypes.
+// The gap between the two is the overhead of the process group: flattening,
+// event record / wait and syncing the comm stream with the current one.
+// usage: torchrun --no-python --nproc_per_node=N bench_dicl [iterations]
+//        [max_bytes]
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <torch/csrc/distributed/c10d/PrefixStore.hpp>
+#include <torch/csrc/distributed/c10d/TCPStore.hpp>
+#include <torch/torch.h>
+
+#include <csrc_dipu/runtime/core/DIPUStream.h>
+#include <csrc_dipu/runtime/devproxy/deviceproxy.h>
+#include <csrc_dipu/runtime/devproxy/diclproxy.h>
+#include <csrc_dipu/runtime/distributed/ProcessGroupDICL.h>
+
+using namespace dipu;
+
+namespace {
+
+int envInt(const char* name, int fallback) {
+  const char* value = std::getenv(name);
+  return value != nullptr ? std::atoi(value) : fallback;
+}
+
+struct Bench {
+  const char* name;
+  c10d::OpType type;
+};
+
+const std::vector<Bench>& benches() {
+  static const std::vector<Bench> list = {
+      {"allreduce", c10d::OpType::ALLREDUCE},
+      {"allgather", c10d::OpType::_ALLGATHER_BASE},
+      {"reduce_scatter", c10d::OpType::_REDUCE_SCATTER_BASE},
+      {"broadcast", c10d::OpType::BROADCAST},
+      {"alltoall", c10d::OpType::ALLTOALL_BASE},
+      // even ranks with the next odd one, both ways
+      {"sendrecv", c10d::OpType::SEND},
+  };
+  return list;
+}
+
+// `bytes` is the larger of input and output, as nccl-tests counts them
+struct Buffers {
+  at::Tensor input;
+  at::Tensor output;
+  int64_t bytes = 0;
+};
+
+Buffers makeBuffers(const Bench& bench, int64_t count, int ranks,
+                    at::ScalarType dtype) {
+  auto options = at::TensorOptions().dtype(dtype).device(
+      DIPU_DEVICE_TYPE, devproxy::current_device());
+  const auto chunk = count / ranks;
+  Buffers buffers;
+  switch (bench.type) {
+    case c10d::OpType::_ALLGATHER_BASE:
+      buffers = {at::ones({chunk}, options),
+                 at::empty({chunk * ranks}, options)};
+      break;
+    case c10d::OpType::_REDUCE_SCATTER_BASE:
+      buffers = {at::ones({chunk * ranks}, options),
+                 at::empty({chunk}, options)};
+      break;
+    default:
+      buffers = {at::ones({chunk * ranks}, options),
+                 at::empty({chunk * ranks}, options)};
+  }
+  buffers.bytes = static_cast<int64_t>(
+      std::max(buffers.input.nbytes(), buffers.output.nbytes()));
+  return buffers;
+}
+
+void runProcessGroup(ProcessGroupDICL& pg, const Bench& bench,
+                     Buffers& buffers) {
+  std::vector<at::Tensor> inputs{buffers.input};
+  std::vector<at::Tensor> outputs{buffers.output};
+  std::vector<int64_t> splits;
+  const int peer = pg.getRank() ^ 1;
+  switch (bench.type) {
+    case c10d::OpType::ALLREDUCE:
+      pg.allreduce(inputs, c10d::AllreduceOptions())->wait();
+      break;
+    case c10d::OpType::_ALLGATHER_BASE:
+      pg._allgather_base(buffers.output, buffers.input,
+                         c10d::AllgatherOptions())
+          ->wait();
+      break;
+    case c10d::OpType::_REDUCE_SCATTER_BASE:
+      pg._reduce_scatter_base(buffers.output, buffers.input,
+                              c10d::ReduceScatterOptions())
+          ->wait();
+      break;
+    case c10d::OpType::BROADCAST:
+      pg.broadcast(inputs, c10d::BroadcastOptions())->wait();
+      break;
+    case c10d::OpType::ALLTOALL_BASE:
+      pg.alltoall_base(buffers.output, buffers.input, splits, splits,
+                       c10d::AllToAllOptions())
+          ->wait();
+      break;
+    default:
+      // the pair shares one stream, so the order must match
+      if (pg.getRank() % 2 == 0) {
+        pg.send(inputs, peer, 0)->wait();
+        pg.recv(outputs, peer, 0)->wait();
+      } else {
+        pg.recv(outputs, peer, 0)->wait();
+        pg.send(inputs, peer, 0)->wait();
+      }
+  }
+}
+
+// Only the vendor calls, no events, stream syncs or copies. `pairComm` is
+// only used by sendrecv.
+void runDirect(DICLComm& comm, DICLComm* pairComm, int rank, int ranks,
+               const Bench& bench, Buffers& buffers) {
+  auto* input = buffers.input.data_ptr();
+  auto* output = buffers.output.data_ptr();
+  const auto dtype = buffers.input.scalar_type();
+  const auto stream = comm.diclStream_.rawstream();
+  const auto chunk = static_cast<size_t>(buffers.input.numel() / ranks);
+  const auto count = static_cast<size_t>(buffers.input.numel());
+  switch (bench.type) {
+    case c10d::OpType::ALLREDUCE:
+      devproxy::diclAllReduce(input, output, count, dtype, c10d::ReduceOp::SUM,
+                              comm.rawComm(), stream);
+      break;
+    case c10d::OpType::_ALLGATHER_BASE:
+      devproxy::diclAllGather(input, output, count, dtype, comm.rawComm(),
+                              stream);
+      break;
+    case c10d::OpType::_REDUCE_SCATTER_BASE:
+      devproxy::diclReduceScatter(input, output, chunk, dtype,
+                                  c10d::ReduceOp::SUM, comm.rawComm(), stream);
+      break;
+    case c10d::OpType::BROADCAST:
+      devproxy::diclBroadcast(input, input, count, dtype, 0, comm.rawComm(),
+                              stream);
+      break;
+    case c10d::OpType::ALLTOALL_BASE:
+      devproxy::diclAllToAll(input, output, chunk, dtype, ranks,
+                             comm.rawComm(), stream);
+      break;
+    default: {
+      const auto pairStream = pairComm->diclStream_.rawstream();
+      const int peer = 1 - rank % 2;
+      if (rank % 2 == 0) {
+        devproxy::diclSend(input, count, dtype, peer, pairComm->rawComm(),
+                           pairStream);
+        devproxy::diclRecv(output, count, dtype, peer, pairComm->rawComm(),
+                           pairStream);
+      } else {
+        devproxy::diclRecv(output, count, dtype, peer, pairComm->rawComm(),
+                           pairStream);
+        devproxy::diclSend(input, count, dtype, peer, pairComm->rawComm(),
+                           pairStream);
+      }
+    }
+  }
+}
+
+// Microseconds per call, after a warm-up call and a barrier so that all
+// ranks start together
+template <typename Fn>
+double timeUs(ProcessGroupDICL& pg, Fn fn, int iterations) {
+  fn();
+  devproxy::syncDevice();
+  pg.barrier(c10d::BarrierOptions())->wait();
+  devproxy::syncDevice();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    fn();
+  }
+  devproxy::syncDevice();
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+std::shared_ptr<DICLComm> createComm(c10d::Store& store,
+                                     const std::string& key, int ranks,
+                                     int rank) {
+  commUniqueId id;
+  if (rank == 0) {
+    devproxy::diclGetUniqueId(&id);
+    auto* begin = reinterpret_cast<uint8_t*>(&id);
+    store.set(key, std::vector<uint8_t>(
+                       begin, begin + devapis::DICL_UNIQUE_ID_BYTES_SIZE));
+  } else {
+    auto bytes = store.get(key);
+    TORCH_CHECK(bytes.size() == devapis::DICL_UNIQUE_ID_BYTES_SIZE,
+                "unexpected DICL unique ID length");
+    std::memcpy(&id, bytes.data(), bytes.size());
+  }
+  auto stream = getDIPUStreamFromPool(true, devproxy::current_device());
+  return DICLComm::create(ranks, rank, id, stream);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 20;
+  const int64_t maxBytes = argc > 2 ? std::atoll(argv[2]) : int64_t{1} << 28;
+  const int rank = envInt("RANK", 0);
+  const int ranks = envInt("WORLD_SIZE", 1);
+  devproxy::setDevice(
+      static_cast<c10::DeviceIndex>(envInt("LOCAL_RANK", rank)));
+
+  // torchrun already serves the store on MASTER_PORT
+  const char* agentStore = std::getenv("TORCHELASTIC_USE_AGENT_STORE");
+  const char* host = std::getenv("MASTER_ADDR");
+  c10d::TCPStoreOptions storeOptions;
+  storeOptions.port = static_cast<uint16_t>(envInt("MASTER_PORT", 29500));
+  storeOptions.isServer = rank == 0 && (agentStore == nullptr ||
+                                        std::strcmp(agentStore, "True") != 0);
+  storeOptions.numWorkers = ranks;
+  auto tcpStore = c10::make_intrusive<c10d::TCPStore>(
+      host != nullptr ? host : "127.0.0.1", storeOptions);
+  auto store = c10::make_intrusive<c10d::PrefixStore>("bench_dicl", tcpStore);
+
+  auto pg = createProcessGroupDICL(
+      c10::make_intrusive<c10d::PrefixStore>("pg", store), rank, ranks,
+      kBackendDefaultTimeout);
+  auto comm = createComm(*store, "comm", ranks, rank);
+  // the last rank of an odd world has no pair and skips sendrecv
+  const bool paired = (rank ^ 1) < ranks;
+  std::shared_ptr<DICLComm> pairComm;
+  if (paired) {
+    pairComm =
+        createComm(*store, "pair" + std::to_string(rank / 2), 2, rank % 2);
+  }
+
+  const std::vector<at::ScalarType> dtypes = {at::kFloat, at::kHalf};
+  if (rank == 0) {
+    printf("%-15s %-6s %12s %10s %9s %9s %10s %9s %9s %10s\n", "op", "dtype",
+           "bytes", "c10d_us", "algbw", "busbw", "dicl_us", "algbw", "busbw",
+           "overhead");
+  }
+  for (const auto& bench : benches()) {
+    const bool p2p = bench.type == c10d::OpType::SEND;
+    if (p2p && ranks < 2) {
+      continue;
+    }
+    const auto busFactor = collectiveBusFactor(bench.type, ranks);
+    for (auto dtype : dtypes) {
+      const auto elementSize = static_cast<int64_t>(c10::elementSize(dtype));
+      for (int64_t bytes = 1024; bytes <= maxBytes; bytes *= 4) {
+        auto buffers = makeBuffers(bench, bytes / elementSize, ranks, dtype);
+        if (buffers.bytes == 0) {
+          continue;
+        }
+        double c10dUs = 0;
+        double directUs = 0;
+        if (!p2p || paired) {
+          c10dUs = timeUs(
+              *pg, [&] { runProcessGroup(*pg, bench, buffers); }, iterations);
+          directUs = timeUs(
+              *pg,
+              [&] {
+                runDirect(*comm, pairComm.get(), rank, ranks, bench, buffers);
+              },
+              iterations);
+        } else {
+          // still take part in the barriers
+          timeUs(*pg, [] {}, iterations);
+          timeUs(*pg, [] {}, iterations);
+        }
+        if (rank != 0) {
+          continue;
+        }
+        // GB/s, bytes per microsecond / 1e3
+        const auto size = static_cast<double>(buffers.bytes);
+        const auto c10dAlgbw = size / c10dUs / 1e3;
+        const auto directAlgbw = size / directUs / 1e3;
+        printf("%-15s %-6s %12" PRId64
+               " %10.1f %9.2f %9.2f %10.1f %9.2f %9.2f %9.1f%%\n",
+               bench.name, c10::toString(dtype), buffers.bytes, c10dUs,
+               c10dAlgbw, c10dAlgbw * busFactor, directUs, directAlgbw,
+               directAlgbw * busFactor, (c10dUs - directUs) / directUs * 100);
+      }
+    }
+  }
+  return 0;
+}
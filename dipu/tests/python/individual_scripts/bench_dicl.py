@@ -0,0 +1,141 @@
+# Copyright (c) 2024, DeepLink.
+# Bandwidth of the dicl collectives through torch.distributed, next to the
+# time of their vendor calls as the collective stats of ProcessGroupDICL
+# measure it on the comm stream. The gap is the overhead of python, c10d and
+# the process group. tests/cpp/bench_dicl compares against devproxy directly.
+# usage: torchrun --nproc_per_node=N bench_dicl.py [--iters 20]
+#        [--max-bytes 268435456]
+import argparse
+import os
+import time
+
+import torch
+import torch.distributed as dist
+import torch_dipu
+from torch_dipu.dipu.distributed import (
+    collective_stats,
+    reset_collective_stats,
+    set_dicl_stats_enabled,
+)
+
+# stats op names, busbw / algbw factor as nccl-tests
+_BENCHES = {
+    "allreduce": (["ALLREDUCE"], lambda n: 2 * (n - 1) / n),
+    "allgather": (["_ALLGATHER_BASE"], lambda n: (n - 1) / n),
+    "reduce_scatter": (["_REDUCE_SCATTER_BASE"], lambda n: (n - 1) / n),
+    "broadcast": (["BROADCAST"], lambda n: 1),
+    "alltoall": (["ALLTOALL_BASE"], lambda n: (n - 1) / n),
+    "sendrecv": (["SEND", "RECV"], lambda n: 1),
+}
+
+
+def _buffers(name, count, world_size, dtype):
+    chunk = count // world_size
+    full = torch.ones(chunk * world_size, dtype=dtype).cuda()
+    if name == "allgather":
+        return torch.ones(chunk, dtype=dtype).cuda(), torch.empty_like(full)
+    if name == "reduce_scatter":
+        return full, torch.empty(chunk, dtype=dtype).cuda()
+    return full, torch.empty_like(full)
+
+
+def _run(name, src, dst, rank):
+    if name == "allreduce":
+        dist.all_reduce(src)
+    elif name == "allgather":
+        dist.all_gather_into_tensor(dst, src)
+    elif name == "reduce_scatter":
+        dist.reduce_scatter_tensor(dst, src)
+    elif name == "broadcast":
+        dist.broadcast(src, 0)
+    elif name == "alltoall":
+        dist.all_to_all_single(dst, src)
+    else:
+        # even ranks with the next odd one, the order must match
+        peer = rank ^ 1
+        if rank % 2 == 0:
+            dist.send(src, peer)
+            dist.recv(dst, peer)
+        else:
+            dist.recv(dst, peer)
+            dist.send(src, peer)
+
+
+def _vendor_ms(ops, calls):
+    # the watchdog adds the works as they finish
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        stats = {item["op"]: item for item in collective_stats()}
+        if all(stats.get(op, {}).get("calls", 0) >= calls for op in ops):
+            return sum(stats[op]["device_ms"] for op in ops) / calls
+        time.sleep(0.01)
+    return float("nan")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--iters", type=int, default=20)
+    parser.add_argument("--max-bytes", type=int, default=1 << 28)
+    args = parser.parse_args()
+
+    rank = int(os.environ["RANK"])
+    world_size = int(os.environ["WORLD_SIZE"])
+    torch.cuda.set_device(int(os.environ.get("LOCAL_RANK", rank)))
+    dist.init_process_group("nccl")
+
+    if rank == 0:
+        print(
+            f"{'op':<15} {'dtype':<9} {'bytes':>12} {'c10d_us':>10} {'algbw':>9} "
+            f"{'busbw':>9} {'vendor_us':>10} {'algbw':>9} {'busbw':>9}"
+        )
+    # the last rank of an odd world has no pair
+    paired = (rank ^ 1) < world_size
+    for name, (ops, bus_factor) in _BENCHES.items():
+        if name == "sendrecv" and world_size < 2:
+            continue
+        for dtype in [torch.float, torch.half]:
+            element_size = torch.tensor([], dtype=dtype).element_size()
+            size = 1024
+            while size <= args.max_bytes:
+                src, dst = _buffers(name, size // element_size, world_size, dtype)
+                size *= 4
+                nbytes = max(src.numel(), dst.numel()) * element_size
+                if nbytes == 0:
+                    continue
+                iters = args.iters if name != "sendrecv" or paired else 0
+                # the warm-up, the barrier and the wall clock pass are not
+                # timed on the comm stream
+                set_dicl_stats_enabled(False)
+                for _ in range(min(iters, 1)):
+                    _run(name, src, dst, rank)
+                torch.cuda.synchronize()
+                dist.barrier()
+                torch.cuda.synchronize()
+                start = time.perf_counter()
+                for _ in range(iters):
+                    _run(name, src, dst, rank)
+                torch.cuda.synchronize()
+                c10d_us = (time.perf_counter() - start) / args.iters * 1e6
+                set_dicl_stats_enabled(True)
+                reset_collective_stats()
+                for _ in range(iters):
+                    _run(name, src, dst, rank)
+                torch.cuda.synchronize()
+                set_dicl_stats_enabled(False)
+                if rank != 0:
+                    continue
+                vendor_us = _vendor_ms(ops, args.iters) * 1e3
+                c10d_algbw = nbytes / c10d_us / 1e3
+                vendor_algbw = nbytes / vendor_us / 1e3
+                factor = bus_factor(world_size)
+                print(
+                    f"{name:<15} {str(dtype)[6:]:<9} {nbytes:>12} {c10d_us:>10.1f} "
+                    f"{c10d_algbw:>9.2f} {c10d_algbw * factor:>9.2f} "
+                    f"{vendor_us:>10.1f} {vendor_algbw:>9.2f} "
+                    f"{vendor_algbw * factor:>9.2f}"
+                )
+    dist.destroy_process_group()
+
+
+if __name__ == "__main__":
+    main()
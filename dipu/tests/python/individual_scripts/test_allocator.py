@@ -73,6 +73,83 @@ def test_allocator(
     )
 
 
+def test_allocator_multithread(algorithm: str, num_threads: int):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = algorithm
+    os.environ["DIPU_MEM_CHECK"] = "1"
+    os.environ["DIPU_MEM_CHECK_LOG_INTERVAL"] = "100000"
+    import torch
+    import torch_dipu
+    import threading
+
+    def worker(seed: int):
+        tensors = []
+        for i in range(2000):
+            nbytes = (seed * 131 + i * 17) % (64 << 10)
+            x = torch.empty(size=(nbytes,), dtype=torch.uint8, device="dipu")
+            assert x.numel() == nbytes
+            tensors.append(x)
+            if len(tensors) > 16:
+                tensors.pop(0)
+
+    threads = [
+        threading.Thread(target=worker, args=(i,)) for i in range(num_threads)
+    ]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_allocated() == 0
+    assert torch.cuda.memory_reserved() == 0
+    print(f"allocate small blocks in {num_threads} threads use {algorithm} success")
+
+
+def test_allocator_stream_ordered(algorithm: str, flush_interval: int):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = algorithm
+    os.environ["DIPU_ASYNC_RESOURCE_POOL_STREAM_ORDERED"] = "1"
+    os.environ["DIPU_ASYNC_RESOURCE_POOL_FLUSH_INTERVAL"] = str(flush_interval)
+    import torch
+    import torch_dipu
+
+    side = torch.cuda.Stream()
+    for i in range(1000):
+        x = torch.ones(size=(i + 1,), device="dipu")
+        with torch.cuda.stream(side):
+            y = torch.ones(size=(4096,), device="dipu")
+            y.add_(x.sum())
+        torch.cuda.current_stream().wait_stream(side)
+        x.record_stream(side)
+        y.record_stream(torch.cuda.current_stream())
+        assert y[0].item() == i + 2
+        del x, y
+
+    torch.cuda.synchronize()
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_allocated() == 0
+    assert torch.cuda.memory_reserved() == 0
+    print(f"stream ordered freeing use {algorithm} success")
+
+
+def test_allocator_huge_page_pin_memory(algorithm: str):
+    os.environ["DIPU_HOST_MEMCACHING_ALGORITHM"] = algorithm
+    os.environ["DIPU_HOST_HUGE_PAGE_MIN_SIZE"] = "4"
+    import torch
+    import torch_dipu
+
+    # not a multiple of the huge page size, the block is rounded up
+    numel = (64 << 20) + 12345
+    src = torch.arange(numel, dtype=torch.int32) % 251
+    pin = src.pin_memory()
+    assert pin.is_pinned()
+    dev = pin.to("dipu", non_blocking=True)
+    back = torch.empty_like(pin).pin_memory()
+    back.copy_(dev, non_blocking=True)
+    torch.cuda.synchronize()
+    assert torch.equal(back, src)
+    print(f"huge page pin memory use {algorithm} success")
+
+
 if __name__ == "__main__":
     MAX_ALLOCATE = 1 << 15
     run_individual_test_cases(
@@ -87,3 +164,34 @@ if __name__ == "__main__":
         ),
         in_parallel=False,
     )
+    run_individual_test_cases(
+        itertools.product(
+            (test_allocator_multithread,),
+            (
+                {"args": ("BF", 4)},
+                {"args": ("BS", 4)},
+            ),
+        ),
+        in_parallel=False,
+    )
+    run_individual_test_cases(
+        itertools.product(
+            (test_allocator_huge_page_pin_memory,),
+            (
+                {"args": ("BF",)},
+                {"args": ("RAW",)},
+            ),
+        ),
+        in_parallel=False,
+    )
+    run_individual_test_cases(
+        itertools.product(
+            (test_allocator_stream_ordered,),
+            (
+                {"args": ("BF", 16)},
+                {"args": ("BS", 1)},
+                {"args": ("RAW", 16)},
+            ),
+        ),
+        in_parallel=False,
+    )
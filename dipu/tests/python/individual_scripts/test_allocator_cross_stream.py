@@ -0,0 +1,42 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_cross_stream_reuse(numel: int):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = "BF"
+    os.environ["DIPU_BF_CROSS_STREAM_REUSE"] = "1"
+    import torch
+    import torch_dipu
+
+    side = torch.cuda.Stream()
+    x = torch.ones(numel, device="cuda")
+    side.wait_stream(torch.cuda.current_stream())
+    with torch.cuda.stream(side):
+        for _ in range(16):
+            y = x * 2
+    x.record_stream(side)
+    del x
+    reserved = torch.cuda.memory_reserved()
+
+    # the freed chunk is reused instead of growing the cache, whether or not
+    # the side stream is done with it
+    z = torch.full((numel,), 3.0, device="cuda")
+    assert torch.cuda.memory_reserved() == reserved
+
+    torch.cuda.synchronize()
+    assert y.sum().item() == 2 * numel
+    assert z.sum().item() == 3 * numel
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_cross_stream_reuse,),
+            (
+                {"args": (1 << 22,)},
+                {"args": (1 << 24,)},
+            ),
+        ),
+        in_parallel=False,
+    )
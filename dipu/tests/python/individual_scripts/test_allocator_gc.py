@@ -0,0 +1,47 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_allocator_gc(algorithm: str):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = algorithm
+    # any memory held beyond the current allocation is over the limit
+    os.environ["DIPU_ALLOCATOR_GC_THRESHOLD"] = "1e-9"
+    print("allocator algorithm:", algorithm)
+    import torch
+    import torch_dipu
+    from torch_dipu.dipu import MemPool, use_mem_pool
+
+    numel = 1 << 20
+    pool = MemPool()
+    with use_mem_pool(pool):
+        x = torch.empty(numel, device="cuda")
+    del x
+    assert torch.cuda.memory_reserved() > 0
+
+    # growing the cache gives back the idle memory of the freed tensor
+    y = torch.empty(numel * 2, device="cuda")
+    assert torch.cuda.memory_stats()["num_garbage_collections"] > 0
+    reserved = torch.cuda.memory_reserved()
+    pool.empty_cache()
+    torch.cuda.synchronize()
+    assert torch.cuda.memory_reserved() == reserved
+    if algorithm == "BS":
+        assert reserved == y.numel() * y.element_size()
+
+    del y
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_reserved() == 0
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_allocator_gc,),
+            (
+                {"args": ("BF",)},
+                {"args": ("BS",)},
+            ),
+        ),
+        in_parallel=False,
+    )
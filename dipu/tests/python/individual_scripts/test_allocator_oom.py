@@ -0,0 +1,71 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_out_of_memory_observer():
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = "BF"
+    os.environ["DIPU_OOM_RETRIES"] = "2"
+    import torch
+    import torch_dipu
+    from torch_dipu.dipu.memory import _attach_out_of_memory_observer
+
+    calls = []
+    held = [torch.empty(1 << 20, device="cuda")]
+
+    def observer(device, size, allocated, reserved):
+        calls.append((device, size))
+        held.clear()
+
+    _attach_out_of_memory_observer(observer)
+    total = torch.cuda.get_device_properties(0).total_memory
+    try:
+        torch.empty(total * 2, dtype=torch.uint8, device="cuda")
+        assert False, "allocation larger than the device should fail"
+    except RuntimeError:
+        pass
+    # called before every retry, and it freed the held tensor
+    assert len(calls) == 2, calls
+    assert calls[0][0] == 0 and calls[0][1] >= total * 2
+    assert not held
+    assert torch.cuda.memory_allocated() == 0
+
+
+def test_expandable_segments_defrag():
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = "BF"
+    os.environ["DIPU_BF_EXPANDABLE_SEGMENTS"] = "1"
+    os.environ["DIPU_BF_EXPANDABLE_SEGMENTS_DEFRAG"] = "1"
+    import torch
+    import torch_dipu
+
+    numel = 8 << 20
+    a = torch.empty(numel, dtype=torch.uint8, device="cuda")
+    b = torch.empty(numel, dtype=torch.uint8, device="cuda")
+    segments = torch.cuda.memory._snapshot()["segments"]
+    if not any(segment["is_expandable"] for segment in segments):
+        print("expandable segments not supported, skipped")
+        return
+
+    # the pages of `a` before `b` are unmapped although `b` is still used
+    del a
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_reserved() == numel
+    c = torch.empty(numel * 2, dtype=torch.uint8, device="cuda")
+    c.fill_(1)
+    b.fill_(2)
+    assert torch.cuda.memory_reserved() == numel * 3
+    assert c.cpu().eq(1).all() and b.cpu().eq(2).all()
+
+    del b, c
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_reserved() == 0
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_out_of_memory_observer, test_expandable_segments_defrag),
+            ({"args": ()},),
+        ),
+        in_parallel=False,
+    )
@@ -0,0 +1,54 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_allocator_profile(numel: int):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = "BF"
+    import tempfile
+    import torch
+    import torch_dipu
+    from torch_dipu.dipu import AllocatorProfile
+
+    def step():
+        x = torch.ones(numel, device="cuda")
+        y = [torch.empty(n, device="cuda") for n in (16, 1024, numel // 3)]
+        return (x * 2).sum().item()
+
+    with AllocatorProfile() as profile:
+        step()
+    assert sum(profile.peak_bytes) >= numel * 4
+
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_reserved() == 0
+    with tempfile.TemporaryDirectory() as path:
+        filename = os.path.join(path, "profile.json")
+        profile.save(filename)
+        AllocatorProfile.load(filename).warm_up()
+
+    reserved = torch.cuda.memory_reserved()
+    assert reserved >= sum(profile.peak_bytes)
+    assert torch.cuda.memory_allocated() == 0
+    # the warmed up step is served from the reserved segments
+    assert step() == numel * 2
+    assert torch.cuda.memory_reserved() == reserved
+
+    # nothing more is reserved once the profile is covered
+    profile.warm_up()
+    assert torch.cuda.memory_reserved() == reserved
+
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_reserved() == 0
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_allocator_profile,),
+            (
+                {"args": (1 << 20,)},
+                {"args": (1 << 24,)},
+            ),
+        ),
+        in_parallel=False,
+    )
@@ -0,0 +1,41 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_async_error_check(enabled: str):
+    os.environ["DIPU_ASYNC_ERROR_CHECK"] = enabled
+    import torch
+    import torch_dipu
+    from torch_dipu import _C
+
+    # the markers don't change what the ops compute
+    a = torch.ones(1 << 20, device="cuda")
+    for _ in range(100):
+        a = a + 1
+    in_flight = _C._dipu_describe_unfinished_ops()
+    assert torch.equal(a.cpu(), torch.full((1 << 20,), 101.0))
+
+    if enabled == "0":
+        assert in_flight == ""
+        assert _C._dipu_describe_unfinished_ops() == ""
+        return
+    # ops the device had not reached yet are named by their DIOPI function
+    if "unfinished ops" in in_flight:
+        assert "the first unfinished one is diopiAdd" in in_flight, in_flight
+    torch.cuda.synchronize()
+    finished = _C._dipu_describe_unfinished_ops()
+    assert finished == "async error check: all recorded ops finished", finished
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_async_error_check,),
+            (
+                {"args": ("0",)},
+                {"args": ("1",)},
+            ),
+        ),
+        in_parallel=False,
+    )
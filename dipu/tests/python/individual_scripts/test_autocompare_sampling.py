@@ -0,0 +1,50 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_autocompare_sampling(env: str, value: str, calls_per_sample: int):
+    os.environ[env] = value
+    import re
+    import torch
+    import torch_dipu
+    from torch_dipu import _C
+
+    a = torch.randn(64, device="cuda")
+    b = torch.randn(64, device="cuda")
+    calls = 10
+    for _ in range(calls):
+        out = torch.add(a, b)
+    assert torch.allclose(out.cpu(), a.cpu() + b.cpu())
+
+    report = _C._dipu_autocompare_report()
+    print(report)
+    sampled, dropped = map(
+        int, re.search(r"(\d+) sampled calls, (\d+) dropped", report).groups()
+    )
+    if sampled == 0:
+        # the wrappers were generated without autocompare
+        return
+    assert dropped == 0
+    rows = [line.split() for line in report.splitlines()[2:]]
+    # one row per output and input of each add overload
+    add_rows = [row for row in rows if row[0].startswith("add")]
+    assert add_rows, report
+    for _, _, compared, not_close, errors, max_abs, _ in add_rows:
+        # the device and the CPU agree on add
+        assert int(compared) == calls // calls_per_sample, report
+        assert int(not_close) == 0 and int(errors) == 0, report
+        assert float(max_abs) < 1e-4, report
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_autocompare_sampling,),
+            (
+                {"args": ("DIPU_AUTOCOMPARE_SAMPLE_INTERVAL", "2", 2)},
+                {"args": ("DIPU_AUTOCOMPARE_SAMPLE_RATE", "1", 1)},
+            ),
+        ),
+        in_parallel=False,
+    )
@@ -69,6 +69,27 @@ def _test_cpu_fallback():
     )
 
 
+def _test_cpu_fallback_write_back():
+    def fn():
+        x_cpu = torch.randn(64, 128)
+        y_cpu = torch.randn(64, 128)
+        x = x_cpu.cuda()
+        y = y_cpu.cuda()
+        out = torch.empty(64, 128).cuda()
+        torch.add(x, y, out=out)
+        # written back without a host sync, later work on the stream sees it
+        out.mul_(2)
+        assert torch.allclose(out.cpu(), (x_cpu + y_cpu) * 2)
+        z = torch.add(x[:, ::2], y[:, ::2])
+        assert torch.allclose(z.cpu(), x_cpu[:, ::2] + y_cpu[:, ::2])
+
+    test_fallback(
+        ["add.out"],
+        ["diopiAdd"],
+        fn,
+        ["cpu_fallback:\taten::add.out", "write back"],
+    )
+
 def _test_dipu_index_put_impl_fallback():
     def fn():
         dipu_tensor = torch.tensor([1, 2, 3, 4, 5]).cuda()
@@ -240,17 +261,83 @@ def _test_dipu_linear_backward_fallback():
     )
 
 
+def _test_foreach_device_fallback():
+    def fn():
+        xs = [torch.randn(3, 4).cuda() for _ in range(3)]
+        expected = [x.cpu() + 2 for x in xs]
+        torch._foreach_add_(xs, 2)
+        for x, e in zip(xs, expected):
+            assert x.is_cuda
+            assert torch.allclose(x.cpu(), e)
+
+    test_fallback(
+        ["_foreach_add_.Scalar"],
+        [],
+        fn,
+        ["fallback to per-tensor device loop, name=aten::_foreach_add_.Scalar"],
+    )
+
+
+def _test_fallback_stats():
+    with local_eviron({"DIPU_FORCE_FALLBACK_OPS_LIST": "add.Tensor"}):
+        import torch_dipu
+
+        torch_dipu.dipu.reset_fallback_stats()
+        x = torch.randn(3, 4).cuda()
+        for _ in range(3):
+            _ = x + x
+        stats = {item["op"]: item for item in torch_dipu.dipu.fallback_stats()}
+        add = stats["aten::add.Tensor"]
+        nbytes = x.numel() * x.element_size()
+        assert add["calls"] == 3
+        assert add["d2h_bytes"] == 3 * 2 * nbytes
+        assert add["h2d_bytes"] == 3 * nbytes
+        assert add["seconds"] > 0
+
+
+def _test_fallback_chain():
+    with local_eviron(
+        {
+            "DIPU_FORCE_FALLBACK_OPS_LIST": "add.Tensor,mul.Tensor",
+            "DIPU_CPU_FALLBACK_CHAIN_MB": "64",
+        }
+    ):
+        import torch_dipu
+
+        torch_dipu.dipu.reset_fallback_stats()
+        x_cpu = torch.randn(3, 4)
+        x = x_cpu.cuda()
+        y = x + x
+        # y is taken from its host copy
+        z = y * 2
+        assert torch.allclose(z.cpu(), x_cpu * 4)
+        stats = {item["op"]: item for item in torch_dipu.dipu.fallback_stats()}
+        assert stats["aten::mul.Tensor"]["d2h_bytes"] == 0
+
+        # written on the device, copied again
+        y.sub_(x)
+        z = y * 2
+        assert torch.allclose(z.cpu(), x_cpu * 2)
+        stats = {item["op"]: item for item in torch_dipu.dipu.fallback_stats()}
+        nbytes = x.numel() * x.element_size()
+        assert stats["aten::mul.Tensor"]["d2h_bytes"] == nbytes
+
+
 if __name__ == "__main__":
     run_individual_test_cases(
         [
             _test_dipu_fallback,
             _test_cpu_fallback,
+            _test_cpu_fallback_write_back,
             _test_dipu_index_put_impl_fallback,
             _test_dipu_copy_fallback_,
             _test_dipu_convolution_backward_overrideable_fallback,
             _test_dipu_convolution_overrideable_fallback,
             _test_dipu_silu_fallback,
             _test_dipu_linear_backward_fallback,
+            _test_foreach_device_fallback,
+            _test_fallback_stats,
+            _test_fallback_chain,
         ],
         in_parallel=True,
     )
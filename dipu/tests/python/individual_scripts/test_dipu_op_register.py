@@ -16,15 +16,34 @@ def _test_op_register(mode: Union[int, str]) -> None:
         _ = x + x
 
 
+def _test_lazy_op_register() -> None:
+    with local_eviron(
+        {"DIPU_LAZY_REGISTER_OP": "1", "DIPU_FORCE_FALLBACK_OPS_LIST": "mul.out"}
+    ):
+        import torch
+        import torch_dipu
+
+        x = torch.randn(3, 4)
+        y = x.cuda()
+        # the first call registers the op, later ones call it directly
+        for _ in range(2):
+            assert torch.allclose((y + y).cpu(), x + x)
+            assert torch.allclose((y * y).cpu(), x * x)
+            assert torch.allclose(torch.relu(y).cpu(), torch.relu(x))
+
+
 if __name__ == "__main__":
     run_individual_test_cases(
-        itertools.product(
-            (_test_op_register,),
-            (
-                {"args": (0,)},
-                {"args": (1,)},
-                {"args": ("",)},
+        itertools.chain(
+            itertools.product(
+                (_test_op_register,),
+                (
+                    {"args": (0,)},
+                    {"args": (1,)},
+                    {"args": ("",)},
+                ),
             ),
+            (_test_lazy_op_register,),
         ),
         in_parallel=True,
     )
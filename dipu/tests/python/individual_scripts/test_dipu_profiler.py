@@ -59,6 +59,205 @@ class TestProfiler(TestCase):
         with tempfile.TemporaryDirectory() as tmpdir:
             prof.export_chrome_trace(f"{tmpdir}/dipu_resnet18_profiler.json")
 
+    def test_memory_peak_attribution(self):
+        from torch_dipu.profiler import memory_peak_attribution, memory_peak_table
+
+        model = models.resnet18().cuda()
+        inputs = torch.randn(5, 3, 224, 224).cuda()
+        with local_eviron({"KINETO_LOG_LEVEL": "999"}):
+            with profile(
+                activities=[ProfilerActivity.CPU, ProfilerActivity.CUDA],
+                profile_memory=True,
+                with_stack=True,
+            ) as prof:
+                model(inputs).sum().backward()
+
+        result = memory_peak_attribution(prof)
+        self.assertGreater(result["peak_bytes"], 0)
+        self.assertNotIn("cpu", result["device"])
+        allocations = result["allocations"]
+        self.assertGreater(len(allocations), 0)
+        self.assertLessEqual(
+            sum(item["bytes"] for item in allocations), result["peak_bytes"]
+        )
+        self.assertTrue(any(item["op"].startswith("aten::") for item in allocations))
+        self.assertTrue(
+            any("resnet.py" in frame for item in allocations for frame in item["stack"])
+        )
+        self.assertIn("peak of", memory_peak_table(prof))
+
+    def test_profiler_counters(self):
+        from torch_dipu.profiler import set_counters, supported_counters
+
+        counters = supported_counters()
+        self.assertIsInstance(counters, list)
+        with self.assertRaisesRegex(RuntimeError, "not supported"):
+            set_counters(["no_such_counter"])
+        set_counters(counters)
+        set_counters([])
+
+    def test_skip_python_frames(self):
+        from torch_dipu.profiler import skip_python_frames, skipped_python_prefixes
+
+        model = models.resnet18().cuda()
+        inputs = torch.randn(5, 3, 224, 224).cuda()
+        skip_python_frames()
+        try:
+            self.assertGreater(len(skipped_python_prefixes()), 0)
+            with local_eviron({"KINETO_LOG_LEVEL": "999"}):
+                with profile(
+                    activities=[ProfilerActivity.CPU, ProfilerActivity.CUDA],
+                    with_stack=True,
+                ) as prof:
+                    model(inputs).sum().backward()
+        finally:
+            skip_python_frames(False)
+        self.assertEqual(skipped_python_prefixes(), [])
+
+        stacks = [frame for event in prof.events() for frame in event.stack]
+        self.assertTrue(any("resnet.py" in frame for frame in stacks))
+        self.assertFalse(any("torch/nn/functional.py" in frame for frame in stacks))
+
+    def test_trace_summary(self):
+        from torch_dipu.profiler import diff_summaries, summarize_trace
+
+        model = models.resnet18().cuda()
+        inputs = torch.randn(5, 3, 224, 224).cuda()
+        with local_eviron({"KINETO_LOG_LEVEL": "999"}):
+            with profile(
+                activities=[ProfilerActivity.CPU, ProfilerActivity.CUDA],
+                record_shapes=True,
+            ) as prof:
+                model(inputs).sum().backward()
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = f"{tmpdir}/trace.json"
+            prof.export_chrome_trace(path)
+            summary = summarize_trace(path)
+        self.assertIn("aten::conv2d", summary)
+        conv = summary["aten::conv2d"]
+        self.assertEqual(conv["calls"], 20)
+        self.assertGreater(conv["device_us"], 0)
+        self.assertIn("[5, 3, 224, 224]", " ".join(conv["shapes"]))
+
+        diff = diff_summaries(summary, summary)
+        self.assertEqual(len(diff), len(summary))
+        self.assertTrue(all(item["delta_us"] == 0 for item in diff))
+
+    def test_stream_overlap(self):
+        from torch_dipu.profiler import analyze_overlap, annotate_trace
+
+        x = torch.randn(512, 512).cuda()
+        side = torch.cuda.Stream()
+        with local_eviron({"KINETO_LOG_LEVEL": "999"}):
+            with profile(
+                activities=[ProfilerActivity.CPU, ProfilerActivity.CUDA]
+            ) as prof:
+                for _ in range(2):
+                    y = x @ x
+                    side.wait_stream(torch.cuda.current_stream())
+                    with torch.cuda.stream(side):
+                        z = y @ y
+                    w = y + 1
+                    torch.cuda.current_stream().wait_stream(side)
+                    (z + w).sum().item()
+                    prof.step()
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = f"{tmpdir}/trace.json"
+            prof.export_chrome_trace(path)
+            analysis = analyze_overlap(path)
+            annotate_trace(path, analysis, f"{tmpdir}/annotated.json")
+            with open(f"{tmpdir}/annotated.json") as f:
+                self.assertIn("critical path", f.read())
+        self.assertTrue(analysis)
+        self.assertGreaterEqual(len(analysis[0]["streams"]), 2)
+        for item in analysis:
+            # the critical path covers the step
+            self.assertAlmostEqual(
+                sum(item["critical_path"].values()), item["wall_us"], delta=1
+            )
+            self.assertEqual(item["comm_us"], 0)
+
+    def test_stream_overlap_attribution(self):
+        from torch_dipu.profiler import analyze_overlap
+
+        events = [
+            {"ph": "X", "cat": "user_annotation", "name": "ProfilerStep#0",
+             "pid": 1, "tid": 1, "ts": 0, "dur": 100},
+            {"ph": "X", "cat": "cpu_op", "name": "aten::_local_scalar_dense",
+             "pid": 1, "tid": 1, "ts": 0, "dur": 4},
+        ]
+        # name, stream, start, duration, launch
+        kernels = [
+            ("A", 7, 10, 30, 5),
+            ("B", 7, 45, 15, 42),
+            ("DiclAllreduce", 8, 40, 30, 8),
+            ("C", 7, 71, 19, 10),
+        ]
+        for i, (name, stream, ts, dur, launch) in enumerate(kernels):
+            events.append({"ph": "X", "cat": "kernel", "name": name, "pid": 0,
+                           "tid": stream, "ts": ts, "dur": dur})
+            events.append({"ph": "s", "cat": "ac2g", "id": i, "pid": 1,
+                           "tid": 1, "ts": launch})
+            events.append({"ph": "f", "cat": "ac2g", "id": i, "pid": 0,
+                           "tid": stream, "ts": ts, "bp": "e"})
+        (item,) = analyze_overlap(events)
+        self.assertEqual(item["wall_us"], 90)
+        # launched after the sync, A runs, C waits for the allreduce after A
+        self.assertEqual(
+            item["critical_path"],
+            {"compute": 49, "comm": 30, "host_launch": 6, "sync": 4,
+             "event_wait": 1, "other": 0},
+        )
+        self.assertEqual(item["overlap"], 0.5)
+        self.assertEqual(item["exposed_comm_us"], 15)
+        self.assertEqual(item["streams"][8]["busy_us"], 30)
+        self.assertEqual(item["streams"][8]["idle"]["event_wait"], 32)
+
+    def test_sampling_profiler(self):
+        from torch_dipu.profiler import SamplingProfiler
+
+        model = models.resnet18().cuda()
+        inputs = torch.randn(5, 3, 224, 224).cuda()
+        summaries = []
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = f"{tmpdir}/sampling.jsonl"
+            with SamplingProfiler(
+                every_n_steps=2, interval_s=3600, path=path, callback=summaries.append
+            ) as sampler:
+                for _ in range(4):
+                    model(inputs).sum().backward()
+                    sampler.step()
+                torch.cuda.synchronize()
+            with open(path) as f:
+                self.assertEqual(len(f.readlines()), 1)
+        self.assertEqual(len(summaries), 1)
+        ops = {item["name"]: item for item in summaries[0]}
+        self.assertIn("diopiConvolution2d", ops)
+        self.assertGreater(ops["diopiConvolution2d"]["calls"], 0)
+        self.assertGreater(ops["diopiConvolution2d"]["device_ms"], 0)
+    def test_trace_stream(self):
+        from torch_dipu.profiler import TraceStream
+
+        model = models.resnet18().cuda()
+        inputs = torch.randn(5, 3, 224, 224).cuda()
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = f"{tmpdir}/trace.pftrace"
+            # small chunks, so that the threads hand over several of them
+            with TraceStream(path, flush_interval_s=0.01, chunk_records=64) as trace:
+                for _ in range(2):
+                    model(inputs).sum().backward()
+                torch.cuda.synchronize()
+            self.assertGreater(trace.stats["records"], 0)
+            self.assertGreater(trace.stats["chunks"], 1)
+            with open(path, "rb") as f:
+                data = f.read()
+            self.assertEqual(len(data), trace.stats["bytes"])
+            # a sequence of Trace.packet fields
+            self.assertEqual(data[0], 0x0A)
+            self.assertIn(b"diopiConvolution2d", data)
+            self.assertIn(b"aten::conv2d", data)
 
 if __name__ == "__main__":
     run_tests()
@@ -0,0 +1,57 @@
+import itertools
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_graph_replay(numel: int):
+    import torch
+    import torch_dipu
+    from torch_dipu import dipu
+
+    if not dipu.is_graph_supported():
+        print("stream capture is not supported, skip")
+        return
+
+    static_input = torch.zeros(numel, device="cuda")
+    # warm up on a side stream before capturing
+    side = torch.cuda.Stream()
+    side.wait_stream(torch.cuda.current_stream())
+    with torch.cuda.stream(side):
+        static_output = static_input * 2 + 1
+    torch.cuda.current_stream().wait_stream(side)
+
+    g = torch.cuda.CUDAGraph()
+    with torch.cuda.graph(g):
+        assert torch.cuda.is_current_stream_capturing()
+        static_output = static_input * 2 + 1
+    assert not torch.cuda.is_current_stream_capturing()
+
+    for value in (1.0, 3.0):
+        static_input.copy_(torch.full((numel,), value))
+        g.replay()
+        torch.cuda.synchronize()
+        assert torch.allclose(static_output.cpu(), torch.full((numel,), value * 2 + 1))
+
+    # a second graph sharing the memory pool of the first one
+    h = torch.cuda.CUDAGraph()
+    with torch.cuda.graph(h, pool=g.pool()):
+        other_output = static_output - 1
+    g.replay()
+    h.replay()
+    torch.cuda.synchronize()
+    assert torch.allclose(other_output.cpu(), torch.full((numel,), 6.0))
+
+    g.reset()
+    h.reset()
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_graph_replay,),
+            (
+                {"args": (16,)},
+                {"args": (1 << 20,)},
+            ),
+        ),
+        in_parallel=False,
+    )
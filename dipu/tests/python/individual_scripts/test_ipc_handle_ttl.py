@@ -0,0 +1,38 @@
+import itertools
+import os
+import time
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_unopened_handle_expires(ttl: str):
+    os.environ["DIPU_IPC_HANDLE_TTL"] = ttl
+    import torch
+    import torch_dipu
+
+    if not torch_dipu._C._dipu_is_ipc_supported():
+        return
+    before = torch.cuda.memory_allocated()
+    x = torch.zeros(1 << 20, device="cuda")
+    # exported, but no process ever opens it
+    x.untyped_storage()._share_device_()
+    del x
+    time.sleep(0.1)
+    torch_dipu._C._dipu_collect_shared_storages()
+    if ttl == "0":
+        assert torch.cuda.memory_allocated() == before
+    else:
+        # kept for a receiver that may still open it
+        assert torch.cuda.memory_allocated() > before
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_unopened_handle_expires,),
+            (
+                {"args": ("0",)},
+                {"args": ("300",)},
+            ),
+        ),
+        in_parallel=False,
+    )
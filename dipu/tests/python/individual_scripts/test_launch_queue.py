@@ -0,0 +1,57 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_launch_queue(enabled: str):
+    os.environ["DIPU_LAUNCH_QUEUE"] = enabled
+    import torch
+    import torch_dipu
+
+    x = torch.randn(1024, device="cuda")
+    expected = (x.cpu().relu() * 2 + 1).exp().sqrt()
+
+    # queued launches mixed with ones launched directly
+    y = torch.relu(x)
+    y.mul_(2)
+    y.add_(torch.ones_like(y))
+    y = torch.sqrt(torch.exp(y))
+    assert torch.allclose(y.cpu(), expected, rtol=1e-4, atol=1e-4)
+
+    # an op launched directly waits for the queued producer of its input, held
+    # back on the launch thread
+    torch_dipu._C._dipu_delay_launch_queue(500)
+    y = torch.relu(x)
+    z = torch.exp(y)
+    assert torch.allclose(z.cpu(), x.cpu().relu().exp(), rtol=1e-4, atol=1e-4)
+
+    # the inputs are kept alive until the queued launch is done
+    out = torch.empty(1 << 20, device="cuda")
+    for _ in range(16):
+        torch.neg(torch.ones(1 << 20, device="cuda"), out=out)
+    torch.cuda.synchronize()
+    assert out.eq(-1).all().item()
+
+    # another stream sees the work queued before an event on the current one
+    event = torch.cuda.Event()
+    z = torch.tanh(torch.zeros(64, device="cuda"))
+    event.record()
+    stream = torch.cuda.Stream()
+    with torch.cuda.stream(stream):
+        event.wait()
+        z.add_(1)
+    stream.synchronize()
+    assert z.eq(1).all().item()
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_launch_queue,),
+            (
+                {"args": ("0",)},
+                {"args": ("1",)},
+            ),
+        ),
+        in_parallel=False,
+    )
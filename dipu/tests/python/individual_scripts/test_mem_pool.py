@@ -0,0 +1,57 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_mem_pool(numel: int):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = "BF"
+    import torch
+    import torch_dipu
+    from torch_dipu.dipu import MemPool, use_mem_pool
+
+    pool = MemPool()
+    other = MemPool()
+    assert pool.id != other.id
+
+    x = torch.empty(numel, device="cuda")
+    with use_mem_pool(pool):
+        y = torch.empty(numel, device="cuda")
+        with use_mem_pool(other):
+            w = torch.empty(numel, device="cuda")
+        # back to the outer pool
+        v = torch.empty(16, device="cuda")
+    del w, v
+
+    reserved = torch.cuda.memory_reserved()
+    del y
+    # memory freed in a private pool stays there
+    assert torch.cuda.memory_reserved() == reserved
+    z = torch.empty(numel * 2, device="cuda")
+    assert torch.cuda.memory_reserved() > reserved
+
+    reserved = torch.cuda.memory_reserved()
+    pool.empty_cache()
+    assert torch.cuda.memory_reserved() < reserved
+    assert torch.cuda.memory_allocated() > 0
+
+    with use_mem_pool(pool):
+        y = torch.ones(numel, device="cuda")
+    assert y.sum().item() == numel
+
+    del x, y, z
+    torch.cuda.empty_cache()
+    assert torch.cuda.memory_allocated() == 0
+    assert torch.cuda.memory_reserved() == 0
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_mem_pool,),
+            (
+                {"args": (1 << 20,)},
+                {"args": (1 << 24,)},
+            ),
+        ),
+        in_parallel=False,
+    )
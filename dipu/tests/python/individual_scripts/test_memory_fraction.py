@@ -0,0 +1,70 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_memory_limit(algorithm: str):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = algorithm
+    print("allocator algorithm:", algorithm)
+    import torch
+    import torch_dipu
+    from torch_dipu.dipu import (
+        get_per_process_memory_limit,
+        set_per_process_memory_limit,
+    )
+
+    mb = 1 << 20
+    limit = 64 * mb
+    torch.cuda.empty_cache()
+    set_per_process_memory_limit(limit)
+    assert get_per_process_memory_limit() == limit
+
+    def expect_oom(numel, message):
+        try:
+            torch.empty(numel, dtype=torch.uint8, device="cuda")
+        except RuntimeError as e:
+            assert message in str(e), str(e)
+        else:
+            assert False, "allocation beyond the limit should fail"
+
+    # more than the limit fails before touching the cache
+    expect_oom(limit * 2, "more than the memory limit")
+
+    a = torch.empty(32 * mb, dtype=torch.uint8, device="cuda")
+    b = torch.empty(32 * mb, dtype=torch.uint8, device="cuda")
+    expect_oom(32 * mb, "allowed to this process")
+
+    # the cached memory is given back to make room
+    del a, b
+    c = torch.empty(64 * mb, dtype=torch.uint8, device="cuda")
+    assert torch.cuda.memory_reserved() <= limit
+    del c
+
+    # a fraction of 0 is rejected rather than read as no limit
+    try:
+        torch.cuda.set_per_process_memory_fraction(0.0)
+    except RuntimeError as e:
+        assert "memory fraction" in str(e), str(e)
+    else:
+        assert False, "a memory fraction of 0 should be rejected"
+    assert get_per_process_memory_limit() == limit
+
+    set_per_process_memory_limit(0)
+    assert get_per_process_memory_limit() == 0
+    d = torch.empty(limit * 2, dtype=torch.uint8, device="cuda")
+    del d
+    torch.cuda.empty_cache()
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_memory_limit,),
+            (
+                {"args": ("BF",)},
+                {"args": ("BS",)},
+                {"args": ("RAW",)},
+            ),
+        ),
+        in_parallel=False,
+    )
@@ -0,0 +1,67 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_memory_snapshot(algorithm: str):
+    os.environ["DIPU_DEVICE_MEMCACHING_ALGORITHM"] = algorithm
+    print("allocator algorithm:", algorithm)
+    import pickle
+    import tempfile
+    import torch
+    import torch_dipu
+
+    torch.cuda.memory._record_memory_history(max_entries=1000)
+    x = torch.empty(1 << 20, device="cuda")
+    y = torch.empty(1 << 10, device="cuda")
+    address = x.data_ptr()
+    del y
+
+    snapshot = torch.cuda.memory._snapshot()
+    blocks = [
+        block
+        for segment in snapshot["segments"]
+        for block in segment["blocks"]
+        if block["state"] == "active_allocated"
+    ]
+    assert any(block["address"] == address for block in blocks)
+    for segment in snapshot["segments"]:
+        assert segment["total_size"] == sum(b["size"] for b in segment["blocks"])
+
+    trace = snapshot["device_traces"][x.device.index]
+    actions = [entry["action"] for entry in trace]
+    assert "alloc" in actions
+    assert "free_requested" in actions
+    assert any(e["action"] == "alloc" and e["addr"] == address for e in trace)
+
+    # the ring buffer keeps the latest entries only
+    for _ in range(1000):
+        torch.empty(16, device="cuda")
+    trace = torch.cuda.memory._snapshot()["device_traces"][x.device.index]
+    assert len(trace) == 1000
+    assert not any(e["action"] == "alloc" and e["addr"] == address for e in trace)
+
+    torch.cuda.memory._record_memory_history(enabled=None)
+    count = len(torch.cuda.memory._snapshot()["device_traces"][x.device.index])
+    torch.empty(16, device="cuda")
+    trace = torch.cuda.memory._snapshot()["device_traces"][x.device.index]
+    assert len(trace) == count
+
+    with tempfile.TemporaryDirectory() as path:
+        filename = os.path.join(path, "snapshot.pickle")
+        torch.cuda.memory._dump_snapshot(filename)
+        with open(filename, "rb") as f:
+            assert "segments" in pickle.load(f)
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_memory_snapshot,),
+            (
+                {"args": ("BF",)},
+                {"args": ("BS",)},
+            ),
+        ),
+        in_parallel=False,
+    )
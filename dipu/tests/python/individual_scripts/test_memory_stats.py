@@ -60,6 +60,16 @@ def test_mem_stats(algorithm: str, log_mask: int):
     assert torch.cuda.max_memory_allocated() == real_max_allocate
     assert torch.cuda.max_memory_reserved() > 0
 
+    stats = torch_dipu.dipu.memory_stats()
+    assert stats["allocated_bytes.all.current"] == 0
+    assert stats["reserved_bytes.all.current"] == 0
+    # 100 device tensors, plus copies from the host ones
+    assert stats["allocation.all.allocated"] >= 100
+    assert stats["allocation.all.allocated"] == stats["allocation.all.freed"]
+    assert stats["num_empty_cache"] >= 1
+    assert stats["segment.all.current"] == 0
+    assert sum(v for k, v in stats.items() if k.endswith(".allocated")) > 0
+
 
 if __name__ == "__main__":
     run_individual_test_cases(
@@ -0,0 +1,61 @@
+import itertools
+import os
+from utils.test_in_subprocess import run_individual_test_cases
+
+
+def test_philox_offset_block(block: str):
+    os.environ["DIPU_PHILOX_OFFSET_BLOCK"] = block
+    import threading
+    import torch
+    import torch_dipu
+    from torch_dipu import _C
+
+    gen = torch.Generator("cuda")
+    gen.manual_seed(7)
+
+    def reserve(states):
+        for _ in range(100):
+            states.append(_C._dipu_reserve_philox_offset(gen, 5))
+
+    # threads drawing at once never get the same offsets
+    per_thread = [[] for _ in range(4)]
+    threads = [threading.Thread(target=reserve, args=(s,)) for s in per_thread]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    states = [state for states in per_thread for state in states]
+    assert {seed for seed, _ in states} == {7}
+    # 5 offsets are rounded up to 8
+    offsets = sorted(offset for _, offset in states)
+    assert all(b - a >= 8 for a, b in zip(offsets, offsets[1:]))
+    for states in per_thread:
+        assert all(a[1] < b[1] for a, b in zip(states, states[1:]))
+
+    # a new seed or offset drops the offsets reserved before
+    gen.manual_seed(8)
+    assert _C._dipu_reserve_philox_offset(gen, 5) == (8, 0)
+    if hasattr(gen, "set_offset"):
+        gen.set_offset(1 << 20)
+        assert _C._dipu_reserve_philox_offset(gen, 5) == (8, 1 << 20)
+
+    # random ops draw at offsets of their own, the same seed repeats them
+    torch.manual_seed(1)
+    a = torch.empty(1000, device="cuda").uniform_()
+    b = torch.empty(1000, device="cuda").uniform_()
+    torch.manual_seed(1)
+    assert torch.equal(a, torch.empty(1000, device="cuda").uniform_())
+    assert not torch.equal(a, b)
+
+
+if __name__ == "__main__":
+    run_individual_test_cases(
+        itertools.product(
+            (test_philox_offset_block,),
+            (
+                {"args": ("0",)},
+                {"args": ("64",)},
+            ),
+        ),
+        in_parallel=False,
+    )
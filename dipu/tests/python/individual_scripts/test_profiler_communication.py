@@ -45,6 +45,12 @@ def demo_basic_ddp(rank, world_size, port):
     input.requires_grad = True
     labels = torch.randn(20, 5).to(rank)
 
+    from torch_dipu.profiler import align_time_base
+
+    offset = align_time_base()
+    if rank == 0:
+        assert offset == 0
+
     with profile(
         activities=[ProfilerActivity.CPU, ProfilerActivity.CUDA],
         profile_memory=True,
@@ -65,6 +71,7 @@ def demo_basic_ddp(rank, world_size, port):
     assert "LaunchKernel_DiclAllreduce" in profile_output
     with tempfile.TemporaryDirectory() as tmpdir:
         prof.export_chrome_trace(f"{tmpdir}/dipu_resnet18_profiler_{rank}.json")
+    torch_dipu.profiler.reset_time_base()
     cleanup()
 
 
@@ -97,6 +97,34 @@ def demo_basic_ddp(rank, world_size, port):
     cleanup()
 
 
+def demo_future(rank, world_size, port):
+    import torch_dipu
+    from torch.distributed.algorithms.ddp_comm_hooks import default_hooks
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    # chained callbacks run on the current stream after the allreduce
+    src = torch.ones((2, 4)).to(rank)
+    fut = dist.all_reduce(src, async_op=True).get_future()
+    doubled = fut.then(lambda f: f.value()[0] * 2).wait()
+    assert torch.allclose(doubled, torch.ones_like(doubled) * 2 * world_size)
+
+    # the future holds the outputs, not the reused flat buffer
+    dests = [torch.zeros(3).to(rank) for _ in range(world_size)]
+    work = dist.all_gather(dests, torch.ones(3).to(rank), async_op=True)
+    for value, dest in zip(work.get_future().wait(), dests):
+        assert value.data_ptr() == dest.data_ptr()
+
+    model = DDP(ToyModel().to(rank))
+    model.register_comm_hook(None, default_hooks.fp16_compress_hook)
+    for _ in range(2):
+        model(torch.randn(20, 10).to(rank)).sum().backward()
+    torch.cuda.synchronize()
+    assert model.module.net2.weight.grad is not None
+    cleanup()
+
+
 def demo_allreduce(rank, world_size, port):
     import torch_dipu
 
@@ -180,8 +208,8 @@ def demo_p2p(rank, world_size, port):
 
             reqs = dist.batch_isend_irecv([recv_op, send_op])
 
-            # dicl not really support group p2p (underlying device also not support it?)
-            # so, such test will block
+            # batched p2p is grouped, but only vendors implementing diclGroupStart
+            # and diclGroupEnd launch it at once, others would block on the order
             # reqs = dist.batch_isend_irecv([send_op, recv_op])
 
             for req in reqs:
@@ -190,6 +218,73 @@ def demo_p2p(rank, world_size, port):
     cleanup()
 
 
+def demo_comm_streams(rank, world_size, port):
+    # read when torch_dipu is loaded
+    os.environ["DIPU_DICL_COMM_STREAMS"] = "2"
+    os.environ["DIPU_DICL_COMM_STREAM_POLICY"] = "roundrobin"
+    import torch_dipu
+
+    setup(rank, world_size, port)
+
+    # independent collectives alternate between the two streams
+    tensors = [torch.ones(16).to(rank) * i for i in range(4)]
+    works = [dist.all_reduce(t, async_op=True) for t in tensors]
+    dest = torch.zeros(16 * world_size).to(rank)
+    src = torch.ones(16).to(rank)
+    works.append(dist.all_gather_into_tensor(dest, src, async_op=True))
+    for work in works:
+        work.wait()
+    for i, t in enumerate(tensors):
+        assert torch.allclose(t.cpu(), torch.ones(16) * i * world_size)
+    assert torch.allclose(dest.cpu(), torch.ones(16 * world_size))
+    cleanup()
+
+
+def demo_eager_init(rank, world_size, port):
+    # read when torch_dipu is loaded
+    os.environ["DIPU_DICL_EAGER_INIT"] = "2"
+    import torch_dipu
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    # the communicators already exist, only the warm-up runs again
+    pg = dist.distributed_c10d._get_default_group()
+    pg._get_backend(torch.device(rank)).eager_init([rank], warmup=True)
+    src = torch.ones(4).to(rank)
+    dist.all_reduce(src)
+    assert torch.allclose(src.cpu(), torch.ones(4) * world_size)
+    cleanup()
+
+
+def demo_strided_p2p(rank, world_size, port):
+    import torch_dipu
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    # transposed views are staged on the comm stream, no contiguous() needed
+    expected = torch.arange(12, dtype=torch.float).reshape(3, 4)
+    for _ in range(2):
+        if rank == 0:
+            src = expected.t().contiguous().to(rank).t()
+            assert not src.is_contiguous()
+            dist.send(src, 1)
+        elif rank == 1:
+            dst = torch.zeros(4, 3).to(rank).t()
+            dist.recv(dst, 0)
+            assert torch.equal(dst.cpu(), expected)
+
+    # the elements arrive in logical order, whatever the layout on either side
+    if rank == 0:
+        dist.send(expected.t().contiguous().to(rank).t(), 1)
+    elif rank == 1:
+        dst = torch.zeros(3, 4).to(rank)
+        dist.recv(dst, 0)
+        assert torch.equal(dst.cpu(), expected)
+    cleanup()
+
+
 def demo_allgather(rank, world_size, port):
     import torch_dipu
 
@@ -290,6 +385,34 @@ def demo_reducescatter(rank, world_size, port):
     cleanup()
 
 
+def demo_fusion_buffer(rank, world_size, port):
+    # read when torch_dipu is loaded, the fusion buffers are off by default
+    os.environ["DIPU_DICL_FUSION_BUFFER_MB"] = "1"
+    import torch_dipu
+
+    setup(rank, world_size, port)
+
+    # growing sizes reallocate the fusion buffer, separate outputs are
+    # unpacked one by one and the chunks of a bucket by a single copy
+    for numel in [4, 64, 4096]:
+        src = torch.full((numel,), rank + 1.0).to(rank)
+        dests = [torch.zeros(numel).to(rank) for _ in range(world_size)]
+        dist.all_gather(dests, src)
+        bucket = torch.zeros(world_size * numel).to(rank)
+        dist.all_gather([*bucket.chunk(world_size)], src)
+        for i in range(world_size):
+            assert torch.allclose(dests[i], torch.full((numel,), i + 1.0).to(rank))
+        assert torch.allclose(bucket, torch.cat(dests))
+
+        # another dtype gets its own buffer
+        srcs = [torch.ones(numel).half().to(rank) for _ in range(world_size)]
+        dst = torch.zeros(numel).half().to(rank)
+        dist.reduce_scatter(dst, srcs, op=dist.reduce_op.SUM)
+        expected = torch.full((numel,), float(world_size)).half().to(rank)
+        assert torch.allclose(dst, expected)
+    cleanup()
+
+
 def demo_reducescatter_base(rank, world_size, port):
     import torch_dipu
 
@@ -304,6 +427,331 @@ def demo_reducescatter_base(rank, world_size, port):
     cleanup()
 
 
+def demo_overlapped_matmul(rank, world_size, port):
+    import torch_dipu
+    from torch_dipu.dipu.distributed import allgather_matmul, matmul_reduce_scatter
+
+    setup(rank, world_size, port)
+
+    torch.manual_seed(rank)
+    shard = torch.randn(6, 8).to(rank)
+    weight = torch.randn(8, 5).to(rank)
+    expected_gathered = torch.empty(world_size * 6, 8).to(rank)
+    dist.all_gather_into_tensor(expected_gathered, shard)
+    # 4 pieces don't divide 6 rows, 3 of 2 rows are used
+    gathered, output = allgather_matmul(shard, weight, chunks=4)
+    assert torch.allclose(gathered, expected_gathered)
+    assert torch.allclose(output, expected_gathered @ weight, atol=1e-5)
+
+    full = torch.randn(world_size * 6, 8).to(rank)
+    expected = torch.empty(6, 5).to(rank)
+    dist.reduce_scatter_tensor(expected, full @ weight)
+    output = matmul_reduce_scatter(full, weight, chunks=2)
+    assert torch.allclose(output, expected, atol=1e-4)
+    cleanup()
+
+
+def demo_grad_buckets(rank, world_size, port):
+    import torch_dipu
+    from torch_dipu.dipu.distributed import GradBucketScheduler
+
+    setup(rank, world_size, port)
+
+    torch.manual_seed(0)
+    model = nn.Sequential(nn.Linear(8, 16), nn.ReLU(), nn.Linear(16, 4)).to(rank)
+    # 256 bytes, each param gets a bucket of its own
+    scheduler = GradBucketScheduler(model.parameters(), bucket_cap_mb=256 / 2**20)
+    assert len(scheduler.bucket_indices()) == 4
+    for step in range(2):
+        model.zero_grad()
+        torch.manual_seed(rank + step)
+        inputs = torch.randn(5, 8).to(rank)
+        model(inputs).sum().backward()
+        scheduler.finalize()
+        for param in model.parameters():
+            expected = param.grad.clone()
+            dist.all_reduce(expected)
+            # all ranks hold the average already
+            assert torch.allclose(param.grad * world_size, expected, atol=1e-5)
+    scheduler.remove()
+    cleanup()
+
+
+def demo_coalesced(rank, world_size, port):
+    import torch_dipu
+    from torch_dipu.dipu.utils import get_dipu_torch_version, torch_ver_200
+
+    setup(rank, world_size, port)
+
+    srcs = [torch.ones((2, 4)).to(rank), torch.ones(3, dtype=torch.int64).to(rank)]
+    dist.all_reduce_coalesced(srcs, op=dist.ReduceOp.SUM)
+    for src in srcs:
+        assert torch.allclose(torch.ones_like(src) * world_size, src)
+
+    # torch 2.0 has no coalescing manager taking a device alone
+    if get_dipu_torch_version() != torch_ver_200:
+        inputs = [torch.ones((2, 4)).to(rank), torch.ones(3).to(rank) * 2]
+        outputs = [
+            torch.zeros((2 * world_size, 4)).to(rank),
+            torch.zeros(3 * world_size).to(rank),
+        ]
+        with dist._coalescing_manager(device=torch.device(rank)):
+            for output, input in zip(outputs, inputs):
+                dist.all_gather_into_tensor(output, input)
+        torch.cuda.synchronize()
+        assert torch.allclose(outputs[0], torch.ones_like(outputs[0]))
+        assert torch.allclose(outputs[1], torch.ones_like(outputs[1]) * 2)
+    cleanup()
+
+
+def demo_alltoall(rank, world_size, port):
+    import torch_dipu
+
+    setup(rank, world_size, port)
+
+    # rank r sends r * world_size + i to rank i
+    src = torch.arange(world_size, dtype=torch.float32) + rank * world_size
+    dst = torch.zeros(world_size).to(rank)
+    dist.all_to_all_single(dst, src.to(rank))
+    expected = torch.arange(world_size, dtype=torch.float32) * world_size + rank
+    assert torch.allclose(dst.cpu(), expected)
+
+    # rank r sends i + 1 elements of value r to rank i
+    inputs = [torch.full((i + 1,), float(rank)).to(rank) for i in range(world_size)]
+    outputs = [torch.zeros(rank + 1).to(rank) for _ in range(world_size)]
+    dist.all_to_all(outputs, inputs)
+    for i, output in enumerate(outputs):
+        assert torch.allclose(output.cpu(), torch.full((rank + 1,), float(i)))
+
+    splits = [rank + 1] * world_size
+    dst = torch.zeros(sum(splits)).to(rank)
+    dist.all_to_all_single(
+        dst,
+        torch.cat(inputs),
+        output_split_sizes=splits,
+        input_split_sizes=[i + 1 for i in range(world_size)],
+    )
+    assert torch.allclose(dst.cpu(), torch.cat([o.cpu() for o in outputs]))
+    cleanup()
+
+
+def demo_gather_scatter(rank, world_size, port):
+    import torch_dipu
+    from torch_dipu.dipu.distributed import all_gather_v, reduce_scatter_v
+
+    setup(rank, world_size, port)
+
+    src = torch.full((2, 3), float(rank)).to(rank)
+    outputs = [torch.zeros(2, 3).to(rank) for _ in range(world_size)]
+    dist.gather(src, outputs if rank == 0 else None, dst=0)
+    if rank == 0:
+        for i, output in enumerate(outputs):
+            assert torch.allclose(output.cpu(), torch.full((2, 3), float(i)))
+
+    inputs = [torch.full((4,), float(i)).to(rank) for i in range(world_size)]
+    dst = torch.zeros(4).to(rank)
+    dist.scatter(dst, inputs if rank == 0 else None, src=0)
+    assert torch.allclose(dst.cpu(), torch.full((4,), float(rank)))
+
+    # rank r has r + 1 rows of value r
+    splits = [i + 1 for i in range(world_size)]
+    gathered = all_gather_v(torch.full((rank + 1, 2), float(rank)).to(rank), splits)
+    expected = torch.cat([torch.full((i + 1, 2), float(i)) for i in range(world_size)])
+    assert torch.allclose(gathered.cpu(), expected)
+
+    reduced = reduce_scatter_v(gathered, splits)
+    assert torch.allclose(reduced.cpu(), torch.full((rank + 1, 2), float(rank)) * world_size)
+
+    # integers average with truncation, the sum is 1 + 2 + ... + world_size
+    ints = torch.full((world_size, 2), rank + 1, dtype=torch.int32).to(rank)
+    averaged = reduce_scatter_v(ints, [1] * world_size, op=dist.ReduceOp.AVG)
+    expected = world_size * (world_size + 1) // 2 // world_size
+    assert torch.equal(averaged.cpu(), torch.full((1, 2), expected, dtype=torch.int32))
+    cleanup()
+
+
+def demo_desync_uneven_shapes(rank, world_size, port):
+    # read when torch_dipu is loaded
+    os.environ["DIPU_DICL_DESYNC_CHECK_INTERVAL"] = "1"
+    import time
+    import torch_dipu
+    from torch_dipu.dipu.distributed import all_gather_v
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    # the ranks pass inputs of different shapes, which is not a desync
+    inputs = [torch.full((i + 1,), float(rank)).to(rank) for i in range(world_size)]
+    outputs = [torch.zeros(rank + 1).to(rank) for _ in range(world_size)]
+    dist.all_to_all(outputs, inputs)
+    dst = torch.zeros(world_size * (rank + 1)).to(rank)
+    dist.all_to_all_single(
+        dst,
+        torch.cat(inputs),
+        output_split_sizes=[rank + 1] * world_size,
+        input_split_sizes=[i + 1 for i in range(world_size)],
+    )
+    splits = [i + 1 for i in range(world_size)]
+    all_gather_v(torch.full((rank + 1, 2), float(rank)).to(rank), splits)
+    torch.cuda.synchronize()
+    # the watchdog compares the hashes, a mismatch fails the next collective
+    time.sleep(1)
+    src = torch.ones(4).to(rank)
+    dist.all_reduce(src)
+    assert torch.allclose(src.cpu(), torch.full((4,), float(world_size)))
+    cleanup()
+
+
+def demo_hierarchical_allreduce(rank, world_size, port):
+    # read when torch_dipu is loaded, every 2 ranks act as a node
+    os.environ["DIPU_DICL_HIERARCHICAL_ALLREDUCE"] = "1"
+    os.environ["DIPU_DICL_HIERARCHICAL_ALLREDUCE_MIN_BYTES"] = "0"
+    os.environ["LOCAL_WORLD_SIZE"] = "2"
+    import torch_dipu
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    # 8 elements take the three steps, 3 can't be split across a node
+    for numel in [8, 3]:
+        src = torch.arange(numel, dtype=torch.float).to(rank) * (rank + 1)
+        dist.all_reduce(src)
+        expected = torch.arange(numel, dtype=torch.float) * sum(
+            range(1, world_size + 1)
+        )
+        assert torch.allclose(src.cpu(), expected)
+    cleanup()
+
+
+def demo_compressed_allreduce(rank, world_size, port):
+    # read when torch_dipu is loaded
+    os.environ["DIPU_DICL_COMPRESSED_ALLREDUCE"] = "int8"
+    os.environ["DIPU_DICL_COMPRESSED_ALLREDUCE_MIN_BYTES"] = "0"
+    import torch_dipu
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    # not a multiple of the block size, so padding is exercised too
+    expected = torch.linspace(-1, 1, 1000) * sum(range(1, world_size + 1))
+    for op in [dist.ReduceOp.SUM, dist.ReduceOp.AVG]:
+        src = torch.linspace(-1, 1, 1000).to(rank) * (rank + 1)
+        dist.all_reduce(src, op=op)
+        if op == dist.ReduceOp.AVG:
+            src *= world_size
+        assert torch.allclose(src.cpu(), expected, atol=0.02 * world_size)
+
+    # integers are never compressed
+    src = torch.arange(1000).to(rank)
+    dist.all_reduce(src)
+    assert torch.equal(src.cpu(), torch.arange(1000) * world_size)
+    cleanup()
+
+
+def demo_collective_stats(rank, world_size, port):
+    # read when torch_dipu is loaded
+    os.environ["DIPU_DICL_STATS"] = "1"
+    import time
+    import torch_dipu
+    from torch_dipu.dipu.distributed import collective_stats, reset_collective_stats
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    src = torch.ones(1 << 18).to(rank)
+    for _ in range(3):
+        dist.all_reduce(src)
+    torch.cuda.synchronize()
+    # the watchdog adds finished works to the stats
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        stats = {item["op"]: item for item in collective_stats()}
+        if stats.get("ALLREDUCE", {}).get("calls", 0) == 3:
+            break
+        time.sleep(0.1)
+    allreduce = stats["ALLREDUCE"]
+    assert allreduce["calls"] == 3
+    assert allreduce["bytes"] == 3 * src.numel() * src.element_size()
+    assert allreduce["device_ms"] > 0 and allreduce["algbw_gbps"] > 0
+
+    skew = {item["op"]: item for item in collective_stats(gather_skew=True)}
+    assert len(skew["ALLREDUCE"]["rank_device_ms"]) == world_size
+    assert skew["ALLREDUCE"]["skew_ms"] >= 0
+
+    reset_collective_stats()
+    assert "ALLREDUCE" not in {item["op"] for item in collective_stats()}
+    cleanup()
+
+
+def demo_flight_recorder(rank, world_size, port):
+    import time
+    import torch_dipu
+    from torch_dipu.dipu.distributed import flight_records
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+
+    src = torch.ones(16).to(rank)
+    dist.all_reduce(src)
+    dist.broadcast(src, 0)
+    torch.cuda.synchronize()
+    # the watchdog marks finished works
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        records = flight_records()
+        if records and all(item["state"] == "completed" for item in records):
+            break
+        time.sleep(0.1)
+    ops = [item["op"] for item in records]
+    assert ops[-2:] == ["ALLREDUCE", "BROADCAST"], ops
+    assert records[-1]["id"] == records[-2]["id"] + 1
+    assert records[-1]["numel"] == 16 and records[-1]["dtype"] == "Float"
+    assert all(item["state"] == "completed" for item in records)
+    cleanup()
+
+
+def demo_registered_buffers(rank, world_size, port):
+    # read when torch_dipu is loaded
+    os.environ["DIPU_DICL_REGISTER_BUFFERS"] = "1"
+    import torch_dipu
+    from torch_dipu.dipu.distributed import dicl_buffer_registration_enabled
+
+    torch.cuda.set_device(rank)
+    # segments of before the communicator, after it, and freed in between
+    before = torch.ones(1 << 20).to(rank)
+    setup(rank, world_size, port)
+    print(f"rank {rank} buffer registration {dicl_buffer_registration_enabled()}")
+    for _ in range(2):
+        after = torch.ones(1 << 22).to(rank)
+        dist.all_reduce(before)
+        dist.all_reduce(after)
+        torch.cuda.synchronize()
+        assert torch.all(after == world_size)
+        del after
+        torch.cuda.empty_cache()
+    assert torch.all(before == world_size**2)
+    cleanup()
+
+
+def demo_new_group_split(rank, world_size, port):
+    import torch_dipu
+    from torch_dipu.dipu.distributed import dicl_comm_split_supported
+
+    torch.cuda.set_device(rank)
+    setup(rank, world_size, port)
+    print(f"rank {rank} comm split {dicl_comm_split_supported()}")
+    # every rank alone, then the even ranks together
+    groups = [dist.new_group([r]) for r in range(world_size)]
+    evens = dist.new_group(list(range(0, world_size, 2)))
+    src = torch.ones(4).to(rank)
+    dist.all_reduce(src, group=groups[rank])
+    assert torch.allclose(src.cpu(), torch.ones(4))
+    if rank % 2 == 0:
+        dist.all_reduce(src, group=evens)
+        assert torch.allclose(src.cpu(), torch.ones(4) * ((world_size + 1) // 2))
+    cleanup()
+
+
 def demo_model_parallel(rank, world_size, port):
     print(f"Running DDP with model parallel example on rank {rank}.")
     backend = "nccl"
@@ -389,17 +837,36 @@ if __name__ == "__main__":
     world_size = 1
     run_demo(demo_basic_ddp, world_size, port)
     run_demo(demo_allreduce, world_size, port)
+    run_demo(demo_future, world_size, port)
     run_demo(demo_allgather, world_size, port)
+    run_demo(demo_comm_streams, world_size, port)
+    run_demo(demo_eager_init, world_size, port)
     run_demo(demo_reduce, world_size, port)
     run_demo(demo_reducescatter, world_size, port)
     run_demo(demo_reducescatter_base, world_size, port)
+    run_demo(demo_overlapped_matmul, world_size, port)
+    run_demo(demo_grad_buckets, world_size, port)
+    run_demo(demo_fusion_buffer, world_size, port)
+    run_demo(demo_coalesced, world_size, port)
+    run_demo(demo_alltoall, world_size, port)
+    run_demo(demo_gather_scatter, world_size, port)
+    run_demo(demo_desync_uneven_shapes, world_size, port)
+    run_demo(demo_compressed_allreduce, world_size, port)
+    run_demo(demo_collective_stats, world_size, port)
+    run_demo(demo_registered_buffers, world_size, port)
+    run_demo(demo_flight_recorder, world_size, port)
+    run_demo(demo_new_group_split, world_size, port)
 
     run_demo(demo_allgather_gloo, world_size, port)
 
     # need 2 card to run
     # run_demo(demo_p2p, world_size, port)
+    # run_demo(demo_strided_p2p, world_size, port)
     # run_demo(demo_bcast, world_size, port)
 
+    # need 4 cards to run
+    # run_demo(demo_hierarchical_allreduce, 4, port)
+
     # run_demo(demo_model_parallel, world_size)
 
     # run_demo(test_special_group_stuck, world_size)
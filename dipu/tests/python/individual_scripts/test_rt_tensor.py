@@ -98,6 +98,42 @@ def testStream():
     print(st1)
 
 
+def test_priority_stream():
+    import torch_dipu
+    from torch import cuda
+
+    low = cuda.Stream(0)
+    high = cuda.Stream(0, priority=-1)
+    assert low.priority == 0
+    assert high.priority == -1
+    assert high.priority_range() == (0, -1)
+    assert high.dipu_stream != low.dipu_stream
+    # the pool is reused round-robin
+    streams = [cuda.Stream(0, priority=-1) for _ in range(64)]
+    assert len({s.stream_id for s in streams}) < len(streams)
+
+    with cuda.stream(high):
+        x = torch.ones((2, 4), device="cuda") * 2
+    high.synchronize()
+    assert x.sum().item() == 16
+
+
+def test_external_stream():
+    import torch_dipu
+    from torch import cuda
+
+    # any raw stream works, use one owned by another dipu stream here
+    owner = cuda.Stream(0)
+    ext = cuda.ExternalStream(owner.dipu_stream, device=0)
+    assert ext.dipu_stream == owner.dipu_stream
+    assert ext.stream_id != owner.stream_id
+    with cuda.stream(ext):
+        assert cuda.current_stream().dipu_stream == owner.dipu_stream
+        x = torch.ones((2, 4), device="cuda") * 3
+    ext.synchronize()
+    assert x.sum().item() == 24
+
+
 def test_record_stream():
     stream = torch.cuda.Stream()
     s1 = torch.cuda.current_stream()
@@ -106,6 +142,22 @@ def test_record_stream():
     src1.record_stream(s1)
 
 
+def test_side_stream_reuse():
+    # memory freed on the default stream and reused by another stream must
+    # not be overwritten before the default stream is done with it
+    stream = torch.cuda.Stream()
+    for i in range(8):
+        x = torch.full((1 << 20,), float(i), device="cuda")
+        y = x * 2
+        del x
+        with torch.cuda.stream(stream):
+            z = torch.zeros(1 << 20, device="cuda")
+            w = torch.zeros(1 << 20, device="cuda")
+        stream.synchronize()
+        assert y.sum().item() == 2 * i * (1 << 20)
+        assert z.sum().item() == 0 and w.sum().item() == 0
+
+
 def testevent():
     import torch_dipu
     from torch import cuda
@@ -124,6 +176,32 @@ def testevent():
     print(elapsed)
 
 
+def test_cached_stream_and_event_calls():
+    from torch import cuda
+
+    # the stream objects of current_stream are cached
+    assert cuda.current_stream() is cuda.current_stream()
+    side = cuda.Stream(0)
+    with cuda.stream(side):
+        assert cuda.current_stream() == side
+        assert cuda.current_stream(0) is cuda.current_stream()
+    assert cuda.current_stream() != side
+
+    ev = cuda.Event()
+    assert ev.query()
+    x = torch.ones((1 << 20,), device="cuda")
+    # None means the current stream
+    ev.record()
+    ev.wait(side)
+    ev.wait()
+    with cuda.stream(side):
+        y = x * 2
+    ev.synchronize()
+    side.synchronize()
+    assert ev.query()
+    assert y.sum().item() == 2 * (1 << 20)
+
+
 def testDeviceProperties():
     print("device properties: ", torch.cuda.get_device_properties(0))
     print("device capability: ", torch.cuda.get_device_capability(0))
@@ -230,8 +308,12 @@ if __name__ == "__main__":
         testDeviceProperties()
         test_mem_get_info()
         testStream()
+        test_priority_stream()
+        test_external_stream()
         test_record_stream()
+        test_side_stream_reuse()
         testevent()
+        test_cached_stream_and_event_calls()
         test_type()
         test_complex_type()
         test_dipu_as_cuda_type()
@@ -24,6 +24,37 @@ class TestAdd(TestCase):
         y.add_(torch.ones_like(y))
         self.assertEqual(x.cpu(), y)
 
+    def test_add_output_layout(self):
+        # repeated calls with the same inputs reuse the inferred output
+        cases = [
+            (torch.randn(2, 3, 4, 5), torch.randn(2, 3, 4, 5)),
+            (
+                torch.randn(2, 3, 4, 5).to(memory_format=torch.channels_last),
+                torch.randn(2, 3, 4, 5).to(memory_format=torch.channels_last),
+            ),
+            (torch.randn(2, 3, 4, 5).permute(0, 2, 3, 1), torch.randn(1, 4, 5, 1)),
+            (torch.randn(3, 1), torch.randint(0, 10, (4,))),
+            (torch.randint(0, 10, (4,)), torch.tensor(1.5)),
+        ]
+        for _ in range(3):
+            for a, b in cases:
+                expected = a + b
+                result = a.cuda() + b.cuda()
+                self.assertEqual(result.dtype, expected.dtype)
+                self.assertEqual(result.stride(), expected.stride())
+                self.assertEqual(result.cpu(), expected)
+
+    def test_same_layout_output(self):
+        # contiguous inputs of the same shape and dtype skip the generic inference
+        a = torch.randint(0, 10, (2, 3, 4))
+        b = torch.randint(1, 10, (2, 3, 4))
+        for op in (torch.add, torch.div, torch.eq):
+            expected = op(a, b)
+            result = op(a.cuda(), b.cuda())
+            self.assertEqual(result.dtype, expected.dtype)
+            self.assertEqual(result.stride(), expected.stride())
+            self.assertEqual(result.cpu(), expected)
+
 
 if __name__ == "__main__":
     run_tests()
@@ -4,7 +4,7 @@ import torch_dipu
 import torch.nn as nn
 import torch.optim as optim
 from torch.cuda.amp import autocast, GradScaler
-from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests, onlyOn
 
 
 class TestAmp(TestCase):
@@ -29,6 +29,22 @@ class TestAmp(TestCase):
         expected_growth_result = torch.tensor(1, dtype=torch.int32)
         self.assertEqual(growth_tracker_.cpu(), expected_growth_result)
 
+    def test_amp_foreach_unscale(self):
+        grads = [
+            torch.full((4,), 4.0, device="cuda"),
+            torch.full((2, 3), 8.0, device="cuda", dtype=torch.float16),
+        ]
+        found_inf = torch.zeros(1, device="cuda")
+        inv_scale = torch.full((1,), 0.25, device="cuda")
+        torch._amp_foreach_non_finite_check_and_unscale_(grads, found_inf, inv_scale)
+        self.assertEqual(grads[0].cpu(), torch.full((4,), 1.0))
+        self.assertEqual(grads[1].cpu(), torch.full((2, 3), 2.0, dtype=torch.float16))
+        self.assertEqual(found_inf.item(), 0.0)
+
+        grads[1][0, 0] = float("inf")
+        torch._amp_foreach_non_finite_check_and_unscale_(grads, found_inf, inv_scale)
+        self.assertEqual(found_inf.item(), 1.0)
+
     def test_autocast(self):
         # Creates some tensors in default dtype (here assumed to be float32)
         a_float32 = torch.rand((8, 8), device="cuda")
@@ -71,6 +87,69 @@ class TestAmp(TestCase):
                 d_bfloat16 = torch.mm(a_float32, b_float32)
             self.assertEqual(d_bfloat16.dtype, torch.bfloat16)
 
+    def test_persistent_cast_cache(self):
+        from torch_dipu.dipu import amp
+
+        weight = torch.rand((8, 8), device="cuda", requires_grad=True)
+        inputs = torch.rand((8, 8), device="cuda")
+        amp.set_persistent_cast_cache(True)
+        try:
+            self.assertTrue(amp.is_persistent_cast_cache_enabled())
+            with torch.no_grad():
+                with torch.autocast("cuda", torch.float16):
+                    first = torch.mm(inputs, weight)
+                with torch.autocast("cuda", torch.float16):
+                    second = torch.mm(inputs, weight)
+                self.assertEqual(first.dtype, torch.float16)
+                self.assertEqual(first, second)
+
+                # in-place updates of the weight invalidate its cast
+                weight.mul_(2)
+                with torch.autocast("cuda", torch.float16):
+                    third = torch.mm(inputs, weight)
+                self.assertEqual(third, torch.mm(inputs, weight).half(), atol=1e-2, rtol=1e-2)
+                self.assertNotEqual(third, first)
+        finally:
+            amp.set_persistent_cast_cache(False)
+        self.assertFalse(amp.is_persistent_cast_cache_enabled())
+
+    @onlyOn("CUDA")
+    def test_scaled_mm(self):
+        from torch_dipu.dipu import amp
+
+        if not hasattr(torch, "float8_e4m3fn"):
+            return
+        a = torch.randn((16, 32), device="cuda")
+        b = torch.randn((32, 16), device="cuda")
+        a_scaling = amp.Fp8DelayedScaling()
+        b_scaling = amp.Fp8DelayedScaling()
+        # the first call scales by 1, the next ones by the amax history
+        for _ in range(2):
+            out = amp.scaled_mm(a, b, a_scaling, b_scaling)
+        self.assertEqual(out.dtype, torch.float16)
+        self.assertEqual(out.float(), a @ b, atol=0.5, rtol=0.1)
+        self.assertEqual(a_scaling.amax_history[0], a.abs().max())
+
+        # fp8 autocast falls back to fp16 unless the vendor supports fp8
+        amp.set_autocast_fp8_enabled(True)
+        try:
+            self.assertTrue(amp.is_autocast_fp8_enabled())
+            with torch.autocast("cuda", torch.float16):
+                out = torch.mm(a, b)
+            self.assertEqual(out.dtype, torch.float16)
+
+            # inputs needing grad stay in fp16, which has a backward
+            weight = b.clone().requires_grad_()
+            with torch.autocast("cuda", torch.float16):
+                out = torch.mm(a, weight)
+                linear_out = torch.nn.functional.linear(a, weight.t())
+            (out.float().sum() + linear_out.float().sum()).backward()
+            self.assertEqual(out.float(), a @ b, atol=0.5, rtol=0.1)
+            expected = a.t() @ torch.ones_like(out.float())
+            self.assertEqual(weight.grad, 2 * expected, atol=0.5, rtol=0.1)
+        finally:
+            amp.set_autocast_fp8_enabled(False)
+
     def test_gradscaler(self):
         """won't fail, only detecting errors"""
         # 确定 CUDA 可用
@@ -63,6 +63,79 @@ class TestCopy(TestCase):
         dst1.copy_(src)
         self.assertEqual(dst1.cpu(), src.cpu())
 
+    def test_hollow_host_copy_(self):
+        # views with big holes go through a contiguous relay
+        base_cpu = torch.rand((8, 256))
+        base_dipu = base_cpu.cuda()
+        self.assertEqual(base_dipu[:, ::64].cpu(), base_cpu[:, ::64])
+
+        dst_dipu = torch.zeros((8, 256), device="cuda")
+        dst_dipu[:, ::64] = base_cpu[:, :4]
+        dst_cpu = torch.zeros((8, 256))
+        dst_cpu[:, ::64] = base_cpu[:, :4]
+        self.assertEqual(dst_dipu.cpu(), dst_cpu)
+
+        dst_cpu = torch.zeros((8, 256))
+        dst_cpu[:, ::64].copy_(base_dipu[:, 1::64])
+        expected = torch.zeros((8, 256))
+        expected[:, ::64] = base_cpu[:, 1::64]
+        self.assertEqual(dst_cpu, expected)
+
+    def test_non_blocking_pageable_h2d_copy_(self):
+        # large enough to be split into several staging chunks
+        src = torch.randn(5 << 20)
+        expected = src.clone()
+        dst = torch.empty(src.shape, device="cuda")
+        dst.copy_(src, non_blocking=True)
+        # staged copies don't read src after copy_ returns
+        src.zero_()
+        torch.cuda.synchronize()
+        self.assertEqual(dst.cpu(), expected)
+
+    def test_peer_copy_(self):
+        if torch.cuda.device_count() < 2:
+            return
+        self.assertFalse(torch.cuda.can_device_access_peer(0, 0))
+        src = torch.rand((8, 16), device="cuda:0")
+        dst = torch.empty((16, 8), device="cuda:1")
+        # strided between devices
+        dst.t().copy_(src)
+        self.assertEqual(dst.t().cpu(), src.cpu())
+        dst = torch.empty((8, 4), device="cuda:1")
+        dst.copy_(src[:, ::4])
+        self.assertEqual(dst.cpu(), src[:, ::4].cpu())
+
+    def test_chunked_cast_copy_(self):
+        # more elements than one staging chunk holds
+        src = torch.randn(5 << 20)
+        for dtype in (torch.float16, torch.float64):
+            dst = torch.empty(src.shape, dtype=dtype, device="cuda")
+            dst.copy_(src)
+            self.assertEqual(dst.cpu(), src.to(dtype))
+            back = torch.empty(src.shape)
+            back.copy_(dst)
+            self.assertEqual(back, src.to(dtype).float())
+
+    def test_copy_many(self):
+        from torch_dipu.dipu import copy_many
+
+        shapes = [(3,), (4, 5), (0,), (7, 1, 2), (1 << 19,)]
+        srcs_cpu = [torch.randn(shape) for shape in shapes]
+        srcs_cpu.append(torch.randn((6, 4))[:, ::2])
+        dsts_dipu = [torch.empty(src.shape, device="cuda") for src in srcs_cpu]
+        copy_many(dsts_dipu, srcs_cpu)
+        for dst, src in zip(dsts_dipu, srcs_cpu):
+            self.assertEqual(dst.cpu(), src)
+
+        dsts_cpu = [torch.empty(src.shape) for src in srcs_cpu]
+        copy_many(dsts_cpu, dsts_dipu, non_blocking=True)
+        torch.cuda.synchronize()
+        for dst, src in zip(dsts_cpu, srcs_cpu):
+            self.assertEqual(dst, src)
+
+        with self.assertRaises(ValueError):
+            copy_many(dsts_cpu, srcs_cpu[:1])
+
 
 if __name__ == "__main__":
     run_tests()
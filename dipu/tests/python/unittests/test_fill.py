@@ -12,6 +12,34 @@ class TestFill(TestCase):
         y.fill_(2)
         self.assertEqual(x.cpu(), y.cpu())
 
+    def test_fill_memset_patterns(self):
+        # byte, 16 and 32 bit patterns, and values no memset can write
+        values = (0, -1, 1, 0.5, -2.25, float("inf"))
+        dtypes = (torch.float32, torch.float16, torch.bfloat16, torch.float64)
+        dtypes += (torch.int32, torch.int64, torch.int16, torch.int8, torch.bool)
+        for dtype in dtypes:
+            for value in values:
+                if not dtype.is_floating_point and value not in (0, -1, 1):
+                    continue
+                if dtype == torch.bool and value == -1:
+                    continue
+                x = torch.empty(5, 7, dtype=dtype).cuda()
+                x.fill_(value)
+                self.assertEqual(x.cpu(), torch.full((5, 7), value, dtype=dtype))
+
+    def test_fill_memset_views(self):
+        # a dense slice at an offset, a strided view and a transposed tensor
+        base = torch.zeros(4, 6).cuda()
+        base[1:3].fill_(3)
+        expected = torch.zeros(4, 6)
+        expected[1:3] = 3
+        self.assertEqual(base.cpu(), expected)
+        base[:, ::2].fill_(7)
+        expected[:, ::2] = 7
+        self.assertEqual(base.cpu(), expected)
+        base.t().zero_()
+        self.assertEqual(base.cpu(), torch.zeros(4, 6))
+
 
 if __name__ == "__main__":
     run_tests()
@@ -65,6 +65,60 @@ class TestFormatCast(TestCase):
         for dipu_format in dipu_format_list:
             dipu_tensor2 = self.check_and_get_format_tensor(dipu_tensor2, dipu_format)
 
+    @onlyOn("NPU")
+    def test_cache_native_formats(self):
+        model = torch.nn.Sequential(
+            torch.nn.Linear(64, 32), torch.nn.ReLU(), torch.nn.Linear(32, 16)
+        ).to(device_dipu)
+        input = torch.randn(8, 64, device=device_dipu)
+        with torch.no_grad():
+            expected = model(input)
+            self.assertEqual(torch_dipu.cache_native_formats(model), 2)
+            self.assertEqual(model(input), expected, prec=1e-3)
+            cached = model[0]._dipu_native_weight[1]
+            self.assertEqual(
+                torch_dipu.get_native_memory_format(cached),
+                torch_dipu.NativeMemoryFormat.FRACTAL_NZ,
+            )
+            model(input)
+            self.assertIs(model[0]._dipu_native_weight[1], cached)
+            # an update of the weight is seen by the next call
+            model[0].weight.mul_(2)
+            model(input)
+            self.assertIsNot(model[0]._dipu_native_weight[1], cached)
+        self.assertIsInstance(model[0].weight, torch.nn.Parameter)
+
+        torch_dipu.clear_native_format_cache(model)
+        self.assertFalse(hasattr(model[0], "_dipu_native_weight"))
+        self.assertNotIn("forward", model[0].__dict__)
+
+    @onlyOn("NPU")
+    def test_lazy_native_formats(self):
+        model = (
+            torch.nn.Sequential(
+                torch.nn.Conv2d(4, 8, 3, padding=1),
+                torch.nn.BatchNorm2d(8),
+                torch.nn.ReLU(),
+                torch.nn.Conv2d(8, 8, 3, padding=1),
+            )
+            .to(device_dipu)
+            .eval()
+        )
+        input = torch.randn(2, 4, 8, 8, device=device_dipu)
+        with torch.no_grad():
+            expected = model(input)
+            mode = torch_dipu.LazyNativeFormatMode()
+            with mode:
+                hidden = model[:3](input)
+                output = model[3](hidden)
+                flat = output.flatten(1)
+            self.assertEqual(
+                torch_dipu.get_native_memory_format(hidden),
+                torch_dipu.NativeMemoryFormat.NC1HWC0,
+            )
+        self.assertIn(hidden, mode.formats)
+        self.assertEqual(flat.view(output.shape).cpu(), expected.cpu(), prec=1e-2)
+
 
 if __name__ == "__main__":
     run_tests()
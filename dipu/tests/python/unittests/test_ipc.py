@@ -0,0 +1,42 @@
+# Copyright (c) 2024, DeepLink.
+import torch
+import torch.multiprocessing as mp
+import torch_dipu
+from torch_dipu.testing._internal.common_utils import TestCase, onlyOn, run_tests
+
+
+def _add_one(queue, done):
+    tensor = queue.get()
+    tensor.add_(1)
+    torch.cuda.synchronize()
+    done.put(tensor.sum().item())
+    del tensor
+
+
+class TestIpc(TestCase):
+    @onlyOn("CUDA")
+    def test_share_tensor_with_child(self):
+        ctx = mp.get_context("spawn")
+        queue, done = ctx.Queue(), ctx.Queue()
+        child = ctx.Process(target=_add_one, args=(queue, done))
+        child.start()
+        storage = torch.zeros(64, 32, device="cuda")
+        tensor = storage[8:16]
+        queue.put(tensor)
+        self.assertEqual(done.get(timeout=120), 8 * 32)
+        child.join()
+        self.assertEqual(child.exitcode, 0)
+        self.assertEqual(storage[8:16].cpu(), torch.ones(8, 32))
+        self.assertEqual(storage[:8].cpu(), torch.zeros(8, 32))
+        torch_dipu._C._dipu_collect_shared_storages()
+
+    @onlyOn("CUDA")
+    def test_share_storage_handle(self):
+        storage = torch.arange(16, dtype=torch.float32, device="cuda")
+        handle = storage.untyped_storage()._share_device_()
+        self.assertTrue(isinstance(handle, bytes))
+        self.assertTrue(torch_dipu._C._dipu_is_ipc_supported())
+
+
+if __name__ == "__main__":
+    run_tests()
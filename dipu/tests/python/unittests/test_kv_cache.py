@@ -0,0 +1,64 @@
+# Copyright (c) 2024, DeepLink.
+import torch
+import torch_dipu
+from torch_dipu import dipu
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestPagedKVCache(TestCase):
+    def _cache(self, num_blocks=8, block_size=4):
+        return dipu.PagedKVCache(2, num_blocks, block_size, 2, 8, torch.float32)
+
+    def test_allocate_and_free(self):
+        cache = self._cache()
+        cache.allocate(0, 9)
+        self.assertEqual(cache.num_free_blocks, 5)
+        self.assertEqual(cache.slots(0), [0, 1, 2, 3, 4, 5, 6, 7, 8])
+        self.assertFalse(cache.can_allocate(21))
+        cache.free(0)
+        self.assertEqual(cache.num_free_blocks, 8)
+        self.assertTrue(cache.can_allocate(32))
+
+    def test_append_slot(self):
+        cache = self._cache()
+        cache.allocate(0, 3)
+        cache.allocate(1, 2)
+        self.assertEqual(cache.append_slot(0), 3)
+        # block 0 is full, the next one is taken
+        self.assertEqual(cache.append_slot(0), 8)
+        self.assertEqual(cache.seq_len(0), 5)
+        self.assertEqual(cache.num_free_blocks, 5)
+        with self.assertRaises(RuntimeError):
+            for _ in range(32):
+                cache.append_slot(1)
+
+    def test_fork_copies_on_write(self):
+        cache = self._cache()
+        cache.allocate(0, 6)
+        key = cache.key_cache(1).view(-1, 2, 8)
+        key[:6] = torch.arange(6.0).view(6, 1, 1).cuda()
+        cache.fork(0, 1)
+        self.assertEqual(cache.num_free_blocks, 6)
+        # the shared last block is copied before writing to it
+        slot = cache.append_slot(1)
+        self.assertEqual(cache.num_free_blocks, 5)
+        self.assertEqual(slot // 4, 2)
+        self.assertEqual(key[8:10].cpu(), key[4:6].cpu())
+        self.assertEqual(cache.append_slot(0), 6)
+        cache.free(0)
+        self.assertEqual(cache.num_free_blocks, 6)
+        cache.free(1)
+        self.assertEqual(cache.num_free_blocks, 8)
+
+    def test_block_tables(self):
+        cache = self._cache()
+        cache.allocate(0, 9)
+        cache.allocate(1, 1)
+        tables = cache.block_tables([0, 1], pad=-1)
+        self.assertEqual(tables.dtype, torch.int32)
+        self.assertEqual(tables.cpu().tolist(), [[0, 1, 2], [3, -1, -1]])
+        self.assertEqual(cache.seq_lens([1, 0]).cpu().tolist(), [1, 9])
+
+
+if __name__ == "__main__":
+    run_tests()
@@ -0,0 +1,75 @@
+# Copyright (c) 2024, DeepLink.
+import threading
+import urllib.request
+
+import torch
+import torch_dipu
+from torch_dipu.dipu import metrics
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+from utils.local_eviron import local_eviron
+
+
+class TestMetrics(TestCase):
+    def _families(self):
+        return {family["name"]: family for family in metrics.collect_metrics()}
+
+    def test_user_metrics(self):
+        steps = metrics.counter("test_steps_total", "Steps", ["kind"])
+        steps.inc(kind="train")
+        steps.inc(2, kind="train")
+        latency = metrics.histogram("test_step_seconds", buckets=[0.1, 1])
+        latency.observe(0.05)
+        latency.observe(5)
+        families = self._families()
+        self.assertEqual(
+            families["test_steps_total"]["samples"],
+            [("test_steps_total", {"kind": "train"}, 3)],
+        )
+        samples = families["test_step_seconds"]["samples"]
+        self.assertIn(("test_step_seconds_count", {}, 2), samples)
+        self.assertIn(("test_step_seconds_bucket", {"le": 1}, 1), samples)
+        self.assertIs(metrics.counter("test_steps_total"), steps)
+        with self.assertRaises(ValueError):
+            metrics.gauge("test_steps_total")
+
+    def test_allocator_metrics(self):
+        x = torch.empty(1 << 20, device="cuda")
+        samples = self._families()["dipu_allocator_allocated_bytes_all_current"][
+            "samples"
+        ]
+        device = str(torch.cuda.current_device())
+        (value,) = [v for _, labels, v in samples if labels["device"] == device]
+        self.assertGreaterEqual(value, x.numel() * x.element_size())
+
+    def test_allocator_metrics_from_thread(self):
+        x = torch.empty(1 << 20, device="cuda")
+        device = str(torch.cuda.current_device())
+        result = []
+        # as the server thread collects them, on no device of its own
+        thread = threading.Thread(target=lambda: result.append(self._families()))
+        thread.start()
+        thread.join()
+        samples = result[0]["dipu_allocator_allocated_bytes_all_current"]["samples"]
+        self.assertIn(device, [labels["device"] for _, labels, _ in samples])
+
+    def test_malformed_port(self):
+        with local_eviron({"DIPU_METRICS_PORT": "metrics"}):
+            with self.assertWarnsRegex(UserWarning, "DIPU_METRICS_PORT"):
+                metrics._start_from_env()
+
+    def test_exporter(self):
+        metrics.gauge("test_tokens_per_second").set(1.5)
+        server = metrics.start_metrics_server(0, "127.0.0.1")
+        try:
+            port = server.server_address[1]
+            with urllib.request.urlopen(f"http://127.0.0.1:{port}/metrics") as r:
+                text = r.read().decode()
+        finally:
+            server.shutdown()
+        self.assertIn("# TYPE test_tokens_per_second gauge", text)
+        self.assertIn("test_tokens_per_second 1.5", text)
+        self.assertIn("dipu_allocator_reserved_bytes_all_current{", text)
+
+
+if __name__ == "__main__":
+    run_tests()
@@ -0,0 +1,24 @@
+# Copyright (c) 2024, DeepLink.
+import torch
+import torch_dipu
+from torch_dipu.dipu import nvtx
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestNvtx(TestCase):
+    def test_nested_ranges(self):
+        outer = nvtx.range_push("outer")
+        inner = nvtx.range_push("inner")
+        nvtx.mark("step")
+        self.assertEqual(inner, outer + 1)
+        self.assertEqual(nvtx.range_pop(), inner)
+        self.assertEqual(nvtx.range_pop(), outer)
+
+    def test_range_context(self):
+        with nvtx.range("layer {}", 3):
+            y = torch.ones(4).cuda() * 2
+        self.assertEqual(y.sum().item(), 8)
+
+
+if __name__ == "__main__":
+    run_tests()
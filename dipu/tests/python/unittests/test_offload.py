@@ -0,0 +1,58 @@
+# Copyright (c) 2024, DeepLink.
+import torch
+import torch_dipu
+from torch_dipu import dipu
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestOffloadActivations(TestCase):
+    def _model(self):
+        torch.manual_seed(0)
+        return torch.nn.Sequential(
+            torch.nn.Linear(64, 256),
+            torch.nn.GELU(),
+            torch.nn.Linear(256, 64),
+            torch.nn.Tanh(),
+        ).cuda()
+
+    def test_same_grads(self):
+        x = torch.randn(128, 64).cuda()
+        model = self._model()
+        model(x).sum().backward()
+        expected = [p.grad.clone() for p in model.parameters()]
+
+        model.zero_grad()
+        offloaded = []
+        with dipu.offload_activations(
+            min_bytes=0, filter=lambda t: offloaded.append(t.shape) or True
+        ):
+            loss = model(x).sum()
+        self.assertTrue(offloaded)
+        loss.backward()
+        for p, grad in zip(model.parameters(), expected):
+            self.assertEqual(p.grad, grad)
+
+    def test_weights_and_small_tensors_stay(self):
+        x = torch.randn(4, 64).cuda()
+        model = self._model()
+        offloaded = []
+        with dipu.offload_activations(
+            min_bytes=4096, filter=lambda t: offloaded.append(t) or True
+        ):
+            model(x).sum().backward()
+        for t in offloaded:
+            self.assertGreaterEqual(t.numel() * t.element_size(), 4096)
+            self.assertFalse(t.requires_grad and t.is_leaf)
+
+    def test_retain_graph(self):
+        x = torch.randn(32, 64).cuda().requires_grad_()
+        with dipu.offload_activations(min_bytes=0):
+            y = (x.exp() * x.sin()).sum()
+        (grad,) = torch.autograd.grad(y, x, retain_graph=True)
+        (again,) = torch.autograd.grad(y, x)
+        self.assertEqual(grad, again)
+        self.assertEqual(grad, x.exp() * (x.sin() + x.cos()))
+
+
+if __name__ == "__main__":
+    run_tests()
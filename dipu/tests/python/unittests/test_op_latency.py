@@ -0,0 +1,45 @@
+import torch
+import torch_dipu
+from torch_dipu import dipu
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestOpLatency(TestCase):
+    def setUp(self):
+        self.was_enabled = dipu.op_latency_enabled()
+        dipu.reset_op_latency_stats()
+
+    def tearDown(self):
+        dipu.set_op_latency_enabled(self.was_enabled)
+
+    def _stats_of(self, op):
+        return [item for item in dipu.op_latency_stats() if item["op"] == op]
+
+    def test_disabled(self):
+        dipu.set_op_latency_enabled(False)
+        x = torch.randn(16).cuda()
+        torch.add(x, x, out=torch.empty_like(x))
+        self.assertEqual(self._stats_of("add.out"), [])
+
+    def test_histograms(self):
+        x = torch.randn(16).cuda()
+        dipu.set_op_latency_enabled(True)
+        out = torch.empty_like(x)
+        for _ in range(10):
+            torch.add(x, x, out=out)
+        dipu.set_op_latency_enabled(False)
+        stats = self._stats_of("add.out")
+        self.assertEqual(len(stats), 1)
+        item = stats[0]
+        self.assertEqual(item["calls"], 10)
+        for part in ("prologue", "call"):
+            self.assertEqual(sum(item[part]["buckets"]), 10)
+            self.assertGreater(item[part]["p99_us"], 0)
+            self.assertLessEqual(item[part]["p50_us"], item[part]["p99_us"])
+
+        dipu.reset_op_latency_stats()
+        self.assertEqual(self._stats_of("add.out"), [])
+
+
+if __name__ == "__main__":
+    run_tests()
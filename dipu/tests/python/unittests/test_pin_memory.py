@@ -31,6 +31,84 @@ class TestPinMemory(TestCase):
         x = torch.empty(3, 4, pin_memory=False)
         self.assertFalse(x.is_pinned())
 
+    def test_pin_memory_sizes(self):
+        # small blocks share pinned regions, large ones are pinned one by one
+        pinned = []
+        for numel in (1, 100, 129, 1000, 1 << 16, 1 << 20, (1 << 20) + 1):
+            a = torch.arange(numel, dtype=torch.float32)
+            b = a.pin_memory()
+            self.assertTrue(b.is_pinned())
+            self.assertTrue(b[numel // 2 :].is_pinned())
+            self.assertEqual(a, b)
+            pinned.append(b)
+        ptrs = [b.data_ptr() for b in pinned]
+        self.assertEqual(len(set(ptrs)), len(ptrs))
+        del pinned
+
+        for _ in range(100):
+            b = torch.ones(1000).pin_memory()
+            self.assertTrue(b.is_pinned())
+            self.assertEqual(b.sum().item(), 1000)
+
+    def test_pin_memory_batch(self):
+        pinned = torch.ones(5).pin_memory()
+        batch = {
+            "image": torch.randn(8, 3, 17, 17),
+            "label": [torch.arange(8), torch.arange(8, dtype=torch.int8)],
+            "mask": torch.randn(16, 8).t(),
+            "pinned": pinned,
+            "name": "batch",
+        }
+        results = [
+            torch_dipu.dipu.pin_memory_batch(batch),
+            torch.utils.data._utils.pin_memory.pin_memory(batch),
+        ]
+        for result in results:
+            self.assertEqual(result["name"], "batch")
+            self.assertEqual(result["pinned"].data_ptr(), pinned.data_ptr())
+            tensors = [result["image"], *result["label"], result["mask"]]
+            expected = [batch["image"], *batch["label"], batch["mask"]]
+            for tensor, origin in zip(tensors, expected):
+                self.assertTrue(tensor.is_pinned())
+                self.assertEqual(tensor.stride(), origin.stride())
+                self.assertEqual(tensor, origin, prec=0)
+            # all copied tensors are views of the same pinned region
+            self.assertEqual(
+                len({t.untyped_storage().data_ptr() for t in tensors}), 1
+            )
+
+    def test_device_prefetcher(self):
+        dataset = torch.utils.data.TensorDataset(
+            torch.arange(64, dtype=torch.float32).view(32, 2), torch.arange(32)
+        )
+        loader = torch.utils.data.DataLoader(dataset, batch_size=4, pin_memory=True)
+        prefetcher = torch_dipu.dipu.DevicePrefetcher(loader)
+        self.assertEqual(len(prefetcher), 8)
+        batches = list(prefetcher)
+        self.assertEqual(len(batches), 8)
+        for i, (inputs, labels) in enumerate(batches):
+            self.assertTrue(inputs.is_cuda)
+            self.assertEqual(labels.cpu(), torch.arange(4 * i, 4 * i + 4))
+            self.assertEqual((inputs * 2).cpu(), dataset.tensors[0][4 * i : 4 * i + 4] * 2)
+
+        # pageable batches are pinned first, several may be in flight
+        loader = torch.utils.data.DataLoader(dataset, batch_size=4)
+        prefetcher = torch_dipu.dipu.DevicePrefetcher(loader, depth=3)
+        labels = torch.cat([labels.cpu() for _, labels in prefetcher])
+        self.assertEqual(labels, torch.arange(32))
+
+    def test_item_async(self):
+        x = torch.arange(10, dtype=torch.float).cuda()
+        flag = torch_dipu.dipu.item_async((x > 8).any())
+        total = torch_dipu.dipu.item_async(x.sum())
+        x.mul_(2)  # queued after the copies, does not change them
+        self.assertTrue(flag)
+        self.assertEqual(total.item(), 45.0)
+        self.assertTrue(total.done())
+        self.assertEqual(torch_dipu.dipu.item_async(torch.tensor([3])).item(), 3)
+        with self.assertRaises(ValueError):
+            torch_dipu.dipu.item_async(x)
+
 
 if __name__ == "__main__":
     run_tests()
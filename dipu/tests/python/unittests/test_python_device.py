@@ -21,6 +21,12 @@ class TestPythonDevice(TestCase):
         self.assertEqual(str(a), f"tensor([1, 2, 3], device='cuda:{device_index}')")
         self.assertEqual(repr(a), f"tensor([1, 2, 3], device='cuda:{device_index}')")
 
+    def test_topology(self):
+        from torch_dipu.dipu import get_device_link, get_device_numa_node
+
+        self.assertEqual(get_device_link(0, 0)[0], "same_device")
+        self.assertIsInstance(get_device_numa_node(0), int)
+
 
 if __name__ == "__main__":
     run_tests()
@@ -0,0 +1,42 @@
+import torch
+import torch_dipu
+from torch_dipu import dipu
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestRuntimeConfig(TestCase):
+    NAME = "DIPU_ALLOCATOR_GC_THRESHOLD"
+
+    def setUp(self):
+        self.old = dipu.get_runtime_config(self.NAME)
+
+    def tearDown(self):
+        dipu.set_runtime_config(self.NAME, self.old)
+
+    def test_set_and_get(self):
+        self.assertIn(self.NAME, dipu.runtime_configs())
+        dipu.set_runtime_config(self.NAME, 0.5)
+        self.assertEqual(float(dipu.get_runtime_config(self.NAME)), 0.5)
+        self.assertEqual(float(dipu.runtime_configs()[self.NAME]), 0.5)
+        # allocations keep working under the new threshold
+        x = torch.ones(1024, device="cuda")
+        self.assertEqual(x.sum().item(), 1024)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            dipu.set_runtime_config("DIPU_NO_SUCH_CONFIG", 1)
+        with self.assertRaises(ValueError):
+            dipu.set_runtime_config(self.NAME, "half")
+        self.assertEqual(dipu.get_runtime_config(self.NAME), self.old)
+
+    def test_negative_unsigned(self):
+        # "-1" must not wrap around to the largest value
+        name = "DIPU_MAX_ASYNC_RESOURCE_POOL_LENGTH"
+        old = dipu.get_runtime_config(name)
+        with self.assertRaises(ValueError):
+            dipu.set_runtime_config(name, -1)
+        self.assertEqual(dipu.get_runtime_config(name), old)
+
+
+if __name__ == "__main__":
+    run_tests()
@@ -0,0 +1,112 @@
+import json
+import os
+import struct
+import tempfile
+import torch
+import torch_dipu
+from torch_dipu.dipu.serialization import (
+    load_safetensors,
+    load_sharded,
+    load_to_device,
+    save_async,
+)
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestSerialization(TestCase):
+    @staticmethod
+    def _save_safetensors(tensors, path):
+        header = {"__metadata__": {"format": "pt"}}
+        dtypes = {torch.float32: "F32", torch.bfloat16: "BF16", torch.int64: "I64"}
+        offset = 0
+        for name, tensor in tensors.items():
+            nbytes = tensor.numel() * tensor.element_size()
+            header[name] = {
+                "dtype": dtypes[tensor.dtype],
+                "shape": list(tensor.shape),
+                "data_offsets": [offset, offset + nbytes],
+            }
+            offset += nbytes
+        header_bytes = json.dumps(header).encode()
+        with open(path, "wb") as f:
+            f.write(struct.pack("<Q", len(header_bytes)))
+            f.write(header_bytes)
+            for tensor in tensors.values():
+                f.write(tensor.contiguous().view(torch.uint8).numpy().tobytes())
+
+    def test_load_safetensors(self):
+        tensors = {
+            "weight": torch.randn(256, 1024),
+            "bias": torch.randn(7).to(torch.bfloat16),
+            "step": torch.tensor([3]),
+            "empty": torch.randn(0, 4),
+        }
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "model.safetensors")
+            self._save_safetensors(tensors, path)
+            loaded = load_safetensors(path)
+        self.assertEqual(set(loaded), set(tensors))
+        for name, tensor in tensors.items():
+            self.assertTrue(loaded[name].is_cuda)
+            self.assertEqual(loaded[name].cpu(), tensor, prec=0)
+        self.assertEqual(loaded["empty"].shape, (0, 4))
+
+    def test_load_safetensors_unsupported_dtype(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "model.safetensors")
+            self._save_safetensors({"scale": torch.randn(4)}, path)
+            with open(path, "rb") as f:
+                data = f.read()
+            with open(path, "wb") as f:
+                # same length as F32, the header size is kept
+                f.write(data.replace(b'"F32"', b'"F8X"', 1))
+            with self.assertRaisesRegex(ValueError, "scale.*F8X"):
+                load_safetensors(path)
+
+    def test_load_to_device(self):
+        state = {
+            "weight": torch.randn(256, 1024),
+            "nested": [torch.randn(3, 3).t(), 5],
+        }
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "model.pth")
+            torch.save(state, path)
+            loaded = load_to_device(path)
+        self.assertTrue(loaded["weight"].is_cuda)
+        self.assertEqual(loaded["weight"].cpu(), state["weight"], prec=0)
+        self.assertEqual(loaded["nested"][0].cpu(), state["nested"][0], prec=0)
+        self.assertEqual(loaded["nested"][1], 5)
+
+    def test_save_async(self):
+        weight = torch.randn(256, 1024).cuda()
+        expected = weight.cpu()
+        state = {"weight": weight, "tied": weight, "step": torch.tensor([3])}
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "model.pth")
+            checkpoint = save_async(state, path)
+            # the checkpoint keeps the values at the time of the call
+            weight.add_(1)
+            state["step"].add_(1)
+            checkpoint.wait()
+            self.assertTrue(checkpoint.done())
+            loaded = torch.load(path)
+        self.assertEqual(loaded["weight"], expected, prec=0)
+        self.assertIs(loaded["weight"], loaded["tied"])
+        self.assertEqual(loaded["step"], torch.tensor([3]), prec=0)
+
+    def test_save_async_sharded(self):
+        state = {f"layer{i}.weight": torch.randn(64, 64).cuda() for i in range(5)}
+        state["step"] = 10
+        with tempfile.TemporaryDirectory() as tmpdir:
+            save_async(state, tmpdir, num_shards=3, num_workers=2).wait()
+            self.assertEqual(len(os.listdir(tmpdir)), 3)
+            loaded = load_sharded(tmpdir)
+        self.assertEqual(set(loaded), set(state))
+        for name, tensor in state.items():
+            if isinstance(tensor, torch.Tensor):
+                self.assertTrue(loaded[name].is_cuda)
+            self.assertEqual(loaded[name], tensor, prec=0)
+
+
+if __name__ == "__main__":
+    run_tests()
@@ -33,6 +33,20 @@ class TestStorage(TestCase):
             self.assertTrue(x1.is_dipu)
             self.assertTrue(x1.is_cuda)
 
+    def test_resize_grow_keeps_data(self):
+        # Grown in place when the memory after it is free, else moved
+        x = torch.arange(1 << 20, device="cuda", dtype=torch.float32)
+        x.resize_(3 << 20)
+        self.assertEqual(x[: 1 << 20].cpu(), torch.arange(1 << 20, dtype=torch.float32))
+        x[1 << 20 :].fill_(1)
+        self.assertEqual(x[-1].item(), 1)
+
+        s = torch.UntypedStorage(1024, device=diputype)
+        s.fill_(7)
+        s.resize_(1 << 22)
+        self.assertEqual(s.size(), 1 << 22)
+        self.assertEqual(torch.tensor(s[:1024].cpu().tolist()), torch.full((1024,), 7))
+
 
 if __name__ == "__main__":
     run_tests()
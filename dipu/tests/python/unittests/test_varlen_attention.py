@@ -0,0 +1,84 @@
+# Copyright (c) 2024, DeepLink.
+import torch
+import torch.nn.functional as F
+import torch_dipu
+from torch_dipu import dipu
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+class TestVarlenAttention(TestCase):
+    def _sequences(self, lengths, heads, head_dim=16):
+        return dipu.PackedSequences.from_sequences(
+            [torch.randn(n, heads, head_dim).cuda() for n in lengths]
+        )
+
+    def _expected(self, q, k, v, causal):
+        outs = []
+        for qi, ki, vi in zip(q.unbind(), k.unbind(), v.unbind()):
+            groups = qi.size(1) // ki.size(1)
+            # [heads, len, head_dim]
+            qi = qi.transpose(0, 1).cpu()
+            ki = ki.transpose(0, 1).cpu().repeat_interleave(groups, 0)
+            vi = vi.transpose(0, 1).cpu().repeat_interleave(groups, 0)
+            out = F.scaled_dot_product_attention(qi, ki, vi, is_causal=causal)
+            outs.append(out.transpose(0, 1))
+        return torch.cat(outs)
+
+    def test_packed_sequences(self):
+        padded = torch.randn(3, 5, 8).cuda()
+        packed = dipu.PackedSequences.from_padded(padded, [5, 2, 3])
+        self.assertEqual(packed.values.shape, (10, 8))
+        self.assertEqual(packed.cu_seqlens.tolist(), [0, 5, 7, 10])
+        self.assertEqual(packed.max_seqlen, 5)
+        unpadded = packed.to_padded()
+        self.assertEqual(unpadded[0], padded[0])
+        self.assertEqual(unpadded[1, :2], padded[1, :2])
+        self.assertEqual(unpadded[1, 2:], torch.zeros(3, 8))
+        # token-wise layers run on the packed values
+        norm = torch.nn.LayerNorm(8).cuda()
+        normed = packed.map(norm)
+        self.assertEqual(normed.unbind()[2], norm(padded[2, :3]))
+        with self.assertRaises(ValueError):
+            packed.map(lambda t: t[1:])
+
+    def test_attention(self):
+        for causal in (False, True):
+            q = self._sequences([7, 1, 12], 4)
+            k = q.map(lambda t: torch.randn_like(t))
+            v = q.map(lambda t: torch.randn_like(t))
+            out = dipu.varlen_attention(q, k, v, causal=causal)
+            self.assertEqual(out.cu_seqlens, q.cu_seqlens)
+            self.assertEqual(
+                out.values.cpu(), self._expected(q, k, v, causal), atol=1e-4, rtol=1e-4
+            )
+
+    def test_grouped_query_attention(self):
+        q = self._sequences([3, 9], 8)
+        k = q.map(lambda t: torch.randn(t.size(0), 2, 16).cuda())
+        v = q.map(lambda t: torch.randn(t.size(0), 2, 16).cuda())
+        out = dipu.varlen_attention(q, k, v, causal=True)
+        self.assertEqual(
+            out.values.cpu(), self._expected(q, k, v, True), atol=1e-4, rtol=1e-4
+        )
+
+    def test_cpu_and_meta(self):
+        q = self._sequences([4, 6], 2)
+        args = (
+            q.values.cpu(),
+            q.values.cpu(),
+            q.values.cpu(),
+            q.cu_seqlens.cpu(),
+            q.cu_seqlens.cpu(),
+            6,
+            6,
+        )
+        out = torch.ops.dipu.varlen_attention(*args)
+        self.assertEqual(out, self._expected(q, q, q, False), atol=1e-4, rtol=1e-4)
+        meta = torch.ops.dipu.varlen_attention(
+            *(a.to("meta") if isinstance(a, torch.Tensor) else a for a in args)
+        )
+        self.assertEqual(meta.shape, (10, 2, 16))
+
+
+if __name__ == "__main__":
+    run_tests()
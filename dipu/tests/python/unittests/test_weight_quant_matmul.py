@@ -0,0 +1,64 @@
+# Copyright (c) 2024, DeepLink.
+import torch
+import torch_dipu
+from torch_dipu.testing._internal.common_utils import TestCase, run_tests
+
+
+def dequantize(q, scale, offset, group_size):
+    n, k = q.shape
+    groups = k // group_size if group_size > 0 else 1
+    w = q.float().view(n, groups, -1)
+    w = (w - offset.float().view(n, groups, 1)) * scale.float().view(n, groups, 1)
+    return w.view(n, k)
+
+
+def pack_int4(q):
+    q = q.view(q.size(0), -1, 2)
+    return ((q[..., 0] & 0xF) | (q[..., 1] << 4)).to(torch.int8)
+
+
+class TestWeightQuantMatmul(TestCase):
+    def _check(self, bits, group_size):
+        n, k = 64, 128
+        low, high = (-8, 8) if bits == 4 else (-128, 128)
+        q = torch.randint(low, high, (n, k), dtype=torch.int8)
+        params_size = (n, k // group_size) if group_size > 0 else (n,)
+        scale = torch.rand(params_size) / 64
+        offset = torch.randint(-2, 2, params_size).float()
+        bias = torch.randn(n)
+        x = torch.randn(4, 8, k)
+        expected = x @ dequantize(q, scale, offset, group_size).t() + bias
+
+        weight = pack_int4(q) if bits == 4 else q
+        out = torch.ops.dipu.weight_quant_matmul(
+            x.half().cuda(),
+            weight.cuda(),
+            scale.half().cuda(),
+            offset.half().cuda(),
+            bias.half().cuda(),
+            group_size,
+            bits,
+        )
+        self.assertEqual(out.shape, (4, 8, n))
+        self.assertEqual(out.dtype, torch.float16)
+        self.assertEqual(out.float().cpu(), expected, atol=1e-1, rtol=1e-2)
+
+    def test_int8_per_channel(self):
+        self._check(8, 0)
+
+    def test_int8_per_group(self):
+        self._check(8, 32)
+
+    def test_int4_per_group(self):
+        self._check(4, 32)
+
+    def test_cpu(self):
+        q = torch.randint(-128, 128, (16, 32), dtype=torch.int8)
+        scale = torch.rand(16)
+        x = torch.randn(3, 32)
+        out = torch.ops.dipu.weight_quant_matmul(x, q, scale)
+        self.assertEqual(out, x @ (q.float() * scale.view(16, 1)).t())
+
+
+if __name__ == "__main__":
+    run_tests()
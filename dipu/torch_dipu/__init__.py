@@ -11,6 +11,9 @@ mockcuda = (
     False if os.environ.get("DIPU_MOCK_CUDA", "True").lower() == "false" else True
 )
 
+# Where TorchDipuConfig.cmake is, to build extensions with dipu_add_extension
+cmake_prefix_path = os.path.join(os.path.dirname(__file__), "share", "cmake")
+
 import torch
 from typing import Tuple, List, Union, Sequence
 from torch.types import _int, _size, Device, Number
@@ -27,6 +30,7 @@ from .dipu.dataloader import apply_dataloader_patch
 from .dipu.generator import apply_generator_patch
 from .dipu.streams import apply_stream_patch, _dipu_record_stream
 from .dipu.amp import apply_amp_patch
+from .dipu.benchmark import apply_benchmark_patch
 
 
 # mock device functions in generated/python_variable_methods.cpp
@@ -101,6 +105,8 @@ def apply_torch_function_patch():
                 setattr(torch.cuda.random, attr, getattr(dipu.random_dipu, attr))
             if attr in torch.cuda.memory.__all__ and hasattr(dipu.memory, attr):
                 setattr(torch.cuda.memory, attr, getattr(dipu.memory, attr))
+        for attr in ("_record_memory_history", "_snapshot", "_dump_snapshot"):
+            setattr(torch.cuda.memory, attr, getattr(dipu.memory, attr))
         # special case dipu ans cuda use different name
         torch.cuda.device = dipu.devicectx
 
@@ -124,6 +130,7 @@ def apply_patches():
     apply_generator_patch()
     apply_stream_patch()
     apply_amp_patch()
+    apply_benchmark_patch()
 
 
 apply_patches()
@@ -1,21 +1,226 @@
 #define TORCH_ASSERT_ONLY_METHOD_OPERATORS
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 
+#include <ATen/EmptyTensor.h>
 #include <ATen/core/dispatch/Dispatcher.h>
 #include <ATen/core/ivalue.h>
 #include <ATen/core/stack.h>
 #include <ATen/native/CPUFallback.h>
+#include <c10/core/Storage.h>
+#include <c10/core/TensorImpl.h>
+#include <c10/util/intrusive_ptr.h>
 
 #ifndef AT_PER_OPERATOR_HEADERS
 #include <ATen/Functions.h>
 #else
 #include <ATen/ops/_copy_from_and_resize.h>
 #include <ATen/ops/_to_cpu.h>
+#include <ATen/ops/empty.h>
 #endif
 
+#include "csrc_dipu/runtime/rthelper.h"
+#include "csrc_dipu/utils/env.hpp"
+#include "csrc_dipu/utils/helpfunc.hpp"
+
 namespace dipu {
 namespace native {
 
+namespace {
+
+// Move fallback tensors between device and host with non-blocking copies
+// through pinned memory, so that inputs take one sync and write backs none.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kAsyncCpuFallback =
+    get_env_or_default("DIPU_CPU_FALLBACK_ASYNC", 1) > 0;
+
+// Pinned host tensor of the same sizes, overlapping tensors get contiguous
+// strides as they can't be copied into
+at::Tensor empty_pinned_like(const at::Tensor& self) {
+  std::vector<int64_t> strides(self.strides().begin(), self.strides().end());
+  if (!self.is_non_overlapping_and_dense()) {
+    int64_t stride = 1;
+    for (auto i = self.dim() - 1; i >= 0; --i) {
+      strides[i] = stride;
+      stride *= std::max<int64_t>(self.size(i), 1);
+    }
+  }
+  auto nbytes = at::detail::computeStorageNbytes(self.sizes(), strides,
+                                                 self.dtype().itemsize());
+  auto storage = c10::Storage(c10::Storage::use_byte_size_t(), nbytes,
+                              getAllocator(at::DeviceType::CPU), false);
+  return at::empty({0}, self.options().device(at::kCPU))
+      .set_(storage, 0, self.sizes(), strides);
+}
+
+// Collects the D2H copies of all fallback inputs, they are waited for at once
+class AsyncToCpu {
+  std::vector<DIPUStream> streams_;
+
+ public:
+  at::Tensor operator()(const at::Tensor& tensor) {
+    if (!tensor.defined() || !isDeviceTensor(tensor)) {
+      return tensor;
+    }
+    auto cpu_tensor = empty_pinned_like(tensor);
+    cpu_tensor.copy_(tensor, /*non_blocking=*/true);
+    auto stream = getCurrentDIPUStream(tensor.device().index());
+    if (std::find(streams_.begin(), streams_.end(), stream) ==
+        streams_.end()) {
+      streams_.push_back(stream);
+    }
+    return cpu_tensor;
+  }
+
+  std::vector<at::Tensor> operator()(const at::TensorList& tensors) {
+    std::vector<at::Tensor> cpu_tensors;
+    cpu_tensors.reserve(tensors.size());
+    for (const auto& tensor : tensors) {
+      cpu_tensors.push_back((*this)(tensor));
+    }
+    return cpu_tensors;
+  }
+
+  void synchronize() {
+    for (auto& stream : streams_) {
+      stream.synchronize();
+    }
+    streams_.clear();
+  }
+};
+
+// Write back without a host sync if the cpu result stays in pinned memory,
+// the pinned block is then kept by the host allocator until the copy is done
+void copy_back(const at::Tensor& tensor, const at::Tensor& cpu_tensor) {
+  const bool non_blocking = kAsyncCpuFallback && cpu_tensor.is_pinned();
+  tensor.reshape_as(cpu_tensor).copy_(cpu_tensor, non_blocking);
+}
+
+at::Tensor to_device(const at::Tensor& cpu_tensor, const c10::Device& device) {
+  if (!kAsyncCpuFallback || device.type() != DIPU_DEVICE_TYPE) {
+    return cpu_tensor.to(device);
+  }
+  auto pinned = cpu_tensor;
+  if (!pinned.is_pinned()) {
+    pinned = empty_pinned_like(cpu_tensor);
+    pinned.copy_(cpu_tensor);
+  }
+  return pinned.to(device, /*non_blocking=*/true);
+}
+
+// Host copies of the outputs of fallback ops, so that the fallback ops taking
+// them next skip copying them back from the device. Up to
+// DIPU_CPU_FALLBACK_CHAIN_MB of them are kept, none by default. A copy is
+// used while its device tensor is unchanged, i.e. neither written by an op,
+// which bumps its version, nor resized or set to other memory, so the device
+// tensor must not be written otherwise, e.g. by a replayed graph.
+class HostShadows {
+  struct Shadow {
+    // Weak, so the device tensor is freed as usual
+    c10::weak_intrusive_ptr<c10::TensorImpl, c10::UndefinedTensorImpl> device;
+    uint32_t version = 0;
+    const void* data = nullptr;
+    at::Tensor host;
+  };
+
+  const size_t max_bytes_ =
+      static_cast<size_t>(get_env_or_default("DIPU_CPU_FALLBACK_CHAIN_MB", 0))
+      << 20;
+  std::mutex mutex_;
+  std::unordered_map<const c10::TensorImpl*, Shadow> shadows_;
+  size_t bytes_ = 0;
+
+  static bool isValid(const Shadow& shadow, const at::Tensor& device) {
+    return !shadow.device.expired() && device._version() == shadow.version &&
+           device.data_ptr() == shadow.data &&
+           device.sizes() == shadow.host.sizes() &&
+           device.strides() == shadow.host.strides();
+  }
+
+  void erase(
+      std::unordered_map<const c10::TensorImpl*, Shadow>::iterator& it) {
+    bytes_ -= it->second.host.nbytes();
+    it = shadows_.erase(it);
+  }
+
+  // Drops the copies of freed or written device tensors
+  void sweep() {
+    for (auto it = shadows_.begin(); it != shadows_.end();) {
+      auto device = it->second.device.lock();
+      if (!device ||
+          device->version_counter().current_version() != it->second.version) {
+        erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+ public:
+  bool enabled() const { return max_bytes_ > 0; }
+
+  static bool isEligible(const at::Tensor& device) {
+    return device.defined() && isDeviceTensor(device) &&
+           !device.is_inference();
+  }
+
+  at::Tensor find(const at::Tensor& device) {
+    if (!enabled() || !isEligible(device)) {
+      return {};
+    }
+    std::lock_guard<std::mutex> _(mutex_);
+    auto it = shadows_.find(device.unsafeGetTensorImpl());
+    if (it == shadows_.end()) {
+      return {};
+    }
+    if (isValid(it->second, device)) {
+      return it->second.host;
+    }
+    erase(it);
+    return {};
+  }
+
+  void record(const at::Tensor& device, const at::Tensor& host) {
+    if (!enabled() || !isEligible(device) || !host.defined() ||
+        host.nbytes() > max_bytes_) {
+      return;
+    }
+    Shadow shadow{
+        c10::weak_intrusive_ptr<c10::TensorImpl, c10::UndefinedTensorImpl>(
+            device.getIntrusivePtr()),
+        static_cast<uint32_t>(device._version()), device.data_ptr(), host};
+    std::lock_guard<std::mutex> _(mutex_);
+    auto it = shadows_.find(device.unsafeGetTensorImpl());
+    if (it != shadows_.end()) {
+      erase(it);
+    }
+    if (bytes_ + host.nbytes() > max_bytes_) {
+      sweep();
+      if (bytes_ + host.nbytes() > max_bytes_) {
+        return;
+      }
+    }
+    bytes_ += host.nbytes();
+    shadows_.emplace(device.unsafeGetTensorImpl(), std::move(shadow));
+  }
+};
+
+HostShadows& hostShadows() {
+  static HostShadows shadows;
+  return shadows;
+}
+
+}  // namespace
+
+bool cpuFallbackChainEnabled() { return hostShadows().enabled(); }
+
+bool hasHostShadow(const at::Tensor& tensor) {
+  return hostShadows().find(tensor).defined();
+}
+
 // convenience helper for converting tensors to cpu
 
 std::vector<at::Tensor> to_cpu(const at::TensorList& tensors) {
@@ -86,6 +291,36 @@ void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) {
   static bool log_fallback_detail =
       std::getenv("DIPU_LOG_FALLBACK_INFO") != nullptr;
 
+  AsyncToCpu async_to_cpu;
+  auto& host_shadows = hostShadows();
+  // The host copies of the tensors not written by the op are used if kept
+  auto convert_to_cpu = [&async_to_cpu, &host_shadows](
+                            const at::TensorList& tensors,
+                            const std::vector<bool>& writable) {
+    std::vector<at::Tensor> cpu_tensors(tensors.size());
+    std::vector<at::Tensor> copied;
+    std::vector<size_t> copied_indices;
+    for (const auto i : c10::irange(tensors.size())) {
+      if (!writable[i]) {
+        cpu_tensors[i] = host_shadows.find(tensors[i]);
+      }
+      if (!cpu_tensors[i].defined()) {
+        copied.push_back(tensors[i]);
+        copied_indices.push_back(i);
+      }
+    }
+    auto copies = kAsyncCpuFallback ? async_to_cpu(copied) : to_cpu(copied);
+    for (const auto i : c10::irange(copied_indices.size())) {
+      cpu_tensors[copied_indices[i]] = std::move(copies[i]);
+    }
+    return cpu_tensors;
+  };
+  auto is_write_alias = [&schema_args](size_t idx) {
+    const at::AliasInfo* alias_info = schema_args[idx].alias_info();
+    return alias_info != nullptr && alias_info->isWrite();
+  };
+  std::vector<bool> tensor_args_writable;
+
   // Step 1: Convert all non-CPU tensor inputs into CPU tensors
   // and put them on the stack at the correct indices.
   for (const auto idx : c10::irange(arguments.size())) {
@@ -103,14 +338,16 @@ void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) {
     if (ivalue.isTensor()) {
       tensor_args.push_back(ivalue.toTensor());
       tensor_args_indices.push_back(idx);
+      tensor_args_writable.push_back(is_write_alias(idx));
     } else if (ivalue.isTensorList()) {
       // Note: we copy each TensorList argument to CPU individually out of
       // convenience, but XLA would benefit from materializing all tensor and
       // TensorList args onto the CPU at the same time. We can improve this if
       // we need better perf for XLA's CPU fallbacks.
       tensorlist_args.push_back(ivalue.toTensorList());
-      auto cpu_ivalue = c10::IValue(
-          c10::List<at::Tensor>(to_cpu(ivalue.toTensorList().vec())));
+      auto tensors = ivalue.toTensorList().vec();
+      auto cpu_ivalue = c10::IValue(c10::List<at::Tensor>(convert_to_cpu(
+          tensors, std::vector<bool>(tensors.size(), is_write_alias(idx)))));
       (*stack)[arguments_begin + idx] = std::move(cpu_ivalue);
       cpu_tensorlist_args.push_back(
           (*stack)[arguments_begin + idx].toTensorList());
@@ -119,7 +356,8 @@ void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) {
   }
   // XLA requires all of the tensor arguments to be gathered up and converted to
   // CPU together.
-  auto cpu_tensors = to_cpu(tensor_args);
+  auto cpu_tensors = convert_to_cpu(tensor_args, tensor_args_writable);
+  async_to_cpu.synchronize();
 
   for (const auto i : c10::irange(tensor_args_indices.size())) {
     auto idx = tensor_args_indices[i];
@@ -147,7 +385,8 @@ void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) {
                   << tensor_args[i].options()
                   << ",size:" << cpu_tensors[i].sizes() << std::endl;
       }
-      tensor_args[i].reshape_as(cpu_tensors[i]).copy_(cpu_tensors[i], false);
+      copy_back(tensor_args[i], cpu_tensors[i]);
+      host_shadows.record(tensor_args[i], cpu_tensors[i]);
     }
   }
   for (const auto i : c10::irange(tensorlist_args_indices.size())) {
@@ -158,9 +397,7 @@ void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) {
       std::vector<at::Tensor> tensorlist = tensorlist_args[i].vec();
       for (auto j = 0; j < tensorlist.size(); j++) {
         if (cpu_tensorlist.get(j).defined()) {
-          tensorlist[j]
-              .reshape_as(cpu_tensorlist.get(j))
-              .copy_(cpu_tensorlist.get(j), false);
+          copy_back(tensorlist[j], cpu_tensorlist.get(j));
         }
         if (log_fallback_detail) {
           std::cout << "write back " << tensorlist_idx << "th args " << j
@@ -261,8 +498,10 @@ void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack) {
           // torch.cat() with an empty list In that case, we shouldn't have any
           // tensors to schlep across devices anyway.
           if (tgt_device) {
-            (*stack)[returns_begin + idx] =
-                c10::IValue(returns[idx].toTensor().to(*tgt_device));
+            auto cpu_tensor = returns[idx].toTensor();
+            auto tensor = to_device(cpu_tensor, *tgt_device);
+            host_shadows.record(tensor, cpu_tensor);
+            (*stack)[returns_begin + idx] = c10::IValue(std::move(tensor));
           }
         }
       }
@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include <ATen/core/ATen_fwd.h>
 #include <ATen/core/TensorBody.h>
@@ -56,6 +57,8 @@ void resize_bytes_dipu(c10::StorageImpl* storage, size_t newsize_bytes);
 bool is_pinned(const at::Tensor& self, c10::optional<at::Device> device);
 at::Tensor _pin_memory(const at::Tensor& self,
                        c10::optional<at::Device> device);
+// Pin a collated batch into one pinned region, the results are views into it
+std::vector<at::Tensor> pin_memory_batch(at::TensorList tensors);
 
 // todo:: use same format as autogen
 // diopi function defined in AutoGenedKernels.cpp,
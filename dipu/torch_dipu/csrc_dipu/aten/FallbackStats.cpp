@@ -0,0 +1,95 @@
+// Copyright (c) 2024, DeepLink.
+#include "FallbackStats.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// Number of ops printed at exit, 0 disables the report
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kFallbackReportSize =
+    get_env_or_default("DIPU_FALLBACK_REPORT", size_t{20});
+
+class FallbackStatsTable {
+  std::mutex mutex_;
+  std::unordered_map<std::string, FallbackStats> stats_;
+
+ public:
+  void record(const std::string& op, const FallbackStats& call) {
+    std::lock_guard<std::mutex> _(mutex_);
+    auto& stats = stats_[op];
+    stats.calls += call.calls;
+    stats.d2h_bytes += call.d2h_bytes;
+    stats.h2d_bytes += call.h2d_bytes;
+    stats.nanoseconds += call.nanoseconds;
+  }
+
+  std::vector<std::pair<std::string, FallbackStats>> sorted() {
+    std::vector<std::pair<std::string, FallbackStats>> result;
+    {
+      std::lock_guard<std::mutex> _(mutex_);
+      result.assign(stats_.begin(), stats_.end());
+    }
+    std::sort(result.begin(), result.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.second.nanoseconds > rhs.second.nanoseconds;
+              });
+    return result;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> _(mutex_);
+    stats_.clear();
+  }
+};
+
+FallbackStatsTable& fallbackStatsTable() {
+  static FallbackStatsTable table;
+  return table;
+}
+
+}  // namespace
+
+void recordFallback(const std::string& op, const FallbackStats& call) {
+  fallbackStatsTable().record(op, call);
+}
+
+std::vector<std::pair<std::string, FallbackStats>> getFallbackStats() {
+  return fallbackStatsTable().sorted();
+}
+
+void resetFallbackStats() { fallbackStatsTable().reset(); }
+
+void printFallbackReport() {
+  if (kFallbackReportSize == 0) {
+    return;
+  }
+  auto stats = getFallbackStats();
+  if (stats.empty()) {
+    return;
+  }
+  constexpr double kMB = 1024.0 * 1024.0;
+  printf("dipu cpu fallbacks, the most expensive %zu of %zu ops:\n",
+         std::min(kFallbackReportSize, stats.size()), stats.size());
+  printf("%-50s %10s %12s %12s %12s\n", "op", "calls", "D2H(MB)", "H2D(MB)",
+         "time(ms)");
+  for (size_t i = 0; i < std::min(kFallbackReportSize, stats.size()); ++i) {
+    const auto& [op, op_stats] = stats[i];
+    printf("%-50s %10" PRIu64 " %12.2f %12.2f %12.2f\n", op.c_str(),
+           op_stats.calls,
+           static_cast<double>(op_stats.d2h_bytes) / kMB,
+           static_cast<double>(op_stats.h2d_bytes) / kMB,
+           static_cast<double>(op_stats.nanoseconds) / 1e6);
+  }
+  fflush(stdout);
+}
+
+}  // namespace dipu
@@ -0,0 +1,30 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dipu {
+
+// What the boxed CPU fallbacks of one op cost, D2H covers the device inputs
+// and H2D the written back inputs and the outputs
+struct FallbackStats {
+  uint64_t calls = 0;
+  uint64_t d2h_bytes = 0;
+  uint64_t h2d_bytes = 0;
+  uint64_t nanoseconds = 0;
+};
+
+void recordFallback(const std::string& op, const FallbackStats& call);
+
+// The ops that fell back so far, the most expensive first
+std::vector<std::pair<std::string, FallbackStats>> getFallbackStats();
+
+void resetFallbackStats();
+
+// Prints the most expensive fallbacks at exit, unless DIPU_FALLBACK_REPORT=0
+void printFallbackReport();
+
+}  // namespace dipu
@@ -0,0 +1,171 @@
+// Copyright (c) 2024, DeepLink.
+#include "OpLatency.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+#include "csrc_dipu/runtime/core/allocator/DIPUSpinMutex.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> op_latency_enabled{
+    get_env_or_default("DIPU_OP_LATENCY", 0) > 0};
+
+size_t bucketOf(std::chrono::nanoseconds duration) {
+  const auto ns = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+  if (ns == 0) {
+    return 0;
+  }
+  const auto bucket = static_cast<size_t>(64 - __builtin_clzll(ns));
+  return std::min(bucket, kOpLatencyBuckets - 1);
+}
+
+void add(LatencyHistogram& histogram, std::chrono::nanoseconds duration) {
+  ++histogram.buckets[bucketOf(duration)];
+  histogram.nanoseconds += static_cast<uint64_t>(duration.count());
+}
+
+void merge(OpLatencyStats& to, const OpLatencyStats& from) {
+  to.calls += from.calls;
+  for (size_t i = 0; i < kOpLatencyBuckets; ++i) {
+    to.prologue.buckets[i] += from.prologue.buckets[i];
+    to.call.buckets[i] += from.call.buckets[i];
+  }
+  to.prologue.nanoseconds += from.prologue.nanoseconds;
+  to.call.nanoseconds += from.call.nanoseconds;
+}
+
+// Indexed by site id, only `op` of the merged stats is set
+using OpLatencyTable = std::vector<OpLatencyStats>;
+
+void merge(OpLatencyTable& to, const OpLatencyTable& from) {
+  if (to.size() < from.size()) {
+    to.resize(from.size());
+  }
+  for (size_t i = 0; i < from.size(); ++i) {
+    merge(to[i], from[i]);
+  }
+}
+
+// The histograms of one thread. Its lock is only contended by readers.
+struct ThreadLatencies {
+  SpinMutex mutex;
+  OpLatencyTable table;
+};
+
+class LatencyRegistry {
+ public:
+  size_t addSite(const char* op) {
+    std::lock_guard<std::mutex> _(mutex_);
+    sites_.emplace_back(op);
+    return sites_.size() - 1;
+  }
+
+  void addThread(ThreadLatencies* thread) {
+    std::lock_guard<std::mutex> _(mutex_);
+    threads_.insert(thread);
+  }
+
+  // Keep what an exiting thread has recorded
+  void removeThread(ThreadLatencies* thread) {
+    std::lock_guard<std::mutex> _(mutex_);
+    threads_.erase(thread);
+    std::lock_guard<SpinMutex> thread_lock(thread->mutex);
+    merge(retired_, thread->table);
+  }
+
+  std::vector<OpLatencyStats> collect() {
+    OpLatencyTable merged;
+    std::lock_guard<std::mutex> _(mutex_);
+    merge(merged, retired_);
+    for (auto* thread : threads_) {
+      std::lock_guard<SpinMutex> thread_lock(thread->mutex);
+      merge(merged, thread->table);
+    }
+    std::vector<OpLatencyStats> result;
+    for (size_t i = 0; i < merged.size(); ++i) {
+      if (merged[i].calls > 0) {
+        merged[i].op = sites_[i];
+        result.push_back(std::move(merged[i]));
+      }
+    }
+    return result;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> _(mutex_);
+    retired_.clear();
+    for (auto* thread : threads_) {
+      std::lock_guard<SpinMutex> thread_lock(thread->mutex);
+      thread->table.clear();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  // Guarded by `mutex_`
+  std::vector<std::string> sites_;
+  std::unordered_set<ThreadLatencies*> threads_;
+  OpLatencyTable retired_;
+};
+
+LatencyRegistry& latencyRegistry() {
+  // Leaked, threads may exit after static destruction
+  static auto* registry = new LatencyRegistry();
+  return *registry;
+}
+
+ThreadLatencies& localLatencies() {
+  struct Holder {
+    ThreadLatencies latencies;
+    Holder() { latencyRegistry().addThread(&latencies); }
+    Holder(const Holder&) = delete;
+    Holder(Holder&&) = delete;
+    Holder& operator=(const Holder&) = delete;
+    Holder& operator=(Holder&&) = delete;
+    ~Holder() { latencyRegistry().removeThread(&latencies); }
+  };
+  static thread_local Holder holder;
+  return holder.latencies;
+}
+
+}  // namespace
+
+bool opLatencyEnabled() {
+  return op_latency_enabled.load(std::memory_order_relaxed);
+}
+
+void setOpLatencyEnabled(bool enabled) {
+  op_latency_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+OpLatencySite::OpLatencySite(const char* op)
+    : id_(latencyRegistry().addSite(op)) {}
+
+void recordOpLatency(const OpLatencySite& site,
+                     std::chrono::nanoseconds prologue,
+                     std::chrono::nanoseconds call) {
+  auto& latencies = localLatencies();
+  std::lock_guard<SpinMutex> _(latencies.mutex);
+  if (latencies.table.size() <= site.id()) {
+    latencies.table.resize(site.id() + 1);
+  }
+  auto& stats = latencies.table[site.id()];
+  ++stats.calls;
+  add(stats.prologue, prologue);
+  add(stats.call, call);
+}
+
+std::vector<OpLatencyStats> getOpLatencyStats() {
+  return latencyRegistry().collect();
+}
+
+void resetOpLatencyStats() { latencyRegistry().reset(); }
+
+}  // namespace dipu
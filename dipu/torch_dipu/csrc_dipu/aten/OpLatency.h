@@ -0,0 +1,91 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+namespace dipu {
+
+// Bucket 0 holds 0ns, bucket i > 0 holds [2^(i-1), 2^i) ns and the last one
+// everything longer
+constexpr size_t kOpLatencyBuckets = 40;
+
+struct LatencyHistogram {
+  std::array<uint64_t, kOpLatencyBuckets> buckets{};
+  uint64_t nanoseconds = 0;
+};
+
+// Host latencies of the calls of one generated wrapper
+struct OpLatencyStats {
+  std::string op;
+  uint64_t calls = 0;
+  // From entering the wrapper to calling DIOPI: custom code, output
+  // allocation and handle conversion
+  LatencyHistogram prologue;
+  // The DIOPI call itself, which usually only launches kernels
+  LatencyHistogram call;
+};
+
+// Initially DIPU_OP_LATENCY, can be toggled at any time
+DIPU_API bool opLatencyEnabled();
+DIPU_API void setOpLatencyEnabled(bool enabled);
+
+// A static of each wrapper, `op` must outlive the process
+class DIPU_API OpLatencySite {
+ public:
+  explicit OpLatencySite(const char* op);
+  size_t id() const { return id_; }
+
+ private:
+  size_t id_;
+};
+
+DIPU_API void recordOpLatency(const OpLatencySite& site,
+                              std::chrono::nanoseconds prologue,
+                              std::chrono::nanoseconds call);
+
+// Times one wrapper call from its construction, nothing is recorded if the
+// DIOPI call is never reached
+class OpLatencyTimer {
+  using clock = std::chrono::steady_clock;
+
+ public:
+  explicit OpLatencyTimer(const OpLatencySite& site)
+      : site_(opLatencyEnabled() ? &site : nullptr) {
+    if (site_ != nullptr) {
+      start_ = clock::now();
+    }
+  }
+
+  void beginCall() {
+    if (site_ != nullptr) {
+      call_start_ = clock::now();
+    }
+  }
+
+  void endCall() {
+    if (site_ != nullptr) {
+      recordOpLatency(*site_, call_start_ - start_,
+                      clock::now() - call_start_);
+      site_ = nullptr;
+    }
+  }
+
+ private:
+  const OpLatencySite* site_;
+  clock::time_point start_;
+  clock::time_point call_start_;
+};
+
+// Merges the histograms of all threads, ops never timed are left out
+DIPU_API std::vector<OpLatencyStats> getOpLatencyStats();
+
+DIPU_API void resetOpLatencyStats();
+
+}  // namespace dipu
@@ -2,20 +2,29 @@
 #include "RegisterDIPU.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <ios>
 #include <iostream>
 #include <regex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <ATen/EmptyTensor.h>
+#include <ATen/core/dispatch/Dispatcher.h>
 #include <ATen/core/op_registration/adaption.h>
 #include <ATen/native/CPUFallback.h>
+#include <ATen/record_function.h>
 #include <c10/core/Storage.h>
 #include <c10/util/Exception.h>
 #include <c10/util/irange.h>
 
 #include "csrc_dipu/aten/DIPUATenFunctions.h"
+#include "csrc_dipu/aten/FallbackStats.h"
 #include "csrc_dipu/base/basedef.h"
 #include "csrc_dipu/profiler/profiler.h"
+#include "csrc_dipu/utils/env.hpp"
 #include "csrc_dipu/utils/helpfunc.hpp"
 
 namespace dnative = dipu::native::dipu_aten;
@@ -23,6 +32,9 @@ namespace dnative = dipu::native::dipu_aten;
 namespace dipu {
 namespace native {
 void cpu_fallback(const c10::OperatorHandle& op, torch::jit::Stack* stack);
+// Whether fallback outputs keep their host copies, see CPUFallback.cpp
+bool cpuFallbackChainEnabled();
+bool hasHostShadow(const at::Tensor& tensor);
 }  // end of namespace native
 
 void dump_fallback_op_args(const c10::OperatorHandle& op,
@@ -84,6 +96,40 @@ void dump_fallback_op_args(const c10::OperatorHandle& op,
   }
 }
 
+namespace {
+
+// Skipping the tensors whose host copies are kept if with_shadows is false
+uint64_t deviceNbytes(const c10::IValue& ivalue, bool with_shadows = true) {
+  uint64_t nbytes = 0;
+  auto add = [&nbytes, with_shadows](const at::Tensor& tensor) {
+    if (tensor.defined() && isDeviceTensor(tensor) &&
+        (with_shadows || !native::hasHostShadow(tensor))) {
+      nbytes += tensor.nbytes();
+    }
+  };
+  if (ivalue.isTensor()) {
+    add(ivalue.toTensor());
+  } else if (ivalue.isTensorList()) {
+    for (const auto& tensor : ivalue.toTensorList()) {
+      add(tensor);
+    }
+  }
+  return nbytes;
+}
+
+// Run foreach ops without a DIPU kernel through the per-tensor loops of their
+// CPU kernels, on the device tensors, instead of falling back to the CPU
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kForeachDeviceFallback =
+    get_env_or_default("DIPU_FOREACH_DEVICE_FALLBACK", 1) > 0;
+
+bool isWriteAlias(const c10::Argument& argument) {
+  const at::AliasInfo* alias_info = argument.alias_info();
+  return alias_info != nullptr && alias_info->isWrite();
+}
+
+}  // namespace
+
 }  // end of namespace dipu
 
 namespace at {
@@ -97,6 +143,16 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
   //   "Currently the foreach operator does not support fallback: ", name);
   const bool forech_op = name.find("foreach") != std::string::npos;
 
+  // The generic `foreach_tensor_*_slow` kernels of CPU only loop over the
+  // lists and call the per-tensor op, which dispatches back to DIPU (or falls
+  // back on its own). Amp foreach ops have real CPU kernels, they are skipped.
+  if (dipu::kForeachDeviceFallback && name.rfind("aten::_foreach_", 0) == 0) {
+    DIPU_OP_LOG_WARNING_ONCE("fallback to per-tensor device loop, name="
+                             << name << std::endl);
+    op.redispatchBoxed(c10::DispatchKeySet(c10::DispatchKey::CPU), stack);
+    return;
+  }
+
   DIPU_OP_LOG_WARNING_ONCE("fallback to cpu, name=" << name << std::endl);
 
   const static std::vector<std::string> custom_fallback_operators_list{
@@ -107,27 +163,137 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
   auto iter =
       std::find(custom_fallback_operators_list.cbegin(),
                 custom_fallback_operators_list.cend(), std::string(name));
-  if (iter != custom_fallback_operators_list.cend() || forech_op) {
+
+  // Inputs are copied to the host, and written back if they are mutable
+  dipu::FallbackStats call;
+  call.calls = 1;
+  const auto& schema_args = op.schema().arguments();
+  auto arguments = torch::jit::last(stack, schema_args.size());
+  // The host copies kept of the outputs of fallback ops are used instead
+  const bool chained = dipu::native::cpuFallbackChainEnabled();
+  for (const auto idx : c10::irange(arguments.size())) {
+    const bool written = dipu::isWriteAlias(schema_args[idx]);
+    auto nbytes = dipu::deviceNbytes(arguments[idx]);
+    call.d2h_bytes +=
+        chained && !written ? dipu::deviceNbytes(arguments[idx], false) : nbytes;
+    if (written) {
+      call.h2d_bytes += nbytes;
+    }
+  }
+  // Marks the op as a fallback in profiler traces, see profiler/summary.py
+  RECORD_FUNCTION("dipu_cpu_fallback", std::vector<c10::IValue>());
+  const auto start = std::chrono::steady_clock::now();
+
+  if (iter != custom_fallback_operators_list.cend() || forech_op || chained) {
     dipu::native::cpu_fallback(op, stack);
   } else {
     at::native::cpu_fallback(op, stack);
   }
+
+  call.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  // Mutable outputs are the inputs written back above, others are copied in
+  const auto& schema_returns = op.schema().returns();
+  auto returns = torch::jit::last(stack, schema_returns.size());
+  for (const auto idx : c10::irange(returns.size())) {
+    if (!dipu::isWriteAlias(schema_returns[idx])) {
+      call.h2d_bytes += dipu::deviceNbytes(returns[idx]);
+    }
+  }
+  dipu::recordFallback(name, call);
 }
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
-std::deque<std::tuple<torch::Library*, DIPUOpRegister::OpRegFunPtr>>
-    DIPUOpRegister::dipuOpRegisterList;
+std::deque<DIPUOpRegister::PendingLibrary> DIPUOpRegister::dipuOpRegisterList;
 std::mutex DIPUOpRegister::mutex_;
+bool DIPUOpRegister::registered_ = false;
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kLazyRegisterOp =
+    dipu::get_env_or_default("DIPU_LAZY_REGISTER_OP", 0) > 0;
+
+struct LazyOp {
+  torch::Library* lib;
+  // in registration order, later ones override earlier ones as in m.impl
+  std::vector<DIPUOpRegister::OpRegFunPtr> regs;
+  c10::RegistrationHandleRAII trampoline;
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+std::mutex lazy_ops_mutex;
+std::unordered_map<c10::OperatorName, LazyOp> lazy_ops;
+// Library being registered by register_op, guarded by DIPUOpRegister::mutex_
+const DIPUOpRegister::PendingLibrary* registering_library = nullptr;
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+void registerLazyOp(const c10::OperatorName& name) {
+  std::lock_guard<std::mutex> guard(lazy_ops_mutex);
+  auto iter = lazy_ops.find(name);
+  if (iter == lazy_ops.end()) {
+    // registered by another call already
+    return;
+  }
+  auto op = std::move(iter->second);
+  lazy_ops.erase(iter);
+  {
+    // Deregister the trampoline first, the real kernel must not override it
+    auto trampoline = std::move(op.trampoline);
+  }
+  for (auto reg : op.regs) {
+    reg(*op.lib);
+  }
+}
+
+void lazyRegisteredKernel(const c10::OperatorHandle& op,
+                          c10::DispatchKeySet dispatch_keys,
+                          torch::jit::Stack* stack) {
+  registerLazyOp(op.operator_name());
+  // Dispatch again to the same key, which now has the real kernel, or falls
+  // back to the cpu if the op is not supported
+  op.redispatchBoxed(dispatch_keys, stack);
+}
+
+}  // namespace
+
 void DIPUOpRegister::register_op() {
   std::lock_guard<std::mutex> guard(mutex_);
   for (auto& iter : dipuOpRegisterList) {
-    torch::Library* lib = std::get<0>(iter);
-    DIPUOpRegister::OpRegFunPtr fun_ptr = std::get<1>(iter);
-    fun_ptr(*lib);
+    registering_library = &iter;
+    iter.fun_ptr(*iter.lib);
   }
+  registering_library = nullptr;
   dipuOpRegisterList.clear();
+  registered_ = true;
+}
+
+void DIPUOpRegister::registerOp(torch::Library& lib, const char* opname,
+                                OpRegFunPtr reg) {
+  if (!kLazyRegisterOp || registering_library == nullptr ||
+      registering_library->lib != &lib || !registering_library->key) {
+    reg(lib);
+    return;
+  }
+
+  auto name = std::string(opname);
+  auto dot = name.find('.');
+  auto op_name = c10::OperatorName(
+      std::string(registering_library->ns) + "::" + name.substr(0, dot),
+      dot == std::string::npos ? "" : name.substr(dot + 1));
+  std::lock_guard<std::mutex> guard(lazy_ops_mutex);
+  auto iter = lazy_ops.find(op_name);
+  if (iter != lazy_ops.end()) {
+    iter->second.regs.push_back(reg);
+    return;
+  }
+  auto trampoline = c10::Dispatcher::singleton().registerImpl(
+      op_name, registering_library->key,
+      c10::KernelFunction::makeFromBoxedFunction<&lazyRegisteredKernel>(),
+      c10::nullopt, nullptr, "registered lazily by DIPU");
+  lazy_ops.emplace(op_name, LazyOp{&lib, {reg}, std::move(trampoline)});
 }
 
 namespace {
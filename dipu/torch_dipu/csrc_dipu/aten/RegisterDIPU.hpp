@@ -49,8 +49,8 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
 // It mat be necessary to determine whether to keep torchop default impl
 // for non-custom ops through function dipuKeepTorchopDefaultImpl firstly in the
 // future, and we use force fallback to keep torchop default impl now.
-#define NO_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER(opname, diopiFunc,         \
-                                                    wrapperFunc)               \
+#define NO_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER_EAGER(                     \
+    opname, diopiFunc, wrapperFunc)                                            \
   do {                                                                         \
     if ((reinterpret_cast<void*>(diopiFunc) != nullptr) &&                     \
         (!dipu::op_regex_match::isOpMatch(                                     \
@@ -73,8 +73,8 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
     }                                                                          \
   } while (false);
 
-#define NO_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER(opname, diopiFunc,           \
-                                                  wrapperFunc)                 \
+#define NO_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER_EAGER(opname, diopiFunc,     \
+                                                        wrapperFunc)           \
   do {                                                                         \
     if ((reinterpret_cast<void*>(diopiFunc) != nullptr) &&                     \
         (!dipu::op_regex_match::isOpMatch(                                     \
@@ -94,7 +94,7 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
 
 // Determine whether to keep torchop default impl for custom ops through
 // function dipuKeepTorchopDefaultImpl firstly.
-#define WITH_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER(                         \
+#define WITH_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER_EAGER(                   \
     opname, diopi_func, force_fallback, wrapper_func, custom_fallback_func)    \
   do {                                                                         \
     if (dipu::native::dipuKeepTorchopDefaultImpl(opname)) {                    \
@@ -123,7 +123,7 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
     }                                                                          \
   } while (false);
 
-#define WITH_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER(                           \
+#define WITH_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER_EAGER(                     \
     opname, diopi_func, force_fallback, wrapper_func, custom_fallback_func)    \
   do {                                                                         \
     if (dipu::native::dipuKeepTorchopDefaultImpl(opname)) {                    \
@@ -147,17 +147,55 @@ void dipu_fallback(const c10::OperatorHandle& op, DispatchKeySet dispatch_keys,
     }                                                                          \
   } while (false);
 
+// Register an op through `DIPUOpRegister::registerOp`, so that with
+// DIPU_LAZY_REGISTER_OP set, the fallback and autocompare resolution and the
+// m.impl of the op run on its first call.
+#define DIPU_REGISTER_OP(opname, ...)                                      \
+  ::at::DIPUOpRegister::registerOp(m, opname,                              \
+                                   [](torch::Library& m) { __VA_ARGS__ })
+
+#define NO_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER(opname, diopiFunc,         \
+                                                    wrapperFunc)               \
+  DIPU_REGISTER_OP(opname, NO_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER_EAGER(  \
+                               opname, diopiFunc, wrapperFunc))
+
+#define NO_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER(opname, diopiFunc,         \
+                                                  wrapperFunc)               \
+  DIPU_REGISTER_OP(opname, NO_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER_EAGER(  \
+                               opname, diopiFunc, wrapperFunc))
+
+#define WITH_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER(                       \
+    opname, diopi_func, force_fallback, wrapper_func, custom_fallback_func)  \
+  DIPU_REGISTER_OP(opname,                                                   \
+                   WITH_CUSTOMFALLBACK_WITH_AUTOCOMPARE_REGISTER_EAGER(      \
+                       opname, diopi_func, force_fallback, wrapper_func,     \
+                       custom_fallback_func))
+
+#define WITH_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER(                         \
+    opname, diopi_func, force_fallback, wrapper_func, custom_fallback_func)  \
+  DIPU_REGISTER_OP(opname,                                                   \
+                   WITH_CUSTOMFALLBACK_NO_AUTOCOMPARE_REGISTER_EAGER(        \
+                       opname, diopi_func, force_fallback, wrapper_func,     \
+                       custom_fallback_func))
+
 class DIPUOpRegister {
  public:
   using OpRegFunPtr = void (*)(torch::Library&);
 
  private:
+  struct PendingLibrary {
+    torch::Library* lib;
+    OpRegFunPtr fun_ptr;
+    const char* ns;
+    c10::optional<c10::DispatchKey> key;
+  };
+
   OpRegFunPtr fun_ptr_;
   torch::Library lib_;
   // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
-  static std::deque<std::tuple<torch::Library*, OpRegFunPtr>>
-      dipuOpRegisterList;
+  static std::deque<PendingLibrary> dipuOpRegisterList;
   static std::mutex mutex_;
+  static bool registered_;
   // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
  public:
@@ -170,11 +208,23 @@ class DIPUOpRegister {
       fun_ptr_(lib_);
     } else {
       std::lock_guard<std::mutex> guard(mutex_);
-      dipuOpRegisterList.emplace_back(&lib_, fun_ptr_);
+      // Libraries loaded after register_op, e.g. extensions built with
+      // TorchDipuConfig.cmake, register right away
+      if (registered_) {
+        fun_ptr_(lib_);
+      } else {
+        dipuOpRegisterList.push_back({&lib_, fun_ptr_, ns, key});
+      }
     }
   }
 
   static void register_op();
+
+  // Run `reg` on `lib` now, or in lazy mode, register a trampoline kernel
+  // which runs it on the first call of the op. Lazy registration is only
+  // done inside register_op, where the namespace and key of `lib` are known.
+  static void registerOp(torch::Library& lib, const char* opname,
+                         OpRegFunPtr reg);
 };
 
 }  // namespace at
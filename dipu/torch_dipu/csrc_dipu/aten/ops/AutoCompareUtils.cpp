@@ -0,0 +1,269 @@
+// Copyright (c) 2024, DeepLink.
+#include "AutoCompareUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include <ATen/core/LegacyTypeDispatch.h>
+
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+namespace native {
+namespace autocompare {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+RuntimeConfig<uint64_t> gSampleInterval("DIPU_AUTOCOMPARE_SAMPLE_INTERVAL",
+                                        uint64_t{0});
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+RuntimeConfig<double> gSampleRate("DIPU_AUTOCOMPARE_SAMPLE_RATE", 0.0);
+
+// Sampled calls waiting for their CPU reference, more are dropped so that the
+// overhead stays bounded when the CPU can't keep up
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kMaxPendingSamples = std::max<size_t>(
+    get_env_or_default("DIPU_AUTOCOMPARE_MAX_PENDING", size_t{64}), 1);
+
+// Same as the ones of allclose_autocompare
+constexpr double kToleranceAbsolute = 1e-4;
+constexpr double kToleranceRelative = 1e-5;
+
+struct Statistics {
+  uint64_t compared = 0;
+  uint64_t not_close = 0;
+  // Undefined on one side only, mismatched sizes, or a failed CPU reference
+  uint64_t errors = 0;
+  double max_abs = 0;
+  double max_rel = 0;
+};
+
+// A NaN error is sticky
+void updateMax(double& current, double value) {
+  if (std::isnan(value) || value > current) {
+    current = value;
+  }
+}
+
+class StatisticsReport final : public Report {
+ public:
+  using Report::compare;
+
+  void compare(const char* op, const char* name, const at::Tensor& expected,
+               const at::Tensor& actual) override {
+    auto& stats = entry(op, name);
+    if (!expected.defined() || !actual.defined()) {
+      ++(expected.defined() == actual.defined() ? stats.compared
+                                                : stats.errors);
+      return;
+    }
+    if (expected.sizes() != actual.sizes()) {
+      ++stats.errors;
+      return;
+    }
+    ++stats.compared;
+    if (expected.numel() == 0) {
+      return;
+    }
+
+    const bool complex = expected.is_complex() || actual.is_complex();
+    const auto dtype = complex ? at::kComplexDouble : at::kDouble;
+    const auto expected_value = expected.to(dtype);
+    const auto actual_value = actual.to(dtype);
+    auto diff = (expected_value - actual_value).abs();
+    // equal infinities and NaNs on both sides are close, as with allclose
+    diff.masked_fill_((expected_value == actual_value) |
+                          (expected_value.isnan() & actual_value.isnan()),
+                      0);
+    const auto magnitude = expected_value.abs();
+    const auto relative =
+        diff / magnitude.clamp_min(std::numeric_limits<double>::min());
+    updateMax(stats.max_abs, diff.max().item<double>());
+    updateMax(stats.max_rel, relative.max().item<double>());
+    const bool close =
+        (diff <= kToleranceAbsolute + kToleranceRelative * magnitude)
+            .all()
+            .item<bool>();
+    if (!close) {
+      ++stats.not_close;
+    }
+  }
+
+  void mismatch(const char* op, const char* name) override {
+    ++entry(op, name).errors;
+  }
+
+  void format(std::ostream& stream) const {
+    stream << std::left << std::setw(40) << "op" << std::setw(16) << "name"
+           << std::right << std::setw(10) << "compared" << std::setw(11)
+           << "not_close" << std::setw(8) << "errors" << std::setw(14)
+           << "max_abs" << std::setw(14) << "max_rel"
+           << "\n";
+    for (const auto& [key, stats] : stats_) {
+      stream << std::left << std::setw(40) << key.first << std::setw(16)
+             << key.second << std::right << std::setw(10) << stats.compared
+             << std::setw(11) << stats.not_close << std::setw(8)
+             << stats.errors << std::setw(14) << stats.max_abs
+             << std::setw(14) << stats.max_rel << "\n";
+    }
+  }
+
+ private:
+  Statistics& entry(const char* op, const char* name) {
+    return stats_[{op, name}];
+  }
+
+  std::map<std::pair<std::string, std::string>, Statistics> stats_;
+};
+
+// Runs the CPU references one by one on a single background thread
+class Sampler {
+ public:
+  static Sampler& instance() {
+    static Sampler sampler;
+    return sampler;
+  }
+
+  Sampler() = default;
+  Sampler(const Sampler&) = delete;
+  Sampler(Sampler&&) = delete;
+  Sampler& operator=(const Sampler&) = delete;
+  Sampler& operator=(Sampler&&) = delete;
+
+  ~Sampler() { stop(); }
+
+  void enqueue(Task task) {
+    {
+      std::lock_guard<std::mutex> _(mutex_);
+      ++sampled_;
+      if (stopping_ || pending_ >= kMaxPendingSamples) {
+        ++dropped_;
+        return;
+      }
+      if (!worker_.joinable()) {
+        worker_ = std::thread([this] { run(); });
+      }
+      ++pending_;
+      tasks_.push_back(std::move(task));
+    }
+    wake_.notify_one();
+  }
+
+  std::string report() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return pending_ == 0; });
+    std::ostringstream stream;
+    stream << "autocompare report: " << sampled_ << " sampled calls, "
+           << dropped_ << " dropped\n";
+    std::lock_guard<std::mutex> _(report_mutex_);
+    report_.format(stream);
+    return stream.str();
+  }
+
+  // Drains the pending comparisons first, later samples are dropped
+  void stop() {
+    {
+      std::lock_guard<std::mutex> _(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+  bool sampled() {
+    std::lock_guard<std::mutex> _(mutex_);
+    return sampled_ > 0;
+  }
+
+ private:
+  void run() {
+    // same as in the wrappers, which run below autograd
+    at::AutoDispatchBelowADInplaceOrView guard;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      auto task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> _(report_mutex_);
+        task(report_);
+      }
+      lock.lock();
+      --pending_;
+      idle_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  // Guarded by `mutex_`
+  std::deque<Task> tasks_;
+  size_t pending_ = 0;
+  uint64_t sampled_ = 0;
+  uint64_t dropped_ = 0;
+  bool stopping_ = false;
+  std::thread worker_;
+
+  std::mutex report_mutex_;
+  StatisticsReport report_;
+};
+
+}  // namespace
+
+bool sampling() { return gSampleInterval.get() > 0 || gSampleRate.get() > 0; }
+
+bool OpSampler::sample() {
+  const uint64_t interval = gSampleInterval.get();
+  if (interval > 0) {
+    return calls_.fetch_add(1, std::memory_order_relaxed) % interval == 0;
+  }
+  thread_local std::mt19937_64 engine{std::random_device{}()};
+  thread_local std::uniform_real_distribution<double> distribution;
+  return distribution(engine) < gSampleRate.get();
+}
+
+void OpSampler::enqueue(Task task) const {
+  Sampler::instance().enqueue([op = op_, task = std::move(task)](Report& r) {
+    try {
+      task(r);
+    } catch (const std::exception&) {
+      // Don't let a failed CPU reference abort model running
+      r.mismatch(op, "(reference)");
+    }
+  });
+}
+
+std::string report() { return Sampler::instance().report(); }
+
+void releaseAutocompare() {
+  if (!sampling()) {
+    return;
+  }
+  auto& sampler = Sampler::instance();
+  sampler.stop();
+  if (sampler.sampled()) {
+    std::cout << sampler.report();
+  }
+}
+
+}  // namespace autocompare
+}  // namespace native
+}  // namespace dipu
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iomanip>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <ATen/core/TensorBody.h>
 #include <ATen/ops/abs.h>
@@ -14,6 +20,9 @@
 #include <c10/core/Device.h>
 #include <c10/util/ArrayRef.h>
 #include <c10/util/Exception.h>
+#include <c10/util/Optional.h>
+#include <c10/util/OptionalArrayRef.h>
+#include <c10/util/string_view.h>
 
 #include "csrc_dipu/aten/ops/OpUtils.hpp"
 
@@ -197,5 +206,145 @@ inline std::string allclose_autocompare(T val_expected, T val_real,
   return stream.str();
 }
 
+// Sampled autocompare, for accuracy canaries inside real training jobs. It is
+// enabled by DIPU_AUTOCOMPARE_SAMPLE_INTERVAL=N (every Nth call of each op) or
+// DIPU_AUTOCOMPARE_SAMPLE_RATE=p (a random fraction p of the calls). Sampled
+// calls snapshot their arguments and results to the CPU, the CPU reference
+// runs on a background thread, and only max-abs / max-rel error statistics
+// per op are kept. They are printed at exit, or returned by `report()`.
+namespace autocompare {
+
+bool sampling();
+
+// Aggregated statistics, only touched by the background thread
+class Report {
+ public:
+  virtual ~Report() = default;
+
+  virtual void compare(const char* op, const char* name,
+                       const at::Tensor& expected,
+                       const at::Tensor& actual) = 0;
+  virtual void mismatch(const char* op, const char* name) = 0;
+
+  void compare(const char* op, const char* name,
+               c10::ArrayRef<at::Tensor> expected,
+               c10::ArrayRef<at::Tensor> actual) {
+    if (expected.size() != actual.size()) {
+      mismatch(op, name);
+      return;
+    }
+    for (size_t i = 0; i < expected.size(); ++i) {
+      compare(op, name, expected[i], actual[i]);
+    }
+  }
+
+  template <typename T,
+            std::enable_if_t<std::is_arithmetic<T>::value, bool> = true>
+  void compare(const char* op, const char* name, T expected, T actual) {
+    if (expected != actual) {
+      mismatch(op, name);
+    }
+  }
+};
+
+using Task = std::function<void(Report&)>;
+
+// One for each autocompare wrapper
+class OpSampler {
+ public:
+  explicit OpSampler(const char* op) : op_(op) {}
+
+  // Whether the current call is compared
+  bool sample();
+
+  // Runs `task` on the background thread, or drops it when too many are
+  // pending
+  void enqueue(Task task) const;
+
+ private:
+  const char* op_;
+  std::atomic<uint64_t> calls_{0};
+};
+
+// Waits for the pending comparisons and formats the statistics so far
+std::string report();
+
+// Stops the background thread and prints the report, if anything was sampled
+void releaseAutocompare();
+
+// Owning copies of the wrapper arguments, for the CPU reference to run after
+// the wrapper returned
+template <typename T>
+T own(const T& value) {
+  return value;
+}
+
+template <typename T>
+std::vector<T> own(c10::ArrayRef<T> value) {
+  return value.vec();
+}
+
+inline std::string own(c10::string_view value) {
+  return std::string(value.data(), value.size());
+}
+
+inline c10::optional<std::string> own(
+    const c10::optional<c10::string_view>& value) {
+  if (!value.has_value()) {
+    return c10::nullopt;
+  }
+  return own(*value);
+}
+
+template <typename T>
+struct OwnedOptionalArrayRef {
+  c10::optional<std::vector<T>> values;
+
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  operator c10::OptionalArrayRef<T>() const {
+    if (!values.has_value()) {
+      return c10::nullopt;
+    }
+    return c10::ArrayRef<T>(*values);
+  }
+};
+
+template <typename T>
+OwnedOptionalArrayRef<T> own(const c10::OptionalArrayRef<T>& value) {
+  if (!value.has_value()) {
+    return {};
+  }
+  return {value->vec()};
+}
+
+// CPU copies of what the device op returned or modified
+inline at::Tensor snapshot(const at::Tensor& tensor) {
+  return tensor.defined() ? toCpuTensorWithoutDiopiCopy(tensor) : tensor;
+}
+
+inline std::vector<at::Tensor> snapshot(c10::ArrayRef<at::Tensor> tensors) {
+  std::vector<at::Tensor> result;
+  result.reserve(tensors.size());
+  for (const auto& tensor : tensors) {
+    result.push_back(snapshot(tensor));
+  }
+  return result;
+}
+
+template <typename T,
+          std::enable_if_t<std::is_arithmetic<T>::value, bool> = true>
+T snapshot(T value) {
+  return value;
+}
+
+template <typename... Ts>
+auto snapshot(const std::tuple<Ts...>& values) {
+  return std::apply(
+      [](const auto&... value) { return std::make_tuple(snapshot(value)...); },
+      values);
+}
+
+}  // namespace autocompare
+
 }  // namespace native
 }  // namespace dipu
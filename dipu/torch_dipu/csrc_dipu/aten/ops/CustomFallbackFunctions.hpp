@@ -6,6 +6,9 @@
 
 #include "csrc_dipu/aten/RegisterDIPU.hpp"
 
+#include "DIPUFp8.h"
+#include "DIPUVarlenAttention.h"
+#include "DIPUWeightQuant.h"
 #include "OpUtils.hpp"
 
 namespace dipu {
@@ -505,5 +508,42 @@ static at::Tensor& custom_fallback_dipu_sigmoid_backward_grad_input(
   return grad_input;
 }
 
+static std::tuple<at::Tensor, at::Tensor> custom_fallback_dipu__scaled_mm(
+    const at::Tensor& self, const at::Tensor& mat2,
+    const c10::optional<at::Tensor>& bias,
+    c10::optional<at::ScalarType> out_dtype,
+    const c10::optional<at::Tensor>& scale_a,
+    const c10::optional<at::Tensor>& scale_b,
+    const c10::optional<at::Tensor>& scale_result) {
+  DIPU_OP_LOG_WARNING_ONCE("custom fallback to float, name=_scaled_mm"
+                           << std::endl);
+  return scaledMmReference(self, mat2, bias, out_dtype, scale_a, scale_b,
+                           scale_result);
+}
+
+// Dequantizes on the device rather than on the cpu, the weight is the large
+// operand
+static at::Tensor custom_fallback_dipu_weight_quant_matmul(
+    const at::Tensor& input, const at::Tensor& weight, const at::Tensor& scale,
+    const c10::optional<at::Tensor>& offset,
+    const c10::optional<at::Tensor>& bias, int64_t group_size, int64_t bits) {
+  DIPU_OP_LOG_WARNING_ONCE(
+      "custom fallback to dequantize, name=weight_quant_matmul" << std::endl);
+  return weightQuantMatmulReference(input, weight, scale, offset, bias,
+                                    group_size, bits);
+}
+
+static at::Tensor custom_fallback_dipu_varlen_attention(
+    const at::Tensor& q, const at::Tensor& k, const at::Tensor& v,
+    const at::Tensor& cu_seqlens_q, const at::Tensor& cu_seqlens_kv,
+    int64_t max_seqlen_q, int64_t max_seqlen_kv, c10::optional<double> scale,
+    bool causal) {
+  DIPU_OP_LOG_WARNING_ONCE(
+      "custom fallback to per sequence attention, name=varlen_attention"
+      << std::endl);
+  return varlenAttentionReference(q, k, v, cu_seqlens_q, cu_seqlens_kv,
+                                  max_seqlen_q, max_seqlen_kv, scale, causal);
+}
+
 }  // namespace native
 }  // namespace dipu
@@ -4,31 +4,22 @@
 // GradScaler. The corresponding declarations can be found in
 // CustomFallbackFunctions.hpp.
 
+#include <vector>
+
 #include <ATen/ATen.h>
 
 #include "csrc_dipu/aten/RegisterDIPU.hpp"
+#include "csrc_dipu/aten/ops/DIPUScalarCache.h"
 
 namespace dipu {
 namespace native {
 
 namespace {
 
-void _amp_non_finite_check_and_unscale_(at::Tensor& scaled_grad,
-                                        at::Tensor& found_inf,
-                                        const at::Tensor& inv_scale) {
-  scaled_grad *= inv_scale.item();
-  if (!scaled_grad.isfinite().all().item<bool>()) {
-    found_inf[0] = 1.F;
-  }
-}
-
-// growth_tracker in torch 2.1 is a scalar tensor. in 2.0 is a dim=1 tensor.
-void set_growth_tracker(at::Tensor& growth_tracker, int value) {
-  if (growth_tracker.ndimension() == 1) {
-    growth_tracker[0] = value;
-  } else {
-    growth_tracker.fill_(c10::Scalar(value));
-  }
+// Views a one-element tensor as a scalar tensor, which broadcasts to and type
+// promotes like a scalar in the ops below
+at::Tensor asScalarTensor(const at::Tensor& tensor) {
+  return tensor.reshape({});
 }
 
 }  // anonymous namespace
@@ -54,11 +45,20 @@ void custom_fallback_dipu__amp_foreach_non_finite_check_and_unscale_(
       << std::endl);
   TORCH_CHECK(inv_scale.numel() == 1, "inv_scale must be a 1-element tensor.");
   TORCH_CHECK(found_inf.numel() == 1, "found_inf must be a 1-element tensor.");
+  if (scaled_grads.empty()) {
+    return;
+  }
+  // Everything stays on the device: a finite flag per tensor, reduced once
+  // into found_inf, instead of a host sync per tensor.
+  const auto scale = asScalarTensor(inv_scale);
+  std::vector<at::Tensor> finite;
+  finite.reserve(scaled_grads.size());
   for (const at::Tensor& t : scaled_grads) {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast): const_cast here is safe according to pytorch's source code
-    _amp_non_finite_check_and_unscale_(const_cast<at::Tensor&>(t), found_inf,
-                                       inv_scale);
+    const_cast<at::Tensor&>(t).mul_(scale);
+    finite.push_back(t.isfinite().all());
   }
+  found_inf.masked_fill_(at::logical_not(at::stack(finite).all()), 1.F);
 }
 
 // Updates the scale tensor in place.
@@ -93,20 +93,24 @@ at::Tensor& custom_fallback_dipu__amp_update_scale_(at::Tensor& current_scale,
               "current_scale must be a float tensor.");
   TORCH_CHECK(found_inf.scalar_type() == at::ScalarType::Float,
               "found_inf must be a float tensor.");
-  if (static_cast<bool>(found_inf.item<float>())) {
-    current_scale *= backoff_factor;
-    set_growth_tracker(growth_tracker, 0);
-  } else {
-    // Entering this branch means we just carried out a successful step,
-    // so growth_tracker is incremented before comparing to growth_interval.
-    auto successful = growth_tracker.item<int>() + 1;
-    if (successful == growth_interval) {
-      current_scale *= growth_factor;
-      set_growth_tracker(growth_tracker, 0);
-    } else {
-      set_growth_tracker(growth_tracker, successful);
-    }
-  }
+  // The same state machine as the CUDA kernel, in tensor ops so that the
+  // step needs no host sync
+  const auto found = asScalarTensor(found_inf) > 0;
+  // Entering the growth branch means we just carried out a successful step,
+  // so growth_tracker is incremented before comparing to growth_interval.
+  const auto successful = asScalarTensor(growth_tracker) + 1;
+  const auto interval_reached = successful == growth_interval;
+  // The factors are the same every step, so they come from the scalar cache
+  const auto dtype = current_scale.scalar_type();
+  const auto device = current_scale.device();
+  const auto factor = at::where(
+      found, cachedScalarTensor(backoff_factor, dtype, device),
+      at::where(interval_reached,
+                cachedScalarTensor(growth_factor, dtype, device),
+                cachedScalarTensor(1, dtype, device)));
+  current_scale.mul_(factor);
+  growth_tracker.copy_(at::where(at::logical_or(found, interval_reached),
+                                 at::zeros_like(successful), successful));
   return current_scale;
 }
 
@@ -2,17 +2,209 @@
 
 #include "DIPUAmp.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
+#include <ATen/Functions.h>
 #include <ATen/Operators.h>
 #include <ATen/autocast_mode.h>
+#include <c10/core/GradMode.h>
+#include <c10/util/intrusive_ptr.h>
 #include <torch/library.h>
 
 #include "csrc_dipu/base/basedef.h"
 #include "csrc_dipu/runtime/device/basedef.h"
+#include "csrc_dipu/utils/env.hpp"
+
+#include "DIPUFp8.h"
 
 #ifndef DIPU_NO_VENDOR_AUTOCAST
 #include "csrc_dipu/vendor/vendor_autocast.h"
 #endif
 
+namespace dipu {
+namespace autocast {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> gPersistentCastCacheEnabled{
+    get_env_or_default("DIPU_AMP_PERSISTENT_CAST_CACHE", 0) > 0};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> gFp8AutocastEnabled{
+    get_env_or_default("DIPU_AMP_FP8", 0) > 0};
+
+class PersistentCastCache {
+  struct Entry {
+    // Weak, so the cache neither keeps the weight alive nor sees its address
+    // reused by another tensor
+    c10::weak_intrusive_ptr<c10::TensorImpl, c10::UndefinedTensorImpl> source;
+    uint32_t version = 0;
+    at::ScalarType type = at::ScalarType::Undefined;
+    at::Tensor cast;
+  };
+
+  std::mutex mutex_;
+  std::unordered_map<const c10::TensorImpl*, Entry> entries_;
+  size_t sweep_size_ = 64;
+
+  // Drops the entries of freed weights once the cache doubled since the last
+  // sweep
+  void maybeSweep() {
+    if (entries_.size() < sweep_size_) {
+      return;
+    }
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      it = it->second.source.expired() ? entries_.erase(it) : std::next(it);
+    }
+    sweep_size_ = std::max(sweep_size_, 2 * entries_.size());
+  }
+
+ public:
+  at::Tensor cast(at::ScalarType to_type, const at::Tensor& arg) {
+    const auto version = arg._version();
+    {
+      std::lock_guard<std::mutex> _(mutex_);
+      auto it = entries_.find(arg.unsafeGetTensorImpl());
+      if (it != entries_.end() && it->second.version == version &&
+          it->second.type == to_type && !it->second.source.expired()) {
+        return it->second.cast;
+      }
+    }
+    auto result = arg.to(to_type);
+    std::lock_guard<std::mutex> _(mutex_);
+    maybeSweep();
+    entries_[arg.unsafeGetTensorImpl()] = {
+        c10::weak_intrusive_ptr<c10::TensorImpl, c10::UndefinedTensorImpl>(
+            arg.getIntrusivePtr()),
+        version, to_type, result};
+    return result;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> _(mutex_);
+    entries_.clear();
+  }
+};
+
+PersistentCastCache& persistentCastCache() {
+  static PersistentCastCache cache;
+  return cache;
+}
+
+}  // namespace
+
+void setPersistentCastCacheEnabled(bool enabled) {
+  gPersistentCastCacheEnabled = enabled;
+  if (!enabled) {
+    clearPersistentCastCache();
+  }
+}
+
+bool persistentCastCacheEnabled() { return gPersistentCastCacheEnabled; }
+
+void clearPersistentCastCache() { persistentCastCache().clear(); }
+
+// at::autocast::cached_cast, whose cache is cleared on leaving each autocast
+// region, unless the persistent cache applies
+inline at::Tensor cachedCast(at::ScalarType to_type, const at::Tensor& arg,
+                             c10::DeviceType device_type) {
+  if (gPersistentCastCacheEnabled.load(std::memory_order_relaxed) &&
+      !c10::GradMode::is_enabled() &&
+      at::autocast::is_eligible(arg, device_type) &&
+      arg.scalar_type() == at::kFloat && arg.requires_grad() &&
+      arg.is_leaf() && !arg.is_view() && !arg.is_inference() &&
+      (to_type == at::kHalf || to_type == at::kBFloat16)) {
+    return persistentCastCache().cast(to_type, arg);
+  }
+  return at::autocast::cached_cast(to_type, arg, device_type);
+}
+
+// Other args, e.g. optional tensors and tensor lists, go the usual way
+template <typename T>
+inline decltype(auto) cachedCast(at::ScalarType to_type, const T& arg,
+                                 c10::DeviceType device_type) {
+  return at::autocast::cached_cast(to_type, arg, device_type);
+}
+
+void setFp8AutocastEnabled(bool enabled) { gFp8AutocastEnabled = enabled; }
+
+bool fp8AutocastEnabled() { return gFp8AutocastEnabled; }
+
+inline bool fp8AutocastActive() {
+  return gFp8AutocastEnabled.load(std::memory_order_relaxed) &&
+         native::isFp8MatmulSupported();
+}
+
+#if DIPU_TORCH_VERSION >= 20100
+
+namespace {
+
+// float8 matmul kernels take k and n in multiples of 16
+bool fp8Eligible(const at::Tensor& a, const at::Tensor& b, int64_t n,
+                 c10::DeviceType device_type) {
+  return at::autocast::is_eligible(a, device_type) &&
+         at::autocast::is_eligible(b, device_type) && a.size(-1) % 16 == 0 &&
+         n % 16 == 0;
+}
+
+// at::_scaled_mm has no autograd, so calls that need gradients stay in
+// lower_precision_fp
+bool fp8NeedsGrad(const at::Tensor& a, const at::Tensor& b,
+                  const c10::optional<at::Tensor>& bias = c10::nullopt) {
+  return c10::GradMode::is_enabled() &&
+         (a.requires_grad() || b.requires_grad() ||
+          (bias.has_value() && bias->defined() && bias->requires_grad()));
+}
+
+// The e4m3 cast of t scaled so that its amax is the largest e4m3 value, and
+// the inverse of the scale as at::_scaled_mm takes it
+std::tuple<at::Tensor, at::Tensor> castToFp8(const at::Tensor& t) {
+  constexpr float kE4m3Max = 448.0F;
+  auto inv_scale =
+      t.abs().max().to(at::kFloat).clamp_min(1e-12).div_(kE4m3Max);
+  auto cast = t.to(at::kFloat).div(inv_scale).clamp_(-kE4m3Max, kE4m3Max);
+  return {cast.to(at::kFloat8_e4m3fn), inv_scale};
+}
+
+at::Tensor fp8Mm(const at::Tensor& self, const at::Tensor& mat2,
+                 const c10::optional<at::Tensor>& bias,
+                 at::ScalarType out_type) {
+  auto [a, scale_a] = castToFp8(self);
+  auto [b, scale_b] = castToFp8(mat2);
+  // mat2 goes in column major, as a transposed weight already is
+  b = b.t().contiguous().t();
+  return std::get<0>(
+      at::_scaled_mm(a, b, bias, out_type, scale_a, scale_b, c10::nullopt));
+}
+
+at::Tensor fp8Linear(const at::Tensor& input, const at::Tensor& weight,
+                     const c10::optional<at::Tensor>& bias,
+                     at::ScalarType out_type) {
+  auto sizes = input.sizes().vec();
+  sizes.back() = weight.size(0);
+  c10::optional<at::Tensor> out_bias;
+  if (bias.has_value() && bias->defined()) {
+    out_bias = bias->to(out_type);
+  }
+  auto out = fp8Mm(input.reshape({-1, input.size(-1)}), weight.t(), out_bias,
+                   out_type);
+  return out.view(sizes);
+}
+
+}  // namespace
+
+#endif
+
+}  // namespace autocast
+}  // namespace dipu
+
 namespace at {
 namespace autocast {
 
@@ -54,6 +246,13 @@ enum class CastPolicy : uint8_t {
                        // append at::kFloat to the args, and redispatch to the
   // type-aware overload.
   promote,  // Run in the widest dtype among several args.
+  // DIPU only: cast all inputs to a fixed lower precision type, for ops the
+  // device runs faster, or only, in that type.
+  fp16,
+  bf16,
+  // DIPU only: run in float8 if the op has an Fp8Kernel below and fp8
+  // autocast is active, otherwise like lower_precision_fp.
+  fp8,
 };
 
 // Base template for WrapFunction_, which is specialized to contain a "call"
@@ -72,9 +271,9 @@ struct WrapFunction_<CastPolicy::lower_precision_fp, device_type, Redispatch, F,
     // Autograd, it's just alias of AutocastCUDA (see c10/core/DispatchKey.h)
     c10::impl::ExcludeDispatchKeyGuard no_autocast(
         get_autocast_dispatch_key_from_device_type(device_type));
-    return (*F)(
-        cached_cast(get_lower_precision_fp_from_device_type(device_type), args,
-                    device_type)...);
+    return (*F)(dipu::autocast::cachedCast(
+        get_lower_precision_fp_from_device_type(device_type), args,
+        device_type)...);
   }
 };
 
@@ -138,7 +337,96 @@ struct WrapFunction_<CastPolicy::promote, device_type, Redispatch, F, Ret,
     auto to_type =
         promote_type(get_lower_precision_fp_from_device_type(device_type),
                      device_type, args...);
-    return (*F)(cached_cast(to_type, args, device_type)...);
+    return (*F)(dipu::autocast::cachedCast(to_type, args, device_type)...);
+  }
+};
+
+// CastPolicy::fp16 and CastPolicy::bf16 General_DeviceType, like
+// lower_precision_fp with a fixed type
+template <CastPolicy policy, DeviceType device_type, class Redispatch,
+          Redispatch* F, class Ret, class... Args>
+struct WrapFixedTypeFunction_ {
+  static Ret call(Args... args) {
+    constexpr auto to_type =
+        policy == CastPolicy::fp16 ? at::kHalf : at::kBFloat16;
+    c10::impl::ExcludeDispatchKeyGuard no_autocast(
+        get_autocast_dispatch_key_from_device_type(device_type));
+    return (*F)(dipu::autocast::cachedCast(to_type, args, device_type)...);
+  }
+};
+
+template <DeviceType device_type, class Redispatch, Redispatch* F, class Ret,
+          class... Args>
+struct WrapFunction_<CastPolicy::fp16, device_type, Redispatch, F, Ret,
+                     guts::typelist::typelist<Args...>>
+    : WrapFixedTypeFunction_<CastPolicy::fp16, device_type, Redispatch, F, Ret,
+                             Args...> {};
+
+template <DeviceType device_type, class Redispatch, Redispatch* F, class Ret,
+          class... Args>
+struct WrapFunction_<CastPolicy::bf16, device_type, Redispatch, F, Ret,
+                     guts::typelist::typelist<Args...>>
+    : WrapFixedTypeFunction_<CastPolicy::bf16, device_type, Redispatch, F, Ret,
+                             Args...> {};
+
+// The float8 kernels of the ops CastPolicy::fp8 can run in float8
+template <DeviceType device_type, class Redispatch, Redispatch* F>
+struct Fp8Kernel {
+  static constexpr bool kAvailable = false;
+};
+
+#if DIPU_TORCH_VERSION >= 20100
+
+template <DeviceType device_type>
+struct Fp8Kernel<device_type, decltype(ATEN_FN(mm)), &ATEN_FN(mm)> {
+  static constexpr bool kAvailable = true;
+  static bool accepts(const Tensor& self, const Tensor& mat2) {
+    return dipu::autocast::fp8Eligible(self, mat2, mat2.size(1),
+                                       device_type) &&
+           !dipu::autocast::fp8NeedsGrad(self, mat2);
+  }
+  static Tensor call(const Tensor& self, const Tensor& mat2,
+                     ScalarType out_type) {
+    return dipu::autocast::fp8Mm(self, mat2, c10::nullopt, out_type);
+  }
+};
+
+template <DeviceType device_type>
+struct Fp8Kernel<device_type, decltype(ATEN_FN(linear)), &ATEN_FN(linear)> {
+  static constexpr bool kAvailable = true;
+  static bool accepts(const Tensor& input, const Tensor& weight,
+                      const c10::optional<Tensor>& bias) {
+    return input.dim() >= 2 && weight.dim() == 2 &&
+           dipu::autocast::fp8Eligible(input, weight, weight.size(0),
+                                       device_type) &&
+           !dipu::autocast::fp8NeedsGrad(input, weight, bias);
+  }
+  static Tensor call(const Tensor& input, const Tensor& weight,
+                     const c10::optional<Tensor>& bias, ScalarType out_type) {
+    return dipu::autocast::fp8Linear(input, weight, bias, out_type);
+  }
+};
+
+#endif
+
+// CastPolicy::fp8 General_DeviceType
+template <DeviceType device_type, class Redispatch, Redispatch* F, class Ret,
+          class... Args>
+struct WrapFunction_<CastPolicy::fp8, device_type, Redispatch, F, Ret,
+                     guts::typelist::typelist<Args...>> {
+  static Ret call(Args... args) {
+    using Kernel = Fp8Kernel<device_type, Redispatch, F>;
+    if constexpr (Kernel::kAvailable) {
+      if (dipu::autocast::fp8AutocastActive() && Kernel::accepts(args...)) {
+        c10::impl::ExcludeDispatchKeyGuard no_autocast(
+            get_autocast_dispatch_key_from_device_type(device_type));
+        return Kernel::call(
+            args..., get_lower_precision_fp_from_device_type(device_type));
+      }
+    }
+    return WrapFunction_<CastPolicy::lower_precision_fp, device_type,
+                         Redispatch, F, Ret,
+                         guts::typelist::typelist<Args...>>::call(args...);
   }
 };
 
@@ -221,6 +509,9 @@ struct FromDipuCastPolicyHelper {
 DIPU_DEFINE_CAST_POLICY_CONVERSION(kLowerPrecisionFp, lower_precision_fp);
 DIPU_DEFINE_CAST_POLICY_CONVERSION(kFp32, fp32);
 DIPU_DEFINE_CAST_POLICY_CONVERSION(kPromote, promote);
+DIPU_DEFINE_CAST_POLICY_CONVERSION(kFp16, fp16);
+DIPU_DEFINE_CAST_POLICY_CONVERSION(kBf16, bf16);
+DIPU_DEFINE_CAST_POLICY_CONVERSION(kFp8, fp8);
 
 #undef DIPU_DEFINE_CAST_POLICY_CONVERSION
 
@@ -19,6 +19,8 @@
 //   DIPU_CUSTOMIZE_OP_CAST_POLICY(conv2d, kFp32);
 //   DIPU_CUSTOMIZE_OP_CAST_POLICY(conv3d, kFp32);
 //   DIPU_CUSTOMIZE_OP_CAST_POLICY(mm, kPromote);
+//   DIPU_CUSTOMIZE_OP_CAST_POLICY(bmm, kFp16);
+//   DIPU_CUSTOMIZE_OP_CAST_POLICY(linear, kFp8);
 //
 //   }  // namespace autocast
 //   }  // namespace dipu
@@ -27,6 +29,10 @@
 // - dot will run in lower precision (float16, bfloat16, etc.);
 // - conv1d, conv2d, conv3d will run in float32;
 // - mm will run in the widest dtype among args;
+// - bmm will run in float16 even if autocast is set to bfloat16, e.g. as the
+//   device has no fast bfloat16 kernel for it;
+// - linear will run in float8 while fp8 autocast is enabled, see
+//   setFp8AutocastEnabled, and in lower precision otherwise;
 // - the other ops will run in default policies.
 //
 // If no "vendor_autocast.h" or an empty one is provided, all ops will run in
@@ -51,6 +57,10 @@ enum class DipuCastPolicy : std::uint8_t {
                       // floating-point type (e.g. float16, bfloat16).
   kFp32,              // cast into float32.
   kPromote,           // run in the widest dtype among several args.
+  kFp16,              // cast into float16, whatever the autocast dtype is.
+  kBf16,              // cast into bfloat16, whatever the autocast dtype is.
+  kFp8,  // run mm and linear in float8 while fp8 autocast is enabled, other
+         // ops and other times like kLowerPrecisionFp.
 };
 
 namespace details {
@@ -188,5 +198,22 @@ DIPU_DEFAULT_OP_CAST_POLICY(scatter_add, kPromote);
 
 #undef DIPU_DEFAULT_OP_CAST_POLICY
 
+// Keeps the lower precision casts of fp32 leaf tensors requiring grad, i.e.
+// the weights, across autocast regions while grad mode is off, so inference
+// casts them once instead of on every request. A cast is redone once the
+// version counter of its weight changes. Defaults to
+// DIPU_AMP_PERSISTENT_CAST_CACHE, off if unset.
+void setPersistentCastCacheEnabled(bool enabled);
+bool persistentCastCacheEnabled();
+// Drops the cached casts, e.g. to free their memory
+void clearPersistentCastCache();
+
+// Runs the ops of the kFp8 policy by at::_scaled_mm on float8 e4m3 inputs,
+// each scaled by its own amax, if the device supports float8 matmuls (see
+// dipu::native::isFp8MatmulSupported) and k and n are multiples of 16.
+// Defaults to DIPU_AMP_FP8, off if unset.
+void setFp8AutocastEnabled(bool enabled);
+bool fp8AutocastEnabled();
+
 }  // namespace autocast
 }  // namespace dipu
@@ -3,13 +3,432 @@
 #include "DIPUCopy.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
 
+#include <c10/core/Storage.h>
 #include <c10/util/Exception.h>
 
 #include "csrc_dipu/aten/DIPUATenFunctions.h"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 
+namespace {
+
+// Max number of device copies issued by doStridedMemCopy for one tensor,
+// tensors needing more go through the slower relay paths instead.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kMaxStridedCopyCalls =
+    get_env_or_default("DIPU_STRIDED_COPY_MAX_CALLS", size_t{1024});
+
+// Use contiguous relay once the storage span of a view is this many times its
+// numel. The contiguous relay costs an extra strided copy on the host / other
+// device side, so it only pays off for views with big holes.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const double kContigRelaySpanRatio =
+    get_env_or_default("DIPU_COPY_CONTIG_RELAY_SPAN_RATIO", 2.0);
+
+// Tensors not larger than this are packed by copyMany
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kCopyManyMaxPackBytes =
+    get_env_or_default("DIPU_COPY_MANY_MAX_PACK_BYTES", size_t{1} << 20);
+
+constexpr size_t kCopyManyPackAlignment = 64;
+
+// Size (in KB) of the staging chunks of doChunkedCastCopy, 0 disables it
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kCastCopyChunkBytes =
+    get_env_or_default("DIPU_CAST_COPY_CHUNK_KB", size_t{16384}) * 1024;
+
+// Number of elements between the first and the last element of a tensor
+int64_t storageSpan(const at::Tensor& tensor) {
+  int64_t span = 1;
+  for (int64_t i = 0; i < tensor.dim(); ++i) {
+    if (tensor.size(i) == 0) {
+      return 0;
+    }
+    span += (tensor.size(i) - 1) * tensor.stride(i);
+  }
+  return span;
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::array<std::atomic<uint64_t>, static_cast<size_t>(DIPUCopyPath::kCount)>
+    copy_path_counts{};
+
+struct StridedDim {
+  int64_t size;
+  int64_t dstStride;
+  int64_t srcStride;
+};
+
+// Dims of size > 1 ordered from outermost to innermost by dst strides, with
+// adjacent dims merged where both tensors are contiguous across them
+std::vector<StridedDim> coalesceDims(const at::Tensor& dst,
+                                     const at::Tensor& src) {
+  std::vector<StridedDim> dims;
+  for (int64_t i = 0; i < dst.dim(); ++i) {
+    if (dst.size(i) > 1) {
+      dims.push_back({dst.size(i), dst.stride(i), src.stride(i)});
+    }
+  }
+  std::stable_sort(dims.begin(), dims.end(),
+                   [](const StridedDim& a, const StridedDim& b) {
+                     return a.dstStride > b.dstStride ||
+                            (a.dstStride == b.dstStride &&
+                             a.srcStride > b.srcStride);
+                   });
+  std::vector<StridedDim> merged;
+  for (const auto& dim : dims) {
+    if (!merged.empty()) {
+      auto& outer = merged.back();
+      if (outer.dstStride == dim.dstStride * dim.size &&
+          outer.srcStride == dim.srcStride * dim.size) {
+        outer = {outer.size * dim.size, dim.dstStride, dim.srcStride};
+        continue;
+      }
+    }
+    merged.push_back(dim);
+  }
+  return merged;
+}
+
+struct PackedCopy {
+  at::Tensor dst;
+  at::Tensor src;
+  size_t offset;
+};
+
+// Packed copies of one device in one direction
+struct PackedCopyGroup {
+  DIPUCopyType copyType;
+  c10::DeviceIndex device;
+  size_t nbytes = 0;
+  std::vector<PackedCopy> copies;
+};
+
+bool canPackCopy(const at::Tensor& dst, const at::Tensor& src) {
+  auto copyType = getCopyType(dst, src);
+  return (copyType == DIPUCopyType::H2D || copyType == DIPUCopyType::D2H) &&
+         dst.numel() > 0 && dst.scalar_type() == src.scalar_type() &&
+         dst.sizes().equals(src.sizes()) && dst.is_contiguous() &&
+         src.is_contiguous() && dst.nbytes() <= kCopyManyMaxPackBytes;
+}
+
+at::Tensor emptyPinnedBytes(size_t nbytes) {
+  auto storage = c10::Storage(c10::Storage::use_byte_size_t(),
+                              static_cast<int64_t>(nbytes),
+                              getAllocator(at::DeviceType::CPU), false);
+  return at::empty({0}, at::TensorOptions().dtype(at::kByte))
+      .set_(storage, 0, {static_cast<int64_t>(nbytes)}, {1});
+}
+
+// Must be called with the device of the group being current
+void runPackedCopyGroup(const PackedCopyGroup& group, DIPUStream& stream) {
+  auto hostStaging = emptyPinnedBytes(group.nbytes);
+  auto deviceStaging = at::empty(
+      {static_cast<int64_t>(group.nbytes)},
+      at::TensorOptions().dtype(at::kByte).device(DIPU_DEVICE_TYPE,
+                                                  group.device));
+  auto host_ptr = static_cast<char*>(hostStaging.data_ptr());
+  auto device_ptr = static_cast<char*>(deviceStaging.data_ptr());
+  const bool is_default_stream = getDefaultDIPUStream() == stream;
+
+  if (group.copyType == DIPUCopyType::H2D) {
+    for (const auto& copy : group.copies) {
+      memcpy(host_ptr + copy.offset, copy.src.data_ptr(), copy.src.nbytes());
+    }
+    devproxy::memCopyH2DAsync(stream.rawstream(), group.nbytes, device_ptr,
+                              host_ptr);
+    for (const auto& copy : group.copies) {
+      MemChecker::instance().check(copy.dst);
+      devproxy::memCopyD2DAsync(stream.rawstream(), copy.dst.nbytes(),
+                                group.device, copy.dst.data_ptr(),
+                                group.device, device_ptr + copy.offset);
+      tryRecordStream(copy.dst, stream, is_default_stream);
+    }
+    // The staging buffer is read by the device after we return
+    hostStaging.record_stream(stream.unwrap());
+    return;
+  }
+
+  for (const auto& copy : group.copies) {
+    MemChecker::instance().check(copy.src);
+    devproxy::memCopyD2DAsync(stream.rawstream(), copy.src.nbytes(),
+                              group.device, device_ptr + copy.offset,
+                              group.device, copy.src.data_ptr());
+    tryRecordStream(copy.src, stream, is_default_stream);
+  }
+  devproxy::memCopyD2HAsync(stream.rawstream(), group.nbytes, host_ptr,
+                            device_ptr);
+  DIPUEvent event(devapis::EventFlags::DISABLE_TIMING);
+  event.record(stream);
+  event.synchronize();
+  for (const auto& copy : group.copies) {
+    memcpy(copy.dst.data_ptr(), host_ptr + copy.offset, copy.dst.nbytes());
+  }
+}
+
+}  // namespace
+
+const char* copyPathName(DIPUCopyPath path) {
+  switch (path) {
+    case DIPUCopyPath::kDirectMemCopy:
+      return "doDirectMemCopy";
+    case DIPUCopyPath::kStagedMemCopy:
+      return "doStagedMemCopy";
+    case DIPUCopyPath::kDiopiCopy:
+      return "diopiCopyInp";
+    case DIPUCopyPath::kDeviceStridedCopy:
+      return "doDeviceStridedCopy";
+    case DIPUCopyPath::kPeerCopy:
+      return "doPeerCopy";
+    case DIPUCopyPath::kChunkedCastCopy:
+      return "doChunkedCastCopy";
+    case DIPUCopyPath::kDeviceRelayCopy:
+      return "doDeviceRelayCopy";
+    case DIPUCopyPath::kContigRelayCopy:
+      return "doContigTensorRelayCopy";
+    case DIPUCopyPath::kCpuRelayCopy:
+      return "doCpuRelayCopy";
+    default:
+      return "unknown";
+  }
+}
+
+void recordCopyPath(DIPUCopyPath path) {
+  auto count = copy_path_counts[static_cast<size_t>(path)].fetch_add(
+                   1, std::memory_order_relaxed) +
+               1;
+  if (native::dumpOpArgLevel() > 0) {
+    printf("--%-50s %-30s #%" PRIu64 "\n", "[copy_]:", copyPathName(path),
+           count);
+  }
+}
+
+uint64_t getCopyPathCount(DIPUCopyPath path) {
+  return copy_path_counts[static_cast<size_t>(path)].load(
+      std::memory_order_relaxed);
+}
+
+void resetCopyPathCounts() {
+  for (auto& count : copy_path_counts) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool doStridedMemCopy(const at::Tensor& dst, const at::Tensor& src,
+                      DIPUStream& stream) {
+  if (dst.scalar_type() != src.scalar_type() ||
+      !dst.sizes().equals(src.sizes())) {
+    return false;
+  }
+  if (dst.numel() == 0) {
+    return true;
+  }
+  const auto itemsize = static_cast<int64_t>(dst.element_size());
+  auto dims = coalesceDims(dst, src);
+
+  // Each 2D copy moves `height` rows of `width` bytes
+  size_t width = itemsize;
+  size_t height = 1;
+  size_t dpitch = width;
+  size_t spitch = width;
+  if (!dims.empty() && dims.back().dstStride == 1 &&
+      dims.back().srcStride == 1) {
+    width = dims.back().size * itemsize;
+    dims.pop_back();
+  }
+  // Rows must not overlap, so broadcast dims stay in the outer loop
+  if (!dims.empty() &&
+      dims.back().dstStride * itemsize >= static_cast<int64_t>(width) &&
+      dims.back().srcStride * itemsize >= static_cast<int64_t>(width)) {
+    height = dims.back().size;
+    dpitch = dims.back().dstStride * itemsize;
+    spitch = dims.back().srcStride * itemsize;
+    dims.pop_back();
+  }
+
+  size_t outer = 1;
+  for (const auto& dim : dims) {
+    outer *= dim.size;
+  }
+  const auto dst_device = dst.device().index();
+  const auto src_device = src.device().index();
+  // Copies between peers go row by row with the vendor's peer copy
+  const bool use2D =
+      devproxy::isMemCopy2DSupported() && dst_device == src_device;
+  size_t calls = use2D ? outer : outer * height;
+  if (calls > kMaxStridedCopyCalls) {
+    return false;
+  }
+
+  MemChecker::instance().check(src);
+  MemChecker::instance().check(dst);
+  auto dst_ptr = static_cast<char*>(dst.data_ptr());
+  auto src_ptr = static_cast<const char*>(src.data_ptr());
+  // Odometer over the outer dims, innermost is the last one
+  std::vector<int64_t> index(dims.size(), 0);
+  for (size_t n = 0; n < outer; ++n) {
+    int64_t dst_offset = 0;
+    int64_t src_offset = 0;
+    for (size_t i = 0; i < dims.size(); ++i) {
+      dst_offset += index[i] * dims[i].dstStride;
+      src_offset += index[i] * dims[i].srcStride;
+    }
+    auto dst_rows = dst_ptr + dst_offset * itemsize;
+    auto src_rows = src_ptr + src_offset * itemsize;
+    if (use2D) {
+      devproxy::memCopy2DAsync(stream.rawstream(), devapis::MemCPKind::D2D,
+                               dst_rows, dpitch, src_rows, spitch, width,
+                               height);
+    } else {
+      for (size_t row = 0; row < height; ++row) {
+        devproxy::memCopyD2DAsync(stream.rawstream(), width, dst_device,
+                                  dst_rows + row * dpitch, src_device,
+                                  src_rows + row * spitch);
+      }
+    }
+    for (auto i = static_cast<int64_t>(dims.size()) - 1; i >= 0; --i) {
+      if (++index[i] < dims[i].size) {
+        break;
+      }
+      index[i] = 0;
+    }
+  }
+  return true;
+}
+
+bool doChunkedCastCopy(const at::Tensor& dst, const at::Tensor& src,
+                       DIPUCopyType copyType, DIPUStream& stream) {
+  if (kCastCopyChunkBytes == 0 ||
+      (copyType != DIPUCopyType::H2D && copyType != DIPUCopyType::D2H) ||
+      dst.scalar_type() == src.scalar_type() ||
+      !dst.sizes().equals(src.sizes()) || !dst.is_contiguous() ||
+      !src.is_contiguous()) {
+    return false;
+  }
+  const auto max_itemsize = std::max(dst.element_size(), src.element_size());
+  const auto chunk_numel =
+      static_cast<int64_t>(kCastCopyChunkBytes / max_itemsize);
+  // Small copies don't need bounded temporaries
+  if (chunk_numel == 0 || dst.numel() <= chunk_numel) {
+    return false;
+  }
+
+  const bool is_h2d = copyType == DIPUCopyType::H2D;
+  // Cast on the side of the larger dtype, so data moves in the smaller one
+  const bool cast_on_host = is_h2d == (dst.element_size() < src.element_size());
+  const auto& host_side = is_h2d ? src : dst;
+  const auto& device_side = is_h2d ? dst : src;
+  const auto& transfer_dtype_of = cast_on_host ? device_side : host_side;
+  const auto transfer_dtype = transfer_dtype_of.scalar_type();
+  const auto itemsize = static_cast<int64_t>(transfer_dtype_of.element_size());
+
+  // Double buffered, host buffers are reused once their event is done and
+  // device buffers are ordered by the stream
+  constexpr int kNumBuffers = 2;
+  at::Tensor host_buffers[kNumBuffers];
+  at::Tensor device_buffers[kNumBuffers];
+  DIPUEvent events[kNumBuffers] = {
+      DIPUEvent(devapis::EventFlags::DISABLE_TIMING),
+      DIPUEvent(devapis::EventFlags::DISABLE_TIMING)};
+  for (int i = 0; i < kNumBuffers; ++i) {
+    host_buffers[i] =
+        emptyPinnedBytes(chunk_numel * itemsize).view(transfer_dtype);
+    if (!cast_on_host) {
+      device_buffers[i] = at::empty({chunk_numel},
+                                    at::TensorOptions()
+                                        .dtype(transfer_dtype)
+                                        .device(device_side.device()));
+    }
+  }
+
+  MemChecker::instance().check(device_side);
+  auto dst_flat = dst.view(-1);
+  auto src_flat = src.view(-1);
+  const auto numel = dst.numel();
+  const auto num_chunks = (numel + chunk_numel - 1) / chunk_numel;
+  auto chunk_range = [&](int64_t k) {
+    auto offset = k * chunk_numel;
+    return std::make_pair(offset, std::min(chunk_numel, numel - offset));
+  };
+
+  if (is_h2d) {
+    for (int64_t k = 0; k < num_chunks; ++k) {
+      auto [offset, n] = chunk_range(k);
+      auto b = k % kNumBuffers;
+      events[b].synchronize();
+      auto host = host_buffers[b].narrow(0, 0, n);
+      host.copy_(src_flat.narrow(0, offset, n));
+      auto device = cast_on_host ? dst_flat.narrow(0, offset, n)
+                                 : device_buffers[b].narrow(0, 0, n);
+      devproxy::memCopyH2DAsync(stream.rawstream(), n * itemsize,
+                                device.data_ptr(), host.data_ptr());
+      if (!cast_on_host) {
+        dst_flat.narrow(0, offset, n).copy_(device, /*non_blocking=*/true);
+      }
+      events[b].record(stream);
+    }
+    for (auto& buffer : host_buffers) {
+      buffer.record_stream(stream.unwrap());
+    }
+    return true;
+  }
+
+  auto issue = [&](int64_t k) {
+    auto [offset, n] = chunk_range(k);
+    auto b = k % kNumBuffers;
+    auto device = src_flat.narrow(0, offset, n);
+    if (!cast_on_host) {
+      device = device_buffers[b].narrow(0, 0, n);
+      device.copy_(src_flat.narrow(0, offset, n), /*non_blocking=*/true);
+    }
+    devproxy::memCopyD2HAsync(stream.rawstream(), n * itemsize,
+                              host_buffers[b].data_ptr(), device.data_ptr());
+    events[b].record(stream);
+  };
+  issue(0);
+  for (int64_t k = 0; k < num_chunks; ++k) {
+    if (k + 1 < num_chunks) {
+      issue(k + 1);
+    }
+    auto [offset, n] = chunk_range(k);
+    auto b = k % kNumBuffers;
+    events[b].synchronize();
+    dst_flat.narrow(0, offset, n).copy_(host_buffers[b].narrow(0, 0, n));
+  }
+  return true;
+}
+
+bool preferContigRelay(const at::Tensor& dst, const at::Tensor& src,
+                       DIPUCopyType copyType) {
+  // doDeviceRelayCopy makes the relay with strides of the non-local tensor
+  const at::Tensor* relayed = nullptr;
+  switch (copyType) {
+    case DIPUCopyType::D2H:
+    case DIPUCopyType::D2OtherD:
+      relayed = &dst;
+      break;
+    case DIPUCopyType::H2D:
+      relayed = &src;
+      break;
+    default:
+      return false;
+  }
+  if (relayed->is_non_overlapping_and_dense()) {
+    return false;
+  }
+  return static_cast<double>(storageSpan(*relayed)) >
+         kContigRelaySpanRatio * static_cast<double>(relayed->numel());
+}
+
 // it's the default strategy and be assigned to the pointer dipu_copy_op_ which
 // is a mutable poiner and may be change by vendor at runtime, so nor can
 // this variable be const.
@@ -31,6 +450,51 @@ DIPUCopyBase* getDipuCopyInstance() {
 
 void setDipuCopyInstance(DIPUCopyBase* op) { dipu_copy_op() = op; }
 
+void copyMany(at::TensorList dsts, at::TensorList srcs, bool non_blocking) {
+  TORCH_CHECK(dsts.size() == srcs.size(), "copy_many got ", dsts.size(),
+              " dst tensors but ", srcs.size(), " src tensors");
+  std::vector<PackedCopyGroup> groups;
+  for (size_t i = 0; i < dsts.size(); ++i) {
+    const auto& dst = dsts[i];
+    const auto& src = srcs[i];
+    if (!canPackCopy(dst, src)) {
+      dst.copy_(src, non_blocking);
+      continue;
+    }
+    auto copyType = getCopyType(dst, src);
+    auto device = (dst.is_cpu() ? src : dst).device().index();
+    auto group = std::find_if(groups.begin(), groups.end(),
+                              [&](const PackedCopyGroup& item) {
+                                return item.copyType == copyType &&
+                                       item.device == device;
+                              });
+    if (group == groups.end()) {
+      groups.push_back({copyType, device});
+      group = groups.end() - 1;
+    }
+    group->copies.push_back({dst, src, group->nbytes});
+    group->nbytes += (dst.nbytes() + kCopyManyPackAlignment - 1) /
+                     kCopyManyPackAlignment * kCopyManyPackAlignment;
+  }
+
+  std::vector<DIPUStream> streamsToSync;
+  for (const auto& group : groups) {
+    if (group.copies.size() == 1) {
+      group.copies[0].dst.copy_(group.copies[0].src, non_blocking);
+      continue;
+    }
+    const c10::DeviceGuard guard(c10::Device(DIPU_DEVICE_TYPE, group.device));
+    auto stream = getCurrentDIPUStream();
+    runPackedCopyGroup(group, stream);
+    if (!non_blocking && group.copyType == DIPUCopyType::H2D) {
+      streamsToSync.push_back(stream);
+    }
+  }
+  for (auto& stream : streamsToSync) {
+    stream.synchronize();
+  }
+}
+
 }  // namespace dipu
 
 namespace dipu {
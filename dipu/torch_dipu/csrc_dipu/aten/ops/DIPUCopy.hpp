@@ -1,6 +1,8 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <type_traits>
+
 #include <ATen/ATen.h>
 #include <ATen/MemoryOverlap.h>
 #include <ATen/Tensor.h>
@@ -177,6 +179,51 @@ inline void memCopy(const at::Tensor& dst, const at::Tensor& src,
   }
 }
 
+// Copy between two tensors of the same dtype and sizes on one device, or on
+// two devices with peer access enabled, with 2D memcpys (row by row between
+// devices). Any strides (including broadcast) are supported. Returns false
+// without copying if the layout needs more than DIPU_STRIDED_COPY_MAX_CALLS
+// device copies.
+bool doStridedMemCopy(const at::Tensor& dst, const at::Tensor& src,
+                      DIPUStream& stream);
+
+// Copy with dtype cast between host and device in bounded chunks, casting on
+// the side of the larger dtype so that data is transferred in the smaller
+// one. Only handles large contiguous tensors of the same sizes, returns false
+// for others. D2H copies always wait for the device.
+bool doChunkedCastCopy(const at::Tensor& dst, const at::Tensor& src,
+                       DIPUCopyType copyType, DIPUStream& stream);
+
+// Whether a relay copy between devices or device and host should go through
+// contiguous tensors rather than a relay with the same strides as the host /
+// other device side tensor. A same-stride relay moves the whole storage span
+// of that tensor, which is far more than its numel for views with big holes.
+bool preferContigRelay(const at::Tensor& dst, const at::Tensor& src,
+                       DIPUCopyType copyType);
+
+// Branches taken by DIPUCopyInplace. Each is counted, and printed with its
+// count so far when DIPU_DUMP_OP_ARGS > 0.
+enum class DIPUCopyPath : uint8_t {
+  kDirectMemCopy,
+  kStagedMemCopy,
+  kDiopiCopy,
+  kDeviceStridedCopy,
+  kPeerCopy,
+  kChunkedCastCopy,
+  kDeviceRelayCopy,
+  kContigRelayCopy,
+  kCpuRelayCopy,
+  kCount,
+};
+
+DIPU_API const char* copyPathName(DIPUCopyPath path);
+
+DIPU_API void recordCopyPath(DIPUCopyPath path);
+
+DIPU_API uint64_t getCopyPathCount(DIPUCopyPath path);
+
+DIPU_API void resetCopyPathCounts();
+
 class CopyParamsInfo {
  public:
   DIPUCopyType copyType_;
@@ -191,6 +238,8 @@ class CopyParamsInfo {
 
   // composite info, can direct mem copy
   bool directMemCopy_ = false;
+  // relay through contiguous tensors when copy is not direct
+  bool contigRelay_ = false;
 
   void recomputeTensorsInfo(const at::Tensor& dst, const at::Tensor& src) {
     sameDtype_ = dst.scalar_type() == src.scalar_type();
@@ -200,6 +249,7 @@ class CopyParamsInfo {
                          src.is_non_overlapping_and_dense();
     directMemCopy_ =
         sameDtype_ && sameSize_ && sameStride_ && denseAndNoOverlap_;
+    contigRelay_ = !directMemCopy_ && preferContigRelay(dst, src, copyType_);
   }
 
   explicit CopyParamsInfo(const at::Tensor& dst, const at::Tensor& src,
@@ -233,9 +283,18 @@ copyNodirectXX.
 DiopiCast: means call separate diopiCast func, it's a forward compatible
 solutions because some vendor's DiopiCopy not support cast. new DiopiCopy api
 require cast/
+
+Vendor: the final vendor class deriving from this one, if any. The steps it
+overrides are called on it directly, so they are resolved at compile time and
+can be inlined into run() instead of going through the vtable on every copy.
+The vendor class must befriend this one if it overrides protected steps.
 */
-template <bool DiopiCopy, bool DiopiCast>
+template <bool DiopiCopy, bool DiopiCast, typename Vendor = void>
 class DIPUCopyInplace : public DIPUCopyBase {
+  using Impl = std::conditional_t<std::is_void<Vendor>::value, DIPUCopyInplace,
+                                  Vendor>;
+  Impl& impl() { return static_cast<Impl&>(*this); }
+
  public:
   DIPUCopyInplace() = default;
   void run(at::Tensor& dst, const at::Tensor& src, bool non_blocking) override {
@@ -261,11 +320,11 @@ class DIPUCopyInplace : public DIPUCopyBase {
                 << std::endl;
     }
 
-    copyPreProcess(dst, src, non_blocking, info);
+    impl().copyPreProcess(dst, src, non_blocking, info);
 
-    copyAll(dst, src, non_blocking, info);
+    impl().copyAll(dst, src, non_blocking, info);
 
-    copyPostProcess(non_blocking, info, curStream);
+    impl().copyPostProcess(non_blocking, info, curStream);
   }
 
  protected:
@@ -315,9 +374,7 @@ class DIPUCopyInplace : public DIPUCopyBase {
   void doDirectMemCopy(at::Tensor& dst, const at::Tensor& src,
                        DIPUStream& curStream, DIPUCopyType copyType,
                        bool needMemCpSync = true) {
-    if (native::dumpOpArgLevel() > 0) {
-      printf("--%-50s %-30s \n", "[copy_]:", "doDirectMemCopy");
-    }
+    recordCopyPath(DIPUCopyPath::kDirectMemCopy);
     memCopy(dst, src, curStream, copyType, /*nonOverlappingAndDense=*/true,
             /*isSynchronousCopy=*/false);
 
@@ -368,6 +425,7 @@ class DIPUCopyInplace : public DIPUCopyBase {
   // as relay in d2h, h2d, d2d copy. cannot used in device copy(D2Self).
   void doDeviceRelayCopy(at::Tensor& dst, const at::Tensor& src,
                          bool non_blocking, CopyParamsInfo& info) {
+    recordCopyPath(DIPUCopyPath::kDeviceRelayCopy);
     switch (info.copyType_) {
       // create dst_device (relay, same stride)
       // 1. direct dst_cpu/otherdevice -> dst_device (is view).
@@ -381,7 +439,7 @@ class DIPUCopyInplace : public DIPUCopyBase {
         auto dstInDevSrc =
             makeSameStrideTensor(dst, info.curStream_, src.device(), true);
         info.updateCopyType(DIPUCopyType::D2Self);
-        copyNodirectOnDevice(dstInDevSrc, src, non_blocking, info);
+        impl().copyNodirectOnDevice(dstInDevSrc, src, non_blocking, info);
         doDirectMemFill(dst, dstInDevSrc, info.curStream_, curCopyType, true);
       } break;
       // create src_device (relay, same stride)
@@ -391,7 +449,7 @@ class DIPUCopyInplace : public DIPUCopyBase {
             makeSameStrideTensor(src, info.curStream_, dst.device());
         doDirectMemFill(srcInDstdev, src, info.curStream_, DIPUCopyType::H2D);
         info.updateCopyType(DIPUCopyType::D2Self);
-        copyNodirectOnDevice(dst, srcInDstdev, non_blocking, info);
+        impl().copyNodirectOnDevice(dst, srcInDstdev, non_blocking, info);
       } break;
       default:
         TORCH_CHECK(false,
@@ -406,7 +464,7 @@ class DIPUCopyInplace : public DIPUCopyBase {
   // device copy(D2Self). logical approach:
   // 1. create dst_contig. 2. create src_contig and src -> src_contig.
   // 3. direct src_contig -> dst_contig  4. dst_contig -> dst
-  //  (TODO(fandaoyi): automatic use)
+  // chosen by CopyParamsInfo::contigRelay_.
   void doContigTensorRelayCopy(at::Tensor& dst, const at::Tensor& src,
                                bool non_blocking, CopyParamsInfo& info) {
     switch (info.copyType_) {
@@ -441,12 +499,13 @@ class DIPUCopyInplace : public DIPUCopyBase {
         if (newInfo.directMemCopy_) {
           doDirectMemCopy(dst, srcContig, newInfo.curStream_,
                           newInfo.copyType_);
+        } else {
+          // equivalent as logical approach:
+          // 1. create src_contig_2(D).  3. direct src_contig(CPU) ->
+          // src_contig_2 (D).
+          // 4. src_contig_2 (device) -> dst (device),
+          doDeviceRelayCopy(dst, srcContig, non_blocking, newInfo);
         }
-        // equivalent as logical approach:
-        // 1. create src_contig_2(D).  3. direct src_contig(CPU) -> src_contig_2
-        // (D).
-        // 4. src_contig_2 (device) -> dst (device),
-        doDeviceRelayCopy(dst, srcContig, non_blocking, newInfo);
       } break;
       default:
         TORCH_CHECK(false,
@@ -455,6 +514,16 @@ class DIPUCopyInplace : public DIPUCopyBase {
     }
   }
 
+  void doRelayCopy(at::Tensor& dst, const at::Tensor& src, bool non_blocking,
+                   CopyParamsInfo& info) {
+    if (info.contigRelay_) {
+      recordCopyPath(DIPUCopyPath::kContigRelayCopy);
+      doContigTensorRelayCopy(dst, src, non_blocking, info);
+    } else {
+      doDeviceRelayCopy(dst, src, non_blocking, info);
+    }
+  }
+
   /*
   NOTICE:
   d2h: direct src (device) -> src_cpu. src_cpu -> dst (cpu)
@@ -466,9 +535,7 @@ class DIPUCopyInplace : public DIPUCopyBase {
  */
   void doCpuRelayCopy(at::Tensor& dst, const at::Tensor& src,
                       DIPUStream& curStream, bool non_blocking) {
-    if (native::dumpOpArgLevel() > 0) {
-      printf("--%-50s %-30s \n", "[copy_]:", "doCpuRelayCopy");
-    }
+    recordCopyPath(DIPUCopyPath::kCpuRelayCopy);
 
     at::Tensor src_cpu = src;
     if (dipu::isDeviceTensor(src)) {
@@ -521,17 +588,30 @@ class DIPUCopyInplace : public DIPUCopyBase {
         doDirectMemCopy(dst, tmpSrc, info.curStream_, info.copyType_,
                         !tmpSrc.is_same(src));
       } else if (DiopiCopy) {
+        recordCopyPath(DIPUCopyPath::kDiopiCopy);
         native::dipu_wrap_diopi_copy_inp(dst, tmpSrc, non_blocking);
-      } else {
+      } else if (!doDeviceStridedCopy(dst, tmpSrc, info)) {
         doCpuRelayCopy(dst, src, info.curStream_, non_blocking);
       }
     } else if (DiopiCopy) {  // !DiopiCast
+      recordCopyPath(DIPUCopyPath::kDiopiCopy);
       native::dipu_wrap_diopi_copy_inp(dst, src, non_blocking);
-    } else {
+    } else if (!doDeviceStridedCopy(dst, src, info)) {
       doCpuRelayCopy(dst, src, info.curStream_, non_blocking);
     }
   }
 
+  // Device side fallback of copyNodirectOnDevice for vendors without a
+  // complete diopiCopyInp, handles views and broadcast but not dtype cast
+  bool doDeviceStridedCopy(at::Tensor& dst, const at::Tensor& src,
+                           CopyParamsInfo& info) {
+    if (!doStridedMemCopy(dst, src, info.curStream_)) {
+      return false;
+    }
+    recordCopyPath(DIPUCopyPath::kDeviceStridedCopy);
+    return true;
+  }
+
   // NOTICE: handle no-direct mem copy between different devices, dipu has
   // default strategy which use a intermidiate tensor, it's slow. vendor who has
   // more efficient p2p device copy can override it (eg: device has unified
@@ -541,23 +621,49 @@ class DIPUCopyInplace : public DIPUCopyBase {
                                           const at::Tensor& src,
                                           bool non_blocking,
                                           CopyParamsInfo& info) {
+    if (doPeerCopy(dst, src, info)) {
+      return;
+    }
     if (DiopiCopy) {
-      // doContigTensorRelayCopy(dst, src, non_blocking, info);
-      doDeviceRelayCopy(dst, src, non_blocking, info);
+      doRelayCopy(dst, src, non_blocking, info);
       return;
     }
     // if diopiCopy = false, direct do cpu copy is best.
     doCpuRelayCopy(dst, src, info.curStream_, non_blocking);
   }
 
+  // Copy straight between devices which can access each other. The copy is
+  // queued on the current stream of dst after the work already queued on the
+  // current stream of src, and src's stream waits for it in turn, so that
+  // src memory is not reused too early.
+  bool doPeerCopy(at::Tensor& dst, const at::Tensor& src,
+                  CopyParamsInfo& info) {
+    const auto src_device = src.device().index();
+    if (!info.sameDtype_ || !info.sameSize_ ||
+        !devproxy::tryEnablePeerAccess(dst.device().index(), src_device)) {
+      return false;
+    }
+    auto srcStream = getCurrentDIPUStream(src_device);
+    DIPUEvent srcReady(devapis::EventFlags::DISABLE_TIMING);
+    srcReady.record(srcStream);
+    srcReady.wait(info.curStream_);
+    if (!doStridedMemCopy(dst, src, info.curStream_)) {
+      return false;
+    }
+    DIPUEvent copied(devapis::EventFlags::DISABLE_TIMING);
+    copied.record(info.curStream_);
+    copied.wait(srcStream);
+    recordCopyPath(DIPUCopyPath::kPeerCopy);
+    return true;
+  }
+
   // NOTICE: copy no-direct mem copy between cpu and device, dipu has default
   // strategy use intermidiate tensor, it's slow. vendor who has more efficient
   // solution can override it.
   virtual void copyNodirectDeviceHost(at::Tensor& dst, const at::Tensor& src,
                                       bool non_blocking, CopyParamsInfo& info) {
     if (DiopiCopy) {  // try to maximum leverage device copy,
-      // doContigTensorRelayCopy(dst, src, non_blocking, info);
-      doDeviceRelayCopy(dst, src, non_blocking, info);
+      doRelayCopy(dst, src, non_blocking, info);
       return;
     }
     // if diopiCopy = false, direct do cpu copy is best.
@@ -570,10 +676,28 @@ class DIPUCopyInplace : public DIPUCopyBase {
   // devices for more control of the direct memory copy process
   virtual void directMemCopy(at::Tensor& dst, const at::Tensor& src,
                              CopyParamsInfo& info, bool non_blocking) {
+    if (non_blocking && tryStagedMemCopy(dst, src, info)) {
+      return;
+    }
     doDirectMemCopy(dst, src, info.curStream_, info.copyType_,
                     /*needMemCpSync=*/false);
   }
 
+  // Async copies from pageable memory are synchronous on most vendors, so
+  // non_blocking H2D copies of them go through pinned staging buffers
+  bool tryStagedMemCopy(at::Tensor& dst, const at::Tensor& src,
+                        CopyParamsInfo& info) {
+    if (info.copyType_ != DIPUCopyType::H2D ||
+        !shouldStageMemCopyH2D(src.nbytes(), src.is_pinned())) {
+      return false;
+    }
+    recordCopyPath(DIPUCopyPath::kStagedMemCopy);
+    MemChecker::instance().check(dst);
+    memCopyH2DStagedAsync(info.curStream_, src.nbytes(), dst.data_ptr(),
+                          src.data_ptr());
+    return true;
+  }
+
   // overriding this func is possible but not recommended
   virtual void copyAll(at::Tensor& dst, const at::Tensor& src,
                        bool non_blocking, CopyParamsInfo& info) {
@@ -583,18 +707,23 @@ class DIPUCopyInplace : public DIPUCopyBase {
       info.recomputeTensorsInfo(dst, tmpSrc);
     }
     if (info.directMemCopy_) {
-      directMemCopy(dst, tmpSrc, info, non_blocking);
+      impl().directMemCopy(dst, tmpSrc, info, non_blocking);
+      return;
+    }
+    if (!info.sameDtype_ &&
+        doChunkedCastCopy(dst, tmpSrc, info.copyType_, info.curStream_)) {
+      recordCopyPath(DIPUCopyPath::kChunkedCastCopy);
       return;
     }
     switch (info.copyType_) {
       case DIPUCopyType::D2Self:
-        copyNodirectOnDevice(dst, tmpSrc, non_blocking, info);
+        impl().copyNodirectOnDevice(dst, tmpSrc, non_blocking, info);
         break;
       case DIPUCopyType::D2OtherD:
-        copyNodirectBetweenDevices(dst, tmpSrc, non_blocking, info);
+        impl().copyNodirectBetweenDevices(dst, tmpSrc, non_blocking, info);
         break;
       default:
-        copyNodirectDeviceHost(dst, tmpSrc, non_blocking, info);
+        impl().copyNodirectDeviceHost(dst, tmpSrc, non_blocking, info);
     }
   }
 };
@@ -604,6 +733,13 @@ using DIPUCopyInpOnDIOPIWithCast = DIPUCopyInplace<true, true>;
 
 DIPUCopyBase* getDipuCopyInstance();
 
+// Same as dsts[i].copy_(srcs[i], non_blocking) for every i. Small contiguous
+// H2D / D2H pairs are packed into one pinned staging buffer per device and
+// direction, so that they take a single host-device memcpy and at most one
+// sync (D2H always waits, the host side unpacking needs the data). Other
+// pairs go through copy_ one by one.
+void copyMany(at::TensorList dsts, at::TensorList srcs, bool non_blocking);
+
 void setDipuCopyInstance(DIPUCopyBase* op);
 
 }  // namespace dipu
@@ -0,0 +1,110 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUFill.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <c10/core/ScalarType.h>
+
+#include "csrc_dipu/runtime/core/DIPULaunchQueue.h"
+#include "csrc_dipu/runtime/core/DIPUStream.h"
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+namespace native {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kFillByMemset = get_env_or_default("DIPU_FILL_MEMSET", 1) > 0;
+
+// The bytes of `value` stored as `dtype`, false for dtypes not handled
+bool elementBits(const at::Scalar& value, at::ScalarType dtype,
+                 uint64_t& bits) {
+  auto store = [&bits](auto element) {
+    static_assert(sizeof(element) <= sizeof(bits));
+    bits = 0;
+    std::memcpy(&bits, &element, sizeof(element));
+  };
+  switch (dtype) {
+    case at::ScalarType::Bool:
+      store(value.to<bool>());
+      break;
+    case at::ScalarType::Byte:
+      store(value.to<uint8_t>());
+      break;
+    case at::ScalarType::Char:
+      store(value.to<int8_t>());
+      break;
+    case at::ScalarType::Short:
+      store(value.to<int16_t>());
+      break;
+    case at::ScalarType::Int:
+      store(value.to<int32_t>());
+      break;
+    case at::ScalarType::Long:
+      store(value.to<int64_t>());
+      break;
+    case at::ScalarType::Half:
+      store(value.to<at::Half>());
+      break;
+    case at::ScalarType::BFloat16:
+      store(value.to<at::BFloat16>());
+      break;
+    case at::ScalarType::Float:
+      store(value.to<float>());
+      break;
+    case at::ScalarType::Double:
+      store(value.to<double>());
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+bool isRepeatedByte(uint64_t bits, size_t size) {
+  for (size_t i = 1; i < size; ++i) {
+    if (((bits >> (8 * i)) & 0xff) != (bits & 0xff)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool fillByMemset(const at::Tensor& self, const at::Scalar& value) {
+  if (!kFillByMemset || launchQueueEnabled() || self.is_cpu() ||
+      self.numel() == 0 || self.is_neg() || self.is_conj() ||
+      !self.is_non_overlapping_and_dense()) {
+    return false;
+  }
+  uint64_t bits = 0;
+  if (!elementBits(value, self.scalar_type(), bits)) {
+    return false;
+  }
+  const auto size = static_cast<size_t>(self.element_size());
+  const auto count = static_cast<size_t>(self.numel());
+  auto stream = getCurrentDIPUStream().rawstream();
+  void* ptr = self.data_ptr();
+  if (isRepeatedByte(bits, size)) {
+    devproxy::memSetAsync(stream, ptr, static_cast<int>(bits & 0xff),
+                          size * count);
+    return true;
+  }
+  if (size == 2) {
+    return devproxy::memSetD16Async(stream, ptr, static_cast<uint16_t>(bits),
+                                    count);
+  }
+  if (size == 4) {
+    return devproxy::memSetD32Async(stream, ptr, static_cast<uint32_t>(bits),
+                                    count);
+  }
+  return false;
+}
+
+}  // namespace native
+}  // namespace dipu
@@ -0,0 +1,18 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Scalar.h>
+
+namespace dipu {
+namespace native {
+
+// Fill a device tensor whose elements cover one dense range of memory with
+// memsets instead of a DIOPI kernel, if `value` is a repeated byte, e.g. 0
+// or -1 for ints, or a 16 or 32 bit word the vendor can memset. Returns
+// false and does nothing otherwise. Off with DIPU_FILL_MEMSET=0 and while
+// the launch queue is on, as memsets would wait for the queue.
+bool fillByMemset(const at::Tensor& self, const at::Scalar& value);
+
+}  // namespace native
+}  // namespace dipu
@@ -0,0 +1,46 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUFp8.h"
+
+#include <ATen/ATen.h>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+
+namespace dipu {
+namespace native {
+
+bool isFp8MatmulSupported() {
+#if defined(DIPU_DIOPI_FP8) && DIPU_TORCH_VERSION >= 20100
+  return devproxy::vendorCapabilities().fp8Matmul &&
+         ::diopiScaledMm != nullptr;
+#else
+  return false;
+#endif
+}
+
+std::tuple<at::Tensor, at::Tensor> scaledMmReference(
+    const at::Tensor& self, const at::Tensor& mat2,
+    const c10::optional<at::Tensor>& bias,
+    c10::optional<at::ScalarType> out_dtype,
+    const c10::optional<at::Tensor>& scale_a,
+    const c10::optional<at::Tensor>& scale_b,
+    const c10::optional<at::Tensor>& scale_result) {
+  auto scaled = [](const at::Tensor& t, const c10::optional<at::Tensor>& s) {
+    auto result = t.to(at::kFloat);
+    if (s.has_value() && s->defined()) {
+      result.mul_(*s);
+    }
+    return result;
+  };
+  auto out = at::mm(scaled(self, scale_a), scaled(mat2, scale_b));
+  if (bias.has_value() && bias->defined()) {
+    out.add_(*bias);
+  }
+  auto amax = out.abs().max();
+  if (scale_result.has_value() && scale_result->defined()) {
+    out.mul_(*scale_result);
+  }
+  return {out.to(out_dtype.value_or(self.scalar_type())), amax};
+}
+
+}  // namespace native
+}  // namespace dipu
@@ -0,0 +1,42 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <tuple>
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/ScalarType.h>
+#include <c10/util/Optional.h>
+
+#include <diopi/diopirt.h>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+// at::_scaled_mm of torch 2.1, out = (self * scaleA) @ (mat2 * scaleB) + bias
+// multiplied by scaleResult and stored in the type of out, where amax is the
+// largest absolute value before scaleResult. self and mat2 are float8, mat2
+// in column major. The scales are float scalar tensors, each optional.
+extern "C" DIPU_WEAK diopiError_t diopiScaledMm(
+    diopiContextHandle_t ctx, diopiTensorHandle_t out, diopiTensorHandle_t amax,
+    diopiConstTensorHandle_t self, diopiConstTensorHandle_t mat2,
+    diopiConstTensorHandle_t bias, diopiConstTensorHandle_t scaleA,
+    diopiConstTensorHandle_t scaleB, diopiConstTensorHandle_t scaleResult);
+
+namespace dipu {
+namespace native {
+
+// Whether float8 matmuls run on the device: the vendor claims fp8Matmul in
+// its capabilities, implements diopiScaledMm, and DIOPI knows the float8
+// dtypes.
+bool isFp8MatmulSupported();
+
+// at::_scaled_mm by upcasting to float and running at::mm, on any device
+std::tuple<at::Tensor, at::Tensor> scaledMmReference(
+    const at::Tensor& self, const at::Tensor& mat2,
+    const c10::optional<at::Tensor>& bias,
+    c10::optional<at::ScalarType> out_dtype,
+    const c10::optional<at::Tensor>& scale_a,
+    const c10::optional<at::Tensor>& scale_b,
+    const c10::optional<at::Tensor>& scale_result);
+
+}  // namespace native
+}  // namespace dipu
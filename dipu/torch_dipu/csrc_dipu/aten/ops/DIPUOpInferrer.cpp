@@ -2,11 +2,18 @@
 #include "DIPUOpInferrer.h"
 
 #include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
 
 #include <ATen/native/TypeProperties.h>
+#include <c10/util/hash.h>
 
 #include "csrc_dipu/aten/ops/NodispatchUtils.hpp"
 #include "csrc_dipu/aten/ops/OpUtils.hpp"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 
@@ -63,6 +70,52 @@ void OpInferrer::compute_shape() {
   }
 }
 
+namespace {
+
+// Max number of inferred results cached by each thread, 0 disables the cache
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kInferCacheSize =
+    get_env_or_default("DIPU_OP_INFER_CACHE_SIZE", size_t{1024});
+
+// Values of the `kind` of load_cache
+enum InferKind : int64_t {
+  kBinaryInfer,
+  kBinaryFloatInfer,
+  kUnaryInfer,
+  kLogicInfer,
+  kReduceInfer,
+  kCatInfer,
+};
+
+using InferCacheKey = c10::SmallVector<int64_t, 32>;
+
+struct InferCacheKeyHash {
+  size_t operator()(const InferCacheKey& key) const {
+    size_t seed = key.size();
+    for (auto value : key) {
+      seed = c10::hash_combine(seed, std::hash<int64_t>()(value));
+    }
+    return seed;
+  }
+};
+
+struct InferResult {
+  c10::DimVector shape;
+  c10::DimVector strides;
+  at::ScalarType dtype;
+  at::MemoryFormat memory_format;
+};
+
+using InferCache =
+    std::unordered_map<InferCacheKey, InferResult, InferCacheKeyHash>;
+
+InferCache& inferCache() {
+  static thread_local InferCache cache;
+  return cache;
+}
+
+}  // namespace
+
 void OpInferrerMeta::add_input(const at::Tensor& tensor) {
   TORCH_CHECK(tensor.defined(), "Input tensor is undefined");
   inputs_.push_back(c10::MaybeOwned<at::Tensor>::borrowed(tensor));
@@ -79,6 +132,70 @@ at::Tensor OpInferrerMeta::malloc_output() {
   return out;
 }
 
+bool OpInferrerMeta::load_cache(int64_t kind, c10::IntArrayRef extras) {
+  if (kInferCacheSize == 0) {
+    return false;
+  }
+  cache_key_.clear();
+  cache_key_.push_back(kind);
+  cache_key_.push_back(static_cast<int64_t>(extras.size()));
+  cache_key_.append(extras.begin(), extras.end());
+  for (const auto i : c10::irange(ntensors())) {
+    const auto& t = tensor(i);
+    // scalars wrapped as tensors take part in type promotion differently
+    cache_key_.push_back(
+        static_cast<int64_t>(t.scalar_type()) * 2 +
+        static_cast<int64_t>(t.unsafeGetTensorImpl()->is_wrapped_number()));
+    cache_key_.push_back(t.dim());
+    cache_key_.append(t.sizes().begin(), t.sizes().end());
+    cache_key_.append(t.strides().begin(), t.strides().end());
+  }
+
+  auto& cache = inferCache();
+  auto iter = cache.find(cache_key_);
+  if (iter == cache.end()) {
+    return false;
+  }
+  const auto& result = iter->second;
+  shape_ = result.shape;
+  strides_ = result.strides;
+  dtype_ = result.dtype;
+  memory_format_ = result.memory_format;
+  return true;
+}
+
+void OpInferrerMeta::store_cache() {
+  if (cache_key_.empty()) {
+    return;
+  }
+  auto& cache = inferCache();
+  if (cache.size() >= kInferCacheSize) {
+    // shapes seen in a steady workload come back quickly after a reset
+    cache.clear();
+  }
+  cache.emplace(std::move(cache_key_),
+                InferResult{shape_, strides_, dtype_, memory_format_});
+  cache_key_.clear();
+}
+
+bool OpInferrer::fast_infer() {
+  const auto& first = tensor(0);
+  const auto dtype = first.scalar_type();
+  const auto sizes = first.sizes();
+  for (const auto i : c10::irange(ntensors())) {
+    const auto& t = tensor(i);
+    // wrapped numbers take part in type promotion differently
+    if (t.scalar_type() != dtype || !t.sizes().equals(sizes) ||
+        !t.is_contiguous() || t.unsafeGetTensorImpl()->is_wrapped_number()) {
+      return false;
+    }
+  }
+  shape_ = sizes;
+  dtype_ = dtype;
+  memory_format_ = at::MemoryFormat::Contiguous;
+  return true;
+}
+
 void OpInferrer::compute_dtype() {
   at::native::ResultTypeState state = {};
   for (const auto i : c10::irange(ntensors())) {
@@ -229,9 +346,12 @@ at::Tensor BinaryOpInferrer::infer_out(const at::Tensor& self,
                                        const at::Tensor& other) {
   add_input(self);
   add_input(other);
-  compute_shape();
-  compute_dtype();
-  compute_memory_format();
+  if (!fast_infer() && !load_cache(kBinaryInfer)) {
+    compute_shape();
+    compute_dtype();
+    compute_memory_format();
+    store_cache();
+  }
   return malloc_output();
 }
 
@@ -239,21 +359,34 @@ at::Tensor BinaryFloatOpInferrer::infer_out(const at::Tensor& self,
                                             const at::Tensor& other) {
   add_input(self);
   add_input(other);
-  compute_shape();
-  compute_dtype();
-  // Promotes common dtype to the default float scalar type, if needed
-  if (c10::isIntegralType(dtype_, /*includeBool=*/true)) {
-    dtype_ = c10::typeMetaToScalarType(c10::get_default_dtype());
+  const auto default_dtype =
+      c10::typeMetaToScalarType(c10::get_default_dtype());
+  if (fast_infer()) {
+    if (c10::isIntegralType(dtype_, /*includeBool=*/true)) {
+      dtype_ = default_dtype;
+    }
+  } else if (!load_cache(kBinaryFloatInfer,
+                         {static_cast<int64_t>(default_dtype)})) {
+    compute_shape();
+    compute_dtype();
+    // Promotes common dtype to the default float scalar type, if needed
+    if (c10::isIntegralType(dtype_, /*includeBool=*/true)) {
+      dtype_ = default_dtype;
+    }
+    compute_memory_format();
+    store_cache();
   }
-  compute_memory_format();
   return malloc_output();
 }
 
 at::Tensor UnaryOpInferrer::infer_out(const at::Tensor& self) {
   add_input(self);
-  compute_shape();
-  compute_dtype();
-  compute_memory_format();
+  if (!fast_infer() && !load_cache(kUnaryInfer)) {
+    compute_shape();
+    compute_dtype();
+    compute_memory_format();
+    store_cache();
+  }
   return malloc_output();
 }
 
@@ -261,9 +394,14 @@ at::Tensor LogicOpInferrer::infer_out(const at::Tensor& self,
                                       const at::Tensor& other) {
   add_input(self);
   add_input(other);
-  compute_shape();
-  dtype_ = at::ScalarType::Bool;
-  compute_memory_format();
+  if (fast_infer()) {
+    dtype_ = at::ScalarType::Bool;
+  } else if (!load_cache(kLogicInfer)) {
+    compute_shape();
+    dtype_ = at::ScalarType::Bool;
+    compute_memory_format();
+    store_cache();
+  }
   return malloc_output();
 }
 
@@ -310,13 +448,24 @@ at::Tensor ReduceOpInferrer::infer_out(const at::Tensor& self,
                                        bool keep_dim,
                                        c10::optional<at::ScalarType> dtype) {
   add_input(self);
-  compute_shape(dim, keep_dim);
-  if (dtype.has_value()) {
-    dtype_ = dtype.value();
-  } else {
-    compute_dtype();
+  // -1 stands for a missing dim list or dtype, dims are appended last
+  auto extras = c10::SmallVector<int64_t, 8>{
+      static_cast<int64_t>(keep_dim),
+      dtype.has_value() ? static_cast<int64_t>(dtype.value()) : -1,
+      dim.has_value() ? static_cast<int64_t>(dim->size()) : -1};
+  if (dim.has_value()) {
+    extras.append(dim->begin(), dim->end());
+  }
+  if (!load_cache(kReduceInfer, extras)) {
+    compute_shape(dim, keep_dim);
+    if (dtype.has_value()) {
+      dtype_ = dtype.value();
+    } else {
+      compute_dtype();
+    }
+    memory_format_ = at::MemoryFormat::Contiguous;
+    store_cache();
   }
-  memory_format_ = at::MemoryFormat::Contiguous;
   return malloc_output();
 }
 
@@ -409,9 +558,12 @@ at::Tensor CatOpInferrer::infer_out(const at::ITensorListRef& tensors,
   TORCH_CHECK(!inputs_.empty(),
               "torch.cat(): expected a non-empty list of Tensors");
 
-  compute_shape(dim);
-  dtype_ = at::native::result_type(tensors);
-  compute_memory_format();
+  if (!load_cache(kCatInfer, {dim})) {
+    compute_shape(dim);
+    dtype_ = at::native::result_type(tensors);
+    compute_memory_format();
+    store_cache();
+  }
   return malloc_output();
 }
 
@@ -39,11 +39,21 @@ class OpInferrerMeta {
   // Allocates the output based on the inferred attributes, use strides_ if set
   at::Tensor malloc_output();
 
+  // Inferred attributes are cached per thread, keyed by `kind`, `extras`
+  // (the non-tensor arguments) and the sizes, strides and dtypes of the
+  // inputs. Return true and set the attributes on a hit, otherwise the key is
+  // kept for store_cache after the attributes are computed.
+  bool load_cache(int64_t kind, c10::IntArrayRef extras = {});
+  void store_cache();
+
   c10::SmallVector<c10::MaybeOwned<at::Tensor>, 4> inputs_;
   c10::DimVector shape_;
   at::ScalarType dtype_ = at::ScalarType::Undefined;
   at::MemoryFormat memory_format_ = at::MemoryFormat::Contiguous;
   c10::DimVector strides_;
+
+ private:
+  c10::SmallVector<int64_t, 32> cache_key_;
 };
 
 // This class is intended as a base class only and should not be instantiated
@@ -55,6 +65,11 @@ class OpInferrer : public OpInferrerMeta {
  protected:
   OpInferrer() = default;
 
+  // Sets the shape, dtype and memory format of the inputs and returns true if
+  // they are all contiguous, of the same shape and of the same dtype, which
+  // covers most elementwise calls without the generic inference or its cache.
+  bool fast_infer();
+
   void compute_shape();
   void compute_dtype();
   void compute_memory_format();
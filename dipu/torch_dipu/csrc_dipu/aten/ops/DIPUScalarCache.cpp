@@ -0,0 +1,127 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUScalarCache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include <c10/util/hash.h>
+
+#include "csrc_dipu/aten/ops/NodispatchUtils.hpp"
+#include "csrc_dipu/runtime/core/DIPUGraph.h"
+#include "csrc_dipu/runtime/core/DIPUStream.h"
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+namespace native {
+
+namespace {
+
+// Entries of all devices, streams and dtypes together
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kScalarCacheSize =
+    get_env_or_default("DIPU_SCALAR_CACHE_SIZE", size_t{256});
+
+struct ScalarKey {
+  c10::DeviceIndex device;
+  c10::StreamId stream;
+  at::ScalarType dtype;
+  // The value as int64_t, or the bits of it as double for floating dtypes
+  uint64_t bits;
+
+  bool operator==(const ScalarKey& other) const {
+    return device == other.device && stream == other.stream &&
+           dtype == other.dtype && bits == other.bits;
+  }
+};
+
+struct ScalarKeyHash {
+  size_t operator()(const ScalarKey& key) const {
+    return c10::get_hash(key.device, key.stream, static_cast<int>(key.dtype),
+                         key.bits);
+  }
+};
+
+class ScalarCache {
+ public:
+  at::Tensor get(const ScalarKey& key, const at::Scalar& value,
+                 const at::TensorOptions& options) {
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      auto it = index_.find(key);
+      if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->second;
+      }
+    }
+    // Filled out of the lock, a racing thread may fill the same value and
+    // the first one is kept
+    auto tensor = nodispatch::scalar_tensor(value, options);
+    // Freed after the lock is released
+    at::Tensor evicted;
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto inserted = index_.emplace(key, lru_.end());
+    if (!inserted.second) {
+      return inserted.first->second->second;
+    }
+    lru_.emplace_front(key, tensor);
+    inserted.first->second = lru_.begin();
+    if (lru_.size() > kScalarCacheSize) {
+      index_.erase(lru_.back().first);
+      evicted = std::move(lru_.back().second);
+      lru_.pop_back();
+    }
+    return tensor;
+  }
+
+ private:
+  using Entries = std::list<std::pair<ScalarKey, at::Tensor>>;
+
+  std::mutex mutex_;
+  // Most recently used first
+  Entries lru_;
+  std::unordered_map<ScalarKey, Entries::iterator, ScalarKeyHash> index_;
+};
+
+ScalarCache& scalarCache() {
+  // Leaked, the tensors must not be freed after the allocators at exit
+  static auto* cache = new ScalarCache();
+  return *cache;
+}
+
+}  // namespace
+
+at::Tensor cachedScalarTensor(const at::Scalar& value, at::ScalarType dtype,
+                              const at::Device& device) {
+  const auto options = at::TensorOptions().dtype(dtype).device(device);
+  if (kScalarCacheSize == 0 || device.is_cpu() || c10::isComplexType(dtype) ||
+      isCaptureUnderway()) {
+    return nodispatch::scalar_tensor(value, options);
+  }
+  const auto index =
+      device.has_index() ? device.index() : devproxy::current_device();
+  ScalarKey key{index, getCurrentDIPUStream(index).id(), dtype, 0};
+  if (c10::isFloatingType(dtype)) {
+    const double number = value.toDouble();
+    std::memcpy(&key.bits, &number, sizeof(number));
+  } else if (dtype == at::ScalarType::Bool) {
+    key.bits = value.toBool() ? 1 : 0;
+  } else {
+    key.bits = static_cast<uint64_t>(value.toLong());
+  }
+  return scalarCache().get(key, value, options.device(device.type(), index));
+}
+
+at::Tensor scalarOnDevice(const at::Tensor& tensor, const at::Device& device) {
+  if (tensor.dim() != 0 || !tensor.is_cpu() || device.is_cpu()) {
+    return tensor;
+  }
+  return cachedScalarTensor(tensor.item(), tensor.scalar_type(), device);
+}
+
+}  // namespace native
+}  // namespace dipu
@@ -0,0 +1,27 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Device.h>
+#include <c10/core/Scalar.h>
+#include <c10/core/ScalarType.h>
+
+namespace dipu {
+namespace native {
+
+// A 0-dim tensor holding `value` as `dtype` on `device`, shared with other
+// callers through a cache of the most recently used values, so that
+// constants like 0, 1, eps, alpha and beta need neither an allocation nor a
+// fill per op call. It must never be written. Entries are kept per stream
+// and so are always ready in stream order. Nothing is cached for complex
+// dtypes, during graph capture or with DIPU_SCALAR_CACHE_SIZE=0.
+at::Tensor cachedScalarTensor(const at::Scalar& value, at::ScalarType dtype,
+                              const at::Device& device);
+
+// `tensor` itself unless it is a 0-dim CPU tensor, e.g. a wrapped python
+// number, which is replaced by the cached scalar tensor of its value on
+// `device` instead of a blocking H2D copy
+at::Tensor scalarOnDevice(const at::Tensor& tensor, const at::Device& device);
+
+}  // namespace native
+}  // namespace dipu
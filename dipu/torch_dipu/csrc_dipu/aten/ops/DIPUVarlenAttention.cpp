@@ -0,0 +1,98 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUVarlenAttention.h"
+
+#include <cmath>
+#include <limits>
+
+#include <ATen/ATen.h>
+#include <c10/util/Exception.h>
+#include <torch/library.h>
+
+namespace dipu {
+namespace native {
+
+at::Tensor varlenAttentionReference(const at::Tensor& q, const at::Tensor& k,
+                                    const at::Tensor& v,
+                                    const at::Tensor& cu_seqlens_q,
+                                    const at::Tensor& cu_seqlens_kv,
+                                    int64_t max_seqlen_q, int64_t max_seqlen_kv,
+                                    c10::optional<double> scale,
+                                    bool is_causal) {
+  TORCH_CHECK(q.dim() == 3 && k.dim() == 3 && v.dim() == 3,
+              "varlen_attention: q, k and v must be [tokens, heads, head_dim]");
+  TORCH_CHECK(k.size(1) > 0 && q.size(1) % k.size(1) == 0,
+              "varlen_attention: ", q.size(1), " query heads are not a "
+              "multiple of ", k.size(1), " key heads");
+  auto cu_q = cu_seqlens_q.to(at::kCPU, at::kLong).contiguous();
+  auto cu_kv = cu_seqlens_kv.to(at::kCPU, at::kLong).contiguous();
+  TORCH_CHECK(cu_q.dim() == 1 && cu_q.numel() > 0 &&
+                  cu_q.numel() == cu_kv.numel(),
+              "varlen_attention: cu_seqlens_q and cu_seqlens_kv must hold the "
+              "offsets of the same sequences");
+  // CPU matmuls of half are missing or slow, e.g. for autocompare
+  auto dtype = q.scalar_type();
+  if (q.is_cpu() && dtype != at::kFloat && dtype != at::kDouble) {
+    dtype = at::kFloat;
+  }
+  const auto groups = q.size(1) / k.size(1);
+  const double softmax_scale =
+      scale.has_value() ? *scale
+                        : 1.0 / std::sqrt(static_cast<double>(q.size(2)));
+  auto out = at::zeros({q.size(0), q.size(1), v.size(2)}, q.options());
+  const auto* q_offsets = cu_q.data_ptr<int64_t>();
+  const auto* kv_offsets = cu_kv.data_ptr<int64_t>();
+  for (int64_t i = 0; i + 1 < cu_q.numel(); ++i) {
+    const auto q_len = q_offsets[i + 1] - q_offsets[i];
+    const auto kv_len = kv_offsets[i + 1] - kv_offsets[i];
+    if (q_len == 0 || kv_len == 0) {
+      continue;
+    }
+    // [heads, len, head_dim], each key head serving `groups` query heads
+    auto qi = q.narrow(0, q_offsets[i], q_len).transpose(0, 1).to(dtype);
+    auto ki = k.narrow(0, kv_offsets[i], kv_len)
+                  .transpose(0, 1)
+                  .to(dtype)
+                  .repeat_interleave(groups, 0);
+    auto vi = v.narrow(0, kv_offsets[i], kv_len)
+                  .transpose(0, 1)
+                  .to(dtype)
+                  .repeat_interleave(groups, 0);
+    auto scores = at::matmul(qi, ki.transpose(1, 2)).mul_(softmax_scale);
+    if (is_causal) {
+      auto hidden = at::ones({q_len, kv_len}, scores.options().dtype(at::kBool))
+                        .triu_(kv_len - q_len + 1);
+      scores.masked_fill_(hidden, -std::numeric_limits<double>::infinity());
+    }
+    // queries seeing no key get zeros, as in FlashAttention
+    auto probs = at::softmax(scores, -1).nan_to_num_(0.0);
+    out.narrow(0, q_offsets[i], q_len)
+        .copy_(at::matmul(probs, vi).transpose(0, 1));
+  }
+  return out;
+}
+
+namespace {
+
+// Shape only, for fake tensors, e.g. when dicp traces the op
+at::Tensor varlenAttentionMeta(const at::Tensor& q, const at::Tensor& k,
+                               const at::Tensor& v,
+                               const at::Tensor& cu_seqlens_q,
+                               const at::Tensor& cu_seqlens_kv,
+                               int64_t max_seqlen_q, int64_t max_seqlen_kv,
+                               c10::optional<double> scale, bool is_causal) {
+  return at::empty({q.size(0), q.size(1), v.size(2)}, q.options());
+}
+
+}  // namespace
+
+// The schema and the device kernel are generated from diopi_functions.yaml
+TORCH_LIBRARY_IMPL(dipu, CPU, m) {
+  m.impl("varlen_attention", TORCH_FN(varlenAttentionReference));
+}
+
+TORCH_LIBRARY_IMPL(dipu, Meta, m) {
+  m.impl("varlen_attention", TORCH_FN(varlenAttentionMeta));
+}
+
+}  // namespace native
+}  // namespace dipu
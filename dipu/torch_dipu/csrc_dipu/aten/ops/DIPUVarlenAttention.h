@@ -0,0 +1,41 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstdint>
+
+#include <ATen/core/Tensor.h>
+#include <c10/util/Optional.h>
+
+#include <diopi/diopirt.h>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+// Attention over sequences packed back to back without padding. q is
+// [total_q, heads, head_dim], k and v are [total_kv, kv_heads, head_dim] and
+// sequence i takes rows [cuSeqlens[i], cuSeqlens[i + 1]) of them, heads being
+// a multiple of kv_heads as in grouped query attention. With isCausal, query
+// j of a sequence sees the keys up to j + seqlen_kv - seqlen_q, aligned to the
+// end as in FlashAttention. Weak, as vendors not implementing it in DIOPI run
+// dipu::varlen_attention by varlenAttentionReference on the device instead.
+extern "C" DIPU_WEAK diopiError_t diopiVarlenAttention(
+    diopiContextHandle_t ctx, diopiTensorHandle_t out,
+    diopiConstTensorHandle_t q, diopiConstTensorHandle_t k,
+    diopiConstTensorHandle_t v, diopiConstTensorHandle_t cuSeqlensQ,
+    diopiConstTensorHandle_t cuSeqlensKv, int64_t maxSeqlenQ,
+    int64_t maxSeqlenKv, double scale, bool isCausal);
+
+namespace dipu {
+namespace native {
+
+// dipu::varlen_attention one sequence at a time with at:: ops, on any device.
+// The sequence offsets are read on the host.
+at::Tensor varlenAttentionReference(const at::Tensor& q, const at::Tensor& k,
+                                    const at::Tensor& v,
+                                    const at::Tensor& cu_seqlens_q,
+                                    const at::Tensor& cu_seqlens_kv,
+                                    int64_t max_seqlen_q, int64_t max_seqlen_kv,
+                                    c10::optional<double> scale,
+                                    bool is_causal);
+
+}  // namespace native
+}  // namespace dipu
@@ -0,0 +1,91 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUWeightQuant.h"
+
+#include <ATen/ATen.h>
+#include <c10/util/Exception.h>
+#include <torch/library.h>
+
+namespace dipu {
+namespace native {
+
+namespace {
+
+// Sign extends the low and the high nibble of each byte
+at::Tensor unpackInt4(const at::Tensor& packed) {
+  auto low = packed.bitwise_left_shift(4).bitwise_right_shift(4);
+  auto high = packed.bitwise_right_shift(4);
+  return at::stack({low, high}, -1).flatten(-2);
+}
+
+}  // namespace
+
+at::Tensor dequantizeWeight(const at::Tensor& weight, const at::Tensor& scale,
+                            const c10::optional<at::Tensor>& offset,
+                            int64_t group_size, int64_t bits,
+                            at::ScalarType dtype) {
+  TORCH_CHECK(bits == 4 || bits == 8,
+              "weight_quant_matmul: bits must be 4 or 8, got ", bits);
+  TORCH_CHECK(weight.scalar_type() == at::kChar && weight.dim() == 2,
+              "weight_quant_matmul: weight must be a 2-D int8 tensor");
+  auto q = bits == 4 ? unpackInt4(weight) : weight;
+  const auto n = q.size(0);
+  const auto k = q.size(1);
+  // [n, groups, group_size] with scale and offset of [n, groups, 1]
+  const auto groups = group_size > 0 ? k / group_size : 1;
+  TORCH_CHECK(groups * (group_size > 0 ? group_size : k) == k,
+              "weight_quant_matmul: group_size ", group_size,
+              " does not divide the ", k, " input channels");
+  auto w = q.to(dtype).view({n, groups, k / groups});
+  if (offset.has_value() && offset->defined()) {
+    w = w - offset->to(dtype).reshape({n, groups, 1});
+  }
+  w = w * scale.to(dtype).reshape({n, groups, 1});
+  return w.view({n, k});
+}
+
+at::Tensor weightQuantMatmulReference(const at::Tensor& input,
+                                      const at::Tensor& weight,
+                                      const at::Tensor& scale,
+                                      const c10::optional<at::Tensor>& offset,
+                                      const c10::optional<at::Tensor>& bias,
+                                      int64_t group_size, int64_t bits) {
+  // CPU matmuls of half are missing or slow, e.g. for autocompare
+  auto dtype = input.scalar_type();
+  if (input.is_cpu() && dtype != at::kFloat && dtype != at::kDouble) {
+    dtype = at::kFloat;
+  }
+  auto w = dequantizeWeight(weight, scale, offset, group_size, bits, dtype);
+  auto out = at::matmul(input.to(dtype), w.t());
+  if (bias.has_value() && bias->defined()) {
+    out.add_(bias->to(dtype));
+  }
+  return out.to(input.scalar_type());
+}
+
+namespace {
+
+// Shape only, for fake tensors, e.g. when dicp traces the op
+at::Tensor weightQuantMatmulMeta(const at::Tensor& input,
+                                 const at::Tensor& weight,
+                                 const at::Tensor& scale,
+                                 const c10::optional<at::Tensor>& offset,
+                                 const c10::optional<at::Tensor>& bias,
+                                 int64_t group_size, int64_t bits) {
+  auto sizes = input.sizes().vec();
+  sizes.back() = weight.size(0);
+  return at::empty(sizes, input.options());
+}
+
+}  // namespace
+
+// The schema and the device kernel are generated from diopi_functions.yaml
+TORCH_LIBRARY_IMPL(dipu, CPU, m) {
+  m.impl("weight_quant_matmul", TORCH_FN(weightQuantMatmulReference));
+}
+
+TORCH_LIBRARY_IMPL(dipu, Meta, m) {
+  m.impl("weight_quant_matmul", TORCH_FN(weightQuantMatmulMeta));
+}
+
+}  // namespace native
+}  // namespace dipu
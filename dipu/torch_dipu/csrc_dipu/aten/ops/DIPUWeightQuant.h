@@ -0,0 +1,45 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstdint>
+
+#include <ATen/core/Tensor.h>
+#include <c10/util/Optional.h>
+
+#include <diopi/diopirt.h>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+// Weight-only quantized matmul, out = input @ dequant(weight).T + bias, where
+// weight is [n, k] int8, or [n, k / 2] int8 holding two int4 values per byte
+// (low nibble first) if bits is 4, and dequant(q) = (q - offset) * scale.
+// scale and offset are [n] per output channel if groupSize is 0, otherwise
+// [n, k / groupSize] per group of groupSize input channels. Weak, as vendors
+// not implementing it in DIOPI run dipu::weight_quant_matmul by
+// weightQuantMatmulReference on the device instead.
+extern "C" DIPU_WEAK diopiError_t diopiWeightQuantMatmul(
+    diopiContextHandle_t ctx, diopiTensorHandle_t out,
+    diopiConstTensorHandle_t input, diopiConstTensorHandle_t weight,
+    diopiConstTensorHandle_t scale, diopiConstTensorHandle_t offset,
+    diopiConstTensorHandle_t bias, int64_t groupSize, int64_t bits);
+
+namespace dipu {
+namespace native {
+
+// The float weight of dipu::weight_quant_matmul, of shape [n, k].
+at::Tensor dequantizeWeight(const at::Tensor& weight, const at::Tensor& scale,
+                            const c10::optional<at::Tensor>& offset,
+                            int64_t group_size, int64_t bits,
+                            at::ScalarType dtype);
+
+// dipu::weight_quant_matmul by dequantizing the weight with at:: ops, on any
+// device.
+at::Tensor weightQuantMatmulReference(const at::Tensor& input,
+                                      const at::Tensor& weight,
+                                      const at::Tensor& scale,
+                                      const c10::optional<at::Tensor>& offset,
+                                      const c10::optional<at::Tensor>& bias,
+                                      int64_t group_size, int64_t bits);
+
+}  // namespace native
+}  // namespace dipu
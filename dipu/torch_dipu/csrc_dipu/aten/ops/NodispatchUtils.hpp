@@ -6,14 +6,18 @@
 
 #pragma once
 
+#include <vector>
+
 #include <ATen/ExpandUtils.h>
 #include <ATen/NamedTensorUtils.h>
+#include <ATen/ScalarOps.h>
 #include <ATen/core/ATen_fwd.h>
 #include <ATen/core/TensorBody.h>
 #include <c10/core/Device.h>
 #include <c10/core/DeviceType.h>
 #include <c10/core/Layout.h>
 #include <c10/core/MemoryFormat.h>
+#include <c10/core/Scalar.h>
 #include <c10/core/ScalarType.h>
 #include <c10/core/ScalarTypeToTypeMeta.h>
 #include <c10/core/TensorOptions.h>
@@ -126,6 +130,77 @@ inline at::Tensor empty_like(
                                                                 memory_format));
 }
 
+// an equivalent to `at::zeros` with a single dispatch (to `zero_`)
+inline at::Tensor zeros(at::IntArrayRef size, at::TensorOptions options = {}) {
+  auto result = nodispatch::empty(size, options);
+  result.zero_();
+  return result;
+}
+
+// an equivalent to `at::scalar_tensor`, without dispatch for CPU tensors and
+// with a single one (to `fill_`) for device tensors
+inline at::Tensor scalar_tensor(const at::Scalar& s,
+                                at::TensorOptions options = {}) {
+  if (options.device().is_cpu()) {
+    return at::detail::scalar_tensor_static(
+        s, c10::typeMetaToScalarType(options.dtype()), options.device());
+  }
+  auto result = nodispatch::empty({}, options);
+  result.fill_(s);
+  return result;
+}
+
+// an equivalent to `self.to(options, non_blocking)`. `self` is returned as is
+// when neither the device nor the dtype changes, otherwise the result keeps
+// the layout of `self` and is filled with a single dispatch (to `copy_`).
+inline at::Tensor to(const at::Tensor& self, at::TensorOptions options,
+                     bool non_blocking = false) {
+  auto device = options.device_opt().value_or(self.device());
+  if (device.type() == self.device().type() && !device.has_index()) {
+    device = self.device();
+  }
+  const auto dtype = options.dtype_opt().has_value()
+                         ? c10::typeMetaToScalarType(*options.dtype_opt())
+                         : self.scalar_type();
+  if (device == self.device() && dtype == self.scalar_type()) {
+    return self;
+  }
+  if (device.is_cpu() && self.is_cpu()) {
+    return self.to(dtype, non_blocking);
+  }
+
+  std::vector<int64_t> dense_strides;
+  const bool dense = self.is_non_overlapping_and_dense();
+  if (!dense) {
+    dense_strides = at::infer_dense_strides(self.sizes(), self.strides());
+  }
+  const auto strides = dense ? self.strides() : at::IntArrayRef(dense_strides);
+  auto result =
+      device.is_cpu()
+          ? dipu_aten::empty_strided_cpu(self.sizes(), strides, dtype,
+                                         c10::nullopt, device, c10::nullopt)
+          : dipu_aten::empty_strided(self.sizes(), strides, dtype,
+                                     c10::nullopt, device, c10::nullopt);
+  result.copy_(self, non_blocking);
+  return result;
+}
+
+inline at::Tensor to(const at::Tensor& self, at::Device device,
+                     bool non_blocking = false) {
+  return nodispatch::to(self, at::TensorOptions().device(device), non_blocking);
+}
+
+inline at::Tensor to(const at::Tensor& self,
+                     c10::optional<at::ScalarType> dtype,
+                     bool non_blocking = false) {
+  return nodispatch::to(self, at::TensorOptions().dtype(dtype), non_blocking);
+}
+
+inline at::Tensor to(const at::Tensor& self, at::ScalarType dtype,
+                     bool non_blocking = false) {
+  return nodispatch::to(self, at::TensorOptions().dtype(dtype), non_blocking);
+}
+
 }  // namespace nodispatch
 }  // namespace native
 }  // namespace dipu
@@ -2,10 +2,14 @@
 #include "OpRegexMatch.hpp"
 
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <regex>
+#include <sstream>
+#include <string>
 
 #include <c10/util/Exception.h>
 
@@ -17,9 +21,66 @@
 
 namespace dipu {
 namespace op_regex_match {
-std::vector<std::regex> loadMatcher(const char* env_name,
-                                    const char* config_name) {
-  auto append = [](std::istream& input, std::vector<std::regex>& output) {
+
+namespace {
+
+bool isNameChar(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) != 0 || c == '_';
+}
+
+}  // namespace
+
+void OpNameMatcher::add(const std::string& pattern) {
+  if (std::all_of(pattern.begin(), pattern.end(), isNameChar)) {
+    literals_.insert(pattern);
+    return;
+  }
+  if (std::all_of(pattern.begin(), pattern.end(),
+                  [](char c) { return isNameChar(c) || c == '.'; })) {
+    wildcards_[pattern.size()].push_back(pattern);
+    return;
+  }
+  try {
+    regexes_.emplace_back(pattern,
+                          std::regex::ECMAScript | std::regex::optimize);
+  } catch (const std::regex_error& e) {
+    TORCH_CHECK(false, e.what());
+  }
+}
+
+bool OpNameMatcher::empty() const {
+  return literals_.empty() && wildcards_.empty() && regexes_.empty();
+}
+
+bool OpNameMatcher::match(const char* opname) const {
+  if (opname == nullptr || empty()) {
+    return false;
+  }
+  auto name = std::string(opname);
+  if (literals_.count(name) > 0) {
+    return true;
+  }
+  auto iter = wildcards_.find(name.size());
+  if (iter != wildcards_.end()) {
+    auto matched = [&name](const std::string& pattern) {
+      for (size_t i = 0; i < name.size(); ++i) {
+        if (pattern[i] != '.' && pattern[i] != name[i]) {
+          return false;
+        }
+      }
+      return true;
+    };
+    if (std::any_of(iter->second.begin(), iter->second.end(), matched)) {
+      return true;
+    }
+  }
+  return std::any_of(
+      regexes_.begin(), regexes_.end(),
+      [&name](auto& matcher) { return std::regex_match(name, matcher); });
+}
+
+OpNameMatcher loadMatcher(const char* env_name, const char* config_name) {
+  auto append = [](std::istream& input, OpNameMatcher& output) {
     auto constexpr separator = ',';
 
     auto line = std::string();
@@ -30,48 +91,37 @@ std::vector<std::regex> loadMatcher(const char* env_name,
         if (pattern.empty()) {
           continue;
         }
-        try {
-          output.emplace_back(pattern);
-        } catch (const std::regex_error& e) {
-          TORCH_CHECK(false, e.what());
-        }
+        output.add(pattern);
       }
     }
   };
 
-  auto list = std::vector<std::regex>();
+  auto matcher = OpNameMatcher();
   if (auto env = std::getenv(env_name)) {
     auto iss = std::istringstream(env);
-    append(iss, list);
+    append(iss, matcher);
   }
   if (auto file = std::ifstream(config_name, std::ios::binary)) {
-    append(file, list);
+    append(file, matcher);
   }
-  return list;
+  return matcher;
 }
 
-bool isOpMatch(const char* opname,
-               const std::vector<std::regex>& regexMatchers) {
-  if (regexMatchers.empty() || opname == nullptr) {
-    return false;
-  }
-
-  return std::any_of(
-      regexMatchers.begin(), regexMatchers.end(),
-      [&opname](auto& matcher) { return std::regex_match(opname, matcher); });
+bool isOpMatch(const char* opname, const OpNameMatcher& matcher) {
+  return matcher.match(opname);
 }
 
 constexpr const char* kFallbackEnvName = "DIPU_FORCE_FALLBACK_OPS_LIST";
 constexpr const char* kFallbackConfigName =
     ".dipu_force_fallback_op_list.config";
-const std::vector<std::regex> kFallbackMatchers =
+const OpNameMatcher kFallbackMatchers =
     dipu::op_regex_match::loadMatcher(kFallbackEnvName, kFallbackConfigName);
 
 constexpr const char* kSpecifiedAutocompareEnvName =
     "DIPU_AUTOCOMPARE_OPS_LIST";
 constexpr const char* kSpecifiedAutocompareConfigName =
     ".specified_autocompare_op_list.config";
-const std::vector<std::regex> kAutocompareMatchers =
+const OpNameMatcher kAutocompareMatchers =
     dipu::op_regex_match::loadMatcher(kSpecifiedAutocompareEnvName,
                                       kSpecifiedAutocompareConfigName);
 }  // namespace op_regex_match
@@ -1,18 +1,36 @@
 // Copyright (c) 2024, DeepLink.
-#include <algorithm>
-#include <ios>
-#include <iostream>
-#include <regex>
+#pragma once
 
-#include <c10/util/Exception.h>
+#include <cstddef>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace dipu {
 namespace op_regex_match {
-std::vector<std::regex> loadMatcher(const char* env_name,
-                                    const char* config_name);
-bool isOpMatch(const char* opname,
-               const std::vector<std::regex>& regexMatchers);
-extern const std::vector<std::regex> kFallbackMatchers;
-extern const std::vector<std::regex> kAutocompareMatchers;
+
+// Matches op names against the patterns of an op list. Patterns made of name
+// characters only are looked up in a hash set, and those whose only special
+// character is '.' are compared char by char, so just the true regexes cost
+// a std::regex_match for each registered op.
+class OpNameMatcher {
+ public:
+  void add(const std::string& pattern);
+  bool empty() const;
+  bool match(const char* opname) const;
+
+ private:
+  std::unordered_set<std::string> literals_;
+  // Patterns with '.' as wildcard, by length
+  std::unordered_map<size_t, std::vector<std::string>> wildcards_;
+  std::vector<std::regex> regexes_;
+};
+
+OpNameMatcher loadMatcher(const char* env_name, const char* config_name);
+bool isOpMatch(const char* opname, const OpNameMatcher& matcher);
+extern const OpNameMatcher kFallbackMatchers;
+extern const OpNameMatcher kAutocompareMatchers;
 }  // namespace op_regex_match
 }  // namespace dipu
@@ -8,6 +8,7 @@
 #include <cstring>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -26,6 +27,7 @@
 #include <c10/util/OptionalArrayRef.h>
 #include <c10/util/string_view.h>
 
+#include "csrc_dipu/runtime/core/DIPUAsyncErrorCheck.h"
 #include "csrc_dipu/runtime/core/DIPUStream.h"
 #include "csrc_dipu/runtime/device/deviceapis.h"
 #include "csrc_dipu/runtime/rthelper.h"
@@ -73,11 +75,29 @@ inline void synchronizeIfEnable() {
   }
 }
 
+// Lets a device error reported by a later sync name this op, see
+// DIPU_ASYNC_ERROR_CHECK
+inline void recordOpMarkerIfEnable(const char* op) {
+  if (asyncErrorCheckEnabled()) {
+    recordOpMarker(op);
+  }
+}
+
 inline bool dipuKeepTorchopDefaultImpl(const char* opname) {
-  static const char* env = std::getenv("DIPU_KEEP_TORCHOP_DEFAULT_IMPL_OPS");
-  return (env != nullptr) &&
-         ((std::string(env) + ',').find(std::string(opname) + ',') <
-          (strlen(env) - 1));
+  // comma separated op names, parsed once instead of for every op
+  static const auto ops = [] {
+    auto names = std::unordered_set<std::string>();
+    if (auto env = std::getenv("DIPU_KEEP_TORCHOP_DEFAULT_IMPL_OPS")) {
+      auto input = std::istringstream(env);
+      for (auto name = std::string(); std::getline(input, name, ',');) {
+        if (!name.empty()) {
+          names.insert(name);
+        }
+      }
+    }
+    return names;
+  }();
+  return !ops.empty() && opname != nullptr && ops.count(opname) > 0;
 }
 
 inline int dumpOpArgLevel() {
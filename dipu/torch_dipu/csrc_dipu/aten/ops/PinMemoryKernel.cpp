@@ -1,4 +1,9 @@
 // Copyright (c) 2023, DeepLink.
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include <ATen/ATen.h>
 #include <ATen/CPUFunctions.h>
 #include <ATen/Tensor.h>
@@ -7,11 +12,76 @@
 
 #include "csrc_dipu/aten/DIPUATenFunctions.h"
 #include "csrc_dipu/runtime/rthelper.h"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 namespace native {
 namespace dipu_aten {
 
+namespace {
+
+// Host tensors whose storage is at least this large (in KB) are pinned by
+// registering their memory in place instead of copying it, 0 disables it.
+// The pinned tensor then shares memory with the tensor it was pinned from.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kPinRegisterMinSize =
+    get_env_or_default("DIPU_PIN_MEMORY_REGISTER_MIN_KB", size_t{0}) << 10U;
+
+// Offset alignment of the tensors sharing a pinned region in a batch
+constexpr size_t kPinBatchAlignment = 64;
+
+// Keeps the registered storage alive, and unregisters it before releasing
+struct RegisteredHostMemory {
+  c10::Storage storage;
+
+  explicit RegisteredHostMemory(c10::Storage registered)
+      : storage(std::move(registered)) {}
+  RegisteredHostMemory(const RegisteredHostMemory&) = delete;
+  RegisteredHostMemory(RegisteredHostMemory&&) = delete;
+  RegisteredHostMemory& operator=(const RegisteredHostMemory&) = delete;
+  RegisteredHostMemory& operator=(RegisteredHostMemory&&) = delete;
+
+  ~RegisteredHostMemory() {
+    unregisterPinnedHostMemory(const_cast<void*>(storage.data()));
+  }
+};
+
+void deleteRegisteredHostMemory(void* ctx) {
+  delete static_cast<RegisteredHostMemory*>(ctx);
+}
+
+// Pin `self` without a copy by registering its whole storage, return an
+// undefined tensor if it is too small or the vendor can't register it.
+at::Tensor tryPinInPlace(const at::Tensor& self) {
+  if (kPinRegisterMinSize == 0 || !self.has_storage()) {
+    return {};
+  }
+  const auto& storage = self.storage();
+  const auto nbytes = storage.nbytes();
+  auto* data = const_cast<void*>(storage.data());
+  if (nbytes < kPinRegisterMinSize || data == nullptr ||
+      !registerPinnedHostMemory(data, nbytes)) {
+    return {};
+  }
+  auto ctx = std::make_unique<RegisteredHostMemory>(storage);
+  c10::DataPtr data_ptr(data, ctx.get(), &deleteRegisteredHostMemory,
+                        at::DeviceType::CPU);
+  ctx.release();
+  auto pinned_storage = c10::Storage(c10::Storage::use_byte_size_t(),
+                                     static_cast<int64_t>(nbytes),
+                                     std::move(data_ptr), nullptr, false);
+  return at::cpu::empty({0}, self.options())
+      .set_(pinned_storage, self.storage_offset(), self.sizes(),
+            self.strides());
+}
+
+size_t pinnedNbytes(const at::Tensor& self) {
+  return at::detail::computeStorageNbytes(self.sizes(), self.strides(),
+                                          self.dtype().itemsize());
+}
+
+}  // namespace
+
 bool is_pinned(const at::Tensor& self, c10::optional<at::Device> device) {
   // Only CPU tensors can be pinned
   if (!self.is_cpu()) {
@@ -25,18 +95,62 @@ bool is_pinned(const at::Tensor& self, c10::optional<at::Device> device) {
 
 at::Tensor _pin_memory(const at::Tensor& self,
                        c10::optional<at::Device> device) {
+  auto registered = tryPinInPlace(self);
+  if (registered.defined()) {
+    return registered;
+  }
   auto allocator = dipu::getAllocator(at::DeviceType::CPU);
-  auto storage =
-      c10::Storage(c10::Storage::use_byte_size_t(),
-                   static_cast<int64_t>(at::detail::computeStorageNbytes(
-                       self.sizes(), self.strides(), self.dtype().itemsize())),
-                   allocator, false);
+  auto storage = c10::Storage(c10::Storage::use_byte_size_t(),
+                              static_cast<int64_t>(pinnedNbytes(self)),
+                              allocator, false);
   auto tensor = at::cpu::empty({0}, self.options())
                     .set_(storage, 0, self.sizes(), self.strides());
   tensor.copy_(self);
   return tensor;
 }
 
+std::vector<at::Tensor> pin_memory_batch(at::TensorList tensors) {
+  std::vector<at::Tensor> result(tensors.size());
+  // Byte offset in the shared region of each tensor which must be copied
+  std::vector<std::pair<size_t, size_t>> copies;
+  size_t total_nbytes = 0;
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    const auto& tensor = tensors[i];
+    TORCH_CHECK(tensor.is_cpu(), "cannot pin '", tensor.toString(),
+                "' only dense CPU tensors can be pinned");
+    if (tensor.layout() != at::kStrided) {
+      result[i] = tensor.pin_memory();
+    } else if (is_pinned(tensor, c10::nullopt)) {
+      result[i] = tensor;
+    } else if (auto registered = tryPinInPlace(tensor); registered.defined()) {
+      result[i] = std::move(registered);
+    } else {
+      copies.emplace_back(i, total_nbytes);
+      total_nbytes += (pinnedNbytes(tensor) + kPinBatchAlignment - 1) /
+                      kPinBatchAlignment * kPinBatchAlignment;
+    }
+  }
+  if (copies.empty()) {
+    return result;
+  }
+
+  // One pinned region for the whole batch, the tensors are views into it and
+  // it is freed together with the last of them
+  auto storage = c10::Storage(c10::Storage::use_byte_size_t(),
+                              static_cast<int64_t>(total_nbytes),
+                              dipu::getAllocator(at::DeviceType::CPU), false);
+  for (const auto& [index, offset] : copies) {
+    const auto& tensor = tensors[index];
+    const auto itemsize = tensor.dtype().itemsize();
+    TORCH_INTERNAL_ASSERT(offset % itemsize == 0);
+    result[index] = at::cpu::empty({0}, tensor.options())
+                        .set_(storage, static_cast<int64_t>(offset / itemsize),
+                              tensor.sizes(), tensor.strides());
+    result[index].copy_(tensor);
+  }
+  return result;
+}
+
 }  // namespace dipu_aten
 }  // namespace native
 }  // namespace dipu
@@ -10,6 +10,7 @@
 
 #include "csrc_dipu/aten/DIPUATenFunctions.h"
 #include "csrc_dipu/runtime/core/MemChecker.h"
+#include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocator.h"
 #include "csrc_dipu/runtime/rthelper.h"
 
 namespace dipu {
@@ -31,6 +32,15 @@ void resize_bytes_dipu(c10::StorageImpl* storage, size_t newsize_bytes) {
     storage->set_nbytes(0);
     return;
   }
+  if (newsize_bytes > storage->nbytes() && storage->data() != nullptr) {
+    // Grow into the free memory after the block, which saves the copy
+    auto cache_allocator = dynamic_cast<CacheAllocator*>(allocator);
+    if (cache_allocator != nullptr &&
+        cache_allocator->try_expand(storage->data_ptr(), newsize_bytes)) {
+      storage->set_nbytes(newsize_bytes);
+      return;
+    }
+  }
   size_t nbytes = std::min(storage->nbytes(), newsize_bytes);
   at::DataPtr data = allocator->allocate(newsize_bytes);  // alloc new
   if (storage->data_ptr()) {                              // copy old to new
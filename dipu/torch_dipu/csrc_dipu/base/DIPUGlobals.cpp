@@ -2,12 +2,19 @@
 
 #include <atomic>
 #include <ctime>
+#include <exception>
 #include <iostream>
+#include <thread>
 
+#include "csrc_dipu/aten/FallbackStats.h"
 #include "csrc_dipu/aten/RegisterDIPU.hpp"
+#include "csrc_dipu/aten/ops/AutoCompareUtils.hpp"
+#include "csrc_dipu/diopirt/workspace_arena.h"
 #include "csrc_dipu/runtime/core/DIPUEventPool.h"
 #include "csrc_dipu/runtime/core/DIPUGeneratorImpl.h"
+#include "csrc_dipu/runtime/core/DIPUPinnedStaging.h"
 #include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocatorUtils.h"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 
@@ -20,6 +27,13 @@ static void printPromptAtStartup() {
             << " dipu | git hash:" << getDipuCommitId() << std::endl;
 }
 
+// Initialize the vendor runtime on a helper thread while the ops are
+// registered. Off by default, as the init of some vendors is bound to the
+// thread making it, e.g. aclInit on ascend.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static const bool kConcurrentInit =
+    get_env_or_default("DIPU_CONCURRENT_INIT", 0) > 0;
+
 static void initResourceImpl() {
   static bool called(false);
   if (called) {
@@ -28,9 +42,32 @@ static void initResourceImpl() {
   called = true;
 
   printPromptAtStartup();
-  devproxy::initializeVendor();
   initCachedAllocator();
-  at::DIPUOpRegister::register_op();
+  // Op registration doesn't touch the device, it runs while the vendor
+  // runtime starts up, which takes seconds on some vendors
+  if (!kConcurrentInit) {
+    devproxy::initializeVendor();
+    at::DIPUOpRegister::register_op();
+    return;
+  }
+  std::exception_ptr vendor_error;
+  std::thread vendor_init([&vendor_error] {
+    try {
+      devproxy::initializeVendor();
+    } catch (...) {
+      vendor_error = std::current_exception();
+    }
+  });
+  try {
+    at::DIPUOpRegister::register_op();
+  } catch (...) {
+    vendor_init.join();
+    throw;
+  }
+  vendor_init.join();
+  if (vendor_error) {
+    std::rethrow_exception(vendor_error);
+  }
 }
 
 static void releaseAllResourcesImpl() {
@@ -39,7 +76,11 @@ static void releaseAllResourcesImpl() {
     return;
   }
   called = true;
+  printFallbackReport();
+  native::autocompare::releaseAutocompare();
   releaseAllGenerator();
+  releasePinnedStagingBuffers();
+  releaseDiopiWorkspaceArenas();
   releaseAllDeviceMem();
   releaseAllEvent();
   devproxy::finalizeVendor();
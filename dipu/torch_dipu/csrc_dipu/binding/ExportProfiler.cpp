@@ -2,15 +2,22 @@
 // Copyright (c) 2023, DeepLink.
 
 #include <set>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <torch/csrc/profiler/orchestration/observer.h>
+#include <torch/csrc/profiler/util.h>
 #include <torch/csrc/utils/pybind.h>
 
 #include <pybind11/chrono.h>
 
+#include <csrc_dipu/profiler/DIPUDeviceActivity.h>
 #include <csrc_dipu/profiler/profiler_kineto.h>
 #include <csrc_dipu/profiler/profiler_python.h>
+#include <csrc_dipu/profiler/SamplingProfiler.h>
+#include <csrc_dipu/profiler/TraceStream.h>
+#include <csrc_dipu/profiler/profiler.h>
 #include <csrc_dipu/runtime/device/profilerapis.h>
 #include <csrc_dipu/runtime/devproxy/deviceproxy.h>
 
@@ -40,8 +47,95 @@ void exportProfiler(PyObject* module) {
   });
   profile::init();
 
+  m.def("_dipu_start_sampling", profile::startSampling, py::arg("every_steps"),
+        py::arg("op_fraction"), py::arg("ring_size"));
+  m.def("_dipu_stop_sampling", profile::stopSampling);
+  m.def("_dipu_sampling_step", profile::samplingStep);
+  m.def(
+      "_dipu_sampling_summary",
+      [](bool reset) -> py::list {
+        py::list result;
+        for (const auto& stats : profile::samplingSummary(reset)) {
+          py::dict item;
+          item["name"] = stats.name;
+          item["calls"] = stats.calls;
+          item["host_ms"] = stats.hostMs;
+          item["device_calls"] = stats.deviceCalls;
+          item["device_ms"] = stats.deviceMs;
+          item["max_device_ms"] = stats.maxDeviceMs;
+          result.append(item);
+        }
+        return result;
+      },
+      py::arg("reset"));
+
+  m.def("_dipu_start_trace_stream", profile::startTraceStream,
+        py::arg("path"), py::arg("flush_interval_ms"),
+        py::arg("chunk_records"));
+  m.def("_dipu_stop_trace_stream", []() -> py::dict {
+    const auto stats = profile::stopTraceStream();
+    py::dict result;
+    result["records"] = stats.records;
+    result["bytes"] = stats.bytes;
+    result["chunks"] = stats.chunks;
+    return result;
+  });
+
+  m.def("_dipu_profiler_time_ns", []() -> int64_t {
+    return torch::profiler::impl::getTime();
+  });
+  m.def("_dipu_set_profiler_time_offset", profile::setTimeBaseOffset,
+        py::arg("offset_ns"));
+  m.def("_dipu_profiler_time_offset", profile::timeBaseOffset);
+
+  m.def("_dipu_profiler_counters", []() {
+    return profile::DIPUDeviceActivity::instance().supportedCounters();
+  });
+  m.def(
+      "_dipu_set_profiler_counters",
+      [](const std::vector<std::string>& counters) {
+        profile::DIPUDeviceActivity::instance().setCounters(counters);
+      },
+      py::arg("counters"));
+
+  m.def("_dipu_set_python_tracer_skip_prefixes",
+        profile::setPythonTracerSkipPrefixes, py::arg("prefixes"));
+  m.def("_dipu_python_tracer_skip_prefixes",
+        profile::pythonTracerSkipPrefixes);
+
   m.def("_enable_profiler_api", &devapis::enableProfiler);
+  m.def(
+      "_set_profiler_api_counters",
+      [](const std::vector<std::string>& counters) {
+        TORCH_CHECK(devapis::setProfilerCounters != nullptr,
+                    "the native profiler has no hardware counters to select");
+        devapis::setProfilerCounters(counters);
+      },
+      py::arg("counters"));
   m.def("_disable_profiler_api", &devapis::disableProfiler);
+
+  // Depth of the ranges pushed by this thread, as nvtx returns it
+  static thread_local int trace_range_depth = 0;
+  m.def("_dipu_has_trace_markers",
+        []() { return devapis::traceRangePush != nullptr; });
+  m.def(
+      "_dipu_trace_range_push",
+      [](const std::string& message) {
+        devapis::traceRangePush(message.c_str());
+        return trace_range_depth++;
+      },
+      py::arg("message"));
+  m.def("_dipu_trace_range_pop", []() {
+    if (trace_range_depth == 0) {
+      return -1;
+    }
+    devapis::traceRangePop();
+    return --trace_range_depth;
+  });
+  m.def(
+      "_dipu_trace_mark",
+      [](const std::string& message) { devapis::traceMark(message.c_str()); },
+      py::arg("message"));
 }
 
 }  // namespace dipu
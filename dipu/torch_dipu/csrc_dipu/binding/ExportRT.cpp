@@ -1,16 +1,32 @@
 // Copyright (c) 2023, DeepLink.
+#include <array>
+#include <chrono>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <ATen/autocast_mode.h>
 #include <c10/core/Device.h>
 #include <torch/csrc/Device.h>
+#include <torch/csrc/Exceptions.h>
 #include <torch/csrc/utils/pybind.h>
 
 #include <pybind11/chrono.h>
 
 #include "csrc_dipu/aten/DIPUATenFunctions.h"
+#include "csrc_dipu/aten/FallbackStats.h"
+#include "csrc_dipu/aten/OpLatency.h"
+#include "csrc_dipu/aten/ops/AutoCompareUtils.hpp"
+#include "csrc_dipu/aten/ops/DIPUAmp.hpp"
+#include "csrc_dipu/aten/ops/DIPUCopy.hpp"
+#include "csrc_dipu/aten/ops/DIPUFp8.h"
 #include "csrc_dipu/base/DIPUGlobals.h"
+#include "csrc_dipu/runtime/core/DIPUAsyncErrorCheck.h"
+#include "csrc_dipu/runtime/core/DIPULaunchQueue.h"
 #include "csrc_dipu/runtime/rthelper.h"
+#include "csrc_dipu/utils/env.hpp"
 #include "csrc_dipu/utils/helpfunc.hpp"
 #include "csrc_dipu/utils/vender_helper.hpp"
 
@@ -59,6 +75,21 @@ static void registerDIPUDeviceStatus(py::module& m) {
       });
 }
 
+static const char* linkTypeName(devapis::LinkType type) {
+  switch (type) {
+    case devapis::LinkType::HOST:
+      return "host";
+    case devapis::LinkType::PCIE:
+      return "pcie";
+    case devapis::LinkType::DEVICE_LINK:
+      return "device_link";
+    case devapis::LinkType::SAME_DEVICE:
+      return "same_device";
+    default:
+      return "unknown";
+  }
+}
+
 static void exportDevices(py::module& m) {
   registerDIPUDeviceProperties(m);
   registerDIPUDeviceStatus(m);
@@ -77,6 +108,23 @@ static void exportDevices(py::module& m) {
   });
   m.def("_dipu_current_device",
         []() -> int { return static_cast<int>(devproxy::current_device()); });
+  m.def("_dipu_can_device_access_peer", [](int device, int peer) -> bool {
+    return devproxy::canAccessPeer(static_cast<devapis::deviceId_t>(device),
+                                   static_cast<devapis::deviceId_t>(peer));
+  });
+  m.def("_dipu_get_device_link", [](int device, int peer) -> py::tuple {
+    auto link =
+        devproxy::getDeviceLink(static_cast<devapis::deviceId_t>(device),
+                                static_cast<devapis::deviceId_t>(peer));
+    return py::make_tuple(linkTypeName(link.type), link.bandwidthGBps);
+  });
+  m.def("_dipu_get_device_numa_node", [](int device) -> int {
+    return devproxy::getDeviceNumaNode(
+        static_cast<devapis::deviceId_t>(device));
+  });
+  m.def("_dipu_bind_thread_to_device", [](int device) -> bool {
+    return bindCurrentThreadToDevice(static_cast<c10::DeviceIndex>(device));
+  });
   m.def("_dipu_synchronize", []() -> void {
     devproxy::syncDevice();
     return;
@@ -121,7 +169,8 @@ static void exportStream(py::module& m) {
                    reinterpret_cast<deviceStream_t>(stream_ptr),
                    devproxy::current_device());
              }
-             return getDIPUStreamFromPool();
+             // any negative priority means the high priority pool
+             return getDIPUStreamFromPool(priority < 0);
            }),
            py::arg("priority") = 0, py::arg("stream_id") = 0,
            py::arg("device_index") = 0, py::arg("device_type") = 0,
@@ -137,9 +186,9 @@ static void exportStream(py::module& m) {
            })
       .def("__eq__", &DIPUStream::operator==)
       .def("priority_range",
-           // not support priority now, return a mock value.
+           // (least, greatest) priority, as torch.cuda.Stream.priority_range
            [](DIPUStream& stream) -> py::tuple {
-             py::tuple range = pybind11::make_tuple(0, 0);
+             py::tuple range = pybind11::make_tuple(0, -1);
              return range;
            })
       // cpp properties
@@ -147,6 +196,7 @@ static void exportStream(py::module& m) {
           "stream_id",
           [](DIPUStream& stream) -> c10::StreamId { return stream.id(); })
       .def_property_readonly("device_index", &DIPUStream::device_index)
+      .def_property_readonly("priority", &DIPUStream::priority)
       .def_property_readonly(
           "device_type",
           [](DIPUStream& stream) -> int64_t {
@@ -215,6 +265,109 @@ static void exportEvent(py::module& m) {
       });
 }
 
+// The hot stream and event calls as METH_FASTCALL functions, which skip
+// the overload resolution and argument conversion of pybind11. A stream
+// argument of None means the current stream.
+static DIPUStream streamOrCurrent(PyObject* stream) {
+  if (stream == Py_None) {
+    return dipu::getCurrentDIPUStream();
+  }
+  return py::handle(stream).cast<DIPUStream>();
+}
+
+// (stream_id, device_index, device_type) of the current stream of a device,
+// the python Stream objects are cached by it
+static PyObject* dipuCurrentStreamKey(PyObject* /*unused*/,
+                                      PyObject* const* args,
+                                      Py_ssize_t nargs) {
+  HANDLE_TH_ERRORS
+  c10::DeviceIndex device_index = -1;
+  if (nargs > 0 && args[0] != Py_None) {
+    device_index = py::handle(args[0]).cast<c10::DeviceIndex>();
+  }
+  auto stream = dipu::getCurrentDIPUStream(device_index);
+  return py::make_tuple(stream.id(), stream.device_index(),
+                        static_cast<int64_t>(stream.device().type()))
+      .release()
+      .ptr();
+  END_HANDLE_TH_ERRORS
+}
+
+static PyObject* dipuEventRecord(PyObject* /*unused*/, PyObject* const* args,
+                                 Py_ssize_t nargs) {
+  HANDLE_TH_ERRORS
+  TORCH_CHECK(nargs == 2, "_dipu_eventRecord expects an event and a stream");
+  auto& event = py::handle(args[0]).cast<DIPUEvent&>();
+  event.record(streamOrCurrent(args[1]));
+  Py_RETURN_NONE;
+  END_HANDLE_TH_ERRORS
+}
+
+static PyObject* dipuEventWait(PyObject* /*unused*/, PyObject* const* args,
+                               Py_ssize_t nargs) {
+  HANDLE_TH_ERRORS
+  TORCH_CHECK(nargs == 2, "_dipu_eventWait expects an event and a stream");
+  auto& event = py::handle(args[0]).cast<DIPUEvent&>();
+  auto stream = streamOrCurrent(args[1]);
+  {
+    pybind11::gil_scoped_release no_gil;
+    event.wait(stream);
+  }
+  Py_RETURN_NONE;
+  END_HANDLE_TH_ERRORS
+}
+
+static PyObject* dipuEventQuery(PyObject* /*unused*/, PyObject* const* args,
+                                Py_ssize_t nargs) {
+  HANDLE_TH_ERRORS
+  TORCH_CHECK(nargs == 1, "_dipu_eventQuery expects an event");
+  const auto& event = py::handle(args[0]).cast<DIPUEvent&>();
+  return PyBool_FromLong(static_cast<long>(event.query()));
+  END_HANDLE_TH_ERRORS
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static std::array<PyMethodDef, 5> StreamFastMethods = {
+    {{"_dipu_currentStreamKey",
+      reinterpret_cast<PyCFunction>(
+          reinterpret_cast<void (*)()>(dipuCurrentStreamKey)),
+      METH_FASTCALL, nullptr},
+     {"_dipu_eventRecord",
+      reinterpret_cast<PyCFunction>(
+          reinterpret_cast<void (*)()>(dipuEventRecord)),
+      METH_FASTCALL, nullptr},
+     {"_dipu_eventWait",
+      reinterpret_cast<PyCFunction>(
+          reinterpret_cast<void (*)()>(dipuEventWait)),
+      METH_FASTCALL, nullptr},
+     {"_dipu_eventQuery",
+      reinterpret_cast<PyCFunction>(
+          reinterpret_cast<void (*)()>(dipuEventQuery)),
+      METH_FASTCALL, nullptr},
+     {nullptr, nullptr, 0, nullptr}}};
+
+static void exportGraph(py::module& m) {
+  // follow the api in torch/csrc/cuda/Graph.cpp
+  pybind11::class_<DIPUGraph>(m, "_DIPUGraph")
+      .def(py::init<>())
+      .def("capture_begin", &DIPUGraph::capture_begin,
+           py::call_guard<py::gil_scoped_release>(),
+           py::arg("pool") = kDefaultMemPool)
+      .def("capture_end", &DIPUGraph::capture_end,
+           py::call_guard<py::gil_scoped_release>())
+      .def("replay", &DIPUGraph::replay,
+           py::call_guard<py::gil_scoped_release>())
+      .def("reset", &DIPUGraph::reset,
+           py::call_guard<py::gil_scoped_release>())
+      .def("pool", &DIPUGraph::pool);
+
+  m.def("_dipu_is_current_stream_capturing",
+        []() -> bool { return isCurrentStreamCapturing(); });
+
+  m.def("_dipu_is_stream_capture_supported",
+        []() -> bool { return devproxy::isStreamCaptureSupported(); });
+}
+
 static void exportCommunicator(py::module& m) {
   pybind11::class_<ProcessGroupDICL, c10d::Backend,
                    c10::intrusive_ptr<ProcessGroupDICL>>(m, "ProcessGroupDICL")
@@ -226,11 +379,118 @@ static void exportCommunicator(py::module& m) {
            py::arg("timeout") = kBackendDefaultTimeout,
            py::call_guard<py::gil_scoped_release>())
       .def("store", &ProcessGroupDICL::getStore)
+      .def(
+          "eager_init",
+          [](ProcessGroupDICL& self, const std::vector<int>& deviceIndices,
+             bool warmup) {
+            // the current device by default
+            std::vector<at::Device> devices;
+            if (deviceIndices.empty()) {
+              devices.emplace_back(DIPU_DEVICE_TYPE,
+                                   devproxy::current_device());
+            }
+            for (auto index : deviceIndices) {
+              devices.emplace_back(DIPU_DEVICE_TYPE,
+                                   static_cast<c10::DeviceIndex>(index));
+            }
+            self.eagerInit(devices, warmup);
+          },
+          py::arg("devices") = std::vector<int>{}, py::arg("warmup") = false,
+          py::call_guard<py::gil_scoped_release>())
+      .def("_split_into", &ProcessGroupDICL::splitInto, py::arg("child"),
+           py::arg("color"), py::arg("key"), py::call_guard<py::gil_scoped_release>())
+      .def("collective_stats",
+           [](ProcessGroupDICL& self) -> py::list {
+             py::list result;
+             for (const auto& stats : self.collectiveStats()) {
+               py::dict item;
+               item["op"] = stats.op;
+               item["calls"] = stats.calls;
+               item["bytes"] = stats.bytes;
+               item["device_ms"] = stats.deviceMs;
+               item["max_device_ms"] = stats.maxDeviceMs;
+               item["queued_calls"] = stats.queuedCalls;
+               item["queue_ms"] = stats.queueMs;
+               item["max_queue_ms"] = stats.maxQueueMs;
+               item["algbw_gbps"] = stats.algbw();
+               item["busbw_gbps"] = stats.busbw();
+               result.append(item);
+             }
+             return result;
+           })
+      .def("reset_collective_stats", &ProcessGroupDICL::resetCollectiveStats)
+      .def("flight_records",
+           [](ProcessGroupDICL& self) -> py::list {
+             py::list result;
+             for (const auto& record : self.flightRecords()) {
+               py::dict item;
+               item["id"] = record.id;
+               item["op"] = c10d::opTypeToString(record.opType);
+               item["numel"] = record.numel;
+               item["dtype"] = c10::toString(record.dtype);
+               item["bytes"] = record.bytes;
+               item["queued_us"] = record.queuedUs;
+               item["comm"] = record.comm;
+               item["state"] = flightRecordStateName(record.state);
+               result.append(item);
+             }
+             return result;
+           })
+      .def("allgather_v", &ProcessGroupDICL::allgatherV, py::arg("output"),
+           py::arg("input"), py::arg("split_sizes"),
+           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "reduce_scatter_v",
+          [](ProcessGroupDICL& self, at::Tensor& output, at::Tensor& input,
+             const std::vector<int64_t>& splitSizes,
+             const c10d::ReduceOp& op) {
+            c10d::ReduceScatterOptions opts;
+            opts.reduceOp = op;
+            return self.reduceScatterV(output, input, splitSizes, opts);
+          },
+          py::arg("output"), py::arg("input"), py::arg("split_sizes"),
+          py::arg("op") = c10d::ReduceOp(c10d::ReduceOp::SUM),
+          py::call_guard<py::gil_scoped_release>())
+      .def("allgather_matmul", &ProcessGroupDICL::allgatherMatmul,
+           py::arg("gathered"), py::arg("output"), py::arg("input"),
+           py::arg("weight"), py::arg("chunks"),
+           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "matmul_reduce_scatter",
+          [](ProcessGroupDICL& self, at::Tensor& output,
+             const at::Tensor& input, const at::Tensor& weight,
+             int64_t chunks, const c10d::ReduceOp& op) {
+            c10d::ReduceScatterOptions opts;
+            opts.reduceOp = op;
+            return self.matmulReduceScatter(output, input, weight, chunks,
+                                            opts);
+          },
+          py::arg("output"), py::arg("input"), py::arg("weight"),
+          py::arg("chunks"),
+          py::arg("op") = c10d::ReduceOp(c10d::ReduceOp::SUM),
+          py::call_guard<py::gil_scoped_release>())
       .def("timeout", [](ProcessGroupDICL& self) {
         // need enhance to support tiemout
         return kBackendDefaultTimeout;
       });
 
+  pybind11::class_<DICLGradBucketScheduler>(m, "_DICLGradBucketScheduler")
+      .def(py::init<c10::intrusive_ptr<ProcessGroupDICL>,
+                    std::vector<at::Tensor>, int64_t>(),
+           py::arg("pg"), py::arg("params"), py::arg("bucket_cap_bytes"))
+      .def("mark_ready", &DICLGradBucketScheduler::markReady,
+           py::call_guard<py::gil_scoped_release>())
+      .def("finalize", &DICLGradBucketScheduler::finalize,
+           py::call_guard<py::gil_scoped_release>())
+      .def("bucket_indices", &DICLGradBucketScheduler::bucketIndices);
+
+  m.def("_dipu_dicl_stats_enabled", collectiveStatsEnabled);
+  m.def("_dipu_set_dicl_stats_enabled", setCollectiveStatsEnabled);
+  m.def("_dipu_dicl_buffer_registration_enabled",
+        diclBufferRegistrationEnabled);
+  m.def("_dipu_dicl_comm_split_supported",
+        []() -> bool { return devproxy::isDiclCommSplitSupported(); });
+
   // py::object mdist = py::module::import("torch.distributed");
   // py::object register_backend =
   // mdist.attr("Backend").attr("register_backend"); The first parameter is the
@@ -262,6 +522,140 @@ static void exportMemCaching(py::module& m) {
   m.def("max_memory_allocated", [](const c10::Device& device) -> size_t {
     return maxMemoryAllocated(device);
   });
+
+  m.def("_dipu_set_memory_fraction",
+        [](double fraction, const c10::Device& device) {
+          setMemoryFraction(fraction, device);
+        });
+
+  m.def("_dipu_set_memory_limit", [](size_t limit, const c10::Device& device) {
+    setMemoryLimit(limit, device);
+  });
+
+  m.def("_dipu_memory_limit", [](const c10::Device& device) -> size_t {
+    return memoryLimit(device);
+  });
+
+  m.def("memory_stats",
+        [](const c10::Device& device) -> std::map<std::string, int64_t> {
+          return memoryStats(device);
+        });
+
+  m.def("_dipu_start_allocator_profile", [](const c10::Device& device) {
+    startAllocatorProfile(device);
+  });
+
+  m.def("_dipu_stop_allocator_profile",
+        [](const c10::Device& device) -> std::vector<int64_t> {
+          return stopAllocatorProfile(device);
+        });
+
+  m.def("_dipu_reserve_for_allocator_profile",
+        [](const c10::Device& device, const std::vector<int64_t>& peak_bytes) {
+          reserveForAllocatorProfile(device, peak_bytes);
+        });
+
+  m.def("_dipu_create_mem_pool", []() -> MemPoolId { return createMemPool(); });
+
+  m.def("_dipu_exchange_mem_pool", [](MemPoolId pool) -> MemPoolId {
+    return exchangeMemPool(pool);
+  });
+
+  m.def("_dipu_empty_mem_pool", [](MemPoolId pool) { emptyMemPool(pool); });
+
+  m.def("_dipu_record_memory_history",
+        [](bool enabled, bool record_stacks, size_t max_entries) {
+          if (enabled) {
+            MemTracer::instance().enable(record_stacks, max_entries);
+          } else {
+            MemTracer::instance().disable();
+          }
+        });
+
+  m.def("_dipu_attach_out_of_memory_observer", [](py::function observer) {
+    // Leaked, it may be called until the process exits
+    auto* fn = new py::function(std::move(observer));
+    addOutOfMemoryObserver([fn](c10::DeviceIndex device, size_t size,
+                                size_t allocated, size_t reserved) {
+      py::gil_scoped_acquire gil;
+      (*fn)(device, size, allocated, reserved);
+    });
+  });
+
+  // Same layout as torch.cuda.memory._snapshot()
+  m.def("_dipu_memory_snapshot", []() -> py::dict {
+    auto to_frames = [](const std::string& backtrace) {
+      py::list frames;
+      std::istringstream lines(backtrace);
+      std::string line;
+      while (std::getline(lines, line)) {
+        if (line.empty()) {
+          continue;
+        }
+        py::dict frame;
+        frame["filename"] = "";
+        frame["line"] = 0;
+        frame["name"] = line;
+        frames.append(frame);
+      }
+      return frames;
+    };
+
+    py::list segments;
+    for (const auto& segment : memorySnapshot()) {
+      py::list blocks;
+      size_t active_size = 0;
+      for (const auto& block : segment.blocks) {
+        py::dict item;
+        item["address"] = block.address;
+        item["size"] = block.size;
+        item["requested_size"] = block.size;
+        item["state"] = block.active ? "active_allocated" : "inactive";
+        item["frames"] = py::list();
+        blocks.append(item);
+        active_size += block.active ? block.size : 0;
+      }
+      py::dict item;
+      item["device"] = segment.device;
+      item["address"] = segment.address;
+      item["total_size"] = segment.total_size;
+      item["allocated_size"] = active_size;
+      item["active_size"] = active_size;
+      item["requested_size"] = active_size;
+      item["stream"] = segment.stream;
+      item["segment_type"] = "large";
+      item["segment_pool_id"] = py::make_tuple(0, 0);
+      item["is_expandable"] = segment.expandable;
+      item["frames"] = py::list();
+      item["blocks"] = blocks;
+      segments.append(item);
+    }
+
+    std::vector<py::list> device_traces(devproxy::getDeviceCount());
+    for (const auto& entry : MemTracer::instance().entries()) {
+      if (entry.device < 0 ||
+          static_cast<size_t>(entry.device) >= device_traces.size()) {
+        continue;
+      }
+      py::dict item;
+      item["action"] = MemTracer::actionName(entry.action);
+      item["addr"] = entry.addr;
+      item["size"] = entry.size;
+      item["stream"] = entry.stream;
+      item["time_us"] = entry.time_us;
+      item["frames"] = to_frames(entry.frames);
+      device_traces[entry.device].append(item);
+    }
+
+    py::list traces;
+    for (const auto& trace : device_traces) {
+      traces.append(trace);
+    }
+    py::dict result;
+    result["segments"] = segments;
+    result["device_traces"] = traces;
+    return result;
+  });
 }
 
 static void patchStorage(py::module& m) {
@@ -279,12 +673,38 @@ static void patchStorage(py::module& m) {
             return stor;
           }
         });
+
+  m.def("_dipu_is_ipc_supported", &dipu::isIpcSupported);
+  m.def("_dipu_share_device_storage", [](const at::Storage& stor) {
+    return py::bytes(dipu::shareDeviceStorage(stor));
+  });
+  m.def("_dipu_open_shared_device_storage",
+        [](const py::bytes& handle) -> at::Storage {
+          return dipu::openSharedDeviceStorage(handle);
+        });
+  m.def("_dipu_collect_shared_storages", &dipu::collectSharedDeviceStorages);
 }
 
 static void patchTensor(py::module& m) {
   m.def("is_dipu", [](const at::Tensor& self) -> bool {
     return dipu::isDeviceTensor(self);
   });
+
+  m.def(
+      "_dipu_copy_many",
+      [](const std::vector<at::Tensor>& dsts,
+         const std::vector<at::Tensor>& srcs, bool non_blocking) {
+        copyMany(dsts, srcs, non_blocking);
+      },
+      py::arg("dsts"), py::arg("srcs"), py::arg("non_blocking") = false,
+      py::call_guard<py::gil_scoped_release>());
+
+  m.def(
+      "_dipu_pin_memory_batch",
+      [](const std::vector<at::Tensor>& tensors) {
+        return dipu::native::dipu_aten::pin_memory_batch(tensors);
+      },
+      py::arg("tensors"), py::call_guard<py::gil_scoped_release>());
 }
 
 static void exportNativeMemoryFormat(py::module& m) {
@@ -334,6 +754,18 @@ static void exportGenerator(py::module& m) {
     auto index = static_cast<at::DeviceIndex>(idx);
     return createDIPUGenerator(index);
   });
+
+  // Seed and offset the next random op of this thread drawing `increment`
+  // offsets from `generator` would get, for tests of the offset blocks
+  m.def(
+      "_dipu_reserve_philox_offset",
+      [](const at::Generator& generator,
+         uint64_t increment) -> std::pair<uint64_t, uint64_t> {
+        auto* gen = at::check_generator<DIPUGeneratorImpl>(generator);
+        const auto state = philoxDIPUStateFromBlock(gen, increment);
+        return {state.seed_.val, state.offset_.val};
+      },
+      py::call_guard<py::gil_scoped_release>());
 }
 
 static void exportAutocast(py::module& m) {
@@ -341,10 +773,77 @@ static void exportAutocast(py::module& m) {
   m.def("is_autocast_dipu_enabled", at::autocast::is_xpu_enabled);
   m.def("set_autocast_dipu_enabled", at::autocast::set_xpu_enabled);
   m.def("set_autocast_dipu_dtype", at::autocast::set_autocast_xpu_dtype);
+  m.def("_dipu_persistent_cast_cache_enabled",
+        autocast::persistentCastCacheEnabled);
+  m.def("_dipu_set_persistent_cast_cache_enabled",
+        autocast::setPersistentCastCacheEnabled);
+  m.def("_dipu_clear_persistent_cast_cache",
+        autocast::clearPersistentCastCache);
+  m.def("_dipu_fp8_autocast_enabled", autocast::fp8AutocastEnabled);
+  m.def("_dipu_set_fp8_autocast_enabled", autocast::setFp8AutocastEnabled);
+  m.def("_dipu_is_fp8_matmul_supported", native::isFp8MatmulSupported);
 }
 
 static void exportUtils(py::module& m) {
   m.def("get_dipu_torch_version", []() -> int { return DIPU_TORCH_VERSION; });
+  m.def("_dipu_fallback_stats", []() -> py::list {
+    py::list result;
+    for (const auto& [op, stats] : getFallbackStats()) {
+      py::dict item;
+      item["op"] = op;
+      item["calls"] = stats.calls;
+      item["d2h_bytes"] = stats.d2h_bytes;
+      item["h2d_bytes"] = stats.h2d_bytes;
+      item["seconds"] = static_cast<double>(stats.nanoseconds) / 1e9;
+      result.append(item);
+    }
+    return result;
+  });
+  m.def("_dipu_reset_fallback_stats", []() { resetFallbackStats(); });
+  // Holds the launch thread of the current device for `ms`, so that tests see
+  // whether other work waits for the launches queued after it
+  m.def(
+      "_dipu_delay_launch_queue",
+      [](int64_t ms) {
+        enqueueLaunch([ms] {
+          std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        });
+      },
+      py::call_guard<py::gil_scoped_release>());
+  m.def("_dipu_op_latency_enabled", opLatencyEnabled);
+  m.def("_dipu_set_op_latency_enabled", setOpLatencyEnabled);
+  m.def("_dipu_op_latency_stats", []() -> py::list {
+    auto histogram = [](const LatencyHistogram& h) {
+      py::dict item;
+      item["buckets"] =
+          std::vector<uint64_t>(h.buckets.begin(), h.buckets.end());
+      item["seconds"] = static_cast<double>(h.nanoseconds) / 1e9;
+      return item;
+    };
+    py::list result;
+    for (const auto& stats : getOpLatencyStats()) {
+      py::dict item;
+      item["op"] = stats.op;
+      item["calls"] = stats.calls;
+      item["prologue"] = histogram(stats.prologue);
+      item["call"] = histogram(stats.call);
+      result.append(item);
+    }
+    return result;
+  });
+  m.def("_dipu_reset_op_latency_stats", []() { resetOpLatencyStats(); });
+  m.def("_dipu_autocompare_report",
+        []() -> std::string { return native::autocompare::report(); });
+  m.def("_dipu_describe_unfinished_ops", describeUnfinishedOps);
+  m.def("_dipu_runtime_configs",
+        []() { return RuntimeConfigRegistry::instance().values(); });
+  m.def("_dipu_get_runtime_config", [](const std::string& name) {
+    return RuntimeConfigRegistry::instance().get(name);
+  });
+  m.def("_dipu_set_runtime_config",
+        [](const std::string& name, const std::string& value) {
+          RuntimeConfigRegistry::instance().set(name, value);
+        });
 }
 
 extern void patchTorchCsrcDevice(PyObject* module);
@@ -355,6 +854,10 @@ DIPU_API void exportDIPURuntime(PyObject* module) {
   exportDevices(m);
   exportStream(m);
   exportEvent(m);
+  if (PyModule_AddFunctions(module, StreamFastMethods.data()) < 0) {
+    throw py::error_already_set();
+  }
+  exportGraph(m);
   exportCommunicator(m);
   exportMemCaching(m);
   patchStorage(m);
@@ -120,6 +120,12 @@ at::Tensor* fromDiopiTensorHandle(::diopiTensorHandle_t tensor) {
       return diopi_dtype_complex64;
     case at::ScalarType::ComplexDouble:
       return diopi_dtype_complex128;
+#if defined(DIPU_DIOPI_FP8) && DIPU_TORCH_VERSION >= 20100
+    case at::ScalarType::Float8_e4m3fn:
+      return diopi_dtype_float8_e4m3fn;
+    case at::ScalarType::Float8_e5m2:
+      return diopi_dtype_float8_e5m2;
+#endif
     default:
       TORCH_CHECK(false, "invalid scalar type, type is ", type);
   }
@@ -156,6 +162,12 @@ caffe2::TypeMeta toATenType(::diopiDtype_t dt) {
       return caffe2::TypeMeta::Make<c10::complex<float>>();
     case diopi_dtype_complex128:
       return caffe2::TypeMeta::Make<c10::complex<double>>();
+#if defined(DIPU_DIOPI_FP8) && DIPU_TORCH_VERSION >= 20100
+    case diopi_dtype_float8_e4m3fn:
+      return caffe2::TypeMeta::Make<c10::Float8_e4m3fn>();
+    case diopi_dtype_float8_e5m2:
+      return caffe2::TypeMeta::Make<c10::Float8_e5m2>();
+#endif
     default:
       TORCH_CHECK(false, "invalid diopi type, diopi type is ", dt);
   }
@@ -218,6 +230,13 @@ c10::DeviceType toATenDevice(::diopiDevice_t device) {
   return diopi_size;
 }
 
+at::IntArrayRef asIntArrayRef(c10::SymIntArrayRef array) {
+  // A SymInt holding an int has the layout of an int64_t
+  auto result = c10::asIntArrayRefSlowOpt(array);
+  TORCH_CHECK(result.has_value(), "symbolic sizes are not supported: ", array);
+  return *result;
+}
+
 ::diopiRoundMode_t toDiopiRoundMode(const std::string& rounding_mode) {
   if (rounding_mode == "none" || rounding_mode == "None" ||
       rounding_mode.empty()) {
@@ -7,11 +7,40 @@
 
 #include "csrc_dipu/profiler/profiler.h"
 
+#include "workspace_arena.h"
+
 namespace diopihelper = dipu::diopi_helper;
 using dipu::profile::RecordBlockCreator;
 
+namespace {
+
+// Bump device scratch from the arena of the context's stream, return an
+// undefined tensor if there is no arena or the buffer doesn't fit
+at::Tensor requireWorkspaceBuffer(diopiContextHandle_t ctx, int64_t num_bytes,
+                                  const at::TensorOptions& options) {
+  if (options.device().type() != dipu::DIPU_DEVICE_TYPE) {
+    return {};
+  }
+  if (ctx->arena == nullptr) {
+    ctx->arena = dipu::DiopiWorkspaceArena::get(ctx->stream);
+    if (ctx->arena == nullptr) {
+      return {};
+    }
+    ctx->arena_mark = ctx->arena->mark();
+  }
+  return ctx->arena->allocate({num_bytes}, c10::nullopt, options);
+}
+
+}  // namespace
+
 extern "C" {
 
+diopiContext::~diopiContext() {
+  if (arena != nullptr) {
+    arena->release(arena_mark);
+  }
+}
+
 DIOPI_RT_API const char* diopiGetVersion() {
   auto static const version =
       std::string("DIOPI Version: ") + std::to_string(DIOPI_VER_MAJOR) + "." +
@@ -147,9 +176,19 @@ DIOPI_RT_API diopiError_t diopiRequireBuffer(diopiContextHandle_t ctx,
                                              diopiTensorHandle_t* tensor,
                                              int64_t num_bytes,
                                              diopiDevice_t device) {
-  diopiSize_t size{&num_bytes, 1};
-  return diopiRequireTensor(ctx, tensor, &size, nullptr, diopi_dtype_int8,
-                            device);
+  // Only buffers are scratch of the op, tensors required by it may be
+  // returned, e.g. by nonzero or unique, and outlive the context
+  auto options = at::TensorOptions(diopihelper::toATenDevice(device))
+                     .dtype(diopihelper::toATenType(diopi_dtype_int8));
+  at::Tensor t = requireWorkspaceBuffer(ctx, num_bytes, options);
+  if (!t.defined()) {
+    diopiSize_t size{&num_bytes, 1};
+    return diopiRequireTensor(ctx, tensor, &size, nullptr, diopi_dtype_int8,
+                              device);
+  }
+  ctx->arrays.emplace_back(std::move(t));
+  *tensor = reinterpret_cast<diopiTensorHandle_t>(&(ctx->arrays.back()));
+  return diopiSuccess;
 }
 
 DIOPI_RT_API diopiError_t diopiGeneratorGetState(diopiContextHandle_t ctx,
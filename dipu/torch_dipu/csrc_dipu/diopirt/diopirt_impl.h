@@ -1,6 +1,7 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <cstddef>
 #include <list>
 
 #include <ATen/ATen.h>
@@ -15,14 +16,27 @@
 
 using deviceStream_t = dipu::deviceStream_t;
 
+namespace dipu {
+class DiopiWorkspaceArena;
+}  // namespace dipu
+
 extern "C" {
 struct diopiContext {
   deviceStream_t stream;
   // 1. use arrays to hold tensor that avoid tensor deleting when leaving scope
   // 2. The address of each array must be fixed, so use list instead of vector
   std::list<at::Tensor> arrays;
+  // Buffers required by the op are bumped from the arena of the stream, and
+  // released back to `arena_mark` when the context ends
+  dipu::DiopiWorkspaceArena* arena = nullptr;
+  size_t arena_mark = 0;
 
   explicit diopiContext(const deviceStream_t& s) : stream(s) {}
+  diopiContext(const diopiContext&) = delete;
+  diopiContext(diopiContext&&) = delete;
+  diopiContext& operator=(const diopiContext&) = delete;
+  diopiContext& operator=(diopiContext&&) = delete;
+  ~diopiContext();
 };
 
 }  // extern "C"
@@ -55,6 +69,9 @@ c10::DeviceType toATenDevice(::diopiDevice_t device);
 
 ::diopiSize_t toDiopiSize(const at::OptionalIntArrayRef& dim);
 
+// Views `array` as ints without copying, it must not be symbolic
+at::IntArrayRef asIntArrayRef(c10::SymIntArrayRef array);
+
 ::diopiRoundMode_t toDiopiRoundMode(const std::string& rounding_mode);
 
 }  // namespace diopi_helper
@@ -0,0 +1,152 @@
+// Copyright (c) 2024, DeepLink.
+#include "workspace_arena.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <ATen/EmptyTensor.h>
+#include <ATen/core/DimVector.h>
+#include <ATen/ops/empty.h>
+
+#include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocatorUtils.h"
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// Maximum size (in MB) of the workspace buffer of each thread and stream,
+// larger workspace is allocated tensor by tensor. 0 disables the arena.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kArenaMaxSize =
+    get_env_or_default("DIPU_DIOPI_WORKSPACE_ARENA_MAX_MB", size_t{64})
+    << 20U;
+
+constexpr size_t kArenaAlignment = 512;
+// Buffers grow in units of this size
+constexpr size_t kArenaGranularity = size_t{1} << 20U;
+
+size_t alignUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+using ArenaHandle = std::shared_ptr<DiopiWorkspaceArena>;
+
+std::mutex& arenasMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Arenas of all threads, released together with the other device memory
+std::vector<ArenaHandle>& allArenas() {
+  static std::vector<ArenaHandle> arenas;
+  return arenas;
+}
+
+struct ThreadArenas {
+  std::vector<std::pair<c10::StreamId, ArenaHandle>> arenas;
+
+  ThreadArenas() = default;
+  ThreadArenas(const ThreadArenas&) = delete;
+  ThreadArenas(ThreadArenas&&) = delete;
+  ThreadArenas& operator=(const ThreadArenas&) = delete;
+  ThreadArenas& operator=(ThreadArenas&&) = delete;
+
+  ~ThreadArenas() {
+    std::lock_guard<std::mutex> _(arenasMutex());
+    auto& all = allArenas();
+    for (auto& item : arenas) {
+      all.erase(std::remove(all.begin(), all.end(), item.second), all.end());
+    }
+  }
+};
+
+}  // namespace
+
+DiopiWorkspaceArena* DiopiWorkspaceArena::get(deviceStream_t stream) {
+  if (kArenaMaxSize == 0) {
+    return nullptr;
+  }
+  auto current = getCurrentDIPUStream();
+  // Captured graphs may replay the workspace concurrently with eager ops
+  if (current.rawstream() != stream || devproxy::isStreamCapturing(stream)) {
+    return nullptr;
+  }
+  static thread_local ThreadArenas local;
+  const auto id = current.id();
+  const auto device = current.device_index();
+  for (auto& item : local.arenas) {
+    if (item.first == id && item.second->stream_.device_index() == device) {
+      return item.second.get();
+    }
+  }
+  auto arena = std::make_shared<DiopiWorkspaceArena>(current);
+  {
+    std::lock_guard<std::mutex> _(arenasMutex());
+    allArenas().push_back(arena);
+  }
+  local.arenas.emplace_back(id, arena);
+  return arena.get();
+}
+
+at::Tensor DiopiWorkspaceArena::allocate(at::IntArrayRef sizes,
+                                         at::OptionalIntArrayRef strides,
+                                         const at::TensorOptions& options) {
+  if (offset_ == 0 && peak_ > capacity_ && capacity_ < kArenaMaxSize) {
+    // Grow when nothing is bumped from the buffer. Tensors of earlier ops
+    // keep the old buffer alive, the caching allocator frees it in stream
+    // order.
+    capacity_ = std::min(alignUp(peak_, kArenaGranularity), kArenaMaxSize);
+    buffer_ = at::empty({static_cast<int64_t>(capacity_)},
+                        at::TensorOptions(stream_.device()).dtype(at::kByte));
+    recordStream(buffer_, stream_);
+  }
+
+  at::DimVector contiguous_strides(sizes.size());
+  if (!strides.has_value()) {
+    int64_t stride = 1;
+    for (size_t i = sizes.size(); i > 0; --i) {
+      contiguous_strides[i - 1] = stride;
+      stride *= std::max<int64_t>(sizes[i - 1], 1);
+    }
+  }
+  const auto at_strides = strides.value_or(contiguous_strides);
+  const auto itemsize = options.dtype().itemsize();
+  const auto nbytes =
+      at::detail::computeStorageNbytes(sizes, at_strides, itemsize);
+  const auto begin = alignUp(offset_, kArenaAlignment);
+  // Tensors which don't fit still count, so that the buffer grows to hold
+  // the whole workspace of an op
+  offset_ = begin + nbytes;
+  peak_ = std::max(peak_, offset_);
+  if (offset_ > capacity_ || begin % itemsize != 0) {
+    return {};
+  }
+  auto tensor = at::detail::make_tensor<c10::TensorImpl>(
+      c10::Storage(buffer_.storage()), buffer_.key_set(), options.dtype());
+  tensor.unsafeGetTensorImpl()->set_sizes_and_strides(sizes, at_strides);
+  tensor.unsafeGetTensorImpl()->set_storage_offset(
+      static_cast<int64_t>(begin / itemsize));
+  return tensor;
+}
+
+void DiopiWorkspaceArena::release(size_t mark) { offset_ = mark; }
+
+void DiopiWorkspaceArena::releaseBuffer() {
+  buffer_ = at::Tensor();
+  capacity_ = 0;
+  peak_ = 0;
+}
+
+void releaseDiopiWorkspaceArenas() {
+  std::lock_guard<std::mutex> _(arenasMutex());
+  for (auto& arena : allArenas()) {
+    arena->releaseBuffer();
+  }
+}
+
+}  // namespace dipu
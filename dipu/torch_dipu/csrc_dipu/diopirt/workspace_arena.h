@@ -0,0 +1,50 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstddef>
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/TensorOptions.h>
+#include <c10/util/OptionalArrayRef.h>
+
+#include "csrc_dipu/runtime/core/DIPUStream.h"
+
+namespace dipu {
+
+// Device scratch memory for the DIOPI workspace buffers of one thread and
+// stream, see diopiRequireBuffer. Buffers are bumped from a single device
+// buffer and released in LIFO order when their diopiContext ends. Only later
+// ops on the same stream reuse the memory, and they are ordered after the
+// kernels using it.
+class DiopiWorkspaceArena {
+ public:
+  explicit DiopiWorkspaceArena(const DIPUStream& stream) : stream_(stream) {}
+
+  // Arena of the calling thread for the current stream, nullptr if it is
+  // disabled or `stream` is not the current one
+  static DiopiWorkspaceArena* get(deviceStream_t stream);
+
+  size_t mark() const { return offset_; }
+
+  // Contiguous if `strides` is not given. Return an undefined tensor if it
+  // doesn't fit in the buffer.
+  at::Tensor allocate(at::IntArrayRef sizes, at::OptionalIntArrayRef strides,
+                      const at::TensorOptions& options);
+
+  // Release everything allocated after `mark`
+  void release(size_t mark);
+
+  void releaseBuffer();
+
+ private:
+  DIPUStream stream_;
+  at::Tensor buffer_;
+  size_t capacity_ = 0;
+  size_t offset_ = 0;
+  // Most bytes any op has asked for, the buffer grows up to it
+  size_t peak_ = 0;
+};
+
+void releaseDiopiWorkspaceArenas();
+
+}  // namespace dipu
@@ -1,7 +1,12 @@
 #include "DIPUDeviceActivity.h"
 
 #include <GenericTraceActivity.h>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <algorithm>
 #include <output_base.h>
+#include <string>
 
 #include <c10/util/Exception.h>
 
@@ -23,6 +28,48 @@ namespace profile {
 
 using libkineto::GenericTraceActivity;
 
+namespace {
+
+const std::map<libkineto::ActivityType, devapis::ActivityKind>
+    kActivityKindMapping{
+        {libkineto::ActivityType::CUDA_RUNTIME,
+         devapis::ActivityKind::kRuntime},
+        {libkineto::ActivityType::CONCURRENT_KERNEL,
+         devapis::ActivityKind::kKernel},
+        {libkineto::ActivityType::GPU_MEMCPY, devapis::ActivityKind::kMemcpy},
+        {libkineto::ActivityType::GPU_MEMSET, devapis::ActivityKind::kMemset}};
+
+libkineto::ActivityType activityType(devapis::ActivityKind kind) {
+  switch (kind) {
+    case devapis::ActivityKind::kRuntime:
+      return libkineto::ActivityType::CUDA_RUNTIME;
+    case devapis::ActivityKind::kKernel:
+      return libkineto::ActivityType::CONCURRENT_KERNEL;
+    case devapis::ActivityKind::kMemcpy:
+      return libkineto::ActivityType::GPU_MEMCPY;
+    case devapis::ActivityKind::kMemset:
+      return libkineto::ActivityType::GPU_MEMSET;
+  }
+  return libkineto::ActivityType::CONCURRENT_KERNEL;
+}
+
+// FORCE_USE_DIPU_PROFILER times the ops by event pairs even if the vendor
+// has a collector
+bool forceEventPairs() {
+  const char* env = std::getenv("FORCE_USE_DIPU_PROFILER");
+  return env != nullptr && std::strncmp(env, "false", strlen("false")) != 0 &&
+         std::strncmp(env, "False", strlen("False")) != 0;
+}
+
+}  // namespace
+
+DIPUDeviceActivity::DIPUDeviceActivity() {
+  if (devapis::deviceActivityCollector != nullptr && !forceEventPairs()) {
+    collector_ = devapis::deviceActivityCollector();
+    collector_->setOverflowHandler([this] { stopCollection = true; });
+  }
+}
+
 DIPUDeviceActivity::~DIPUDeviceActivity() {
   disableActivities(std::set<libkineto::ActivityType>());
 }
@@ -35,20 +82,50 @@ DIPUDeviceActivity& DIPUDeviceActivity::instance() {
 void DIPUDeviceActivity::pushCorrelationID(
     uint64_t id, libkineto::DeviceActivityInterface::CorrelationFlowType type) {
   CorrelationIDManager::instance().pushCorrelationID(id, type);
+  if (collector_ != nullptr && type == Default) {
+    collector_->pushCorrelationId(id);
+  }
 }
 
 void DIPUDeviceActivity::popCorrelationID(
     libkineto::DeviceActivityInterface::CorrelationFlowType type) {
   CorrelationIDManager::instance().popCorrelationID(type);
+  if (collector_ != nullptr && type == Default) {
+    collector_->popCorrelationId();
+  }
 }
 
 void DIPUDeviceActivity::enableActivities(
-    const std::set<libkineto::ActivityType>& selected_activities) {}
+    const std::set<libkineto::ActivityType>& selected_activities) {
+  if (collector_ == nullptr) {
+    return;
+  }
+  std::set<devapis::ActivityKind> kinds;
+  for (const auto& type : selected_activities) {
+    auto iter = kActivityKindMapping.find(type);
+    if (iter != kActivityKindMapping.end()) {
+      kinds.insert(iter->second);
+    }
+  }
+  collector_->enable(
+      kinds, selected_activities.count(
+                 libkineto::ActivityType::EXTERNAL_CORRELATION) != 0);
+  stopCollection = false;
+}
 
 void DIPUDeviceActivity::disableActivities(
-    const std::set<libkineto::ActivityType>& selected_activities) {}
+    const std::set<libkineto::ActivityType>& selected_activities) {
+  if (collector_ != nullptr) {
+    collector_->disable();
+  }
+}
 
-void DIPUDeviceActivity::clearActivities() { abandonAllRecords(); }
+void DIPUDeviceActivity::clearActivities() {
+  abandonAllRecords();
+  if (collector_ != nullptr) {
+    collector_->clear();
+  }
+}
 
 int32_t DIPUDeviceActivity::processActivities(
     libkineto::ActivityLogger& logger,
@@ -59,8 +136,10 @@ int32_t DIPUDeviceActivity::processActivities(
   auto records = RecordsImpl::get().getAllRecordList();
   for (const auto& record : records) {
     GenericTraceActivity act;
-    act.startTime = static_cast<int64_t>(record.begin / kMillisecondPerSecond);
-    act.endTime = static_cast<int64_t>(record.end / kMillisecondPerSecond);
+    act.startTime =
+        static_cast<int64_t>(toTimeBase(record.begin) / kMillisecondPerSecond);
+    act.endTime =
+        static_cast<int64_t>(toTimeBase(record.end) / kMillisecondPerSecond);
     act.id = static_cast<int32_t>(record.opId);
     act.device = static_cast<int32_t>(record.pid);
     act.resource = static_cast<int32_t>(record.threadIdx);
@@ -72,7 +151,7 @@ int32_t DIPUDeviceActivity::processActivities(
       act.activityType = libkineto::ActivityType::CUDA_RUNTIME;
       act.flow.start = true;
     }
-    act.activityName = record.name;
+    act.activityName = internedName(record.nameId);
     act.flow.id = record.opId;
     act.flow.type = libkineto::kLinkAsyncCpuGpu;
     auto link_cor_id = record.linkCorrelationId;
@@ -86,12 +165,68 @@ int32_t DIPUDeviceActivity::processActivities(
     logger.handleResourceInfo(kv.second, start_time);
   }
 
-  return static_cast<int32_t>(records.size());
+  return static_cast<int32_t>(records.size()) +
+         processCollected(logger, linked_activity, start_time, end_time);
+}
+
+int32_t DIPUDeviceActivity::processCollected(
+    libkineto::ActivityLogger& logger,
+    const std::function<const libkineto::ITraceActivity*(int32_t)>&
+        linked_activity,
+    int64_t start_time, int64_t end_time) {
+  if (collector_ == nullptr) {
+    return 0;
+  }
+  constexpr int64_t kNanosecondPerMicrosecond = 1000;
+  int32_t count = 0;
+  std::map<std::pair<int64_t, int64_t>, libkineto::ResourceInfo> streams;
+  collector_->flush([&](const devapis::ActivityRecord& record) {
+    if (record.startNs < start_time * kNanosecondPerMicrosecond ||
+        record.endNs > end_time * kNanosecondPerMicrosecond) {
+      return;
+    }
+    const auto begin = static_cast<int64_t>(
+        toTimeBase(static_cast<size_t>(record.startNs)));
+    const auto end =
+        static_cast<int64_t>(toTimeBase(static_cast<size_t>(record.endNs)));
+    const bool onDevice = record.kind != devapis::ActivityKind::kRuntime;
+    GenericTraceActivity act;
+    act.startTime = begin / kNanosecondPerMicrosecond;
+    act.endTime = end / kNanosecondPerMicrosecond;
+    act.id = static_cast<int32_t>(record.correlationId);
+    act.device = static_cast<int32_t>(record.device);
+    act.resource = static_cast<int32_t>(record.resource);
+    act.activityType = activityType(record.kind);
+    act.activityName = record.name;
+    act.flow.id = record.correlationId;
+    act.flow.start = !onDevice;
+    act.flow.type = libkineto::kLinkAsyncCpuGpu;
+    if (record.externalId != 0) {
+      act.linked = linked_activity(static_cast<int32_t>(record.externalId));
+    }
+    for (const auto& [name, value] : record.counters) {
+      act.addMetadata(name, std::to_string(value));
+    }
+    logger.handleGenericActivity(act);
+    if (onDevice) {
+      streams.emplace(std::make_pair(record.device, record.resource),
+                      libkineto::ResourceInfo(
+                          record.device, record.resource, record.resource,
+                          "stream " + std::to_string(record.resource)));
+    }
+    ++count;
+  });
+  for (const auto& kv : streams) {
+    logger.handleResourceInfo(kv.second, start_time);
+  }
+  return count;
 }
 
 void DIPUDeviceActivity::startTrace(
     const std::set<libkineto::ActivityType>& selected_activities) {
-  if (selected_activities.find(libkineto::ActivityType::CONCURRENT_KERNEL) !=
+  // the collector times the kernels, no events are needed per op
+  if (collector_ == nullptr &&
+      selected_activities.find(libkineto::ActivityType::CONCURRENT_KERNEL) !=
       selected_activities.end()) {
     setProfileOpen(true);
   }
@@ -107,7 +242,28 @@ void DIPUDeviceActivity::stopTrace(
 
 void DIPUDeviceActivity::teardownContext() {}
 
-void DIPUDeviceActivity::setMaxBufferSize(int32_t size) {}
+std::vector<std::string> DIPUDeviceActivity::supportedCounters() const {
+  return collector_ == nullptr ? std::vector<std::string>()
+                               : collector_->supportedCounters();
+}
+
+void DIPUDeviceActivity::setCounters(const std::vector<std::string>& counters) {
+  const auto supported = supportedCounters();
+  for (const auto& name : counters) {
+    TORCH_CHECK(
+        std::find(supported.begin(), supported.end(), name) != supported.end(),
+        "hardware counter ", name, " is not supported by this device");
+  }
+  if (collector_ != nullptr) {
+    collector_->setCounters(counters);
+  }
+}
+
+void DIPUDeviceActivity::setMaxBufferSize(int32_t size) {
+  if (collector_ != nullptr) {
+    collector_->setMaxBufferSize(size);
+  }
+}
 
 const static int32_t default_device_activity_init = []() {
   // Vendor device activity implementation has higher priority.
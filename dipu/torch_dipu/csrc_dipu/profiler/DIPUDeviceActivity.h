@@ -3,6 +3,10 @@
 #include <DeviceActivityInterface.h>
 #include <GenericTraceActivity.h>
 #include <memory>
+#include <string>
+#include <vector>
+
+#include "csrc_dipu/runtime/device/profilerapis.h"
 
 namespace dipu {
 namespace profile {
@@ -40,8 +44,23 @@ class DIPUDeviceActivity : public libkineto::DeviceActivityInterface {
   void teardownContext() override;
   void setMaxBufferSize(int32_t size) override;
 
+  // The hardware counters the collector of the vendor can attach to kernels
+  std::vector<std::string> supportedCounters() const;
+  // Selects the counters of the next traces, which show up as the args of
+  // the kernels
+  void setCounters(const std::vector<std::string>& counters);
+
  private:
-  DIPUDeviceActivity() = default;
+  DIPUDeviceActivity();
+
+  int32_t processCollected(
+      libkineto::ActivityLogger& logger,
+      const std::function<const libkineto::ITraceActivity*(int32_t)>&
+          linked_activity,
+      int64_t start_time, int64_t end_time);
+
+  // The collector of the vendor, nullptr to time the ops by event pairs
+  devapis::DeviceActivityCollector* collector_ = nullptr;
 };
 
 }  // namespace profile
@@ -0,0 +1,234 @@
+// Copyright (c) 2024, DeepLink.
+#include "SamplingProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include <c10/util/Exception.h>
+#include <torch/csrc/profiler/util.h>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+
+#include "profiler.h"
+
+namespace dipu {
+namespace profile {
+
+namespace {
+
+constexpr double kNsPerMs = 1e6;
+
+struct SampledOp {
+  uint32_t nameId = 0;
+  size_t hostNs = 0;
+  devapis::deviceId_t device = -1;
+  deviceEvent_t start{};
+  deviceEvent_t stop{};
+  // The events are recorded and not yet added to the totals
+  bool pending = false;
+  // Between the start and the end of its op
+  bool running = false;
+};
+
+struct OpTotals {
+  uint64_t calls = 0;
+  size_t hostNs = 0;
+  uint64_t deviceCalls = 0;
+  double deviceMs = 0;
+  double maxDeviceMs = 0;
+};
+
+class Sampler final {
+ public:
+  static Sampler& get() {
+    static Sampler instance;
+    return instance;
+  }
+
+  void start(int64_t everySteps, double opFraction, size_t ringSize) {
+    TORCH_CHECK(everySteps > 0, "sampling every ", everySteps, " steps");
+    TORCH_CHECK(opFraction > 0 && opFraction <= 1, "sampling a fraction of ",
+                opFraction, " of the ops");
+    std::lock_guard<std::mutex> lk(mtx_);
+    releaseWithoutLock();
+    everySteps_.store(everySteps, std::memory_order_relaxed);
+    opFraction_.store(opFraction, std::memory_order_relaxed);
+    step_.store(0, std::memory_order_relaxed);
+    ring_.assign(std::max<size_t>(ringSize, 1), SampledOp{});
+    next_ = 0;
+    totals_.clear();
+    enabled_.store(true, std::memory_order_release);
+  }
+
+  void stop() {
+    enabled_.store(false, std::memory_order_release);
+    std::lock_guard<std::mutex> lk(mtx_);
+    releaseWithoutLock();
+  }
+
+  void step() { step_.fetch_add(1, std::memory_order_relaxed); }
+
+  bool sample() {
+    if (!enabled_.load(std::memory_order_acquire) ||
+        step_.load(std::memory_order_relaxed) %
+                everySteps_.load(std::memory_order_relaxed) !=
+            0) {
+      return false;
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+    thread_local double credit = 0;
+    credit += opFraction_.load(std::memory_order_relaxed);
+    if (credit < 1) {
+      return false;
+    }
+    credit -= 1;
+    return true;
+  }
+
+  // A free slot of the ring with its start event recorded, -1 if the ring
+  // is full of ops still running on the device
+  int64_t begin(uint32_t nameId, deviceStream_t stream) {
+    const auto device = devproxy::current_device();
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (ring_.empty()) {
+      return -1;
+    }
+    const auto index = next_;
+    auto& op = ring_[index];
+    if (op.running || (op.pending && !tryAddWithoutLock(op))) {
+      return -1;
+    }
+    next_ = (next_ + 1) % ring_.size();
+    if (op.device != device) {
+      destroyEvents(op);
+      devproxy::createEvent(&op.start);
+      devproxy::createEvent(&op.stop);
+      op.device = device;
+    }
+    op.nameId = nameId;
+    op.running = true;
+    devproxy::recordEvent(op.start, stream);
+    return static_cast<int64_t>(index);
+  }
+
+  void end(uint32_t nameId, size_t hostNs, int64_t slot,
+           deviceStream_t stream) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto& totals = totals_[nameId];
+    ++totals.calls;
+    totals.hostNs += hostNs;
+    if (slot < 0 || static_cast<size_t>(slot) >= ring_.size()) {
+      return;
+    }
+    auto& op = ring_[slot];
+    if (!op.running || op.nameId != nameId) {
+      // the ring was reset while the op ran
+      return;
+    }
+    devproxy::recordEvent(op.stop, stream);
+    op.running = false;
+    op.pending = true;
+  }
+
+  std::vector<SampledOpStats> summary(bool reset) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    for (auto& op : ring_) {
+      if (op.pending) {
+        tryAddWithoutLock(op);
+      }
+    }
+    std::vector<SampledOpStats> result;
+    result.reserve(totals_.size());
+    for (const auto& kv : totals_) {
+      const auto& totals = kv.second;
+      result.push_back({internedName(kv.first), totals.calls,
+                        static_cast<double>(totals.hostNs) / kNsPerMs,
+                        totals.deviceCalls, totals.deviceMs,
+                        totals.maxDeviceMs});
+    }
+    std::sort(result.begin(), result.end(),
+              [](const auto& a, const auto& b) { return a.name < b.name; });
+    if (reset) {
+      totals_.clear();
+    }
+    return result;
+  }
+
+ private:
+  Sampler() = default;
+
+  // Adds the device time of `op` if its events are done
+  bool tryAddWithoutLock(SampledOp& op) {
+    if (devproxy::getEventStatus(op.stop) != devapis::EventStatus::READY) {
+      return false;
+    }
+    float ms = 0.F;
+    devproxy::eventElapsedTime(&ms, op.start, op.stop);
+    auto& totals = totals_[op.nameId];
+    ++totals.deviceCalls;
+    totals.deviceMs += ms;
+    totals.maxDeviceMs = std::max(totals.maxDeviceMs, static_cast<double>(ms));
+    op.pending = false;
+    return true;
+  }
+
+  static void destroyEvents(SampledOp& op) {
+    if (op.device >= 0) {
+      devproxy::destroyEvent(op.start);
+      devproxy::destroyEvent(op.stop);
+      op.device = -1;
+    }
+  }
+
+  // Ops still running find their slot gone and only add their host time
+  void releaseWithoutLock() {
+    for (auto& op : ring_) {
+      destroyEvents(op);
+    }
+    ring_.clear();
+    next_ = 0;
+  }
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<int64_t> everySteps_{1};
+  std::atomic<double> opFraction_{1};
+  std::atomic<int64_t> step_{0};
+
+  std::mutex mtx_;
+  // Guarded by `mtx_`
+  std::vector<SampledOp> ring_;
+  size_t next_ = 0;
+  std::unordered_map<uint32_t, OpTotals> totals_;
+};
+
+}  // namespace
+
+void startSampling(int64_t everySteps, double opFraction, size_t ringSize) {
+  Sampler::get().start(everySteps, opFraction, ringSize);
+}
+
+void stopSampling() { Sampler::get().stop(); }
+
+void samplingStep() { Sampler::get().step(); }
+
+bool sampleOp() { return Sampler::get().sample(); }
+
+std::vector<SampledOpStats> samplingSummary(bool reset) {
+  return Sampler::get().summary(reset);
+}
+
+SampledRecord::SampledRecord(uint32_t nameId, deviceStream_t stream)
+    : nameId_(nameId),
+      stream_(stream),
+      begin_(static_cast<size_t>(torch::profiler::impl::getTime())),
+      slot_(Sampler::get().begin(nameId, stream)) {}
+
+SampledRecord::~SampledRecord() {
+  const auto end = static_cast<size_t>(torch::profiler::impl::getTime());
+  Sampler::get().end(nameId_, end - begin_, slot_, stream_);
+}
+
+}  // namespace profile
+}  // namespace dipu
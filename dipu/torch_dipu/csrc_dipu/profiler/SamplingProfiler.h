@@ -0,0 +1,60 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "csrc_dipu/vendor/vendorapi.h"
+
+namespace dipu {
+namespace profile {
+
+// Totals of the sampled ops of one name. Device times are timed by events
+// around the op on its stream, only for the ops whose events were done when
+// the totals were read.
+struct SampledOpStats {
+  std::string name;
+  uint64_t calls = 0;
+  double hostMs = 0;
+  uint64_t deviceCalls = 0;
+  double deviceMs = 0;
+  double maxDeviceMs = 0;
+};
+
+// Samples the ops of one step out of `everySteps`, counted by samplingStep(),
+// and `opFraction` of the ops of those. At most `ringSize` sampled ops wait
+// for their device times; an op sampled while the ring is full only gets its
+// host time. Runs next to, and independently of, the full profiler.
+void startSampling(int64_t everySteps, double opFraction, size_t ringSize);
+void stopSampling();
+
+void samplingStep();
+
+// Whether the op starting now on the calling thread is sampled
+bool sampleOp();
+
+// Per op totals since the last reset, sorted by name
+std::vector<SampledOpStats> samplingSummary(bool reset);
+
+class SampledRecord final {
+ public:
+  SampledRecord(uint32_t nameId, deviceStream_t stream);
+  ~SampledRecord();
+
+  SampledRecord(const SampledRecord&) = delete;
+  SampledRecord& operator=(const SampledRecord&) = delete;
+  SampledRecord(SampledRecord&&) = delete;
+  SampledRecord& operator=(SampledRecord&&) = delete;
+
+ private:
+  uint32_t nameId_;
+  deviceStream_t stream_;
+  size_t begin_;
+  // Index in the ring, -1 without device timing
+  int64_t slot_ = -1;
+};
+
+}  // namespace profile
+}  // namespace dipu
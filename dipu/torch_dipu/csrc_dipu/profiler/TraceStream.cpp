@@ -0,0 +1,450 @@
+// Copyright (c) 2024, DeepLink.
+#include "TraceStream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+#include <ATen/record_function.h>
+#include <c10/util/Exception.h>
+#include <torch/csrc/profiler/util.h>
+
+#include "csrc_dipu/utils/Log.h"
+
+#include "ThreadUtil.h"
+
+namespace dipu {
+namespace profile {
+
+namespace {
+
+// Field numbers in perfetto/protos/perfetto/trace, by message
+namespace field {
+// Trace
+constexpr uint32_t kPacket = 1;
+// TracePacket
+constexpr uint32_t kTimestamp = 8;
+constexpr uint32_t kSequenceId = 10;
+constexpr uint32_t kTrackEvent = 11;
+constexpr uint32_t kInternedData = 12;
+constexpr uint32_t kSequenceFlags = 13;
+constexpr uint32_t kTrackDescriptor = 60;
+// TrackEvent
+constexpr uint32_t kType = 9;
+constexpr uint32_t kNameIid = 10;
+constexpr uint32_t kTrackUuid = 11;
+constexpr uint32_t kFlowIds = 47;
+constexpr uint32_t kTerminatingFlowIds = 48;
+// InternedData
+constexpr uint32_t kEventNames = 2;
+// EventName
+constexpr uint32_t kIid = 1;
+constexpr uint32_t kName = 2;
+// TrackDescriptor, kName as well
+constexpr uint32_t kUuid = 1;
+constexpr uint32_t kThread = 4;
+constexpr uint32_t kParentUuid = 5;
+// ThreadDescriptor
+constexpr uint32_t kPid = 1;
+constexpr uint32_t kTid = 2;
+}  // namespace field
+
+constexpr uint64_t kSliceBegin = 1;
+constexpr uint64_t kSliceEnd = 2;
+constexpr uint64_t kIncrementalStateCleared = 1;
+constexpr uint64_t kNeedsIncrementalState = 2;
+// All packets are written by the writer thread, on one sequence
+constexpr uint64_t kSequence = 1;
+
+// Chunks handed to the writer and not yet written, beyond which the threads
+// adding more wait
+constexpr size_t kMaxQueuedChunks = 4;
+
+// Appends protobuf fields to a buffer
+class ProtoWriter final {
+ public:
+  void varint(uint32_t id, uint64_t value) {
+    key(id, 0);
+    raw(value);
+  }
+
+  void fixed64(uint32_t id, uint64_t value) {
+    key(id, 1);
+    for (int i = 0; i < 8; ++i) {
+      data_.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+  }
+
+  void bytes(uint32_t id, std::string_view value) {
+    key(id, 2);
+    raw(value.size());
+    data_.append(value);
+  }
+
+  void message(uint32_t id, const ProtoWriter& value) {
+    bytes(id, value.data_);
+  }
+
+  const std::string& data() const { return data_; }
+
+ private:
+  void key(uint32_t id, uint32_t wireType) {
+    raw((uint64_t{id} << 3) | wireType);
+  }
+
+  void raw(uint64_t value) {
+    while (value >= 0x80) {
+      data_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    data_.push_back(static_cast<char>(value));
+  }
+
+  std::string data_;
+};
+
+// Encodes records as perfetto slices, host records on the track of their
+// thread and device records on a track per stream under one per device.
+// Launches and their kernels are linked by a flow on the op id. Tracks and
+// names are described the first time they are used.
+class PerfettoEncoder final {
+ public:
+  void encode(const std::vector<Record>& records, std::string& out) {
+    for (const auto& r : records) {
+      const auto track = trackOf(r, out);
+
+      ProtoWriter begin;
+      begin.varint(field::kType, kSliceBegin);
+      begin.varint(field::kTrackUuid, track);
+      begin.varint(field::kNameIid, uint64_t{r.nameId} + 1);
+      if (r.opId != 0) {
+        begin.fixed64(r.isKernel ? field::kTerminatingFlowIds : field::kFlowIds,
+                      r.opId);
+      }
+      ProtoWriter packet;
+      packet.varint(field::kTimestamp, toTimeBase(r.begin));
+      packet.varint(field::kSequenceId, kSequence);
+      packet.varint(field::kSequenceFlags,
+                    first_ ? kIncrementalStateCleared | kNeedsIncrementalState
+                           : kNeedsIncrementalState);
+      first_ = false;
+      if (r.nameId >= names_.size() || !names_[r.nameId]) {
+        if (r.nameId >= names_.size()) {
+          names_.resize(r.nameId + 1, false);
+        }
+        names_[r.nameId] = true;
+        ProtoWriter name;
+        name.varint(field::kIid, uint64_t{r.nameId} + 1);
+        name.bytes(field::kName, internedName(r.nameId));
+        ProtoWriter interned;
+        interned.message(field::kEventNames, name);
+        packet.message(field::kInternedData, interned);
+      }
+      packet.message(field::kTrackEvent, begin);
+      append(packet, out);
+
+      ProtoWriter end;
+      end.varint(field::kType, kSliceEnd);
+      end.varint(field::kTrackUuid, track);
+      ProtoWriter endPacket;
+      endPacket.varint(field::kTimestamp,
+                        toTimeBase(std::max(r.end, r.begin)));
+      endPacket.varint(field::kSequenceId, kSequence);
+      endPacket.varint(field::kSequenceFlags, kNeedsIncrementalState);
+      endPacket.message(field::kTrackEvent, end);
+      append(endPacket, out);
+    }
+  }
+
+ private:
+  static void append(const ProtoWriter& packet, std::string& out) {
+    ProtoWriter trace;
+    trace.message(field::kPacket, packet);
+    out += trace.data();
+  }
+
+  uint64_t trackOf(const Record& r, std::string& out) {
+    constexpr uint64_t kLow = 0xffffffff;
+    if (!r.isKernel) {
+      const auto uuid = (uint64_t{1} << 63) | ((r.pid & 0x7fffffff) << 32) |
+                        (r.threadIdx & kLow);
+      if (tracks_.insert(uuid).second) {
+        ProtoWriter thread;
+        thread.varint(field::kPid, r.pid);
+        thread.varint(field::kTid, r.threadIdx);
+        ProtoWriter track;
+        track.varint(field::kUuid, uuid);
+        track.message(field::kThread, thread);
+        describe(track, out);
+      }
+      return uuid;
+    }
+    const auto device = (uint64_t{1} << 62) | ((r.pid & 0xffff) << 32);
+    const auto uuid = device | ((r.threadIdx + 1) & kLow);
+    if (tracks_.insert(uuid).second) {
+      if (tracks_.insert(device).second) {
+        ProtoWriter track;
+        track.varint(field::kUuid, device);
+        track.bytes(field::kName, "dipu device " + std::to_string(r.pid));
+        describe(track, out);
+      }
+      ProtoWriter track;
+      track.varint(field::kUuid, uuid);
+      track.varint(field::kParentUuid, device);
+      track.bytes(field::kName,
+                  "stream " + std::to_string(static_cast<int>(r.threadIdx)));
+      describe(track, out);
+    }
+    return uuid;
+  }
+
+  static void describe(const ProtoWriter& track, std::string& out) {
+    ProtoWriter packet;
+    packet.message(field::kTrackDescriptor, track);
+    append(packet, out);
+  }
+
+  std::unordered_set<uint64_t> tracks_;
+  std::vector<bool> names_;
+  bool first_ = true;
+};
+
+class TraceStream final {
+ public:
+  static TraceStream& get() {
+    static TraceStream instance;
+    return instance;
+  }
+
+  bool active() const { return active_.load(std::memory_order_acquire); }
+
+  void start(const std::string& path, int64_t flushIntervalMs,
+             size_t chunkRecords) {
+    TORCH_CHECK(flushIntervalMs > 0, "flushing the trace every ",
+                flushIntervalMs, " ms");
+    TORCH_CHECK(chunkRecords > 0, "chunks of ", chunkRecords, " records");
+    std::lock_guard<std::mutex> lk(mtx_);
+    file_ = std::fopen(path.c_str(), "wb");
+    TORCH_CHECK(file_ != nullptr, "can't open ", path, " for the trace");
+    for (auto& buffer : threads_) {
+      std::lock_guard<std::mutex> bufferLock(buffer->mtx);
+      buffer->records.clear();
+    }
+    queue_.clear();
+    encoder_ = PerfettoEncoder();
+    stats_ = TraceStreamStats{};
+    interval_ = std::chrono::milliseconds(flushIntervalMs);
+    chunkRecords_ = chunkRecords;
+    running_ = true;
+    writer_ = std::thread([this] { loop(); });
+    active_.store(true, std::memory_order_release);
+  }
+
+  TraceStreamStats stop() {
+    {
+      std::lock_guard<std::mutex> lk(mtx_);
+      if (!active()) {
+        return TraceStreamStats{};
+      }
+      active_.store(false, std::memory_order_release);
+      running_ = false;
+    }
+    cv_.notify_all();
+    writer_.join();
+    // the writer is done with the file and the stats
+    std::fclose(file_);
+    file_ = nullptr;
+    return stats_;
+  }
+
+  void add(const Record& record) {
+    auto& buffer = localBuffer();
+    std::vector<Record> full;
+    {
+      std::lock_guard<std::mutex> lk(buffer.mtx);
+      buffer.records.push_back(record);
+      if (buffer.records.size() < chunkRecords_) {
+        return;
+      }
+      full.swap(buffer.records);
+      buffer.records.reserve(chunkRecords_);
+    }
+    addChunk(std::move(full));
+  }
+
+  void addChunk(std::vector<Record> records) {
+    if (records.empty()) {
+      return;
+    }
+    std::unique_lock<std::mutex> lk(mtx_);
+    cv_.wait(lk,
+             [this] { return !running_ || queue_.size() < kMaxQueuedChunks; });
+    if (!running_) {
+      return;
+    }
+    queue_.push_back(std::move(records));
+    cv_.notify_all();
+  }
+
+ private:
+  // Only locked by its thread, and by the writer when it takes the records
+  struct ThreadBuffer {
+    std::mutex mtx;
+    std::vector<Record> records;
+  };
+
+  TraceStream() = default;
+
+  ThreadBuffer& localBuffer() {
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+    thread_local ThreadBuffer* pBuffer = nullptr;
+    if (pBuffer == nullptr) {
+      std::lock_guard<std::mutex> lk(mtx_);
+      threads_.push_back(std::make_unique<ThreadBuffer>());
+      pBuffer = threads_.back().get();
+    }
+    return *pBuffer;
+  }
+
+  // Must be called with `mtx_` held
+  void takeThreadBuffersWithoutLock() {
+    for (auto& buffer : threads_) {
+      std::lock_guard<std::mutex> lk(buffer->mtx);
+      if (!buffer->records.empty()) {
+        queue_.push_back(std::move(buffer->records));
+        buffer->records.clear();
+      }
+    }
+  }
+
+  void loop() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    auto deadline = std::chrono::steady_clock::now() + interval_;
+    std::string out;
+    while (true) {
+      cv_.wait_until(lk, deadline,
+                     [this] { return !running_ || !queue_.empty(); });
+      const bool stopping = !running_;
+      if (stopping || std::chrono::steady_clock::now() >= deadline) {
+        takeThreadBuffersWithoutLock();
+        deadline = std::chrono::steady_clock::now() + interval_;
+      }
+      auto chunks = std::move(queue_);
+      queue_.clear();
+      // room for the threads waiting on the queue
+      cv_.notify_all();
+      lk.unlock();
+      for (const auto& chunk : chunks) {
+        out.clear();
+        encoder_.encode(chunk, out);
+        write(out, chunk.size());
+      }
+      lk.lock();
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  // Only called by the writer thread
+  void write(const std::string& data, size_t records) {
+    if (std::fwrite(data.data(), 1, data.size(), file_) != data.size() ||
+        std::fflush(file_) != 0) {
+      DIPU_LOG_ERROR << "failed to write " << records
+                     << " records to the trace stream" << std::endl;
+      return;
+    }
+    stats_.records += records;
+    stats_.bytes += data.size();
+    ++stats_.chunks;
+  }
+
+  std::atomic<bool> active_{false};
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  // Guarded by `mtx_`
+  bool running_ = false;
+  std::deque<std::vector<Record>> queue_;
+  std::vector<std::unique_ptr<ThreadBuffer>> threads_;
+
+  std::chrono::milliseconds interval_{};
+  size_t chunkRecords_ = 0;
+  // Used by the writer thread only while it runs
+  std::FILE* file_ = nullptr;
+  PerfettoEncoder encoder_;
+  TraceStreamStats stats_;
+  std::thread writer_;
+};
+
+// The torch ops, which the Kineto profiler records in collection.cpp
+struct OpContext final : at::ObserverContext {
+  size_t begin = 0;
+};
+
+std::unique_ptr<at::ObserverContext> onOpEnter(const at::RecordFunction& fn) {
+  auto context = std::make_unique<OpContext>();
+  context->begin = static_cast<size_t>(torch::profiler::impl::getTime());
+  return context;
+}
+
+void onOpExit(const at::RecordFunction& fn, at::ObserverContext* context) {
+  if (!traceStreamActive()) {
+    return;
+  }
+  streamRecord(Record{internName(fn.name()), 0,
+                      static_cast<OpContext*>(context)->begin,
+                      static_cast<size_t>(torch::profiler::impl::getTime()),
+                      static_cast<size_t>(libkineto::processId()),
+                      static_cast<size_t>(libkineto::systemThreadId()), false,
+                      0});
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+at::CallbackHandle op_callback = 0;
+
+}  // namespace
+
+void startTraceStream(const std::string& path, int64_t flushIntervalMs,
+                      size_t chunkRecords) {
+  TORCH_CHECK(!traceStreamActive(), "a trace is already streamed");
+  TORCH_CHECK(!isEnable(), "can't stream a trace while the profiler runs");
+  abandonAllRecords();
+  TraceStream::get().start(path, flushIntervalMs, chunkRecords);
+  op_callback = at::addGlobalCallback(
+      at::RecordFunctionCallback(onOpEnter, onOpExit)
+          .scopes({at::RecordScope::FUNCTION, at::RecordScope::USER_SCOPE}));
+  setProfileOpen(true);
+}
+
+TraceStreamStats stopTraceStream() {
+  if (!traceStreamActive()) {
+    return TraceStreamStats{};
+  }
+  setProfileOpen(false);
+  at::removeCallback(op_callback);
+  // the device records left go through the stream as well
+  FlushAllRecords();
+  auto stats = TraceStream::get().stop();
+  abandonAllRecords();
+  return stats;
+}
+
+bool traceStreamActive() { return TraceStream::get().active(); }
+
+void streamRecord(const Record& record) { TraceStream::get().add(record); }
+
+void streamRecords(std::vector<Record> records) {
+  TraceStream::get().addChunk(std::move(records));
+}
+
+}  // namespace profile
+}  // namespace dipu
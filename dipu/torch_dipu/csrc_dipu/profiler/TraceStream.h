@@ -0,0 +1,41 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "profiler.h"
+
+namespace dipu {
+namespace profile {
+
+struct TraceStreamStats {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  uint64_t chunks = 0;
+};
+
+// Streams the torch ops, the DIOPI launches and the device records to `path`
+// as a perfetto trace (protobuf), without the Kineto profiler. The records
+// of each thread are handed to a writer thread every `flushIntervalMs` or
+// once `chunkRecords` of them are buffered, and the writer appends them to
+// the file as one chunk. As a perfetto trace is a sequence of packets, the
+// file is a valid trace after each chunk, and memory stays bounded by a few
+// chunks however long the trace runs: threads wait for the writer when it
+// falls behind. Device records are timed in batches on a background thread,
+// as with DIPU_PROFILER_BATCHED_TIMESTAMPS.
+void startTraceStream(const std::string& path, int64_t flushIntervalMs,
+                      size_t chunkRecords);
+// Writes the records left and closes the file
+TraceStreamStats stopTraceStream();
+
+bool traceStreamActive();
+
+// Called by RecordsImpl instead of keeping the records while streaming
+void streamRecord(const Record& record);
+void streamRecords(std::vector<Record> records);
+
+}  // namespace profile
+}  // namespace dipu
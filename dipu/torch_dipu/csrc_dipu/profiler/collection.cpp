@@ -22,6 +22,7 @@
 #include <torch/csrc/profiler/kineto_shim.h>
 #include <torch/csrc/profiler/orchestration/vulkan.h>
 
+#include "profiler.h"
 #include "profiler_python.h"
 
 namespace dipu {
@@ -563,11 +564,13 @@ void passEventsToKineto(const std::vector<std::shared_ptr<Result>>& results,
 
   // Generate Kineto events for each event recorded by the PyTorch profiler.
   constexpr time_t kNsPerUs = 1000;
+  const time_t offset = timeBaseOffset();
   for (const auto i : c10::irange(results.size())) {
     const auto& e = results[i];
     const auto* activity = cpu_trace.addCPUActivity(
         e->name(), e->kinetoType(), e->kineto_info_, e->correlationID(),
-        e->start_time_ns_ / kNsPerUs, e->endTimeNS() / kNsPerUs);
+        (e->start_time_ns_ + offset) / kNsPerUs,
+        (e->endTimeNS() + offset) / kNsPerUs);
 
     TORCH_INTERNAL_ASSERT(activity || !kKinetoAvailable);
     if (activity) {
@@ -1,22 +1,35 @@
 #include "profiler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <c10/util/Exception.h>
 #include <c10/util/string_view.h>
 #include <torch/csrc/profiler/util.h>
 
 #include "csrc_dipu/profiler/CorrelationIDManager.h"
+#include "csrc_dipu/utils/env.hpp"
 
 #include "ThreadUtil.h"
+#include "TraceStream.h"
 
 namespace dipu {
 
 namespace profile {
 
 static const int32_t DEFAULT_FLUSH_READY_INTERVAL = 1000;
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static RuntimeConfig<int32_t> gFlushReadyEventInterval(
+    "DIPU_FLUSH_READY_EVENT_INTERVAL", DEFAULT_FLUSH_READY_INTERVAL);
 
 class DeviceEvent final {
  private:
@@ -35,38 +48,269 @@ class DeviceEvent final {
   DeviceEvent& operator=(DeviceEvent&&) = default;
 };
 
+// Device times in milliseconds since the begin event, with the host times of
+// the clock samples, converted to host time in nanoseconds piecewise
+// linearly between the samples
+class ClockMap final {
+ public:
+  // (device ms, host ns) sorted by both
+  explicit ClockMap(std::vector<std::pair<double, size_t>> points)
+      : points_(std::move(points)) {}
+
+  size_t toHostNs(double deviceMs) const {
+    constexpr double kNanosecondPerMillisecond = 1e6;
+    if (points_.size() < 2) {
+      const size_t origin = points_.empty() ? 0 : points_.front().second;
+      return origin +
+             static_cast<size_t>(deviceMs * kNanosecondPerMillisecond);
+    }
+    // the segment of `deviceMs`, the first or last one beyond the samples
+    auto iter = std::upper_bound(
+        points_.begin() + 1, points_.end() - 1, deviceMs,
+        [](double ms, const auto& point) { return ms < point.first; });
+    const auto& [ms0, ns0] = *(iter - 1);
+    const auto& [ms1, ns1] = *iter;
+    const double slope =
+        ms1 > ms0 ? static_cast<double>(ns1 - ns0) / (ms1 - ms0)
+                  : kNanosecondPerMillisecond;
+    const double ns = static_cast<double>(ns0) + (deviceMs - ms0) * slope;
+    return ns > 0 ? static_cast<size_t>(ns) : 0;
+  }
+
+ private:
+  std::vector<std::pair<double, size_t>> points_;
+};
+
+// Interval of the clock samples, 0 keeps the begin and end ones only
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kClockSampleIntervalNs =
+    get_env_or_default("DIPU_PROFILER_CLOCK_SAMPLE_MS", size_t{100}) * 1000000;
+
+// Beyond which every other sample is dropped and the interval doubles
+constexpr size_t kMaxClockSamples = 1024;
+
+// Maps device times to the host clock. Besides the begin event, events are
+// recorded on an idle stream of the tracker at intervals along with the host
+// time, as the device clock drifts against the host one over long traces.
 class StreamTimeOffsetTracker final {
+  struct ClockSample {
+    size_t hostNs = 0;
+    // Released once timed into `deviceMs`
+    std::unique_ptr<DeviceEvent> event;
+    double deviceMs = 0;
+  };
+
   DeviceEvent begin_;
   deviceStream_t stream_;
   size_t beginOffset_;
-  float ratio_ = 0.F;
+  devapis::deviceId_t device_;
+  deviceStream_t clockStream_{};
+
+  std::mutex mtx_;
+  // Guarded by `mtx_`, in host time order
+  std::vector<ClockSample> samples_;
+  size_t interval_ = kClockSampleIntervalNs;
+  std::atomic<size_t> nextSampleNs_{0};
 
  public:
   explicit StreamTimeOffsetTracker(deviceStream_t stream)
-      : stream_(stream), beginOffset_(torch::profiler::impl::getTime()) {
+      : stream_(stream),
+        beginOffset_(torch::profiler::impl::getTime()),
+        device_(devproxy::current_device()) {
     devproxy::recordEvent(begin_.get(), stream_);
     devproxy::waitEvent(begin_.get());
+    if (interval_ > 0) {
+      devproxy::createStream(&clockStream_);
+      nextSampleNs_ = beginOffset_ + interval_;
+    }
   }
 
-  ~StreamTimeOffsetTracker() = default;
+  ~StreamTimeOffsetTracker() {
+    samples_.clear();
+    if (clockStream_ != nullptr) {
+      devproxy::destroyStream(clockStream_, device_);
+    }
+  }
 
-  void sync() {
-    DeviceEvent end;
-    float time = 0.F;
-    dipu::devproxy::recordEvent(end.get(), stream_);
-    dipu::devproxy::waitEvent(end.get());
-    dipu::devproxy::eventElapsedTime(&time, begin_.get(), end.get());
-    size_t endOffset = torch::profiler::impl::getTime();
-    ratio_ = static_cast<float>(endOffset - beginOffset_) / time;
+  StreamTimeOffsetTracker(const StreamTimeOffsetTracker&) = delete;
+  StreamTimeOffsetTracker& operator=(const StreamTimeOffsetTracker&) = delete;
+  StreamTimeOffsetTracker(StreamTimeOffsetTracker&&) = delete;
+  StreamTimeOffsetTracker& operator=(StreamTimeOffsetTracker&&) = delete;
+
+  // Called as device records are added, takes a sample once the interval is
+  // over. Nothing is on the clock stream, so its event is done about when
+  // it is recorded.
+  void maybeSample() {
+    const auto now = static_cast<size_t>(torch::profiler::impl::getTime());
+    if (clockStream_ == nullptr ||
+        now < nextSampleNs_.load(std::memory_order_relaxed) ||
+        devproxy::current_device() != device_) {
+      return;
+    }
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (now < nextSampleNs_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    for (auto& sample : samples_) {
+      timeWithoutLock(sample, false);
+    }
+    if (samples_.size() >= kMaxClockSamples) {
+      thinWithoutLock();
+    }
+    addSampleWithoutLock();
+    nextSampleNs_.store(samples_.back().hostNs + interval_,
+                        std::memory_order_relaxed);
+  }
+
+  // Takes a last sample and times all of them
+  ClockMap sync() {
+    std::lock_guard<std::mutex> lk(mtx_);
+    DIPUGuard guard(device_);
+    if (clockStream_ != nullptr) {
+      addSampleWithoutLock();
+      devproxy::waitEvent(samples_.back().event->get());
+    } else {
+      // on the stream of the ops, after they are done
+      auto event = std::make_unique<DeviceEvent>();
+      dipu::devproxy::recordEvent(event->get(), stream_);
+      dipu::devproxy::waitEvent(event->get());
+      samples_.push_back(
+          {static_cast<size_t>(torch::profiler::impl::getTime()),
+           std::move(event)});
+    }
+    std::vector<std::pair<double, size_t>> points{{0., beginOffset_}};
+    points.reserve(samples_.size() + 1);
+    for (auto& sample : samples_) {
+      timeWithoutLock(sample, true);
+      // a sample timed out of order, e.g. the end one, must not fold back
+      if (sample.deviceMs > points.back().first &&
+          sample.hostNs > points.back().second) {
+        points.emplace_back(sample.deviceMs, sample.hostNs);
+      }
+    }
+    if (clockStream_ == nullptr) {
+      // a fresh end pair each time, as before the drift correction
+      samples_.clear();
+    }
+    return ClockMap(std::move(points));
   }
 
   const DeviceEvent& begin() const { return begin_; }
 
-  size_t offset() const { return beginOffset_; }
+ private:
+  void addSampleWithoutLock() {
+    auto event = std::make_unique<DeviceEvent>();
+    const auto host = static_cast<size_t>(torch::profiler::impl::getTime());
+    dipu::devproxy::recordEvent(event->get(), clockStream_);
+    samples_.push_back({host, std::move(event)});
+  }
 
-  float ratio() const { return ratio_; }
+  void timeWithoutLock(ClockSample& sample, bool wait) {
+    if (!sample.event) {
+      return;
+    }
+    if (wait) {
+      dipu::devproxy::waitEvent(sample.event->get());
+    } else if (dipu::devproxy::getEventStatus(sample.event->get()) !=
+               devapis::EventStatus::READY) {
+      return;
+    }
+    float time = 0.F;
+    dipu::devproxy::eventElapsedTime(&time, begin_.get(), sample.event->get());
+    sample.deviceMs = time;
+    sample.event.reset();
+  }
+
+  // Keeps the first and every other sample, which bounds the samples and
+  // the events of a trace however long it runs
+  void thinWithoutLock() {
+    size_t kept = 1;
+    for (size_t i = 2; i < samples_.size(); i += 2) {
+      samples_[kept++] = std::move(samples_[i]);
+    }
+    samples_.resize(kept);
+    interval_ *= 2;
+  }
 };
 
+namespace {
+
+class NameTable final {
+ public:
+  uint32_t intern(std::string_view name) {
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+    thread_local std::unordered_map<std::string_view, uint32_t> cache;
+    auto iter = cache.find(name);
+    if (iter != cache.end()) {
+      return iter->second;
+    }
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto global = ids_.find(name);
+    uint32_t id = 0;
+    if (global == ids_.end()) {
+      id = static_cast<uint32_t>(names_.size());
+      names_.emplace_back(name);
+      ids_.emplace(names_.back(), id);
+    } else {
+      id = global->second;
+    }
+    // the deque never moves its strings, the views stay valid
+    cache.emplace(names_[id], id);
+    return id;
+  }
+
+  string_t name(uint32_t id) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return id < names_.size() ? names_[id] : string_t();
+  }
+
+  static NameTable& get() {
+    static NameTable instance;
+    return instance;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::deque<string_t> names_;
+  std::unordered_map<std::string_view, uint32_t> ids_;
+};
+
+// The id of "LaunchKernel_" + the name of `nameId`, the host side of a
+// device record
+uint32_t launchNameId(uint32_t nameId) {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+  thread_local std::vector<uint32_t> cache;
+  constexpr uint32_t kUnknown = static_cast<uint32_t>(-1);
+  if (nameId >= cache.size()) {
+    cache.resize(nameId + 1, kUnknown);
+  }
+  if (cache[nameId] == kUnknown) {
+    cache[nameId] = internName("LaunchKernel_" + internedName(nameId));
+  }
+  return cache[nameId];
+}
+
+// The end event of the last device record of the calling thread, shared
+// with the next record on its stream with kBatchedTimestamps
+struct EventBoundary {
+  deviceStream_t stream{};
+  size_t hostTimeNs = 0;
+  std::shared_ptr<DeviceEvent> event;
+};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+thread_local EventBoundary last_boundary;
+
+}  // namespace
+
+uint32_t internName(std::string_view name) {
+  return NameTable::get().intern(name);
+}
+
+string_t internedName(uint32_t nameId) {
+  return NameTable::get().name(nameId);
+}
+
 RecordsImpl& RecordsImpl::get() {
   static RecordsImpl instance;
   return instance;
@@ -78,20 +322,43 @@ void RecordsImpl::abandon() {
     kv.second->clear();
   }
   resourceInfo_.clear();
+  ++resourceGeneration_;
 }
 
 void RecordsImpl::addRecord(const Record& record) {
+  if (traceStreamActive()) {
+    streamRecord(record);
+    return;
+  }
   if (pRecords == nullptr) {
     std::lock_guard<mutex_t> lk(mtx_);
     int32_t tid = libkineto::systemThreadId();
-    allRecordLists_[tid] = std::make_unique<records_t>();
-    pRecords = allRecordLists_[tid].get();
+    auto& records = allRecordLists_[tid];
+    if (!records) {
+      records = std::make_unique<records_t>();
+    }
+    pRecords = records.get();
   }
   pRecords->emplace_back(record);
 }
 
 void RecordsImpl::recordStream(int device, int streamId,
                                const std::string& postfix) {
+  // the streams this thread reported since the last abandon()
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+  thread_local std::vector<std::pair<int, int>> reported;
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+  thread_local uint64_t reportedGeneration = 0;
+  const auto generation = resourceGeneration_.load(std::memory_order_relaxed);
+  if (reportedGeneration != generation) {
+    reported.clear();
+    reportedGeneration = generation;
+  }
+  const std::pair<int, int> key{device, streamId};
+  if (std::find(reported.begin(), reported.end(), key) != reported.end()) {
+    return;
+  }
+  reported.push_back(key);
   std::lock_guard<mutex_t> lck(mtx_);
   if (resourceInfo_.find({device, streamId}) == resourceInfo_.end()) {
     resourceInfo_.emplace(std::make_pair(device, streamId),
@@ -101,16 +368,17 @@ void RecordsImpl::recordStream(int device, int streamId,
   }
 }
 
-RecordsImpl::records_t RecordsImpl::getAllRecordList() const {
+std::vector<Record> RecordsImpl::getAllRecordList() const {
   std::lock_guard<mutex_t> lck(mtx_);
-  records_t allrecords;
+  std::vector<Record> allrecords;
   for (const auto& kv : allRecordLists_) {
     if (!kv.second || kv.second->empty()) {
       continue;
     }
 
-    for (const auto& r : *(kv.second)) {
-      allrecords.push_back(r);
+    const auto& records = *kv.second;
+    for (size_t i = 0; i < records.size(); ++i) {
+      allrecords.push_back(records[i]);
     }
   }
   return allrecords;
@@ -125,13 +393,149 @@ RecordsImpl::getResourceInfo() const {
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 thread_local RecordsImpl::records_t* RecordsImpl::pRecords = nullptr;
 
+// Share the events between adjacent ops on a stream and time the device
+// records on a background thread, for vendors without activity APIs. An op
+// starting within DIPU_PROFILER_SHARE_EVENT_WINDOW_US (host time) after the
+// previous one on its stream ended reuses that end event as its start, so
+// device idle time in between counts to it.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kBatchedTimestamps =
+    get_env_or_default("DIPU_PROFILER_BATCHED_TIMESTAMPS", 0) > 0;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kShareEventWindowNs =
+    get_env_or_default("DIPU_PROFILER_SHARE_EVENT_WINDOW_US", size_t{20}) *
+    1000;
+
+// Times batches of device records once their events are done, so that the
+// threads recording them never wait. The events are released as soon as a
+// batch is timed.
+class BatchedTimestampResolver final {
+ public:
+  // Offered each batch once timed, the records it doesn't take are kept for
+  // drain()
+  using Sink = std::function<bool(std::vector<Record>&)>;
+
+  explicit BatchedTimestampResolver(Sink sink)
+      : sink_(std::move(sink)), thread_([this] { loop(); }) {}
+
+  ~BatchedTimestampResolver() {
+    {
+      std::lock_guard<std::mutex> lk(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  BatchedTimestampResolver(const BatchedTimestampResolver&) = delete;
+  BatchedTimestampResolver& operator=(const BatchedTimestampResolver&) =
+      delete;
+  BatchedTimestampResolver(BatchedTimestampResolver&&) = delete;
+  BatchedTimestampResolver& operator=(BatchedTimestampResolver&&) = delete;
+
+  // `begin` is the event the times are relative to
+  void submit(std::vector<DeviceRecord> batch, deviceEvent_t begin) {
+    if (batch.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lk(mtx_);
+      batches_.emplace_back(std::move(batch), begin);
+    }
+    cv_.notify_all();
+  }
+
+  // Waits for the batches submitted so far and takes their records, in
+  // microseconds since the begin event
+  std::vector<Record> drain() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    cv_.wait(lk, [this] { return batches_.empty() && !resolving_; });
+    return std::move(resolved_);
+  }
+
+ private:
+  void loop() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (true) {
+      cv_.wait(lk, [this] { return stop_ || !batches_.empty(); });
+      if (batches_.empty()) {
+        return;
+      }
+      auto [batch, begin] = std::move(batches_.front());
+      batches_.pop_front();
+      resolving_ = true;
+      lk.unlock();
+      auto records = resolve(batch, begin);
+      // the events go back to the pool here
+      batch.clear();
+      const bool taken = sink_(records);
+      lk.lock();
+      if (!taken) {
+        resolved_.insert(resolved_.end(), records.begin(), records.end());
+      }
+      resolving_ = false;
+      cv_.notify_all();
+    }
+  }
+
+  static std::vector<Record> resolve(const std::vector<DeviceRecord>& batch,
+                                     deviceEvent_t begin) {
+    std::vector<Record> records;
+    records.reserve(batch.size());
+    constexpr double kMillisecondPerSecond = 1e3;
+    for (const auto& r : batch) {
+      devproxy::setDevice(static_cast<devapis::deviceId_t>(r.deviceId));
+      // the last event of a stream is usually done already
+      devproxy::waitEvent(r.stop->get());
+      devproxy::waitEvent(r.start->get());
+      float t1 = 0.F;
+      float t2 = 0.F;
+      devproxy::eventElapsedTime(&t1, begin, r.start->get());
+      devproxy::eventElapsedTime(&t2, begin, r.stop->get());
+      records.push_back(Record(
+          {r.nameId, r.opId, static_cast<size_t>(t1 * kMillisecondPerSecond),
+           static_cast<size_t>(t2 * kMillisecondPerSecond), r.deviceId,
+           r.streamId, true, r.linkCorrelationId}));
+    }
+    return records;
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  // Guarded by `mtx_`
+  std::deque<std::pair<std::vector<DeviceRecord>, deviceEvent_t>> batches_;
+  std::vector<Record> resolved_;
+  bool resolving_ = false;
+  bool stop_ = false;
+  const Sink sink_;
+  std::thread thread_;
+};
+
 class DeviceRecordsImpl final {
  private:
-  // mutex for records and tracker
+  // The device records of one thread, only touched by it until flush()
+  struct ThreadRecords {
+    RecordBuffer<DeviceRecord> pending;
+    // pending[0, resolved) are already timed in `ready`
+    size_t resolved = 0;
+    // Times in microseconds since the begin event of the tracker
+    RecordBuffer<Record> ready;
+    // Batched, the records not yet handed to the resolver
+    std::vector<DeviceRecord> batch;
+  };
+
+  // mutex for the thread list and tracker
   std::mutex mtx_;
-  std::list<DeviceRecord> records_;
-  std::vector<Record> ready_records_;
+  std::vector<std::unique_ptr<ThreadRecords>> threads_;
   std::unique_ptr<StreamTimeOffsetTracker> pTracker_;
+  // Started by the first batch, with kBatchedTimestamps or a trace stream
+  std::unique_ptr<BatchedTimestampResolver> pResolver_;
+  // Syncs the tracker, taken by the resolver thread without `mtx_`
+  std::mutex syncMtx_;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+  thread_local static ThreadRecords* pLocal;
 
   DeviceRecordsImpl() {}
 
@@ -145,11 +549,7 @@ class DeviceRecordsImpl final {
   }
 
   static int32_t flushReadyEventInterval() {
-    static int32_t flush_ready_event_interval = []() -> int32_t {
-      const char* str = std::getenv("DIPU_FLUSH_READY_EVENT_INTERVAL");
-      return str == nullptr ? DEFAULT_FLUSH_READY_INTERVAL : std::stoi(str);
-    }();
-    return flush_ready_event_interval;
+    return std::max(gFlushReadyEventInterval.get(), 1);
   }
 
   deviceEvent_t beginEvent() const {
@@ -157,44 +557,91 @@ class DeviceRecordsImpl final {
     return pTracker_->begin().get();
   }
 
-  size_t getTime(const DeviceEvent& evt, float scale = 1., size_t shift = 0) {
+  size_t getTime(const DeviceEvent& evt, const ClockMap& clock) {
     float time = 0.F;
     dipu::devproxy::waitEvent(evt.get());
     dipu::devproxy::eventElapsedTime(&time, beginEvent(), evt.get());
-    return static_cast<size_t>(time * scale) + shift;
+    return clock.toHostNs(time);
   }
 
- public:
-  ~DeviceRecordsImpl() { reset(); }
+  static bool batched() { return kBatchedTimestamps || traceStreamActive(); }
 
-  void ensureSetup(deviceStream_t stream) {
-    if (!pTracker_) {
-      std::lock_guard<std::mutex> lk(mtx_);
-      if (!pTracker_) {
-        pTracker_ = std::make_unique<StreamTimeOffsetTracker>(stream);
-      }
+  // Converts times in microseconds since the begin event of the tracker to
+  // host time in nanoseconds
+  static void toHostTime(Record& r, const ClockMap& clock) {
+    constexpr double kMillisecondPerMicrosecond = 1e-3;
+    r.begin = clock.toHostNs(static_cast<double>(r.begin) *
+                             kMillisecondPerMicrosecond);
+    r.end =
+        clock.toHostNs(static_cast<double>(r.end) * kMillisecondPerMicrosecond);
+  }
+
+  // Called by the resolver thread, streams the records it timed instead of
+  // keeping them until flush()
+  bool streamResolved(std::vector<Record>& records) {
+    if (!traceStreamActive()) {
+      return false;
     }
+    auto clock = [this] {
+      // reset() drains the resolver before it releases the tracker
+      std::lock_guard<std::mutex> lk(syncMtx_);
+      return pTracker_->sync();
+    }();
+    for (auto& r : records) {
+      toHostTime(r, clock);
+    }
+    streamRecords(std::move(records));
+    return true;
+  }
+
+  // Must be called with `mtx_` held
+  BatchedTimestampResolver& resolverWithoutLock() {
+    if (!pResolver_) {
+      pResolver_ = std::make_unique<BatchedTimestampResolver>(
+          [this](std::vector<Record>& records) {
+            return streamResolved(records);
+          });
+    }
+    return *pResolver_;
   }
 
-  void addDeviceRecord(const DeviceRecord& record) {
+  BatchedTimestampResolver& resolver() {
     std::lock_guard<std::mutex> lk(mtx_);
-    TORCH_CHECK(pTracker_, "dipu profiler error with pTracker is not inited");
-    records_.push_back(record);
-    if (enableFlushReadyEvent() &&
-        (records_.size() % flushReadyEventInterval() == 0)) {
-      flushReady();
+    return resolverWithoutLock();
+  }
+
+  // Must be called with `mtx_` held
+  void submitBatchesWithoutLock() {
+    resolverWithoutLock();
+    for (auto& records : threads_) {
+      pResolver_->submit(std::move(records->batch), beginEvent());
+      records->batch.clear();
     }
   }
 
-  void flushReady() {
-    while (!records_.empty()) {
-      auto& r = records_.front();
+  ThreadRecords& localRecords() {
+    if (pLocal == nullptr) {
+      std::lock_guard<std::mutex> lk(mtx_);
+      threads_.push_back(std::make_unique<ThreadRecords>());
+      pLocal = threads_.back().get();
+    }
+    return *pLocal;
+  }
+
+  // Times the records of `records` whose events are done, in order, and
+  // returns their events
+  void flushReady(ThreadRecords& records) {
+    if (dipu::devproxy::getEventStatus(beginEvent()) !=
+        devapis::EventStatus::READY) {
+      return;
+    }
+    auto& pending = records.pending;
+    for (; records.resolved < pending.size(); ++records.resolved) {
+      auto& r = pending[records.resolved];
       auto start_status = dipu::devproxy::getEventStatus(r.start->get());
       auto end_status = dipu::devproxy::getEventStatus(r.stop->get());
-      auto origin_status = dipu::devproxy::getEventStatus(beginEvent());
       if (start_status != devapis::EventStatus::READY ||
-          end_status != devapis::EventStatus::READY ||
-          origin_status != devapis::EventStatus::READY) {
+          end_status != devapis::EventStatus::READY) {
         break;
       }
       float t1 = 0.F;
@@ -202,49 +649,110 @@ class DeviceRecordsImpl final {
       constexpr double kMillisecondPerSecond = 1e3;
       dipu::devproxy::eventElapsedTime(&t1, beginEvent(), r.start->get());
       dipu::devproxy::eventElapsedTime(&t2, r.start->get(), r.stop->get());
-      ready_records_.push_back(Record(
-          {r.name, r.opId, static_cast<size_t>(t1 * kMillisecondPerSecond),
+      records.ready.emplace_back(Record(
+          {r.nameId, r.opId, static_cast<size_t>(t1 * kMillisecondPerSecond),
            static_cast<size_t>((t1 + t2) * kMillisecondPerSecond), r.deviceId,
            r.streamId, true, r.linkCorrelationId}));
-      records_.pop_front();
+      r = DeviceRecord{};
+    }
+    if (records.resolved == pending.size()) {
+      pending.clear();
+      records.resolved = 0;
+    }
+  }
+
+ public:
+  ~DeviceRecordsImpl() { reset(); }
+
+  void ensureSetup(deviceStream_t stream) {
+    if (!pTracker_) {
+      std::lock_guard<std::mutex> lk(mtx_);
+      if (!pTracker_) {
+        pTracker_ = std::make_unique<StreamTimeOffsetTracker>(stream);
+      }
+    }
+  }
+
+  void addDeviceRecord(DeviceRecord record) {
+    TORCH_CHECK(pTracker_, "dipu profiler error with pTracker is not inited");
+    pTracker_->maybeSample();
+    auto& records = localRecords();
+    if (batched()) {
+      const auto interval = static_cast<size_t>(flushReadyEventInterval());
+      records.batch.push_back(std::move(record));
+      if (records.batch.size() >= interval) {
+        resolver().submit(std::move(records.batch), beginEvent());
+        records.batch.clear();
+        records.batch.reserve(interval);
+      }
+      return;
+    }
+    records.pending.emplace_back(std::move(record));
+    if (enableFlushReadyEvent() &&
+        (records.pending.size() % flushReadyEventInterval() == 0)) {
+      flushReady(records);
     }
   }
 
   void flush() {
     std::lock_guard<std::mutex> lk(mtx_);
-    if (!records_.empty()) {
-      TORCH_CHECK(pTracker_, "dipu profiler error with pTracker is not inited");
-      auto& trakcer = *pTracker_;
-      trakcer.sync();
-      float ratio = trakcer.ratio();
-      size_t offset = trakcer.offset();
-
-      constexpr double kSecondPerMillisecond = 1e-3;
-      for (auto& r : ready_records_) {
-        r.begin = static_cast<size_t>(static_cast<double>(r.begin) *
-                                      kSecondPerMillisecond * ratio) +
-                  offset;
-        r.end = static_cast<size_t>(static_cast<double>(r.end) *
-                                    kSecondPerMillisecond * ratio) +
-                offset;
-        RecordsImpl::get().addRecord(r);
+    std::vector<Record> resolved;
+    if (batched() && pTracker_) {
+      submitBatchesWithoutLock();
+      resolved = pResolver_->drain();
+    }
+    const bool empty = std::all_of(
+        threads_.begin(), threads_.end(), [](const auto& records) {
+          return records->pending.empty() && records->ready.empty();
+        });
+    if (empty && resolved.empty()) {
+      return;
+    }
+    TORCH_CHECK(pTracker_, "dipu profiler error with pTracker is not inited");
+    auto clock = [this] {
+      std::lock_guard<std::mutex> syncLock(syncMtx_);
+      return pTracker_->sync();
+    }();
+
+    auto addReady = [&](Record r) {
+      toHostTime(r, clock);
+      RecordsImpl::get().addRecord(r);
+    };
+    for (const auto& r : resolved) {
+      addReady(r);
+    }
+    for (auto& records : threads_) {
+      for (size_t i = 0; i < records->ready.size(); ++i) {
+        addReady(records->ready[i]);
       }
-      ready_records_.clear();
+      records->ready.clear();
 
-      for (auto& r : records_) {
+      auto& pending = records->pending;
+      for (size_t i = records->resolved; i < pending.size(); ++i) {
+        auto& r = pending[i];
         RecordsImpl::get().addRecord(
-            Record({r.name, r.opId, getTime(*r.start, ratio, offset),
-                    getTime(*r.stop, ratio, offset), r.deviceId, r.streamId,
-                    true, r.linkCorrelationId}));
+            Record({r.nameId, r.opId, getTime(*r.start, clock),
+                    getTime(*r.stop, clock), r.deviceId, r.streamId, true,
+                    r.linkCorrelationId}));
       }
-      records_.clear();
+      pending.clear();
+      records->resolved = 0;
     }
   }
 
   void reset() {
     std::lock_guard<std::mutex> lck(mtx_);
-    records_.clear();
-    ready_records_.clear();
+    if (pResolver_) {
+      // the batches refer to the begin event of the tracker
+      pResolver_->drain();
+    }
+    // the threads keep their buffers
+    for (auto& records : threads_) {
+      records->batch.clear();
+      records->pending.clear();
+      records->resolved = 0;
+      records->ready.clear();
+    }
     pTracker_.reset();
   }
 
@@ -256,6 +764,10 @@ class DeviceRecordsImpl final {
   }
 };
 
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+thread_local DeviceRecordsImpl::ThreadRecords* DeviceRecordsImpl::pLocal =
+    nullptr;
+
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 bool gEnableFlag = false;
 
@@ -265,6 +777,18 @@ void setProfileOpen(bool profileFlag) { gEnableFlag = profileFlag; }
 
 void FlushAllRecords() { DeviceRecordsImpl::get().flush(); }
 
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int64_t> gTimeBaseOffsetNs{0};
+
+void setTimeBaseOffset(int64_t offsetNs) { gTimeBaseOffsetNs = offsetNs; }
+
+int64_t timeBaseOffset() { return gTimeBaseOffsetNs; }
+
+size_t toTimeBase(size_t hostNs) {
+  const auto shifted = static_cast<int64_t>(hostNs) + timeBaseOffset();
+  return shifted > 0 ? static_cast<size_t>(shifted) : 0;
+}
+
 constexpr size_t kInitModuleId = 10000;
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 std::atomic_size_t moduleId(kInitModuleId);
@@ -279,10 +803,10 @@ void abandonAllRecords() {
   resetId();
 }
 
-RecordCreator::RecordCreator(string_t name, size_t opId,
+RecordCreator::RecordCreator(uint32_t nameId, size_t opId,
                              uint64_t linkCorrelationId) {
   if (isEnable()) {
-    name_ = std::move(name);
+    nameId_ = nameId;
     opId_ = opId;
     begin_ = torch::profiler::impl::getTime();
     end_ = false;
@@ -293,7 +817,7 @@ RecordCreator::RecordCreator(string_t name, size_t opId,
 void RecordCreator::end() noexcept {
   if (!end_) {
     RecordsImpl::get().addRecord(
-        Record{name_, opId_, begin_,
+        Record{nameId_, opId_, begin_,
                static_cast<size_t>(torch::profiler::impl::getTime()),
                static_cast<size_t>(libkineto::processId()),
                static_cast<size_t>(libkineto::systemThreadId()), false,
@@ -302,18 +826,25 @@ void RecordCreator::end() noexcept {
   end_ = true;
 }
 
-DeviceRecordCreator::DeviceRecordCreator(string_t name, deviceStream_t stream,
+DeviceRecordCreator::DeviceRecordCreator(uint32_t nameId, deviceStream_t stream,
                                          int streamId, size_t opId,
                                          uint64_t linkCorrelationId) {
   if (isEnable()) {
     DeviceRecordsImpl::get().ensureSetup(stream);
-    name_ = std::move(name);
+    nameId_ = nameId;
     opId_ = opId;
     stream_ = stream;
     streamId_ = streamId;
-    pStart_.reset(new DeviceEvent());
-    pStop_.reset(new DeviceEvent());
-    dipu::devproxy::recordEvent(pStart_->get(), stream_);
+    auto& boundary = last_boundary;
+    if (kBatchedTimestamps && boundary.event && boundary.stream == stream &&
+        static_cast<size_t>(torch::profiler::impl::getTime()) <
+            boundary.hostTimeNs + kShareEventWindowNs) {
+      pStart_ = boundary.event;
+    } else {
+      pStart_ = std::make_shared<DeviceEvent>();
+      dipu::devproxy::recordEvent(pStart_->get(), stream_);
+    }
+    pStop_ = std::make_shared<DeviceEvent>();
     linkCorrelationId_ = linkCorrelationId;
     end_ = false;
   }
@@ -324,24 +855,29 @@ void DeviceRecordCreator::end() noexcept {
     TORCH_CHECK(pStart_, "dipu profiler error with pStart_ is not inited");
     TORCH_CHECK(pStop_, "dipu profiler error with pStop_ is not inited");
     dipu::devproxy::recordEvent(pStop_->get(), stream_);
+    if (kBatchedTimestamps) {
+      last_boundary = {stream_,
+                       static_cast<size_t>(torch::profiler::impl::getTime()),
+                       pStop_};
+    }
     auto deviceId = dipu::devproxy::current_device();
     DeviceRecordsImpl::get().addDeviceRecord(DeviceRecord{
-        pStart_, pStop_, static_cast<size_t>(deviceId),
-        static_cast<size_t>(streamId_), name_, opId_, linkCorrelationId_});
+        std::move(pStart_), std::move(pStop_), static_cast<size_t>(deviceId),
+        static_cast<size_t>(streamId_), nameId_, opId_, linkCorrelationId_});
     RecordsImpl::get().recordStream(deviceId, streamId_);
   }
   end_ = true;
 }
 
-void RecordBlockCreator::initialize(string_t name, deviceStream_t stream,
+void RecordBlockCreator::initialize(std::string_view name,
+                                    deviceStream_t stream,
                                     c10::StreamId streamId) {
   size_t opId = generateId();
   uint64_t correlationId = CorrelationIDManager::instance().getCorrelationID();
 
-  pHostRecord_ = std::make_unique<RecordCreator>("LaunchKernel_" + name, opId,
-                                                 correlationId);
-  pDeviceRecord_ = std::make_unique<DeviceRecordCreator>(
-      std::move(name), stream, streamId, opId, correlationId);
+  const auto nameId = internName(name);
+  pHostRecord_.emplace(launchNameId(nameId), opId, correlationId);
+  pDeviceRecord_.emplace(nameId, stream, streamId, opId, correlationId);
 }
 
 }  // namespace profile
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
-#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <c10/core/Stream.h>
 #include <c10/util/Optional.h>
@@ -18,6 +22,7 @@
 #include "csrc_dipu/vendor/vendorapi.h"
 
 #include "IActivityProfiler.h"
+#include "SamplingProfiler.h"
 
 namespace dipu {
 namespace profile {
@@ -38,31 +43,85 @@ void setProfileOpen(bool profileFlag);
 void FlushAllRecords();
 void abandonAllRecords();
 
+// Added to the host times of the exported traces, so that the traces of
+// several ranks share a common time base, see
+// torch_dipu.profiler.align_time_base
+void setTimeBaseOffset(int64_t offsetNs);
+int64_t timeBaseOffset();
+// `hostNs` shifted by timeBaseOffset()
+size_t toTimeBase(size_t hostNs);
+
+// Op names are interned, records keep their ids. Names seen before by the
+// calling thread are looked up without a lock.
+uint32_t internName(std::string_view name);
+string_t internedName(uint32_t nameId);
+
+// Records appended by one thread, in chunks that never move. Appending takes
+// no lock and only allocates when all chunks are full, clear() keeps them.
+template <typename T, size_t ChunkSize = 1024>
+class RecordBuffer final {
+ public:
+  template <class... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == chunks_.size() * ChunkSize) {
+      chunks_.push_back(std::make_unique<std::array<T, ChunkSize>>());
+    }
+    auto& slot = (*this)[size_];
+    slot = T{std::forward<Args>(args)...};
+    ++size_;
+    return slot;
+  }
+
+  T& operator[](size_t i) { return (*chunks_[i / ChunkSize])[i % ChunkSize]; }
+
+  const T& operator[](size_t i) const {
+    return (*chunks_[i / ChunkSize])[i % ChunkSize];
+  }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  // Resets the records so that they release what they hold
+  void clear() {
+    for (size_t i = 0; i < size_; ++i) {
+      (*this)[i] = T{};
+    }
+    size_ = 0;
+  }
+
+ private:
+  std::vector<std::unique_ptr<std::array<T, ChunkSize>>> chunks_;
+  size_t size_ = 0;
+};
+
 struct Record {
-  string_t name;
-  size_t opId;
+  uint32_t nameId = 0;
+  size_t opId = 0;
   // clock real time in nanosecond
-  size_t begin;
-  size_t end;
-  size_t pid;
-  size_t threadIdx;
+  size_t begin = 0;
+  size_t end = 0;
+  size_t pid = 0;
+  size_t threadIdx = 0;
   bool isKernel = false;
   uint64_t linkCorrelationId = 0;
 };
 
 class RecordsImpl final {
  private:
-  using records_t = std::list<Record>;
+  using records_t = RecordBuffer<Record>;
   using mutex_t = std::mutex;
 
   mutable mutex_t mtx_;
-  // tid -> record list
+  // tid -> record list, each only appended by its thread
   std::unordered_map<int32_t, std::unique_ptr<records_t>> allRecordLists_;
 
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
   thread_local static records_t* pRecords;
 
   std::map<std::pair<int64_t, int64_t>, libkineto::ResourceInfo> resourceInfo_;
+  // Bumped by abandon(), so that threads report their streams again
+  std::atomic<uint64_t> resourceGeneration_{0};
 
   RecordsImpl() = default;
 
@@ -74,14 +133,14 @@ class RecordsImpl final {
   void recordStream(int device, int streamId, const std::string& postfix = "");
   void abandon();
 
-  records_t getAllRecordList() const;
+  std::vector<Record> getAllRecordList() const;
   std::map<std::pair<int64_t, int64_t>, libkineto::ResourceInfo>
   getResourceInfo() const;
 };
 
 class RecordCreator final {
  private:
-  string_t name_;
+  uint32_t nameId_{};
   size_t opId_{};
   size_t begin_{};
   bool end_ = true;
@@ -89,7 +148,7 @@ class RecordCreator final {
 
  public:
   RecordCreator() = default;
-  RecordCreator(string_t name, size_t opId, uint64_t linkCorrelationId);
+  RecordCreator(uint32_t nameId, size_t opId, uint64_t linkCorrelationId);
 
   ~RecordCreator() { end(); }
 
@@ -101,16 +160,16 @@ class DeviceEvent;
 
 struct DeviceRecord {
   std::shared_ptr<DeviceEvent> start, stop;
-  size_t deviceId;
-  size_t streamId;
-  string_t name;
-  size_t opId;
+  size_t deviceId = 0;
+  size_t streamId = 0;
+  uint32_t nameId = 0;
+  size_t opId = 0;
   uint64_t linkCorrelationId = 0;
 };
 
 class DeviceRecordCreator final {
  private:
-  string_t name_;
+  uint32_t nameId_{};
   size_t opId_{};
   deviceStream_t stream_{};
   int streamId_{};
@@ -120,7 +179,7 @@ class DeviceRecordCreator final {
 
  public:
   DeviceRecordCreator() = default;
-  DeviceRecordCreator(string_t name, deviceStream_t stream, int streamId,
+  DeviceRecordCreator(uint32_t nameId, deviceStream_t stream, int streamId,
                       size_t opId, uint64_t linkCorrelationId);
 
   ~DeviceRecordCreator() { end(); }
@@ -138,7 +197,8 @@ class RecordBlockCreator {
       c10::optional<deviceStream_t> stream = c10::nullopt,
       c10::optional<c10::StreamId> streamId = c10::nullopt,
       c10::optional<bool> enProfile = c10::nullopt) {
-    if (enProfile.value_or(isEnable())) {
+    const bool profiled = enProfile.value_or(isEnable());
+    if (profiled || (!enProfile && sampleOp())) {
       if (!stream) {
         auto dipu_stream = getCurrentDIPUStream();
         if (!streamId) {
@@ -146,7 +206,12 @@ class RecordBlockCreator {
         }
         stream = dipu_stream.rawstream();
       }
-      initialize(string_t{name}, *stream, *streamId);
+      const std::string_view view(name.data(), name.size());
+      if (profiled) {
+        initialize(view, *stream, *streamId);
+      } else {
+        pSampledRecord_.emplace(internName(view), *stream);
+      }
     }
   }
 
@@ -154,6 +219,7 @@ class RecordBlockCreator {
     if (!finish_) {
       pHostRecord_.reset();
       pDeviceRecord_.reset();
+      pSampledRecord_.reset();
       finish_ = true;
     }
   }
@@ -161,10 +227,14 @@ class RecordBlockCreator {
   ~RecordBlockCreator() { end(); }
 
  private:
-  void initialize(string_t name, deviceStream_t stream, c10::StreamId streamId);
-
-  std::unique_ptr<RecordCreator> pHostRecord_ = nullptr;
-  std::unique_ptr<DeviceRecordCreator> pDeviceRecord_ = nullptr;
+  void initialize(std::string_view name, deviceStream_t stream,
+                  c10::StreamId streamId);
+
+  // Inline, the records allocate nothing per op
+  c10::optional<RecordCreator> pHostRecord_;
+  c10::optional<DeviceRecordCreator> pDeviceRecord_;
+  // Set instead of the two above for ops picked by the sampling profiler
+  c10::optional<SampledRecord> pSampledRecord_;
   bool finish_ = false;
 };
 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <string>
 #include <utility>
@@ -669,8 +670,28 @@ struct ThreadLocalResults {
   CallTypeHelper<TraceKeyCacheState>::tuple_type trace_keys_;
   AppendOnlyList<approx_time_t, BLOCK_SIZE> exit_times_;
   AppendOnlyList<approx_time_t, BLOCK_SIZE> c_exit_times_;
+
+  // Whether each open call was filtered out, so that its exit is dropped as
+  // well. Empty while no filter is set.
+  std::vector<bool> skipped_calls_;
+  std::vector<bool> skipped_c_calls_;
 };
 
+// Pops the call being exited, true if it was filtered out
+bool popSkipped(std::vector<bool>& skipped_calls) {
+  if (skipped_calls.empty()) {
+    return false;
+  }
+  const bool skipped = skipped_calls.back();
+  skipped_calls.pop_back();
+  return skipped;
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::mutex gSkipPrefixesMutex;
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::vector<std::string> gSkipPrefixes;
+
 // ============================================================================
 // == Tracing implementation ==================================================
 // ============================================================================
@@ -699,6 +720,10 @@ class DIPUPythonTracer final : public PythonTracerBase {
   void recordCCall(ThreadLocalResults& tls, PyFrameObject* frame,
                    PyObject* arg);
 
+  // Whether frames of `code` are left out of the trace, cached per code object
+  // as the filename match is too slow to repeat on every call
+  bool skipped(PyCodeObject* code);
+
   std::vector<PyThreadState*> interpreterThreads() const;
 
   std::atomic<bool> active_lock_{false};
@@ -712,6 +737,9 @@ class DIPUPythonTracer final : public PythonTracerBase {
   std::vector<StartFrame> start_frames_;
   std::deque<ThreadLocalResults> thread_local_results_;
   ValueCache value_cache_;
+
+  std::vector<std::string> skip_prefixes_;
+  ska::flat_hash_map<PyCodeObject*, bool> skipped_codes_;
 };
 
 std::vector<PyThreadState*> DIPUPythonTracer::interpreterThreads() const {
@@ -732,6 +760,10 @@ DIPUPythonTracer::DIPUPythonTracer(DIPURecordQueue* queue)
       module_call_code_(getCode<CallType::PyModuleCall>()),
       optimizer_hook_(getCode<CallType::PyOptimizerCall>()) {
   TORCH_CHECK(queue_ != nullptr);
+  {
+    std::lock_guard<std::mutex> lock(gSkipPrefixesMutex);
+    skip_prefixes_ = gSkipPrefixes;
+  }
 
   bool expected{false};
   active_ = active_lock_.compare_exchange_strong(expected, true);
@@ -821,8 +853,15 @@ void DIPUPythonTracer::recordPyCall(ThreadLocalResults& tls,
                                     PyFrameObject* frame,
                                     bool is_startup_frame) {
   static constexpr auto E = EventType::PyCall;
+  auto code = THPCodeObjectPtr(PyFrame_GetCode(frame));
+  if (!skip_prefixes_.empty()) {
+    const bool skip = skipped(code.get());
+    tls.skipped_calls_.push_back(skip);
+    if (skip) {
+      return;
+    }
+  }
   const auto key = [&]() -> TraceKey {
-    auto code = THPCodeObjectPtr(PyFrame_GetCode(frame));
     if (code.get() == module_call_code_) {
       // By default, CPython stores locals in a "fast" format, with an array
       // of names and an array of values. Consequently, frame->f_locals is
@@ -865,6 +904,13 @@ void DIPUPythonTracer::recordCCall(ThreadLocalResults& tls,
                                    PyFrameObject* frame, PyObject* arg) {
   TORCH_INTERNAL_ASSERT_DEBUG_ONLY(Py_TYPE(arg) == &PyCFunction_Type);
   auto fn = reinterpret_cast<PyCFunctionObject*>(arg);
+  if (!skip_prefixes_.empty()) {
+    const bool skip = skipped(THPCodeObjectPtr(PyFrame_GetCode(frame)).get());
+    tls.skipped_c_calls_.push_back(skip);
+    if (skip) {
+      return;
+    }
+  }
 
   // NB: For C calls a new frame is not created, so we use `frame` rather than
   //     `frame->f_back`.
@@ -873,6 +919,27 @@ void DIPUPythonTracer::recordCCall(ThreadLocalResults& tls,
   queue_->getSubqueue()->emplace_py_call(key, getApproximateTime());
 }
 
+bool DIPUPythonTracer::skipped(PyCodeObject* code) {
+  auto it = skipped_codes_.find(code);
+  if (it != skipped_codes_.end()) {
+    return it->second;
+  }
+  // nn.Module and optimizer calls live in torch/ but make up the module
+  // hierarchy of the trace, so they are always kept.
+  bool skip = false;
+  if (code != module_call_code_ && code != optimizer_hook_) {
+    const auto filename = THPUtils_unpackStringView(code->co_filename);
+    for (const auto& prefix : skip_prefixes_) {
+      if (filename.compare(0, prefix.size(), prefix) == 0) {
+        skip = true;
+        break;
+      }
+    }
+  }
+  skipped_codes_.emplace(code, skip);
+  return skip;
+}
+
 // ============================================================================
 // == Post processing =========================================================
 // ============================================================================
@@ -1070,12 +1137,16 @@ int DIPUPythonTracer::pyProfileFn(PyObject* obj, PyFrameObject* frame, int what,
 
     case PyTrace_EXCEPTION:
     case PyTrace_RETURN:
-      local_results.exit_times_.emplace_back(getApproximateTime());
+      if (!popSkipped(local_results.skipped_calls_)) {
+        local_results.exit_times_.emplace_back(getApproximateTime());
+      }
       break;
 
     case PyTrace_C_EXCEPTION:
     case PyTrace_C_RETURN:
-      local_results.c_exit_times_.emplace_back(getApproximateTime());
+      if (!popSkipped(local_results.skipped_c_calls_)) {
+        local_results.c_exit_times_.emplace_back(getApproximateTime());
+      }
       break;
   }
   return 0;
@@ -1086,6 +1157,16 @@ std::unique_ptr<PythonTracerBase> makeTracer(DIPURecordQueue* queue) {
   return std::make_unique<DIPUPythonTracer>(queue);
 }
 
+void setPythonTracerSkipPrefixes(const std::vector<std::string>& prefixes) {
+  std::lock_guard<std::mutex> lock(gSkipPrefixesMutex);
+  gSkipPrefixes = prefixes;
+}
+
+std::vector<std::string> pythonTracerSkipPrefixes() {
+  std::lock_guard<std::mutex> lock(gSkipPrefixesMutex);
+  return gSkipPrefixes;
+}
+
 void init() {
   pybind11::gil_scoped_acquire gil;
   TORCH_CHECK(PyType_Ready(&TraceContextType) == 0);
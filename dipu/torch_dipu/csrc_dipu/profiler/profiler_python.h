@@ -1,6 +1,8 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <torch/csrc/profiler/orchestration/python_tracer.h>
 
@@ -11,6 +13,12 @@ class DIPURecordQueue;
 std::unique_ptr<torch::profiler::impl::python_tracer::PythonTracerBase>
 makeTracer(DIPURecordQueue* queue);
 
+// Frames of code whose filename starts with one of `prefixes` are left out of
+// the stacks of the next Python traces, e.g. those of torch/ and the stdlib.
+// Empty, the default, records every frame.
+void setPythonTracerSkipPrefixes(const std::vector<std::string>& prefixes);
+std::vector<std::string> pythonTracerSkipPrefixes();
+
 void init();
 
 }  // namespace profile
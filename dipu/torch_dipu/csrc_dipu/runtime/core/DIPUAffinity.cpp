@@ -0,0 +1,105 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUAffinity.h"
+
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/Log.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// Threads working for one device, such as the pin memory thread of the
+// DataLoader and the DICL watchdog, run next to it on multi-socket hosts.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kBindThreadAffinity =
+    get_env_or_default("DIPU_BIND_THREAD_AFFINITY", 0) > 0;
+
+// CPUs of NUMA `node` as listed by sysfs, e.g. "0-15,32-47", empty if unknown
+std::vector<int> nodeCpus(int node) {
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+  std::string list;
+  std::vector<int> cpus;
+  if (!std::getline(file, list)) {
+    return cpus;
+  }
+  std::istringstream stream(list);
+  std::string range;
+  try {
+    while (std::getline(stream, range, ',')) {
+      const auto dash = range.find('-');
+      const int first = std::stoi(range.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+  } catch (const std::exception&) {
+    cpus.clear();
+  }
+  return cpus;
+}
+
+}  // namespace
+
+int getDeviceNumaNodeFromCache(c10::DeviceIndex device_index) {
+  static const std::vector<int> nodes = [] {
+    std::vector<int> result(devproxy::getDeviceCount());
+    for (size_t i = 0; i < result.size(); ++i) {
+      result[i] = devproxy::getDeviceNumaNode(static_cast<devapis::deviceId_t>(i));
+    }
+    return result;
+  }();
+  if (device_index < 0 || static_cast<size_t>(device_index) >= nodes.size()) {
+    return -1;
+  }
+  return nodes[device_index];
+}
+
+bool bindCurrentThreadToDevice(c10::DeviceIndex device_index) {
+  if (!kBindThreadAffinity) {
+    return false;
+  }
+  const int node = getDeviceNumaNodeFromCache(device_index);
+  if (node < 0) {
+    return false;
+  }
+  // Only CPUs the process may already run on, e.g. under taskset or cgroups
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return false;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int cpu : nodeCpus(node)) {
+    if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  if (CPU_COUNT(&cpus) == 0) {
+    return false;
+  }
+  const int result =
+      pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (result != 0) {
+    DIPU_LOG_ERROR << "failed to bind thread to NUMA node " << node
+                   << " of device " << static_cast<int>(device_index)
+                   << ", error " << result << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace dipu
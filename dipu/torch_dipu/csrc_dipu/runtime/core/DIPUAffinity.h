@@ -0,0 +1,18 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <c10/core/Device.h>
+
+#include "csrc_dipu/base/basedef.h"
+
+namespace dipu {
+
+// NUMA node the device is attached to, -1 if unknown. Cached after the first
+// call.
+DIPU_API int getDeviceNumaNodeFromCache(c10::DeviceIndex device_index);
+
+// Restrict the calling thread to the CPUs of the NUMA node of the device, if
+// DIPU_BIND_THREAD_AFFINITY is set. Returns whether the thread was bound.
+DIPU_API bool bindCurrentThreadToDevice(c10::DeviceIndex device_index);
+
+}  // namespace dipu
@@ -0,0 +1,180 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUAsyncErrorCheck.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+#include "DIPUHostCallback.h"
+#include "DIPUStream.h"
+
+namespace dipu {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kAsyncErrorCheck =
+    get_env_or_default("DIPU_ASYNC_ERROR_CHECK", 0) > 0;
+
+// Ops remembered per stream, older ones are only counted
+constexpr uint32_t kMarkerRingSize = 1024;
+// Ops listed after the first unfinished one
+constexpr uint32_t kMaxListedOps = 8;
+
+uint32_t loadWord(const uint32_t* word) {
+  return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+void storeWord(uint32_t* word, uint32_t value) {
+  __atomic_store_n(word, value, __ATOMIC_RELEASE);
+}
+
+// Sequence numbers start at 1 and wrap around, only differences matter
+class StreamMarkers {
+ public:
+  StreamMarkers() {
+    void* word = nullptr;
+    devproxy::mallocHost(&word, sizeof(uint32_t));
+    completed_ = static_cast<uint32_t*>(word);
+    storeWord(completed_, 0);
+  }
+
+  StreamMarkers(const StreamMarkers&) = delete;
+  StreamMarkers(StreamMarkers&&) = delete;
+  StreamMarkers& operator=(const StreamMarkers&) = delete;
+  StreamMarkers& operator=(StreamMarkers&&) = delete;
+
+  // The word is never freed, the device may still write to it at exit
+  ~StreamMarkers() = default;
+
+  void record(const DIPUStream& stream, const char* op) {
+    std::lock_guard<std::mutex> _(mutex_);
+    const auto seq = issued_ + 1;
+    ops_[seq % kMarkerRingSize] = op;
+    issued_ = seq;
+    // The device writes the word itself if it can, otherwise a host function
+    // does it, which is slower but still doesn't block the caller
+    if (!write_value_unsupported_) {
+      if (devproxy::streamWriteValue32(stream.rawstream(), completed_, seq)) {
+        return;
+      }
+      write_value_unsupported_ = true;
+    }
+    launchHostCallback(stream, [word = completed_, seq] {
+      storeWord(word, seq);
+    });
+  }
+
+  // Empty if the device has reached all markers
+  std::string describe() {
+    std::lock_guard<std::mutex> _(mutex_);
+    const auto completed = loadWord(completed_);
+    const auto in_flight = issued_ - completed;
+    if (in_flight == 0) {
+      return {};
+    }
+    std::ostringstream stream;
+    stream << in_flight << " ops in flight";
+    if (in_flight > kMarkerRingSize) {
+      stream << ", the first unfinished one is too old to be remembered";
+      return stream.str();
+    }
+    stream << ", the first unfinished one is "
+           << ops_[(completed + 1) % kMarkerRingSize];
+    const auto listed = std::min(in_flight - 1, kMaxListedOps);
+    if (listed > 0) {
+      stream << ", followed by";
+      for (uint32_t i = 2; i <= listed + 1; ++i) {
+        stream << " " << ops_[(completed + i) % kMarkerRingSize];
+      }
+      if (in_flight - 1 > listed) {
+        stream << " ...";
+      }
+    }
+    return stream.str();
+  }
+
+ private:
+  std::mutex mutex_;
+  // Written by the device or a host function, read by any thread
+  uint32_t* completed_ = nullptr;
+  // Guarded by `mutex_`
+  uint32_t issued_ = 0;
+  bool write_value_unsupported_ = false;
+  std::array<const char*, kMarkerRingSize> ops_{};
+};
+
+class MarkerRegistry {
+ public:
+  StreamMarkers& markers(deviceStream_t stream) {
+    std::lock_guard<std::mutex> _(mutex_);
+    auto& markers = markers_[stream];
+    if (!markers) {
+      markers = std::make_unique<StreamMarkers>();
+    }
+    return *markers;
+  }
+
+  std::string describe() {
+    std::lock_guard<std::mutex> _(mutex_);
+    std::ostringstream stream;
+    for (auto& [raw, markers] : markers_) {
+      auto description = markers->describe();
+      if (!description.empty()) {
+        stream << "stream " << raw << ": " << description << "\n";
+      }
+    }
+    return stream.str();
+  }
+
+ private:
+  std::mutex mutex_;
+  // Guarded by `mutex_`, entries are never erased
+  std::unordered_map<deviceStream_t, std::unique_ptr<StreamMarkers>> markers_;
+};
+
+MarkerRegistry& markerRegistry() {
+  // Leaked, markers may be recorded by threads alive at exit
+  static auto* registry = new MarkerRegistry();
+  return *registry;
+}
+
+}  // namespace
+
+bool asyncErrorCheckEnabled() { return kAsyncErrorCheck; }
+
+void recordOpMarker(const char* op) {
+  auto stream = getCurrentDIPUStream();
+  auto raw = stream.rawstream();
+  // Markers in a graph would be replayed with stale sequence numbers
+  if (devproxy::isStreamCapturing(raw)) {
+    return;
+  }
+  thread_local deviceStream_t cached_stream = nullptr;
+  thread_local StreamMarkers* cached_markers = nullptr;
+  if (cached_markers == nullptr || cached_stream != raw) {
+    cached_markers = &markerRegistry().markers(raw);
+    cached_stream = raw;
+  }
+  cached_markers->record(stream, op);
+}
+
+std::string describeUnfinishedOps() {
+  if (!kAsyncErrorCheck) {
+    return {};
+  }
+  auto description = markerRegistry().describe();
+  if (description.empty()) {
+    return "async error check: all recorded ops finished";
+  }
+  return "async error check, unfinished ops:\n" + description;
+}
+
+}  // namespace dipu
@@ -0,0 +1,23 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <string>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+namespace dipu {
+
+// Whether DIPU_ASYNC_ERROR_CHECK is set. In this mode every wrapper leaves a
+// marker on its stream, so that a device error reported by a later sync can
+// be attributed to an op without synchronizing after each of them.
+DIPU_API bool asyncErrorCheckEnabled();
+
+// Marks the end of `op` on the current stream. `op` must be a string literal
+// or otherwise outlive the process.
+DIPU_API void recordOpMarker(const char* op);
+
+// The ops whose markers the device has not reached yet, per stream, the first
+// of them is most likely the one that failed
+DIPU_API std::string describeUnfinishedOps();
+
+}  // namespace dipu
@@ -20,8 +20,8 @@ class DIPU_API DIPUEvent {
   // Default value for `flags` is specified below
   DIPUEvent() = default;
 
-  // add flags in future
-  // DIPUEvent(unsigned int flags) : flags_{flags} {}
+  // Events only used to order streams should pass DISABLE_TIMING
+  explicit DIPUEvent(devapis::EventFlags flags) : flags_{flags} {}
 
   // dipu do not support IpcEventHandle until now
 
@@ -29,7 +29,7 @@ class DIPU_API DIPUEvent {
     try {
       if (isCreated()) {
         DIPUGuard guard(device_index_);
-        devproxy::destroyEvent(event_);
+        devproxy::destroyEvent(event_, flags_);
       }
     } catch (...) { /* No throw */
     }
@@ -38,8 +38,14 @@ class DIPU_API DIPUEvent {
   DIPUEvent(const DIPUEvent&) = delete;
   DIPUEvent& operator=(const DIPUEvent&) = delete;
 
-  DIPUEvent(DIPUEvent&& other) noexcept = default;
-  DIPUEvent& operator=(DIPUEvent&& other) noexcept = default;
+  DIPUEvent(DIPUEvent&& other) noexcept { moveHelper(std::move(other)); }
+
+  DIPUEvent& operator=(DIPUEvent&& other) noexcept {
+    if (this != &other) {
+      moveHelper(std::move(other));
+    }
+    return *this;
+  }
 
   explicit operator deviceEvent_t() const { return rawevent(); }
 
@@ -96,6 +102,10 @@ class DIPU_API DIPUEvent {
     TORCH_CHECK(
         isCreated() && other.isCreated(),
         "Both events must be recorded before calculating elapsed time.");
+    TORCH_CHECK(flags_ != devapis::EventFlags::DISABLE_TIMING &&
+                    other.flags_ != devapis::EventFlags::DISABLE_TIMING,
+                "Both events must be created with timing enabled to "
+                "calculate elapsed time.");
     float time_ms = 0;
     devproxy::eventElapsedTime(&time_ms, event_, other.event_);
     return time_ms;
@@ -110,7 +120,7 @@ class DIPU_API DIPUEvent {
   // dipu do not support IpcEventHandle until now
 
  private:
-  unsigned int flags_ = 0;
+  devapis::EventFlags flags_ = devapis::EventFlags::DEFAULT;
   bool was_recorded_ = false;
   c10::DeviceIndex device_index_ = -1;
   deviceEvent_t event_ = nullptr;
@@ -118,7 +128,15 @@ class DIPU_API DIPUEvent {
   void createEvent(c10::DeviceIndex device_index) {
     device_index_ = device_index;
     DIPUGuard guard(device_index_);
-    devproxy::createEvent(&event_);
+    devproxy::createEvent(&event_, flags_);
+  }
+
+  // Take over the event of `other`, so that it is destroyed only once
+  void moveHelper(DIPUEvent&& other) {
+    std::swap(flags_, other.flags_);
+    std::swap(was_recorded_, other.was_recorded_);
+    std::swap(device_index_, other.device_index_);
+    std::swap(event_, other.event_);
   }
 };
 
@@ -1,27 +1,118 @@
 #include "DIPUEventPool.h"
 
-#include <deque>
-#include <functional>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <utility>
+#include <vector>
+
+#include <c10/util/Exception.h>
+
+#include "csrc_dipu/runtime/core/allocator/DIPUSpinMutex.h"
+#include "csrc_dipu/utils/env.hpp"
+
+#include "DIPUGuard.h"
 
 namespace dipu {
 
-template <typename T>
+namespace {
+
+// Number of events created at once, both when a device is first used and
+// whenever its pool runs out. Event creation is slow on some vendors.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kEventPoolBatchSize = std::max<size_t>(
+    get_env_or_default("DIPU_EVENT_POOL_BATCH_SIZE", size_t{16}), 1);
+
+constexpr size_t kNumEventFlags = 2;
+
+void createRawEvent(deviceEvent_t* event, devapis::EventFlags flags) {
+  using create_fn_t = void (*)(deviceEvent_t*, devapis::EventFlags);
+  auto create_with_flags = static_cast<create_fn_t>(&devapis::createEvent);
+  if (flags != devapis::EventFlags::DEFAULT && create_with_flags != nullptr) {
+    create_with_flags(event, flags);
+  } else {
+    devapis::createEvent(event);
+  }
+}
+
+// Events of a single device and flags. Each thread keeps a cache of up to two
+// batches, so getting and restoring events rarely touches the shared list.
 class EventPool final {
- protected:
-  std::deque<T> event_pool_;
-  unsigned int allocate_num_ = 0;
+  using mutex_t = SpinMutex;
+
+  struct ThreadCache {
+    // Only contended when the pool takes events back from the cache
+    mutex_t mut;
+    // Set when the owner thread exits, its events are reclaimed later
+    std::atomic<bool> orphaned{false};
+    std::vector<deviceEvent_t> events;
+  };
+
+  using ThreadCacheHandle = std::shared_ptr<ThreadCache>;
+
+  struct ThreadCacheHolder {
+    std::vector<std::pair<const EventPool*, ThreadCacheHandle>> caches;
+
+    ~ThreadCacheHolder() {
+      for (auto& item : caches) {
+        item.second->orphaned.store(true, std::memory_order_release);
+      }
+    }
+  };
+
+  c10::DeviceIndex device_;
+  devapis::EventFlags flags_;
+  std::once_flag init_flag_;
+  mutex_t mut_;
+  // Guarded by `mut_`
+  std::vector<deviceEvent_t> events_;
+  std::vector<ThreadCacheHandle> caches_;
+
+  ThreadCache& localCache() {
+    static thread_local ThreadCacheHolder holder;
+    for (auto& item : holder.caches) {
+      if (item.first == this) {
+        return *item.second;
+      }
+    }
+    auto cache = std::make_shared<ThreadCache>();
+    {
+      std::lock_guard<mutex_t> _(mut_);
+      caches_.push_back(cache);
+    }
+    holder.caches.emplace_back(this, cache);
+    return *cache;
+  }
+
+  // Take the events of exited threads, with `mut_` held
+  void reclaimOrphanedCaches() {
+    auto orphaned = [](const ThreadCacheHandle& cache) {
+      return cache->orphaned.load(std::memory_order_acquire);
+    };
+    for (auto& cache : caches_) {
+      if (orphaned(cache)) {
+        std::lock_guard<mutex_t> _(cache->mut);
+        events_.insert(events_.end(), cache->events.begin(),
+                       cache->events.end());
+        cache->events.clear();
+      }
+    }
+    caches_.erase(std::remove_if(caches_.begin(), caches_.end(), orphaned),
+                  caches_.end());
+  }
 
-  std::function<void(T&)> allocator_;
-  std::function<void(T&)> deleter_;
-  using mutex_t = std::recursive_mutex;
-  mutex_t event_mutex_;
+  void createEvents(std::vector<deviceEvent_t>& events, size_t num) const {
+    for (size_t i = 0; i < num; ++i) {
+      deviceEvent_t event{};
+      createRawEvent(&event, flags_);
+      events.push_back(event);
+    }
+  }
 
  public:
-  EventPool(const std::function<void(T&)>& allocator,
-            const std::function<void(T&)>& deleter)
-      : allocator_(allocator), deleter_(deleter) {}
+  EventPool(c10::DeviceIndex device, devapis::EventFlags flags)
+      : device_(device), flags_(flags) {}
 
   EventPool(const EventPool&) = delete;
   EventPool(EventPool&&) = delete;
@@ -30,73 +121,131 @@ class EventPool final {
 
   ~EventPool() = default;
 
+  // Prefill the pool when the device is first used, it must be current
+  void init() {
+    std::call_once(init_flag_, [this] {
+      std::vector<deviceEvent_t> events;
+      createEvents(events, kEventPoolBatchSize);
+      std::lock_guard<mutex_t> _(mut_);
+      events_.insert(events_.end(), events.begin(), events.end());
+    });
+  }
+
   void release() {
-    std::lock_guard<mutex_t> _(event_mutex_);
-    for (auto& event : event_pool_) {
-      deleter_(event);
-      allocate_num_--;
+    std::lock_guard<mutex_t> _(mut_);
+    for (auto& cache : caches_) {
+      std::lock_guard<mutex_t> cache_lock(cache->mut);
+      events_.insert(events_.end(), cache->events.begin(),
+                     cache->events.end());
+      cache->events.clear();
+    }
+    if (!events_.empty()) {
+      DIPUGuard guard(device_);
+      for (auto& event : events_) {
+        devapis::destroyEvent(event);
+      }
+      events_.clear();
     }
-    event_pool_.clear();
   }
 
-  void get(T& event) {
-    bool need_allocator = false;
+  // Lock order is `mut_` before the thread caches, so the local cache is
+  // never held while taking the shared lock
+  void get(deviceEvent_t& event) {
+    auto& cache = localCache();
     {
-      std::lock_guard<mutex_t> _(event_mutex_);
-      if (event_pool_.empty()) {
-        need_allocator = true;
-      } else {
-        event = event_pool_.back();
-        event_pool_.pop_back();
+      std::lock_guard<mutex_t> cache_lock(cache.mut);
+      if (!cache.events.empty()) {
+        event = cache.events.back();
+        cache.events.pop_back();
+        return;
       }
     }
-    if (need_allocator) {
-      allocator_(event);
+
+    std::vector<deviceEvent_t> batch;
+    {
+      std::lock_guard<mutex_t> _(mut_);
+      reclaimOrphanedCaches();
+      size_t num = std::min(events_.size(), kEventPoolBatchSize);
+      auto first = events_.end() - static_cast<std::ptrdiff_t>(num);
+      batch.assign(first, events_.end());
+      events_.erase(first, events_.end());
+    }
+    if (batch.empty()) {
+      createEvents(batch, kEventPoolBatchSize);
+    }
+    event = batch.back();
+    batch.pop_back();
+    if (!batch.empty()) {
+      std::lock_guard<mutex_t> cache_lock(cache.mut);
+      cache.events.insert(cache.events.end(), batch.begin(), batch.end());
     }
   }
 
-  void restore(T& event) {
-    std::lock_guard<mutex_t> _(event_mutex_);
-    event_pool_.emplace_back(event);
+  void restore(const deviceEvent_t& event) {
+    auto& cache = localCache();
+    std::vector<deviceEvent_t> spilled;
+    {
+      std::lock_guard<mutex_t> cache_lock(cache.mut);
+      cache.events.push_back(event);
+      if (cache.events.size() > 2 * kEventPoolBatchSize) {
+        // Give a batch back so that other threads can use it
+        auto first = cache.events.end() -
+                     static_cast<std::ptrdiff_t>(kEventPoolBatchSize);
+        spilled.assign(first, cache.events.end());
+        cache.events.erase(first, cache.events.end());
+      }
+    }
+    if (!spilled.empty()) {
+      std::lock_guard<mutex_t> _(mut_);
+      events_.insert(events_.end(), spilled.begin(), spilled.end());
+    }
   }
 };
 
-EventPool<deviceEvent_t>* getEventPool() {
-  const int index = devproxy::current_device();
-// GlobalEventPool for different cards , construct when really needed
-#define dispatch_event_pool(device_id)                               \
-  if (index == (device_id)) {                                        \
-    static EventPool<deviceEvent_t> gDIPUEventPool(                  \
-        [](deviceEvent_t& event) { devapis::createEvent(&event); },  \
-        [](deviceEvent_t& event) { devapis::destroyEvent(event); }); \
-    return &gDIPUEventPool;                                          \
-  }
+// Indexed by device and then flags, pools are constructed up front but only
+// filled when they are used
+std::vector<std::unique_ptr<EventPool>>& eventPools() {
+  static std::vector<std::unique_ptr<EventPool>> pools = [] {
+    auto number_of_device = devproxy::getDeviceCount();
+    std::vector<std::unique_ptr<EventPool>> list;
+    list.reserve(number_of_device * kNumEventFlags);
+    for (auto i = 0; i < number_of_device; ++i) {
+      for (size_t flags = 0; flags < kNumEventFlags; ++flags) {
+        list.emplace_back(std::make_unique<EventPool>(
+            static_cast<c10::DeviceIndex>(i),
+            static_cast<devapis::EventFlags>(flags)));
+      }
+    }
+    return list;
+  }();
+  return pools;
+}
 
-  dispatch_event_pool(0);
-  dispatch_event_pool(1);
-  dispatch_event_pool(2);
-  dispatch_event_pool(3);
-  dispatch_event_pool(4);
-  dispatch_event_pool(5);
-  dispatch_event_pool(6);
-  dispatch_event_pool(7);
-  dispatch_event_pool(8);
-  dispatch_event_pool(9);
-  dispatch_event_pool(10);
-  dispatch_event_pool(11);
-  dispatch_event_pool(12);
-  dispatch_event_pool(13);
-  dispatch_event_pool(14);
-  dispatch_event_pool(15);
-  TORCH_CHECK(false, "support up to 16 cards");
+EventPool& getEventPool(devapis::EventFlags flags) {
+  const auto device = static_cast<size_t>(devproxy::current_device());
+  const auto index = device * kNumEventFlags + static_cast<size_t>(flags);
+  auto& pools = eventPools();
+  TORCH_CHECK(index < pools.size(), "invalid device index ", device,
+              " for event pool");
+  auto& pool = *pools[index];
+  pool.init();
+  return pool;
 }
 
-void getEventFromPool(deviceEvent_t& event) { getEventPool()->get(event); }
+}  // namespace
+
+void getEventFromPool(deviceEvent_t& event, devapis::EventFlags flags) {
+  getEventPool(flags).get(event);
+}
 
-void restoreEventToPool(deviceEvent_t& event) {
-  getEventPool()->restore(event);
+void restoreEventToPool(deviceEvent_t& event, devapis::EventFlags flags) {
+  getEventPool(flags).restore(event);
 }
 
-void releaseAllEvent() { getEventPool()->release(); }
+void releaseAllEvent() {
+  for (auto& pool : eventPools()) {
+    pool->release();
+  }
+}
 
 }  // namespace dipu
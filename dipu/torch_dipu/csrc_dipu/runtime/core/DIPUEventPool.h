@@ -6,9 +6,13 @@
 
 namespace dipu {
 
-void getEventFromPool(deviceEvent_t& event);
+void getEventFromPool(
+    deviceEvent_t& event,
+    devapis::EventFlags flags = devapis::EventFlags::DEFAULT);
 
-void restoreEventToPool(deviceEvent_t& event);
+void restoreEventToPool(
+    deviceEvent_t& event,
+    devapis::EventFlags flags = devapis::EventFlags::DEFAULT);
 
 void releaseAllEvent();
 
@@ -1,11 +1,18 @@
 // Copyright (c) 2023, DeepLink.
 #include "DIPUGeneratorImpl.h"
 
+#include <array>
+#include <atomic>
+#include <limits>
+
 #include <ATen/ATen.h>
 #include <ATen/Utils.h>
 #include <c10/util/logging_is_not_google_glog.h>
 
 #include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+#include "DIPUGraph.h"
 
 namespace dipu {
 
@@ -27,6 +34,21 @@ static std::deque<std::once_flag> dipu_gens_init_flag;
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 static std::vector<at::Generator> default_gens_dipu;
 
+// Number of Philox offsets a thread reserves at once, see
+// philoxDIPUStateFromBlock
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static const uint64_t kPhiloxOffsetBlock = [] {
+  const auto block = get_env_or_default("DIPU_PHILOX_OFFSET_BLOCK", int64_t{0});
+  TORCH_CHECK(block >= 0, "DIPU_PHILOX_OFFSET_BLOCK must not be negative");
+  return static_cast<uint64_t>(block);
+}();
+
+static uint64_t nextOffsetEpoch() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+  static std::atomic<uint64_t> epoch{0};
+  return epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 /*
  * Populates the global variables related to DIPU generators
  * Warning: this function must only be called once!
@@ -82,7 +104,8 @@ DIPUGeneratorImpl::DIPUGeneratorImpl(at::DeviceIndex device_index)
     : c10::GeneratorImpl{at::Device(dipu::DIPU_DEVICE_TYPE, device_index),
                          at::DispatchKeySet(dipu::DIPU_DISPATCH_KEY)},
       offset_(0),
-      state_need_reset_(true) {}
+      state_need_reset_(true),
+      offset_epoch_(nextOffsetEpoch()) {}
 
 /**
  * Sets the seed to be used by MTGP
@@ -91,7 +114,9 @@ DIPUGeneratorImpl::DIPUGeneratorImpl(at::DeviceIndex device_index)
  */
 void DIPUGeneratorImpl::set_current_seed(uint64_t seed) {
   seed_ = seed;
+  offset_ = 0;
   state_need_reset_ = true;
+  invalidate_offset_blocks();
 }
 
 /**
@@ -137,10 +162,8 @@ DIPUGeneratorImpl* DIPUGeneratorImpl::clone_impl() const {
       createDIPUGenerator(this->device().index()).unsafeReleaseGeneratorImpl());
   TORCH_CHECK(gen != nullptr);
   gen->set_current_seed(this->seed_);
-  auto state = this->state_;
-  const auto& state_clone = state.clone();
-  gen->set_state(*state_clone.getIntrusivePtr());
-  gen->set_state_flag(this->state_need_reset_);
+  gen->offset_ = this->offset_;
+  gen->set_state(*this->get_state());
   return gen;
 }
 
@@ -157,6 +180,138 @@ c10::intrusive_ptr<c10::TensorImpl> DIPUGeneratorImpl::get_state() const {
   return state_clone.getIntrusivePtr();
 }
 
+/**
+ * Philox seed and offset of a kernel, see PhiloxDIPUState
+ *
+ * See Note [Acquire lock when using random generators]
+ */
+PhiloxDIPUState DIPUGeneratorImpl::philox_dipu_state(uint64_t increment) {
+  return philox_dipu_state(increment, 1);
+}
+
+uint64_t DIPUGeneratorImpl::philox_stride(uint64_t increment) {
+  constexpr uint64_t kPhiloxRound = 4;
+  return (increment + kPhiloxRound - 1) / kPhiloxRound * kPhiloxRound;
+}
+
+/**
+ * Philox seed and offset of `count` kernels, see PhiloxDIPUState
+ *
+ * See Note [Acquire lock when using random generators]
+ */
+PhiloxDIPUState DIPUGeneratorImpl::philox_dipu_state(uint64_t increment,
+                                                     uint64_t count) {
+  const uint64_t stride = philox_stride(increment);
+  TORCH_CHECK(count == 0 ||
+                  stride <= std::numeric_limits<uint64_t>::max() / count,
+              "Philox offset increment overflows");
+  increment = stride * count;
+  if (graph_expects_this_gen_) {
+    TORCH_INTERNAL_ASSERT(isCurrentStreamCapturing());
+    TORCH_CHECK(
+        increment <= std::numeric_limits<uint32_t>::max() - offset_intragraph_,
+        "Philox offset of the captured graph overflows");
+    PhiloxDIPUState state(seed_extragraph_, offset_extragraph_,
+                          offset_intragraph_);
+    offset_intragraph_ += static_cast<uint32_t>(increment);
+    return state;
+  }
+  TORCH_CHECK(!isCurrentStreamCapturing(),
+              "Random numbers were drawn during graph capture from a "
+              "generator the graph does not know, use the default generator");
+  const uint64_t offset = offset_;
+  offset_ = offset + increment;
+  return {seed_, offset};
+}
+
+void DIPUGeneratorImpl::capture_prologue(int64_t* seed_extragraph,
+                                         int64_t* offset_extragraph) {
+  seed_extragraph_ = seed_extragraph;
+  offset_extragraph_ = offset_extragraph;
+  offset_intragraph_ = 0;
+  graph_expects_this_gen_ = true;
+  invalidate_offset_blocks();
+}
+
+uint64_t DIPUGeneratorImpl::capture_epilogue() {
+  graph_expects_this_gen_ = false;
+  seed_extragraph_ = nullptr;
+  offset_extragraph_ = nullptr;
+  invalidate_offset_blocks();
+  return offset_intragraph_;
+}
+
+void DIPUGeneratorImpl::invalidate_offset_blocks() {
+  offset_epoch_.store(nextOffsetEpoch(), std::memory_order_release);
+}
+
+namespace {
+
+// Offsets [next, end) of `seed` reserved by this thread, valid while the
+// generator is at `epoch`
+struct PhiloxOffsetBlock {
+  uint64_t epoch = 0;
+  uint64_t seed = 0;
+  uint64_t next = 0;
+  uint64_t end = 0;
+};
+
+// Blocks of the last few generators used by this thread, most threads only
+// use the default generator of their device
+constexpr size_t kBlocksPerThread = 4;
+
+}  // namespace
+
+PhiloxDIPUState philoxDIPUStateFromBlock(DIPUGeneratorImpl* gen,
+                                         uint64_t increment) {
+  const uint64_t stride = DIPUGeneratorImpl::philox_stride(increment);
+  if (kPhiloxOffsetBlock == 0 || stride > kPhiloxOffsetBlock ||
+      isCurrentStreamCapturing()) {
+    std::lock_guard<std::mutex> lock(gen->mutex_);
+    return gen->philox_dipu_state(increment);
+  }
+  thread_local std::array<PhiloxOffsetBlock, kBlocksPerThread> blocks;
+  thread_local size_t victim = 0;
+  const uint64_t epoch = gen->offset_epoch();
+  PhiloxOffsetBlock* block = nullptr;
+  for (auto& candidate : blocks) {
+    if (candidate.epoch == epoch) {
+      block = &candidate;
+      break;
+    }
+  }
+  if (block == nullptr || block->end - block->next < stride) {
+    if (block == nullptr) {
+      block = &blocks[victim];
+      victim = (victim + 1) % kBlocksPerThread;
+    }
+    std::lock_guard<std::mutex> lock(gen->mutex_);
+    const auto state = gen->philox_dipu_state(kPhiloxOffsetBlock);
+    block->epoch = gen->offset_epoch();
+    block->seed = state.seed_.val;
+    block->next = state.offset_.val;
+    block->end =
+        block->next + DIPUGeneratorImpl::philox_stride(kPhiloxOffsetBlock);
+  }
+  const uint64_t offset = block->next;
+  block->next += stride;
+  return {block->seed, offset};
+}
+
+PhiloxCallGenerator::PhiloxCallGenerator(at::Generator& generator,
+                                         uint64_t increment)
+    : generator_(generator) {
+  auto* gen = at::check_generator<DIPUGeneratorImpl>(generator);
+  if (!gen->has_philox_state() || isCurrentStreamCapturing()) {
+    return;
+  }
+  const auto state = philoxDIPUStateFromBlock(gen, increment);
+  call_ = vendorMakeGenerator(gen->device().index());
+  auto* call = at::check_generator<DIPUGeneratorImpl>(call_);
+  call->set_current_seed(state.seed_.val);
+  call->set_offset(state.offset_.val);
+}
+
 /**
  * set state flag
  * See Note [Acquire lock when using random generators]
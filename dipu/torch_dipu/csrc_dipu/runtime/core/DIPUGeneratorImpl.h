@@ -1,12 +1,44 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+
 #include <ATen/TensorUtils.h>
 #include <ATen/core/Generator.h>
 #include <c10/core/Device.h>
 #include <c10/core/GeneratorImpl.h>
 
 namespace dipu {
+
+// The Philox seed and offset of one kernel, modelled on at::PhiloxCudaState.
+// Outside graph capture they are plain values. During capture they point to
+// device scalars that the graph refills before each replay, and the kernel
+// adds offset_intragraph_, what earlier kernels of the graph consumed.
+struct PhiloxDIPUState {
+  PhiloxDIPUState() = default;
+  PhiloxDIPUState(uint64_t seed, uint64_t offset) {
+    seed_.val = seed;
+    offset_.val = offset;
+  }
+  PhiloxDIPUState(int64_t* seed, int64_t* offset_extragraph,
+                  uint32_t offset_intragraph)
+      : offset_intragraph_(offset_intragraph), captured_(true) {
+    seed_.ptr = seed;
+    offset_.ptr = offset_extragraph;
+  }
+
+  union Payload {
+    uint64_t val;
+    int64_t* ptr;
+  };
+
+  Payload seed_{};
+  Payload offset_{};
+  uint32_t offset_intragraph_ = 0;
+  bool captured_ = false;
+};
+
 class DIPUGeneratorImpl : public c10::GeneratorImpl {
  public:
   // Constructors
@@ -26,24 +58,105 @@ class DIPUGeneratorImpl : public c10::GeneratorImpl {
 // not match the order elsewhere. we will change to keep the order from
 // oldest-compatiable to latest vesion.
 #if DIPU_TORCH_VERSION == 20100 || DIPU_TORCH_VERSION == 20101
-  void set_offset(uint64_t offset) override { offset_ = offset; }
+  void set_offset(uint64_t offset) override {
+    offset_ = offset;
+    invalidate_offset_blocks();
+  }
   uint64_t get_offset() const override { return offset_; }
 
 #else  // # temp solution, default use torch2.0.0
-  virtual void set_offset(uint64_t offset) { offset_ = offset; }
+  virtual void set_offset(uint64_t offset) {
+    offset_ = offset;
+    invalidate_offset_blocks();
+  }
   virtual uint64_t get_offset() const { return offset_; }
 
 #endif
 
+  // Reserves `increment` random numbers per thread for a kernel, rounded up
+  // to a multiple of 4 as each Philox round yields 4. Unlike get_state() it
+  // needs no state tensor, and it is safe in graph capture. The DIOPI random
+  // wrappers reach it through PhiloxCallGenerator outside capture; captured
+  // DIOPI kernels still read get_state(), as DIOPI can't pass them the device
+  // scalars.
+  //
+  // See Note [Acquire lock when using random generators]
+  PhiloxDIPUState philox_dipu_state(uint64_t increment);
+
+  // Reserves the offsets of `count` kernels of `increment` each at once. The
+  // i-th kernel adds i * philox_stride(increment) to the offset of the
+  // returned state, be it a value or, in graph capture, offset_intragraph_.
+  //
+  // See Note [Acquire lock when using random generators]
+  PhiloxDIPUState philox_dipu_state(uint64_t increment, uint64_t count);
+
+  // What philox_dipu_state() advances the offset by for `increment`
+  static uint64_t philox_stride(uint64_t increment);
+
+  // Changes whenever offsets reserved earlier must no longer be handed out,
+  // i.e. on a new seed or offset and around graph capture. Unique across
+  // generators, so that a block never outlives the generator it came from.
+  uint64_t offset_epoch() const {
+    return offset_epoch_.load(std::memory_order_acquire);
+  }
+
+  // Whether the state tensor of the vendor's kernels is the Philox seed_ and
+  // offset_, so that a generator set to a reserved seed and offset draws the
+  // numbers of that reservation, see PhiloxCallGenerator
+  virtual bool has_philox_state() const { return false; }
+
+  // Called by DIPUGraph around the capture: kernels captured in between read
+  // the seed and offset from the given device scalars. capture_epilogue()
+  // returns the offset consumed by the whole graph.
+  void capture_prologue(int64_t* seed_extragraph, int64_t* offset_extragraph);
+  uint64_t capture_epilogue();
+
  protected:
   void set_state_flag(bool flag);
   virtual void update_state() const = 0;
+  void invalidate_offset_blocks();
 
   DIPUGeneratorImpl* clone_impl() const override;
   volatile uint64_t offset_;
   uint64_t seed_ = c10::default_rng_seed_val;
   mutable at::Tensor state_;
   mutable bool state_need_reset_;
+
+ private:
+  int64_t* seed_extragraph_ = nullptr;
+  int64_t* offset_extragraph_ = nullptr;
+  uint32_t offset_intragraph_ = 0;
+  bool graph_expects_this_gen_ = false;
+  std::atomic<uint64_t> offset_epoch_;
+};
+
+// Philox state of one kernel from a block of offsets the calling thread
+// reserved from `gen`, so that threads drawing many small random numbers,
+// e.g. for dropout, take the generator mutex once per block rather than once
+// per kernel. Blocks hold DIPU_PHILOX_OFFSET_BLOCK offsets, 0 by default, in
+// which case, as for increments larger than a block and in graph capture,
+// the offsets are reserved one kernel at a time. Offsets left in a block are
+// skipped, so get_offset() runs ahead of what the kernels consumed.
+//
+// Takes the generator mutex itself, do NOT hold it.
+PhiloxDIPUState philoxDIPUStateFromBlock(DIPUGeneratorImpl* gen,
+                                         uint64_t increment);
+
+// Generator of one random op, at the Philox seed and offset reserved for it
+// from `generator` by philoxDIPUStateFromBlock. The op neither serializes on
+// the mutex of `generator` nor rebuilds its state, and what the DIOPI kernel
+// writes back goes to the copy. The kernel must advance the offset by at
+// most `increment`. get() is `generator` itself in graph capture and if the
+// vendor has no has_philox_state().
+class PhiloxCallGenerator {
+ public:
+  PhiloxCallGenerator(at::Generator& generator, uint64_t increment);
+
+  at::Generator& get() { return call_.defined() ? call_ : generator_; }
+
+ private:
+  at::Generator& generator_;
+  at::Generator call_;
 };
 
 at::Generator& getDefaultDIPUGenerator(at::DeviceIndex device_index = -1);
@@ -0,0 +1,195 @@
+// Copyright (c) 2023, DeepLink.
+#include "DIPUGraph.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include <ATen/ATen.h>
+#include <c10/util/Exception.h>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+
+#include "DIPUEvent.h"
+#include "DIPUGeneratorImpl.h"
+#include "DIPUGuard.h"
+
+namespace dipu {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> captures_underway{0};
+
+// Number of graphs using each private pool
+struct PoolUsers {
+  std::mutex mutex;
+  std::unordered_map<MemPoolId, int> count;
+};
+
+PoolUsers& poolUsers() {
+  static PoolUsers users;
+  return users;
+}
+
+void retainPool(MemPoolId pool) {
+  auto& users = poolUsers();
+  std::lock_guard<std::mutex> lk(users.mutex);
+  ++users.count[pool];
+}
+
+void releasePool(MemPoolId pool) {
+  auto& users = poolUsers();
+  {
+    std::lock_guard<std::mutex> lk(users.mutex);
+    auto iter = users.count.find(pool);
+    if (iter == users.count.end() || --iter->second > 0) {
+      return;
+    }
+    users.count.erase(iter);
+  }
+  emptyMemPool(pool);
+}
+
+DIPUGeneratorImpl* defaultGenerator(c10::DeviceIndex device) {
+  return at::check_generator<DIPUGeneratorImpl>(
+      getDefaultDIPUGenerator(device));
+}
+
+}  // namespace
+
+DIPUGraph::~DIPUGraph() {
+  try {
+    reset();
+  } catch (...) {
+  }
+}
+
+void DIPUGraph::capture_begin(MemPoolId pool) {
+  TORCH_CHECK(!has_graph_ && !capturing_,
+              "This DIPUGraph instance already owns a captured graph. To "
+              "capture a new graph, create a new instance or call reset().");
+  TORCH_CHECK(devproxy::isStreamCaptureSupported(),
+              "Stream capture is not supported on this device");
+  auto stream = getCurrentDIPUStream();
+  TORCH_CHECK(stream != getDefaultDIPUStream(stream.device_index()),
+              "DIPU graphs must be captured on a non-default stream. "
+              "(However, after capture, it's ok to replay them on the "
+              "default stream.)");
+
+  capture_stream_ = stream;
+  device_ = stream.device_index();
+  pool_ = pool == kDefaultMemPool ? createMemPool() : pool;
+  retainPool(pool_);
+
+  // The captured work runs after everything already on the default stream,
+  // allocations during the capture rely on it instead of waiting on events
+  DIPUEvent event(devapis::EventFlags::DISABLE_TIMING);
+  event.record(getDefaultDIPUStream(device_));
+  event.wait(stream);
+
+  auto options =
+      at::TensorOptions().device(DIPU_DEVICE_TYPE, device_).dtype(at::kLong);
+  seed_extragraph_ = at::empty({1}, options);
+  offset_extragraph_ = at::empty({1}, options);
+  has_seed_ = false;
+  {
+    auto* gen = defaultGenerator(device_);
+    std::lock_guard<std::mutex> lock(gen->mutex_);
+    gen->capture_prologue(seed_extragraph_.data_ptr<int64_t>(),
+                          offset_extragraph_.data_ptr<int64_t>());
+  }
+
+  prev_pool_ = exchangeMemPool(pool_);
+  captures_underway.fetch_add(1, std::memory_order_relaxed);
+  capturing_ = true;
+  try {
+    devproxy::streamBeginCapture(stream.rawstream());
+  } catch (...) {
+    finish_capture();
+    // reset() and the destructor would release it again
+    releasePool(pool_);
+    pool_ = kDefaultMemPool;
+    throw;
+  }
+}
+
+void DIPUGraph::capture_end() {
+  TORCH_CHECK(capturing_, "Call capture_begin() before capture_end()");
+  TORCH_CHECK(getCurrentDIPUStream(device_) == capture_stream_,
+              "Capture must end on the same stream it began on.");
+  void* graph = nullptr;
+  try {
+    graph = devproxy::streamEndCapture(capture_stream_.rawstream());
+  } catch (...) {
+    finish_capture();
+    throw;
+  }
+  finish_capture();
+  graph_ = graph;
+  has_graph_ = true;
+}
+
+void DIPUGraph::finish_capture() {
+  {
+    auto* gen = defaultGenerator(device_);
+    std::lock_guard<std::mutex> lock(gen->mutex_);
+    wholegraph_increment_ = gen->capture_epilogue();
+  }
+  exchangeMemPool(prev_pool_);
+  captures_underway.fetch_sub(1, std::memory_order_relaxed);
+  capturing_ = false;
+}
+
+void DIPUGraph::replay() {
+  TORCH_CHECK(has_graph_,
+              "Called DIPUGraph::replay without a preceding successful "
+              "capture.");
+  DIPUGuard guard(device_);
+  if (wholegraph_increment_ > 0) {
+    // Advances the default generator by what the graph consumes, as if its
+    // kernels ran eagerly
+    auto* gen = defaultGenerator(device_);
+    PhiloxDIPUState state;
+    {
+      std::lock_guard<std::mutex> lock(gen->mutex_);
+      state = gen->philox_dipu_state(wholegraph_increment_);
+    }
+    // the seed only changes on reseeding, unlike the offset
+    if (!has_seed_ || state.seed_.val != seed_) {
+      seed_extragraph_.fill_(static_cast<int64_t>(state.seed_.val));
+      seed_ = state.seed_.val;
+      has_seed_ = true;
+    }
+    offset_extragraph_.fill_(static_cast<int64_t>(state.offset_.val));
+  }
+  devproxy::graphLaunch(graph_, getCurrentDIPUStream(device_).rawstream());
+}
+
+void DIPUGraph::reset() {
+  if (has_graph_) {
+    DIPUGuard guard(device_);
+    devproxy::graphDestroy(graph_);
+    graph_ = nullptr;
+    has_graph_ = false;
+    seed_extragraph_.reset();
+    has_seed_ = false;
+    offset_extragraph_.reset();
+    wholegraph_increment_ = 0;
+  }
+  if (pool_ != kDefaultMemPool && !capturing_) {
+    releasePool(pool_);
+    pool_ = kDefaultMemPool;
+  }
+}
+
+bool isCaptureUnderway() {
+  return captures_underway.load(std::memory_order_relaxed) > 0;
+}
+
+bool isCurrentStreamCapturing() {
+  return isCaptureUnderway() &&
+         devproxy::isStreamCapturing(getCurrentDIPUStream().rawstream());
+}
+
+}  // namespace dipu
@@ -0,0 +1,78 @@
+// Copyright (c) 2023, DeepLink.
+#pragma once
+
+#include <cstdint>
+
+#include <ATen/core/Tensor.h>
+#include <c10/core/Device.h>
+
+#include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocatorUtils.h"
+#include "csrc_dipu/runtime/device/basedef.h"
+
+#include "DIPUStream.h"
+
+namespace dipu {
+
+// Records the work submitted to a stream once and replays it with a single
+// launch, modelled on at::cuda::CUDAGraph. Device memory allocated during
+// capture comes from a private pool of the caching allocator, so that the
+// addresses baked into the graph stay valid for replays. Only vendors
+// implementing the stream capture hooks of devapis support it.
+//
+// Kernels drawing random numbers through philox_dipu_state() of the default
+// generator during capture read the seed and offset from device scalars,
+// which replay() refills, so each replay draws fresh numbers. No DIOPI op
+// takes a PhiloxDIPUState yet: outside capture the random wrappers reserve
+// their offsets through PhiloxCallGenerator, but in capture they read the
+// state tensor of the generator, so their replays may repeat the numbers
+// drawn at capture time.
+class DIPU_API DIPUGraph {
+ public:
+  DIPUGraph() = default;
+  ~DIPUGraph();
+
+  DIPUGraph(const DIPUGraph&) = delete;
+  DIPUGraph(DIPUGraph&&) = delete;
+  DIPUGraph& operator=(const DIPUGraph&) = delete;
+  DIPUGraph& operator=(DIPUGraph&&) = delete;
+
+  // Capture the current stream, which must not be the default stream. Pass
+  // the pool of another graph to share it, graphs sharing a pool must be
+  // replayed in the order they were captured.
+  void capture_begin(MemPoolId pool = kDefaultMemPool);
+
+  void capture_end();
+
+  // Launch the graph on the current stream
+  void replay();
+
+  // Drop the graph, the pool is released once no graph uses it
+  void reset();
+
+  MemPoolId pool() const { return pool_; }
+
+ private:
+  void finish_capture();
+
+  void* graph_ = nullptr;
+  at::Tensor seed_extragraph_;
+  at::Tensor offset_extragraph_;
+  // what seed_extragraph_ holds, once replay() filled it
+  uint64_t seed_ = 0;
+  bool has_seed_ = false;
+  uint64_t wholegraph_increment_ = 0;
+  bool has_graph_ = false;
+  bool capturing_ = false;
+  MemPoolId pool_ = kDefaultMemPool;
+  MemPoolId prev_pool_ = kDefaultMemPool;
+  DIPUStream capture_stream_;
+  c10::DeviceIndex device_ = -1;
+};
+
+// Whether any stream of this process is being captured, checked on the
+// allocation path before querying the capture status of a stream
+DIPU_API bool isCaptureUnderway();
+
+DIPU_API bool isCurrentStreamCapturing();
+
+}  // namespace dipu
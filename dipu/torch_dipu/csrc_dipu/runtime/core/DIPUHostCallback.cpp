@@ -0,0 +1,83 @@
+// Copyright (c) 2023, DeepLink.
+#include "DIPUHostCallback.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+
+namespace dipu {
+
+namespace {
+
+void runHostCallback(void* arg) {
+  std::unique_ptr<std::function<void()>> callback(
+      static_cast<std::function<void()>*>(arg));
+  (*callback)();
+}
+
+}  // namespace
+
+bool launchHostCallback(const DIPUStream& stream,
+                        std::function<void()> callback) {
+  if (!devproxy::isHostFuncSupported()) {
+    return false;
+  }
+  auto boxed = std::make_unique<std::function<void()>>(std::move(callback));
+  devproxy::launchHostFunc(stream.rawstream(), runHostCallback, boxed.get());
+  // Owned by the host function from now on
+  boxed.release();
+  return true;
+}
+
+struct DIPUCompletionNotifier::State {
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t pending = 0;
+};
+
+DIPUCompletionNotifier::DIPUCompletionNotifier()
+    : state_(std::make_shared<State>()) {}
+
+bool DIPUCompletionNotifier::watch(const DIPUStream& stream) {
+  {
+    std::lock_guard<std::mutex> lk(state_->mutex);
+    ++state_->pending;
+  }
+  // Keep the state alive, the notifier may be gone when the callback runs
+  auto state = state_;
+  bool launched = false;
+  try {
+    launched = launchHostCallback(stream, [state] {
+      {
+        std::lock_guard<std::mutex> lk(state->mutex);
+        --state->pending;
+      }
+      state->cv.notify_all();
+    });
+  } catch (...) {
+    std::lock_guard<std::mutex> lk(state_->mutex);
+    --state_->pending;
+    throw;
+  }
+  if (!launched) {
+    std::lock_guard<std::mutex> lk(state_->mutex);
+    --state_->pending;
+  }
+  return launched;
+}
+
+bool DIPUCompletionNotifier::completed() const {
+  std::lock_guard<std::mutex> lk(state_->mutex);
+  return state_->pending == 0;
+}
+
+bool DIPUCompletionNotifier::waitFor(std::chrono::milliseconds timeout) const {
+  std::unique_lock<std::mutex> lk(state_->mutex);
+  return state_->cv.wait_for(lk, timeout,
+                             [this] { return state_->pending == 0; });
+}
+
+}  // namespace dipu
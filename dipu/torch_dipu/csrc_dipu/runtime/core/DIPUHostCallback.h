@@ -0,0 +1,41 @@
+// Copyright (c) 2023, DeepLink.
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+#include "DIPUStream.h"
+
+namespace dipu {
+
+// Run `callback` on a driver thread once the work queued on `stream` so far
+// is done. Returns false without running it if the vendor can't launch host
+// functions. The callback must not call device apis.
+DIPU_API bool launchHostCallback(const DIPUStream& stream,
+                                 std::function<void()> callback);
+
+// Tells waiting threads that the work queued on some streams is done, so
+// that they can sleep instead of polling events. Copies share the state.
+class DIPU_API DIPUCompletionNotifier {
+ public:
+  DIPUCompletionNotifier();
+
+  // Watch the work queued on `stream` so far, returns false if host
+  // callbacks are not supported and the caller should poll instead
+  bool watch(const DIPUStream& stream);
+
+  // Whether all watched work is done
+  bool completed() const;
+
+  // Returns false if the watched work is not done within `timeout`
+  bool waitFor(std::chrono::milliseconds timeout) const;
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace dipu
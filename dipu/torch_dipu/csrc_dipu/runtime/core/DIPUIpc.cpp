@@ -0,0 +1,319 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUIpc.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <c10/util/Exception.h>
+
+#include "csrc_dipu/base/basedef.h"
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+#include "DIPUGuard.h"
+#include "DIPUStream.h"
+
+namespace dipu {
+
+namespace {
+
+using Counter = std::atomic<int64_t>;
+static_assert(Counter::is_always_lock_free,
+              "counters in shared memory must be lock free");
+
+// Storages a process can share at once
+constexpr size_t kCounterSlots = 4096;
+constexpr size_t kCounterFileSize = kCounterSlots * sizeof(Counter);
+
+// Set in a slot by the first receiver opening it, the other bits count the
+// receivers still using it
+constexpr int64_t kOpened = int64_t{1} << 62;
+
+// Seconds after which a handle no receiver opened expires, and the producer
+// releases its storage
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const std::chrono::seconds kUnopenedHandleTtl{
+    get_env_or_default("DIPU_IPC_HANDLE_TTL", 300)};
+
+// Sent to the receiver as raw bytes
+struct SharedHandle {
+  devapis::IpcMemHandle handle;
+  uint64_t offset = 0;
+  uint64_t nbytes = 0;
+  int32_t device = 0;
+  uint32_t slot = 0;
+  // Name of the counter file of the producer
+  char counters[64] = {};
+};
+
+// Reference counts in shared memory, a slot counts the receivers of a shared
+// storage that may still use it. The producer creates the file and unlinks it
+// when it exits.
+class CounterFile {
+ public:
+  CounterFile(std::string name, bool create)
+      : name_(std::move(name)), owner_(create) {
+    if (create) {
+      // left behind by a crashed process of the same pid
+      ::shm_unlink(name_.c_str());
+    }
+    int fd = ::shm_open(name_.c_str(), create ? O_CREAT | O_EXCL | O_RDWR
+                                              : O_RDWR,
+                        0600);
+    TORCH_CHECK(fd >= 0, "shm_open ", name_, " failed: ", std::strerror(errno));
+    // a new file reads as zeros
+    if (create && ::ftruncate(fd, kCounterFileSize) != 0) {
+      int error = errno;
+      ::close(fd);
+      ::shm_unlink(name_.c_str());
+      TORCH_CHECK(false, "ftruncate ", name_,
+                  " failed: ", std::strerror(error));
+    }
+    void* p = ::mmap(nullptr, kCounterFileSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    ::close(fd);
+    TORCH_CHECK(p != MAP_FAILED, "mmap ", name_,
+                " failed: ", std::strerror(errno));
+    slots_ = static_cast<Counter*>(p);
+  }
+
+  ~CounterFile() {
+    ::munmap(slots_, kCounterFileSize);
+    if (owner_) {
+      ::shm_unlink(name_.c_str());
+    }
+  }
+
+  CounterFile(const CounterFile&) = delete;
+  CounterFile& operator=(const CounterFile&) = delete;
+
+  Counter& operator[](size_t slot) { return slots_[slot]; }
+  const std::string& name() const { return name_; }
+
+ private:
+  std::string name_;
+  bool owner_;
+  Counter* slots_ = nullptr;
+};
+
+// The storages shared by this process, by the slot counting their receivers
+class SharedStorages {
+ public:
+  SharedStorages()
+      : counters_("/dipu_ipc_" + std::to_string(::getpid()), true),
+        storages_(kCounterSlots),
+        shared_at_(kCounterSlots) {}
+
+  // At exit the allocator may be gone already, the driver frees the memory
+  ~SharedStorages() {
+    for (auto& storage : storages_) {
+      if (storage) {
+        storage.unsafeReleaseStorageImpl();
+      }
+    }
+  }
+
+  SharedStorages(const SharedStorages&) = delete;
+  SharedStorages& operator=(const SharedStorages&) = delete;
+
+  uint32_t add(const c10::Storage& storage) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    collectLocked();
+    for (size_t i = 0; i < kCounterSlots; ++i) {
+      size_t slot = (next_ + i) % kCounterSlots;
+      if (!storages_[slot]) {
+        storages_[slot] = storage;
+        shared_at_[slot] = std::chrono::steady_clock::now();
+        counters_[slot].store(0);
+        next_ = slot + 1;
+        return static_cast<uint32_t>(slot);
+      }
+    }
+    TORCH_CHECK(false, "more than ", kCounterSlots,
+                " device storages are shared at once");
+  }
+
+  void collect() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    collectLocked();
+  }
+
+  const std::string& name() const { return counters_.name(); }
+
+ private:
+  void collectLocked() {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t slot = 0; slot < kCounterSlots; ++slot) {
+      if (!storages_[slot]) {
+        continue;
+      }
+      int64_t count = counters_[slot].load();
+      // opened and released by every receiver, or never opened in time, e.g.
+      // as the receiver died or dropped the handle
+      if (count == kOpened ||
+          (count == 0 && now - shared_at_[slot] > kUnopenedHandleTtl)) {
+        storages_[slot] = c10::Storage();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  CounterFile counters_;
+  std::vector<c10::Storage> storages_;
+  std::vector<std::chrono::steady_clock::time_point> shared_at_;
+  size_t next_ = 0;
+};
+
+SharedStorages& sharedStorages() {
+  // unlinks the counter file at exit
+  static SharedStorages storages;
+  return storages;
+}
+
+// What a receiver opened, shared by the storages over the same allocation
+class OpenedHandles {
+ public:
+  std::shared_ptr<void> base(const SharedHandle& handle) {
+    std::string key(handle.handle.data, sizeof(handle.handle.data));
+    std::lock_guard<std::mutex> lk(mutex_);
+    // an allocation can be opened only once per process
+    auto& opened = bases_[key];
+    if (auto base = opened.lock()) {
+      return base;
+    }
+    for (auto it = bases_.begin(); it != bases_.end();) {
+      it = it->second.expired() && it->first != key ? bases_.erase(it)
+                                                    : std::next(it);
+    }
+    void* p = nullptr;
+    devproxy::ipcOpenMemHandle(&p, handle.handle);
+    int32_t device = handle.device;
+    std::shared_ptr<void> base(p, [device](void* p) {
+      DIPUGuard guard(static_cast<c10::DeviceIndex>(device));
+      devproxy::ipcCloseMemHandle(p);
+    });
+    opened = base;
+    return base;
+  }
+
+  std::shared_ptr<CounterFile> counters(const std::string& name) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto& file = counters_[name];
+    if (!file) {
+      file = std::make_shared<CounterFile>(name, false);
+    }
+    return file;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, std::weak_ptr<void>> bases_;
+  std::map<std::string, std::shared_ptr<CounterFile>> counters_;
+};
+
+OpenedHandles& openedHandles() {
+  static OpenedHandles handles;
+  return handles;
+}
+
+// Context of the DataPtr of an opened storage
+struct OpenedStorage {
+  std::shared_ptr<void> base;
+  std::shared_ptr<CounterFile> counters;
+  uint32_t slot = 0;
+  int32_t device = 0;
+
+  ~OpenedStorage() {
+    if (!counters) {
+      return;
+    }
+    // the producer may reuse the memory as soon as the count drops
+    try {
+      DIPUGuard guard(static_cast<c10::DeviceIndex>(device));
+      getCurrentDIPUStream().synchronize();
+    } catch (const std::exception& e) {
+      TORCH_WARN("releasing a shared device storage: ", e.what());
+    }
+    (*counters)[slot].fetch_sub(1);
+  }
+};
+
+void deleteOpenedStorage(void* ctx) { delete static_cast<OpenedStorage*>(ctx); }
+
+}  // namespace
+
+bool isIpcSupported() { return devproxy::isIpcSupported(); }
+
+std::string shareDeviceStorage(const c10::Storage& storage) {
+  TORCH_CHECK(storage.device_type() == DIPU_DEVICE_TYPE,
+              "only device storages can be shared, got ",
+              storage.device_type());
+  TORCH_CHECK(isIpcSupported(), "the vendor can't share device memory");
+  DIPUGuard guard(storage.device());
+  SharedHandle handle;
+  handle.device = storage.device().index();
+  handle.nbytes = storage.nbytes();
+  if (handle.nbytes > 0) {
+    getCurrentDIPUStream().synchronize();
+    size_t offset = 0;
+    TORCH_CHECK(
+        devproxy::ipcGetMemHandle(&handle.handle, &offset,
+                                  storage.data_ptr().get()),
+        "the device memory of the storage can't be shared, it may be mapped "
+        "by the expandable segments of the allocator");
+    handle.offset = offset;
+    auto& shared = sharedStorages();
+    handle.slot = shared.add(storage);
+    TORCH_CHECK(shared.name().size() < sizeof(handle.counters));
+    std::memcpy(handle.counters, shared.name().c_str(), shared.name().size());
+  }
+  return {reinterpret_cast<const char*>(&handle), sizeof(handle)};
+}
+
+c10::Storage openSharedDeviceStorage(const std::string& bytes) {
+  TORCH_CHECK(bytes.size() == sizeof(SharedHandle),
+              "not a shared device storage handle");
+  SharedHandle handle;
+  std::memcpy(&handle, bytes.data(), sizeof(handle));
+  c10::Device device(DIPU_DEVICE_TYPE,
+                     static_cast<c10::DeviceIndex>(handle.device));
+  if (handle.nbytes == 0) {
+    return {c10::Storage::use_byte_size_t(), 0, c10::DataPtr(nullptr, device),
+            nullptr, false};
+  }
+
+  DIPUGuard guard(device);
+  auto ctx = std::make_unique<OpenedStorage>();
+  ctx->base = openedHandles().base(handle);
+  ctx->counters = openedHandles().counters(handle.counters);
+  ctx->slot = handle.slot;
+  ctx->device = handle.device;
+  // counted before marked as opened, so that the producer never sees the slot
+  // opened and unused in between
+  auto& counter = (*ctx->counters)[handle.slot];
+  counter.fetch_add(1);
+  counter.fetch_or(kOpened);
+  void* data = static_cast<char*>(ctx->base.get()) + handle.offset;
+  c10::DataPtr data_ptr(data, ctx.release(), deleteOpenedStorage, device);
+  return {c10::Storage::use_byte_size_t(), static_cast<size_t>(handle.nbytes),
+          std::move(data_ptr), nullptr, false};
+}
+
+void collectSharedDeviceStorages() { sharedStorages().collect(); }
+
+}  // namespace dipu
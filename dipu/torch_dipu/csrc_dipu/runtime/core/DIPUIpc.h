@@ -0,0 +1,31 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <string>
+
+#include <c10/core/Storage.h>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+namespace dipu {
+
+// Whether the vendor can share device memory with other processes
+DIPU_API bool isIpcSupported();
+
+// Serializes a handle other processes open the device memory of `storage`
+// by. The memory stays owned by the caching allocator of this process, which
+// does not reuse it until every process that opened the handle released the
+// storage it got. A handle no process opened within DIPU_IPC_HANDLE_TTL
+// seconds, 300 by default, expires. Work queued on the current stream so far
+// is waited for, so that the receiver sees its results.
+DIPU_API std::string shareDeviceStorage(const c10::Storage& storage);
+
+// A storage over the device memory of a handle serialized by
+// shareDeviceStorage() in another process
+DIPU_API c10::Storage openSharedDeviceStorage(const std::string& handle);
+
+// Releases the storages shared by this process that all receivers are done
+// with. Sharing collects too, calling it only returns memory sooner.
+DIPU_API void collectSharedDeviceStorages();
+
+}  // namespace dipu
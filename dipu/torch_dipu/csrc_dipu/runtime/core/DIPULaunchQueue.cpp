@@ -0,0 +1,173 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPULaunchQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <c10/util/Exception.h>
+
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kLaunchQueue = get_env_or_default("DIPU_LAUNCH_QUEUE", 0) > 0;
+
+// Launches queued on all devices and not done yet, barriers only look at it
+// when there is nothing to wait for
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<size_t> pending_launches{0};
+
+// Whether a launch raised an error not reported by a barrier yet
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> launch_failed{false};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> pause_count{0};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+thread_local bool on_launch_thread = false;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+thread_local int barrier_skips = 0;
+
+class LaunchQueue {
+ public:
+  explicit LaunchQueue(deviceId_t device) : device_(device) {
+    // Never joined, the queues live until the process exits
+    std::thread([this] { run(); }).detach();
+  }
+
+  void push(std::function<void()> launch) {
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      tasks_.push_back(std::move(launch));
+      pending_launches.fetch_add(1, std::memory_order_release);
+    }
+    ready_.notify_one();
+  }
+
+  // Wait until the launches queued so far are done, returns the first error
+  // they raised since the last call
+  std::exception_ptr drain() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    done_.wait(lk, [this] { return tasks_.empty() && !running_; });
+    return std::exchange(error_, nullptr);
+  }
+
+ private:
+  void run() {
+    on_launch_thread = true;
+    devproxy::setDevice(device_);
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (true) {
+      ready_.wait(lk, [this] { return !tasks_.empty(); });
+      auto launch = std::move(tasks_.front());
+      tasks_.pop_front();
+      running_ = true;
+      // Launches after a failed one may depend on it, they are dropped until
+      // the error is reported
+      bool skip = error_ != nullptr;
+      lk.unlock();
+      if (!skip) {
+        try {
+          launch();
+        } catch (...) {
+          lk.lock();
+          error_ = std::current_exception();
+          launch_failed.store(true, std::memory_order_release);
+          lk.unlock();
+        }
+      }
+      // Release what the launch holds before others may reuse the memory
+      launch = nullptr;
+      lk.lock();
+      running_ = false;
+      pending_launches.fetch_sub(1, std::memory_order_acq_rel);
+      if (tasks_.empty()) {
+        done_.notify_all();
+      }
+    }
+  }
+
+  deviceId_t device_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable done_;
+  std::deque<std::function<void()>> tasks_;
+  bool running_ = false;
+  std::exception_ptr error_;
+};
+
+std::vector<LaunchQueue*>& launchQueues() {
+  // Leaked, launch threads may still use them during static destruction
+  static auto* queues = [] {
+    auto* result = new std::vector<LaunchQueue*>();
+    const int count = devproxy::getDeviceCount();
+    for (int i = 0; i < count; ++i) {
+      result->push_back(new LaunchQueue(static_cast<deviceId_t>(i)));
+    }
+    return result;
+  }();
+  return *queues;
+}
+
+}  // namespace
+
+bool launchQueueEnabled() { return kLaunchQueue; }
+
+void enqueueLaunch(std::function<void()> launch) {
+  if (!kLaunchQueue || on_launch_thread ||
+      pause_count.load(std::memory_order_acquire) > 0) {
+    launch();
+    return;
+  }
+  auto& queues = launchQueues();
+  auto device = static_cast<size_t>(devproxy::current_device());
+  TORCH_CHECK(device < queues.size(), "no launch queue for device ", device);
+  queues[device]->push(std::move(launch));
+}
+
+void launchQueueBarrier() {
+  if (!kLaunchQueue || on_launch_thread || barrier_skips > 0 ||
+      (pending_launches.load(std::memory_order_acquire) == 0 &&
+       !launch_failed.load(std::memory_order_acquire))) {
+    return;
+  }
+  launch_failed.store(false, std::memory_order_release);
+  std::exception_ptr error;
+  for (auto* queue : launchQueues()) {
+    auto queue_error = queue->drain();
+    if (error == nullptr) {
+      error = queue_error;
+    }
+  }
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
+LaunchQueueBarrierSkip::LaunchQueueBarrierSkip() { ++barrier_skips; }
+
+LaunchQueueBarrierSkip::~LaunchQueueBarrierSkip() { --barrier_skips; }
+
+void pauseLaunchQueue() {
+  launchQueueBarrier();
+  pause_count.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void resumeLaunchQueue() {
+  pause_count.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+}  // namespace dipu
@@ -0,0 +1,47 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <functional>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+namespace dipu {
+
+// With DIPU_LAUNCH_QUEUE=1, the wrappers of ops marked async_launch hand
+// their kernel launches to a thread per device instead of launching them on
+// the calling thread, so that python runs ahead of the vendor launch cost.
+// Every other operation on streams waits for the queued launches first, see
+// launchQueueBarrier.
+DIPU_API bool launchQueueEnabled();
+
+// Run `launch` on the launch thread of the current device after the launches
+// queued before it. `launch` must own everything it uses. It runs right away
+// on the calling thread if the queue is disabled or paused, or when called
+// from a launch thread.
+DIPU_API void enqueueLaunch(std::function<void()> launch);
+
+// Wait until all queued launches are done and rethrow the first error one of
+// them raised. devproxy calls it before the stream, event and copy apis, so
+// that work queued on streams directly keeps its order with the launches.
+// It returns at once on launch threads and when nothing is queued.
+DIPU_API void launchQueueBarrier();
+
+// Launch on the calling thread while paused, e.g. during stream capture.
+// Calls nest.
+DIPU_API void pauseLaunchQueue();
+DIPU_API void resumeLaunchQueue();
+
+// Barriers of the calling thread return at once while one of these lives.
+// The caching allocators hold one while they work: the memory they hand out
+// or take back is not used by queued launches, which keep their tensors
+// alive, and a barrier under their locks could wait for a launch thread
+// waiting for the same locks.
+class DIPU_API LaunchQueueBarrierSkip {
+ public:
+  LaunchQueueBarrierSkip();
+  ~LaunchQueueBarrierSkip();
+  LaunchQueueBarrierSkip(const LaunchQueueBarrierSkip&) = delete;
+  LaunchQueueBarrierSkip& operator=(const LaunchQueueBarrierSkip&) = delete;
+};
+
+}  // namespace dipu
@@ -0,0 +1,112 @@
+// Copyright (c) 2024, DeepLink.
+#include "DIPUPinnedStaging.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <c10/core/Allocator.h>
+
+#include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocator.h"
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
+
+#include "DIPUEvent.h"
+
+namespace dipu {
+
+namespace {
+
+// Size (in KB) of each staging buffer, 0 disables staging
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kStagingChunkBytes =
+    get_env_or_default("DIPU_PINNED_STAGING_CHUNK_KB", size_t{4096}) * 1024;
+
+// Number of staging buffers, two are enough to overlap staging and transfer
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kNumStagingBuffers = std::max<size_t>(
+    get_env_or_default("DIPU_PINNED_STAGING_BUFFERS", size_t{2}), 1);
+
+// Smaller copies are cheap enough for the vendor to stage on its own
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kStagingMinBytes =
+    get_env_or_default("DIPU_PINNED_STAGING_MIN_KB", size_t{64}) * 1024;
+
+class PinnedStagingRing final {
+  struct Buffer {
+    c10::DataPtr data;
+    // Recorded after the last copy out of `data`
+    DIPUEvent event{devapis::EventFlags::DISABLE_TIMING};
+  };
+
+  std::mutex mtx_;
+  // Guarded by `mtx_`
+  std::vector<Buffer> buffers_;
+  size_t next_ = 0;
+
+  // Wait until the buffer is no longer read by the device, with `mtx_` held
+  Buffer& acquire(const DIPUStream& stream) {
+    if (buffers_.empty()) {
+      buffers_.resize(kNumStagingBuffers);
+    }
+    auto& buffer = buffers_[next_];
+    next_ = (next_ + 1) % buffers_.size();
+    if (!buffer.data) {
+      buffer.data =
+          getAllocator(at::DeviceType::CPU)->allocate(kStagingChunkBytes);
+    }
+    buffer.event.synchronize();
+    if (buffer.event.isCreated() &&
+        buffer.event.device_index() != stream.device_index()) {
+      buffer.event = DIPUEvent(devapis::EventFlags::DISABLE_TIMING);
+    }
+    return buffer;
+  }
+
+ public:
+  void copyH2D(const DIPUStream& stream, size_t nbytes, void* dst,
+               const void* src) {
+    std::lock_guard<std::mutex> _(mtx_);
+    for (size_t offset = 0; offset < nbytes; offset += kStagingChunkBytes) {
+      auto chunk = std::min(kStagingChunkBytes, nbytes - offset);
+      auto& buffer = acquire(stream);
+      memcpy(buffer.data.get(), static_cast<const char*>(src) + offset, chunk);
+      devproxy::memCopyH2DAsync(stream.rawstream(), chunk,
+                                static_cast<char*>(dst) + offset,
+                                buffer.data.get());
+      buffer.event.record(stream);
+    }
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> _(mtx_);
+    for (auto& buffer : buffers_) {
+      buffer.event.synchronize();
+    }
+    buffers_.clear();
+    next_ = 0;
+  }
+};
+
+PinnedStagingRing& stagingRing() {
+  static PinnedStagingRing ring;
+  return ring;
+}
+
+}  // namespace
+
+bool shouldStageMemCopyH2D(size_t nbytes, bool src_pinned) {
+  // Staging only pays off if the copies from it overlap with the host
+  return kStagingChunkBytes > 0 && !src_pinned && nbytes >= kStagingMinBytes &&
+         devproxy::vendorCapabilities().asyncMemCopyH2D;
+}
+
+void memCopyH2DStagedAsync(const DIPUStream& stream, size_t nbytes, void* dst,
+                           const void* src) {
+  stagingRing().copyH2D(stream, nbytes, dst, src);
+}
+
+void releasePinnedStagingBuffers() { stagingRing().release(); }
+
+}  // namespace dipu
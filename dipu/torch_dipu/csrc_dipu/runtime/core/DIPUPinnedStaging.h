@@ -0,0 +1,26 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstddef>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+#include "DIPUStream.h"
+
+namespace dipu {
+
+// Whether an async H2D copy of `nbytes` from the pageable host memory `src`
+// should go through memCopyH2DStagedAsync. Vendor async copies from pageable
+// memory are synchronous in practice.
+DIPU_API bool shouldStageMemCopyH2D(size_t nbytes, bool src_pinned);
+
+// Copy pageable host memory to device through a ring of pinned staging
+// buffers taken from the host caching allocator. Chunks are staged while the
+// previous ones are transferred, and the call returns once the last chunk is
+// queued, so `src` may be reused right away.
+DIPU_API void memCopyH2DStagedAsync(const DIPUStream& stream, size_t nbytes,
+                                    void* dst, const void* src);
+
+void releasePinnedStagingBuffers();
+
+}  // namespace dipu
@@ -1,11 +1,13 @@
 // Copyright (c) 2023, DeepLink.
 #include "DIPUStream.h"
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sys/time.h>
 #include <unistd.h>
@@ -13,6 +15,8 @@
 
 #include <c10/util/Exception.h>
 
+#include "csrc_dipu/utils/env.hpp"
+
 #include "DIPUGuard.h"
 
 namespace dipu {
@@ -21,6 +25,9 @@ namespace {
 enum class StreamIdType : uint8_t {
   DEFAULT = 0,
   POOL = 1,
+  PRIORITY_POOL = 2,
+  // Streams created outside of dipu, the stream id is the raw stream pointer
+  EXT = 3,
 };
 
 std::string to_string(StreamIdType s) {
@@ -29,14 +36,39 @@ std::string to_string(StreamIdType s) {
       return "DEFAULT";
     case StreamIdType::POOL:
       return "POOL";
+    case StreamIdType::PRIORITY_POOL:
+      return "PRIORITY_POOL";
+    case StreamIdType::EXT:
+      return "EXT";
     default:
       return std::to_string(static_cast<uint8_t>(s));
   }
 }
 
 // follow old pytorch cuda, seems new version use an opposite strategy.
-constexpr int kStreamsPerPoolBits = 3;
-constexpr int kStreamsPerPool = 1 << kStreamsPerPoolBits;
+constexpr int kStreamsPerPoolBits = 5;
+constexpr int kMaxStreamsPerPool = 1 << kStreamsPerPoolBits;
+
+// Number of streams in each of the low and high priority pools
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const uint32_t kStreamsPerPool = std::clamp<uint32_t>(
+    get_env_or_default("DIPU_STREAMS_PER_POOL", uint32_t{8}), 1,
+    kMaxStreamsPerPool);
+
+// Ids of streams owned by dipu are below this value, larger ids are pointers
+// of external streams
+constexpr int kStreamTypeBits = 3;
+constexpr c10::StreamId kMaxInternalStreamId = c10::StreamId{1}
+                                               << (kStreamsPerPoolBits +
+                                                   kStreamTypeBits);
+
+StreamIdType getStreamIdType(c10::StreamId s) {
+  if (s < 0 || s >= kMaxInternalStreamId) {
+    return StreamIdType::EXT;
+  }
+  return static_cast<StreamIdType>(static_cast<uint32_t>(s) >>
+                                   kStreamsPerPoolBits);
+}
 
 c10::StreamId makeC10StreamId(StreamIdType sType, size_t id) {
   return (static_cast<uint32_t>(static_cast<c10::StreamId>(sType)
@@ -49,33 +81,32 @@ struct DIPUStreamDevice {
  private:
   // Default streams
   std::once_flag pool_flag;
+  std::once_flag priority_pool_flag;
   std::once_flag default_flag;
   devapis::deviceId_t devidx_;
   // seems pytorch 2.0 giveup default stream and enable cuda per_thread stream
   // feature at compile time. it cannot be applied to other device.
   deviceStream_t default_stream{};
   std::atomic<uint32_t> next_pool_pos{};
-  std::array<deviceStream_t, kStreamsPerPool> pool_streams{};
+  std::atomic<uint32_t> next_priority_pool_pos{};
+  std::array<deviceStream_t, kMaxStreamsPerPool> pool_streams{};
+  std::array<deviceStream_t, kMaxStreamsPerPool> priority_pool_streams{};
 
-  inline uint32_t getNextPoolIdx() {
-    auto raw_idx = next_pool_pos++;
+  static uint32_t getNextPoolIdx(std::atomic<uint32_t>& pos) {
+    auto raw_idx = pos++;
     return raw_idx % kStreamsPerPool;
   }
 
-  static StreamIdType getStreamIdType(c10::StreamId s) {
-    return static_cast<StreamIdType>(static_cast<uint32_t>(s) >>
-                                     kStreamsPerPoolBits);
-  }
-
   static size_t getStreamIdIndex(c10::StreamId s) {
     return static_cast<size_t>(static_cast<uint32_t>(s) &
                                ((1 << kStreamsPerPoolBits) - 1));
   }
 
-  void _doInitPool() {
+  void _doInitPool(bool prior) {
     DIPUGuard device_guard{devidx_};
-    for (auto& stream : pool_streams) {
-      devproxy::createStream(&stream);
+    auto& streams = prior ? priority_pool_streams : pool_streams;
+    for (uint32_t i = 0; i < kStreamsPerPool; ++i) {
+      devproxy::createStream(&streams[i], prior);
     }
   }
 
@@ -90,8 +121,13 @@ struct DIPUStreamDevice {
   explicit DIPUStreamDevice(devapis::deviceId_t device_id)
       : devidx_(device_id) {}
 
-  DIPUStream getDIPUStreamfromPool() {
-    const auto idx = getNextPoolIdx();
+  DIPUStream getDIPUStreamfromPool(bool isHighPriority) {
+    if (isHighPriority) {
+      const auto idx = getNextPoolIdx(next_priority_pool_pos);
+      return DIPUStream(devidx_,
+                        makeC10StreamId(StreamIdType::PRIORITY_POOL, idx));
+    }
+    const auto idx = getNextPoolIdx(next_pool_pos);
     return DIPUStream(devidx_, makeC10StreamId(StreamIdType::POOL, idx));
   }
 
@@ -117,32 +153,65 @@ struct DIPUStreamDevice {
         return default_stream;
       case StreamIdType::POOL:
         return pool_streams[sidx];
+      case StreamIdType::PRIORITY_POOL:
+        return priority_pool_streams[sidx];
+      case StreamIdType::EXT:
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        return reinterpret_cast<deviceStream_t>(stream_id);
       default:
         // TODO(assert): AT_ERROR is deprecated.
         AT_ERROR("Invalid stream", stream_id, " (type=", to_string(st), ")");
     }
   }
-  void initPool() {
-    std::call_once(pool_flag, &DIPUStreamDevice::_doInitPool, this);
+  // The high priority pool is created on first use, since some vendors
+  // don't support priority streams and warn on each of them
+  void initPool(bool isHighPriority) {
+    std::call_once(isHighPriority ? priority_pool_flag : pool_flag,
+                   &DIPUStreamDevice::_doInitPool, this, isHighPriority);
   }
   void initDevice() {
     std::call_once(default_flag, &DIPUStreamDevice::_doInitDeivce, this);
   }
 };
 
-auto StreamDeviceList()
-    -> std::vector<std::unique_ptr<DIPUStreamDevice>> const& {
-  auto make_list = [] {
-    auto number_of_device = devproxy::getDeviceCount();
-    auto list = std::vector<std::unique_ptr<DIPUStreamDevice>>();
-    list.reserve(number_of_device);
-    for (auto i = 0; i < number_of_device; ++i) {
-      list.emplace_back(std::make_unique<DIPUStreamDevice>(i));
+// The stream state of each device, created on first use of the device since
+// processes often use a single one of many
+class StreamDevices {
+ public:
+  StreamDevices() : devices_(devproxy::getDeviceCount()) {}
+
+  StreamDevices(const StreamDevices&) = delete;
+  StreamDevices& operator=(const StreamDevices&) = delete;
+
+  ~StreamDevices() {
+    for (auto& device : devices_) {
+      delete device.load(std::memory_order_relaxed);
     }
-    return list;
-  };
+  }
+
+  size_t size() const { return devices_.size(); }
+
+  DIPUStreamDevice* operator[](size_t index) {
+    auto& entry = devices_[index];
+    auto* device = entry.load(std::memory_order_acquire);
+    if (device == nullptr) {
+      std::lock_guard<std::mutex> lk(create_mutex_);
+      device = entry.load(std::memory_order_relaxed);
+      if (device == nullptr) {
+        device = new DIPUStreamDevice(static_cast<devapis::deviceId_t>(index));
+        entry.store(device, std::memory_order_release);
+      }
+    }
+    return device;
+  }
 
-  auto static device_list = make_list();
+ private:
+  std::vector<std::atomic<DIPUStreamDevice*>> devices_;
+  std::mutex create_mutex_;
+};
+
+StreamDevices& StreamDeviceList() {
+  static StreamDevices device_list;
   return device_list;
 }
 
@@ -182,12 +251,25 @@ deviceStream_t DIPUStream::rawstream() const {
       stream_.id());
 }
 
+int DIPUStream::priority() const {
+  return getStreamIdType(id()) == StreamIdType::PRIORITY_POOL ? -1 : 0;
+}
+
+bool DIPUStream::isExternal() const {
+  return getStreamIdType(id()) == StreamIdType::EXT;
+}
+
 DIPUStream getDIPUStreamFromPool(c10::DeviceIndex device_index) {
+  return getDIPUStreamFromPool(false, device_index);
+}
+
+DIPUStream getDIPUStreamFromPool(bool isHighPriority,
+                                 c10::DeviceIndex device_index) {
   device_index = setupDevice(device_index);
   // Initializes the stream pools (once)
   auto& device = *StreamDeviceList()[device_index];
-  device.initPool();
-  return device.getDIPUStreamfromPool();
+  device.initPool(isHighPriority);
+  return device.getDIPUStreamfromPool(isHighPriority);
 }
 
 DIPUStream getDefaultDIPUStream(c10::DeviceIndex device_index) {
@@ -195,16 +277,43 @@ DIPUStream getDefaultDIPUStream(c10::DeviceIndex device_index) {
   return StreamDeviceList()[device_index]->getDefaultDIPUStream();
 }
 
+namespace {
+
+// The current stream of the device this thread looked up last, so that the
+// common lookup skips the device setup and the per-device table
+struct CurrentStreamCache {
+  c10::DeviceIndex device = -1;
+  c10::StreamId stream = 0;
+};
+
+CurrentStreamCache& currentStreamCache() {
+  static thread_local CurrentStreamCache cache;
+  return cache;
+}
+
+}  // namespace
+
 DIPUStream getCurrentDIPUStream(c10::DeviceIndex device_index) {
+  if (device_index == -1) {
+    device_index = devproxy::current_device();
+  }
+  auto& cache = currentStreamCache();
+  if (device_index >= 0 && device_index == cache.device) {
+    return DIPUStream(device_index, cache.stream);
+  }
   device_index = setupDevice(device_index);
-  return DIPUStream(device_index, LocalStreams()[device_index]);
+  cache = {device_index, LocalStreams()[device_index]};
+  return DIPUStream(device_index, cache.stream);
 }
 
-// copy from pytorch, not verify
 DIPUStream getStreamFromExternal(deviceStream_t ext_stream,
                                  c10::DeviceIndex device_index) {
   // The stream pointer will be the actual id
-  return DIPUStream(device_index, reinterpret_cast<int64_t>(ext_stream));
+  auto stream_id = reinterpret_cast<c10::StreamId>(ext_stream);
+  TORCH_CHECK(getStreamIdType(stream_id) == StreamIdType::EXT,
+              "Invalid external stream ", ext_stream,
+              ", it collides with the ids of dipu streams");
+  return DIPUStream(setupDevice(device_index), stream_id);
 }
 
 void setCurrentDIPUStream(DIPUStream stream) {
@@ -212,6 +321,7 @@ void setCurrentDIPUStream(DIPUStream stream) {
   // TODO(assert): assert(setupDevice(device_index) == device_index)
   setupDevice(device_index);
   LocalStreams()[device_index] = stream.unwrap().id();
+  currentStreamCache() = {device_index, stream.unwrap().id()};
 }
 
 }  // namespace dipu
@@ -59,17 +59,33 @@ class DIPU_API DIPUStream {
 
   c10::Stream unwrap() const { return stream_; }
 
+  // -1 for streams of the high priority pool, 0 otherwise. Lower numbers
+  // represent higher priorities as in CUDA.
+  int priority() const;
+
+  // Whether the stream is created outside of dipu and only wrapped, see
+  // getStreamFromExternal
+  bool isExternal() const;
+
   deviceStream_t rawstream() const;
 };
 
 DIPU_API DIPUStream getDIPUStreamFromPool(c10::DeviceIndex device_index = -1);
 
+// Streams are taken round-robin from a low or a high priority pool, the size
+// of both pools is set by DIPU_STREAMS_PER_POOL
+DIPU_API DIPUStream getDIPUStreamFromPool(bool isHighPriority,
+                                          c10::DeviceIndex device_index = -1);
+
 DIPU_API DIPUStream getDefaultDIPUStream(c10::DeviceIndex device_index = -1);
 
 DIPU_API DIPUStream getCurrentDIPUStream(c10::DeviceIndex device_index = -1);
 
 DIPU_API void setCurrentDIPUStream(DIPUStream stream);
 
+// Wrap a stream created by another library so that dipu kernels can run on
+// it directly. The caller keeps the ownership and must keep it alive while
+// the returned stream is in use.
 DIPU_API DIPUStream getStreamFromExternal(deviceStream_t ext_stream,
                                           c10::DeviceIndex device_index);
 
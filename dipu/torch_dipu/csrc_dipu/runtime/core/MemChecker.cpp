@@ -1,6 +1,7 @@
 // Copyright (c) 2023, DeepLink.
 #include "MemChecker.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
@@ -9,22 +10,32 @@
 #include <c10/util/Backtrace.h>
 #include <c10/util/Exception.h>
 
+#include "csrc_dipu/utils/env.hpp"
+
 namespace dipu {
 
 static const int32_t DEFAULT_MAX_BLOCK_NUM = 10000;
 static const int32_t DEFAULT_LOG_INTERVAL = 1000;
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static RuntimeConfig<int32_t> gBacktraceSample(
+    "DIPU_MEM_CHECK_BACKTRACE_SAMPLE", 1);
 
 MemChecker::~MemChecker() {
   if (!enable()) {
     return;
   }
 
-  if (!blocks_.empty()) {
+  if (block_num_ > 0) {
     std::cout << "dipu memory checker: there maybe exist memory leak. "
-              << blocks_.size() << " blocks not released." << std::endl;
-    for (const auto& kv : blocks_) {
-      std::cout << "key: " << kv.first << ", ptr: " << kv.second.first
-                << ", trace: " << kv.second.second << std::endl;
+              << block_num_ << " blocks not released." << std::endl;
+    for (auto& shard : shards_) {
+      for (const auto& kv : shard.blocks) {
+        if (kv.second.home) {
+          std::cout << "key: " << reinterpret_cast<const void*>(kv.first)
+                    << ", size: " << kv.second.size
+                    << ", trace: " << kv.second.trace << std::endl;
+        }
+      }
     }
   }
   std::cout << "dipu memory checker: going to destruction. " << current_state()
@@ -47,6 +58,12 @@ bool MemChecker::enable_backtrace() {
   return enable_trace;
 }
 
+// Capture the backtrace of one in every DIPU_MEM_CHECK_BACKTRACE_SAMPLE
+// allocations, all of them by default
+int32_t MemChecker::backtrace_sample() {
+  return std::max(gBacktraceSample.get(), 1);
+}
+
 int32_t MemChecker::max_block_num() {
   static int32_t max_block = []() -> int32_t {
     const char* str = std::getenv("DIPU_MEM_CHECK_MAX_BLOCK");
@@ -71,11 +88,24 @@ int32_t MemChecker::log_interval() {
   return interval;
 }
 
+uint64_t MemChecker::shardsOf(uintptr_t addr, size_t size) {
+  uintptr_t first = addr >> kRegionShift;
+  uintptr_t last = (addr + std::max<size_t>(size, 1) - 1) >> kRegionShift;
+  if (last - first + 1 >= kNumShards) {
+    return ~uint64_t{0};
+  }
+  uint64_t mask = 0;
+  for (uintptr_t region = first; region <= last; ++region) {
+    mask |= uint64_t{1} << (region % kNumShards);
+  }
+  return mask;
+}
+
 std::string MemChecker::current_state() const {
   std::stringstream stream;
   stream
       << "current block num = "
-      << blocks_.size()
+      << block_num_
       // convert B to MB
       // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
       << ", total_size = " << (total_size_ >> 20) << "MB"
@@ -90,32 +120,36 @@ void MemChecker::insert(const void* ptr, size_t size) {
     return;
   }
 
-  bool may_leak = false;
-  bool print_log = false;
-  std::string state;
-  {
-    std::lock_guard<std::mutex> lck(mtx_);
-    blocks_[ptr] =
-        std::make_pair(size, enable_backtrace() ? c10::get_backtrace() : "");
-    total_size_ += static_cast<int64_t>(size);
-    ++insert_cnt_;
-
-    if (blocks_.size() > max_block_num()) {
-      may_leak = true;
-    } else if (insert_cnt_ % log_interval() == 0) {
-      print_log = true;
-    }
+  auto addr = reinterpret_cast<uintptr_t>(ptr);
+  int64_t count = ++insert_cnt_;
+  std::string trace;
+  if (enable_backtrace() && count % backtrace_sample() == 0) {
+    // outside of the locks, it is by far the slowest part
+    trace = c10::get_backtrace();
+  }
 
-    if (may_leak || print_log) {
-      state = current_state();
+  size_t home = shardOf(addr);
+  uint64_t mask = shardsOf(addr, size);
+  for (size_t i = 0; i < kNumShards; ++i) {
+    if ((mask >> i & 1U) == 0) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lck(shards_[i].mtx);
+    auto& block = shards_[i].blocks[addr];
+    block.size = size;
+    block.home = i == home;
+    if (block.home) {
+      block.trace = std::move(trace);
     }
   }
-
-  if (may_leak) {
-    std::cout << "dipu memory checker: there may be memory leak. " << state
-              << std::endl;
-  } else if (print_log) {
-    std::cout << "dipu memory checker: " << state << std::endl;
+  int64_t blocks = ++block_num_;
+  total_size_ += static_cast<int64_t>(size);
+
+  if (blocks > max_block_num()) {
+    std::cout << "dipu memory checker: there may be memory leak. "
+              << current_state() << std::endl;
+  } else if (count % log_interval() == 0) {
+    std::cout << "dipu memory checker: " << current_state() << std::endl;
   }
 }
 
@@ -124,15 +158,17 @@ void MemChecker::erase(const void* ptr) {
     return;
   }
 
-  bool found = true;
+  auto addr = reinterpret_cast<uintptr_t>(ptr);
+  size_t home = shardOf(addr);
+  bool found = false;
+  size_t size = 0;
   {
-    std::lock_guard<std::mutex> lck(mtx_);
-    auto iter = blocks_.find(ptr);
-    if (iter == blocks_.end()) {
-      found = false;
-    } else {
-      total_size_ -= static_cast<int64_t>(iter->second.first);
-      blocks_.erase(iter);
+    std::lock_guard<std::mutex> lck(shards_[home].mtx);
+    auto iter = shards_[home].blocks.find(addr);
+    if (iter != shards_[home].blocks.end() && iter->second.home) {
+      found = true;
+      size = iter->second.size;
+      shards_[home].blocks.erase(iter);
     }
   }
 
@@ -140,7 +176,18 @@ void MemChecker::erase(const void* ptr) {
     std::cout
         << "dipu memory checker: not found point address going to free, ptr = "
         << ptr << std::endl;
+    return;
   }
+
+  uint64_t mask = shardsOf(addr, size) & ~(uint64_t{1} << home);
+  for (size_t i = 0; i < kNumShards; ++i) {
+    if ((mask >> i & 1U) != 0) {
+      std::lock_guard<std::mutex> lck(shards_[i].mtx);
+      shards_[i].blocks.erase(addr);
+    }
+  }
+  --block_num_;
+  total_size_ -= static_cast<int64_t>(size);
 }
 
 void MemChecker::check(const at::Tensor& input) {
@@ -153,10 +200,16 @@ void MemChecker::check(const void* ptr) {
     return;
   }
 
-  bool found = true;
+  auto addr = reinterpret_cast<uintptr_t>(ptr);
+  auto& shard = shards_[shardOf(addr)];
+  bool found = false;
   {
-    std::lock_guard<std::mutex> lck(mtx_);
-    found = (blocks_.find(ptr) != blocks_.end());
+    std::lock_guard<std::mutex> lck(shard.mtx);
+    auto iter = shard.blocks.upper_bound(addr);
+    if (iter != shard.blocks.begin()) {
+      --iter;
+      found = addr < iter->first + std::max<size_t>(iter->second.size, 1);
+    }
   }
 
   if (!found) {
@@ -1,11 +1,12 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <map>
 #include <mutex>
 #include <string>
-#include <unordered_map>
-#include <utility>
 
 #include <ATen/Tensor.h>
 
@@ -16,22 +17,51 @@ class MemChecker final {
   static MemChecker& instance();
   static bool enable();
   static bool enable_backtrace();
+  static int32_t backtrace_sample();
   static int32_t max_block_num();
   static int32_t log_interval();
 
   void insert(const void* ptr, size_t size);
   void erase(const void* ptr);
+  // `ptr` may point anywhere inside a block
   void check(const at::Tensor& input);
   void check(const void* ptr);
   ~MemChecker();
 
  private:
+  // Blocks are sharded by the address regions they cover, so that threads
+  // working on different memory don't contend and a block containing any
+  // pointer is found in the shard of its region
+  static constexpr size_t kNumShards = 64;
+  static constexpr unsigned kRegionShift = 24;  // 16MB
+
+  struct Block {
+    size_t size = 0;
+    // Only the shard of the start of a block counts it and keeps its trace
+    bool home = false;
+    std::string trace;
+  };
+
+  struct Shard {
+    std::mutex mtx;
+    // Live blocks never overlap, so the one before the first starting after
+    // a pointer is the only one which may contain it
+    std::map<uintptr_t, Block> blocks;
+  };
+
+  static size_t shardOf(uintptr_t addr) {
+    return (addr >> kRegionShift) % kNumShards;
+  }
+
+  // Bit i set if the block covers a region of shard i
+  static uint64_t shardsOf(uintptr_t addr, size_t size);
+
   std::string current_state() const;
 
-  std::mutex mtx_;
-  std::unordered_map<const void*, std::pair<size_t, std::string>> blocks_;
-  int64_t total_size_ = 0;
-  int64_t insert_cnt_ = 0;
+  std::array<Shard, kNumShards> shards_;
+  std::atomic<int64_t> block_num_{0};
+  std::atomic<int64_t> total_size_{0};
+  std::atomic<int64_t> insert_cnt_{0};
 };
 
 }  // namespace dipu
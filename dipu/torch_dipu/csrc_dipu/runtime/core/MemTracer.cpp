@@ -0,0 +1,108 @@
+// Copyright (c) 2023, DeepLink.
+#include "MemTracer.h"
+
+#include <chrono>
+#include <cstdlib>
+
+#include <c10/util/Backtrace.h>
+
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+static const size_t DEFAULT_MAX_TRACE_ENTRIES = 100000;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> MemTracer::enabled_{std::getenv("DIPU_MEM_TRACE") !=
+                                      nullptr};
+
+MemTracer::MemTracer()
+    : record_stacks_(std::getenv("DIPU_MEM_TRACE_ENABLE_BACKTRACE") !=
+                     nullptr),
+      max_entries_(get_env_or_default("DIPU_MEM_TRACE_MAX_ENTRIES",
+                                      DEFAULT_MAX_TRACE_ENTRIES)) {}
+
+MemTracer& MemTracer::instance() {
+  static MemTracer tracer;
+  return tracer;
+}
+
+const char* MemTracer::actionName(Action action) {
+  switch (action) {
+    case Action::kAlloc:
+      return "alloc";
+    case Action::kFreeRequested:
+      return "free_requested";
+    case Action::kFreeCompleted:
+      return "free_completed";
+    case Action::kSegmentAlloc:
+      return "segment_alloc";
+    case Action::kSegmentFree:
+      return "segment_free";
+    case Action::kSegmentMap:
+      return "segment_map";
+    case Action::kSegmentUnmap:
+      return "segment_unmap";
+    case Action::kOOM:
+      return "oom";
+  }
+  return "unknown";
+}
+
+void MemTracer::enable(bool record_stacks, size_t max_entries) {
+  std::lock_guard<std::mutex> lck(mtx_);
+  record_stacks_.store(record_stacks, std::memory_order_relaxed);
+  max_entries_ = max_entries;
+  next_ = 0;
+  entries_.clear();
+  enabled_.store(max_entries > 0, std::memory_order_relaxed);
+}
+
+void MemTracer::disable() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+void MemTracer::record(Action action, c10::DeviceIndex device,
+                       const void* addr, size_t size, c10::StreamId stream) {
+  if (!enabled()) {
+    return;
+  }
+
+  auto time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+  Entry entry{action,
+              device,
+              reinterpret_cast<uintptr_t>(addr),
+              size,
+              stream,
+              static_cast<int64_t>(time_us),
+              {}};
+  if (record_stacks_.load(std::memory_order_relaxed)) {
+    // skip record() itself and the allocator helper calling it
+    entry.frames = c10::get_backtrace(/*frames_to_skip=*/2);
+  }
+
+  std::lock_guard<std::mutex> lck(mtx_);
+  if (max_entries_ == 0) {
+    return;
+  }
+  if (entries_.size() < max_entries_) {
+    entries_.push_back(std::move(entry));
+  } else {
+    entries_[next_] = std::move(entry);
+    next_ = (next_ + 1) % max_entries_;
+  }
+}
+
+std::vector<MemTracer::Entry> MemTracer::entries() const {
+  std::lock_guard<std::mutex> lck(mtx_);
+  std::vector<Entry> result;
+  result.reserve(entries_.size());
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    result.push_back(entries_[(next_ + i) % entries_.size()]);
+  }
+  return result;
+}
+
+}  // namespace dipu
@@ -0,0 +1,73 @@
+// Copyright (c) 2023, DeepLink.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <c10/core/Device.h>
+#include <c10/core/Stream.h>
+
+#include "csrc_dipu/runtime/device/basedef.h"
+
+namespace dipu {
+
+// Ring buffer of allocator events, the layout of the entries follows the
+// device traces of torch.cuda.memory._snapshot() so that they can be viewed
+// by PyTorch's memory visualizer.
+class DIPU_API MemTracer final {
+ public:
+  enum class Action : uint8_t {
+    kAlloc,
+    kFreeRequested,
+    kFreeCompleted,
+    kSegmentAlloc,
+    kSegmentFree,
+    kSegmentMap,
+    kSegmentUnmap,
+    kOOM,
+  };
+
+  struct Entry {
+    Action action;
+    c10::DeviceIndex device;
+    uintptr_t addr;
+    size_t size;
+    c10::StreamId stream;
+    int64_t time_us;
+    std::string frames;
+  };
+
+  static MemTracer& instance();
+
+  // Checked on allocator hot paths, so keep it a single relaxed load
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  static const char* actionName(Action action);
+
+  // Start recording, previous entries are dropped
+  void enable(bool record_stacks, size_t max_entries);
+  void disable();
+
+  void record(Action action, c10::DeviceIndex device, const void* addr,
+              size_t size, c10::StreamId stream = 0);
+
+  // Oldest entry first
+  std::vector<Entry> entries() const;
+
+ private:
+  MemTracer();
+
+  static std::atomic<bool> enabled_;
+
+  mutable std::mutex mtx_;
+  std::atomic<bool> record_stacks_;
+  size_t max_entries_ = 0;
+  // Index of the oldest entry once the buffer is full
+  size_t next_ = 0;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace dipu
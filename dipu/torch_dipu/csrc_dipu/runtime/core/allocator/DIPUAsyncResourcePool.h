@@ -1,18 +1,75 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <mutex>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <c10/util/SmallVector.h>
 
 #include "csrc_dipu/runtime/core/DIPUEvent.h"
+#include "csrc_dipu/runtime/core/DIPUStream.h"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 
+// Track freed resources by the sequence numbers of the streams using them
+// instead of recording events for each of them
+extern const bool kStreamOrderedAsyncResourcePool;
+
+// Max number of resources sharing a single event in the stream-ordered mode
+extern RuntimeConfig<size_t> gStreamOrderedFlushInterval;
+
+// Streams using a block besides the one it was allocated on. There are
+// rarely more than one, so they are kept inline and searched linearly.
+class StreamSet {
+  c10::SmallVector<DIPUStream, 2> streams_;
+
+ public:
+  using const_iterator = c10::SmallVector<DIPUStream, 2>::const_iterator;
+
+  void insert(const DIPUStream& stream) {
+    if (std::find(streams_.begin(), streams_.end(), stream) ==
+        streams_.end()) {
+      streams_.push_back(stream);
+    }
+  }
+
+  bool empty() const { return streams_.empty(); }
+
+  size_t size() const { return streams_.size(); }
+
+  const_iterator begin() const { return streams_.begin(); }
+
+  const_iterator end() const { return streams_.end(); }
+};
+
 template <class T>
 class AsyncResourcePool {
  public:
   virtual void add(const T& t, std::deque<DIPUEvent>& events) = 0;
+  // `t` can be reused after all pending work on `streams` is done
+  virtual void add(const T& t, const StreamSet& streams) {
+    std::deque<DIPUEvent> events;
+    for (const auto& stream : streams) {
+      events.emplace_back(devapis::EventFlags::DISABLE_TIMING);
+      events.back().record(stream);
+    }
+    add(t, events);
+  }
+  // Take the first resource matching `pred` even if it is still in use, and
+  // make `stream` wait for the work using it instead. Returns false if none
+  // matches.
+  virtual bool steal(const std::function<bool(const T&)>& pred,
+                     const DIPUStream& stream, T& out) {
+    return false;
+  }
   virtual T get() = 0;
   virtual bool ready() const = 0;
   virtual bool empty() const = 0;
@@ -21,19 +78,109 @@ class AsyncResourcePool {
 
 template <class T, at::DeviceType device_type, int algorithm>
 class AsyncResourcePoolImpl : public AsyncResourcePool<T> {
-  using Res = std::tuple<T, std::deque<DIPUEvent>>;
+  // (stream, sequence number of the stream when `t` is added)
+  using Tag = std::pair<DIPUStream, uint64_t>;
+  using Res = std::tuple<T, std::deque<DIPUEvent>, std::vector<Tag>>;
   std::deque<Res> list_;
   using mutex_t = std::mutex;
   mutable mutex_t mutex_;
 
+  // Resources added while `current` is the sequence number of a stream are
+  // released together by one event recorded on it.
+  struct Timeline {
+    uint64_t current = 1;
+    // All sequence numbers <= `completed` are done
+    uint64_t completed = 0;
+    size_t pending = 0;
+    std::deque<std::pair<uint64_t, DIPUEvent>> recorded;
+  };
+  mutable std::unordered_map<DIPUStream, Timeline> timelines_;
+
+  static void advance(const DIPUStream& stream, Timeline& timeline) {
+    timeline.recorded.emplace_back(
+        timeline.current, DIPUEvent(devapis::EventFlags::DISABLE_TIMING));
+    timeline.recorded.back().second.record(stream);
+    ++timeline.current;
+    timeline.pending = 0;
+  }
+
+  bool reached(const Tag& tag) const {
+    auto& timeline = timelines_[tag.first];
+    if (tag.second <= timeline.completed) {
+      return true;
+    }
+    if (tag.second == timeline.current) {
+      // Waited on before the interval is full, don't wait for more resources
+      advance(tag.first, timeline);
+    }
+    while (!timeline.recorded.empty() &&
+           timeline.recorded.front().second.query()) {
+      timeline.completed = timeline.recorded.front().first;
+      timeline.recorded.pop_front();
+    }
+    return tag.second <= timeline.completed;
+  }
+
  public:
   void add(const T& t, std::deque<DIPUEvent>& events) override {
     std::lock_guard<mutex_t> lk(mutex_);
     if (events.empty()) {
-      list_.emplace_front(t, std::move(events));
+      list_.emplace_front(t, std::move(events), std::vector<Tag>());
     } else {
-      list_.emplace_back(t, std::move(events));
+      list_.emplace_back(t, std::move(events), std::vector<Tag>());
+    }
+  }
+
+  void add(const T& t, const StreamSet& streams) override {
+    if (!kStreamOrderedAsyncResourcePool) {
+      AsyncResourcePool<T>::add(t, streams);
+      return;
+    }
+    std::lock_guard<mutex_t> lk(mutex_);
+    if (streams.empty()) {
+      list_.emplace_front(t, std::deque<DIPUEvent>(), std::vector<Tag>());
+      return;
+    }
+    std::vector<Tag> tags;
+    tags.reserve(streams.size());
+    for (const auto& stream : streams) {
+      auto& timeline = timelines_[stream];
+      tags.emplace_back(stream, timeline.current);
+      if (++timeline.pending >= gStreamOrderedFlushInterval.get()) {
+        advance(stream, timeline);
+      }
     }
+    list_.emplace_back(t, std::deque<DIPUEvent>(), std::move(tags));
+  }
+
+  bool steal(const std::function<bool(const T&)>& pred,
+             const DIPUStream& stream, T& out) override {
+    std::lock_guard<mutex_t> lk(mutex_);
+    auto iter = std::find_if(list_.begin(), list_.end(), [&pred](Res& res) {
+      return pred(std::get<0>(res));
+    });
+    if (iter == list_.end()) {
+      return false;
+    }
+    for (auto& event : std::get<1>(*iter)) {
+      event.wait(stream);
+    }
+    for (const auto& tag : std::get<2>(*iter)) {
+      if (tag.first == stream || reached(tag)) {
+        continue;
+      }
+      auto& timeline = timelines_[tag.first];
+      // `reached` recorded an event covering the tag if there was none
+      for (auto& recorded : timeline.recorded) {
+        if (recorded.first >= tag.second) {
+          recorded.second.wait(stream);
+          break;
+        }
+      }
+    }
+    out = std::get<0>(*iter);
+    list_.erase(iter);
+    return true;
   }
 
   T get() override {
@@ -60,6 +207,12 @@ class AsyncResourcePoolImpl : public AsyncResourcePool<T> {
       }
     }
 
+    for (const auto& tag : std::get<2>(list_.front())) {
+      if (!reached(tag)) {
+        return false;
+      }
+    }
+
     return true;
   }
 
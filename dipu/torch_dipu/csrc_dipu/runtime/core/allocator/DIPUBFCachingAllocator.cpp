@@ -1,12 +1,17 @@
 // Copyright (c) 2023, DeepLink.
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <stack>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "csrc_dipu/runtime/devproxy/deviceproxy.h"
 #include "csrc_dipu/utils/env.hpp"
 
 #include "DIPUCachingAllocator.h"
@@ -18,14 +23,64 @@ namespace dipu {
 const size_t kMaxExtendSize = get_env_or_default("DIPU_MAX_EXTEND_SIZE", 1024)
                               << 20U;
 
+// Chunks not larger than this (in KB) are served from a per-thread cache, set
+// it to 0 to disable the per-thread cache.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kMaxThreadCachedSize =
+    get_env_or_default("DIPU_BF_THREAD_CACHE_MAX_SIZE", 64) << 10U;
+
+// Max number of chunks kept by each size class of a per-thread cache.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kThreadCacheBinCapacity =
+    get_env_or_default("DIPU_BF_THREAD_CACHE_BIN_CAPACITY", 8);
+
+// Reserve a virtual address range per stream and map physical memory on
+// demand, so that all chunks are adjacent and can always be coalesced. Only
+// works for vendors supporting virtual memory management.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kExpandableSegments =
+    get_env_or_default("DIPU_BF_EXPANDABLE_SEGMENTS", 0) > 0;
+
+// Also unmap the free pages inside expandable segments when emptying the
+// cache, so that memory held by fragments can be mapped at the end of a
+// segment for a larger chunk.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kExpandableSegmentsDefrag =
+    get_env_or_default("DIPU_BF_EXPANDABLE_SEGMENTS_DEFRAG", 0) > 0;
+
+// Size (in MB) of the virtual range reserved by each expandable segment, 0
+// means the total memory of the device.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kExpandableSegmentSize =
+    get_env_or_default("DIPU_BF_EXPANDABLE_SEGMENT_SIZE", size_t{0}) << 20U;
+
+// Before growing the cache for a large chunk, reuse a freed one still used
+// by other streams, making the current stream wait for them.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kCrossStreamReuse =
+    get_env_or_default("DIPU_BF_CROSS_STREAM_REUSE", 0) > 0;
+
 class BFCachingAllocatorImpl {
  public:
   using allocate_fn_t = std::function<void*(size_t)>;
-  using deallocate_fn_t = std::function<void(void*)>;
+  using deallocate_fn_t = std::function<void(void*, size_t)>;
+  // Count mapped bytes against the memory limit, false if beyond it
+  using hold_fn_t = std::function<bool(size_t)>;
+  using unhold_fn_t = std::function<void(size_t)>;
+  // Return (granularity, bytes to reserve), granularity is 0 if expandable
+  // segments are not available
+  using expandable_fn_t = std::function<std::pair<size_t, size_t>()>;
+  // (ptr, chunk id)
+  using Block = std::pair<void*, int>;
 
  private:
   allocate_fn_t allocate_fn;
   deallocate_fn_t deallocate_fn;
+  hold_fn_t hold_fn;
+  unhold_fn_t unhold_fn;
+  expandable_fn_t expandable_fn;
+  AllocatorStats* stats_ = nullptr;
+  const c10::Device* device_ = nullptr;
   // Number of first level bins (exponentially)
   static constexpr int kNumBigBins = 32;
   // Number of second level bins (linearly)
@@ -38,12 +93,21 @@ class BFCachingAllocatorImpl {
 
   size_t cachedBytes = 0;
   size_t allocatedBytes = 0;
+  // Bumped whenever a chunk becomes free, orders chunks by idle time
+  uint64_t idleClock_ = 0;
+
+  // Mapping granularity of expandable segments, 0 means disabled
+  size_t granularity_ = 0;
+  size_t segmentReserveSize_ = 0;
+  bool expandableChecked_ = false;
 
   void* allocateOnDevice(size_t nbytes) {
     void* ptr = nullptr;
     try {
       ptr = allocate_fn(nbytes);
       cachedBytes += nbytes;
+      stats_->add(AllocatorStats::kSegmentAlloc);
+      trace(MemTracer::Action::kSegmentAlloc, ptr, nbytes);
     } catch (...) {
     }
 
@@ -55,8 +119,20 @@ class BFCachingAllocatorImpl {
   void releaseOnDevice(void* ptr, size_t nbytes) {
     DIPU_DEBUG_ALLOCATOR(4, "BFCachingAllocatorImpl: releaseOnDevice "
                                 << nbytes << " nbytes, ptr:" << ptr);
-    deallocate_fn(ptr);
+    trace(MemTracer::Action::kSegmentFree, ptr, nbytes);
+    deallocate_fn(ptr, nbytes);
     cachedBytes -= nbytes;
+    stats_->add(AllocatorStats::kSegmentFree);
+  }
+
+  void trace(MemTracer::Action action, const void* ptr, size_t nbytes) const {
+    if (device_ == nullptr || device_->type() != dipu::DIPU_DEVICE_TYPE) {
+      return;
+    }
+    if (MemTracer::enabled()) {
+      MemTracer::instance().record(action, device_->index(), ptr, nbytes);
+    }
+    notifySegmentHooks(action, device_->index(), ptr, nbytes);
   }
 
   // Chunks and bins obtained by a single stream
@@ -70,6 +146,22 @@ class BFCachingAllocatorImpl {
     // The extending size next time
     size_t currExtendSize_ = kMinExtendSize;
 
+    // Virtual range mapped on demand, [base, base + mapped) is backed by
+    // physical memory except for the `holes` chunks unmapped by
+    // defragmentation. `tail` is the last chunk of the mapped part.
+    struct Segment {
+      char* base = nullptr;
+      size_t reserved = 0;
+      size_t mapped = 0;
+      int tail = 0;
+      size_t holes = 0;
+
+      bool contains(const void* ptr) const {
+        const char* p = static_cast<const char*>(ptr);
+        return base != nullptr && p >= base && p < base + reserved;
+      }
+    } segment;
+
     explicit StreamSet(size_t id) : id(id) {}
 
     // Find an available bin greater than or equal to `least`
@@ -112,6 +204,9 @@ class BFCachingAllocatorImpl {
 
   struct Chunk {
     bool allocated = false;
+    // Unmapped range of an expandable segment, also marked as allocated so
+    // that it is never coalesced nor handed out
+    bool hole = false;
     int binId = -1;
     int prevChunkInMem = 0, nextChunkInMem = 0;
     int prevChunkInList = 0, nextChunkInList = 0;
@@ -120,6 +215,8 @@ class BFCachingAllocatorImpl {
     size_t size;
     // The stream id when created
     size_t stream;
+    // `idleClock_` when the chunk was put into a bin
+    uint64_t idleSince = 0;
 
     Chunk(void* ptr, size_t size, size_t stream)
         : ptr(ptr), size(size), stream(stream) {}
@@ -139,6 +236,92 @@ class BFCachingAllocatorImpl {
   using mutex_t = SpinMutex;
   mutable mutex_t mut_;
 
+  // Per-thread magazine of small chunks, indexed by `nbytes` size class.
+  // Chunks inside are still marked as allocated in `chunks_`, so they never
+  // appear in the shared bins until the cache is flushed.
+  struct ThreadCache {
+    // Only contended when another thread flushes this cache
+    mutex_t mut;
+    // Set when the owner thread exits, the cache is dropped on next flush
+    std::atomic<bool> orphaned{false};
+    // Set when the allocator is destroyed, the owner thread drops the cache
+    // so that a later allocator at the same address never picks it up
+    std::atomic<bool> detached{false};
+    std::vector<std::vector<Block>> bins;
+
+    explicit ThreadCache(size_t numBins) : bins(numBins) {}
+  };
+
+  using ThreadCacheHandle = std::shared_ptr<ThreadCache>;
+  // All per-thread caches of this allocator, guarded by `mut_`
+  std::vector<ThreadCacheHandle> threadCaches_;
+
+  struct ThreadCacheHolder {
+    std::vector<std::pair<const BFCachingAllocatorImpl*, ThreadCacheHandle>>
+        caches;
+
+    ~ThreadCacheHolder() {
+      for (auto& item : caches) {
+        item.second->orphaned.store(true, std::memory_order_release);
+      }
+    }
+  };
+
+  static bool isThreadCacheable(size_t nbytes) {
+    return nbytes <= kMaxThreadCachedSize && kThreadCacheBinCapacity > 0;
+  }
+
+  static size_t threadCacheBinForSize(size_t nbytes) {
+    // `nbytes` is already rounded to `kMinAllocationSize`
+    return nbytes / kMinAllocationSize - 1;
+  }
+
+  ThreadCache& localThreadCache() {
+    static thread_local ThreadCacheHolder holder;
+    holder.caches.erase(
+        std::remove_if(holder.caches.begin(), holder.caches.end(),
+                       [](const auto& item) {
+                         return item.second->detached.load(
+                             std::memory_order_acquire);
+                       }),
+        holder.caches.end());
+    for (auto& item : holder.caches) {
+      if (item.first == this) {
+        return *item.second;
+      }
+    }
+    auto cache = std::make_shared<ThreadCache>(kMaxThreadCachedSize /
+                                               kMinAllocationSize);
+    {
+      std::lock_guard<mutex_t> lk(mut_);
+      threadCaches_.push_back(cache);
+    }
+    holder.caches.emplace_back(this, cache);
+    return *cache;
+  }
+
+  void flushThreadCacheWithoutLock(ThreadCache& cache) {
+    std::lock_guard<mutex_t> lk(cache.mut);
+    for (auto& bin : cache.bins) {
+      for (const auto& block : bin) {
+        releaseWithoutLock(block.second);
+      }
+      bin.clear();
+    }
+  }
+
+  void flushThreadCachesWithoutLock() {
+    for (auto& cache : threadCaches_) {
+      flushThreadCacheWithoutLock(*cache);
+    }
+    threadCaches_.erase(
+        std::remove_if(threadCaches_.begin(), threadCaches_.end(),
+                       [](const ThreadCacheHandle& cache) {
+                         return cache->orphaned.load(std::memory_order_acquire);
+                       }),
+        threadCaches_.end());
+  }
+
   static size_t roundBytes(size_t nbytes) {
     return ((nbytes - 1) | (kMinAllocationSize - 1)) + 1;
   }
@@ -159,6 +342,12 @@ class BFCachingAllocatorImpl {
     return id;
   }
 
+  // Recycled chunks have no memory, so they are skipped by snapshots
+  void recycleChunk(int id) {
+    chunks_[id].ptr = nullptr;
+    recycleIds_.push(id);
+  }
+
   static int binIdForSize(size_t nbytes) {
     // Big bin range:
     //      [2^`bigBinIdx`, 2^(`bigBinIdx`+1)), length: 2^`bigBinIdx`
@@ -205,6 +394,7 @@ class BFCachingAllocatorImpl {
   void insertChunkIntoBin(int id) {
     int binId = (chunks_[id].binId = binIdForSize(chunks_[id].size));
     auto& set = streamSets_[chunks_[id].stream];
+    chunks_[id].idleSince = ++idleClock_;
     set->set(binId);
     linkChunkInList(set->binHeads_[binId], id,
                     chunks_[set->binHeads_[binId]].nextChunkInList);
@@ -240,13 +430,18 @@ class BFCachingAllocatorImpl {
   }
 
   void shrink(StreamSetHandle& set) {
+    trimSegment(set);
+    if (kExpandableSegmentsDefrag) {
+      punchHoles(set);
+    }
     for (int binHead : set->binHeads_) {
       int k = chunks_[binHead].nextChunkInList;
       while (k) {
-        if (chunks_[k].isMonoBlock()) {
+        if (chunks_[k].isMonoBlock() &&
+            !set->segment.contains(chunks_[k].ptr)) {
           releaseOnDevice(chunks_[k].ptr, chunks_[k].size);
           removeChunkFromBin(k);
-          recycleIds_.push(k);
+          recycleChunk(k);
         }
         k = chunks_[k].nextChunkInList;
       }
@@ -254,6 +449,7 @@ class BFCachingAllocatorImpl {
   }
 
   int split(int id, size_t nbytes) {
+    stats_->add(AllocatorStats::kSplit);
     void* ptr = static_cast<char*>(chunks_[id].ptr) + nbytes;
     size_t const size = chunks_[id].size - nbytes;
 
@@ -263,12 +459,23 @@ class BFCachingAllocatorImpl {
     linkChunkInMem(id, newId, chunks_[id].nextChunkInMem);
     insertChunkIntoBin(newId);
 
+    auto& segment = streamSets_[chunks_[id].stream]->segment;
+    if (segment.tail == id) {
+      segment.tail = newId;
+    }
+
     return id;
   }
 
   int merge(int c1, int c2) {
+    stats_->add(AllocatorStats::kMerge);
     chunks_[c1].size += chunks_[c2].size;
     removeChunkInMem(c1, chunks_[c2].nextChunkInMem);
+
+    auto& segment = streamSets_[chunks_[c1].stream]->segment;
+    if (segment.tail == c2) {
+      segment.tail = c1;
+    }
     return c1;
   }
 
@@ -277,7 +484,7 @@ class BFCachingAllocatorImpl {
     if (next && !chunks_[next].allocated) {
       removeChunkFromBin(next);
       id = merge(id, next);
-      recycleIds_.push(next);
+      recycleChunk(next);
     }
 
     int prev = chunks_[id].prevChunkInMem;
@@ -285,13 +492,248 @@ class BFCachingAllocatorImpl {
       removeChunkFromBin(prev);
       int oldId = id;
       id = merge(prev, id);
-      recycleIds_.push(oldId);
+      recycleChunk(oldId);
     }
 
     return id;
   }
 
+  static size_t roundUp(size_t nbytes, size_t alignment) {
+    return (nbytes + alignment - 1) / alignment * alignment;
+  }
+
+  bool initSegment(StreamSetHandle& set) {
+    if (!expandableChecked_) {
+      expandableChecked_ = true;
+      if (expandable_fn) {
+        std::tie(granularity_, segmentReserveSize_) = expandable_fn();
+      }
+      DIPU_DEBUG_ALLOCATOR(4, "BFCachingAllocatorImpl: expandable segment "
+                                  << "granularity:" << granularity_
+                                  << ", reserve:" << segmentReserveSize_);
+    }
+    if (granularity_ == 0) {
+      return false;
+    }
+    auto& segment = set->segment;
+    if (segment.base == nullptr) {
+      size_t reserved = roundUp(segmentReserveSize_, granularity_);
+      void* ptr = nullptr;
+      if (devproxy::reserveVirtualMem(&ptr, reserved) !=
+          devproxy::OpStatus::SUCCESS) {
+        // No address space, never try again
+        granularity_ = 0;
+        return false;
+      }
+      segment.base = static_cast<char*>(ptr);
+      segment.reserved = reserved;
+    }
+    return true;
+  }
+
+  // Map more physical memory at the end of the segment. The returned chunk is
+  // already coalesced with the free tail chunk.
+  int extendSegment(size_t nbytes, StreamSetHandle& set) {
+    auto& segment = set->segment;
+    int tail = segment.tail;
+    size_t freeTailBytes =
+        (tail && !chunks_[tail].allocated) ? chunks_[tail].size : 0;
+    size_t bytes = std::max(
+        roundUp(nbytes - std::min(nbytes, freeTailBytes), granularity_),
+        granularity_);
+    if (segment.mapped + bytes > segment.reserved) {
+      return 0;
+    }
+    void* ptr = segment.base + segment.mapped;
+    if (!hold_fn(bytes)) {
+      return 0;
+    }
+    if (devproxy::mapVirtualMem(ptr, bytes) != devproxy::OpStatus::SUCCESS) {
+      unhold_fn(bytes);
+      return 0;
+    }
+    DIPU_DEBUG_ALLOCATOR(
+        4, "BFCachingAllocatorImpl: map " << bytes << " nbytes, ptr:" << ptr);
+    segment.mapped += bytes;
+    cachedBytes += bytes;
+    stats_->add(AllocatorStats::kSegmentAlloc);
+    trace(MemTracer::Action::kSegmentMap, ptr, bytes);
+
+    int id = newChunk(ptr, bytes, set->id);
+    if (tail) {
+      linkChunkInMem(tail, id, 0);
+    }
+    segment.tail = id;
+    return coalesce(id);
+  }
+
+  // Unmap the free physical memory at the end of the segment
+  void trimSegment(StreamSetHandle& set) {
+    auto& segment = set->segment;
+    int tail = segment.tail;
+    if (!tail || chunks_[tail].allocated) {
+      return;
+    }
+    auto offset = static_cast<size_t>(static_cast<char*>(chunks_[tail].ptr) -
+                                      segment.base);
+    char* start = segment.base + roundUp(offset, granularity_);
+    char* end = segment.base + segment.mapped;
+    if (start >= end) {
+      return;
+    }
+    auto bytes = static_cast<size_t>(end - start);
+    DIPU_DEBUG_ALLOCATOR(4, "BFCachingAllocatorImpl: unmap "
+                                << bytes << " nbytes, ptr:"
+                                << static_cast<void*>(start));
+    removeChunkFromBin(tail);
+    trace(MemTracer::Action::kSegmentUnmap, start, bytes);
+    devproxy::unmapVirtualMem(start, bytes);
+    unhold_fn(bytes);
+    segment.mapped -= bytes;
+    cachedBytes -= bytes;
+    stats_->add(AllocatorStats::kSegmentFree);
+    if (start == chunks_[tail].ptr) {
+      int prev = chunks_[tail].prevChunkInMem;
+      removeChunkInMem(prev, 0);
+      segment.tail = prev;
+      recycleChunk(tail);
+      // Holes at the end are given back to the unmapped range
+      while (segment.tail && chunks_[segment.tail].hole) {
+        int hole = segment.tail;
+        segment.mapped = static_cast<size_t>(
+            static_cast<char*>(chunks_[hole].ptr) - segment.base);
+        --segment.holes;
+        prev = chunks_[hole].prevChunkInMem;
+        removeChunkInMem(prev, 0);
+        segment.tail = prev;
+        recycleChunk(hole);
+      }
+    } else {
+      chunks_[tail].size -= bytes;
+      insertChunkIntoBin(tail);
+    }
+  }
+
+  // Unmap the pages of [start, end) inside free chunk `id`, the pages become a
+  // hole chunk and the rest of `id` stays free around it
+  void punchHole(StreamSetHandle& set, int id, char* start, char* end) {
+    auto& segment = set->segment;
+    auto bytes = static_cast<size_t>(end - start);
+    DIPU_DEBUG_ALLOCATOR(4, "BFCachingAllocatorImpl: unmap hole "
+                                << bytes << " nbytes, ptr:"
+                                << static_cast<void*>(start));
+    removeChunkFromBin(id);
+    trace(MemTracer::Action::kSegmentUnmap, start, bytes);
+    devproxy::unmapVirtualMem(start, bytes);
+    unhold_fn(bytes);
+    cachedBytes -= bytes;
+    stats_->add(AllocatorStats::kSegmentFree);
+
+    char* chunkEnd = static_cast<char*>(chunks_[id].ptr) + chunks_[id].size;
+    int hole = id;
+    if (start > chunks_[id].ptr) {
+      chunks_[id].size =
+          static_cast<size_t>(start - static_cast<char*>(chunks_[id].ptr));
+      hole = newChunk(start, bytes, set->id);
+      linkChunkInMem(id, hole, chunks_[id].nextChunkInMem);
+      insertChunkIntoBin(id);
+    }
+    chunks_[hole].size = bytes;
+    chunks_[hole].allocated = true;
+    chunks_[hole].hole = true;
+    ++segment.holes;
+    if (end < chunkEnd) {
+      int rest = newChunk(end, static_cast<size_t>(chunkEnd - end), set->id);
+      linkChunkInMem(hole, rest, chunks_[hole].nextChunkInMem);
+      insertChunkIntoBin(rest);
+      if (segment.tail == id) {
+        segment.tail = rest;
+      }
+    } else if (segment.tail == id) {
+      segment.tail = hole;
+    }
+  }
+
+  // Unmap the whole pages of free chunks in the segment, so that the end of
+  // this or another segment can map the memory for a larger chunk
+  void punchHoles(StreamSetHandle& set) {
+    auto& segment = set->segment;
+    int k = segment.tail;
+    while (k) {
+      int prev = chunks_[k].prevChunkInMem;
+      if (!chunks_[k].allocated) {
+        auto begin = static_cast<size_t>(static_cast<char*>(chunks_[k].ptr) -
+                                         segment.base);
+        size_t end = (begin + chunks_[k].size) / granularity_ * granularity_;
+        begin = roundUp(begin, granularity_);
+        if (begin < end) {
+          punchHole(set, k, segment.base + begin, segment.base + end);
+        }
+      }
+      k = prev;
+    }
+  }
+
+  // Map the holes of the segment again, returns whether any was mapped
+  bool fillHoles(StreamSetHandle& set) {
+    auto& segment = set->segment;
+    bool filled = false;
+    int k = segment.tail;
+    while (k && segment.holes > 0) {
+      if (chunks_[k].hole) {
+        void* ptr = chunks_[k].ptr;
+        size_t bytes = chunks_[k].size;
+        if (!hold_fn(bytes)) {
+          break;
+        }
+        if (devproxy::mapVirtualMem(ptr, bytes) !=
+            devproxy::OpStatus::SUCCESS) {
+          unhold_fn(bytes);
+          break;
+        }
+        DIPU_DEBUG_ALLOCATOR(4, "BFCachingAllocatorImpl: map hole "
+                                    << bytes << " nbytes, ptr:" << ptr);
+        cachedBytes += bytes;
+        stats_->add(AllocatorStats::kSegmentAlloc);
+        trace(MemTracer::Action::kSegmentMap, ptr, bytes);
+        --segment.holes;
+        chunks_[k].hole = false;
+        chunks_[k].allocated = false;
+        k = coalesce(k);
+        insertChunkIntoBin(k);
+        filled = true;
+      }
+      k = chunks_[k].prevChunkInMem;
+    }
+    return filled;
+  }
+
+  void releaseSegment(StreamSetHandle& set) {
+    auto& segment = set->segment;
+    if (segment.base != nullptr && segment.mapped == 0) {
+      devproxy::releaseVirtualMem(segment.base, segment.reserved);
+      segment = {};
+    }
+  }
+
   int extend(size_t nbytes, StreamSetHandle& set) {
+    if (initSegment(set)) {
+      int id = extendSegment(nbytes, set);
+      if (!id) {
+        // Free pages mapped by other chunks may help
+        emptyCacheWithoutLock();
+        id = extendSegment(nbytes, set);
+      }
+      if (!id && fillHoles(set)) {
+        // The virtual range is exhausted, reuse the holes in it
+        id = findChunk(nbytes, set);
+      }
+      if (id) {
+        return id;
+      }
+      // Fallback to device memory when virtual range is exhausted
+    }
+
     emptyCacheWithoutLock();
     auto& extSize = set->currExtendSize_;
     bool increased = false;
@@ -334,6 +776,7 @@ class BFCachingAllocatorImpl {
   }
 
   void emptyCacheWithoutLock() {
+    flushThreadCachesWithoutLock();
     for (auto& set : streamSets_) {
       if (set != nullptr) {
         shrink(set);
@@ -341,45 +784,172 @@ class BFCachingAllocatorImpl {
     }
   }
 
+  std::tuple<void*, int, size_t> allocateWithoutLock(size_t nbytes,
+                                                     bool extendOnMiss = true) {
+    auto& set = checkStream(0);
+    int id = findChunk(nbytes, set);
+    if (id) {
+      stats_->add(AllocatorStats::kCacheHit);
+    } else if (extendOnMiss) {
+      stats_->add(AllocatorStats::kCacheMiss);
+      id = extend(nbytes, set);
+    }
+
+    if (id) {
+      if (chunks_[id].size >= nbytes * 2 ||
+          chunks_[id].size >= nbytes + kMaxInternalFragmentation) {
+        id = split(id, nbytes);
+      }
+      chunks_[id].allocated = true;
+      allocatedBytes += nbytes;
+      return std::make_tuple(chunks_[id].ptr, id, nbytes);
+    }
+    return std::make_tuple(nullptr, 0, 0);
+  }
+
+  void releaseWithoutLock(int id) {
+    chunks_[id].allocated = false;
+    allocatedBytes -= chunks_[id].size;
+    id = coalesce(id);
+    insertChunkIntoBin(id);
+  }
+
+  // Refill the local cache of `nbytes` in batch and take one chunk from it.
+  Block refillThreadCache(ThreadCache& cache, size_t nbytes) {
+    const size_t batch = std::max<size_t>(kThreadCacheBinCapacity / 2, 1);
+    std::vector<Block> blocks;
+    blocks.reserve(batch);
+    {
+      std::lock_guard<mutex_t> lk(mut_);
+      for (size_t i = 0; i < batch; ++i) {
+        auto block = allocateWithoutLock(nbytes);
+        if (std::get<0>(block) == nullptr) {
+          break;
+        }
+        blocks.emplace_back(std::get<0>(block), std::get<1>(block));
+      }
+    }
+    if (blocks.empty()) {
+      return {nullptr, 0};
+    }
+
+    Block result = blocks.back();
+    blocks.pop_back();
+    if (!blocks.empty()) {
+      std::lock_guard<mutex_t> lk(cache.mut);
+      auto& bin = cache.bins[threadCacheBinForSize(nbytes)];
+      bin.insert(bin.end(), blocks.begin(), blocks.end());
+    }
+    return result;
+  }
+
  public:
   BFCachingAllocatorImpl() {
     // Avoid zero index later
     newChunk(nullptr, 0, 0);
   }
 
-  ~BFCachingAllocatorImpl() { emptyCache(); }
+  ~BFCachingAllocatorImpl() {
+    emptyCache();
+    for (auto& cache : threadCaches_) {
+      cache->detached.store(true, std::memory_order_release);
+    }
+    for (auto& set : streamSets_) {
+      if (set != nullptr) {
+        releaseSegment(set);
+      }
+    }
+  }
 
   void emptyCache() {
     std::lock_guard<mutex_t> lk(mut_);
     emptyCacheWithoutLock();
   }
 
-  std::tuple<void*, int, size_t> allocateRaw(size_t size) {
+  // Lock-free (no shared lock) fast path, only hits local cached chunks
+  std::tuple<void*, int, size_t> allocateCached(size_t size) {
     if (!size) {
       return std::make_tuple(nullptr, 0, 0);
     }
-
     size_t nbytes = roundBytes(size);
+    if (!isThreadCacheable(nbytes)) {
+      return std::make_tuple(nullptr, 0, 0);
+    }
 
-    allocatedBytes += nbytes;
+    auto& cache = localThreadCache();
+    std::lock_guard<mutex_t> lk(cache.mut);
+    auto& bin = cache.bins[threadCacheBinForSize(nbytes)];
+    if (bin.empty()) {
+      return std::make_tuple(nullptr, 0, 0);
+    }
+    Block block = bin.back();
+    bin.pop_back();
+    stats_->add(AllocatorStats::kCacheHit);
+    return std::make_tuple(block.first, block.second, nbytes);
+  }
 
-    std::lock_guard<mutex_t> lk(mut_);
-    auto& set = checkStream(0);
-    int id = findChunk(nbytes, set);
-    if (!id) {
-      id = extend(nbytes, set);
+  // Chunks served by the per-thread caches may always extend the cache
+  std::tuple<void*, int, size_t> allocateRaw(size_t size,
+                                             bool extendOnMiss = true) {
+    if (!size) {
+      return std::make_tuple(nullptr, 0, 0);
     }
 
-    if (id) {
-      if (chunks_[id].size >= nbytes * 2 ||
-          chunks_[id].size >= nbytes + kMaxInternalFragmentation) {
-        id = split(id, nbytes);
+    size_t nbytes = roundBytes(size);
+
+    if (isThreadCacheable(nbytes)) {
+      auto block = allocateCached(nbytes);
+      if (std::get<0>(block) != nullptr) {
+        return block;
       }
-      chunks_[id].allocated = true;
-      return std::make_tuple(chunks_[id].ptr, id, nbytes);
+      Block refilled = refillThreadCache(localThreadCache(), nbytes);
+      return std::make_tuple(refilled.first, refilled.second,
+                             refilled.first ? nbytes : 0);
     }
-    return std::make_tuple(nullptr, 0, 0);
-    ;
+
+    std::lock_guard<mutex_t> lk(mut_);
+    return allocateWithoutLock(nbytes, extendOnMiss);
+  }
+
+  static bool isThreadCached(size_t size) {
+    return isThreadCacheable(roundBytes(size));
+  }
+
+  // Grow allocated chunk `id` of `nbytes` in place to hold `size` bytes by
+  // taking over the free chunk after it in memory. Returns the new `nbytes`,
+  // 0 if that chunk is in use or too small. Chunks of the per-thread caches
+  // keep their size class.
+  size_t tryExpand(int id, size_t nbytes, size_t size) {
+    if (isThreadCacheable(nbytes)) {
+      return 0;
+    }
+    size_t newBytes = roundBytes(size);
+    std::lock_guard<mutex_t> lk(mut_);
+    size_t oldSize = chunks_[id].size;
+    if (oldSize >= newBytes) {
+      // Not split when allocated
+      return newBytes;
+    }
+    int next = chunks_[id].nextChunkInMem;
+    if (!next || chunks_[next].allocated ||
+        oldSize + chunks_[next].size < newBytes) {
+      return 0;
+    }
+    removeChunkFromBin(next);
+    id = merge(id, next);
+    recycleChunk(next);
+    if (chunks_[id].size >= newBytes * 2 ||
+        chunks_[id].size >= newBytes + kMaxInternalFragmentation) {
+      id = split(id, newBytes);
+    }
+    allocatedBytes += chunks_[id].size - oldSize;
+    return newBytes;
+  }
+
+  // Size of an allocated chunk
+  size_t chunkSize(int id) const {
+    std::lock_guard<mutex_t> lk(mut_);
+    return chunks_[id].size;
   }
 
   void releaseRaw(void* ptr, int id) {
@@ -388,10 +958,108 @@ class BFCachingAllocatorImpl {
     }
 
     std::lock_guard<mutex_t> lk(mut_);
-    chunks_[id].allocated = false;
-    allocatedBytes -= chunks_[id].size;
-    id = coalesce(id);
-    insertChunkIntoBin(id);
+    trace(MemTracer::Action::kFreeCompleted, ptr, chunks_[id].size);
+    releaseWithoutLock(id);
+  }
+
+  // `nbytes` must be the value returned by `allocateRaw`/`allocateCached`.
+  // The chunk must be ready to be reused by any stream.
+  void releaseRaw(void* ptr, int id, size_t nbytes) {
+    if (!ptr) {
+      return;
+    }
+    if (!isThreadCacheable(nbytes)) {
+      releaseRaw(ptr, id);
+      return;
+    }
+
+    std::vector<Block> spilled;
+    {
+      auto& cache = localThreadCache();
+      std::lock_guard<mutex_t> lk(cache.mut);
+      auto& bin = cache.bins[threadCacheBinForSize(nbytes)];
+      if (bin.size() >= kThreadCacheBinCapacity) {
+        // Give back the older half to the shared bins
+        auto half = bin.begin() + static_cast<std::ptrdiff_t>(bin.size() / 2);
+        spilled.assign(bin.begin(), half);
+        bin.erase(bin.begin(), half);
+      }
+      bin.emplace_back(ptr, id);
+    }
+    trace(MemTracer::Action::kFreeCompleted, ptr, nbytes);
+    if (!spilled.empty()) {
+      std::lock_guard<mutex_t> lk(mut_);
+      for (const auto& block : spilled) {
+        releaseWithoutLock(block.second);
+      }
+    }
+  }
+
+  // Allocate free segments up front, stop at the first failure
+  void reserveSegments(const std::vector<size_t>& sizes) {
+    std::lock_guard<mutex_t> lk(mut_);
+    auto& set = checkStream(0);
+    for (size_t size : sizes) {
+      if (size == 0) {
+        continue;
+      }
+      size_t nbytes = roundBytes(size);
+      void* ptr = allocateOnDevice(nbytes);
+      if (!ptr) {
+        break;
+      }
+      insertChunkIntoBin(newChunk(ptr, nbytes, set->id));
+      // Later extensions should not restart from small segments
+      set->currExtendSize_ =
+          std::max(set->currExtendSize_, std::min(nbytes, kMaxExtendSize));
+    }
+  }
+
+  // Release free segments, the longest idle first, until `nbytes` are freed.
+  // Chunks in per-thread caches are kept since they are likely reused soon.
+  size_t garbageCollect(size_t nbytes) {
+    std::lock_guard<mutex_t> lk(mut_);
+    std::vector<int> idle;
+    for (const auto& set : streamSets_) {
+      if (set == nullptr) {
+        continue;
+      }
+      for (int binHead : set->binHeads_) {
+        for (int k = chunks_[binHead].nextChunkInList; k;
+             k = chunks_[k].nextChunkInList) {
+          if (chunks_[k].isMonoBlock() &&
+              !set->segment.contains(chunks_[k].ptr)) {
+            idle.push_back(k);
+          }
+        }
+      }
+    }
+    std::sort(idle.begin(), idle.end(), [this](int a, int b) {
+      return chunks_[a].idleSince < chunks_[b].idleSince;
+    });
+
+    size_t released = 0;
+    for (int k : idle) {
+      if (released >= nbytes) {
+        break;
+      }
+      released += chunks_[k].size;
+      releaseOnDevice(chunks_[k].ptr, chunks_[k].size);
+      removeChunkFromBin(k);
+      recycleChunk(k);
+    }
+    // Then the free tails of expandable segments
+    for (auto& set : streamSets_) {
+      if (released >= nbytes) {
+        break;
+      }
+      if (set != nullptr && set->segment.base != nullptr) {
+        size_t before = cachedBytes;
+        trimSegment(set);
+        released += before - cachedBytes;
+      }
+    }
+    return released;
   }
 
   void set_mem_allocate_fn(allocate_fn_t allocate_fn,
@@ -401,6 +1069,83 @@ class BFCachingAllocatorImpl {
     this->deallocate_fn = std::move(deallocate_fn);
   }
 
+  void set_mem_hold_fn(hold_fn_t hold_fn, unhold_fn_t unhold_fn) {
+    this->hold_fn = std::move(hold_fn);
+    this->unhold_fn = std::move(unhold_fn);
+  }
+
+  void set_expandable_segment_fn(expandable_fn_t expandable_fn) {
+    this->expandable_fn = std::move(expandable_fn);
+  }
+
+  void set_stats(AllocatorStats* stats) { stats_ = stats; }
+
+  void set_device(const c10::Device* device) { device_ = device; }
+
+  // Walk all free chunks in the shared bins
+  void collectFreeChunkStats(size_t& largestFreeChunk,
+                             size_t& inactiveSplitBytes,
+                             size_t& inactiveSplitChunks) const {
+    std::lock_guard<mutex_t> lk(mut_);
+    largestFreeChunk = 0;
+    inactiveSplitBytes = 0;
+    inactiveSplitChunks = 0;
+    for (const auto& set : streamSets_) {
+      if (set == nullptr) {
+        continue;
+      }
+      for (int binHead : set->binHeads_) {
+        for (int k = chunks_[binHead].nextChunkInList; k;
+             k = chunks_[k].nextChunkInList) {
+          largestFreeChunk = std::max(largestFreeChunk, chunks_[k].size);
+          if (!chunks_[k].isMonoBlock()) {
+            inactiveSplitBytes += chunks_[k].size;
+            ++inactiveSplitChunks;
+          }
+        }
+      }
+    }
+  }
+
+  // Chunks in per-thread caches are reported as inactive
+  void snapshot(std::vector<MemorySegmentSnapshot>& segments,
+                c10::DeviceIndex device) const {
+    std::lock_guard<mutex_t> lk(mut_);
+    std::unordered_set<int> threadCachedIds;
+    for (const auto& cache : threadCaches_) {
+      std::lock_guard<mutex_t> cacheLock(cache->mut);
+      for (const auto& bin : cache->bins) {
+        for (const auto& block : bin) {
+          threadCachedIds.insert(block.second);
+        }
+      }
+    }
+
+    for (size_t id = 1; id < chunks_.size(); ++id) {
+      const auto& head = chunks_[id];
+      // Segments start with a chunk that has no previous chunk in memory
+      if (head.ptr == nullptr || head.prevChunkInMem != 0) {
+        continue;
+      }
+      MemorySegmentSnapshot segment;
+      segment.device = device;
+      segment.address = reinterpret_cast<uintptr_t>(head.ptr);
+      segment.stream = static_cast<c10::StreamId>(head.stream);
+      segment.expandable = streamSets_[head.stream]->segment.contains(head.ptr);
+      for (int k = static_cast<int>(id); k; k = chunks_[k].nextChunkInMem) {
+        const auto& chunk = chunks_[k];
+        if (chunk.hole) {
+          continue;
+        }
+        bool active = chunk.allocated && threadCachedIds.count(k) == 0;
+        segment.blocks.push_back(
+            {reinterpret_cast<uintptr_t>(chunk.ptr), chunk.size, active});
+        segment.total_size += chunk.size;
+      }
+      segments.push_back(std::move(segment));
+    }
+  }
+
   size_t memory_reserved() const { return cachedBytes; }
 };
 
@@ -410,22 +1155,123 @@ class BFCachingAllocator : public CacheAllocator {
   mutable std::unique_ptr<BFCachingAllocatorImpl> impl;
   using mutex_t = std::mutex;
   mutable mutex_t resource_pool_mutex_;
+  // Private pools are created on first use and erased by empty_mem_pool()
+  // once they hold no memory. Pool ids are never reused.
+  mutable std::unordered_map<MemPoolId, std::unique_ptr<BFCachingAllocatorImpl>>
+      pools_;
+  mutable mutex_t pools_mutex_;
 
  private:
+  static constexpr unsigned kPoolIdShift = 32;
+
+  // Blocks in the async pool carry their pool in the high bits of the id
+  static size_t packBlockId(MemPoolId pool, int id) {
+    return (static_cast<size_t>(pool) << kPoolIdShift) |
+           static_cast<uint32_t>(id);
+  }
+
+  BFCachingAllocatorImpl* pool_impl(MemPoolId pool) const {
+    if (pool == kDefaultMemPool) {
+      return impl.get();
+    }
+    std::lock_guard<mutex_t> lk(pools_mutex_);
+    auto& pool_impl = pools_[pool];
+    if (!pool_impl) {
+      pool_impl = make_impl();
+    }
+    return pool_impl.get();
+  }
+
+  template <typename Fn>
+  void for_each_impl(Fn fn) const {
+    fn(*impl);
+    std::lock_guard<mutex_t> lk(pools_mutex_);
+    for (auto& item : pools_) {
+      fn(*item.second);
+    }
+  }
+
+  size_t total_memory_reserved() const {
+    size_t reserved = 0;
+    for_each_impl([&reserved](BFCachingAllocatorImpl& pool) {
+      reserved += pool.memory_reserved();
+    });
+    return reserved;
+  }
+
+  // Give back idle segments of all pools while the reserved memory is above
+  // the limit, return the reserved memory afterwards. Only called at safe
+  // points where no shared lock is held.
+  size_t garbage_collect(size_t reserved) const {
+    size_t limit = gc_limit();
+    if (limit == 0 || reserved <= limit) {
+      return reserved;
+    }
+    DIPU_DEBUG_ALLOCATOR(8, "BFCachingAllocator: garbage_collect "
+                                << reserved - limit << " nbytes, allocator:"
+                                << this << ", device:" << device());
+    stats().add(AllocatorStats::kGarbageCollection);
+    size_t released = 0;
+    for_each_impl([&](BFCachingAllocatorImpl& pool) {
+      if (released < reserved - limit) {
+        released += pool.garbageCollect(reserved - limit - released);
+      }
+    });
+    return total_memory_reserved();
+  }
+
+  void release_block(void* ptr, size_t packed_id) const {
+    auto pool = static_cast<MemPoolId>(packed_id >> kPoolIdShift);
+    auto id = static_cast<int>(packed_id & ((size_t{1} << kPoolIdShift) - 1));
+    pool_impl(pool)->releaseRaw(ptr, id);
+  }
+
+  // Take a chunk of `pool` waiting in the async pool for other streams, and
+  // order the current stream after their work instead of waiting on host
+  std::tuple<void*, int, size_t> steal_pending_block(
+      size_t size, MemPoolId pool, BFCachingAllocatorImpl* pool_impl) const {
+    auto unpack_id = [](size_t packed_id) {
+      return static_cast<int>(packed_id & ((size_t{1} << kPoolIdShift) - 1));
+    };
+    auto fits = [&](const std::tuple<void*, size_t>& block) {
+      size_t packed_id = std::get<1>(block);
+      if (static_cast<MemPoolId>(packed_id >> kPoolIdShift) != pool) {
+        return false;
+      }
+      // Don't waste more than the chunks split by allocateRaw would
+      size_t chunk_size = pool_impl->chunkSize(unpack_id(packed_id));
+      return chunk_size >= size && chunk_size < size * 2;
+    };
+    std::tuple<void*, size_t> block;
+    {
+      std::lock_guard<mutex_t> lk(resource_pool_mutex_);
+      if (!async_mem_pool()->steal(fits, getCurrentDIPUStream(), block)) {
+        return std::make_tuple(nullptr, 0, 0);
+      }
+    }
+    int id = unpack_id(std::get<1>(block));
+    DIPU_DEBUG_ALLOCATOR(8, "BFCachingAllocator: " << __FUNCTION__ << " ,ptr:"
+                                                   << std::get<0>(block)
+                                                   << " ,id:" << id
+                                                   << ", device:" << device());
+    stats().add(AllocatorStats::kCrossStreamReuse);
+    return std::make_tuple(std::get<0>(block), id, pool_impl->chunkSize(id));
+  }
+
   void restore() const {
     std::lock_guard<mutex_t> lk(resource_pool_mutex_);
     while (async_mem_pool()->ready()) {
       const auto block = async_mem_pool()->get();
       void* ptr = std::get<0>(block);
-      int id = static_cast<int>(std::get<1>(block));
+      size_t id = std::get<1>(block);
       DIPU_DEBUG_ALLOCATOR(
           8, "BFCachingAllocator: "
                  << __FUNCTION__ << " ,ptr:" << ptr << " ,id:" << id
                  << " ,allocator:" << this << ", device:" << device()
                  << ", async_pool.size:" << async_mem_pool()->size());
-      impl->releaseRaw(ptr, id);
+      release_block(ptr, id);
     }
-    set_memory_reserved(impl->memory_reserved());
+    set_memory_reserved(total_memory_reserved());
   }
 
   void empty_resource_pool() const {
@@ -437,12 +1283,12 @@ class BFCachingAllocator : public CacheAllocator {
       }
       const auto block = async_mem_pool()->get();
       void* ptr = std::get<0>(block);
-      int id = static_cast<int>(std::get<1>(block));
+      size_t id = std::get<1>(block);
       DIPU_DEBUG_ALLOCATOR(
           8, "BFCachingAllocator: " << __FUNCTION__ << " ,ptr:" << ptr
                                     << " ,id:" << id << " ,allocator:" << this
                                     << ", device:" << device());
-      impl->releaseRaw(ptr, id);
+      release_block(ptr, id);
     }
   }
 
@@ -463,12 +1309,12 @@ class BFCachingAllocator : public CacheAllocator {
       }
       const auto block = async_mem_pool()->get();
       void* ptr = std::get<0>(block);
-      int id = static_cast<int>(std::get<1>(block));
+      size_t id = std::get<1>(block);
       DIPU_DEBUG_ALLOCATOR(
           8, "BFCachingAllocator: " << __FUNCTION__ << " ,ptr:" << ptr
                                     << " ,id:" << id << " ,allocator:" << this
                                     << ", device:" << device());
-      impl->releaseRaw(ptr, id);
+      release_block(ptr, id);
     }
     return true;
   }
@@ -477,23 +1323,50 @@ class BFCachingAllocator : public CacheAllocator {
     if (impl) {
       return;
     }
-    impl = std::make_unique<BFCachingAllocatorImpl>();
+    impl = make_impl();
+  }
 
-    auto alloc_fn =
-        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
-        [pointer = const_cast<BFCachingAllocator*>(this)](std::size_t PH1) {
-          return pointer->allocate_raw(PH1);
-        };
-    auto dealloc_fn =
-        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
-        [pointer = const_cast<BFCachingAllocator*>(this)](void* PH1) {
-          pointer->free_raw(PH1);
-        };
-    impl->set_mem_allocate_fn(alloc_fn, dealloc_fn);
+  std::unique_ptr<BFCachingAllocatorImpl> make_impl() const {
+    auto pool = std::make_unique<BFCachingAllocatorImpl>();
+
+    auto alloc_fn = [pointer = this](std::size_t PH1) {
+      return pointer->allocate_raw(PH1);
+    };
+    auto dealloc_fn = [pointer = this](void* PH1, std::size_t PH2) {
+      pointer->free_raw(PH1, PH2);
+    };
+    pool->set_mem_allocate_fn(alloc_fn, dealloc_fn);
+    pool->set_mem_hold_fn(
+        [pointer = this](size_t nbytes) {
+          return pointer->hold_memory(nbytes);
+        },
+        [pointer = this](size_t nbytes) { pointer->unhold_memory(nbytes); });
+    pool->set_stats(&stats());
+    pool->set_device(&device());
+
+    auto expandable_fn = [pointer = this]() -> std::pair<size_t, size_t> {
+      if (!kExpandableSegments ||
+          pointer->device().type() != dipu::DIPU_DEVICE_TYPE) {
+        return {0, 0};
+      }
+      size_t granularity = devproxy::getVirtualMemGranularity();
+      if (granularity == 0) {
+        return {0, 0};
+      }
+      size_t reserve = kExpandableSegmentSize;
+      if (reserve == 0) {
+        reserve = devproxy::getDeviceProperties(pointer->device().index())
+                      .totalGlobalMem;
+      }
+      return {granularity, reserve};
+    };
+    pool->set_expandable_segment_fn(expandable_fn);
+    return pool;
   }
 
-  void* makeContext(void* ptr, size_t size, size_t nbytes, int id) const {
-    auto ctx = new Context(ptr, size, nbytes, id, this);
+  void* makeContext(void* ptr, size_t size, size_t nbytes, int id,
+                    MemPoolId pool, BFCachingAllocatorImpl* pool_impl) const {
+    auto ctx = new Context(ptr, size, nbytes, id, pool, pool_impl, this);
     return ctx;
   }
 
@@ -501,9 +1374,16 @@ class BFCachingAllocator : public CacheAllocator {
   struct Context : public DataPtrContextBase {
     int id_ = 0;
     size_t nbytes_ = 0;
-    Context(void* ptr, size_t size, size_t nbytes, int id,
+    MemPoolId pool_ = kDefaultMemPool;
+    BFCachingAllocatorImpl* pool_impl_ = nullptr;
+    Context(void* ptr, size_t size, size_t nbytes, int id, MemPoolId pool,
+            BFCachingAllocatorImpl* pool_impl,
             const BFCachingAllocator* allocator)
-        : DataPtrContextBase(allocator, ptr, size), id_(id), nbytes_(nbytes) {}
+        : DataPtrContextBase(allocator, ptr, size),
+          id_(id),
+          nbytes_(nbytes),
+          pool_(pool),
+          pool_impl_(pool_impl) {}
 
     ~Context() {
       auto allocator_ = static_cast<const BFCachingAllocator*>(allocator());
@@ -513,15 +1393,20 @@ class BFCachingAllocator : public CacheAllocator {
                                   << ", device:" << allocator_->device());
       if (allocator_->impl) {
         if (ptr()) {
-          std::deque<DIPUEvent> events;
-          for (auto const& stream : streams()) {
-            events.emplace_back();
-            DIPU_DEBUG_ALLOCATOR(8, "BFCachingAllocator: record to stream:"
-                                        << stream.rawstream());
-            events.back().record(stream);
-          }
-          allocator_->async_mem_pool()->add(std::make_tuple(ptr(), id_),
-                                            events);
+          markFreed();
+          allocator_->stats().recordFree(nbytes_);
+        }
+        if (ptr() && streams().empty()) {
+          // Not used by other streams, reuse it at once without going through
+          // the async pool, small chunks go back to the per-thread cache
+          pool_impl_->releaseRaw(ptr(), id_, nbytes_);
+          allocator_->set_memory_allocated(allocator_->memory_allocated() -
+                                           nbytes_);
+          return;
+        }
+        if (ptr()) {
+          allocator_->async_mem_pool()->add(
+              std::make_tuple(ptr(), packBlockId(pool_, id_)), streams());
           allocator_->set_memory_allocated(allocator_->memory_allocated() -
                                            nbytes_);
         }
@@ -537,54 +1422,230 @@ class BFCachingAllocator : public CacheAllocator {
   friend class Context;
 
   c10::DataPtr allocate(size_t size) const override {
-    restore();
-    if (async_mem_pool()->size() > kMaxAsyncResourcePoolLength) {
-      try_empty_resource_pool();
-    }
+    LaunchQueueBarrierSkip skipBarrier;
     size = getMemoryAlignmentStrategy()->roundBytes(size);
-    std::tuple<void*, int, size_t> block = impl->allocateRaw(size);
+    check_memory_limit(size);
+    // Pinned memory always comes from the default pool
+    MemPoolId pool = device().type() == dipu::DIPU_DEVICE_TYPE
+                         ? currentMemPool()
+                         : kDefaultMemPool;
+    BFCachingAllocatorImpl* allocator_impl = pool_impl(pool);
+    // Small chunks cached by current thread need no shared lock
+    std::tuple<void*, int, size_t> block = allocator_impl->allocateCached(size);
     void* ptr = std::get<0>(block);
+    if (ptr == nullptr) {
+      restore();
+      if (async_mem_pool()->size() > gMaxAsyncResourcePoolLength.get()) {
+        try_empty_resource_pool();
+      }
+      // Large chunks only, small ones are cheap to cache per stream
+      bool reuse_pending = kCrossStreamReuse &&
+                           device().type() == dipu::DIPU_DEVICE_TYPE &&
+                           !BFCachingAllocatorImpl::isThreadCached(size);
+      block = allocator_impl->allocateRaw(size, !reuse_pending);
+      ptr = std::get<0>(block);
+      if (ptr == nullptr && reuse_pending) {
+        block = steal_pending_block(size, pool, allocator_impl);
+        ptr = std::get<0>(block);
+        if (ptr == nullptr) {
+          block = allocator_impl->allocateRaw(size);
+          ptr = std::get<0>(block);
+        }
+      }
+    }
     if (ptr == nullptr && size > 0) {
+      stats().add(AllocatorStats::kAllocRetry);
       empty_resource_pool();
-      block = impl->allocateRaw(size);
+      block = allocator_impl->allocateRaw(size);
       ptr = std::get<0>(block);
       if (ptr == nullptr && size > 0) {
         empty_cache();
-        block = impl->allocateRaw(size);
+        block = allocator_impl->allocateRaw(size);
         ptr = std::get<0>(block);
-        TORCH_CHECK(ptr != nullptr, "no memory available")
+        // Let the application free memory before giving up
+        for (size_t retry = 0;
+             ptr == nullptr && retry < gOutOfMemoryRetries.get() &&
+             notifyOutOfMemoryObservers(device().index(), size,
+                                        memory_allocated(),
+                                        total_memory_reserved());
+             ++retry) {
+          empty_cache();
+          block = allocator_impl->allocateRaw(size);
+          ptr = std::get<0>(block);
+        }
+        if (ptr == nullptr) {
+          stats().add(AllocatorStats::kOOM);
+          trace(MemTracer::Action::kOOM, nullptr, size);
+        }
+        TORCH_CHECK(ptr != nullptr, out_of_memory_message(size))
       }
     }
 
     int id = std::get<1>(block);
     size_t nbytes = std::get<2>(block);
+    stats().recordAlloc(nbytes);
 
     set_memory_allocated(memory_allocated() + nbytes);
-    set_memory_reserved(impl->memory_reserved());
+    size_t reserved = total_memory_reserved();
+    if (reserved > memory_reserved()) {
+      // The cache grew, trim it if it is above the limit now
+      reserved = garbage_collect(reserved);
+    }
+    set_memory_reserved(reserved);
 
-    c10::DataPtr data_ptr(ptr, makeContext(ptr, size, nbytes, id),
-                          deleteBFContext, device());
+    c10::DataPtr data_ptr(
+        ptr, makeContext(ptr, size, nbytes, id, pool, allocator_impl),
+        deleteBFContext, device());
     DIPU_DEBUG_ALLOCATOR(
         4, "BFCachingAllocator: malloc "
                << nbytes << ",requires " << size << " nbytes, ptr:" << ptr
                << ",device:" << device()
                << ",async_mempool.size:" << async_mem_pool()->size());
-    c10::reportMemoryUsageToProfiler(
-        ptr, static_cast<int64_t>(nbytes), memory_allocated(),
-        memory_reserved(),
-        c10::Device(c10::DeviceType::CUDA, device().index()));
+    report_memory_usage(ptr, static_cast<int64_t>(nbytes));
     return data_ptr;
   }
 
+  bool try_expand(const c10::DataPtr& data_ptr, size_t size) const override {
+    LaunchQueueBarrierSkip skipBarrier;
+    // Blocks of graph pools are laid out by the capture
+    if (data_ptr.get_deleter() != deleteBFContext || !impl ||
+        isCaptureUnderway()) {
+      return false;
+    }
+    auto ctx = static_cast<Context*>(data_ptr.get_context());
+    if (ctx->ptr() == nullptr) {
+      return false;
+    }
+    size = getMemoryAlignmentStrategy()->roundBytes(size);
+    size_t nbytes = ctx->pool_impl_->tryExpand(ctx->id_, ctx->nbytes_, size);
+    if (nbytes == 0) {
+      return false;
+    }
+    if (device().type() == dipu::DIPU_DEVICE_TYPE) {
+      // The memory taken over is only ready for the default stream
+      auto currentStream = getCurrentDIPUStream();
+      auto defaultStream = getDefaultDIPUStream();
+      if (currentStream != defaultStream) {
+        sync_with_default_stream(currentStream, defaultStream);
+      }
+    }
+    stats().recordFree(ctx->nbytes_);
+    stats().recordAlloc(nbytes);
+    set_memory_allocated(memory_allocated() - ctx->nbytes_ + nbytes);
+    auto grown = static_cast<int64_t>(nbytes) -
+                 static_cast<int64_t>(ctx->nbytes_);
+    ctx->nbytes_ = nbytes;
+    DIPU_DEBUG_ALLOCATOR(4, "BFCachingAllocator: expand "
+                                << ctx->ptr() << " to " << nbytes
+                                << " nbytes, device:" << device());
+    report_memory_usage(ctx->ptr(), grown);
+    return true;
+  }
+
   void empty_cache() const override {
+    LaunchQueueBarrierSkip skipBarrier;
     DIPU_DEBUG_ALLOCATOR(8, "BFCachingAllocator: empty_cache, allocator:"
                                 << this << ", device:" << device());
+    stats().add(AllocatorStats::kEmptyCache);
+    empty_resource_pool();
+    for_each_impl([](BFCachingAllocatorImpl& pool) { pool.emptyCache(); });
+    set_memory_reserved(total_memory_reserved());
+  }
+
+  void empty_mem_pool(MemPoolId pool) const override {
+    LaunchQueueBarrierSkip skipBarrier;
+    DIPU_DEBUG_ALLOCATOR(8, "BFCachingAllocator: empty_mem_pool "
+                                << pool << ", allocator:" << this
+                                << ", device:" << device());
     empty_resource_pool();
-    impl->emptyCache();
-    set_memory_reserved(impl->memory_reserved());
+    {
+      std::lock_guard<mutex_t> lk(pools_mutex_);
+      auto iter = pools_.find(pool);
+      if (iter != pools_.end()) {
+        iter->second->emptyCache();
+        // Nothing reserved means no live chunk, nor one in the async pool
+        // drained above, refers to it
+        if (iter->second->memory_reserved() == 0) {
+          pools_.erase(iter);
+        }
+      }
+    }
+    set_memory_reserved(total_memory_reserved());
+  }
+
+  void memory_stats(MemoryStatsMap& stats) const override {
+    CacheAllocator::memory_stats(stats);
+    size_t largestFreeChunk = 0;
+    size_t inactiveSplitBytes = 0;
+    size_t inactiveSplitChunks = 0;
+    for_each_impl([&](BFCachingAllocatorImpl& pool) {
+      size_t largest = 0;
+      size_t bytes = 0;
+      size_t chunks = 0;
+      pool.collectFreeChunkStats(largest, bytes, chunks);
+      largestFreeChunk = std::max(largestFreeChunk, largest);
+      inactiveSplitBytes += bytes;
+      inactiveSplitChunks += chunks;
+    });
+    stats["largest_free_chunk"] = static_cast<int64_t>(largestFreeChunk);
+    stats["inactive_split_bytes.all.current"] =
+        static_cast<int64_t>(inactiveSplitBytes);
+    stats["inactive_split.all.current"] =
+        static_cast<int64_t>(inactiveSplitChunks);
+  }
+
+  void reserve_for_profile(
+      const std::vector<int64_t>& peak_bytes) const override {
+    // Bins of blocks larger than the max extend size get their own
+    // segments, smaller blocks share segments of the max extend size
+    constexpr size_t kMinBinSize = 512;
+    std::vector<size_t> sizes;
+    size_t shared = 0;
+    for (size_t i = 0; i < peak_bytes.size(); ++i) {
+      if (peak_bytes[i] <= 0) {
+        continue;
+      }
+      auto bytes = static_cast<size_t>(peak_bytes[i]);
+      size_t lower = i == 0 ? 0 : kMinBinSize << (i - 1);
+      if (lower >= kMaxExtendSize) {
+        sizes.push_back(bytes);
+      } else {
+        shared += bytes;
+      }
+    }
+    while (shared > 0) {
+      size_t size = std::min(shared, kMaxExtendSize);
+      sizes.push_back(size);
+      shared -= size;
+    }
+
+    // Memory already reserved serves the smallest segments
+    size_t reserved = total_memory_reserved();
+    std::sort(sizes.begin(), sizes.end());
+    auto iter = sizes.begin();
+    for (; iter != sizes.end() && reserved >= *iter; ++iter) {
+      reserved -= *iter;
+    }
+    sizes.erase(sizes.begin(), iter);
+    if (!sizes.empty()) {
+      sizes.front() -= reserved;
+    }
+
+    DIPU_DEBUG_ALLOCATOR(8, "BFCachingAllocator: reserve " << sizes.size()
+                                << " segments, allocator:" << this
+                                << ", device:" << device());
+    impl->reserveSegments(sizes);
+    set_memory_reserved(total_memory_reserved());
+  }
+
+  void snapshot(std::vector<MemorySegmentSnapshot>& segments) const override {
+    for_each_impl([&](BFCachingAllocatorImpl& pool) {
+      pool.snapshot(segments, device().index());
+    });
   }
 
   void release_all_memory() const override {
+    LaunchQueueBarrierSkip skipBarrier;
     if (!impl) {
       return;
     }
@@ -602,12 +1663,16 @@ class BFCachingAllocator : public CacheAllocator {
 };
 
 static void deleteBFContext(void* ptr) {
+  LaunchQueueBarrierSkip skipBarrier;
   auto ctx = static_cast<BFCachingAllocator::Context*>(ptr);
-  c10::reportMemoryUsageToProfiler(
-      ctx->ptr(), -static_cast<int64_t>(ctx->nbytes_),
-      ctx->allocator()->memory_allocated(), ctx->allocator()->memory_reserved(),
-      c10::Device(c10::DeviceType::CUDA, ctx->allocator()->device().index()));
+  const auto* allocator = ctx->allocator();
+  void* data = ctx->ptr();
+  const auto nbytes = static_cast<int64_t>(ctx->nbytes_);
+  // reported once the totals no longer count it
   delete ctx;
+  if (data != nullptr) {
+    allocator->report_memory_usage(data, -nbytes);
+  }
 }
 
 // TODO(allocator) - Refactor it!
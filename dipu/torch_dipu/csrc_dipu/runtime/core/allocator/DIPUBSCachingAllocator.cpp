@@ -1,11 +1,10 @@
 // Copyright (c) 2023, DeepLink.
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <deque>
-#include <list>
-#include <map>
 #include <mutex>
-#include <set>
 #include <unordered_map>
 
 #include "DIPUCachingAllocator.h"
@@ -15,16 +14,87 @@ namespace dipu {
 static void deleteBSContext(void* ptr);
 
 class BSCachingAllocator : public CacheAllocator {
+  // A segment of the raw allocator, blocks are never split
+  struct Block {
+    void* ptr = nullptr;
+    size_t size = 0;
+    bool idle = false;
+    // Order in which the block became idle
+    uint64_t idle_since = 0;
+    // Neighbours in the idle list of its size
+    Block* prev = nullptr;
+    Block* next = nullptr;
+  };
+
+  // Intrusive list of the idle blocks of a size, the most recently freed
+  // first so that reuse takes warm blocks and gc the longest idle ones
+  struct IdleList {
+    Block* head = nullptr;
+    Block* tail = nullptr;
+
+    bool empty() const { return head == nullptr; }
+
+    void push_front(Block* block) {
+      block->prev = nullptr;
+      block->next = head;
+      if (head != nullptr) {
+        head->prev = block;
+      } else {
+        tail = block;
+      }
+      head = block;
+    }
+
+    void remove(Block* block) {
+      (block->prev != nullptr ? block->prev->next : head) = block->next;
+      (block->next != nullptr ? block->next->prev : tail) = block->prev;
+      block->prev = block->next = nullptr;
+    }
+  };
+
+  // Power of two sizes, which is all of them with DIPU_BS_MORE_ADAPTABLE
+  static constexpr size_t kNumSizeClasses = 64;
+
   struct Impl {
-    std::unordered_map<size_t, std::list<void*>> idel_blocks_;
-    std::set<void*> allocated_;
+    // Idle blocks of size 2^i
+    std::array<IdleList, kNumSizeClasses> idle_classes_;
+    // Idle blocks of the other sizes
+    std::unordered_map<size_t, IdleList> idle_others_;
+    // All blocks (including idle ones), nodes never move
+    std::unordered_map<void*, Block> allocated_;
     size_t total_alocated_bytes_ = 0;
     size_t total_idel_bytes_ = 0;
+    uint64_t idle_clock_ = 0;
+    // Allocations since the async pool was last flushed
+    size_t unflushed_allocs_ = 0;
+
+    IdleList& idle_list(size_t nbytes) {
+      if ((nbytes & (nbytes - 1)) == 0) {
+        return idle_classes_[__builtin_ctzll(nbytes)];
+      }
+      return idle_others_[nbytes];
+    }
+
+    template <typename F>
+    void for_each_idle_list(F&& f) {
+      for (size_t i = 0; i < kNumSizeClasses; ++i) {
+        f(size_t{1} << i, idle_classes_[i]);
+      }
+      for (auto& item : idle_others_) {
+        f(item.first, item.second);
+      }
+    }
   };
   mutable std::unique_ptr<Impl> impl;
-  using mutex_t = std::recursive_mutex;
+  // Never taken recursively, the `_locked` methods expect it held. Not a spin
+  // lock, as it is held across device allocation, gc and the async pool wait
+  using mutex_t = std::mutex;
   mutable mutex_t mutex_;
 
+  // Freed blocks are moved out of the async pool every this many
+  // allocations, or when the size asked for has no idle block
+  static constexpr size_t kFlushInterval = 16;
+
  public:
   BSCachingAllocator() { impl = std::make_unique<Impl>(); }
 
@@ -74,24 +144,31 @@ class BSCachingAllocator : public CacheAllocator {
   }
 
   c10::DataPtr allocate(size_t size) const override {
+    LaunchQueueBarrierSkip skipBarrier;
     DIPU_DEBUG_ALLOCATOR(8, "BSCachingAllocator::allocate "
                                 << size << ",allocator:" << this
                                 << ", memory-usage" << memory_allocated() << "/"
                                 << memory_reserved());
-    std::lock_guard<mutex_t> lk(mutex_);
-    flush_mem_pool();
     size_t nbytes = getAllocateSize(size);
+    check_memory_limit(nbytes);
     void* ptr = nullptr;
-    auto& idel_blocks = impl->idel_blocks_[nbytes];
+    std::lock_guard<mutex_t> lk(mutex_);
+    auto& idel_blocks = impl->idle_list(nbytes);
+    if (idel_blocks.empty() || ++impl->unflushed_allocs_ >= kFlushInterval) {
+      flush_mem_pool_locked();
+    }
     if (idel_blocks.empty() ||
-        async_mem_pool()->size() > kMaxAsyncResourcePoolLength) {
-      empty_resource_pool();
+        async_mem_pool()->size() > gMaxAsyncResourcePoolLength.get()) {
+      empty_resource_pool_locked();
     }
     for (size_t i = 0; i < 2; i++) {
       if (!idel_blocks.empty()) {
-        ptr = idel_blocks.front();
-        idel_blocks.pop_front();
+        Block* block = idel_blocks.head;
+        idel_blocks.remove(block);
+        block->idle = false;
+        ptr = block->ptr;
         impl->total_idel_bytes_ -= nbytes;
+        stats().add(AllocatorStats::kCacheHit);
         DIPU_DEBUG_ALLOCATOR(4, "BSCachingAllocator::reuse "
                                     << nbytes << ", requires:" << size
                                     << " bytes, ptr:" << ptr
@@ -99,77 +176,163 @@ class BSCachingAllocator : public CacheAllocator {
         break;
       }
       try {
-        auto data_ptr = raw_allocator()->allocate(nbytes);
-        ptr = data_ptr.get();
-        device() = data_ptr.device();
-        data_ptr.release_context();
+        ptr = allocate_raw(nbytes);
         set_memory_reserved(memory_reserved() + nbytes);
 
-        impl->allocated_.insert(ptr);
+        auto& block = impl->allocated_[ptr];
+        block.ptr = ptr;
+        block.size = nbytes;
         impl->total_alocated_bytes_ += nbytes;
+        stats().add(AllocatorStats::kCacheMiss);
+        stats().add(AllocatorStats::kSegmentAlloc);
+        trace(MemTracer::Action::kSegmentAlloc, ptr, nbytes);
+        garbage_collect();
         DIPU_DEBUG_ALLOCATOR(4, "BSCachingAllocator::allocate "
                                     << nbytes << ", requires:" << size
                                     << " bytes, ptr:" << ptr
                                     << ",allocator:" << this);
         break;
       } catch (...) {
-        TORCH_CHECK(i == 0, "no memory available");
-        empty_cache();
+        if (i != 0) {
+          stats().add(AllocatorStats::kOOM);
+          trace(MemTracer::Action::kOOM, nullptr, nbytes);
+        }
+        TORCH_CHECK(i == 0, out_of_memory_message(nbytes));
+        stats().add(AllocatorStats::kAllocRetry);
+        stats().add(AllocatorStats::kEmptyCache);
+        empty_cache_locked();
       }
     }
     set_memory_allocated(memory_allocated() + nbytes);
+    stats().recordAlloc(nbytes);
     c10::DataPtr data_ptr(ptr, makeContext(ptr, size, nbytes), deleteBSContext,
                           device());
-    c10::reportMemoryUsageToProfiler(
-        ptr, static_cast<int64_t>(nbytes), memory_allocated(),
-        memory_reserved(),
-        c10::Device(c10::DeviceType::CUDA, device().index()));
+    report_memory_usage(ptr, static_cast<int64_t>(nbytes));
     return data_ptr;
   }
 
-  void restore(size_t size, void* ptr) const {
+  void restore_locked(size_t size, void* ptr) const {
     size_t nbytes = getAllocateSize(size);
-    std::lock_guard<mutex_t> lk(mutex_);
     DIPU_DEBUG_ALLOCATOR(8, "BSCachingAllocator::restore "
                                 << nbytes << " bytes, ptr:" << ptr
                                 << ",allocator:" << this);
-    impl->idel_blocks_[nbytes].push_back(ptr);
+    auto& block = impl->allocated_.at(ptr);
+    block.idle = true;
+    block.idle_since = ++impl->idle_clock_;
+    impl->idle_list(nbytes).push_front(&block);
     impl->total_idel_bytes_ += nbytes;
+    trace(MemTracer::Action::kFreeCompleted, ptr, nbytes);
   }
 
-  void empty_resource_pool() const {
+  void empty_resource_pool_locked() const {
     DIPU_DEBUG_ALLOCATOR(
         8, "BSCachingAllocator::empty_resource_pool ,allocator:" << this);
     while (!async_mem_pool()->empty()) {
       if (async_mem_pool()->ready()) {
-        flush_mem_pool();
+        flush_mem_pool_locked();
       } else {
         std::this_thread::yield();
       }
     }
   }
 
-  void empty_cache_impl() const {
+  void empty_cache_locked() const {
     DIPU_DEBUG_ALLOCATOR(8,
                          "BSCachingAllocator::empty_cache ,allocator:" << this);
-    empty_resource_pool();
-    std::lock_guard<mutex_t> lk(mutex_);
-    for (auto iter = impl->idel_blocks_.begin();
-         iter != impl->idel_blocks_.end(); ++iter) {
-      auto& idel_blocks = iter->second;
-      const size_t size = iter->first;
+    empty_resource_pool_locked();
+    // The lists stay, allocate may hold one of them
+    impl->for_each_idle_list([this](size_t /*size*/, IdleList& idel_blocks) {
       while (!idel_blocks.empty()) {
-        void* ptr = idel_blocks.front();
-        idel_blocks.pop_front();
-        impl->total_alocated_bytes_ -= size;
-        set_memory_reserved(memory_reserved() - size);
-        impl->allocated_.erase(ptr);
-        raw_allocator()->raw_deallocate(ptr);
+        release_idle_block(idel_blocks, idel_blocks.head);
+      }
+    });
+  }
+
+  void release_idle_block(IdleList& list, Block* block) const {
+    list.remove(block);
+    void* ptr = block->ptr;
+    const size_t size = block->size;
+    impl->total_idel_bytes_ -= size;
+    impl->total_alocated_bytes_ -= size;
+    set_memory_reserved(memory_reserved() - size);
+    impl->allocated_.erase(ptr);
+    trace(MemTracer::Action::kSegmentFree, ptr, size);
+    free_raw(ptr, size);
+    stats().add(AllocatorStats::kSegmentFree);
+  }
+
+  // Give back the longest idle blocks while the reserved memory is above the
+  // limit, called with `mutex_` held
+  void garbage_collect() const {
+    size_t limit = gc_limit();
+    if (limit == 0 || memory_reserved() <= limit) {
+      return;
+    }
+    DIPU_DEBUG_ALLOCATOR(8, "BSCachingAllocator::garbage_collect "
+                                << memory_reserved() - limit
+                                << " bytes, allocator:" << this);
+    stats().add(AllocatorStats::kGarbageCollection);
+    while (memory_reserved() > limit) {
+      // The oldest block is at the back of one of the lists
+      IdleList* oldest = nullptr;
+      impl->for_each_idle_list([&oldest](size_t /*size*/, IdleList& blocks) {
+        if (!blocks.empty() &&
+            (oldest == nullptr ||
+             blocks.tail->idle_since < oldest->tail->idle_since)) {
+          oldest = &blocks;
+        }
+      });
+      if (oldest == nullptr) {
+        break;
       }
+      release_idle_block(*oldest, oldest->tail);
+    }
+  }
+
+  void empty_cache() const override {
+    LaunchQueueBarrierSkip skipBarrier;
+    stats().add(AllocatorStats::kEmptyCache);
+    std::lock_guard<mutex_t> lk(mutex_);
+    empty_cache_locked();
+  }
+
+  void memory_stats(MemoryStatsMap& stats) const override {
+    CacheAllocator::memory_stats(stats);
+    size_t largest_free_chunk = 0;
+    {
+      std::lock_guard<mutex_t> lk(mutex_);
+      impl->for_each_idle_list(
+          [&largest_free_chunk](size_t size, IdleList& blocks) {
+            if (!blocks.empty()) {
+              largest_free_chunk = std::max(largest_free_chunk, size);
+            }
+          });
     }
+    stats["largest_free_chunk"] = static_cast<int64_t>(largest_free_chunk);
+    // blocks are never split
+    stats["inactive_split_bytes.all.current"] = 0;
+    stats["inactive_split.all.current"] = 0;
   }
 
-  void empty_cache() const override { empty_cache_impl(); }
+  // Blocks are never split, so each of them is a segment
+  void snapshot(std::vector<MemorySegmentSnapshot>& segments) const override {
+    std::lock_guard<mutex_t> lk(mutex_);
+    const size_t first = segments.size();
+    for (const auto& item : impl->allocated_) {
+      const Block& block = item.second;
+      auto address = reinterpret_cast<uintptr_t>(block.ptr);
+      MemorySegmentSnapshot segment;
+      segment.device = device().index();
+      segment.address = address;
+      segment.total_size = block.size;
+      segment.blocks.push_back({address, block.size, !block.idle});
+      segments.push_back(std::move(segment));
+    }
+    std::sort(segments.begin() + static_cast<std::ptrdiff_t>(first),
+              segments.end(), [](const auto& a, const auto& b) {
+                return a.address < b.address;
+              });
+  }
 
   void release_all_memory_impl() const {
     DIPU_DEBUG_ALLOCATOR(
@@ -177,14 +340,18 @@ class BSCachingAllocator : public CacheAllocator {
     empty_cache();
   }
 
-  void release_all_memory() const override { release_all_memory_impl(); }
+  void release_all_memory() const override {
+    LaunchQueueBarrierSkip skipBarrier;
+    release_all_memory_impl();
+  }
 
-  void flush_mem_pool() const {
+  void flush_mem_pool_locked() const {
     DIPU_DEBUG_ALLOCATOR(
         8, "BSCachingAllocator::flush_mem_pool allocator:" << this);
+    impl->unflushed_allocs_ = 0;
     while (async_mem_pool()->ready()) {
       auto mem = async_mem_pool()->get();
-      restore(std::get<1>(mem), std::get<0>(mem));
+      restore_locked(std::get<1>(mem), std::get<0>(mem));
     }
   }
 
@@ -199,17 +366,18 @@ class BSCachingAllocator : public CacheAllocator {
                                            << ", ptr:" << ptr()
                                            << ", size_:" << size());
       if (allocator_->impl) {
-        std::deque<DIPUEvent> events;
-        for (const auto& item : streams()) {
-          events.emplace_back();
-          events.back().record(item);
-        }
-
+        markFreed();
         allocator_->async_mem_pool()->add(std::make_tuple(ptr(), size()),
-                                          events);
+                                          streams());
         allocator_->set_memory_allocated(allocator_->memory_allocated() -
                                          real_size_);
-        allocator_->flush_mem_pool();
+        allocator_->stats().recordFree(real_size_);
+        // Blocks not ready yet are picked up by a later allocate, and there
+        // is no need to wait for an allocate holding the lock
+        std::unique_lock<mutex_t> lk(allocator_->mutex_, std::try_to_lock);
+        if (lk.owns_lock()) {
+          allocator_->flush_mem_pool_locked();
+        }
       }
     }
     size_t real_size_ = 0;
@@ -222,12 +390,14 @@ class BSCachingAllocator : public CacheAllocator {
 };
 
 static void deleteBSContext(void* ptr) {
+  LaunchQueueBarrierSkip skipBarrier;
   auto ctx = static_cast<BSCachingAllocator::Context*>(ptr);
-  c10::reportMemoryUsageToProfiler(
-      ctx->ptr(), -static_cast<int64_t>(ctx->real_size_),
-      ctx->allocator()->memory_allocated(), ctx->allocator()->memory_reserved(),
-      c10::Device(c10::DeviceType::CUDA, ctx->allocator()->device().index()));
+  const auto* allocator = ctx->allocator();
+  void* data = ctx->ptr();
+  const auto nbytes = static_cast<int64_t>(ctx->real_size_);
+  // reported once the totals no longer count it
   delete ctx;
+  allocator->report_memory_usage(data, -nbytes);
 }
 
 // TODO(allocator) - Refactor it!
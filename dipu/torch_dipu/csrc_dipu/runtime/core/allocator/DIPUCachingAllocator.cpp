@@ -2,13 +2,20 @@
 
 #include "DIPUCachingAllocator.h"
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <set>
+#include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include <c10/core/Device.h>
 #include <c10/core/DeviceType.h>
+#include <c10/util/Exception.h>
+#include <c10/util/StringUtil.h>
 
 #include "csrc_dipu/base/basedef.h"
 #include "csrc_dipu/runtime/core/DIPUEvent.h"
@@ -22,9 +29,35 @@ std::mutex DIPURawDeviceAllocator::mutex_;
 
 constexpr size_t kDefaultMaxAsyncResourcePoolLength = 64;
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
-const size_t kMaxAsyncResourcePoolLength = get_env_or_default(
+RuntimeConfig<size_t> gMaxAsyncResourcePoolLength(
     "DIPU_MAX_ASYNC_RESOURCE_POOL_LENGTH", kDefaultMaxAsyncResourcePoolLength);
 
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kStreamOrderedAsyncResourcePool =
+    get_env_or_default("DIPU_ASYNC_RESOURCE_POOL_STREAM_ORDERED", 0) > 0;
+
+constexpr size_t kDefaultStreamOrderedFlushInterval = 16;
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+RuntimeConfig<size_t> gStreamOrderedFlushInterval(
+    "DIPU_ASYNC_RESOURCE_POOL_FLUSH_INTERVAL",
+    kDefaultStreamOrderedFlushInterval);
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+RuntimeConfig<double> gGarbageCollectionThreshold("DIPU_ALLOCATOR_GC_THRESHOLD",
+                                                  0.0);
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+RuntimeConfig<size_t> gOutOfMemoryRetries("DIPU_OOM_RETRIES", 1);
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+RuntimeConfig<double> gMemoryLimitSoftRatio("DIPU_MEMORY_LIMIT_SOFT_RATIO",
+                                            0.9);
+
+// Initial memory fraction of device allocators, 0 for no limit
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const double kPerProcessMemoryFraction =
+    get_env_or_default("DIPU_PER_PROCESS_MEMORY_FRACTION", 0.0);
+
 namespace {
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
@@ -45,6 +78,188 @@ void setMemoryAlignmentStrategy(
   memoryAlignmentStrategy = memoryAlignStrategy;
 }
 
+void AllocatorStats::collect(MemoryStatsMap& stats) const {
+  auto load = [](const std::atomic<uint64_t>& value) {
+    return static_cast<int64_t>(value.load(std::memory_order_relaxed));
+  };
+  stats["num_cache_hits"] = load(counters_[kCacheHit]);
+  stats["num_cache_misses"] = load(counters_[kCacheMiss]);
+  stats["num_splits"] = load(counters_[kSplit]);
+  stats["num_merges"] = load(counters_[kMerge]);
+  stats["segment.all.allocated"] = load(counters_[kSegmentAlloc]);
+  stats["segment.all.freed"] = load(counters_[kSegmentFree]);
+  stats["segment.all.current"] =
+      load(counters_[kSegmentAlloc]) - load(counters_[kSegmentFree]);
+  stats["num_empty_cache"] = load(counters_[kEmptyCache]);
+  stats["num_alloc_retries"] = load(counters_[kAllocRetry]);
+  stats["num_ooms"] = load(counters_[kOOM]);
+  stats["num_garbage_collections"] = load(counters_[kGarbageCollection]);
+  stats["num_cross_stream_reuses"] = load(counters_[kCrossStreamReuse]);
+
+  int64_t allocated = 0;
+  int64_t freed = 0;
+  constexpr size_t kMinBinSize = 512;
+  for (int i = 0; i < kNumSizeBins; ++i) {
+    // use the lower bound of the bin as name
+    auto lower = i == 0 ? 0 : kMinBinSize << (i - 1);
+    auto prefix = "size_histogram." + std::to_string(lower) + ".";
+    stats[prefix + "allocated"] = load(allocCount_[i]);
+    stats[prefix + "freed"] = load(freeCount_[i]);
+    allocated += load(allocCount_[i]);
+    freed += load(freeCount_[i]);
+  }
+  stats["allocation.all.allocated"] = allocated;
+  stats["allocation.all.freed"] = freed;
+  stats["allocation.all.current"] = allocated - freed;
+}
+
+void AllocatorStats::startProfile() {
+  for (int i = 0; i < kNumSizeBins; ++i) {
+    peakBytes_[i].store(currentBytes_[i].load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+  }
+  profiling_.store(true, std::memory_order_relaxed);
+}
+
+std::vector<int64_t> AllocatorStats::stopProfile() {
+  profiling_.store(false, std::memory_order_relaxed);
+  std::vector<int64_t> peaks(kNumSizeBins);
+  for (int i = 0; i < kNumSizeBins; ++i) {
+    peaks[i] = peakBytes_[i].load(std::memory_order_relaxed);
+  }
+  return peaks;
+}
+
+size_t CacheAllocator::device_memory() const {
+  // the thresholds may change at runtime, the device memory doesn't
+  size_t total = device_memory_.load(std::memory_order_relaxed);
+  if (total == 0) {
+    total = devproxy::getDeviceProperties(device_.index()).totalGlobalMem;
+    device_memory_.store(total, std::memory_order_relaxed);
+  }
+  return total;
+}
+
+size_t CacheAllocator::gc_limit() const {
+  if (device_.type() != dipu::DIPU_DEVICE_TYPE) {
+    return 0;
+  }
+  size_t limit = 0;
+  const double threshold = gGarbageCollectionThreshold.get();
+  if (threshold > 0) {
+    limit = static_cast<size_t>(static_cast<double>(device_memory()) *
+                                std::min(threshold, 1.0));
+  }
+  // Trim the cache before allocations fail at the hard limit
+  const size_t hard_limit = memory_limit();
+  if (hard_limit > 0) {
+    auto soft_limit = static_cast<size_t>(
+        static_cast<double>(hard_limit) *
+        std::clamp(gMemoryLimitSoftRatio.get(), 0.0, 1.0));
+    limit = limit == 0 ? soft_limit : std::min(limit, soft_limit);
+  }
+  return limit;
+}
+
+void CacheAllocator::set_raw_allocator(c10::Allocator* raw_allocator) {
+  raw_allocator_ = raw_allocator;
+  device_ = raw_allocator_->allocate(0).device();
+  if (kPerProcessMemoryFraction > 0) {
+    set_memory_fraction(kPerProcessMemoryFraction);
+  }
+}
+
+void CacheAllocator::set_memory_fraction(double fraction) const {
+  // 0 would read as no limit, set_memory_limit(0) removes it instead
+  TORCH_CHECK(fraction > 0 && fraction <= 1,
+              "memory fraction must be in (0, 1], got ", fraction);
+  if (device_.type() != dipu::DIPU_DEVICE_TYPE) {
+    return;
+  }
+  set_memory_limit(static_cast<size_t>(
+      static_cast<double>(device_memory()) * fraction));
+}
+
+void* CacheAllocator::allocate_raw(size_t n) const {
+  TORCH_CHECK(hold_memory(n), out_of_memory_message(n));
+  try {
+    return raw_allocator()->raw_allocate(n);
+  } catch (...) {
+    unhold_memory(n);
+    throw;
+  }
+}
+
+void CacheAllocator::free_raw(void* ptr, size_t n) const {
+  raw_allocator()->raw_deallocate(ptr);
+  unhold_memory(n);
+}
+
+bool CacheAllocator::hold_memory(size_t n) const {
+  const size_t limit = memory_limit();
+  size_t held = held_bytes_.fetch_add(n, std::memory_order_relaxed) + n;
+  if (limit != 0 && held > limit) {
+    unhold_memory(n);
+    return false;
+  }
+  return true;
+}
+
+void CacheAllocator::check_memory_limit(size_t n) const {
+  const size_t limit = memory_limit();
+  TORCH_CHECK(limit == 0 || n <= limit, "tried to allocate ", n,
+              " bytes on ", device_, ", more than the memory limit of ",
+              limit, " bytes of this process");
+}
+
+std::string CacheAllocator::out_of_memory_message(size_t n) const {
+  const size_t limit = memory_limit();
+  if (limit == 0) {
+    return "no memory available";
+  }
+  return c10::str("no memory available, tried to allocate ", n, " bytes on ",
+                  device_, " with ",
+                  held_bytes_.load(std::memory_order_relaxed), " of the ",
+                  limit, " bytes allowed to this process held");
+}
+
+void CacheAllocator::sync_with_default_stream(
+    const DIPUStream& stream, const DIPUStream& default_stream) const {
+  // Read before recording, so a free racing with the event is synced later
+  auto epoch = free_epoch_.load(std::memory_order_relaxed);
+  {
+    std::lock_guard<SpinMutex> lk(sync_epochs_mutex_);
+    auto iter = sync_epochs_.find(stream.id());
+    if (epoch == 0 || (iter != sync_epochs_.end() && iter->second >= epoch)) {
+      return;
+    }
+  }
+  DIPUEvent event(devapis::EventFlags::DISABLE_TIMING);
+  event.record(default_stream);
+  event.wait(stream);
+  std::lock_guard<SpinMutex> lk(sync_epochs_mutex_);
+  auto& synced = sync_epochs_[stream.id()];
+  synced = std::max(synced, epoch);
+}
+
+void CacheAllocator::memory_stats(MemoryStatsMap& stats) const {
+  stats_.collect(stats);
+  auto allocated = static_cast<int64_t>(memory_allocated());
+  auto reserved = static_cast<int64_t>(memory_reserved());
+  stats["allocated_bytes.all.current"] = allocated;
+  stats["allocated_bytes.all.peak"] =
+      static_cast<int64_t>(max_memory_allocated());
+  stats["active_bytes.all.current"] = allocated;
+  stats["reserved_bytes.all.current"] = reserved;
+  stats["reserved_bytes.all.peak"] =
+      static_cast<int64_t>(max_memory_reserved());
+  auto hits = stats["num_cache_hits"];
+  auto total = hits + stats["num_cache_misses"];
+  // in per mille to keep integer values
+  constexpr int64_t kPerMille = 1000;
+  stats["cache_hit_rate_per_mille"] = total > 0 ? hits * kPerMille / total : 0;
+}
+
 namespace {
 
 // using RegisteredAllocator = std::map<c10::DeviceType, std::map<std::string,
@@ -147,11 +362,21 @@ c10::Allocator* getAllocator(const c10::Device& device) {
   // allocator_lookup_table[device_count] == host allocator
   static const int device_count = devproxy::getDeviceCount();
   static const int host_index = device_count;
-  static std::vector<c10::Allocator*> allocator_lookup_table(device_count + 1);
+  static std::vector<std::atomic<c10::Allocator*>> allocator_lookup_table(
+      device_count + 1);
+  static std::mutex create_mutex;
   int device_index = getDeviceIndex(device, host_index);
-  auto& allocator = allocator_lookup_table[device_index];
+  TORCH_CHECK(device_index >= 0 && device_index <= host_index,
+              "invalid device index ", device_index, " for allocator");
+  auto& entry = allocator_lookup_table[device_index];
+  c10::Allocator* allocator = entry.load(std::memory_order_acquire);
   if (allocator == nullptr) {
-    allocator = createAllocator(device);
+    std::lock_guard<std::mutex> lk(create_mutex);
+    allocator = entry.load(std::memory_order_relaxed);
+    if (allocator == nullptr) {
+      allocator = createAllocator(device);
+      entry.store(allocator, std::memory_order_release);
+    }
   }
   return allocator;
 }
@@ -174,6 +399,35 @@ void emptyCachedMem() {
   for (auto& allocator : used_allocator) {
     empty_allocator_cache(allocator);
   }
+  // the blocks handed back above may be waiting in the deferred frees
+  flushDeferredDeviceFrees();
+}
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+thread_local MemPoolId current_mem_pool = kDefaultMemPool;
+
+}  // namespace
+
+MemPoolId createMemPool() {
+  static std::atomic<MemPoolId> next_pool{kDefaultMemPool + 1};
+  return next_pool.fetch_add(1, std::memory_order_relaxed);
+}
+
+MemPoolId currentMemPool() { return current_mem_pool; }
+
+MemPoolId exchangeMemPool(MemPoolId pool) {
+  return std::exchange(current_mem_pool, pool);
+}
+
+void emptyMemPool(MemPoolId pool) {
+  for (auto& allocator : used_allocator) {
+    auto cached_allocator = dynamic_cast<CacheAllocator*>(allocator);
+    if (cached_allocator != nullptr) {
+      cached_allocator->empty_mem_pool(pool);
+    }
+  }
 }
 
 void releaseAllDeviceMem() {
@@ -189,6 +443,7 @@ void releaseAllDeviceMem() {
   for (auto& allocator : used_allocator) {
     release_allocator_memory(allocator);
   }
+  flushDeferredDeviceFrees();
 }
 
 size_t memoryReserved(const c10::Device& device) {
@@ -209,6 +464,32 @@ size_t memoryAllocated(const c10::Device& device) {
   return 0;
 }
 
+void setMemoryFraction(double fraction, const c10::Device& device) {
+  TORCH_CHECK(device.type() == dipu::DIPU_DEVICE_TYPE,
+              "memory limits are only supported on dipu devices");
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(getAllocator(device));
+  if (cached_allocator != nullptr) {
+    cached_allocator->set_memory_fraction(fraction);
+  }
+}
+
+void setMemoryLimit(size_t limit, const c10::Device& device) {
+  TORCH_CHECK(device.type() == dipu::DIPU_DEVICE_TYPE,
+              "memory limits are only supported on dipu devices");
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(getAllocator(device));
+  if (cached_allocator != nullptr) {
+    cached_allocator->set_memory_limit(limit);
+  }
+}
+
+size_t memoryLimit(const c10::Device& device) {
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(getAllocator(device));
+  if (cached_allocator != nullptr) {
+    return cached_allocator->memory_limit();
+  }
+  return 0;
+}
+
 size_t maxMemoryReserved(const c10::Device& device) {
   c10::Allocator* allocator = getAllocator(device);
   auto cached_allocator = dynamic_cast<CacheAllocator*>(allocator);
@@ -227,6 +508,121 @@ size_t maxMemoryAllocated(const c10::Device& device) {
   return 0;
 }
 
+MemoryStatsMap memoryStats(const c10::Device& device) {
+  MemoryStatsMap stats;
+  c10::Allocator* allocator = getAllocator(device);
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(allocator);
+  if (cached_allocator != nullptr) {
+    cached_allocator->memory_stats(stats);
+  }
+  return stats;
+}
+
+namespace allocator_details {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> segment_hooks_added{false};
+
+namespace {
+
+// Function local, hooks may be added by static initializers of other files
+std::mutex& segmentHooksMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Guarded by `segmentHooksMutex()`
+std::vector<SegmentHook>& segmentHooks() {
+  static std::vector<SegmentHook> hooks;
+  return hooks;
+}
+
+}  // namespace
+
+void runSegmentHooks(c10::DeviceIndex device, void* ptr, size_t size,
+                     bool mapped) {
+  std::lock_guard<std::mutex> _(segmentHooksMutex());
+  for (auto& hook : segmentHooks()) {
+    hook(device, ptr, size, mapped);
+  }
+}
+
+}  // namespace allocator_details
+
+void addSegmentHook(SegmentHook hook) {
+  std::lock_guard<std::mutex> _(allocator_details::segmentHooksMutex());
+  allocator_details::segmentHooks().push_back(std::move(hook));
+  allocator_details::segment_hooks_added.store(true);
+}
+
+namespace {
+
+std::mutex& outOfMemoryObserversMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Guarded by `outOfMemoryObserversMutex()`
+std::vector<OutOfMemoryObserver>& outOfMemoryObservers() {
+  static std::vector<OutOfMemoryObserver> observers;
+  return observers;
+}
+
+}  // namespace
+
+void addOutOfMemoryObserver(OutOfMemoryObserver observer) {
+  std::lock_guard<std::mutex> _(outOfMemoryObserversMutex());
+  outOfMemoryObservers().push_back(std::move(observer));
+}
+
+bool notifyOutOfMemoryObservers(c10::DeviceIndex device, size_t size,
+                                size_t allocated, size_t reserved) {
+  // Copied, observers may add observers or allocate on other threads
+  std::vector<OutOfMemoryObserver> observers;
+  {
+    std::lock_guard<std::mutex> _(outOfMemoryObserversMutex());
+    observers = outOfMemoryObservers();
+  }
+  for (auto& observer : observers) {
+    observer(device, size, allocated, reserved);
+  }
+  return !observers.empty();
+}
+
+std::vector<MemorySegmentSnapshot> memorySnapshot() {
+  std::vector<MemorySegmentSnapshot> segments;
+  for (auto& allocator : used_allocator) {
+    auto cached_allocator = dynamic_cast<CacheAllocator*>(allocator);
+    if (cached_allocator != nullptr) {
+      cached_allocator->snapshot(segments);
+    }
+  }
+  return segments;
+}
+
+void startAllocatorProfile(const c10::Device& device) {
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(getAllocator(device));
+  if (cached_allocator != nullptr) {
+    cached_allocator->start_profile();
+  }
+}
+
+std::vector<int64_t> stopAllocatorProfile(const c10::Device& device) {
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(getAllocator(device));
+  if (cached_allocator != nullptr) {
+    return cached_allocator->stop_profile();
+  }
+  return {};
+}
+
+void reserveForAllocatorProfile(const c10::Device& device,
+                                const std::vector<int64_t>& peak_bytes) {
+  auto cached_allocator = dynamic_cast<CacheAllocator*>(getAllocator(device));
+  if (cached_allocator != nullptr) {
+    cached_allocator->reserve_for_profile(peak_bytes);
+  }
+}
+
 void recordStream(const c10::DataPtr& ptr, const DIPUStream& stream) {
   using pointer = CacheAllocator::DataPtrContextBase*;
   if (auto ctx = static_cast<pointer>(ptr.get_context())) {
@@ -251,7 +647,7 @@ class DIPUDeviceCachingProxy : public c10::Allocator {
   c10::DataPtr allocate(size_t size) const override {
     auto currentStream = getCurrentDIPUStream();
     auto defaultStream = getDefaultDIPUStream();
-    DIPUEvent event;
+    DIPUEvent event(devapis::EventFlags::DISABLE_TIMING);
     if (currentStream != defaultStream) {
       // When allocating memory to a non-default stream, since record_stream is
       // not performed on the default stream, the non-default stream needs to
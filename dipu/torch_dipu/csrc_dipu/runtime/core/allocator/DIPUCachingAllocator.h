@@ -1,21 +1,41 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <c10/core/Allocator.h>
 #include <c10/core/Device.h>
 #include <c10/util/flat_hash_map.h>
 
 #include "csrc_dipu/runtime/core/DIPUEvent.h"
+#include "csrc_dipu/runtime/core/DIPUGraph.h"
+#include "csrc_dipu/runtime/core/DIPULaunchQueue.h"
+#include "csrc_dipu/runtime/core/MemTracer.h"
+#include "csrc_dipu/utils/env.hpp"
 
 #include "DIPUAsyncResourcePool.h"
 #include "DIPUCachingAllocatorUtils.h"
 #include "DIPURawAllocator.h"
+#include "DIPUSpinMutex.h"
 
 namespace dipu {
 
 constexpr size_t kDefaultMermoryAlignment = 512;
 
-extern const size_t kMaxAsyncResourcePoolLength;
+extern RuntimeConfig<size_t> gMaxAsyncResourcePoolLength;
+
+// Fraction of the device memory above which caching allocators give idle
+// cached memory back to the device, 0 disables it
+extern RuntimeConfig<double> gGarbageCollectionThreshold;
 
 class MemoryAlignmentStrategy {
   size_t kBytesAlign = kDefaultMermoryAlignment;
@@ -93,42 +113,301 @@ class MemStats {
   size_t max_memory_reserved() const { return max_reserved_in_bytes_; }
 };
 
+using MemoryStatsMap = std::map<std::string, int64_t>;
+
+// Counters maintained on allocator hot paths. They are only read for
+// reporting, so relaxed atomics are enough.
+class AllocatorStats {
+ public:
+  // Bin `i` counts blocks in [512 * 2^(i-1), 512 * 2^i), the last bin holds
+  // all larger blocks
+  static constexpr int kNumSizeBins = 32;
+
+  enum Counter : int {
+    kCacheHit,
+    kCacheMiss,
+    kSplit,
+    kMerge,
+    kSegmentAlloc,
+    kSegmentFree,
+    kEmptyCache,
+    kAllocRetry,
+    kOOM,
+    kGarbageCollection,
+    kCrossStreamReuse,
+    kNumCounters,
+  };
+
+  static int sizeBin(size_t nbytes) {
+    constexpr size_t kMinBinSize = 512;
+    size_t blocks = nbytes / kMinBinSize;
+    if (blocks == 0) {
+      return 0;
+    }
+    constexpr int kMaxBitIdx = 63;
+    int bin = kMaxBitIdx - __builtin_clzll(blocks) + 1;
+    return std::min(bin, kNumSizeBins - 1);
+  }
+
+  void add(Counter counter, uint64_t value = 1) {
+    counters_[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void recordAlloc(size_t nbytes) {
+    int bin = sizeBin(nbytes);
+    allocCount_[bin].fetch_add(1, std::memory_order_relaxed);
+    auto bytes = static_cast<int64_t>(nbytes);
+    auto current =
+        currentBytes_[bin].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    if (profiling_.load(std::memory_order_relaxed)) {
+      auto peak = peakBytes_[bin].load(std::memory_order_relaxed);
+      while (peak < current && !peakBytes_[bin].compare_exchange_weak(
+                                   peak, current, std::memory_order_relaxed)) {
+      }
+    }
+  }
+
+  void recordFree(size_t nbytes) {
+    int bin = sizeBin(nbytes);
+    freeCount_[bin].fetch_add(1, std::memory_order_relaxed);
+    currentBytes_[bin].fetch_sub(static_cast<int64_t>(nbytes),
+                                 std::memory_order_relaxed);
+  }
+
+  void collect(MemoryStatsMap& stats) const;
+
+  // Track the peak bytes in use of each size bin until `stopProfile`
+  void startProfile();
+
+  // Return the peak bytes in use of each size bin since `startProfile`
+  std::vector<int64_t> stopProfile();
+
+ private:
+  std::array<std::atomic<uint64_t>, kNumCounters> counters_{};
+  std::array<std::atomic<uint64_t>, kNumSizeBins> allocCount_{};
+  std::array<std::atomic<uint64_t>, kNumSizeBins> freeCount_{};
+  std::array<std::atomic<int64_t>, kNumSizeBins> currentBytes_{};
+  std::array<std::atomic<int64_t>, kNumSizeBins> peakBytes_{};
+  std::atomic<bool> profiling_{false};
+};
+
+// Memory held by an allocator, see torch.cuda.memory._snapshot()
+struct MemoryBlockSnapshot {
+  uintptr_t address = 0;
+  size_t size = 0;
+  bool active = false;
+};
+
+struct MemorySegmentSnapshot {
+  c10::DeviceIndex device = 0;
+  uintptr_t address = 0;
+  size_t total_size = 0;
+  c10::StreamId stream = 0;
+  bool expandable = false;
+  std::vector<MemoryBlockSnapshot> blocks;
+};
+
+// Called when device allocators get memory from the device, with `mapped`
+// true, and right before they give it back, with `mapped` false. Hooks run
+// under the allocator lock, so they must neither allocate nor free.
+using SegmentHook = std::function<void(c10::DeviceIndex device, void* ptr,
+                                       size_t size, bool mapped)>;
+
+// Hooks can't be removed, they are meant to be added on library load
+DIPU_API void addSegmentHook(SegmentHook hook);
+
+namespace allocator_details {
+
+extern std::atomic<bool> segment_hooks_added;
+
+void runSegmentHooks(c10::DeviceIndex device, void* ptr, size_t size,
+                     bool mapped);
+
+}  // namespace allocator_details
+
+// Called when a caching allocator is about to fail an allocation of `size`
+// bytes on `device` after giving back its cache, with the bytes it has
+// allocated and reserved. Observers may free memory, e.g. drop application
+// caches, and the allocation is retried after them. They run without
+// allocator locks held and may allocate or free.
+using OutOfMemoryObserver = std::function<void(
+    c10::DeviceIndex device, size_t size, size_t allocated, size_t reserved)>;
+
+// Observers can't be removed, they are run in the order they were added
+DIPU_API void addOutOfMemoryObserver(OutOfMemoryObserver observer);
+
+// Runs the observers, returns false if there are none
+bool notifyOutOfMemoryObservers(c10::DeviceIndex device, size_t size,
+                                size_t allocated, size_t reserved);
+
+// Fraction of its memory limit above which a caching allocator gives idle
+// cached memory back to the device, see DIPU_MEMORY_LIMIT_SOFT_RATIO
+extern RuntimeConfig<double> gMemoryLimitSoftRatio;
+
+// Number of times an allocation is retried after the out of memory observers
+// ran, see DIPU_OOM_RETRIES
+extern RuntimeConfig<size_t> gOutOfMemoryRetries;
+
+// Runs the segment hooks if `action` maps or unmaps device memory
+inline void notifySegmentHooks(MemTracer::Action action,
+                               c10::DeviceIndex device, const void* ptr,
+                               size_t size) {
+  if (!allocator_details::segment_hooks_added.load(
+          std::memory_order_relaxed)) {
+    return;
+  }
+  bool mapped = action == MemTracer::Action::kSegmentAlloc ||
+                action == MemTracer::Action::kSegmentMap;
+  if (mapped || action == MemTracer::Action::kSegmentFree ||
+      action == MemTracer::Action::kSegmentUnmap) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    allocator_details::runSegmentHooks(device, const_cast<void*>(ptr), size,
+                                       mapped);
+  }
+}
+
 class DIPU_API CacheAllocator : public c10::Allocator, public MemStats {
   c10::Allocator* raw_allocator_ = nullptr;
   AsyncMemPool* async_mem_pool_ = nullptr;
   mutable c10::Device device_ = c10::DeviceType::CPU;
+  mutable AllocatorStats stats_;
+  mutable std::atomic<size_t> device_memory_{0};
+  // Device memory held by the cache and its hard limit, 0 for no limit
+  mutable std::atomic<size_t> held_bytes_{0};
+  mutable std::atomic<size_t> memory_limit_{0};
+  // Number of frees so far. A stream which waited on the default stream at
+  // some count need not wait again for memory freed before it.
+  mutable std::atomic<uint64_t> free_epoch_{0};
+  mutable SpinMutex sync_epochs_mutex_;
+  // Guarded by `sync_epochs_mutex_`
+  mutable ska::flat_hash_map<c10::StreamId, uint64_t> sync_epochs_;
 
  protected:
   c10::Allocator* raw_allocator() const { return raw_allocator_; }
 
   AsyncMemPool* async_mem_pool() const { return async_mem_pool_; }
 
-  void* allocate_raw(size_t n) { return raw_allocator()->raw_allocate(n); }
+  // Get `n` bytes of device memory for the cache, throws beyond the memory
+  // limit
+  void* allocate_raw(size_t n) const;
+
+  void free_raw(void* ptr, size_t n) const;
+
+  // Count `n` more bytes of device memory mapped by the cache, returns false
+  // and counts nothing if they go beyond the memory limit
+  bool hold_memory(size_t n) const;
+
+  void unhold_memory(size_t n) const {
+    held_bytes_.fetch_sub(n, std::memory_order_relaxed);
+  }
+
+  // Fail at once if `n` bytes can't be allocated even with an empty cache
+  void check_memory_limit(size_t n) const;
+
+  // Error message of a failed allocation of `n` bytes
+  std::string out_of_memory_message(size_t n) const;
+
+  AllocatorStats& stats() const { return stats_; }
+
+  // Hides MemStats::set_memory_reserved, so that segments reserved or
+  // released show up to the profiler as memory events of 0 bytes
+  void set_memory_reserved(size_t reserved_in_bytes) const {
+    const bool changed = reserved_in_bytes != memory_reserved();
+    MemStats::set_memory_reserved(reserved_in_bytes);
+    if (changed) {
+      report_memory_usage(nullptr, 0);
+    }
+  }
+
+  void trace(MemTracer::Action action, const void* ptr, size_t size,
+             c10::StreamId stream = 0) const {
+    if (device_.type() != dipu::DIPU_DEVICE_TYPE) {
+      return;
+    }
+    if (MemTracer::enabled()) {
+      MemTracer::instance().record(action, device_.index(), ptr, size, stream);
+    }
+    notifySegmentHooks(action, device_.index(), ptr, size);
+  }
+
+  // Bytes of reserved memory above which idle cached memory should be
+  // released, 0 if garbage collection is disabled
+  size_t gc_limit() const;
+
+  size_t device_memory() const;
 
-  void free_raw(void* ptr) { return raw_allocator()->raw_deallocate(ptr); }
+  // Make the non-default `stream` wait for the work queued on the default
+  // stream, unless it already did so after the last free
+  void sync_with_default_stream(const DIPUStream& stream,
+                                const DIPUStream& default_stream) const;
 
  public:
   CacheAllocator() = default;
 
-  void set_raw_allocator(c10::Allocator* raw_allocator) {
-    raw_allocator_ = raw_allocator;
-    device_ = raw_allocator_->allocate(0).device();
-  }
+  // Also applies DIPU_PER_PROCESS_MEMORY_FRACTION to device allocators
+  void set_raw_allocator(c10::Allocator* raw_allocator);
 
   void set_async_mem_pool(AsyncMemPool* async_mem_pool) {
     async_mem_pool_ = async_mem_pool;
   }
 
+  // Hard limit of the device memory held by this allocator, 0 for no limit.
+  // Only device allocators are limited. Memory held beyond a new limit is
+  // kept until it is freed.
+  void set_memory_limit(size_t limit) const {
+    memory_limit_.store(limit, std::memory_order_relaxed);
+  }
+
+  size_t memory_limit() const {
+    return memory_limit_.load(std::memory_order_relaxed);
+  }
+
+  // Limit this allocator to `fraction` of the device memory
+  void set_memory_fraction(double fraction) const;
+
   ~CacheAllocator() override = default;
 
   virtual void empty_cache() const = 0;
 
   virtual void release_all_memory() const = 0;
 
+  // Release the cached memory of a private pool
+  virtual void empty_mem_pool(MemPoolId pool) const {}
+
+  // Grow the block of `data_ptr`, allocated by this allocator, to hold
+  // `size` bytes without moving it. Returns false if the memory after it is
+  // not free, leaving the block as it was.
+  virtual bool try_expand(const c10::DataPtr& data_ptr, size_t size) const {
+    return false;
+  }
+
+  // Pre-reserve memory for the peak bytes in use of each size bin, as
+  // returned by AllocatorStats::stopProfile
+  virtual void reserve_for_profile(
+      const std::vector<int64_t>& peak_bytes) const {}
+
+  void start_profile() const { stats_.startProfile(); }
+
+  std::vector<int64_t> stop_profile() const { return stats_.stopProfile(); }
+
+  // Fill `stats` with flattened keys like torch.cuda.memory_stats(). Derived
+  // allocators may add details which need to walk their cache.
+  virtual void memory_stats(MemoryStatsMap& stats) const;
+
+  // Append all segments held by this allocator
+  virtual void snapshot(std::vector<MemorySegmentSnapshot>& segments) const {}
+
   c10::Device& device() const { return device_; }
 
+  // Report `nbytes` allocated at `ptr`, or freed if negative, to the
+  // profiler along with the totals, which must already include them
+  void report_memory_usage(void* ptr, int64_t nbytes) const {
+    c10::reportMemoryUsageToProfiler(ptr, nbytes, memory_allocated(),
+                                     memory_reserved(), device_);
+  }
+
   class DataPtrContextBase {
-    ska::flat_hash_set<DIPUStream> streams_;
+    StreamSet streams_;
     mutable const CacheAllocator* allocator_ = nullptr;
     void* ptr_ = nullptr;
     size_t size_ = 0;
@@ -138,11 +417,19 @@ class DIPU_API CacheAllocator : public c10::Allocator, public MemStats {
         : allocator_(allocator), ptr_(ptr), size_(size) {
       if (allocator_->device().type() == dipu::DIPU_DEVICE_TYPE) {
         auto currentStream = getCurrentDIPUStream();
+        if (ptr != nullptr) {
+          allocator_->trace(MemTracer::Action::kAlloc, ptr, size,
+                            currentStream.id());
+        }
         auto defaultStream = getDefaultDIPUStream();
         // If current stream is the default stream, we don't need to synchronize
         // But before releasing the memory we must synchronize the default
         // stream
-        if (defaultStream != currentStream) {
+        // A capturing stream already waited on the default stream when the
+        // capture began, and its blocks are reused in stream order
+        if (defaultStream != currentStream &&
+            !(isCaptureUnderway() &&
+              devproxy::isStreamCapturing(currentStream.rawstream()))) {
           streams_.insert(currentStream);
           // When allocating memory to a non-default stream, since record_stream
           // is not performed on the default stream, the non-default stream
@@ -151,17 +438,30 @@ class DIPU_API CacheAllocator : public c10::Allocator, public MemStats {
           // operations here, the upper layer does not need to manually add a
           // wait for the default stream when allocating memory on the
           // non-default stream.
-          DIPUEvent event;
-          event.record(defaultStream);
-          event.wait(currentStream);
+          allocator_->sync_with_default_stream(currentStream, defaultStream);
         }
       }
       MemChecker::instance().insert(ptr, size);
     }
 
-    ~DataPtrContextBase() { MemChecker::instance().erase(ptr_); }
+    ~DataPtrContextBase() {
+      if (ptr_ != nullptr) {
+        allocator_->trace(MemTracer::Action::kFreeRequested, ptr_, size_);
+      }
+      MemChecker::instance().erase(ptr_);
+    }
 
-    ska::flat_hash_set<DIPUStream>& streams() { return streams_; }
+   protected:
+    // Derived contexts call it before the memory can be reused. The block is
+    // handed over under the allocator locks, so a relaxed increment is seen
+    // by the thread allocating it next.
+    void markFreed() const {
+      allocator_->free_epoch_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+   public:
+
+    StreamSet& streams() { return streams_; }
 
     const CacheAllocator* allocator() { return allocator_; }
 
@@ -177,6 +477,9 @@ void setAllocator(const std::string& name, c10::DeviceType device_type,
 
 c10::Allocator* getAllocator(c10::DeviceType device_type);
 
+// Segments of all device allocators in use
+std::vector<MemorySegmentSnapshot> memorySnapshot();
+
 namespace allocator_details {  // For internal implementation only
 
 struct AllocatorRegisterer {
@@ -201,48 +504,35 @@ struct RawAllocator<at::DeviceType::CPU> {
   using type = DIPURawHostAllocator;
 };
 
-template <typename AllocatorImpl, class AsyncMemPoolImpl, int device_id>
-c10::Allocator* get_allocator_impl(c10::Allocator* raw_allocator) {
-  // Construct when really needed
-  // async_mem_pool is used when cache_allocator being destructed so it should
-  // be destructed after cache_allocator
-  static AsyncMemPoolImpl async_mem_pool;
-  static AllocatorImpl cache_allocator;
-  static int n = [&]() {
-    cache_allocator.set_raw_allocator(raw_allocator);
-    cache_allocator.set_async_mem_pool(&async_mem_pool);
-    return 0;
-  }();
-  return &cache_allocator;
-}
-
+// Each device gets its own caching allocator, constructed when really needed.
+// The table is sized by the device count, so lookups are O(1) for any number
+// of cards.
 template <class AllocatorImpl, class AsyncMemPoolImpl>
 c10::Allocator* get_allocator(int device_id, c10::Allocator* raw_allocator) {
-#define DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(id)                       \
-  if (device_id == (id)) {                                          \
-    return get_allocator_impl<AllocatorImpl, AsyncMemPoolImpl, id>( \
-        raw_allocator);                                             \
-  }
-
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(0);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(1);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(2);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(3);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(4);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(5);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(6);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(7);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(8);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(9);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(10);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(11);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(12);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(13);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(14);
-  DIPU_ALLOCATOR_DISPATCH_DEVICE_ID(15);
-  TORCH_CHECK(false, "support up to 16 cards");
+  struct Instance {
+    // async_mem_pool is used when cache_allocator being destructed so it
+    // should be destructed after cache_allocator
+    AsyncMemPoolImpl async_mem_pool;
+    AllocatorImpl cache_allocator;
+  };
+  struct Slot {
+    std::once_flag flag;
+    std::unique_ptr<Instance> instance;
+  };
+  // Host allocators are always got with device 0
+  static std::vector<Slot> slots(std::max(devproxy::getDeviceCount(), 1));
+  TORCH_CHECK(device_id >= 0 && device_id < static_cast<int>(slots.size()),
+              "invalid device index ", device_id, " for allocator, only ",
+              slots.size(), " devices found");
+  auto& slot = slots[device_id];
+  std::call_once(slot.flag, [&slot, raw_allocator] {
+    auto instance = std::make_unique<Instance>();
+    instance->cache_allocator.set_raw_allocator(raw_allocator);
+    instance->cache_allocator.set_async_mem_pool(&instance->async_mem_pool);
+    slot.instance = std::move(instance);
+  });
+  return &slot.instance->cache_allocator;
 }
-#undef DIPU_ALLOCATOR_DISPATCH_DEVICE_ID
 
 #define DIPU_REGISTER_ALLOCATOR(name, device_type, CachingAllocator, priority) \
   namespace name##device_type {                                                \
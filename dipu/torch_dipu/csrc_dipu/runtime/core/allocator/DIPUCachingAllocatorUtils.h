@@ -1,6 +1,11 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
 #include <c10/core/Allocator.h>
 #include <c10/core/Device.h>
 
@@ -15,8 +20,60 @@ size_t maxMemoryReserved(const c10::Device& device);
 
 size_t maxMemoryAllocated(const c10::Device& device);
 
+std::map<std::string, int64_t> memoryStats(const c10::Device& device);
+
+// Limit the device memory held by the caching allocator of `device` to
+// `fraction` of the device memory, or to `limit` bytes. 0 removes the limit.
+// Near the limit the allocator gives back idle cached memory, beyond it
+// allocations fail.
+void setMemoryFraction(double fraction, const c10::Device& device);
+
+void setMemoryLimit(size_t limit, const c10::Device& device);
+
+size_t memoryLimit(const c10::Device& device);
+
+// Record the peak bytes in use of each allocation size bin, e.g. during one
+// training step, and reserve memory for them later to skip the slow start
+void startAllocatorProfile(const c10::Device& device);
+
+std::vector<int64_t> stopAllocatorProfile(const c10::Device& device);
+
+void reserveForAllocatorProfile(const c10::Device& device,
+                                const std::vector<int64_t>& peak_bytes);
+
 void emptyCachedMem();
 
+// Private pools isolate allocations from the default pool of the caching
+// allocator, they are selected per thread. Only BF allocator supports them,
+// other allocators always use the default pool.
+using MemPoolId = int64_t;
+constexpr MemPoolId kDefaultMemPool = 0;
+
+MemPoolId createMemPool();
+
+MemPoolId currentMemPool();
+
+// Set the pool of the current thread and return the previous one
+MemPoolId exchangeMemPool(MemPoolId pool);
+
+// Release the cached memory of `pool` on all devices
+void emptyMemPool(MemPoolId pool);
+
+class DIPUMemPoolGuard {
+ public:
+  explicit DIPUMemPoolGuard(MemPoolId pool) : prev_(exchangeMemPool(pool)) {}
+
+  ~DIPUMemPoolGuard() { exchangeMemPool(prev_); }
+
+  DIPUMemPoolGuard(const DIPUMemPoolGuard&) = delete;
+  DIPUMemPoolGuard& operator=(const DIPUMemPoolGuard&) = delete;
+  DIPUMemPoolGuard(DIPUMemPoolGuard&&) = delete;
+  DIPUMemPoolGuard& operator=(DIPUMemPoolGuard&&) = delete;
+
+ private:
+  MemPoolId prev_;
+};
+
 void initCachedAllocator();
 
 void releaseAllDeviceMem();
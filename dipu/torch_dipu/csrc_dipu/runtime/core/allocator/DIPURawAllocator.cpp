@@ -2,32 +2,175 @@
 
 #include "DIPURawAllocator.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
 #include <map>
 #include <mutex>
 #include <unordered_set>
 #include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "csrc_dipu/base/basedef.h"
+#include "csrc_dipu/runtime/core/DIPUAffinity.h"
+#include "csrc_dipu/runtime/core/DIPUEvent.h"
 #include "csrc_dipu/runtime/core/DIPUStream.h"
 #include "csrc_dipu/runtime/devproxy/deviceproxy.h"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 
+namespace allocator_log {
+
+namespace {
+
+class LineBuffer {
+ public:
+  explicit LineBuffer(size_t capacity) : capacity_(capacity) {
+    buffer_.reserve(capacity);
+  }
+  LineBuffer(const LineBuffer&) = delete;
+  LineBuffer& operator=(const LineBuffer&) = delete;
+  ~LineBuffer() { flush(); }
+
+  void append(const std::string& line) {
+    if (buffer_.size() + line.size() > capacity_) {
+      flush();
+    }
+    buffer_ += line;
+  }
+
+  void flush() {
+    if (!buffer_.empty()) {
+      // a single write, lines of different threads don't interleave
+      std::fwrite(buffer_.data(), 1, buffer_.size(), stdout);
+      std::fflush(stdout);
+      buffer_.clear();
+    }
+  }
+
+ private:
+  size_t capacity_;
+  std::string buffer_;
+};
+
+}  // namespace
+
+void write(const std::string& line) {
+  static const size_t capacity =
+      get_env_or_default("DIPU_DEBUG_ALLOCATOR_BUFFER", size_t{0});
+  if (capacity == 0) {
+    std::fwrite(line.data(), 1, line.size(), stdout);
+    std::fflush(stdout);
+    return;
+  }
+  thread_local LineBuffer buffer(capacity);
+  buffer.append(line);
+}
+
+}  // namespace allocator_log
+
+namespace {
+
+// Free device memory after the default stream reaches the point of release
+// instead of synchronizing the default stream, set it to 0 to synchronize.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kDeferredDeviceFree =
+    get_env_or_default("DIPU_RAW_ALLOCATOR_DEFERRED_FREE", 1) > 0;
+
+class DeferredDeviceFrees {
+ public:
+  DeferredDeviceFrees() = default;
+  DeferredDeviceFrees(const DeferredDeviceFrees&) = delete;
+  DeferredDeviceFrees& operator=(const DeferredDeviceFrees&) = delete;
+  DeferredDeviceFrees(DeferredDeviceFrees&&) = delete;
+  DeferredDeviceFrees& operator=(DeferredDeviceFrees&&) = delete;
+
+  ~DeferredDeviceFrees() {
+    try {
+      flush();
+    } catch (...) {
+      // the runtime may already be unusable at exit, leak what is left
+      pending_.clear();
+    }
+  }
+
+  void add(void* ptr) {
+    auto stream = getDefaultDIPUStream();
+    if (devproxy::freeDeviceAsync(ptr, stream.rawstream())) {
+      DIPU_DEBUG_ALLOCATOR(2, "devproxy::freeDeviceAsync: free " << ptr);
+      return;
+    }
+    DIPUEvent event(devapis::EventFlags::DISABLE_TIMING);
+    event.record(stream);
+    std::lock_guard<std::mutex> lk(mutex_);
+    pending_.emplace_back(ptr, std::move(event));
+    freeReadyWithoutLock();
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    for (auto& item : pending_) {
+      item.second.synchronize();
+      free(item.first);
+    }
+    pending_.clear();
+  }
+
+ private:
+  static void free(void* ptr) {
+    DIPU_DEBUG_ALLOCATOR(2, "devproxy::freeDevice: free " << ptr);
+    devproxy::freeDevice(ptr);
+  }
+
+  void freeReadyWithoutLock() {
+    while (!pending_.empty() && pending_.front().second.query()) {
+      free(pending_.front().first);
+      pending_.pop_front();
+    }
+  }
+
+  std::mutex mutex_;
+  std::deque<std::pair<void*, DIPUEvent>> pending_;
+};
+
+// Created at the first free, after the vendor runtime is initialized, so that
+// it is destroyed, freeing what is pending, before the runtime is finalized
+// by the static DIPUIniter
+DeferredDeviceFrees& deferredDeviceFrees() {
+  static DeferredDeviceFrees frees;
+  return frees;
+}
+
+}  // namespace
+
 static void DIPURawDeviceAllocatorDeleter(void* ptr) {
   if (ptr) {
-    DIPU_DEBUG_ALLOCATOR(2, "devproxy::freeDevice: free " << ptr);
     // When only one stream is involved, in order to improve performance and
     // memory usage, we actually do not use events for synchronization. The
     // memory used by the same stream is allocated to the same stream for use
     // without synchronization, this is no problem, but in direct release
-    // without synchronization is problematic, so adding synchronization here is
-    // necessary.
+    // without synchronization is problematic, so the release must be ordered
+    // after the work on the default stream.
+    if (kDeferredDeviceFree) {
+      deferredDeviceFrees().add(ptr);
+      return;
+    }
+    DIPU_DEBUG_ALLOCATOR(2, "devproxy::freeDevice: free " << ptr);
     getDefaultDIPUStream().synchronize();
     devproxy::freeDevice(ptr);
     ptr = nullptr;
   }
 }
 
+void flushDeferredDeviceFrees() { deferredDeviceFrees().flush(); }
+
 DIPURawDeviceAllocator::DIPURawDeviceAllocator() = default;
 
 c10::DataPtr DIPURawDeviceAllocator::allocate(size_t size) const {
@@ -45,7 +188,12 @@ c10::DataPtr DIPURawDeviceAllocator::allocate(
   std::lock_guard<std::mutex> lock(mutex_);
   void* data = nullptr;
   if (nbytes > 0) {
-    devproxy::mallocDevice(&data, nbytes);
+    if (devproxy::mallocDevice(&data, nbytes, false) !=
+        devproxy::OpStatus::SUCCESS) {
+      // Memory waiting to be freed may help
+      flushDeferredDeviceFrees();
+      devproxy::mallocDevice(&data, nbytes);
+    }
     DIPU_DEBUG_ALLOCATOR(1, "devproxy::mallocDevice: malloc "
                                 << nbytes << " nbytes, ptr:" << data);
   }
@@ -53,6 +201,115 @@ c10::DataPtr DIPURawDeviceAllocator::allocate(
           c10::Device(dipu::DIPU_DEVICE_TYPE, device_index)};
 }
 
+namespace {
+
+// Pinned blocks not larger than this (in KB) are carved from shared pinned
+// regions instead of calling mallocHost for each of them, 0 disables it.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kMaxHostSlabBlockSize =
+    get_env_or_default("DIPU_HOST_SLAB_MAX_BLOCK_SIZE", 1024) << 10U;
+
+// Size (in MB) of each pinned region divided into blocks of one size class.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kHostSlabRegionSize =
+    get_env_or_default("DIPU_HOST_SLAB_REGION_SIZE", 4) << 20U;
+
+// Place pinned memory on the NUMA node of the current device, by mapping it
+// there and page-locking it with hostRegister instead of using mallocHost.
+// Copies from memory on the other socket of a dual-socket host are much
+// slower.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kHostNumaLocal = get_env_or_default("DIPU_HOST_NUMA_LOCAL", 0) > 0;
+
+// Pinned blocks at least this large (in MB) are backed by huge pages and
+// page-locked by hostRegister, 0 disables it. Huge pages save TLB misses and
+// pinning time on large transfer buffers.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kHostHugePageMinBlockSize =
+    get_env_or_default("DIPU_HOST_HUGE_PAGE_MIN_SIZE", size_t{0}) << 20U;
+
+// Size (in KB) of the huge pages, 2048 or 1048576. Pages come from the
+// hugetlb pool, or are transparent huge pages of the default size when the
+// pool has too few of them.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kHostHugePageSize =
+    get_env_or_default("DIPU_HOST_HUGE_PAGE_SIZE", size_t{2048}) << 10U;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+size_t roundUpToHugePage(size_t size) {
+  return (size + kHostHugePageSize - 1) / kHostHugePageSize *
+         kHostHugePageSize;
+}
+
+// Anonymous pages of `size`, a multiple of kHostHugePageSize, backed by huge
+// pages where the kernel has them
+void* mapHugePages(size_t size) {
+  const auto log_page_size =
+      static_cast<unsigned>(__builtin_ctzll(kHostHugePageSize));
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                        static_cast<int>(log_page_size << MAP_HUGE_SHIFT),
+                    -1, 0);
+  if (data != MAP_FAILED) {
+    return data;
+  }
+  // Transparent huge pages only back aligned ranges, map more and cut the
+  // unaligned ends off
+  data = mmap(nullptr, size + kHostHugePageSize, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return data;
+  }
+  auto begin = reinterpret_cast<uintptr_t>(data);
+  auto aligned = (begin + kHostHugePageSize - 1) / kHostHugePageSize *
+                 kHostHugePageSize;
+  if (aligned > begin) {
+    munmap(data, aligned - begin);
+  }
+  size_t tail = begin + kHostHugePageSize - aligned;
+  if (tail > 0) {
+    munmap(reinterpret_cast<void*>(aligned + size), tail);
+  }
+  data = reinterpret_cast<void*>(aligned);
+  madvise(data, size, MADV_HUGEPAGE);
+  return data;
+}
+
+// Fresh pages page-locked by hostRegister, preferring NUMA `node` unless it
+// is negative and backed by huge pages if `huge`. nullptr if the vendor
+// can't register host memory.
+void* mallocHostMapped(size_t size, int node, bool huge) {
+  void* data = huge ? mapHugePages(size)
+                    : mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  if (node >= 0) {
+    constexpr size_t kBitsPerWord = sizeof(unsigned long) * 8;  // NOLINT
+    std::vector<unsigned long> mask(node / kBitsPerWord + 1);   // NOLINT
+    mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+    // MPOL_PREFERRED, other nodes are used once `node` is full. Pages are
+    // placed when hostRegister faults them in.
+    constexpr int kMpolPreferred = 1;
+    if (syscall(SYS_mbind, data, size, kMpolPreferred, mask.data(),
+                mask.size() * kBitsPerWord + 1, 0) != 0) {
+      munmap(data, size);
+      return nullptr;
+    }
+  }
+  if (!devproxy::hostRegister(data, size)) {
+    munmap(data, size);
+    return nullptr;
+  }
+  return data;
+}
+
+}  // namespace
+
 class DIPURawHostAllocatorImpl final {
  public:
   static std::pair<void*, void*> allocate(size_t size) {
@@ -60,13 +317,19 @@ class DIPURawHostAllocatorImpl final {
       return {nullptr, nullptr};
     }
 
-    void* data = nullptr;
-    devproxy::mallocHost(&data, size);
-    DIPU_DEBUG_ALLOCATOR(
-        1, "devproxy::mallocHost: malloc " << size << " nbytes, ptr:" << data);
+    if (size <= kMaxHostSlabBlockSize) {
+      void* data = allocateFromSlab(size);
+      return {data, data};
+    }
+
+    bool mapped = false;
+    void* data = mallocPinned(size, mapped);
+    DIPU_DEBUG_ALLOCATOR(1, "devproxy::mallocHost: malloc "
+                                << size << " nbytes, ptr:" << data
+                                << ", mapped:" << mapped);
     {
       std::lock_guard<std::mutex> lck(mtx_);
-      blocks_[data] = size;
+      regions_[static_cast<const char*>(data)] = {size, -1, mapped};
     }
     return {data, data};
   }
@@ -76,9 +339,25 @@ class DIPURawHostAllocatorImpl final {
       return;
     }
 
+    Region region{0, -1};
     {
       std::lock_guard<std::mutex> lck(mtx_);
-      blocks_.erase(ctx);
+      auto iter = findRegion(ctx);
+      if (iter != regions_.end()) {
+        if (iter->second.size_class >= 0) {
+          // Slab regions are kept and their blocks reused
+          slabs_[iter->second.size_class].push_back(ctx);
+          return;
+        }
+        region = iter->second;
+      }
+      regions_.erase(static_cast<const char*>(ctx));
+    }
+    if (region.mapped) {
+      devproxy::hostUnregister(ctx);
+      munmap(ctx, region.size);
+      DIPU_DEBUG_ALLOCATOR(2, "munmap: free " << ctx);
+      return;
     }
     devproxy::freeHost(ctx);
     DIPU_DEBUG_ALLOCATOR(2, "devproxy::freeHost: free " << ctx);
@@ -86,36 +365,143 @@ class DIPURawHostAllocatorImpl final {
   }
 
   static bool isPinnedPtr(const void* p) {
-    bool is_pinned = false;
+    std::lock_guard<std::mutex> lck(mtx_);
+    return findRegion(p) != regions_.end();
+  }
+
+  static bool registerMemory(void* p, size_t size) {
+    if (size == 0 || !devproxy::hostRegister(p, size)) {
+      return false;
+    }
+    DIPU_DEBUG_ALLOCATOR(
+        1, "devproxy::hostRegister: register " << size << " nbytes, ptr:" << p);
+    std::lock_guard<std::mutex> lck(mtx_);
+    regions_[static_cast<const char*>(p)] = {size, kRegisteredSizeClass};
+    return true;
+  }
+
+  static void unregisterMemory(void* p) {
     {
       std::lock_guard<std::mutex> lck(mtx_);
-      for (auto iter = blocks_.crbegin(); iter != blocks_.crend(); iter++) {
-        const void* ptr = iter->first;
-        const size_t size = iter->second;
-        const char* cptr = static_cast<const char*>(ptr);
-        const char* cp = static_cast<const char*>(p);
-        const char* max_ptr = cptr + size;
-        if (cp >= cptr && cp < max_ptr) {
-          is_pinned = true;
-          break;
-        }
-        if (cp >= max_ptr) {
-          break;
-        }
-      }
+      regions_.erase(static_cast<const char*>(p));
     }
-    return is_pinned;
+    devproxy::hostUnregister(p);
+    DIPU_DEBUG_ALLOCATOR(2, "devproxy::hostUnregister: unregister " << p);
   }
 
  private:
+  static constexpr size_t kMinSlabBlockSize = 512;
+  static constexpr int kRegisteredSizeClass = -2;
+
+  struct Region {
+    size_t size;
+    // Index in `slabs_`, -1 for blocks allocated by mallocHost directly and
+    // kRegisteredSizeClass for memory registered by hostRegister
+    int size_class;
+    // Mapped by mallocHostMapped, `size` covers all of its pages
+    bool mapped = false;
+  };
+
+  // Pinned memory on the NUMA node of the current device if kHostNumaLocal,
+  // on huge pages if `size` is at least kHostHugePageMinBlockSize, as long as
+  // the vendor can register host memory, from mallocHost otherwise. Mapped
+  // huge pages round `size` up to whole pages.
+  static void* mallocPinned(size_t& size, bool& mapped) {
+    mapped = false;
+    const int node =
+        kHostNumaLocal ? getDeviceNumaNodeFromCache(devproxy::current_device())
+                       : -1;
+    const bool huge =
+        kHostHugePageMinBlockSize > 0 && size >= kHostHugePageMinBlockSize;
+    if (node >= 0 || huge) {
+      size_t mapped_size = huge ? roundUpToHugePage(size) : size;
+      void* data = mallocHostMapped(mapped_size, node, huge);
+      if (data != nullptr) {
+        mapped = true;
+        size = mapped_size;
+        return data;
+      }
+    }
+    void* data = nullptr;
+    devproxy::mallocHost(&data, size);
+    return data;
+  }
+
+  static int sizeClass(size_t size) {
+    size_t blocks = (size - 1) / kMinSlabBlockSize;
+    constexpr int kMaxBitIdx = 63;
+    return blocks == 0 ? 0 : kMaxBitIdx - __builtin_clzll(blocks) + 1;
+  }
+
+  static size_t sizeOfClass(int size_class) {
+    return kMinSlabBlockSize << static_cast<unsigned>(size_class);
+  }
+
+  // Must be called with `mtx_` held
+  static std::map<const char*, Region>::const_iterator findRegion(
+      const void* p) {
+    const char* cp = static_cast<const char*>(p);
+    auto iter = regions_.upper_bound(cp);
+    if (iter == regions_.begin()) {
+      return regions_.end();
+    }
+    --iter;
+    if (cp < iter->first + iter->second.size) {
+      return iter;
+    }
+    return regions_.end();
+  }
+
+  static void* allocateFromSlab(size_t size) {
+    int size_class = sizeClass(size);
+    size_t block_size = sizeOfClass(size_class);
+    {
+      std::lock_guard<std::mutex> lck(mtx_);
+      auto& slab = slabs_[size_class];
+      if (!slab.empty()) {
+        void* data = slab.back();
+        slab.pop_back();
+        return data;
+      }
+    }
+
+    // Allocate a new region out of the lock, mallocHost is slow
+    size_t region_size = std::max(kHostSlabRegionSize, block_size);
+    region_size = region_size / block_size * block_size;
+    bool mapped = false;
+    void* region = mallocPinned(region_size, mapped);
+    DIPU_DEBUG_ALLOCATOR(1, "devproxy::mallocHost: malloc slab region "
+                                << region_size << " nbytes, ptr:" << region
+                                << ", block size:" << block_size);
+    char* base = static_cast<char*>(region);
+    std::lock_guard<std::mutex> lck(mtx_);
+    regions_[base] = {region_size, size_class, mapped};
+    auto& slab = slabs_[size_class];
+    for (size_t offset = region_size; offset > block_size;) {
+      offset -= block_size;
+      slab.push_back(base + offset);
+    }
+    return base;
+  }
+
+  static constexpr int kNumSizeClasses = 64;
+
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
   static std::mutex mtx_;
+  // All pinned memory sorted by address, slab regions and large blocks
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
-  static std::map<void*, size_t> blocks_;
+  static std::map<const char*, Region> regions_;
+  // Free blocks of each size class
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+  static std::array<std::vector<void*>, kNumSizeClasses> slabs_;
 };
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
-std::map<void*, size_t> DIPURawHostAllocatorImpl::blocks_;
+std::map<const char*, DIPURawHostAllocatorImpl::Region>
+    DIPURawHostAllocatorImpl::regions_;
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::array<std::vector<void*>, DIPURawHostAllocatorImpl::kNumSizeClasses>
+    DIPURawHostAllocatorImpl::slabs_;
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 std::mutex DIPURawHostAllocatorImpl::mtx_;
 
@@ -142,4 +528,12 @@ bool isPinnedPtr(const void* ptr) {
   return dipu_host_allocator.isPinnedPtr(ptr);
 }
 
+bool registerPinnedHostMemory(void* ptr, size_t nbytes) {
+  return dipu_host_allocator.registerMemory(ptr, nbytes);
+}
+
+void unregisterPinnedHostMemory(void* ptr) {
+  dipu_host_allocator.unregisterMemory(ptr);
+}
+
 }  // namespace dipu
@@ -1,8 +1,11 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <cstdlib>
 #include <iostream>
 #include <mutex>
+#include <sstream>
+#include <string>
 #include <thread>
 
 #include <c10/core/Allocator.h>
@@ -14,17 +17,42 @@
 
 namespace dipu {
 
+// Bits of DIPU_DEBUG_ALLOCATOR compiled in, the logs of the other bits are
+// left out of the build
+#ifndef DIPU_DEBUG_ALLOCATOR_COMPILED_MASK
+#define DIPU_DEBUG_ALLOCATOR_COMPILED_MASK (-1)
+#endif
+
+namespace allocator_log {
+
+// DIPU_DEBUG_ALLOCATOR, the bits of the logs to print
+inline int mask() {
+  static const int value = []() {
+    auto env = std::getenv("DIPU_DEBUG_ALLOCATOR");
+    return env ? std::atoi(env) : 0;
+  }();
+  return value;
+}
+
+// Print a log line. With DIPU_DEBUG_ALLOCATOR_BUFFER set to a size in bytes,
+// lines are kept in a buffer of the calling thread and written together
+// when it is full, the thread exits or the process ends, so that threads
+// don't contend on stdout. Lines still buffered are lost on a crash.
+DIPU_API void write(const std::string& line);
+
+}  // namespace allocator_log
+
 // TODO(allocator): refactor it someday.
 // NOLINTBEGIN(bugprone-macro-parentheses)
-#define DIPU_DEBUG_ALLOCATOR(mask, x)                                          \
-  {                                                                            \
-    static int value = []() {                                                  \
-      auto env = std::getenv("DIPU_DEBUG_ALLOCATOR");                          \
-      return env ? std::atoi(env) : 0;                                         \
-    }();                                                                       \
-    if ((mask & value) == mask) {                                              \
-      std::cout << "[" << std::this_thread::get_id() << "]" << x << std::endl; \
-    }                                                                          \
+#define DIPU_DEBUG_ALLOCATOR(mask, x)                                    \
+  {                                                                      \
+    if (((mask) & (DIPU_DEBUG_ALLOCATOR_COMPILED_MASK)) == (mask) &&     \
+        ((mask) & ::dipu::allocator_log::mask()) == (mask)) {            \
+      std::ostringstream dipu_log_line_;                                 \
+      dipu_log_line_ << "[" << std::this_thread::get_id() << "]" << x    \
+                     << '\n';                                            \
+      ::dipu::allocator_log::write(dipu_log_line_.str());                \
+    }                                                                    \
   }
 // NOLINTEND(bugprone-macro-parentheses)
 
@@ -51,4 +79,14 @@ class DIPURawHostAllocator : public c10::Allocator {
 
 DIPU_API bool isPinnedPtr(const void* ptr);
 
+// Page-lock existing host memory in place, isPinnedPtr reports it as pinned
+// until it is unregistered. Returns false if the vendor can't register it.
+DIPU_API bool registerPinnedHostMemory(void* ptr, size_t nbytes);
+
+DIPU_API void unregisterPinnedHostMemory(void* ptr);
+
+// Free device memory released by DIPURawDeviceAllocator but still waiting for
+// the default stream
+void flushDeferredDeviceFrees();
+
 }  // namespace dipu
@@ -1,9 +1,21 @@
 // Copyright (c) 2023, DeepLink.
 
+#include <mutex>
+
 #include "DIPUCachingAllocator.h"
 
 namespace dipu {
 
+namespace {
+
+// Free blocks once the work using them is done, during later allocate and
+// free calls, instead of waiting for it at every free
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kRawDeferredFree =
+    get_env_or_default("DIPU_RAW_CACHING_DEFERRED_RECLAIM", 0) > 0;
+
+}  // namespace
+
 static void deleteRawCachingAllocatorContext(void* ptr);
 
 class RawCachingAllocator : public CacheAllocator {
@@ -18,16 +30,18 @@ class RawCachingAllocator : public CacheAllocator {
             size_t real_size)
         : DataPtrContextBase(allocator, ptr, size), real_size_(real_size) {}
     ~Context() {
-      std::deque<DIPUEvent> events;
-      for (const auto& item : streams()) {
-        events.emplace_back();
-        events.back().record(item);
-      }
       auto allocator_ = static_cast<const RawCachingAllocator*>(allocator());
-      allocator_->async_mem_pool()->add(std::make_tuple(ptr(), size()), events);
+      markFreed();
+      allocator_->async_mem_pool()->add(std::make_tuple(ptr(), size()),
+                                        streams());
       allocator_->set_memory_allocated(allocator_->memory_allocated() -
                                        real_size_);
-      allocator_->empty_cache();
+      allocator_->stats().recordFree(real_size_);
+      if (kRawDeferredFree) {
+        allocator_->free_ready(false);
+      } else {
+        allocator_->empty_cache();
+      }
     }
     size_t real_size_ = 0;
   };
@@ -38,42 +52,93 @@ class RawCachingAllocator : public CacheAllocator {
 
   c10::DataPtr allocate(size_t size) const override {
     size_t nbytes = getAllocateSize(size);
-    empty_cache();
+    check_memory_limit(nbytes);
+    if (kRawDeferredFree) {
+      free_ready(true);
+    } else {
+      empty_cache();
+    }
     DIPU_DEBUG_ALLOCATOR(4, "RawCachingAllocator: malloc "
                                 << nbytes << " nbytes"
                                 << ", requires:" << size << " bytes");
-    auto ptr = raw_allocator()->raw_allocate(nbytes);
+    void* ptr = nullptr;
+    try {
+      ptr = allocate_raw(nbytes);
+    } catch (...) {
+      if (!kRawDeferredFree) {
+        throw;
+      }
+      // The blocks still waited for may be what is missing
+      stats().add(AllocatorStats::kAllocRetry);
+      empty_cache();
+      ptr = allocate_raw(nbytes);
+    }
     set_memory_reserved(memory_reserved() + nbytes);
     set_memory_allocated(memory_allocated() + nbytes);
+    stats().recordAlloc(nbytes);
+    stats().add(AllocatorStats::kSegmentAlloc);
+    trace(MemTracer::Action::kSegmentAlloc, ptr, nbytes);
+    report_memory_usage(ptr, static_cast<int64_t>(nbytes));
     return {ptr, new Context(this, ptr, size, nbytes),
             deleteRawCachingAllocatorContext, device()};
   }
 
   void empty_cache() const override {
     DIPU_DEBUG_ALLOCATOR(8, "RawCachingAllocator: empty_cache");
+    std::lock_guard<std::mutex> lk(free_mutex_);
     while (!async_mem_pool()->empty()) {
       if (async_mem_pool()->ready()) {
-        auto mem = async_mem_pool()->get();
-        void* ptr = std::get<0>(mem);
-        size_t size = std::get<1>(mem);
-        size_t nbytes = getAllocateSize(size);
-        raw_allocator()->raw_deallocate(ptr);
-        set_memory_reserved(memory_reserved() - nbytes);
+        free_block();
       } else {
         std::this_thread::yield();
       }
     }
   }
 
+  // Free the blocks whose work is done without waiting for the others. If
+  // `wait_lock` is false it returns at once while another thread frees.
+  void free_ready(bool wait_lock) const {
+    std::unique_lock<std::mutex> lk(free_mutex_, std::defer_lock);
+    if (wait_lock) {
+      lk.lock();
+    } else if (!lk.try_lock()) {
+      return;
+    }
+    while (async_mem_pool()->ready()) {
+      free_block();
+    }
+  }
+
   void release_all_memory() const override {
     DIPU_DEBUG_ALLOCATOR(8, "RawCachingAllocator: release_all_memory");
     empty_cache();
   }
+
+ private:
+  // Taken by whoever frees blocks, so that a ready block is not taken by
+  // another thread between ready() and get()
+  mutable std::mutex free_mutex_;
+
+  void free_block() const {
+    auto mem = async_mem_pool()->get();
+    void* ptr = std::get<0>(mem);
+    size_t size = std::get<1>(mem);
+    size_t nbytes = getAllocateSize(size);
+    trace(MemTracer::Action::kFreeCompleted, ptr, nbytes);
+    trace(MemTracer::Action::kSegmentFree, ptr, nbytes);
+    free_raw(ptr, nbytes);
+    set_memory_reserved(memory_reserved() - nbytes);
+    stats().add(AllocatorStats::kSegmentFree);
+  }
 };
 
 static void deleteRawCachingAllocatorContext(void* ptr) {
   auto ctx = static_cast<RawCachingAllocator::Context*>(ptr);
+  const auto* allocator = ctx->allocator();
+  void* data = ctx->ptr();
+  const auto nbytes = static_cast<int64_t>(ctx->real_size_);
   delete ctx;
+  allocator->report_memory_usage(data, -nbytes);
 }
 // TODO(allocator) - Refactor it!
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables,modernize-avoid-bind)
@@ -68,7 +68,7 @@ struct DIPUGuardImpl : public c10::impl::DeviceGuardImplInterface {
 
   c10::Stream getStreamFromGlobalPool(c10::Device d,
                                       bool isHighPriority) const override {
-    return getDIPUStreamFromPool(d.index()).unwrap();
+    return getDIPUStreamFromPool(isHighPriority, d.index()).unwrap();
   }
 
   c10::Stream getDefaultStream(c10::Device device) const override {
@@ -44,6 +44,10 @@ enum class VendorDeviceType : enum_t {
 
 enum class EventStatus : enum_t { PENDING, RUNNING, DEFERRED, READY };
 
+// DISABLE_TIMING events can only order streams, they are cheaper to record
+// on some vendors but can't measure elapsed time
+enum class EventFlags : enum_t { DEFAULT, DISABLE_TIMING };
+
 enum class OpStatus : enum_t {
   SUCCESS,
   ERR_UNKNOWN,
@@ -69,6 +73,28 @@ struct DIPUDeviceStatus {
   size_t freeGlobalMem = 0;
 };
 
+// Fast paths a vendor supports. The optional apis a vendor leaves out are
+// off regardless, see devproxy::vendorCapabilities.
+struct DIPUVendorCapabilities {
+  // isPinnedPtr tells pinned from pageable host memory, otherwise the pinned
+  // memory allocated or registered by dipu is trusted only
+  bool pinnedPtrDetection = true;
+  // memCopyH2DAsync overlaps with the host at least for pinned memory
+  bool asyncMemCopyH2D = true;
+  bool peerAccess = true;
+  bool virtualMem = true;
+  bool hostFunc = true;
+  // float8 matmuls, i.e. diopiScaledMm, are fast enough for autocast, see
+  // isFp8MatmulSupported
+  bool fp8Matmul = false;
+};
+
+// Opaque handle of device memory shared with other processes, large enough
+// for the handle of any vendor
+struct IpcMemHandle {
+  char data[64] = {};
+};
+
 struct DIPUDeviceProperties {
   std::string name;
   size_t totalGlobalMem = 0;
@@ -77,6 +103,23 @@ struct DIPUDeviceProperties {
   int32_t multiProcessorCount = 0;
 };
 
+// How two local devices reach each other, from slow to fast
+enum class LinkType : int8_t {
+  UNKNOWN,
+  // through host memory, no peer access
+  HOST,
+  PCIE,
+  // a vendor device link, e.g. NVLink, HCCS or MLU-Link
+  DEVICE_LINK,
+  SAME_DEVICE,
+};
+
+struct DIPUDeviceLink {
+  LinkType type = LinkType::UNKNOWN;
+  // one way, 0 if unknown
+  double bandwidthGBps = 0;
+};
+
 using deviceId_t = c10::DeviceIndex;
 
 }  // end namespace devapis
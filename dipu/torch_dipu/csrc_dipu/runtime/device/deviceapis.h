@@ -24,6 +24,9 @@ DIPU_WEAK void initializeVendor();
 
 DIPU_WEAK void finalizeVendor();
 
+// all capabilities on if not implemented
+DIPU_WEAK DIPUVendorCapabilities getVendorCapabilities();
+
 DIPU_API deviceId_t current_device();
 
 DIPU_API DIPUDeviceProperties getDeviceProperties(int32_t device_index);
@@ -61,12 +64,63 @@ DIPU_API void streamWaitEvent(deviceStream_t stream, deviceEvent_t event);
 // same as query last event status in stream.(every op has a event)
 DIPU_API bool isStreamEmpty(deviceStream_t stream);
 
+// =====================
+//  stream capture related, optional, only vendors support graphs implement them
+// =====================
+
+// record the work submitted to stream into a graph instead of running it
+DIPU_WEAK void streamBeginCapture(deviceStream_t stream);
+
+// stop recording and return an executable graph of the recorded work
+DIPU_WEAK void* streamEndCapture(deviceStream_t stream);
+
+DIPU_WEAK bool isStreamCapturing(deviceStream_t stream);
+
+// launch all work of an executable graph on stream at once
+DIPU_WEAK void graphLaunch(void* graph, deviceStream_t stream);
+
+DIPU_WEAK void graphDestroy(void* graph);
+
+// =====================
+//  host function related, optional
+// =====================
+
+// run fn(arg) on a driver thread once all work queued on stream before it is
+// done, later work on stream waits for it. fn must not call device apis.
+DIPU_WEAK void launchHostFunc(deviceStream_t stream, void (*fn)(void*),
+                              void* arg);
+
+// write value to dst, a word of mallocHost memory, once all work queued on
+// stream before it is done. return false if the stream can't do it.
+DIPU_WEAK bool streamWriteValue32(deviceStream_t stream, uint32_t* dst,
+                                  uint32_t value);
+
+// =====================
+//  peer access related, optional
+// =====================
+
+// whether devId can directly access memory on peerDevId
+DIPU_WEAK bool canAccessPeer(deviceId_t devId, deviceId_t peerDevId);
+
+// allow the current device to access memory on peerDevId. vendors which
+// implement canAccessPeer but not this need no enablement.
+DIPU_WEAK void enablePeerAccess(deviceId_t peerDevId);
+
+// how devId reaches memory on peerDevId, another device
+DIPU_WEAK DIPUDeviceLink getDeviceLink(deviceId_t devId, deviceId_t peerDevId);
+
+// the NUMA node of the host the device is attached to, -1 if none
+DIPU_WEAK int getDeviceNumaNode(deviceId_t devId);
+
 // =====================
 //  device event related
 // =====================
 
 DIPU_API void createEvent(deviceEvent_t* event);
 
+// optional, vendors not implementing it always create default events
+DIPU_WEAK void createEvent(deviceEvent_t* event, EventFlags flags);
+
 DIPU_API void destroyEvent(deviceEvent_t event);
 
 DIPU_API void waitEvent(deviceEvent_t event);
@@ -90,12 +144,61 @@ DIPU_API OpStatus mallocDevice(void** p, size_t nbytes,
 
 DIPU_API void freeDevice(void* p);
 
+// optional, free p after all work already submitted to stream is done.
+// returns false if p can't be freed that way, it's freed by freeDevice then.
+DIPU_WEAK bool freeDeviceAsync(void* p, deviceStream_t stream);
+
 DIPU_API bool isPinnedPtr(const void* p);
 
+// optional, page-lock existing host memory [p, p + nbytes) so that devices
+// can access it like memory from mallocHost. returns false if it can't.
+DIPU_WEAK bool hostRegister(void* p, size_t nbytes);
+
+DIPU_WEAK void hostUnregister(void* p);
+
+// =====================
+//  inter-process memory, optional
+// =====================
+
+// handle of the allocation `p` belongs to and the offset of `p` in it.
+// returns false if the memory can't be shared, e.g. mapped virtual memory.
+DIPU_WEAK bool ipcGetMemHandle(IpcMemHandle* handle, size_t* offset, void* p);
+
+// map an allocation another process got the handle of on the current device
+DIPU_WEAK void ipcOpenMemHandle(void** p, const IpcMemHandle& handle);
+
+DIPU_WEAK void ipcCloseMemHandle(void* p);
+
+// =====================
+//  virtual memory related, optional, only vendors support VMM implement them
+// =====================
+
+// physical memory is mapped in units of this granularity
+DIPU_WEAK size_t getVirtualMemGranularity();
+
+// reserve a virtual address range without backing physical memory
+DIPU_WEAK OpStatus reserveVirtualMem(void** p, size_t nbytes);
+
+DIPU_WEAK void releaseVirtualMem(void* p, size_t nbytes);
+
+// create physical memory and map it to [p, p + nbytes), both p and nbytes are
+// aligned to granularity. unmapVirtualMem may unmap any aligned sub range.
+DIPU_WEAK OpStatus mapVirtualMem(void* p, size_t nbytes);
+
+DIPU_WEAK void unmapVirtualMem(void* p, size_t nbytes);
+
 // (asynchronous) set val
 DIPU_API void memSetAsync(deviceStream_t stream, void* ptr, int val,
                           size_t size);
 
+// (asynchronous) set count 16 or 32 bit words to val, ptr is aligned to the
+// word size. return false if the stream can't do it.
+DIPU_WEAK bool memSetD16Async(deviceStream_t stream, void* ptr, uint16_t val,
+                              size_t count);
+
+DIPU_WEAK bool memSetD32Async(deviceStream_t stream, void* ptr, uint32_t val,
+                              size_t count);
+
 // (synchronous) copy from device to a device
 DIPU_API void memCopyD2D(size_t nbytes, deviceId_t dstDevId, void* dst,
                          deviceId_t srcDevId, const void* src);
@@ -122,5 +225,11 @@ DIPU_API void memCopyH2DAsync(deviceStream_t stream, size_t nbytes,
 DIPU_API void memCopyD2HAsync(deviceStream_t stream, size_t nbytes,
                               /*Host dstDev,*/ void* dst,
                               /*deviceId_t srcDevId,*/ const void* src);
+
+// (asynchronous) copy `height` rows of `width` bytes, rows start every
+// `dpitch` and `spitch` bytes in dst and src, optional
+DIPU_WEAK void memCopy2DAsync(deviceStream_t stream, MemCPKind kind, void* dst,
+                              size_t dpitch, const void* src, size_t spitch,
+                              size_t width, size_t height);
 }  // end namespace devapis
 }  // end namespace dipu
@@ -17,6 +17,8 @@ using ReduceOp = c10d::ReduceOp;
 extern const int DICL_UNIQUE_ID_BYTES_SIZE;
 
 // todo:: dipu only export devproxy but not devapis (which move o diopi)
+// DICL_SUCCESS unless `comm` failed asynchronously, polled by the watchdog of
+// the process group. Vendors which can't tell should return DICL_SUCCESS.
 DIPU_API diclResult_t diclGetCommAsyncError(diclComm_t comm);
 
 DIPU_API diclResult_t diclGetUniqueId(commUniqueId* uniqueId);
@@ -30,9 +32,17 @@ DIPU_API diclResult_t diclCommInitRank(diclComm_t* comm, int nranks,
 
 DIPU_API diclResult_t diclCommDestroy(diclComm_t comm);
 
+// optional, collective over all ranks of `comm`: the ranks passing the same
+// non-negative `color` get a new communicator in `newComm`, ranked by `key`,
+// without exchanging a unique id. Ranks passing a negative color get null.
+DIPU_WEAK diclResult_t diclCommSplit(diclComm_t comm, int color, int key,
+                                     diclComm_t* newComm);
+
 // DIPU_API diclResult_t diclCommFinalize(diclComm_t comm);
 
-// DIPU_API diclResult_t diclCommAbort(diclComm_t comm);
+// optional, makes the pending calls on `comm` return so that a hung job can
+// fail, `comm` can only be destroyed afterwards
+DIPU_WEAK diclResult_t diclCommAbort(diclComm_t comm);
 
 DIPU_API diclResult_t diclAllReduce(const void* sendBuf, void* recvBuf,
                                     size_t count, at::ScalarType datatype,
@@ -67,6 +77,37 @@ DIPU_API diclResult_t diclRecv(void* recvBuf, size_t count,
                                at::ScalarType datatype, int peer,
                                diclComm_t comm, deviceStream_t stream);
 
+// optional, sends `count` elements from sendBuf + rank * count to every rank,
+// and receives as many from every rank into recvBuf + rank * count
+DIPU_WEAK diclResult_t diclAllToAll(const void* sendBuf, void* recvBuf,
+                                    size_t count, at::ScalarType datatype,
+                                    diclComm_t comm, deviceStream_t stream);
+
+// optional, same as diclAllToAll with per rank counts and displacements, all
+// in elements
+DIPU_WEAK diclResult_t diclAllToAllv(const void* sendBuf,
+                                     const size_t* sendCounts,
+                                     const size_t* sendDispls, void* recvBuf,
+                                     const size_t* recvCounts,
+                                     const size_t* recvDispls,
+                                     at::ScalarType datatype, diclComm_t comm,
+                                     deviceStream_t stream);
+
+// optional, dicl calls between them are launched together at diclGroupEnd,
+// so that batched p2p calls don't deadlock and small calls share one launch
+DIPU_WEAK diclResult_t diclGroupStart();
+
+DIPU_WEAK diclResult_t diclGroupEnd();
+
+// optional, registers [buff, buff + size) with `comm` so that calls on it can
+// use the buffer without staging copies. `handle` is later passed to
+// diclCommDeregister, which must happen before the memory is freed and
+// before `comm` is destroyed.
+DIPU_WEAK diclResult_t diclCommRegister(diclComm_t comm, void* buff,
+                                        size_t size, void** handle);
+
+DIPU_WEAK diclResult_t diclCommDeregister(diclComm_t comm, void* handle);
+
 }  // namespace devapis
 
 }  // namespace dipu
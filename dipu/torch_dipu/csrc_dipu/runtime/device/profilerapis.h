@@ -1,7 +1,12 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "basedef.h"
 
@@ -12,5 +17,87 @@ DIPU_WEAK void enableProfiler(const std::string& dump_path, bool call_stack,
                               bool record_shapes, bool profile_memory);
 DIPU_WEAK void disableProfiler();
 
+// Selects the hardware counters the native profiler of the vendor collects
+// on the next enableProfiler(), empty for its default set. Unknown or
+// unsupported names throw.
+DIPU_WEAK void setProfilerCounters(const std::vector<std::string>& counters);
+
+// Nested ranges and instant markers of the calling thread on the timeline of
+// the tracing tools of the vendor, e.g. msTX on Ascend, cnpx on Camb and NVTX
+// on CUDA. They must cost next to nothing while no tool is attached.
+DIPU_WEAK void traceRangePush(const char* message);
+DIPU_WEAK void traceRangePop();
+DIPU_WEAK void traceMark(const char* message);
+
+enum class ActivityKind { kRuntime, kKernel, kMemcpy, kMemset };
+
+// An activity reported by the profiling library of the vendor, in host clock
+// nanoseconds as torch::profiler::impl::getTime
+struct ActivityRecord {
+  ActivityKind kind = ActivityKind::kKernel;
+  std::string name;
+  int64_t startNs = 0;
+  int64_t endNs = 0;
+  // Device and stream of device activities, process and thread of runtime
+  // calls
+  int64_t device = 0;
+  int64_t resource = 0;
+  // Shared by a runtime call and the device activities it launched
+  uint64_t correlationId = 0;
+  // The id pushed last by pushCorrelationId() when the runtime call was made,
+  // 0 if none
+  uint64_t externalId = 0;
+  // Values of the counters selected by setCounters(), for kernels
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+// Collects the activities of the device through the profiling library of the
+// vendor, e.g. cnpapi. The profiler merges them into the Kineto trace
+// instead of timing each op by a pair of events.
+class DeviceActivityCollector {
+ public:
+  virtual ~DeviceActivityCollector() = default;
+
+  // Starts collecting `kinds`, along with the external ids if `correlate`
+  virtual void enable(const std::set<ActivityKind>& kinds, bool correlate) = 0;
+  virtual void disable() = 0;
+
+  virtual void pushCorrelationId(uint64_t id) = 0;
+  virtual void popCorrelationId() = 0;
+
+  // Bytes the library may buffer
+  virtual void setMaxBufferSize(int32_t size) {}
+
+  // The hardware counters the collector can attach to kernels
+  virtual std::vector<std::string> supportedCounters() const { return {}; }
+  // Collects `counters`, a subset of supportedCounters(), from the next
+  // enable() on
+  virtual void setCounters(const std::vector<std::string>& counters) {}
+
+  // Passes the activities collected so far to `handle` and drops them
+  virtual void flush(
+      const std::function<void(const ActivityRecord&)>& handle) = 0;
+  // Drops the activities collected so far
+  virtual void clear() = 0;
+
+  // Called once the buffers are full, which ends the trace
+  void setOverflowHandler(std::function<void()> handler) {
+    overflow_handler_ = std::move(handler);
+  }
+
+ protected:
+  void overflow() const {
+    if (overflow_handler_) {
+      overflow_handler_();
+    }
+  }
+
+ private:
+  std::function<void()> overflow_handler_;
+};
+
+// The collector of the vendor, which owns it
+DIPU_WEAK DeviceActivityCollector* deviceActivityCollector();
+
 }  // end namespace devapis
 }  // end namespace dipu
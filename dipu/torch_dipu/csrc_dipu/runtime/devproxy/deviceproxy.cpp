@@ -1,11 +1,73 @@
 // Copyright (c) 2023, DeepLink.
 #include "deviceproxy.h"
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <c10/util/Exception.h>
+
+#include "csrc_dipu/runtime/core/DIPUAsyncErrorCheck.h"
 #include "csrc_dipu/runtime/core/DIPUEventPool.h"
+#include "csrc_dipu/runtime/core/DIPULaunchQueue.h"
+#include "csrc_dipu/runtime/core/allocator/DIPURawAllocator.h"
+#include "csrc_dipu/utils/env.hpp"
 
 namespace dipu {
 namespace devproxy {
 
+namespace {
+
+// Cache the current device per thread, set it to 0 if other libraries change
+// the current device behind dipu's back
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kCacheCurrentDevice =
+    get_env_or_default("DIPU_CACHE_CURRENT_DEVICE", 1) > 0;
+
+// Bumped by every setDevice and resetDevice of any thread. Some vendors keep
+// a process-level device, so the device cached by a thread is only trusted
+// while no thread switched devices since it was cached.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<uint64_t> device_generation{0};
+
+struct CurrentDeviceCache {
+  deviceId_t device = -1;  // -1 if unknown
+  uint64_t generation = 0;
+
+  bool valid() const {
+    return device >= 0 &&
+           generation == device_generation.load(std::memory_order_acquire);
+  }
+
+  // After the device of this thread was switched to `id` (-1 to forget it)
+  void update(deviceId_t id) {
+    const auto previous =
+        device_generation.fetch_add(1, std::memory_order_acq_rel);
+    device = id;
+    generation = previous + 1;
+  }
+};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+thread_local CurrentDeviceCache current_device_cache;
+
+// Adds the op a device error most likely comes from to errors thrown by fn
+template <typename Fn>
+void withAsyncErrorContext(Fn&& fn) {
+  if (!asyncErrorCheckEnabled()) {
+    return fn();
+  }
+  try {
+    return fn();
+  } catch (c10::Error& e) {
+    e.add_context(describeUnfinishedOps());
+    throw;
+  }
+}
+
+}  // namespace
+
 void initializeVendor() {
   if (devapis::initializeVendor) {
     devapis::initializeVendor();
@@ -18,7 +80,34 @@ void finalizeVendor() {
   }
 }
 
-deviceId_t current_device() { return devapis::current_device(); }
+const DIPUVendorCapabilities& vendorCapabilities() {
+  static const DIPUVendorCapabilities capabilities = [] {
+    DIPUVendorCapabilities caps;
+    if (devapis::getVendorCapabilities) {
+      caps = devapis::getVendorCapabilities();
+    }
+    caps.peerAccess = caps.peerAccess && devapis::canAccessPeer != nullptr;
+    caps.virtualMem =
+        caps.virtualMem && devapis::getVirtualMemGranularity &&
+        devapis::reserveVirtualMem && devapis::releaseVirtualMem &&
+        devapis::mapVirtualMem && devapis::unmapVirtualMem;
+    caps.hostFunc = caps.hostFunc && devapis::launchHostFunc != nullptr;
+    return caps;
+  }();
+  return capabilities;
+}
+
+deviceId_t current_device() {
+  if (!kCacheCurrentDevice) {
+    return devapis::current_device();
+  }
+  if (!current_device_cache.valid()) {
+    current_device_cache.device = devapis::current_device();
+    current_device_cache.generation =
+        device_generation.load(std::memory_order_acquire);
+  }
+  return current_device_cache.device;
+}
 
 DIPUDeviceProperties getDeviceProperties(int32_t device_index) {
   return devapis::getDeviceProperties(device_index);
@@ -32,14 +121,30 @@ DIPUDeviceStatus getDeviceStatus(int32_t device_index) {
 }
 
 // set current device given device according to id
-void setDevice(deviceId_t devId) { return devapis::setDevice(devId); }
+void setDevice(deviceId_t devId) {
+  if (!kCacheCurrentDevice) {
+    return devapis::setDevice(devId);
+  }
+  // Nested guards on the same device are then free of runtime calls
+  if (current_device_cache.valid() && current_device_cache.device == devId) {
+    return;
+  }
+  devapis::setDevice(devId);
+  current_device_cache.update(devId);
+}
 
-void resetDevice(deviceId_t devId) { return devapis::resetDevice(devId); }
+void resetDevice(deviceId_t devId) {
+  devapis::resetDevice(devId);
+  current_device_cache.update(-1);
+}
 
-void syncDevice() { return devapis::syncDevice(); }
+void syncDevice() {
+  launchQueueBarrier();
+  withAsyncErrorContext(devapis::syncDevice);
+}
 
 // check last launch succ or not, throw if fail
-void checkLastError() { return devapis::checkLastError(); }
+void checkLastError() { withAsyncErrorContext(devapis::checkLastError); }
 
 int getDeviceCount() {
   static int device_count = devapis::getDeviceCount();
@@ -68,32 +173,160 @@ void destroyStream(deviceStream_t stream, deviceId_t devId) {
 
 void releaseStream() { return devapis::releaseStream(); }
 
-void syncStream(deviceStream_t stream) { return devapis::syncStream(stream); }
+void syncStream(deviceStream_t stream) {
+  launchQueueBarrier();
+  withAsyncErrorContext([stream] { devapis::syncStream(stream); });
+}
 
 bool streamNotNull(deviceStream_t stream) {
   return devapis::streamNotNull(stream);
 }
 
 void streamWaitEvent(deviceStream_t stream, deviceEvent_t event) {
+  launchQueueBarrier();
   return devapis::streamWaitEvent(stream, event);
 }
 
 // same as query last event status in stream.(every op has a event)
 bool isStreamEmpty(deviceStream_t stream) {
+  launchQueueBarrier();
   return devapis::isStreamEmpty(stream);
 }
 
+// =====================
+//  stream capture related
+// =====================
+
+bool isStreamCaptureSupported() {
+  return devapis::streamBeginCapture && devapis::streamEndCapture &&
+         devapis::isStreamCapturing && devapis::graphLaunch &&
+         devapis::graphDestroy;
+}
+
+// The work of the capturing thread is launched by it, not by the launch queue
+void streamBeginCapture(deviceStream_t stream) {
+  TORCH_CHECK(isStreamCaptureSupported(), "stream capture not supported");
+  pauseLaunchQueue();
+  try {
+    devapis::streamBeginCapture(stream);
+  } catch (...) {
+    resumeLaunchQueue();
+    throw;
+  }
+}
+
+void* streamEndCapture(deviceStream_t stream) {
+  TORCH_CHECK(isStreamCaptureSupported(), "stream capture not supported");
+  resumeLaunchQueue();
+  return devapis::streamEndCapture(stream);
+}
+
+bool isStreamCapturing(deviceStream_t stream) {
+  if (devapis::isStreamCapturing) {
+    return devapis::isStreamCapturing(stream);
+  }
+  return false;
+}
+
+void graphLaunch(void* graph, deviceStream_t stream) {
+  TORCH_CHECK(devapis::graphLaunch != nullptr, "graphLaunch not supported");
+  launchQueueBarrier();
+  return devapis::graphLaunch(graph, stream);
+}
+
+void graphDestroy(void* graph) {
+  TORCH_CHECK(devapis::graphDestroy != nullptr, "graphDestroy not supported");
+  return devapis::graphDestroy(graph);
+}
+
+bool isHostFuncSupported() { return vendorCapabilities().hostFunc; }
+
+void launchHostFunc(deviceStream_t stream, void (*fn)(void*), void* arg) {
+  TORCH_CHECK(isHostFuncSupported(), "launchHostFunc not supported");
+  launchQueueBarrier();
+  return devapis::launchHostFunc(stream, fn, arg);
+}
+
+bool streamWriteValue32(deviceStream_t stream, uint32_t* dst, uint32_t value) {
+  if (devapis::streamWriteValue32 == nullptr) {
+    return false;
+  }
+  launchQueueBarrier();
+  return devapis::streamWriteValue32(stream, dst, value);
+}
+
+bool canAccessPeer(deviceId_t devId, deviceId_t peerDevId) {
+  return devId != peerDevId && vendorCapabilities().peerAccess &&
+         devapis::canAccessPeer(devId, peerDevId);
+}
+
+bool tryEnablePeerAccess(deviceId_t devId, deviceId_t peerDevId) {
+  enum PeerState : int8_t { kUnknown, kEnabled, kUnsupported };
+  static std::mutex mtx;
+  // Indexed by devId * device count + peerDevId, guarded by `mtx`
+  static std::vector<int8_t> states;
+
+  const auto count = getDeviceCount();
+  if (devId < 0 || peerDevId < 0 || devId >= count || peerDevId >= count) {
+    return false;
+  }
+  std::lock_guard<std::mutex> _(mtx);
+  if (states.empty()) {
+    states.resize(static_cast<size_t>(count) * count, kUnknown);
+  }
+  auto& state = states[static_cast<size_t>(devId) * count + peerDevId];
+  if (state == kUnknown) {
+    state = kUnsupported;
+    if (canAccessPeer(devId, peerDevId)) {
+      if (devapis::enablePeerAccess != nullptr) {
+        auto prev = current_device();
+        setDevice(devId);
+        devapis::enablePeerAccess(peerDevId);
+        setDevice(prev);
+      }
+      state = kEnabled;
+    }
+  }
+  return state == kEnabled;
+}
+
+devapis::DIPUDeviceLink getDeviceLink(deviceId_t devId, deviceId_t peerDevId) {
+  devapis::DIPUDeviceLink link;
+  if (devId == peerDevId) {
+    link.type = devapis::LinkType::SAME_DEVICE;
+  } else if (devapis::getDeviceLink != nullptr) {
+    link = devapis::getDeviceLink(devId, peerDevId);
+  } else if (canAccessPeer(devId, peerDevId)) {
+    link.type = devapis::LinkType::PCIE;
+  }
+  return link;
+}
+
+int getDeviceNumaNode(deviceId_t devId) {
+  if (devapis::getDeviceNumaNode == nullptr) {
+    return -1;
+  }
+  return devapis::getDeviceNumaNode(devId);
+}
+
 // =====================
 //  device event related
 // =====================
 
-void createEvent(deviceEvent_t* event) { return getEventFromPool(*event); }
+void createEvent(deviceEvent_t* event, EventFlags flags) {
+  return getEventFromPool(*event, flags);
+}
 
-void destroyEvent(deviceEvent_t event) { return restoreEventToPool(event); }
+void destroyEvent(deviceEvent_t event, EventFlags flags) {
+  return restoreEventToPool(event, flags);
+}
 
-void waitEvent(deviceEvent_t event) { return devapis::waitEvent(event); }
+void waitEvent(deviceEvent_t event) {
+  withAsyncErrorContext([event] { devapis::waitEvent(event); });
+}
 
 void recordEvent(deviceEvent_t event, deviceStream_t stream) {
+  launchQueueBarrier();
   return devapis::recordEvent(event, stream);
 }
 
@@ -120,28 +353,128 @@ OpStatus mallocDevice(void** p, size_t nbytes, bool throwExcepion) {
 
 void freeDevice(void* p) { return devapis::freeDevice(p); }
 
-bool isPinnedPtr(const void* p) { return devapis::isPinnedPtr(p); }
+bool freeDeviceAsync(void* p, deviceStream_t stream) {
+  return devapis::freeDeviceAsync && devapis::freeDeviceAsync(p, stream);
+}
+
+bool isPinnedPtr(const void* p) {
+  if (!vendorCapabilities().pinnedPtrDetection) {
+    return dipu::isPinnedPtr(p);
+  }
+  return devapis::isPinnedPtr(p);
+}
+
+bool hostRegister(void* p, size_t nbytes) {
+  return devapis::hostRegister && devapis::hostUnregister &&
+         devapis::hostRegister(p, nbytes);
+}
+
+void hostUnregister(void* p) {
+  TORCH_CHECK(devapis::hostUnregister != nullptr,
+              "hostUnregister not supported");
+  return devapis::hostUnregister(p);
+}
+
+// =====================
+//  inter-process memory related
+// =====================
+bool isIpcSupported() {
+  return devapis::ipcGetMemHandle && devapis::ipcOpenMemHandle &&
+         devapis::ipcCloseMemHandle;
+}
+
+bool ipcGetMemHandle(IpcMemHandle* handle, size_t* offset, void* p) {
+  return isIpcSupported() && devapis::ipcGetMemHandle(handle, offset, p);
+}
+
+void ipcOpenMemHandle(void** p, const IpcMemHandle& handle) {
+  TORCH_CHECK(isIpcSupported(), "ipcOpenMemHandle not supported");
+  return devapis::ipcOpenMemHandle(p, handle);
+}
+
+void ipcCloseMemHandle(void* p) {
+  TORCH_CHECK(isIpcSupported(), "ipcCloseMemHandle not supported");
+  return devapis::ipcCloseMemHandle(p);
+}
+
+// =====================
+//  virtual memory related
+// =====================
+size_t getVirtualMemGranularity() {
+  if (vendorCapabilities().virtualMem) {
+    return devapis::getVirtualMemGranularity();
+  }
+  return 0;
+}
+
+OpStatus reserveVirtualMem(void** p, size_t nbytes) {
+  if (devapis::reserveVirtualMem) {
+    return devapis::reserveVirtualMem(p, nbytes);
+  }
+  return OpStatus::ERR_UNKNOWN;
+}
+
+void releaseVirtualMem(void* p, size_t nbytes) {
+  TORCH_CHECK(devapis::releaseVirtualMem != nullptr,
+              "releaseVirtualMem not supported");
+  return devapis::releaseVirtualMem(p, nbytes);
+}
+
+OpStatus mapVirtualMem(void* p, size_t nbytes) {
+  if (devapis::mapVirtualMem) {
+    return devapis::mapVirtualMem(p, nbytes);
+  }
+  return OpStatus::ERR_UNKNOWN;
+}
+
+void unmapVirtualMem(void* p, size_t nbytes) {
+  TORCH_CHECK(devapis::unmapVirtualMem != nullptr,
+              "unmapVirtualMem not supported");
+  return devapis::unmapVirtualMem(p, nbytes);
+}
 
 // (asynchronous) set val
 void memSetAsync(const deviceStream_t stream, void* ptr, int val, size_t size) {
+  launchQueueBarrier();
   return devapis::memSetAsync(stream, ptr, val, size);
 }
 
+bool memSetD16Async(deviceStream_t stream, void* ptr, uint16_t val,
+                    size_t count) {
+  if (devapis::memSetD16Async == nullptr) {
+    return false;
+  }
+  launchQueueBarrier();
+  return devapis::memSetD16Async(stream, ptr, val, count);
+}
+
+bool memSetD32Async(deviceStream_t stream, void* ptr, uint32_t val,
+                    size_t count) {
+  if (devapis::memSetD32Async == nullptr) {
+    return false;
+  }
+  launchQueueBarrier();
+  return devapis::memSetD32Async(stream, ptr, val, count);
+}
+
 // (synchronous) copy from device to a device
 void memCopyD2D(size_t nbytes, deviceId_t dstDevId, void* dst,
                 deviceId_t srcDevId, const void* src) {
+  launchQueueBarrier();
   return devapis::memCopyD2D(nbytes, dstDevId, dst, srcDevId, src);
 }
 
 // (synchronous) copy from host to a device
 void memCopyH2D(size_t nbytes, /*deviceId_t dstDevId,*/ void* dst,
                 /*Host srcDev,*/ const void* src) {
+  launchQueueBarrier();
   return devapis::memCopyH2D(nbytes, dst, src);
 }
 
 // (synchronous) copy from a device to host
 void memCopyD2H(size_t nbytes, /*Host dstDev,*/ void* dst,
                 /*deviceId_t srcDevId,*/ const void* src) {
+  launchQueueBarrier();
   return devapis::memCopyD2H(nbytes, dst, src);
 }
 
@@ -149,6 +482,7 @@ void memCopyD2H(size_t nbytes, /*Host dstDev,*/ void* dst,
 void memCopyD2DAsync(const deviceStream_t stream, size_t nbytes,
                      deviceId_t dstDevId, void* dst, deviceId_t srcDevId,
                      const void* src) {
+  launchQueueBarrier();
   return devapis::memCopyD2DAsync(stream, nbytes, dstDevId, dst, srcDevId, src);
 }
 
@@ -156,6 +490,7 @@ void memCopyD2DAsync(const deviceStream_t stream, size_t nbytes,
 void memCopyH2DAsync(const deviceStream_t stream, size_t nbytes,
                      /*deviceId_t dstDevId,*/ void* dst,
                      /*Host srcDev,*/ const void* src) {
+  launchQueueBarrier();
   return devapis::memCopyH2DAsync(stream, nbytes, dst, src);
 }
 
@@ -163,8 +498,38 @@ void memCopyH2DAsync(const deviceStream_t stream, size_t nbytes,
 void memCopyD2HAsync(const deviceStream_t stream, size_t nbytes,
                      /*Host dstDev,*/ void* dst,
                      /*deviceId_t srcDevId,*/ const void* src) {
+  launchQueueBarrier();
   return devapis::memCopyD2HAsync(stream, nbytes, dst, src);
 }
 
+bool isMemCopy2DSupported() { return devapis::memCopy2DAsync != nullptr; }
+
+void memCopy2DAsync(deviceStream_t stream, MemCPKind kind, void* dst,
+                    size_t dpitch, const void* src, size_t spitch,
+                    size_t width, size_t height) {
+  launchQueueBarrier();
+  if (isMemCopy2DSupported()) {
+    return devapis::memCopy2DAsync(stream, kind, dst, dpitch, src, spitch,
+                                   width, height);
+  }
+  auto device = current_device();
+  for (size_t i = 0; i < height; ++i) {
+    auto row_dst = static_cast<char*>(dst) + i * dpitch;
+    auto row_src = static_cast<const char*>(src) + i * spitch;
+    switch (kind) {
+      case MemCPKind::D2H:
+        devapis::memCopyD2HAsync(stream, width, row_dst, row_src);
+        break;
+      case MemCPKind::H2D:
+        devapis::memCopyH2DAsync(stream, width, row_dst, row_src);
+        break;
+      case MemCPKind::D2D:
+        devapis::memCopyD2DAsync(stream, width, device, row_dst, device,
+                                 row_src);
+        break;
+    }
+  }
+}
+
 }  // end namespace devproxy
 }  // end namespace dipu
@@ -10,13 +10,21 @@ namespace devproxy {
 using dipu::devapis::deviceId_t;
 using dipu::devapis::DIPUDeviceProperties;
 using dipu::devapis::DIPUDeviceStatus;
+using dipu::devapis::DIPUVendorCapabilities;
+using dipu::devapis::EventFlags;
 using dipu::devapis::EventStatus;
+using dipu::devapis::IpcMemHandle;
+using dipu::devapis::MemCPKind;
 using dipu::devapis::OpStatus;
 
 DIPU_API void initializeVendor();
 
 DIPU_API void finalizeVendor();
 
+// What the vendor declares, turned off where it misses the apis of a
+// capability. The runtime picks its fast paths by it.
+DIPU_API const DIPUVendorCapabilities& vendorCapabilities();
+
 DIPU_API deviceId_t current_device();
 
 DIPU_API DIPUDeviceProperties getDeviceProperties(int32_t device_index);
@@ -54,13 +62,59 @@ DIPU_API void streamWaitEvent(deviceStream_t stream, deviceEvent_t event);
 // same as query last event status in stream.(every op has a event)
 DIPU_API bool isStreamEmpty(deviceStream_t stream);
 
+// =====================
+//  stream capture related
+// =====================
+
+// capture works only if the vendor implements all stream capture hooks
+DIPU_API bool isStreamCaptureSupported();
+
+DIPU_API void streamBeginCapture(deviceStream_t stream);
+
+DIPU_API void* streamEndCapture(deviceStream_t stream);
+
+// always false if stream capture is not supported
+DIPU_API bool isStreamCapturing(deviceStream_t stream);
+
+DIPU_API void graphLaunch(void* graph, deviceStream_t stream);
+
+DIPU_API void graphDestroy(void* graph);
+
+DIPU_API bool isHostFuncSupported();
+
+DIPU_API void launchHostFunc(deviceStream_t stream, void (*fn)(void*),
+                             void* arg);
+
+// false if the vendor or the stream can't write values from the device
+DIPU_API bool streamWriteValue32(deviceStream_t stream, uint32_t* dst,
+                                 uint32_t value);
+
+// false if the vendor can't tell
+DIPU_API bool canAccessPeer(deviceId_t devId, deviceId_t peerDevId);
+
+// Enable access from devId to peerDevId, only the first call of each pair
+// reaches the vendor. Returns false if peer access is not possible.
+DIPU_API bool tryEnablePeerAccess(deviceId_t devId, deviceId_t peerDevId);
+
+// Falls back to PCIE if the devices can access each other and to UNKNOWN
+// otherwise, if the vendor can't tell
+DIPU_API devapis::DIPUDeviceLink getDeviceLink(deviceId_t devId,
+                                               deviceId_t peerDevId);
+
+// -1 if the vendor can't tell
+DIPU_API int getDeviceNumaNode(deviceId_t devId);
+
 // =====================
 //  device event related
 // =====================
 
-DIPU_API void createEvent(deviceEvent_t* event);
+// events are taken from and given back to per-device pools of each flags,
+// pass the same flags to destroyEvent
+DIPU_API void createEvent(deviceEvent_t* event,
+                          EventFlags flags = EventFlags::DEFAULT);
 
-DIPU_API void destroyEvent(deviceEvent_t event);
+DIPU_API void destroyEvent(deviceEvent_t event,
+                           EventFlags flags = EventFlags::DEFAULT);
 
 DIPU_API void waitEvent(deviceEvent_t event);
 
@@ -83,12 +137,56 @@ DIPU_API OpStatus mallocDevice(void** p, size_t nbytes,
 
 DIPU_API void freeDevice(void* p);
 
+// return false if the vendor does not support stream-ordered free
+DIPU_API bool freeDeviceAsync(void* p, deviceStream_t stream);
+
 DIPU_API bool isPinnedPtr(const void* p);
 
+// return false if the vendor does not support it or registration failed
+DIPU_API bool hostRegister(void* p, size_t nbytes);
+
+DIPU_API void hostUnregister(void* p);
+
+// =====================
+//  inter-process memory related
+// =====================
+
+DIPU_API bool isIpcSupported();
+
+// return false if the vendor does not support it or `p` can't be shared
+DIPU_API bool ipcGetMemHandle(IpcMemHandle* handle, size_t* offset, void* p);
+
+DIPU_API void ipcOpenMemHandle(void** p, const IpcMemHandle& handle);
+
+DIPU_API void ipcCloseMemHandle(void* p);
+
+// =====================
+//  virtual memory related
+// =====================
+
+// return 0 if the vendor does not support virtual memory management
+DIPU_API size_t getVirtualMemGranularity();
+
+DIPU_API OpStatus reserveVirtualMem(void** p, size_t nbytes);
+
+DIPU_API void releaseVirtualMem(void* p, size_t nbytes);
+
+DIPU_API OpStatus mapVirtualMem(void* p, size_t nbytes);
+
+DIPU_API void unmapVirtualMem(void* p, size_t nbytes);
+
 // (asynchronous) set val
 DIPU_API void memSetAsync(deviceStream_t stream, void* ptr, int val,
                           size_t size);
 
+// (asynchronous) set count 16 or 32 bit words to val, returns false if the
+// vendor does not support it
+DIPU_API bool memSetD16Async(deviceStream_t stream, void* ptr, uint16_t val,
+                             size_t count);
+
+DIPU_API bool memSetD32Async(deviceStream_t stream, void* ptr, uint32_t val,
+                             size_t count);
+
 // (synchronous) copy from device to a device
 DIPU_API void memCopyD2D(size_t nbytes, deviceId_t dstDevId, void* dst,
                          deviceId_t srcDevId, const void* src);
@@ -116,5 +214,13 @@ DIPU_API void memCopyD2HAsync(deviceStream_t stream, size_t nbytes,
                               /*Host dstDev,*/ void* dst,
                               /*deviceId_t srcDevId,*/ const void* src);
 
+DIPU_API bool isMemCopy2DSupported();
+
+// (asynchronous) copy rows of bytes at different pitches, falls back to one
+// copy per row if the vendor does not support 2D copies
+DIPU_API void memCopy2DAsync(deviceStream_t stream, MemCPKind kind, void* dst,
+                             size_t dpitch, const void* src, size_t spitch,
+                             size_t width, size_t height);
+
 }  // end namespace devproxy
 }  // end namespace dipu
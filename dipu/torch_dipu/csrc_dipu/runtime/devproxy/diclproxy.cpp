@@ -2,6 +2,10 @@
 
 #include "diclproxy.h"
 
+#include <vector>
+
+#include <c10/util/Exception.h>
+
 namespace dipu {
 // need enhance return status.
 namespace devproxy {
@@ -24,6 +28,25 @@ devapis::diclResult_t diclCommDestroy(diclComm_t comm) {
   return devapis::diclCommDestroy(comm);
 }
 
+bool isDiclCommSplitSupported() {
+  return devapis::diclCommSplit != nullptr;
+}
+
+devapis::diclResult_t diclCommSplit(diclComm_t comm, int color, int key,
+                                    diclComm_t* newComm) {
+  TORCH_CHECK(isDiclCommSplitSupported(),
+              "the vendor can't split communicators");
+  return devapis::diclCommSplit(comm, color, key, newComm);
+}
+
+bool diclCommAbort(diclComm_t comm) {
+  if (!devapis::diclCommAbort) {
+    return false;
+  }
+  devapis::diclCommAbort(comm);
+  return true;
+}
+
 devapis::diclResult_t diclAllReduce(const void* sendbuff, void* recvbuff,
                                     size_t count, at::ScalarType datatype,
                                     const devapis::ReduceOp& reduceOp,
@@ -74,5 +97,89 @@ devapis::diclResult_t diclRecv(void* recvbuff, size_t count,
   return devapis::diclRecv(recvbuff, count, datatype, peer, comm, stream);
 }
 
+devapis::diclResult_t diclAllToAll(const void* sendbuff, void* recvbuff,
+                                   size_t count, at::ScalarType datatype,
+                                   int nranks, diclComm_t comm,
+                                   deviceStream_t stream) {
+  if (devapis::diclAllToAll) {
+    return devapis::diclAllToAll(sendbuff, recvbuff, count, datatype, comm,
+                                 stream);
+  }
+  std::vector<size_t> counts(nranks, count);
+  std::vector<size_t> displs(nranks);
+  for (int i = 0; i < nranks; ++i) {
+    displs[i] = i * count;
+  }
+  return diclAllToAllv(sendbuff, counts.data(), displs.data(), recvbuff,
+                       counts.data(), displs.data(), datatype, nranks, comm,
+                       stream);
+}
+
+devapis::diclResult_t diclAllToAllv(
+    const void* sendbuff, const size_t* sendCounts, const size_t* sendDispls,
+    void* recvbuff, const size_t* recvCounts, const size_t* recvDispls,
+    at::ScalarType datatype, int nranks, diclComm_t comm,
+    deviceStream_t stream) {
+  if (devapis::diclAllToAllv) {
+    return devapis::diclAllToAllv(sendbuff, sendCounts, sendDispls, recvbuff,
+                                  recvCounts, recvDispls, datatype, comm,
+                                  stream);
+  }
+  // sends and receives of all ranks must be in flight at once
+  TORCH_CHECK(isDiclGroupSupported(),
+              "the vendor supports neither all-to-all nor DICL groups");
+  const auto itemsize = c10::elementSize(datatype);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast) dicl send api
+  auto* send = static_cast<char*>(const_cast<void*>(sendbuff));
+  auto* recv = static_cast<char*>(recvbuff);
+  devapis::diclGroupStart();
+  for (int i = 0; i < nranks; ++i) {
+    if (sendCounts[i] > 0) {
+      devapis::diclSend(send + sendDispls[i] * itemsize, sendCounts[i],
+                        datatype, i, comm, stream);
+    }
+    if (recvCounts[i] > 0) {
+      devapis::diclRecv(recv + recvDispls[i] * itemsize, recvCounts[i],
+                        datatype, i, comm, stream);
+    }
+  }
+  return devapis::diclGroupEnd();
+}
+
+bool isDiclGroupSupported() {
+  return devapis::diclGroupStart && devapis::diclGroupEnd;
+}
+
+devapis::diclResult_t diclGroupStart() {
+  if (isDiclGroupSupported()) {
+    return devapis::diclGroupStart();
+  }
+  return devapis::DICL_SUCCESS;
+}
+
+devapis::diclResult_t diclGroupEnd() {
+  if (isDiclGroupSupported()) {
+    return devapis::diclGroupEnd();
+  }
+  return devapis::DICL_SUCCESS;
+}
+
+bool isDiclRegisterSupported() {
+  return devapis::diclCommRegister && devapis::diclCommDeregister;
+}
+
+devapis::diclResult_t diclCommRegister(diclComm_t comm, void* buff,
+                                       size_t size, void** handle) {
+  TORCH_CHECK(isDiclRegisterSupported(),
+              "the vendor can't register buffers with communicators");
+  return devapis::diclCommRegister(comm, buff, size, handle);
+}
+
+devapis::diclResult_t diclCommDeregister(diclComm_t comm, void* handle) {
+  TORCH_CHECK(isDiclRegisterSupported(),
+              "the vendor can't register buffers with communicators");
+  return devapis::diclCommDeregister(comm, handle);
+}
+
 }  // namespace devproxy
 }  // namespace dipu
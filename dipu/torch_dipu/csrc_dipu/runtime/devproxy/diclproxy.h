@@ -17,6 +17,14 @@ DIPU_API devapis::diclResult_t diclCommInitRank(diclComm_t* comm, int nranks,
 
 DIPU_API devapis::diclResult_t diclCommDestroy(diclComm_t comm);
 
+DIPU_API bool isDiclCommSplitSupported();
+
+DIPU_API devapis::diclResult_t diclCommSplit(diclComm_t comm, int color,
+                                             int key, diclComm_t* newComm);
+
+// Returns false if the vendor can't abort communicators
+DIPU_API bool diclCommAbort(diclComm_t comm);
+
 DIPU_API devapis::diclResult_t diclAllReduce(
     const void* sendbuff, void* recvbuff, size_t count, at::ScalarType datatype,
     const devapis::ReduceOp& reduceOp, diclComm_t comm, deviceStream_t stream);
@@ -51,5 +59,35 @@ DIPU_API devapis::diclResult_t diclRecv(void* recvbuff, size_t count,
                                         at::ScalarType datatype, int peer,
                                         diclComm_t comm, deviceStream_t stream);
 
+// Fall back to diclAllToAllv, and diclAllToAllv to grouped sends and receives
+// of every rank, if the vendor doesn't implement them. `nranks` is the size of
+// `comm`.
+DIPU_API devapis::diclResult_t diclAllToAll(const void* sendbuff,
+                                            void* recvbuff, size_t count,
+                                            at::ScalarType datatype,
+                                            int nranks, diclComm_t comm,
+                                            deviceStream_t stream);
+
+DIPU_API devapis::diclResult_t diclAllToAllv(
+    const void* sendbuff, const size_t* sendCounts, const size_t* sendDispls,
+    void* recvbuff, const size_t* recvCounts, const size_t* recvDispls,
+    at::ScalarType datatype, int nranks, diclComm_t comm,
+    deviceStream_t stream);
+
+DIPU_API bool isDiclGroupSupported();
+
+// no-ops if groups are not supported, the calls then run one by one
+DIPU_API devapis::diclResult_t diclGroupStart();
+
+DIPU_API devapis::diclResult_t diclGroupEnd();
+
+DIPU_API bool isDiclRegisterSupported();
+
+DIPU_API devapis::diclResult_t diclCommRegister(diclComm_t comm, void* buff,
+                                                size_t size, void** handle);
+
+DIPU_API devapis::diclResult_t diclCommDeregister(diclComm_t comm,
+                                                  void* handle);
+
 }  // namespace devproxy
 }  // namespace dipu
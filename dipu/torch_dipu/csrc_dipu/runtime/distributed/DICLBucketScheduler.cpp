@@ -0,0 +1,160 @@
+// Copyright (c) 2024, DeepLink.
+#include "DICLBucketScheduler.hpp"
+
+#include <utility>
+
+#include "csrc_dipu/runtime/core/DIPUGuard.h"
+
+namespace dipu {
+
+DICLGradBucketScheduler::DICLGradBucketScheduler(
+    c10::intrusive_ptr<ProcessGroupDICL> pg, std::vector<at::Tensor> params,
+    int64_t bucketCapBytes)
+    : pg_(std::move(pg)),
+      params_(std::move(params)),
+      slots_(params_.size(), {kNoBucket, 0}),
+      ready_(params_.size(), false) {
+  TORCH_CHECK(bucketCapBytes > 0, "bucket cap must be positive, got ",
+              bucketCapBytes);
+  std::vector<int64_t> numels;
+  int64_t bucketBytes = 0;
+  for (size_t i = params_.size(); i-- > 0;) {
+    const auto& param = params_[i];
+    if (!param.requires_grad()) {
+      continue;
+    }
+    TORCH_CHECK(param.is_floating_point() || param.is_complex(),
+                "parameter ", i, " can't have a gradient");
+    TORCH_CHECK(param.device().type() == DIPU_DEVICE_TYPE, "parameter ", i,
+                " is not on a dipu device");
+    TORCH_CHECK(buckets_.empty() ||
+                    params_[buckets_.front().params.front()].device() ==
+                        param.device(),
+                "dipu supports one device per process only");
+    const auto nbytes = static_cast<int64_t>(param.nbytes());
+    if (buckets_.empty() ||
+        params_[buckets_.back().params.front()].scalar_type() !=
+            param.scalar_type() ||
+        bucketBytes + nbytes > bucketCapBytes) {
+      buckets_.emplace_back();
+      numels.push_back(0);
+      bucketBytes = 0;
+    }
+    auto& bucket = buckets_.back();
+    slots_[i] = {buckets_.size() - 1, bucket.params.size()};
+    bucket.params.push_back(i);
+    numels.back() += param.numel();
+    bucketBytes += nbytes;
+  }
+  if (buckets_.empty()) {
+    return;
+  }
+
+  pool_ = createMemPool();
+  DIPUMemPoolGuard poolGuard(pool_);
+  DIPUGuard guard(params_[buckets_.front().params.front()].device());
+  for (size_t b = 0; b < buckets_.size(); ++b) {
+    auto& bucket = buckets_[b];
+    const auto& first = params_[bucket.params.front()];
+    bucket.flat = at::zeros({numels[b]}, first.options());
+    int64_t offset = 0;
+    for (auto i : bucket.params) {
+      auto& param = params_[i];
+      auto view =
+          bucket.flat.narrow(0, offset, param.numel()).view(param.sizes());
+      offset += param.numel();
+      auto& grad = param.mutable_grad();
+      if (grad.defined()) {
+        view.copy_(grad);
+      }
+      grad = view;
+      bucket.views.push_back(std::move(view));
+    }
+    bucket.pending = bucket.params.size();
+  }
+}
+
+DICLGradBucketScheduler::~DICLGradBucketScheduler() {
+  if (pool_ == kDefaultMemPool) {
+    return;
+  }
+  // the gradients may still view the buckets, only what is cached goes
+  buckets_.clear();
+  emptyMemPool(pool_);
+}
+
+void DICLGradBucketScheduler::adoptGrad(size_t index) {
+  const auto [b, slot] = slots_[index];
+  auto& view = buckets_[b].views[slot];
+  auto& grad = params_[index].mutable_grad();
+  if (grad.defined() && grad.data_ptr() == view.data_ptr()) {
+    return;
+  }
+  if (grad.defined()) {
+    view.copy_(grad);
+  } else {
+    view.zero_();
+  }
+  grad = view;
+}
+
+void DICLGradBucketScheduler::markReady(size_t index) {
+  TORCH_CHECK(index < params_.size(), "parameter ", index, " out of range");
+  TORCH_CHECK(slots_[index].first != kNoBucket, "parameter ", index,
+              " doesn't require grad");
+  std::lock_guard<std::mutex> lock(mutex_);
+  TORCH_CHECK(!ready_[index], "the gradient of parameter ", index,
+              " is ready twice, finalize() must be called after backward");
+  ready_[index] = true;
+  adoptGrad(index);
+  if (--buckets_[slots_[index].first].pending == 0) {
+    queueReadyBuckets();
+  }
+}
+
+void DICLGradBucketScheduler::queueReadyBuckets() {
+  while (nextBucket_ < buckets_.size() &&
+         buckets_[nextBucket_].pending == 0) {
+    auto& bucket = buckets_[nextBucket_++];
+    DIPUGuard guard(bucket.flat.device());
+    // averaged before the sum as DDP does, which keeps fp16 from overflowing
+    bucket.flat.div_(pg_->getSize());
+    std::vector<at::Tensor> tensors{bucket.flat};
+    bucket.work = pg_->allreduceOwned(tensors, c10d::AllreduceOptions());
+  }
+}
+
+void DICLGradBucketScheduler::finalize() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < params_.size(); ++i) {
+    if (slots_[i].first == kNoBucket || ready_[i]) {
+      continue;
+    }
+    const auto [b, slot] = slots_[i];
+    buckets_[b].views[slot].zero_();
+    params_[i].mutable_grad() = buckets_[b].views[slot];
+    --buckets_[b].pending;
+  }
+  queueReadyBuckets();
+  for (auto& bucket : buckets_) {
+    if (bucket.work) {
+      bucket.work->wait();
+      bucket.work.reset();
+    }
+    bucket.pending = bucket.params.size();
+  }
+  nextBucket_ = 0;
+  ready_.assign(params_.size(), false);
+}
+
+std::vector<std::vector<size_t>> DICLGradBucketScheduler::bucketIndices()
+    const {
+  std::vector<std::vector<size_t>> result;
+  result.reserve(buckets_.size());
+  for (const auto& bucket : buckets_) {
+    result.push_back(bucket.params);
+  }
+  return result;
+}
+
+}  // namespace dipu
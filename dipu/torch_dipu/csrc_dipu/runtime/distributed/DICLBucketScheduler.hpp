@@ -0,0 +1,86 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <ATen/ATen.h>
+#include <torch/csrc/distributed/c10d/Work.hpp>
+
+#include "csrc_dipu/base/basedef.h"
+#include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocatorUtils.h"
+
+#include "ProcessGroupDICL.h"
+
+namespace dipu {
+
+// Averages the gradients of a model across the ranks of a process group in
+// buckets, as DDP does. The gradients are views of flat buckets allocated
+// from a memory pool of the scheduler, which live as long as it does, so
+// their allreduces skip recordStream and the work of a bucket is the only
+// event tracking it. A bucket is allreduced as soon as all its gradients are
+// ready and the buckets before it are queued, which keeps the order the
+// same on all ranks.
+class DIPU_API DICLGradBucketScheduler {
+ public:
+  // `params` in the order the model defines them. Their gradients are ready
+  // in about the reverse order, so the buckets are filled from the back,
+  // each up to `bucketCapBytes` and of one dtype.
+  DICLGradBucketScheduler(c10::intrusive_ptr<ProcessGroupDICL> pg,
+                          std::vector<at::Tensor> params,
+                          int64_t bucketCapBytes);
+
+  ~DICLGradBucketScheduler();
+
+  DICLGradBucketScheduler(const DICLGradBucketScheduler&) = delete;
+  DICLGradBucketScheduler& operator=(const DICLGradBucketScheduler&) = delete;
+  DICLGradBucketScheduler(DICLGradBucketScheduler&&) = delete;
+  DICLGradBucketScheduler& operator=(DICLGradBucketScheduler&&) = delete;
+
+  // Called once the gradient of params[index] is accumulated in backward
+  void markReady(size_t index);
+
+  // Zeroes the gradients that were not ready, e.g. of unused parameters,
+  // queues the buckets left and makes the current stream wait for all of
+  // them. Called after each backward, before the optimizer step.
+  void finalize();
+
+  // Indices of the params of each bucket, in the order they are allreduced
+  std::vector<std::vector<size_t>> bucketIndices() const;
+
+ private:
+  struct Bucket {
+    std::vector<size_t> params;
+    // The gradient of each of `params` in `flat`
+    std::vector<at::Tensor> views;
+    at::Tensor flat;
+    size_t pending = 0;
+    c10::intrusive_ptr<c10d::Work> work;
+  };
+
+  static constexpr size_t kNoBucket = static_cast<size_t>(-1);
+
+  // Must be called with `mutex_` held
+  void queueReadyBuckets();
+
+  // Points the gradient of params[index] to its view again, copying it if
+  // autograd allocated a new one, e.g. after zero_grad(set_to_none=True)
+  void adoptGrad(size_t index);
+
+  c10::intrusive_ptr<ProcessGroupDICL> pg_;
+  std::vector<at::Tensor> params_;
+  // Bucket and index in it of each param, kNoBucket if it has no gradient
+  std::vector<std::pair<size_t, size_t>> slots_;
+  std::vector<Bucket> buckets_;
+  MemPoolId pool_ = kDefaultMemPool;
+
+  std::mutex mutex_;
+  // Guarded by `mutex_`
+  size_t nextBucket_ = 0;
+  std::vector<bool> ready_;
+};
+
+}  // namespace dipu
@@ -0,0 +1,230 @@
+// Copyright (c) 2024, DeepLink.
+#include "DICLCompression.hpp"
+
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <ATen/ATen.h>
+
+#include "csrc_dipu/runtime/core/DIPUGuard.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+enum class Compression { NONE, FP16, BF16, INT8 };
+
+// Smaller allreduces are latency bound and not worth the extra kernels
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const auto kCompressionMinBytes = get_env_or_default(
+    "DIPU_DICL_COMPRESSED_ALLREDUCE_MIN_BYTES", size_t{1} << 20U);
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kErrorFeedback =
+    get_env_or_default("DIPU_DICL_COMPRESSION_ERROR_FEEDBACK", 1) > 0;
+
+// Residuals of freed tensors are dropped past this, and all of them if still
+// too many, tensors allreduced once would otherwise keep theirs forever
+constexpr size_t kMaxCompressionResiduals = 4096;
+
+// Elements sharing one int8 scale
+constexpr int64_t kInt8BlockSize = 256;
+constexpr double kInt8Max = 127;
+
+Compression compression() {
+  // Read on first use, so that a typo fails the allreduce instead of the
+  // library load
+  static const Compression kCompression = [] {
+    const auto name =
+        get_env_or_default("DIPU_DICL_COMPRESSED_ALLREDUCE", std::string());
+    if (name.empty()) {
+      return Compression::NONE;
+    }
+    if (name == "fp16") {
+      return Compression::FP16;
+    }
+    if (name == "bf16") {
+      return Compression::BF16;
+    }
+    TORCH_CHECK(name == "int8", "DIPU_DICL_COMPRESSED_ALLREDUCE must be ",
+                "fp16, bf16 or int8, got ", name);
+    return Compression::INT8;
+  }();
+  return kCompression;
+}
+
+// The compression error of the last allreduce of `input`, zeros at first
+at::Tensor& residualOf(DICLComm& comm, const at::Tensor& input) {
+  auto& residuals = comm.compressionResiduals_;
+  const auto& storage = input.storage().getIntrusivePtr();
+  const auto key = std::make_pair(storage.get(), input.storage_offset());
+  if (residuals.size() >= kMaxCompressionResiduals &&
+      residuals.find(key) == residuals.end()) {
+    for (auto it = residuals.begin(); it != residuals.end();) {
+      it = it->second.storage.expired() ? residuals.erase(it) : std::next(it);
+    }
+    if (residuals.size() >= kMaxCompressionResiduals) {
+      residuals.clear();
+    }
+  }
+  auto& entry = residuals[key];
+  if (entry.storage.expired() || !entry.residual.defined() ||
+      entry.residual.numel() != input.numel()) {
+    entry.storage = c10::weak_intrusive_ptr<c10::StorageImpl>(storage);
+    entry.residual =
+        at::zeros({input.numel()}, input.options().dtype(at::kFloat));
+  }
+  return entry.residual;
+}
+
+// Rounds float `blocks` of kInt8BlockSize to int8, with one scale per block
+std::tuple<at::Tensor, at::Tensor> quantize(const at::Tensor& blocks) {
+  auto scales = std::get<0>(blocks.abs().max(-1, true));
+  scales.div_(kInt8Max).clamp_min_(std::numeric_limits<float>::min());
+  auto scaled = blocks / scales;
+  // the cast truncates, round half away from zero first
+  auto rounded = at::where(scaled >= 0, scaled + 0.5, scaled - 0.5);
+  return {rounded.clamp_(-kInt8Max, kInt8Max).to(at::kChar), scales};
+}
+
+at::Tensor dequantize(const at::Tensor& quantized, const at::Tensor& scales) {
+  return quantized.to(at::kFloat) * scales;
+}
+
+// Sums `values` of all ranks in `wire` precision: reduce-scatter then
+// allgather, as a ring allreduce does
+devapis::diclResult_t castAllReduce(const at::Tensor& values,
+                                    at::Tensor& reduced, at::Tensor& residual,
+                                    at::ScalarType wire, DICLComm& comm,
+                                    int64_t ranks, DIPUStream& stream) {
+  const auto numel = values.numel();
+  const auto chunk = (numel + ranks - 1) / ranks;
+  auto send = at::zeros({chunk * ranks}, values.options().dtype(wire));
+  auto sent = send.narrow(0, 0, numel);
+  sent.copy_(values);
+  residual.copy_(values - sent.to(at::kFloat));
+  auto recv = at::empty({chunk}, send.options());
+  const auto count = static_cast<size_t>(chunk);
+  auto result = devproxy::diclReduceScatter(
+      send.data_ptr(), recv.data_ptr(), count, wire, c10d::ReduceOp::SUM,
+      comm.rawComm(), stream.rawstream());
+  if (result != devapis::DICL_SUCCESS) {
+    return result;
+  }
+  // `send` is consumed by now, the stream runs in order
+  result = devproxy::diclAllGather(recv.data_ptr(), send.data_ptr(), count,
+                                   wire, comm.rawComm(), stream.rawstream());
+  reduced = sent.to(at::kFloat);
+  return result;
+}
+
+// int8 sums would overflow and mix scales, so each rank receives its chunk
+// of every rank's blocks, sums them in float and shares the requantized sum
+devapis::diclResult_t int8AllReduce(const at::Tensor& values,
+                                    at::Tensor& reduced, at::Tensor& residual,
+                                    DICLComm& comm, int64_t ranks,
+                                    DIPUStream& stream) {
+  const auto numel = values.numel();
+  const auto step = ranks * kInt8BlockSize;
+  const auto padded = (numel + step - 1) / step * step;
+  const auto chunkBlocks = padded / step;
+  auto blocks = at::zeros({padded}, values.options());
+  blocks.narrow(0, 0, numel).copy_(values);
+  blocks = blocks.view({ranks, chunkBlocks, kInt8BlockSize});
+  auto [quantized, scales] = quantize(blocks);
+  residual.copy_(
+      (blocks - dequantize(quantized, scales)).view(-1).narrow(0, 0, numel));
+
+  const auto chunkCount = static_cast<size_t>(chunkBlocks * kInt8BlockSize);
+  const auto scaleCount = static_cast<size_t>(chunkBlocks);
+  const auto nranks = static_cast<int>(ranks);
+  auto recvQuantized = at::empty_like(quantized);
+  auto recvScales = at::empty_like(scales);
+  auto result = devproxy::diclAllToAll(
+      quantized.data_ptr(), recvQuantized.data_ptr(), chunkCount, at::kChar,
+      nranks, comm.rawComm(), stream.rawstream());
+  if (result != devapis::DICL_SUCCESS) {
+    return result;
+  }
+  result = devproxy::diclAllToAll(scales.data_ptr(), recvScales.data_ptr(),
+                                  scaleCount, at::kFloat, nranks,
+                                  comm.rawComm(), stream.rawstream());
+  if (result != devapis::DICL_SUCCESS) {
+    return result;
+  }
+
+  auto [chunkQuantized, chunkScales] =
+      quantize(dequantize(recvQuantized, recvScales).sum(0));
+  result = devproxy::diclAllGather(
+      chunkQuantized.data_ptr(), quantized.data_ptr(), chunkCount, at::kChar,
+      comm.rawComm(), stream.rawstream());
+  if (result != devapis::DICL_SUCCESS) {
+    return result;
+  }
+  result = devproxy::diclAllGather(chunkScales.data_ptr(), scales.data_ptr(),
+                                   scaleCount, at::kFloat, comm.rawComm(),
+                                   stream.rawstream());
+  reduced = dequantize(quantized, scales).view(-1).narrow(0, 0, numel);
+  return result;
+}
+
+}  // namespace
+
+bool canCompressAllReduce(const at::Tensor& tensor,
+                          const c10d::ReduceOp& op) {
+  const auto mode = compression();
+  if (mode == Compression::NONE || tensor.nbytes() < kCompressionMinBytes ||
+      !tensor.is_floating_point()) {
+    return false;
+  }
+  if (!(op == c10d::ReduceOp::SUM || op == c10d::ReduceOp::AVG)) {
+    return false;
+  }
+  // fp16 / bf16 only save bytes over wider types
+  return mode == Compression::INT8 || tensor.element_size() > 2;
+}
+
+devapis::diclResult_t compressedAllReduce(const at::Tensor& input,
+                                          at::Tensor& output,
+                                          const c10d::ReduceOp& op,
+                                          DICLComm& comm, int worldSize,
+                                          DIPUStream& stream) {
+  // temporaries are freed once queued, the allocator reuses them after the
+  // comm stream
+  DIPUStreamGuard guard(stream.unwrap());
+  const auto ranks = static_cast<int64_t>(worldSize);
+  auto values = input.reshape({-1}).to(at::kFloat, false, /*copy=*/true);
+  // AVG divides before the sum, which also keeps fp16 from overflowing
+  if (op == c10d::ReduceOp::AVG) {
+    values.div_(static_cast<double>(ranks));
+  }
+  at::Tensor residual;
+  if (kErrorFeedback) {
+    residual = residualOf(comm, input);
+    values.add_(residual);
+  } else {
+    residual = at::empty_like(values);
+  }
+
+  at::Tensor reduced;
+  devapis::diclResult_t result;
+  const auto mode = compression();
+  if (mode == Compression::INT8) {
+    result = int8AllReduce(values, reduced, residual, comm, ranks, stream);
+  } else {
+    const auto wire = mode == Compression::FP16 ? at::kHalf : at::kBFloat16;
+    result =
+        castAllReduce(values, reduced, residual, wire, comm, ranks, stream);
+  }
+  if (result == devapis::DICL_SUCCESS) {
+    output.copy_(reduced.view(input.sizes()));
+  }
+  return result;
+}
+
+}  // namespace dipu
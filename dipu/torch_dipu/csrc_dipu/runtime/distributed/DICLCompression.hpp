@@ -0,0 +1,29 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <ATen/core/Tensor.h>
+#include <torch/csrc/distributed/c10d/Types.hpp>
+
+#include "csrc_dipu/runtime/core/DIPUStream.h"
+
+#include "DICLUtils.hpp"
+
+namespace dipu {
+
+// Whether an allreduce of `tensor` is compressed, see
+// DIPU_DICL_COMPRESSED_ALLREDUCE. Only SUM and AVG of floating tensors are.
+bool canCompressAllReduce(const at::Tensor& tensor,
+                          const c10d::ReduceOp& op);
+
+// Allreduces `input` into `output` on `stream` with fewer bytes on the wire:
+// fp16 / bf16 data reduce-scattered and allgathered, or int8 data with one
+// scale per block exchanged by all-to-all, reduced locally and allgathered.
+// What the compression of `input` loses is kept by `comm` and added to the
+// next allreduce of the same tensor, e.g. the same DDP bucket.
+devapis::diclResult_t compressedAllReduce(const at::Tensor& input,
+                                          at::Tensor& output,
+                                          const c10d::ReduceOp& op,
+                                          DICLComm& comm, int worldSize,
+                                          DIPUStream& stream);
+
+}  // namespace dipu
@@ -0,0 +1,182 @@
+// Copyright (c) 2024, DeepLink.
+#include "DICLFlightRecorder.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <sstream>
+#include <utility>
+
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+constexpr uint64_t kStateBits = 2;
+constexpr uint64_t kStateMask = (uint64_t{1} << kStateBits) - 1;
+
+uint64_t packState(uint64_t id, FlightRecord::State state) {
+  return id << kStateBits | static_cast<uint64_t>(state);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kFlightRecorderSize =
+    get_env_or_default("DIPU_DICL_FLIGHT_RECORDER_SIZE", size_t{1024});
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<uint64_t> dump_requests{0};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the signal handler needs a lock-free counter");
+
+// A signal number, e.g. 10 for SIGUSR1. Dumps the flight recorders of all
+// process groups to the log, 0 installs no handler.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const int kDumpSignal = [] {
+  const int signal =
+      get_env_or_default("DIPU_DICL_FLIGHT_RECORDER_SIGNAL", 0);
+  if (signal > 0) {
+    std::signal(signal, [](int) {
+      dump_requests.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+  return signal;
+}();
+
+}  // namespace
+
+const char* flightRecordStateName(FlightRecord::State state) {
+  switch (state) {
+    case FlightRecord::State::QUEUED:
+      return "queued";
+    case FlightRecord::State::STARTED:
+      return "started";
+    case FlightRecord::State::COMPLETED:
+      return "completed";
+    case FlightRecord::State::FAILED:
+      return "failed";
+  }
+  return "unknown";
+}
+
+FlightRecorder::FlightRecorder(size_t capacity)
+    : capacity_(capacity),
+      slots_(capacity > 0 ? std::make_unique<Slot[]>(capacity) : nullptr) {}
+
+uint64_t FlightRecorder::record(c10d::OpType opType, const void* comm,
+                                int64_t numel, at::ScalarType dtype,
+                                uint64_t bytes) {
+  if (!enabled()) {
+    return 0;
+  }
+  const auto id = lastId_.fetch_add(1, std::memory_order_relaxed) + 1;
+  auto& slot = slots_[(id - 1) % capacity_];
+  // a seqlock, readers drop the slot if its id changed while they read it
+  slot.id.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.state.store(packState(id, FlightRecord::State::QUEUED),
+                   std::memory_order_relaxed);
+  slot.opType.store(static_cast<int16_t>(opType), std::memory_order_relaxed);
+  slot.dtype.store(static_cast<int8_t>(dtype), std::memory_order_relaxed);
+  slot.numel.store(numel, std::memory_order_relaxed);
+  slot.bytes.store(bytes, std::memory_order_relaxed);
+  slot.queuedUs.store(std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count(),
+                      std::memory_order_relaxed);
+  slot.comm.store(comm, std::memory_order_relaxed);
+  slot.id.store(id, std::memory_order_release);
+  return id;
+}
+
+void FlightRecorder::setState(uint64_t id, FlightRecord::State state) {
+  if (!enabled() || id == 0) {
+    return;
+  }
+  auto& slot = slots_[(id - 1) % capacity_];
+  auto queued = packState(id, FlightRecord::State::QUEUED);
+  slot.state.compare_exchange_strong(queued, packState(id, state),
+                                     std::memory_order_relaxed);
+}
+
+void FlightRecorder::nameComm(const void* comm, std::string name) {
+  std::lock_guard<std::mutex> _(namesMutex_);
+  commNames_[comm] = std::move(name);
+}
+
+std::vector<FlightRecord> FlightRecorder::dump() const {
+  std::vector<FlightRecord> records;
+  if (!enabled()) {
+    return records;
+  }
+  const auto last = lastId_.load(std::memory_order_acquire);
+  const auto first = last > capacity_ ? last - capacity_ + 1 : 1;
+  std::vector<const void*> comms;
+  records.reserve(static_cast<size_t>(last - first + 1));
+  comms.reserve(records.capacity());
+  for (auto id = first; id <= last; ++id) {
+    const auto& slot = slots_[(id - 1) % capacity_];
+    if (slot.id.load(std::memory_order_acquire) != id) {
+      continue;
+    }
+    FlightRecord record;
+    record.id = id;
+    record.opType =
+        static_cast<c10d::OpType>(slot.opType.load(std::memory_order_relaxed));
+    record.dtype =
+        static_cast<at::ScalarType>(slot.dtype.load(std::memory_order_relaxed));
+    record.numel = slot.numel.load(std::memory_order_relaxed);
+    record.bytes = slot.bytes.load(std::memory_order_relaxed);
+    record.queuedUs = slot.queuedUs.load(std::memory_order_relaxed);
+    const auto* comm = slot.comm.load(std::memory_order_relaxed);
+    const auto state = slot.state.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.id.load(std::memory_order_relaxed) != id ||
+        state >> kStateBits != id) {
+      continue;
+    }
+    record.state = static_cast<FlightRecord::State>(state & kStateMask);
+    records.push_back(std::move(record));
+    comms.push_back(comm);
+  }
+
+  // the first unfinished record of each communicator is the running one
+  std::unordered_map<const void*, bool> busy;
+  std::lock_guard<std::mutex> _(namesMutex_);
+  for (size_t i = 0; i < records.size(); ++i) {
+    auto& record = records[i];
+    auto name = commNames_.find(comms[i]);
+    if (name != commNames_.end()) {
+      record.comm = name->second;
+    }
+    if (record.state == FlightRecord::State::COMPLETED) {
+      continue;
+    }
+    auto& commBusy = busy[comms[i]];
+    if (!commBusy && record.state == FlightRecord::State::QUEUED) {
+      record.state = FlightRecord::State::STARTED;
+    }
+    commBusy = true;
+  }
+  return records;
+}
+
+std::string FlightRecorder::format() const {
+  std::ostringstream stream;
+  for (const auto& record : dump()) {
+    stream << "#" << record.id << " " << c10d::opTypeToString(record.opType)
+           << " " << record.numel << " x " << c10::toString(record.dtype)
+           << ", " << record.bytes << " B, queued at " << record.queuedUs
+           << " us, comm " << record.comm << ", "
+           << flightRecordStateName(record.state) << "\n";
+  }
+  return stream.str();
+}
+
+size_t flightRecorderSize() { return kFlightRecorderSize; }
+
+uint64_t flightRecorderDumpRequests() {
+  return kDumpSignal > 0 ? dump_requests.load(std::memory_order_relaxed) : 0;
+}
+
+}  // namespace dipu
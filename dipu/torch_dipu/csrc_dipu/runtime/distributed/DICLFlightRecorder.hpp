@@ -0,0 +1,99 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <c10/core/ScalarType.h>
+#include <torch/csrc/distributed/c10d/Work.hpp>
+
+#include "csrc_dipu/base/basedef.h"
+
+namespace dipu {
+
+// An op of a process group as the flight recorder last saw it
+struct FlightRecord {
+  enum class State : uint8_t { QUEUED, STARTED, COMPLETED, FAILED };
+
+  // Counts the recorded ops of the process group from 1, so the same op has
+  // the same id on all ranks
+  uint64_t id = 0;
+  c10d::OpType opType = c10d::OpType::UNKNOWN;
+  // Of the first input
+  int64_t numel = 0;
+  at::ScalarType dtype = at::ScalarType::Undefined;
+  // The larger of the inputs and the outputs
+  uint64_t bytes = 0;
+  // Since the epoch of the system clock
+  int64_t queuedUs = 0;
+  // The key of the communicators of the op
+  std::string comm;
+  State state = State::QUEUED;
+};
+
+DIPU_API const char* flightRecordStateName(FlightRecord::State state);
+
+// The last ops queued by a process group, in a fixed-size ring. Recording
+// takes a few relaxed atomic stores and never locks, dumps skip the slots
+// being written meanwhile.
+class FlightRecorder {
+ public:
+  explicit FlightRecorder(size_t capacity);
+
+  bool enabled() const { return capacity_ > 0; }
+
+  // Returns the id of the new record, 0 if disabled. `comm` only identifies
+  // the communicators, see nameComm.
+  uint64_t record(c10d::OpType opType, const void* comm, int64_t numel,
+                  at::ScalarType dtype, uint64_t bytes);
+
+  // Only QUEUED records change, and only while they are still in the ring
+  void setState(uint64_t id, FlightRecord::State state);
+
+  // The name `comm` is dumped as, set once when it is created
+  void nameComm(const void* comm, std::string name);
+
+  // The records in the ring, oldest first. Queued records count as started
+  // once all earlier records of their communicators have completed, as the
+  // comm stream runs them in order.
+  std::vector<FlightRecord> dump() const;
+
+  // One line per record
+  std::string format() const;
+
+ private:
+  struct Slot {
+    // Zero while being written, the id of the record otherwise
+    std::atomic<uint64_t> id{0};
+    // id << 2 | state, so that late state changes skip reused slots
+    std::atomic<uint64_t> state{0};
+    std::atomic<int16_t> opType{0};
+    std::atomic<int8_t> dtype{0};
+    std::atomic<int64_t> numel{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> queuedUs{0};
+    std::atomic<const void*> comm{nullptr};
+  };
+
+  const size_t capacity_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> lastId_{0};
+
+  mutable std::mutex namesMutex_;
+  // Guarded by `namesMutex_`
+  std::unordered_map<const void*, std::string> commNames_;
+};
+
+// Initially DIPU_DICL_FLIGHT_RECORDER_SIZE, 1024 if unset, 0 disables it
+DIPU_API size_t flightRecorderSize();
+
+// Counts the dumps requested by the DIPU_DICL_FLIGHT_RECORDER_SIGNAL
+// handler, once installed. Watchdogs dump when it changes.
+uint64_t flightRecorderDumpRequests();
+
+}  // namespace dipu
@@ -0,0 +1,207 @@
+// Copyright (c) 2024, DeepLink.
+#include "DICLRegistry.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocator.h"
+#include "csrc_dipu/runtime/devproxy/diclproxy.h"
+#include "csrc_dipu/utils/Log.h"
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kRegisterBuffers =
+    get_env_or_default("DIPU_DICL_REGISTER_BUFFERS", 0) > 0 &&
+    devproxy::isDiclRegisterSupported();
+
+struct Region {
+  size_t size = 0;
+  // nullptr if not registered
+  void* handle = nullptr;
+};
+
+// By start address, regions never overlap
+using Regions = std::map<uintptr_t, Region>;
+
+// Removes [begin, end) from `regions`. Overlapping regions are passed to
+// `release`, and what is left of them on either side is added back with the
+// handle `acquire` returns for it.
+template <typename Release, typename Acquire>
+void cutRegions(Regions& regions, uintptr_t begin, uintptr_t end,
+                Release release, Acquire acquire) {
+  auto it = regions.upper_bound(begin);
+  if (it != regions.begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second.size > begin) {
+      it = prev;
+    }
+  }
+  std::vector<std::pair<uintptr_t, size_t>> leftovers;
+  while (it != regions.end() && it->first < end) {
+    const auto start = it->first;
+    const auto stop = start + it->second.size;
+    release(it->second);
+    if (start < begin) {
+      leftovers.emplace_back(start, begin - start);
+    }
+    if (stop > end) {
+      leftovers.emplace_back(end, stop - end);
+    }
+    it = regions.erase(it);
+  }
+  for (const auto& leftover : leftovers) {
+    regions[leftover.first] = {leftover.second,
+                               acquire(leftover.first, leftover.second)};
+  }
+}
+
+class BufferRegistry {
+ public:
+  // Never destroyed, communicators may outlive static destructors
+  static BufferRegistry& instance() {
+    static auto* registry = new BufferRegistry();
+    return *registry;
+  }
+
+  void onSegment(c10::DeviceIndex device, void* ptr, size_t size,
+                 bool mapped) {
+    const auto begin = reinterpret_cast<uintptr_t>(ptr);
+    std::lock_guard<std::mutex> _(mutex_);
+    auto& segments = segments_[device];
+    if (mapped) {
+      segments[begin] = {size, nullptr};
+      for (auto& entry : comms_) {
+        if (entry.second.device == device) {
+          auto* handle = registerRegion(entry.first, ptr, size);
+          entry.second.regions[begin] = {size, handle};
+        }
+      }
+      return;
+    }
+    const auto end = begin + size;
+    cutRegions(
+        segments, begin, end, [](Region&) {},
+        [](uintptr_t, size_t) -> void* { return nullptr; });
+    for (auto& entry : comms_) {
+      if (entry.second.device != device) {
+        continue;
+      }
+      auto* comm = entry.first;
+      cutRegions(
+          entry.second.regions, begin, end,
+          [comm](Region& region) { deregisterRegion(comm, region); },
+          [comm](uintptr_t start, size_t bytes) {
+            return registerRegion(comm, reinterpret_cast<void*>(start),
+                                  bytes);
+          });
+    }
+  }
+
+  void addComm(c10::DeviceIndex device, diclComm_t comm) {
+    std::lock_guard<std::mutex> _(mutex_);
+    auto& registered = comms_[comm];
+    registered.device = device;
+    for (const auto& segment : segments_[device]) {
+      registered.regions[segment.first] = {
+          segment.second.size,
+          registerRegion(comm, reinterpret_cast<void*>(segment.first),
+                         segment.second.size)};
+    }
+  }
+
+  void removeComm(diclComm_t comm, bool deregister) {
+    std::lock_guard<std::mutex> _(mutex_);
+    auto it = comms_.find(comm);
+    if (it == comms_.end()) {
+      return;
+    }
+    if (deregister) {
+      for (auto& region : it->second.regions) {
+        deregisterRegion(comm, region.second);
+      }
+    }
+    comms_.erase(it);
+  }
+
+ private:
+  // Failures only cost the fast path, they must not throw out of the
+  // allocator
+  static void* registerRegion(diclComm_t comm, void* ptr, size_t size) {
+    void* handle = nullptr;
+    try {
+      if (devproxy::diclCommRegister(comm, ptr, size, &handle) !=
+          devapis::DICL_SUCCESS) {
+        handle = nullptr;
+      }
+    } catch (const std::exception& e) {
+      DIPU_LOG_ERROR << "failed to register " << size << " bytes at " << ptr
+                     << " with a DICL communicator: " << e.what();
+      handle = nullptr;
+    }
+    return handle;
+  }
+
+  static void deregisterRegion(diclComm_t comm, Region& region) {
+    if (region.handle == nullptr) {
+      return;
+    }
+    try {
+      devproxy::diclCommDeregister(comm, region.handle);
+    } catch (const std::exception& e) {
+      DIPU_LOG_ERROR << "failed to deregister a buffer from a DICL "
+                     << "communicator: " << e.what();
+    }
+    region.handle = nullptr;
+  }
+
+  struct Comm {
+    c10::DeviceIndex device = 0;
+    Regions regions;
+  };
+
+  std::mutex mutex_;
+  // Guarded by `mutex_`. All memory of the device allocators, tracked from
+  // library load on so that new communicators can register it.
+  std::unordered_map<c10::DeviceIndex, Regions> segments_;
+  // Guarded by `mutex_`
+  std::unordered_map<diclComm_t, Comm> comms_;
+};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kSegmentHookAdded = [] {
+  if (kRegisterBuffers) {
+    addSegmentHook([](c10::DeviceIndex device, void* ptr, size_t size,
+                      bool mapped) {
+      BufferRegistry::instance().onSegment(device, ptr, size, mapped);
+    });
+  }
+  return kRegisterBuffers;
+}();
+
+}  // namespace
+
+bool diclBufferRegistrationEnabled() { return kSegmentHookAdded; }
+
+void addRegisteredComm(c10::DeviceIndex device, diclComm_t comm) {
+  if (kSegmentHookAdded && comm != nullptr) {
+    BufferRegistry::instance().addComm(device, comm);
+  }
+}
+
+void removeRegisteredComm(diclComm_t comm, bool deregister) {
+  if (kSegmentHookAdded && comm != nullptr) {
+    BufferRegistry::instance().removeComm(comm, deregister);
+  }
+}
+
+}  // namespace dipu
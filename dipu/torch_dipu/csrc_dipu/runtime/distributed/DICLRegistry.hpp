@@ -0,0 +1,25 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <c10/core/Device.h>
+
+#include "csrc_dipu/base/basedef.h"
+#include "csrc_dipu/runtime/device/diclapis.h"
+
+namespace dipu {
+
+// DIPU_DICL_REGISTER_BUFFERS registers all memory of the device allocators
+// with the communicators of its device, so that the vendor can reach tensors
+// directly instead of staging them. Only has an effect if the vendor
+// implements diclCommRegister.
+DIPU_API bool diclBufferRegistrationEnabled();
+
+// Registers the memory `device` already holds with `comm`, and the memory it
+// gets later until removeRegisteredComm. No-op if registration is disabled.
+DIPU_API void addRegisteredComm(c10::DeviceIndex device, diclComm_t comm);
+
+// Must be called before `comm` is destroyed. With `deregister` false, e.g.
+// for an aborted `comm`, its handles are just dropped.
+DIPU_API void removeRegisteredComm(diclComm_t comm, bool deregister = true);
+
+}  // namespace dipu
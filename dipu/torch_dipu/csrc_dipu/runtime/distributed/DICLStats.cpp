@@ -0,0 +1,103 @@
+// Copyright (c) 2024, DeepLink.
+#include "DICLStats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+
+#include "csrc_dipu/utils/env.hpp"
+
+namespace dipu {
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<bool> collective_stats_enabled{
+    get_env_or_default("DIPU_DICL_STATS", 0) > 0};
+
+}  // namespace
+
+double collectiveBusFactor(c10d::OpType opType, int worldSize) {
+  const auto n = static_cast<double>(worldSize);
+  switch (opType) {
+    case c10d::OpType::ALLREDUCE:
+    case c10d::OpType::ALLREDUCE_COALESCED:
+      return 2 * (n - 1) / n;
+    case c10d::OpType::ALLGATHER:
+    case c10d::OpType::_ALLGATHER_BASE:
+    case c10d::OpType::ALLGATHER_COALESCED:
+    case c10d::OpType::REDUCE_SCATTER:
+    case c10d::OpType::_REDUCE_SCATTER_BASE:
+    case c10d::OpType::ALLTOALL:
+    case c10d::OpType::ALLTOALL_BASE:
+      return (n - 1) / n;
+    default:
+      return 1;
+  }
+}
+
+bool collectiveStatsEnabled() {
+  return collective_stats_enabled.load(std::memory_order_relaxed);
+}
+
+void setCollectiveStatsEnabled(bool enabled) {
+  collective_stats_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void CollectiveStatsTable::add(c10d::OpType opType, int worldSize,
+                               uint64_t bytes, double deviceMs,
+                               double queueMs) {
+  std::lock_guard<std::mutex> _(mutex_);
+  auto& stats = stats_[opType];
+  if (stats.calls == 0) {
+    stats.op = c10d::opTypeToString(opType);
+    stats.busFactor = collectiveBusFactor(opType, worldSize);
+  }
+  ++stats.calls;
+  stats.bytes += bytes;
+  stats.deviceMs += deviceMs;
+  stats.maxDeviceMs = std::max(stats.maxDeviceMs, deviceMs);
+  if (queueMs >= 0) {
+    ++stats.queuedCalls;
+    stats.queueMs += queueMs;
+    stats.maxQueueMs = std::max(stats.maxQueueMs, queueMs);
+  }
+}
+
+std::vector<CollectiveStats> CollectiveStatsTable::get() const {
+  std::lock_guard<std::mutex> _(mutex_);
+  std::vector<CollectiveStats> result;
+  result.reserve(stats_.size());
+  for (const auto& entry : stats_) {
+    result.push_back(entry.second);
+  }
+  return result;
+}
+
+void CollectiveStatsTable::reset() {
+  std::lock_guard<std::mutex> _(mutex_);
+  stats_.clear();
+}
+
+std::string CollectiveStatsTable::summary() const {
+  std::ostringstream stream;
+  stream << std::fixed << std::setprecision(3);
+  for (const auto& stats : get()) {
+    const auto calls = static_cast<double>(stats.calls);
+    stream << stats.op << ": " << stats.calls << " calls, "
+           << static_cast<double>(stats.bytes) / calls << " B avg, "
+           << stats.deviceMs / calls << " ms avg, " << stats.maxDeviceMs
+           << " ms max, algbw " << stats.algbw() << " GB/s, busbw "
+           << stats.busbw() << " GB/s";
+    if (stats.queuedCalls > 0) {
+      stream << ", queued "
+             << stats.queueMs / static_cast<double>(stats.queuedCalls)
+             << " ms avg";
+    }
+    stream << "\n";
+  }
+  return stream.str();
+}
+
+}  // namespace dipu
@@ -0,0 +1,67 @@
+// Copyright (c) 2024, DeepLink.
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <torch/csrc/distributed/c10d/Work.hpp>
+
+#include "csrc_dipu/base/basedef.h"
+
+namespace dipu {
+
+// Totals of the collectives of one op type of a process group, timed by
+// events on the comm stream around the vendor calls
+struct CollectiveStats {
+  std::string op;
+  uint64_t calls = 0;
+  // The larger of input and output, as nccl-tests counts them
+  uint64_t bytes = 0;
+  double deviceMs = 0;
+  double maxDeviceMs = 0;
+  // From queueing the op to the comm stream reaching it, only measured if
+  // the vendor can launch host callbacks
+  uint64_t queuedCalls = 0;
+  double queueMs = 0;
+  double maxQueueMs = 0;
+  // busbw / algbw of the op, as nccl-tests defines it
+  double busFactor = 1;
+
+  // GB/s, 0 if nothing has been timed
+  double algbw() const {
+    return deviceMs > 0 ? static_cast<double>(bytes) / deviceMs / 1e6 : 0;
+  }
+  double busbw() const { return algbw() * busFactor; }
+};
+
+// busbw / algbw of `opType` on `worldSize` ranks, as nccl-tests defines it
+DIPU_API double collectiveBusFactor(c10d::OpType opType, int worldSize);
+
+// Initially DIPU_DICL_STATS, can be toggled at any time. Only ops queued
+// while it is on are timed.
+DIPU_API bool collectiveStatsEnabled();
+DIPU_API void setCollectiveStatsEnabled(bool enabled);
+
+class CollectiveStatsTable {
+ public:
+  // `queueMs` is negative if unknown
+  void add(c10d::OpType opType, int worldSize, uint64_t bytes,
+           double deviceMs, double queueMs);
+
+  std::vector<CollectiveStats> get() const;
+
+  void reset();
+
+  // One line per op type, empty if nothing has been timed
+  std::string summary() const;
+
+ private:
+  mutable std::mutex mutex_;
+  // Guarded by `mutex_`
+  std::map<c10d::OpType, CollectiveStats> stats_;
+};
+
+}  // namespace dipu
@@ -2,14 +2,24 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <utility>
 
+#include <ATen/core/Tensor.h>
 #include <c10/core/Device.h>
+#include <c10/core/ScalarType.h>
+#include <c10/core/StorageImpl.h>
+#include <c10/util/intrusive_ptr.h>
 
 #include "csrc_dipu/runtime/core/DIPUEvent.h"
 #include "csrc_dipu/runtime/core/DIPUStream.h"
 #include "csrc_dipu/runtime/devproxy/deviceproxy.h"
 #include "csrc_dipu/runtime/devproxy/diclproxy.h"
 
+#include "DICLRegistry.hpp"
+
 namespace dipu {
 
 // wrapper of vendor raw communicator
@@ -28,6 +38,7 @@ class DICLComm {
     // Add lock in this destructor, as aborted_ needs to be read after memory
     // barrier here.
     std::unique_lock<std::mutex> lock(mutex_);
+    removeRegisteredComm(rawComm_, !aborted_);
     if (rawComm_ && !aborted_) {
       devproxy::diclCommDestroy(rawComm_);
       rawComm_ = nullptr;
@@ -38,6 +49,22 @@ class DICLComm {
                                           DIPUStream& stream) {
     auto comm = std::make_shared<DICLComm>(stream);
     comm->initRawComm(numRanks, rank, uniqueid);
+    addRegisteredComm(comm->device_.index(), comm->rawComm_);
+    return comm;
+  }
+
+  // The communicator of the ranks of `parent` passing the same non-negative
+  // `color`, see devapis::diclCommSplit. Null for a negative color.
+  static std::shared_ptr<DICLComm> split(const DICLComm& parent, int color,
+                                         int key, DIPUStream& stream) {
+    diclComm_t rawComm = nullptr;
+    devproxy::diclCommSplit(parent.rawComm(), color, key, &rawComm);
+    if (rawComm == nullptr) {
+      return nullptr;
+    }
+    auto comm = std::make_shared<DICLComm>(stream);
+    comm->rawComm_ = rawComm;
+    addRegisteredComm(comm->device_.index(), comm->rawComm_);
     return comm;
   }
 
@@ -52,6 +79,45 @@ class DICLComm {
 
   diclComm_t rawComm() const { return rawComm_; }
 
+  // Returns false if the vendor can't abort, the communicator must not be
+  // used afterwards either way
+  bool abort() {
+    bool aborted = true;
+    for (auto* sub : {&intraNodeComm_, &interNodeComm_}) {
+      if (*sub) {
+        aborted = (*sub)->abort() && aborted;
+      }
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (rawComm_ && !aborted_) {
+      aborted_ = devproxy::diclCommAbort(rawComm_);
+      if (aborted_) {
+        // the vendor may reuse the address for a new communicator
+        removeRegisteredComm(rawComm_, false);
+      }
+    }
+    return aborted_ && aborted;
+  }
+
+  bool aborted() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return aborted_;
+  }
+
+  // Whether the vendor reports an asynchronous error on the communicator or
+  // its sub-communicators, e.g. a lost peer. Their pending calls may then
+  // never finish.
+  bool hasAsyncError() const {
+    for (const auto* sub : {&intraNodeComm_, &interNodeComm_}) {
+      if (*sub && (*sub)->hasAsyncError()) {
+        return true;
+      }
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    return rawComm_ && !aborted_ &&
+           devproxy::diclGetCommAsyncError(rawComm_) != devapis::DICL_SUCCESS;
+  }
+
   void preSyncStream() {
     auto currStream = dipu::getCurrentDIPUStream(device_.index());
     preEvent_.record(currStream);
@@ -61,15 +127,35 @@ class DICLComm {
   // The DIPU queues used by DICL kernels
   DIPUStream diclStream_;
   // The DIPU events used to sync current stream
-  DIPUEvent preEvent_;
+  DIPUEvent preEvent_{devapis::EventFlags::DISABLE_TIMING};
 
   // by default, copy should work in comm stream, if in other stream, use
   // preCopyEvent_ to guarantee comm finish.
-  DIPUEvent preCopyEvent_;
+  DIPUEvent preCopyEvent_{devapis::EventFlags::DISABLE_TIMING};
 
   // The cached list of DIPU devices to operate on
   at::Device device_;
 
+  // The ranks of this node and the ranks of the same local rank on all nodes,
+  // created on demand by hierarchical allreduce. They use diclStream_ too.
+  std::shared_ptr<DICLComm> intraNodeComm_;
+  std::shared_ptr<DICLComm> interNodeComm_;
+
+  // Flat buffers reused by the tensor list allgather and reduce_scatter, one
+  // per dtype, if DIPU_DICL_FUSION_BUFFER_MB is set. They are only touched on
+  // diclStream_, so reuse needs no sync, and kept as long as the communicator.
+  std::unordered_map<c10::ScalarType, at::Tensor> fusionBuffers_;
+
+  // What compressed allreduce lost of each tensor last time, in float, keyed
+  // by its storage and offset. The weak reference tells a storage apart from
+  // a later one at the same address. Also only touched on diclStream_.
+  struct CompressionResidual {
+    c10::weak_intrusive_ptr<c10::StorageImpl> storage;
+    at::Tensor residual;
+  };
+  std::map<std::pair<const c10::StorageImpl*, int64_t>, CompressionResidual>
+      compressionResiduals_;
+
  protected:
   bool aborted_ = false;
   diclComm_t rawComm_ = nullptr;
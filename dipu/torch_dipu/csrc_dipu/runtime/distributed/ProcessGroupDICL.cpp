@@ -1,22 +1,127 @@
 // Copyright (c) 2023, DeepLink.
 #include "ProcessGroupDICL.h"
 
+#include <algorithm>
+#include <exception>
+#include <numeric>
+#include <sstream>
+#include <string>
 #include <utility>
 
+#include <ATen/MemoryOverlap.h>
 #include <ATen/record_function.h>
+#include <c10/util/hash.h>
+#include <torch/csrc/distributed/c10d/Utils.hpp>
 #include <torch/torch.h>
 
 #include "csrc_dipu/profiler/profiler.h"
+#include "csrc_dipu/runtime/core/DIPUAffinity.h"
 #include "csrc_dipu/runtime/core/DIPUGuard.h"
 #include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocator.h"
+#include "csrc_dipu/utils/Log.h"
+#include "csrc_dipu/utils/env.hpp"
 #include "csrc_dipu/utils/helpfunc.hpp"
 
+#include "DICLCompression.hpp"
+
 namespace dipu {
 
 using std::pair;
 
 namespace {
 
+// Run communication on high priority streams, so that it is not queued behind
+// long compute kernels
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kHighPriorityCommStream =
+    get_env_or_default("DIPU_DICL_HIGH_PRIORITY_STREAM", 0) > 0;
+
+// Collectives of a process group are spread over this many communicators
+// and streams per device, so that independent ones can run concurrently.
+// Ops on different streams are not ordered, so consecutive collectives on the
+// same tensors then need a wait() in between.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const int kCommStreams =
+    std::max(get_env_or_default("DIPU_DICL_COMM_STREAMS", 1), 1);
+
+// "optype" gives each op type its own stream (modulo DIPU_DICL_COMM_STREAMS),
+// "roundrobin" cycles through the streams op by op
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kCommStreamRoundRobin =
+    get_env_or_default("DIPU_DICL_COMM_STREAM_POLICY", std::string("optype")) ==
+    "roundrobin";
+
+// Largest fusion buffer kept by a communicator for each dtype, bigger tensor
+// lists get a new flat tensor per call. Off (0) by default: each
+// communicator then holds up to this much device memory per dtype until it
+// is destroyed with its process group.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kFusionBufferMaxBytes = [] {
+  auto mb = get_env_or_default("DIPU_DICL_FUSION_BUFFER_MB", int64_t{0});
+  TORCH_CHECK(mb >= 0, "DIPU_DICL_FUSION_BUFFER_MB must not be negative");
+  return static_cast<size_t>(mb) << 20U;
+}();
+
+// Allreduce tensors of at least DIPU_DICL_HIERARCHICAL_ALLREDUCE_MIN_BYTES in
+// three steps: reduce_scatter inside the node, allreduce of the 1/L chunk
+// across nodes and allgather inside the node. The node size L is
+// LOCAL_WORLD_SIZE as set by torchrun, node n holds ranks [n * L, n * L + L).
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const bool kHierarchicalAllreduce =
+    get_env_or_default("DIPU_DICL_HIERARCHICAL_ALLREDUCE", 0) > 0;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const size_t kHierarchicalAllreduceMinBytes = get_env_or_default(
+    "DIPU_DICL_HIERARCHICAL_ALLREDUCE_MIN_BYTES", size_t{1} << 20U);
+
+// Set by allreduceOwned, whose tensors outlive their works, so the allocator
+// needn't track their use on the comm stream
+thread_local bool skip_record_stream = false;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const int kLocalWorldSize = get_env_or_default("LOCAL_WORLD_SIZE", 0);
+
+// How often the watchdog looks for timed out works. Finished works are
+// noticed at once through host callbacks if the vendor supports them, and
+// every kWatchdogPollMillis otherwise while blocking waits may be sleeping.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const std::chrono::milliseconds kWatchdogIntervalMillis{
+    get_env_or_default("DIPU_DICL_WATCHDOG_INTERVAL_MS", int64_t{100})};
+constexpr std::chrono::milliseconds kWatchdogPollMillis{1};
+
+// How often the watchdog logs the collective stats, 0 never
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const std::chrono::seconds kStatsLogInterval{
+    get_env_or_default("DIPU_DICL_STATS_LOG_INTERVAL", int64_t{0})};
+
+// Every this many collectives the ranks compare a hash of the op types,
+// shapes and dtypes of their collectives since the last check through the
+// store, so that mismatched calls fail before the op timeout. Shapes are left
+// out for ops in which they differ per rank, see shapesMatchAcrossRanks. 0
+// disables it.
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const int64_t kDesyncCheckInterval =
+    get_env_or_default("DIPU_DICL_DESYNC_CHECK_INTERVAL", int64_t{0});
+
+// Hashes are summed in the store, small enough that its counters of 512 or
+// more ranks don't overflow
+constexpr size_t kDesyncHashMask = 0x7fffffff;
+
+// Whether the inputs of a collective have the same shapes on all ranks. Those
+// of all-to-alls with splits, and of the tensor lists of allgather and
+// reduce_scatter, which allgatherV and reduceScatterV also use, may differ.
+bool shapesMatchAcrossRanks(OpType opType) {
+  switch (opType) {
+    case OpType::ALLTOALL_BASE:
+    case OpType::ALLTOALL:
+    case OpType::ALLGATHER:
+    case OpType::REDUCE_SCATTER:
+      return false;
+    default:
+      return true;
+  }
+}
+
 // Get the list of devices from list of tensors, collective comm always use all
 // ranks, so no rank prefix required in key.
 std::string getDeviceIds(const std::vector<at::Device>& devices) {
@@ -31,6 +136,16 @@ std::string getDeviceIds(const std::vector<at::Device>& devices) {
   return deviceList;
 }
 
+// The key of the collective communicators on `devices` using the comm stream
+// `stream`, see DIPU_DICL_COMM_STREAMS
+std::string commsKey(const std::vector<at::Device>& devices, int stream) {
+  auto key = getDeviceIds(devices);
+  if (kCommStreams > 1) {
+    key += "#" + std::to_string(stream);
+  }
+  return key;
+}
+
 pair<int, int> mapPGRank2P2P(int myRank, int peer) {
   // ProcessGroupNCCL support send/recv self, but that seems only work with
   // ncclGroup?
@@ -64,36 +179,111 @@ std::vector<at::Device> getDeviceList(const std::vector<at::Tensor>& tensors) {
   return res;
 }
 
+devapis::diclResult_t hierarchicalAllReduce(const at::Tensor& input,
+                                            at::Tensor& output,
+                                            const c10d::ReduceOp& op,
+                                            DICLComm& comm,
+                                            DIPUStream& stream) {
+  const auto chunkNumel = input.numel() / kLocalWorldSize;
+  // freed once queued, the allocator reuses it after the comm stream
+  DIPUStreamGuard guard(stream.unwrap());
+  auto chunk = at::empty({chunkNumel}, input.options());
+  const auto count = static_cast<size_t>(chunkNumel);
+  const auto dtype = input.scalar_type();
+  auto result = devproxy::diclReduceScatter(
+      input.data_ptr(), chunk.data_ptr(), count, dtype, op,
+      comm.intraNodeComm_->rawComm(), stream.rawstream());
+  if (result != devapis::DICL_SUCCESS) {
+    return result;
+  }
+  result = devproxy::diclAllReduce(chunk.data_ptr(), chunk.data_ptr(), count,
+                                   dtype, op, comm.interNodeComm_->rawComm(),
+                                   stream.rawstream());
+  if (result != devapis::DICL_SUCCESS) {
+    return result;
+  }
+  return devproxy::diclAllGather(chunk.data_ptr(), output.data_ptr(), count,
+                                 dtype, comm.intraNodeComm_->rawComm(),
+                                 stream.rawstream());
+}
+
 void syncStreams(std::vector<std::shared_ptr<DICLComm>>& comms) {
   for (auto& comm : comms) {
     comm->preSyncStream();
   }
 }
 
+// The most pieces up to `chunks` that `rows` splits into evenly
+int64_t overlapChunks(int64_t rows, int64_t chunks) {
+  chunks = std::max(std::min(chunks, rows), int64_t{1});
+  while (rows % chunks != 0) {
+    --chunks;
+  }
+  return chunks;
+}
+
 }  // anonymous namespace
 
 // start WorkDICL
 
-// currently DICL do not support error check
+// failed works count as completed, their calls may never finish
 bool ProcessGroupDICL::WorkDICL::isCompleted() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (exception_) {
+      return true;
+    }
+  }
   return finishedDICLExecutionInternal();
 }
 
-// currently DICL do not support error check
 bool ProcessGroupDICL::WorkDICL::isSuccess() const {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (exception_) {
+      return false;
+    }
+  }
   return finishedDICLExecutionInternal();
 }
 
 bool ProcessGroupDICL::WorkDICL::finishedDICLExecutionInternal() const {
+  if (notifierWatching_) {
+    return notifier_.completed();
+  }
   return std::all_of(workEvents_.begin(), workEvents_.end(),
                      [](const DIPUEvent& e) { return e.query(); });
 }
 
+bool ProcessGroupDICL::WorkDICL::timedOut() const {
+  return std::chrono::steady_clock::now() - workStartTime_ > opTimeout_;
+}
+
+bool ProcessGroupDICL::WorkDICL::waitFinished(
+    std::chrono::milliseconds timeout) {
+  if (notifierWatching_) {
+    return notifier_.waitFor(timeout);
+  }
+  if (!watched_) {
+    // not recorded, e.g. an op inside a coalesced group
+    return finishedDICLExecutionInternal();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  return cv_.wait_for(lock, timeout, [this] { return completed_; });
+}
+
 // record post work event on communicator stream
 void ProcessGroupDICL::WorkDICL::record() {
   for (auto i = 0; i < workEvents_.size(); i++) {
     workEvents_[i].record(diclComms_[i]->diclStream_);
   }
+  if (blockingWait_) {
+    notifierWatching_ = std::all_of(
+        diclComms_.begin(), diclComms_.end(),
+        [this](const std::shared_ptr<DICLComm>& comm) {
+          return notifier_.watch(comm->diclStream_);
+        });
+  }
 }
 
 void ProcessGroupDICL::WorkDICL::synchronize() {
@@ -106,15 +296,18 @@ void ProcessGroupDICL::WorkDICL::synchronize() {
 
   // In case of blocking, wait for the operation to complete.
   if (blockingWait_) {
-    // Wait for the operation to complete.
-    while (!isCompleted()) {
-      auto currentTimepoint = std::chrono::steady_clock::now();
-      if (std::chrono::duration_cast<std::chrono::milliseconds>(
-              currentTimepoint - workStartTime_) > opTimeout_) {
-        throw std::runtime_error("Operation timed out!");
-      }
-      std::this_thread::sleep_for(
-          std::chrono::milliseconds(diclSyncBusyWaitMillis));
+    // Woken up by host callbacks or the watchdog, nothing is polled here
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - workStartTime_);
+    if (!waitFinished(opTimeout_ - std::min(elapsed, opTimeout_))) {
+      throw std::runtime_error("Operation timed out!");
+    }
+  }
+  // set by the watchdog
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (exception_) {
+      std::rethrow_exception(exception_);
     }
   }
 
@@ -129,6 +322,20 @@ void ProcessGroupDICL::WorkDICL::synchronize() {
   }
 }
 
+// Marked completed right after the DICL calls are queued, as CUDAFuture, the
+// future records events on the comm streams. Its waits and callbacks then
+// only make the current streams of the caller wait for them, so comm hooks
+// overlap with the computation.
+void ProcessGroupDICL::WorkDICL::markFutureCompleted() {
+  // todo:: dipu need support multistream guard & remove
+  // work->workEvents_(future already has events ).
+  c10::optional<DIPUStreamGuard> guard;
+  if (!diclComms_.empty()) {
+    guard.emplace(diclComms_[0]->diclStream_.unwrap());
+  }
+  future_->markCompleted(at::IValue(*outputs_));
+}
+
 // Same as calling synchronize().
 // NOLINTNEXTLINE(google-default-arguments)
 bool ProcessGroupDICL::WorkDICL::wait(std::chrono::milliseconds timeout) {
@@ -148,8 +355,9 @@ ProcessGroupDICL::WorkDICL::getFuture() {
 // end WorkDICL
 
 ProcessGroupDICL::ProcessGroupDICL(const c10::intrusive_ptr<Store>& store,
-                                   int rank, int size)
-    : c10d::Backend(rank, size), store_(store) {
+                                   int rank, int size,
+                                   std::chrono::milliseconds timeout)
+    : c10d::Backend(rank, size), store_(store), opTimeout_(timeout) {
   char* blockingWait = getenv(DICL_BLOCKING_WAIT);
   try {
     if (blockingWait != nullptr) {
@@ -166,9 +374,264 @@ ProcessGroupDICL::ProcessGroupDICL(const c10::intrusive_ptr<Store>& store,
     throw std::runtime_error("Invalid value for environment variable: " +
                              std::string(DICL_BLOCKING_WAIT));
   }
+  asyncErrorHandling_ = get_env_or_default(DICL_ASYNC_ERROR_HANDLING, 1) != 0;
+  lastStatsLog_ = std::chrono::steady_clock::now();
+  // the watchdog queries the events of the current device mostly
+  watchdogThread_ = std::thread([this, device = devproxy::current_device()] {
+    bindCurrentThreadToDevice(device);
+    watchdogLoop();
+  });
+}
+
+ProcessGroupDICL::~ProcessGroupDICL() {
+  {
+    std::lock_guard<std::mutex> lock(watchdogMutex_);
+    watchdogStop_ = true;
+  }
+  watchdogCV_.notify_one();
+  watchdogThread_.join();
 }
 
-ProcessGroupDICL::~ProcessGroupDICL() = default;
+void ProcessGroupDICL::watch(const c10::intrusive_ptr<WorkDICL>& work) {
+  work->watched_ = true;
+  {
+    std::lock_guard<std::mutex> lock(watchdogMutex_);
+    watchedWorks_.push_back(work);
+  }
+  watchdogCV_.notify_one();
+}
+
+void ProcessGroupDICL::watchdogLoop() {
+  std::unique_lock<std::mutex> lock(watchdogMutex_);
+  // the fast polls of blocking waits don't query the vendor for errors
+  auto lastErrorCheck = std::chrono::steady_clock::now();
+  while (!watchdogStop_) {
+    // blocking waits sleep until the watchdog finishes their works if they
+    // can't be woken up by host callbacks
+    const bool polled = std::any_of(
+        watchedWorks_.begin(), watchedWorks_.end(),
+        [](const c10::intrusive_ptr<WorkDICL>& work) {
+          return work->blockingWait_ && !work->notifierWatching_;
+        });
+    watchdogCV_.wait_for(lock,
+                         polled ? kWatchdogPollMillis : kWatchdogIntervalMillis,
+                         [this] { return watchdogStop_; });
+    const auto checkTime = std::chrono::steady_clock::now();
+    const bool checkErrors =
+        checkTime - lastErrorCheck >= kWatchdogIntervalMillis;
+    if (checkErrors) {
+      lastErrorCheck = checkTime;
+    }
+    std::unordered_map<const DICLComm*, std::string> checked;
+    for (auto it = watchedWorks_.begin(); it != watchedWorks_.end();) {
+      auto& work = *it;
+      try {
+        OptionalDIPUGuard dipuGuard;
+        if (!work->diclComms_.empty()) {
+          dipuGuard.reset_device(work->diclComms_.front()->device_);
+        }
+        if (work->finishedDICLExecutionInternal()) {
+          if (work->timing_) {
+            recordStats(*work);
+          }
+          flightRecorder_.setState(work->flightRecordId_,
+                                   FlightRecord::State::COMPLETED);
+          work->finish();
+        } else if (work->timedOut()) {
+          handleTimeout(*work);
+        } else if (auto failure = checkErrors ? commFailure(*work, checked)
+                                              : std::string();
+                   !failure.empty()) {
+          handleFailure(*work, failure);
+        } else {
+          ++it;
+          continue;
+        }
+      } catch (const std::exception&) {
+        // e.g. a device error reported by the event query
+        flightRecorder_.setState(work->flightRecordId_,
+                                 FlightRecord::State::FAILED);
+        work->finish(std::current_exception());
+      }
+      it = watchedWorks_.erase(it);
+    }
+    if (kDesyncCheckInterval > 0 && checkErrors) {
+      // the store is remote, watch() must not wait for it
+      lock.unlock();
+      try {
+        checkDesync();
+      } catch (const std::exception& e) {
+        DIPU_LOG_ERROR << "DICL desync check failed: " << e.what()
+                       << std::endl;
+      }
+      lock.lock();
+    }
+    const auto dumps = flightRecorderDumpRequests();
+    if (dumps != flightRecorderDumps_) {
+      flightRecorderDumps_ = dumps;
+      dumpFlightRecorder("on signal");
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (kStatsLogInterval.count() > 0 &&
+        now - lastStatsLog_ >= kStatsLogInterval) {
+      lastStatsLog_ = now;
+      const auto summary = collectiveStats_.summary();
+      if (!summary.empty()) {
+        DIPU_LOG << "DICL collective stats of rank " << rank_ << ":\n"
+                 << summary;
+      }
+    }
+  }
+}
+
+void ProcessGroupDICL::handleTimeout(WorkDICL& work) {
+  handleFailure(work,
+                "timed out after " + std::to_string(work.opTimeout_.count()) +
+                    "ms");
+}
+
+std::string ProcessGroupDICL::commFailure(
+    const WorkDICL& work,
+    std::unordered_map<const DICLComm*, std::string>& checked) {
+  for (const auto& comm : work.diclComms_) {
+    auto found = checked.find(comm.get());
+    if (found == checked.end()) {
+      std::string failure;
+      if (comm->aborted()) {
+        failure = "can't finish, its communicator was aborted";
+      } else if (comm->hasAsyncError()) {
+        failure = "failed, its communicator reported an asynchronous error";
+      }
+      found = checked.emplace(comm.get(), std::move(failure)).first;
+    }
+    if (!found->second.empty()) {
+      return found->second;
+    }
+  }
+  return {};
+}
+
+void ProcessGroupDICL::handleFailure(WorkDICL& work,
+                                     const std::string& reason) {
+  std::ostringstream message;
+  message << "DICL work of process group rank " << rank_ << " " << reason;
+  if (asyncErrorHandling_) {
+    bool aborted = !work.diclComms_.empty();
+    for (auto& comm : work.diclComms_) {
+      aborted = comm->abort() && aborted;
+    }
+    message << (aborted ? ", its communicators are aborted"
+                        : ", the vendor can't abort its communicators");
+  }
+  DIPU_LOG_ERROR << message.str() << std::endl;
+  flightRecorder_.setState(work.flightRecordId_, FlightRecord::State::FAILED);
+  dumpFlightRecorder("after the failure");
+  work.finish(std::make_exception_ptr(std::runtime_error(message.str())));
+  if (asyncErrorHandling_ && !work.blockingWait_) {
+    // the failure would go unnoticed and the job hang on
+    DIPU_LOG_ERROR << "tearing down the process" << std::endl;
+    std::abort();
+  }
+}
+
+void ProcessGroupDICL::recordStats(WorkDICL& work) {
+  auto& timing = *work.timing_;
+  const double deviceMs = timing.start.elapsed_time(timing.end);
+  const auto startedNs = timing.startedNs->load();
+  double queueMs = -1;
+  if (startedNs > 0) {
+    const auto queuedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              timing.queued.time_since_epoch())
+                              .count();
+    queueMs = static_cast<double>(startedNs - queuedNs) / 1e6;
+  }
+  collectiveStats_.add(timing.opType, size_, timing.bytes, deviceMs, queueMs);
+}
+
+void ProcessGroupDICL::trackDesync(const std::vector<at::Tensor>& inputs,
+                                   OpType opType) {
+  uint64_t check = 0;
+  size_t hash = 0;
+  {
+    std::lock_guard<std::mutex> lock(desyncMutex_);
+    TORCH_CHECK(desyncError_.empty(), desyncError_);
+    hash = c10::hash_combine(desyncHash_, static_cast<size_t>(opType));
+    hash = c10::hash_combine(hash, static_cast<size_t>(desyncOps_));
+    const bool sameShapes = shapesMatchAcrossRanks(opType);
+    for (const auto& input : inputs) {
+      hash = c10::hash_combine(hash, static_cast<size_t>(input.scalar_type()));
+      if (!sameShapes) {
+        continue;
+      }
+      for (auto size : input.sizes()) {
+        hash = c10::hash_combine(hash, static_cast<size_t>(size));
+      }
+    }
+    desyncHash_ = hash;
+    if (++desyncOps_ % kDesyncCheckInterval != 0) {
+      return;
+    }
+    check = desyncOps_ / kDesyncCheckInterval;
+    hash &= kDesyncHashMask;
+    desyncHash_ = 0;
+  }
+  const auto key = "dicl_desync/" + std::to_string(check);
+  store_->add(key + "/sum", static_cast<int64_t>(hash));
+  store_->add(key + "/count", 1);
+  std::lock_guard<std::mutex> lock(desyncMutex_);
+  pendingDesyncChecks_.emplace_back(check, static_cast<int64_t>(hash));
+}
+
+void ProcessGroupDICL::checkDesync() {
+  while (true) {
+    std::pair<uint64_t, int64_t> pending;
+    {
+      std::lock_guard<std::mutex> lock(desyncMutex_);
+      if (pendingDesyncChecks_.empty()) {
+        return;
+      }
+      pending = pendingDesyncChecks_.front();
+    }
+    const auto key = "dicl_desync/" + std::to_string(pending.first);
+    // adding 0 reads the counters, ranks behind are waited for next time
+    if (store_->add(key + "/count", 0) < size_) {
+      return;
+    }
+    const auto sum = store_->add(key + "/sum", 0);
+    {
+      std::lock_guard<std::mutex> lock(desyncMutex_);
+      pendingDesyncChecks_.pop_front();
+    }
+    // the last rank to compare removes the counters
+    if (store_->add(key + "/done", 1) == size_) {
+      for (const auto* counter : {"/sum", "/count", "/done"}) {
+        store_->deleteKey(key + counter);
+      }
+    }
+    if (sum == pending.second * size_) {
+      continue;
+    }
+    std::ostringstream message;
+    message << "DICL collectives " << (pending.first - 1) * kDesyncCheckInterval
+            << " to " << pending.first * kDesyncCheckInterval - 1
+            << " of process group rank " << rank_
+            << " differ from those of other ranks in op type, shape or "
+               "dtype, the ranks no longer call the same collectives";
+    DIPU_LOG_ERROR << message.str() << std::endl;
+    dumpFlightRecorder("after the desync");
+    std::lock_guard<std::mutex> lock(desyncMutex_);
+    desyncError_ = message.str();
+    return;
+  }
+}
+
+void ProcessGroupDICL::dumpFlightRecorder(const std::string& why) const {
+  if (flightRecorder_.enabled()) {
+    DIPU_LOG_ERROR << "DICL flight recorder of process group rank " << rank_
+                   << " " << why << ":\n"
+                   << flightRecorder_.format();
+  }
+}
 
 void ProcessGroupDICL::broadcastUniqueID(commUniqueId* uniqueId,
                                          const std::string& storeKey,
@@ -220,11 +683,12 @@ std::vector<std::shared_ptr<DICLComm>>& ProcessGroupDICL::getDICLComms(
     }
   }
   // not cached, create a new entry
-  std::vector<std::shared_ptr<DICLComm>> diclComms;
-  int devSize = static_cast<int>(devices.size());
-  diclComms.resize(devSize);
-  int deviceWorldSize = isP2POp(opType, false) ? 2 : getSize() * devSize;
+  return createDICLComms(localCommsKey, devices, commsRank, opType,
+                         exchangeUniqueID(localCommsKey, commsRank, opType));
+}
 
+commUniqueId ProcessGroupDICL::exchangeUniqueID(
+    const std::string& localCommsKey, int commsRank, OpType opType) {
   commUniqueId diclID;
   if (commsRank == 0) {
     devproxy::diclGetUniqueId(&diclID);
@@ -233,6 +697,16 @@ std::vector<std::shared_ptr<DICLComm>>& ProcessGroupDICL::getDICLComms(
                              ? localCommsKey
                              : std::to_string(diclCommCounter_++);
   broadcastUniqueID(&diclID, bcastKey, commsRank);
+  return diclID;
+}
+
+std::vector<std::shared_ptr<DICLComm>>& ProcessGroupDICL::createDICLComms(
+    const std::string& localCommsKey, const std::vector<at::Device>& devices,
+    int commsRank, OpType opType, commUniqueId diclID) {
+  std::vector<std::shared_ptr<DICLComm>> diclComms;
+  int devSize = static_cast<int>(devices.size());
+  diclComms.resize(devSize);
+  int deviceWorldSize = isP2POp(opType, false) ? 2 : getSize() * devSize;
 
   OptionalDIPUGuard dipuGuard;
 
@@ -241,9 +715,11 @@ std::vector<std::shared_ptr<DICLComm>>& ProcessGroupDICL::getDICLComms(
         isP2POp(opType, false) ? commsRank : getRank() * devSize + i;
     dipuGuard.reset_device(devices[i]);
     // use pool stream, not current stream
-    auto commStream = getDIPUStreamFromPool(devices[i].index());
+    auto commStream =
+        getDIPUStreamFromPool(kHighPriorityCommStream, devices[i].index());
     diclComms[i] =
         DICLComm::create(deviceWorldSize, deviceCommRank, diclID, commStream);
+    flightRecorder_.nameComm(diclComms[i].get(), localCommsKey);
   }
 
   // Hold the lock before modifying the cache.
@@ -255,11 +731,44 @@ std::vector<std::shared_ptr<DICLComm>>& ProcessGroupDICL::getDICLComms(
 
 namespace {
 
+// Views the fusion buffer of `comm` as the flattened `tensors`, growing it to
+// the next power of two bytes if needed. Undefined if it would be too big.
+at::Tensor flatFusionBuffer(DICLComm& comm,
+                            const std::vector<at::Tensor>& tensors) {
+  const auto& first = tensors.front();
+  const auto count = static_cast<int64_t>(tensors.size());
+  const auto numel = count * first.numel();
+  const auto nbytes = static_cast<size_t>(numel) * first.element_size();
+  if (nbytes == 0 || nbytes > kFusionBufferMaxBytes) {
+    return {};
+  }
+  auto& buffer = comm.fusionBuffers_[first.scalar_type()];
+  if (!buffer.defined() || buffer.numel() < numel) {
+    size_t capacity = 1;
+    while (capacity < nbytes) {
+      capacity <<= 1U;
+    }
+    capacity = std::min(capacity, kFusionBufferMaxBytes);
+    // allocated on the comm stream, so that the old buffer is only reused by
+    // the allocator after the comm stream is done with it
+    DIPUStreamGuard guard(comm.diclStream_.unwrap());
+    buffer = at::Tensor();
+    buffer = at::empty(
+        {static_cast<int64_t>(capacity / first.element_size())},
+        first.options());
+  }
+  std::vector<int64_t> sizes{count};
+  sizes.insert(sizes.end(), first.sizes().begin(), first.sizes().end());
+  return buffer.narrow(0, 0, numel).view(sizes);
+}
+
 // Flatten each list in `tensor_lists' for a gather or scatter operation, and
-// ensure compatibility with the corresponding tensor in `other'.
+// ensure compatibility with the corresponding tensor in `other'. The flattened
+// tensors are views of the fusion buffers of `comms` if they are not empty.
 std::vector<at::Tensor> flatten_for_scatter_gather(
     std::vector<std::vector<at::Tensor>>& tensor_lists,
-    std::vector<at::Tensor>& other, size_t world_size) {
+    std::vector<at::Tensor>& other, size_t world_size,
+    const std::vector<std::shared_ptr<DICLComm>>& comms) {
   if (tensor_lists.size() != other.size()) {
     throw std::runtime_error(
         "Tensor list operands to scatter/gather must have the same length");
@@ -290,7 +799,12 @@ std::vector<at::Tensor> flatten_for_scatter_gather(
       }
     }
     // Flatten the tensors (from all ranks) into a single big tensor.
-    flattened[i] = c10d::newLikeFlat(tensor_lists, i);
+    if (!comms.empty()) {
+      flattened[i] = flatFusionBuffer(*comms[i], tensor_lists[i]);
+    }
+    if (!flattened[i].defined()) {
+      flattened[i] = c10d::newLikeFlat(tensor_lists, i);
+    }
   }
   return flattened;
 }
@@ -310,6 +824,66 @@ void copyInCommStream(std::shared_ptr<DICLComm>& diclComm, const Dest& dest,
   }
 }
 
+// Copies `src` into `flat` with a single stack kernel on the comm stream if
+// all of them have the same sizes, and tensor by tensor otherwise.
+void packInCommStream(std::shared_ptr<DICLComm>& diclComm, at::Tensor& flat,
+                      const std::vector<at::Tensor>& src) {
+  const bool sameSizes =
+      std::all_of(src.begin(), src.end(), [&](const at::Tensor& tensor) {
+        return tensor.sizes() == flat[0].sizes();
+      });
+  if (!sameSizes) {
+    copyInCommStream<false>(diclComm, flat, src, static_cast<int>(src.size()));
+    return;
+  }
+  auto diclStream = diclComm->diclStream_;
+  DIPUStreamGuard guard(diclStream.unwrap());
+  at::stack_out(flat, src, 0);
+  for (const auto& tensor : src) {
+    dipu::recordStream(tensor, diclStream);
+  }
+}
+
+// Copies `flat` into `dest` on the comm stream. Contiguous tensors of the same
+// dtype laid out back to back in one storage, such as the chunks of a bucket,
+// take one device memcpy per run instead of one copy kernel each.
+void unpackInCommStream(std::shared_ptr<DICLComm>& diclComm,
+                        const std::vector<at::Tensor>& dest,
+                        const at::Tensor& flat) {
+  auto diclStream = diclComm->diclStream_;
+  DIPUStreamGuard guard(diclStream.unwrap());
+  const auto device = diclComm->device_.index();
+  const bool flatContiguous = flat.is_contiguous();
+  auto memcopyable = [&](const at::Tensor& tensor) {
+    return flatContiguous && tensor.device() == flat.device() &&
+           tensor.scalar_type() == flat.scalar_type() && tensor.is_contiguous();
+  };
+  for (size_t begin = 0, end = 0; begin < dest.size(); begin = end) {
+    end = begin + 1;
+    if (!memcopyable(dest[begin])) {
+      dest[begin].copy_(flat[static_cast<int64_t>(begin)], true);
+      dipu::recordStream(dest[begin], diclStream);
+      continue;
+    }
+    auto* start = static_cast<char*>(dest[begin].data_ptr());
+    size_t nbytes = dest[begin].nbytes();
+    while (end < dest.size() && memcopyable(dest[end]) &&
+           dest[end].storage().is_alias_of(dest[begin].storage()) &&
+           dest[end].data_ptr() == start + nbytes) {
+      nbytes += dest[end].nbytes();
+      ++end;
+    }
+    if (nbytes > 0) {
+      devproxy::memCopyD2DAsync(diclStream.rawstream(), nbytes, device, start,
+                                device,
+                                flat[static_cast<int64_t>(begin)].data_ptr());
+    }
+    for (size_t j = begin; j < end; ++j) {
+      dipu::recordStream(dest[j], diclStream);
+    }
+  }
+}
+
 void copyInCurrentStream(std::shared_ptr<DICLComm>& diclComm,
                          const std::vector<at::Tensor>& dest,
                          const at::Tensor& src) {
@@ -338,6 +912,12 @@ void ProcessGroupDICL::checkDeviceTensors(
         "Tensor list mustn't be larger than the number of available DIPUs");
   }
   const auto& first = tensors.front();
+  if (tensors.size() == 1) {
+    TORCH_CHECK(
+        dipu::isDeviceTensor(first) && first.is_non_overlapping_and_dense(),
+        "Tensors must be DIPU and non-overlapping and dense");
+    return;
+  }
 
   // Set for ensuring that tensors are on separate devices.
   std::unordered_set<decltype(first.get_device())> usedDevices;
@@ -364,6 +944,181 @@ void ProcessGroupDICL::checkDeviceTensors(
   }
 }
 
+void ProcessGroupDICL::checkP2PTensors(
+    const std::vector<at::Tensor>& tensors) {
+  if (std::all_of(tensors.begin(), tensors.end(), [](const at::Tensor& t) {
+        return t.is_non_overlapping_and_dense();
+      })) {
+    checkDeviceTensors(tensors);
+    return;
+  }
+  TORCH_CHECK(tensors.size() == 1,
+              "DICL P2P comm does not support multi-device tensor input");
+  TORCH_CHECK(dipu::isDeviceTensor(tensors[0]), "Tensors must be DIPU");
+}
+
+at::Tensor ProcessGroupDICL::p2pStagingBuffer(DICLComm& comm,
+                                              const at::Tensor& tensor) {
+  // ops of a group run at once, they can't share the fusion buffer
+  if (!coalescing_) {
+    auto flat = flatFusionBuffer(comm, {tensor});
+    if (flat.defined()) {
+      return flat[0];
+    }
+  }
+  DIPUStreamGuard guard(comm.diclStream_.unwrap());
+  return at::empty(tensor.sizes(), tensor.options());
+}
+
+bool ProcessGroupDICL::hierarchicalAllreduceEnabled() const {
+  // the three steps would run concurrently inside a group
+  return kHierarchicalAllreduce && !coalescing_ && kLocalWorldSize > 1 &&
+         kLocalWorldSize < size_ && size_ % kLocalWorldSize == 0;
+}
+
+void ProcessGroupDICL::initHierarchicalComms(DICLComm& comm) {
+  if (comm.intraNodeComm_) {
+    return;
+  }
+  const int node = rank_ / kLocalWorldSize;
+  const int localRank = rank_ % kLocalWorldSize;
+  // all ranks get here at the same allreduce, so the counter stays in step
+  const auto keyPrefix = std::to_string(diclCommCounter_++);
+  DIPUGuard dipuGuard(comm.device_);
+  auto create = [&](const std::string& key, int numRanks, int commRank) {
+    commUniqueId diclID;
+    if (commRank == 0) {
+      devproxy::diclGetUniqueId(&diclID);
+    }
+    broadcastUniqueID(&diclID, keyPrefix + key, commRank);
+    return DICLComm::create(numRanks, commRank, diclID, comm.diclStream_);
+  };
+  comm.intraNodeComm_ =
+      create(":intra:" + std::to_string(node), kLocalWorldSize, localRank);
+  comm.interNodeComm_ = create(":inter:" + std::to_string(localRank),
+                               size_ / kLocalWorldSize, node);
+}
+
+std::vector<std::shared_ptr<DICLComm>> ProcessGroupDICL::fusionBufferComms(
+    const std::vector<at::Tensor>& tensors, OpType opType) {
+  // coalesced ops would all be packed into the same buffer before they run
+  if (kFusionBufferMaxBytes == 0 || coalescing_) {
+    return {};
+  }
+  const auto devices = getDeviceList(tensors);
+  return collectiveComms(devices, opType);
+}
+
+void ProcessGroupDICL::eagerInit(const std::vector<at::Device>& devices,
+                                 bool warmup) {
+  TORCH_CHECK(!devices.empty(), "eager_init needs at least one device");
+  std::vector<std::string> keys;
+  for (int stream = 0; stream < kCommStreams; ++stream) {
+    auto key = commsKey(devices, stream);
+    std::lock_guard<std::mutex> lock(devDICLCommMapLock_);
+    if (devDICLCommsMap_.find(key) == devDICLCommsMap_.end()) {
+      keys.push_back(std::move(key));
+    }
+  }
+  // Exchange all unique ids before creating any communicator, so that the
+  // store round trips don't wait for the inits of the previous ones
+  std::vector<commUniqueId> ids;
+  ids.reserve(keys.size());
+  for (const auto& key : keys) {
+    ids.push_back(exchangeUniqueID(key, this->rank_, OpType::ALLREDUCE));
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    createDICLComms(keys[i], devices, this->rank_, OpType::ALLREDUCE, ids[i]);
+  }
+
+  std::vector<std::shared_ptr<DICLComm>> comms;
+  for (int stream = 0; stream < kCommStreams; ++stream) {
+    std::lock_guard<std::mutex> lock(devDICLCommMapLock_);
+    auto& cached = devDICLCommsMap_[commsKey(devices, stream)];
+    comms.insert(comms.end(), cached.begin(), cached.end());
+  }
+  if (hierarchicalAllreduceEnabled() && devices.size() == 1) {
+    for (auto& comm : comms) {
+      initHierarchicalComms(*comm);
+    }
+  }
+  if (!warmup) {
+    return;
+  }
+  // a one element allreduce on every communicator sets up the connections
+  for (auto& comm : comms) {
+    DIPUGuard dipuGuard(comm->device_);
+    DIPUStreamGuard streamGuard(comm->diclStream_.unwrap());
+    auto tensor = at::zeros({1}, at::TensorOptions(comm->device_));
+    for (auto* target : {comm.get(), comm->intraNodeComm_.get(),
+                         comm->interNodeComm_.get()}) {
+      if (target != nullptr) {
+        devproxy::diclAllReduce(tensor.data_ptr(), tensor.data_ptr(), 1,
+                                tensor.scalar_type(), c10d::ReduceOp::SUM,
+                                target->rawComm(),
+                                comm->diclStream_.rawstream());
+      }
+    }
+    comm->diclStream_.synchronize();
+  }
+}
+
+void ProcessGroupDICL::splitInto(ProcessGroupDICL* child, int color,
+                                 int key) {
+  TORCH_CHECK((child != nullptr) == (color >= 0),
+              "a split needs a child group exactly for a non-negative color");
+  const std::vector<at::Device> devices{
+      at::Device(DIPU_DEVICE_TYPE, devproxy::current_device())};
+  eagerInit(devices, false);
+  DIPUGuard dipuGuard(devices[0]);
+  for (int stream = 0; stream < kCommStreams; ++stream) {
+    const auto commKey = commsKey(devices, stream);
+    std::shared_ptr<DICLComm> parent;
+    {
+      std::lock_guard<std::mutex> lock(devDICLCommMapLock_);
+      parent = devDICLCommsMap_[commKey].at(0);
+    }
+    auto commStream =
+        getDIPUStreamFromPool(kHighPriorityCommStream, devices[0].index());
+    auto comm = DICLComm::split(*parent, color, key, commStream);
+    if (child == nullptr) {
+      continue;
+    }
+    TORCH_CHECK(comm, "the vendor split no communicator for a member rank");
+    child->flightRecorder_.nameComm(comm.get(), commKey);
+    std::lock_guard<std::mutex> lock(child->devDICLCommMapLock_);
+    child->devDICLCommsMap_.emplace(
+        commKey, std::vector<std::shared_ptr<DICLComm>>{std::move(comm)});
+  }
+}
+
+int ProcessGroupDICL::collectiveCommStream(OpType opType) const {
+  // the same on all ranks, as they run the same ops in the same order
+  return kCommStreamRoundRobin ? nextCommStream_
+                               : static_cast<int>(opType) % kCommStreams;
+}
+
+std::vector<std::shared_ptr<DICLComm>>& ProcessGroupDICL::collectiveComms(
+    const std::vector<at::Device>& devices, OpType opType) {
+  const int stream = collectiveCommStream(opType);
+  if (devices.size() != 1) {
+    return getDICLComms(commsKey(devices, stream), devices, this->rank_,
+                        opType);
+  }
+  const auto slot =
+      static_cast<size_t>(devices[0].index()) * kCommStreams + stream;
+  if (slot >= singleDeviceComms_.size()) {
+    singleDeviceComms_.resize(slot + 1, nullptr);
+  }
+  auto*& cached = singleDeviceComms_[slot];
+  if (cached == nullptr) {
+    // entries of devDICLCommsMap_ are never removed, the reference stays valid
+    cached = &getDICLComms(commsKey(devices, stream), devices, this->rank_,
+                           opType);
+  }
+  return *cached;
+}
+
 template <typename Fn, typename PreProcess, typename PostProcess>
 c10::intrusive_ptr<Work> ProcessGroupDICL::doComm(
     std::vector<at::Tensor>& inputs, std::vector<at::Tensor>& outputs,
@@ -378,6 +1133,33 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::doComm(
   OptionalDIPUGuard dipuGuard;
   pre(diclComms);
 
+  auto& timing = work->timing_;
+  const bool timed = collectiveStatsEnabled() && !coalescing_;
+  uint64_t bytes = 0;
+  if (timed || flightRecorder_.enabled()) {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      bytes += std::max(inputs[i].nbytes(), outputs[i].nbytes());
+    }
+  }
+  if (flightRecorder_.enabled() && !inputs.empty()) {
+    work->flightRecordId_ =
+        flightRecorder_.record(opType, diclComms[0].get(), inputs[0].numel(),
+                               inputs[0].scalar_type(), bytes);
+  }
+  if (timed) {
+    timing = std::make_unique<WorkDICL::Timing>();
+    timing->opType = opType;
+    timing->bytes = bytes;
+    auto& stream = diclComms[0]->diclStream_;
+    timing->queued = std::chrono::steady_clock::now();
+    launchHostCallback(stream, [startedNs = timing->startedNs] {
+      startedNs->store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count());
+    });
+    timing->start.record(stream);
+  }
+
   for (size_t i = 0; i < inputs.size(); ++i) {
     dipuGuard.reset_device(diclComms[i]->device_);
 
@@ -385,33 +1167,114 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::doComm(
     fn(inputs[i], outputs[i], diclComms[i]->rawComm(),
        diclComms[i]->diclStream_);
 
-    dipu::recordStream(inputs[i], diclComms[i]->diclStream_);
-    if (inputs[i].storage().data_ptr().get() !=
-        outputs[i].storage().data_ptr().get()) {
-      dipu::recordStream(outputs[i], diclComms[i]->diclStream_);
+    if (!skip_record_stream) {
+      dipu::recordStream(inputs[i], diclComms[i]->diclStream_);
+      if (inputs[i].storage().data_ptr().get() !=
+          outputs[i].storage().data_ptr().get()) {
+        dipu::recordStream(outputs[i], diclComms[i]->diclStream_);
+      }
     }
 
     // mock comm with just copy, used in standalone test.
     // DIPUStreamGuard guard(diclComms[i]->diclStream_.unwrap());
     // outputs[i].copy_(inputs[i], false);
   }
+  if (timing) {
+    timing->end.record(diclComms[0]->diclStream_);
+  }
 
   post(diclComms);
-  work->record();
+  if (coalescing_) {
+    // the calls are only launched when the group ends
+    for (auto& comm : diclComms) {
+      if (std::find(coalescedComms_.begin(), coalescedComms_.end(), comm) ==
+          coalescedComms_.end()) {
+        coalescedComms_.push_back(comm);
+      }
+    }
+  } else {
+    work->record();
+    watch(work);
+  }
+
+  completeWork(work, outputs, devices);
+  return work;
+}
 
+void ProcessGroupDICL::completeWork(const c10::intrusive_ptr<WorkDICL>& work,
+                                    const std::vector<at::Tensor>& outputs,
+                                    const std::vector<at::Device>& devices) {
   work->outputs_ = std::make_shared<std::vector<at::Tensor>>(outputs);
-  // todo:: dipu need support multistream guard & remove
-  // work->workEvents_(future already has events ).
-  {
-    DIPUStreamGuard guard(diclComms[0]->diclStream_.unwrap());
+  work->future_ = c10::make_intrusive<at::ivalue::Future>(
+      c10::ListType::create(c10::TensorType::get()), devices);
+  // the DICL calls of a group are only queued at its end
+  if (coalescing_) {
+    coalescedWorks_.push_back(work);
+  } else {
+    work->markFutureCompleted();
+  }
+}
 
-    work->future_ = c10::make_intrusive<at::ivalue::Future>(
-        c10::ListType::create(c10::TensorType::get()), devices);
-    work->future_->markCompleted(at::IValue(*work->outputs_));
+void ProcessGroupDICL::beginGroup() {
+  TORCH_CHECK(!coalescing_, "DICL coalescing can't be nested");
+  if (!devproxy::isDiclGroupSupported()) {
+    TORCH_WARN_ONCE(
+        "the vendor doesn't support DICL groups, coalesced ops run one by one");
   }
+  devproxy::diclGroupStart();
+  coalescing_ = true;
+  coalescedComms_.clear();
+  coalescedUnpacks_.clear();
+}
+
+c10::intrusive_ptr<ProcessGroupDICL::WorkDICL> ProcessGroupDICL::endGroup(
+    const std::vector<at::Tensor>& outputs) {
+  TORCH_CHECK(coalescing_, "DICL coalescing is not started");
+  coalescing_ = false;
+  auto comms = std::move(coalescedComms_);
+  coalescedComms_.clear();
+  devproxy::diclGroupEnd();
+  auto unpacks = std::move(coalescedUnpacks_);
+  coalescedUnpacks_.clear();
+  for (auto& unpack : unpacks) {
+    unpack();
+  }
+
+  // the works of the ops in the group are done with the group
+  auto works = std::move(coalescedWorks_);
+  coalescedWorks_.clear();
+  for (auto& opWork : works) {
+    opWork->record();
+    watch(opWork);
+    opWork->markFutureCompleted();
+  }
+
+  auto work = c10::make_intrusive<ProcessGroupDICL::WorkDICL>(
+      comms, blockingWait_, opTimeout_);
+  work->record();
+  watch(work);
+  std::vector<at::Device> devices;
+  devices.reserve(comms.size());
+  for (auto& comm : comms) {
+    devices.push_back(comm->device_);
+  }
+  completeWork(work, outputs, devices);
   return work;
 }
 
+template <typename Fn>
+c10::intrusive_ptr<Work> ProcessGroupDICL::coalesced(
+    Fn fn, const std::vector<at::Tensor>& outputs) {
+  beginGroup();
+  try {
+    fn();
+  } catch (...) {
+    endGroup();
+    throw;
+  }
+  return endGroup(outputs);
+}
+
 // std::function< diclResult_t(at::Tensor&, at::Tensor&, DiclComm, DIPUStream&)
 // > enhance: need change template params to lamada, make collective() func
 // overridable by sub class
@@ -419,6 +1282,9 @@ template <typename Fn, typename PreProcess, typename PostProcess>
 c10::intrusive_ptr<Work> ProcessGroupDICL::collective(
     std::vector<at::Tensor>& inputs, std::vector<at::Tensor>& outputs, Fn fn,
     PreProcess pre, PostProcess post, OpType opType) {
+  if (kDesyncCheckInterval > 0) {
+    trackDesync(inputs, opType);
+  }
   const auto devices = getDeviceList(inputs);
 
   TORCH_CHECK(devices.size() == 1,
@@ -426,10 +1292,9 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::collective(
               "ncclGroupStart/End, ",
               "but we cannot support group based comm now.");
 
-  const auto localCommsKey = getDeviceIds(devices);
-
   // collective use PG.rank_ as comsBaseRank
-  auto diclComms = getDICLComms(localCommsKey, devices, this->rank_, opType);
+  auto& diclComms = collectiveComms(devices, opType);
+  nextCommStream_ = (nextCommStream_ + 1) % kCommStreams;
   return doComm(inputs, outputs, diclComms, devices, fn, pre, post, opType);
 }
 
@@ -464,12 +1329,27 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::pointToPoint(
   return doComm(inputs, outputs, diclComms, devices, fn, pre, post, opType);
 }
 
+c10::intrusive_ptr<Work> ProcessGroupDICL::allreduceOwned(
+    std::vector<at::Tensor>& tensors, const AllreduceOptions& opts) {
+  skip_record_stream = true;
+  try {
+    auto work = allreduce(tensors, opts);
+    skip_record_stream = false;
+    return work;
+  } catch (...) {
+    skip_record_stream = false;
+    throw;
+  }
+}
+
 // NOLINTNEXTLINE(google-default-arguments)
 c10::intrusive_ptr<Work> ProcessGroupDICL::allreduce(
     std::vector<at::Tensor>& tensors, const AllreduceOptions& opts) {
   // inplace in = out, every rank use both in&out.
   checkDeviceTensors(tensors);
   std::vector<at::Tensor> tensors_cp{tensors};
+  DICLComm* hierarchicalComm = nullptr;
+  DICLComm* compressionComm = nullptr;
   return collective(
       tensors_cp, tensors_cp,
       [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
@@ -477,12 +1357,31 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::allreduce(
         RECORD_FUNCTION("DiclAllreduce", std::vector<c10::IValue>({input}));
         profile::RecordBlockCreator _("DiclAllreduce", stream.rawstream(),
                                       static_cast<int>(stream.id()));
+        if (compressionComm != nullptr &&
+            canCompressAllReduce(input, opts.reduceOp)) {
+          return compressedAllReduce(input, output, opts.reduceOp,
+                                     *compressionComm, size_, stream);
+        }
+        if (hierarchicalComm != nullptr &&
+            input.nbytes() >= kHierarchicalAllreduceMinBytes &&
+            input.numel() % kLocalWorldSize == 0) {
+          return hierarchicalAllReduce(input, output, opts.reduceOp,
+                                       *hierarchicalComm, stream);
+        }
         return devproxy::diclAllReduce(input.data_ptr(), output.data_ptr(),
                                        static_cast<size_t>(input.numel()),
                                        input.scalar_type(), opts.reduceOp, comm,
                                        stream.rawstream());
       },
       [&](std::vector<std::shared_ptr<DICLComm>>& comms) {
+        if (hierarchicalAllreduceEnabled() && comms.size() == 1) {
+          initHierarchicalComms(*comms[0]);
+          hierarchicalComm = comms[0].get();
+        }
+        // not in a group, whose calls must not wait on the extra kernels
+        if (!coalescing_ && comms.size() == 1) {
+          compressionComm = comms[0].get();
+        }
         if (dicl_hook::allReducePreFn) {
           dicl_hook::allReducePreFn(comms, tensors, tensors_cp);
         }
@@ -556,7 +1455,139 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::reduce(
 c10::intrusive_ptr<Work> ProcessGroupDICL::gather(
     std::vector<std::vector<at::Tensor>>& outputs,
     std::vector<at::Tensor>& inputs, const GatherOptions& opts) {
-  TORCH_CHECK(false, "ProcessGroupDICL does not support gather now");
+  checkDeviceTensors(inputs);
+  TORCH_CHECK(inputs.size() == 1 && inputs[0].is_contiguous(),
+              "gather needs one contiguous input tensor");
+  TORCH_CHECK(opts.rootRank >= 0 && opts.rootRank < size_,
+              "invalid root rank ", opts.rootRank);
+  // the copies out of the flat output would run before the group
+  TORCH_CHECK(!coalescing_, "gather can't be coalesced");
+  const auto& first = inputs[0];
+  const auto numel = static_cast<size_t>(first.numel());
+
+  // an all-to-all in which every rank sends to the root only
+  std::vector<size_t> sendCounts(size_);
+  std::vector<size_t> sendDispls(size_);
+  std::vector<size_t> recvCounts(size_);
+  std::vector<size_t> recvDispls(size_);
+  sendCounts[opts.rootRank] = numel;
+  at::Tensor flat;
+  std::vector<at::Tensor> chunks;
+  if (rank_ == opts.rootRank) {
+    TORCH_CHECK(outputs.size() == 1 &&
+                    outputs[0].size() == static_cast<size_t>(size_),
+                "gather needs one output tensor per rank on the root");
+    for (const auto& tensor : outputs[0]) {
+      TORCH_CHECK(dipu::isDeviceTensor(tensor) &&
+                      tensor.device() == first.device() &&
+                      tensor.scalar_type() == first.scalar_type() &&
+                      tensor.numel() == first.numel(),
+                  "gather outputs must be like the input on the same device");
+    }
+    flat = at::empty({static_cast<int64_t>(numel) * size_}, first.options());
+    for (int i = 0; i < size_; ++i) {
+      recvCounts[i] = numel;
+      recvDispls[i] = i * numel;
+      chunks.push_back(flat.narrow(0, static_cast<int64_t>(recvDispls[i]),
+                                   first.numel())
+                           .view(outputs[0][i].sizes()));
+    }
+  }
+
+  // the input is the same on all ranks, unlike the outputs
+  return collective(
+      inputs, inputs,
+      [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclGather", std::vector<c10::IValue>({input}));
+        profile::RecordBlockCreator _("DiclGather", stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        void* recvBuf = nullptr;
+        if (flat.defined()) {
+          dipu::recordStream(flat, stream);
+          recvBuf = flat.data_ptr();
+        }
+        return devproxy::diclAllToAllv(
+            input.data_ptr(), sendCounts.data(), sendDispls.data(), recvBuf,
+            recvCounts.data(), recvDispls.data(), input.scalar_type(), size_,
+            comm, stream.rawstream());
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {},
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {
+        if (flat.defined()) {
+          copyInCommStream<true>(diclComms[0], outputs[0], chunks, size_);
+        }
+      },
+      OpType::GATHER);
+}
+
+// NOLINTNEXTLINE(google-default-arguments)
+c10::intrusive_ptr<Work> ProcessGroupDICL::scatter(
+    std::vector<at::Tensor>& outputs,
+    std::vector<std::vector<at::Tensor>>& inputs, const ScatterOptions& opts) {
+  checkDeviceTensors(outputs);
+  TORCH_CHECK(outputs.size() == 1 && outputs[0].is_contiguous(),
+              "scatter needs one contiguous output tensor");
+  TORCH_CHECK(opts.rootRank >= 0 && opts.rootRank < size_,
+              "invalid root rank ", opts.rootRank);
+  const auto& first = outputs[0];
+  const auto numel = static_cast<size_t>(first.numel());
+
+  // an all-to-all in which the root sends to every rank
+  std::vector<size_t> sendCounts(size_);
+  std::vector<size_t> sendDispls(size_);
+  std::vector<size_t> recvCounts(size_);
+  std::vector<size_t> recvDispls(size_);
+  recvCounts[opts.rootRank] = numel;
+  at::Tensor flat;
+  std::vector<at::Tensor> chunks;
+  if (rank_ == opts.rootRank) {
+    TORCH_CHECK(inputs.size() == 1 &&
+                    inputs[0].size() == static_cast<size_t>(size_),
+                "scatter needs one input tensor per rank on the root");
+    for (const auto& tensor : inputs[0]) {
+      TORCH_CHECK(dipu::isDeviceTensor(tensor) &&
+                      tensor.device() == first.device() &&
+                      tensor.scalar_type() == first.scalar_type() &&
+                      tensor.numel() == first.numel(),
+                  "scatter inputs must be like the output on the same device");
+    }
+    flat = at::empty({static_cast<int64_t>(numel) * size_}, first.options());
+    for (int i = 0; i < size_; ++i) {
+      sendCounts[i] = numel;
+      sendDispls[i] = i * numel;
+      chunks.push_back(flat.narrow(0, static_cast<int64_t>(sendDispls[i]),
+                                   first.numel())
+                           .view(inputs[0][i].sizes()));
+    }
+  }
+
+  // the output is the same on all ranks, unlike the inputs
+  return collective(
+      outputs, outputs,
+      [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclScatter", std::vector<c10::IValue>({output}));
+        profile::RecordBlockCreator _("DiclScatter", stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        const void* sendBuf = nullptr;
+        if (flat.defined()) {
+          dipu::recordStream(flat, stream);
+          sendBuf = flat.data_ptr();
+        }
+        return devproxy::diclAllToAllv(
+            sendBuf, sendCounts.data(), sendDispls.data(), output.data_ptr(),
+            recvCounts.data(), recvDispls.data(), output.scalar_type(), size_,
+            comm, stream.rawstream());
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {
+        if (flat.defined()) {
+          // record src tensors, the flat input is recorded above
+          copyInCommStream<false>(diclComms[0], chunks, inputs[0], size_);
+        }
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {},
+      OpType::SCATTER);
 }
 
 // NOLINTNEXTLINE(google-default-arguments)
@@ -564,9 +1595,14 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::allgather(
     std::vector<std::vector<at::Tensor>>& outputs,
     std::vector<at::Tensor>& inputs, const AllgatherOptions& opts) {
   checkDeviceTensors(inputs);
+  // the copies out of the flattened output would run before the group
+  TORCH_CHECK(!coalescing_,
+              "allgather of tensor lists can't be coalesced, use "
+              "all_gather_into_tensor");
   // output = input * ranks, no inplace. every ranks use both in&out.
   auto outputFlattened =
-      flatten_for_scatter_gather(outputs, inputs, this->size_);
+      flatten_for_scatter_gather(outputs, inputs, this->size_,
+                                 fusionBufferComms(inputs, OpType::ALLGATHER));
 
   auto work = collective(
       inputs, outputFlattened,
@@ -588,12 +1624,16 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::allgather(
           // warnning & todo:: copy in comm stream,
           // record dest tensor outputs, because src tensor outputFlattened
           // already recorded in collective.
-          copyInCommStream<true>(diclComms[i], outputs[i], outputFlattened[i],
-                                 static_cast<int>(outputs[i].size()));
+          unpackInCommStream(diclComms[i], outputs[i], outputFlattened[i]);
           // copyInCurrentStream(diclComms[i], outputs[i], outputFlattened[i]);
         }
       },
       OpType::ALLGATHER);
+  // The flat views are reused by later ops, so the result and the future
+  // hold the outputs, which are written after the flat views on the comm
+  // stream. One list as all ranks' outputs go to a single device.
+  completeWork(c10::static_intrusive_pointer_cast<WorkDICL>(work),
+               outputs.front(), getDeviceList(inputs));
   return work;
 }
 
@@ -658,6 +1698,126 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::_reduce_scatter_base(
       OpType::_REDUCE_SCATTER_BASE);
 }
 
+c10::intrusive_ptr<Work> ProcessGroupDICL::allgatherMatmul(
+    at::Tensor& gathered, at::Tensor& output, const at::Tensor& input,
+    const at::Tensor& weight, int64_t chunks) {
+  // the pieces wait on each other, which a group would only launch at its end
+  TORCH_CHECK(!coalescing_, "allgather_matmul can't be coalesced");
+  TORCH_CHECK(input.dim() == 2 && weight.dim() == 2 &&
+                  input.size(1) == weight.size(0),
+              "allgather_matmul needs an input of [m, k] and a weight of "
+              "[k, n]");
+  const auto ranks = static_cast<int64_t>(this->size_);
+  const auto rows = input.size(0);
+  const auto cols = input.size(1);
+  TORCH_CHECK(gathered.dim() == 2 && gathered.size(0) == ranks * rows &&
+                  gathered.size(1) == cols && gathered.is_contiguous() &&
+                  gathered.dtype() == input.dtype(),
+              "gathered must be a contiguous tensor of [world_size * m, k]");
+  TORCH_CHECK(output.dim() == 2 && output.size(0) == ranks * rows &&
+                  output.size(1) == weight.size(1) &&
+                  output.is_contiguous() && output.dtype() == input.dtype(),
+              "output must be a contiguous tensor of [world_size * m, n]");
+
+  chunks = overlapChunks(rows, chunks);
+  const auto chunkRows = rows / chunks;
+  // piece c of all ranks is gathered together, as allgather lays it out
+  auto staging = at::empty({chunks, ranks, chunkRows, cols}, input.options());
+  auto inputs = std::vector<at::Tensor>{input.contiguous()};
+  auto outputs = std::vector<at::Tensor>{staging};
+
+  return collective(
+      inputs, outputs,
+      [&](at::Tensor& input, at::Tensor& staging, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclAllgatherMatmul",
+                        std::vector<c10::IValue>({input}));
+        profile::RecordBlockCreator _("DiclAllgatherMatmul",
+                                      stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        auto compute = getCurrentDIPUStream(stream.device_index());
+        auto pieces = input.view({chunks, chunkRows * cols});
+        auto outputPieces =
+            output.view({ranks, chunks, chunkRows, weight.size(1)});
+        std::vector<DIPUEvent> gatheredEvents;
+        gatheredEvents.reserve(static_cast<size_t>(chunks));
+        for (int64_t i = 0; i < chunks; ++i) {
+          auto result = devproxy::diclAllGather(
+              pieces[i].data_ptr(), staging[i].data_ptr(),
+              static_cast<size_t>(chunkRows * cols), input.scalar_type(), comm,
+              stream.rawstream());
+          if (result != devapis::DICL_SUCCESS) {
+            return result;
+          }
+          gatheredEvents.emplace_back(devapis::EventFlags::DISABLE_TIMING);
+          gatheredEvents.back().record(stream);
+          gatheredEvents.back().wait(compute);
+          outputPieces.select(1, i).copy_(at::matmul(staging[i], weight));
+        }
+        // the rows of each rank back together, the current stream has waited
+        // for all pieces by now
+        gathered.view({ranks, chunks, chunkRows, cols})
+            .copy_(staging.transpose(0, 1));
+        return devapis::DICL_SUCCESS;
+      },
+      OpType::_ALLGATHER_BASE);
+}
+
+c10::intrusive_ptr<Work> ProcessGroupDICL::matmulReduceScatter(
+    at::Tensor& output, const at::Tensor& input, const at::Tensor& weight,
+    int64_t chunks, const ReduceScatterOptions& opts) {
+  TORCH_CHECK(!coalescing_, "matmul_reduce_scatter can't be coalesced");
+  TORCH_CHECK(input.dim() == 2 && weight.dim() == 2 &&
+                  input.size(1) == weight.size(0),
+              "matmul_reduce_scatter needs an input of [world_size * m, k] "
+              "and a weight of [k, n]");
+  const auto ranks = static_cast<int64_t>(this->size_);
+  TORCH_CHECK(output.dim() == 2 && output.size(0) * ranks == input.size(0) &&
+                  output.size(1) == weight.size(1) &&
+                  output.is_contiguous() && output.dtype() == input.dtype(),
+              "output must be a contiguous tensor of [m, n]");
+
+  const auto rows = output.size(0);
+  const auto cols = output.size(1);
+  chunks = overlapChunks(rows, chunks);
+  const auto chunkRows = rows / chunks;
+  auto inputs = std::vector<at::Tensor>{input.contiguous()};
+  auto outputs = std::vector<at::Tensor>{output};
+
+  return collective(
+      inputs, outputs,
+      [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclMatmulReduceScatter",
+                        std::vector<c10::IValue>({input}));
+        profile::RecordBlockCreator _("DiclMatmulReduceScatter",
+                                      stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        auto compute = getCurrentDIPUStream(stream.device_index());
+        auto inputPieces =
+            input.view({ranks, chunks, chunkRows, input.size(1)});
+        auto outputPieces = output.view({chunks, chunkRows * cols});
+        for (int64_t i = 0; i < chunks; ++i) {
+          // piece i of the rows of every rank, as reduce-scatter scatters it
+          auto partial =
+              at::matmul(inputPieces.select(1, i), weight).contiguous();
+          DIPUEvent computed(devapis::EventFlags::DISABLE_TIMING);
+          computed.record(compute);
+          computed.wait(stream);
+          dipu::recordStream(partial, stream);
+          auto result = devproxy::diclReduceScatter(
+              partial.data_ptr(), outputPieces[i].data_ptr(),
+              static_cast<size_t>(chunkRows * cols), input.scalar_type(),
+              opts.reduceOp, comm, stream.rawstream());
+          if (result != devapis::DICL_SUCCESS) {
+            return result;
+          }
+        }
+        return devapis::DICL_SUCCESS;
+      },
+      OpType::_REDUCE_SCATTER_BASE);
+}
+
 // NOLINTNEXTLINE(google-default-arguments)
 c10::intrusive_ptr<Work> ProcessGroupDICL::reduce_scatter(
     std::vector<at::Tensor>& outputs,
@@ -665,8 +1825,9 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::reduce_scatter(
     const ReduceScatterOptions& opts) {
   // input = output * ranks, no inplace, output = reduced(input)[rank]
   checkDeviceTensors(outputs);
-  auto inputFlattened =
-      flatten_for_scatter_gather(inputs, outputs, this->size_);
+  auto inputFlattened = flatten_for_scatter_gather(
+      inputs, outputs, this->size_,
+      fusionBufferComms(outputs, OpType::REDUCE_SCATTER));
   checkDeviceTensors(inputFlattened);
 
   auto work = collective(
@@ -686,8 +1847,7 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::reduce_scatter(
         for (size_t i = 0; i < inputs.size(); ++i) {
           // record src tensor inputs, because dest tensor inputFlattened
           // already recorded in collective
-          copyInCommStream<false>(diclComms[i], inputFlattened[i], inputs[i],
-                                  static_cast<int>(inputs[0].size()));
+          packInCommStream(diclComms[i], inputFlattened[i], inputs[i]);
         }
       },
       [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {},
@@ -695,10 +1855,258 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::reduce_scatter(
   return work;
 }
 
+// NOLINTNEXTLINE(google-default-arguments)
+c10::intrusive_ptr<Work> ProcessGroupDICL::alltoall_base(
+    at::Tensor& outputTensor, at::Tensor& inputTensor,
+    std::vector<int64_t>& outputSplitSizes,
+    std::vector<int64_t>& inputSplitSizes, const AllToAllOptions& opts) {
+  TORCH_CHECK(inputTensor.dtype() == outputTensor.dtype(),
+              "output tensor must have the same type as input tensor");
+  TORCH_CHECK(inputTensor.is_contiguous() && outputTensor.is_contiguous(),
+              "alltoall_base needs contiguous tensors");
+  c10d::checkSplitSizes(inputSplitSizes, inputTensor, size_);
+  c10d::checkSplitSizes(outputSplitSizes, outputTensor, size_);
+  const bool equalSplit = inputSplitSizes.empty() && outputSplitSizes.empty();
+
+  // counts and displacements of every rank, in elements
+  std::vector<size_t> sendCounts(size_);
+  std::vector<size_t> sendDispls(size_);
+  std::vector<size_t> recvCounts(size_);
+  std::vector<size_t> recvDispls(size_);
+  c10d::computeLengthsAndOffsets(inputSplitSizes, inputTensor, &sendCounts,
+                                 &sendDispls);
+  c10d::computeLengthsAndOffsets(outputSplitSizes, outputTensor, &recvCounts,
+                                 &recvDispls);
+
+  auto inputs = std::vector<at::Tensor>{inputTensor};
+  auto outputs = std::vector<at::Tensor>{outputTensor};
+  return collective(
+      inputs, outputs,
+      [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclAlltoall_base", std::vector<c10::IValue>({input}));
+        profile::RecordBlockCreator _("DiclAlltoall_base", stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        if (equalSplit) {
+          return devproxy::diclAllToAll(
+              input.data_ptr(), output.data_ptr(),
+              static_cast<size_t>(input.numel() / size_), input.scalar_type(),
+              size_, comm, stream.rawstream());
+        }
+        return devproxy::diclAllToAllv(
+            input.data_ptr(), sendCounts.data(), sendDispls.data(),
+            output.data_ptr(), recvCounts.data(), recvDispls.data(),
+            input.scalar_type(), size_, comm, stream.rawstream());
+      },
+      OpType::ALLTOALL_BASE);
+}
+
+// NOLINTNEXTLINE(google-default-arguments)
+c10::intrusive_ptr<Work> ProcessGroupDICL::alltoall(
+    std::vector<at::Tensor>& outputTensors,
+    std::vector<at::Tensor>& inputTensors, const AllToAllOptions& opts) {
+  // tensor i is sent to and received from rank i, through flat buffers
+  TORCH_CHECK(inputTensors.size() == static_cast<size_t>(size_) &&
+                  outputTensors.size() == static_cast<size_t>(size_),
+              "alltoall needs one input and one output tensor per rank");
+  // the copies out of the flat output would run before the group
+  TORCH_CHECK(!coalescing_, "alltoall of tensor lists can't be coalesced");
+  const auto& first = inputTensors.front();
+  for (const auto* list : {&inputTensors, &outputTensors}) {
+    for (const auto& tensor : *list) {
+      TORCH_CHECK(dipu::isDeviceTensor(tensor) &&
+                      tensor.device() == first.device(),
+                  "alltoall tensors must be on the same DIPU device");
+      TORCH_CHECK(tensor.scalar_type() == first.scalar_type(),
+                  "alltoall tensors must have identical type");
+    }
+  }
+
+  std::vector<size_t> sendCounts(size_);
+  std::vector<size_t> sendDispls(size_);
+  std::vector<size_t> recvCounts(size_);
+  std::vector<size_t> recvDispls(size_);
+  const auto sendTotal =
+      c10d::computeLengthsAndOffsets(inputTensors, &sendCounts, &sendDispls);
+  const auto recvTotal =
+      c10d::computeLengthsAndOffsets(outputTensors, &recvCounts, &recvDispls);
+
+  auto inputs = std::vector<at::Tensor>{
+      at::empty({static_cast<int64_t>(sendTotal)}, first.options())};
+  auto outputs = std::vector<at::Tensor>{
+      at::empty({static_cast<int64_t>(recvTotal)}, first.options())};
+  auto chunks = [](const at::Tensor& flat, const std::vector<size_t>& displs,
+                   const std::vector<at::Tensor>& like) {
+    std::vector<at::Tensor> result;
+    result.reserve(like.size());
+    for (size_t i = 0; i < like.size(); ++i) {
+      result.push_back(flat.narrow(0, static_cast<int64_t>(displs[i]),
+                                   like[i].numel())
+                           .view(like[i].sizes()));
+    }
+    return result;
+  };
+  auto inputChunks = chunks(inputs[0], sendDispls, inputTensors);
+  auto outputChunks = chunks(outputs[0], recvDispls, outputTensors);
+
+  return collective(
+      inputs, outputs,
+      [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclAlltoall", std::vector<c10::IValue>({input}));
+        profile::RecordBlockCreator _("DiclAlltoall", stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        return devproxy::diclAllToAllv(
+            input.data_ptr(), sendCounts.data(), sendDispls.data(),
+            output.data_ptr(), recvCounts.data(), recvDispls.data(),
+            input.scalar_type(), size_, comm, stream.rawstream());
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {
+        // record src tensors, the flat input is recorded in collective
+        copyInCommStream<false>(diclComms[0], inputChunks, inputTensors,
+                                size_);
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {
+        // record dest tensors, the flat output is recorded in collective
+        copyInCommStream<true>(diclComms[0], outputTensors, outputChunks,
+                               size_);
+      },
+      OpType::ALLTOALL);
+}
+
+namespace {
+
+// Checks the row split of a variable length collective, returns the number
+// of elements in a row
+size_t checkRowSplit(const at::Tensor& flat, const at::Tensor& part,
+                     const std::vector<int64_t>& splitSizes, int rank,
+                     int size) {
+  TORCH_CHECK(splitSizes.size() == static_cast<size_t>(size),
+              "needs one split size per rank");
+  TORCH_CHECK(dipu::isDeviceTensor(flat) && dipu::isDeviceTensor(part) &&
+                  flat.device() == part.device(),
+              "tensors must be on the same DIPU device");
+  TORCH_CHECK(flat.is_contiguous() && part.is_contiguous() && flat.dim() > 0 &&
+                  part.dim() == flat.dim() &&
+                  flat.scalar_type() == part.scalar_type(),
+              "tensors must be contiguous, with the same dtype and rank");
+  TORCH_CHECK(flat.sizes().slice(1) == part.sizes().slice(1),
+              "tensors must have the same rows");
+  TORCH_CHECK(
+      std::accumulate(splitSizes.begin(), splitSizes.end(), int64_t{0}) ==
+              flat.size(0) &&
+          splitSizes[rank] == part.size(0),
+      "split sizes don't match the rows of the tensors");
+  return static_cast<size_t>(c10::multiply_integers(flat.sizes().slice(1)));
+}
+
+}  // namespace
+
+c10::intrusive_ptr<Work> ProcessGroupDICL::allgatherV(
+    at::Tensor& output, at::Tensor& input,
+    const std::vector<int64_t>& splitSizes) {
+  const auto rowNumel = checkRowSplit(output, input, splitSizes, rank_, size_);
+  // an all-to-all in which every rank sends all its rows to every rank
+  std::vector<size_t> sendCounts(size_, static_cast<size_t>(input.numel()));
+  std::vector<size_t> sendDispls(size_);
+  std::vector<size_t> recvCounts(size_);
+  std::vector<size_t> recvDispls(size_);
+  for (int i = 0; i < size_; ++i) {
+    recvCounts[i] = static_cast<size_t>(splitSizes[i]) * rowNumel;
+    recvDispls[i] = i == 0 ? 0 : recvDispls[i - 1] + recvCounts[i - 1];
+  }
+
+  // the output is the same on all ranks, unlike the input
+  auto outputs = std::vector<at::Tensor>{output};
+  return collective(
+      outputs, outputs,
+      [&](at::Tensor& /*unused*/, at::Tensor& gathered, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclAllgatherV", std::vector<c10::IValue>({input}));
+        profile::RecordBlockCreator _("DiclAllgatherV", stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        dipu::recordStream(input, stream);
+        return devproxy::diclAllToAllv(
+            input.data_ptr(), sendCounts.data(), sendDispls.data(),
+            gathered.data_ptr(), recvCounts.data(), recvDispls.data(),
+            input.scalar_type(), size_, comm, stream.rawstream());
+      },
+      OpType::ALLGATHER);
+}
+
+c10::intrusive_ptr<Work> ProcessGroupDICL::reduceScatterV(
+    at::Tensor& output, at::Tensor& input,
+    const std::vector<int64_t>& splitSizes, const ReduceScatterOptions& opts) {
+  const auto rowNumel = checkRowSplit(input, output, splitSizes, rank_, size_);
+  // the reduction would run before the group
+  TORCH_CHECK(!coalescing_, "reduce_scatter_v can't be coalesced");
+  const auto op = opts.reduceOp;
+  TORCH_CHECK(op == c10d::ReduceOp::SUM || op == c10d::ReduceOp::AVG ||
+                  op == c10d::ReduceOp::PRODUCT || op == c10d::ReduceOp::MIN ||
+                  op == c10d::ReduceOp::MAX,
+              "reduce_scatter_v doesn't support this reduce op");
+  // the rows of this rank of every rank arrive by an all-to-all, and are
+  // reduced on the comm stream
+  const auto numel = static_cast<size_t>(output.numel());
+  std::vector<size_t> sendCounts(size_);
+  std::vector<size_t> sendDispls(size_);
+  std::vector<size_t> recvCounts(size_, numel);
+  std::vector<size_t> recvDispls(size_);
+  for (int i = 0; i < size_; ++i) {
+    sendCounts[i] = static_cast<size_t>(splitSizes[i]) * rowNumel;
+    sendDispls[i] = i == 0 ? 0 : sendDispls[i - 1] + sendCounts[i - 1];
+    recvDispls[i] = i * numel;
+  }
+  auto received =
+      at::empty({size_, static_cast<int64_t>(numel)}, output.options());
+
+  // the input is the same on all ranks, unlike the output
+  auto inputs = std::vector<at::Tensor>{input};
+  return collective(
+      inputs, inputs,
+      [&](at::Tensor& sent, at::Tensor& /*unused*/, diclComm_t comm,
+          DIPUStream& stream) {
+        RECORD_FUNCTION("DiclReduceScatterV", std::vector<c10::IValue>({sent}));
+        profile::RecordBlockCreator _("DiclReduceScatterV", stream.rawstream(),
+                                      static_cast<int>(stream.id()));
+        dipu::recordStream(received, stream);
+        return devproxy::diclAllToAllv(
+            sent.data_ptr(), sendCounts.data(), sendDispls.data(),
+            received.data_ptr(), recvCounts.data(), recvDispls.data(),
+            sent.scalar_type(), size_, comm, stream.rawstream());
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {},
+      [&](std::vector<std::shared_ptr<DICLComm>>& diclComms) {
+        auto diclStream = diclComms[0]->diclStream_;
+        DIPUStreamGuard guard(diclStream.unwrap());
+        auto flat = output.view({-1});
+        if (op == c10d::ReduceOp::SUM) {
+          at::sum_out(flat, received, 0);
+        } else if (op == c10d::ReduceOp::AVG &&
+                   c10::isIntegralType(flat.scalar_type(),
+                                       /*includeBool=*/false)) {
+          // mean doesn't take integers, they truncate like ncclAvg does
+          at::sum_out(flat, received, 0);
+          flat.div_(size_, "trunc");
+        } else if (op == c10d::ReduceOp::AVG) {
+          at::mean_out(flat, received, 0);
+        } else if (op == c10d::ReduceOp::PRODUCT) {
+          at::prod_out(flat, received, 0);
+        } else if (op == c10d::ReduceOp::MIN) {
+          at::amin_out(flat, received, 0);
+        } else {
+          at::amax_out(flat, received, 0);
+        }
+        dipu::recordStream(output, diclStream);
+      },
+      OpType::REDUCE_SCATTER);
+}
+
 c10::intrusive_ptr<Work> ProcessGroupDICL::send(
     std::vector<at::Tensor>& tensors, int dstRank, int tag) {
-  checkDeviceTensors(tensors);
+  checkP2PTensors(tensors);
   auto p2pPair = mapPGRank2P2P(rank_, dstRank);
+  DICLComm* stagingComm = nullptr;
   return pointToPoint(
       tensors, tensors, dstRank,
       [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
@@ -706,18 +2114,31 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::send(
         RECORD_FUNCTION("diclSend", std::vector<c10::IValue>({input}));
         profile::RecordBlockCreator _("diclSend", stream.rawstream(),
                                       static_cast<int>(stream.id()));
+        // dense but permuted tensors are staged too, the peer reads the
+        // elements in logical order
+        auto sent = input;
+        if (!input.is_contiguous()) {
+          sent = p2pStagingBuffer(*stagingComm, input);
+          DIPUStreamGuard guard(stream.unwrap());
+          sent.copy_(input, true);
+        }
         return devproxy::diclSend(
-            input.data_ptr(), static_cast<size_t>(input.numel()),
-            input.scalar_type(), p2pPair.second, comm, stream.rawstream());
+            sent.data_ptr(), static_cast<size_t>(sent.numel()),
+            sent.scalar_type(), p2pPair.second, comm, stream.rawstream());
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& comms) {
+        stagingComm = comms[0].get();
       },
-      [](std::vector<std::shared_ptr<DICLComm>>&) {},
       [](std::vector<std::shared_ptr<DICLComm>>&) {}, OpType::SEND);
 }
 
 c10::intrusive_ptr<Work> ProcessGroupDICL::recv(
     std::vector<at::Tensor>& tensors, int srcRank, int tag) {
-  checkDeviceTensors(tensors);
+  checkP2PTensors(tensors);
+  TORCH_CHECK(at::has_internal_overlap(tensors[0]) != at::MemOverlap::Yes,
+              "DICL recv tensors must not have overlapping elements");
   auto p2pPair = mapPGRank2P2P(rank_, srcRank);
+  DICLComm* stagingComm = nullptr;
   return pointToPoint(
       tensors, tensors, srcRank,
       [&](at::Tensor& input, at::Tensor& output, diclComm_t comm,
@@ -725,11 +2146,30 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::recv(
         RECORD_FUNCTION("diclRecv", std::vector<c10::IValue>({input}));
         profile::RecordBlockCreator _("diclRecv", stream.rawstream(),
                                       static_cast<int>(stream.id()));
-        return devproxy::diclRecv(
-            input.data_ptr(), static_cast<size_t>(input.numel()),
-            input.scalar_type(), p2pPair.second, comm, stream.rawstream());
+        if (input.is_contiguous()) {
+          return devproxy::diclRecv(
+              input.data_ptr(), static_cast<size_t>(input.numel()),
+              input.scalar_type(), p2pPair.second, comm, stream.rawstream());
+        }
+        auto staged = p2pStagingBuffer(*stagingComm, input);
+        auto result = devproxy::diclRecv(
+            staged.data_ptr(), static_cast<size_t>(staged.numel()),
+            staged.scalar_type(), p2pPair.second, comm, stream.rawstream());
+        auto unpack = [input, staged, stream] {
+          DIPUStreamGuard guard(stream.unwrap());
+          input.copy_(staged, true);
+        };
+        // the recv of a group only runs once the group is launched
+        if (coalescing_) {
+          coalescedUnpacks_.emplace_back(std::move(unpack));
+        } else if (result == devapis::DICL_SUCCESS) {
+          unpack();
+        }
+        return result;
+      },
+      [&](std::vector<std::shared_ptr<DICLComm>>& comms) {
+        stagingComm = comms[0].get();
       },
-      [](std::vector<std::shared_ptr<DICLComm>>&) {},
       [](std::vector<std::shared_ptr<DICLComm>>&) {}, OpType::RECV);
 }
 
@@ -767,12 +2207,68 @@ c10::intrusive_ptr<Work> ProcessGroupDICL::barrier(const BarrierOptions& opts) {
   return work;
 }
 
+// NOLINTNEXTLINE(google-default-arguments)
+c10::intrusive_ptr<Work> ProcessGroupDICL::allreduce_coalesced(
+    std::vector<at::Tensor>& tensors, const AllreduceCoalescedOptions& opts) {
+  AllreduceOptions allreduceOpts;
+  allreduceOpts.reduceOp = opts.reduceOp;
+  allreduceOpts.timeout = opts.timeout;
+  return coalesced(
+      [&] {
+        for (auto& tensor : tensors) {
+          std::vector<at::Tensor> single{tensor};
+          allreduce(single, allreduceOpts);
+        }
+      },
+      tensors);
+}
+
+// NOLINTNEXTLINE(google-default-arguments)
+c10::intrusive_ptr<Work> ProcessGroupDICL::allgather_into_tensor_coalesced(
+    std::vector<at::Tensor>& outputs, std::vector<at::Tensor>& inputs,
+    const AllgatherOptions& opts) {
+  TORCH_CHECK(outputs.size() == inputs.size(),
+              "allgather_into_tensor_coalesced needs as many outputs as "
+              "inputs");
+  return coalesced(
+      [&] {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          _allgather_base(outputs[i], inputs[i], opts);
+        }
+      },
+      outputs);
+}
+
+#if DIPU_TORCH_VERSION != 20000
+// NOLINTNEXTLINE(google-default-arguments)
+c10::intrusive_ptr<Work> ProcessGroupDICL::reduce_scatter_tensor_coalesced(
+    std::vector<at::Tensor>& outputs, std::vector<at::Tensor>& inputs,
+    const ReduceScatterOptions& opts) {
+  TORCH_CHECK(outputs.size() == inputs.size(),
+              "reduce_scatter_tensor_coalesced needs as many outputs as "
+              "inputs");
+  return coalesced(
+      [&] {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          _reduce_scatter_base(outputs[i], inputs[i], opts);
+        }
+      },
+      outputs);
+}
+
+void ProcessGroupDICL::startCoalescing() { beginGroup(); }
+
+c10::intrusive_ptr<Work> ProcessGroupDICL::endCoalescing() {
+  return endGroup();
+}
+#endif
+
 c10::intrusive_ptr<ProcessGroupDICL> createProcessGroupDICL(
     const c10::intrusive_ptr<::c10d::Store>& store, int rank, int size,
     const std::chrono::milliseconds& timeout) {
   auto options = c10::make_intrusive<ProcessGroupDICL::Options>();
   options->timeout = timeout;
-  return c10::make_intrusive<ProcessGroupDICL>(store, rank, size);
+  return c10::make_intrusive<ProcessGroupDICL>(store, rank, size, timeout);
 }
 
 }  // namespace dipu
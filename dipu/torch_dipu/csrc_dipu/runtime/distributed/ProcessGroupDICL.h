@@ -1,8 +1,18 @@
 // Copyright (c) 2023, DeepLink.
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <c10/core/Device.h>
@@ -12,15 +22,20 @@
 
 #include "csrc_dipu/base/basedef.h"
 #include "csrc_dipu/runtime/core/DIPUEvent.h"
+#include "csrc_dipu/runtime/core/DIPUHostCallback.h"
 #include "csrc_dipu/runtime/core/DIPUStream.h"
 #include "csrc_dipu/vendor/vendorapi.h"
 
+#include "DICLFlightRecorder.hpp"
+#include "DICLStats.hpp"
 #include "DICLUtils.hpp"
 
 namespace dipu {
 
 using c10d::AllgatherOptions;
+using c10d::AllreduceCoalescedOptions;
 using c10d::AllreduceOptions;
+using c10d::AllToAllOptions;
 using c10d::Backend;
 using c10d::BarrierOptions;
 using c10d::BroadcastOptions;
@@ -28,13 +43,19 @@ using c10d::GatherOptions;
 using c10d::OpType;
 using c10d::ReduceOptions;
 using c10d::ReduceScatterOptions;
+using c10d::ScatterOptions;
 using c10d::Store;
 using c10d::Work;
 
 // Environment variable which controls whether or not wait() is blocking or
 // non-blocking.
 constexpr const char* DICL_BLOCKING_WAIT = "DICL_BLOCKING_WAIT";
-constexpr int64_t diclSyncBusyWaitMillis = 30;
+
+// Environment variable which controls whether the watchdog aborts the
+// communicators of a timed out work (1, the default) or only fails the work
+// (0). Without blocking wait nobody would see the failure, so the watchdog
+// then also tears down the process.
+constexpr const char* DICL_ASYNC_ERROR_HANDLING = "DICL_ASYNC_ERROR_HANDLING";
 
 /**
  * ProcessGroupDICL implements DICLbindings for c10d.
@@ -54,12 +75,39 @@ constexpr int64_t diclSyncBusyWaitMillis = 30;
  * calling either WorkDICL::wait() or WorkDICL::synchronize(), both achieves the
  * same functionality and are synonyms.
  *
- * @note Every single DICL or DIPU failure will simply raise std::runtime_error.
- * Therefore, WorkDICL::exception() is not supported, and WorkDICL::isSuccess()
- * will always return true if the operation has completed.
+ * The futures of the works are completed once the DICL calls are queued and
+ * are stream-aware like CUDAFuture, so DDP comm hooks run asynchronously.
+ *
+ * @note DICL or DIPU failures while queueing an op raise std::runtime_error.
+ *
+ * A watchdog thread per process group tracks the recorded works. It finishes
+ * them once they are done, which blocking waits sleep on if the vendor can't
+ * launch host callbacks. It fails the ones running longer than the timeout of
+ * the process group, and the ones whose communicators report an asynchronous
+ * error or were aborted, see DICL_ASYNC_ERROR_HANDLING. Failed works report
+ * it through isSuccess() and exception(), and throw it from wait().
+ *
+ * With DIPU_DICL_STATS, or once enabled from Python, the vendor calls of
+ * each op are timed by events on its comm stream, and the watchdog adds them
+ * to the collective stats of the process group as the works finish. Every
+ * DIPU_DICL_STATS_LOG_INTERVAL seconds, if set, it also logs them.
+ *
+ * The flight recorder keeps the last DIPU_DICL_FLIGHT_RECORDER_SIZE ops
+ * queued, with their state as the watchdog sees it. It is logged when a work
+ * fails or times out, on the signal DIPU_DICL_FLIGHT_RECORDER_SIGNAL if set,
+ * and can be read from Python, to tell which collective a hung rank is in.
  *
- * @warning Not supporting gather and all _coalesced functions now. We will add
- * them in the future if needed.
+ * With DIPU_DICL_DESYNC_CHECK_INTERVAL, the ranks sum a hash of the op types,
+ * shapes and dtypes of their collectives in the store every so many calls.
+ * The watchdog compares them, and collectives throw after a mismatch.
+ *
+ * The _coalesced functions and coalescing (e.g. batch_isend_irecv) put the
+ * DICL calls into one group, which is launched at once if the vendor
+ * implements diclGroupStart and diclGroupEnd, and call by call otherwise.
+ *
+ * gather and scatter, and the variable length allgatherV and reduceScatterV,
+ * are all-to-alls with zero counts for the pairs which exchange nothing. They
+ * need diclAllToAllv or DICL groups from the vendor.
  *
  * Example on using DICL process group:
  *
@@ -81,7 +129,10 @@ class DIPU_API ProcessGroupDICL : public Backend {
           blockingWait_(blockingWait),
           opTimeout_(opTimeout),
           workStartTime_(std::chrono::steady_clock::now()) {
-      workEvents_.resize(diclComms_.size());
+      workEvents_.reserve(diclComms_.size());
+      for (size_t i = 0; i < diclComms_.size(); ++i) {
+        workEvents_.emplace_back(devapis::EventFlags::DISABLE_TIMING);
+      }
     }
 
     ~WorkDICL() override = default;
@@ -95,6 +146,9 @@ class DIPU_API ProcessGroupDICL : public Backend {
 
     void record();
 
+    // Completes future_ with outputs_ on the comm streams
+    void markFutureCompleted();
+
     // Same as calling synchronize() for DICL work.
     bool wait(std::chrono::milliseconds timeout /* = kBackendDefaultTimeout */)
         override;
@@ -121,14 +175,47 @@ class DIPU_API ProcessGroupDICL : public Backend {
     // The DIPU events used to sync DICL work on comm stream
     std::vector<DIPUEvent> workEvents_;
 
+    // Set by host callbacks on the comm streams if blockingWait_ is on and
+    // the vendor supports them, so that synchronize() does not poll
+    DIPUCompletionNotifier notifier_;
+    bool notifierWatching_ = false;
+
     // Just checks whether DIPU execution has completed, without modifying
     // exception_ptr.
     bool finishedDICLExecutionInternal() const;
+
+    // Whether the work has been running longer than opTimeout_
+    bool timedOut() const;
+
+    // Returns false if the work is not finished within `timeout`
+    bool waitFinished(std::chrono::milliseconds timeout);
+
     bool barrier_ = false;
 
+    // Set once the watchdog tracks the work, then it finishes it
+    bool watched_ = false;
+
     // Clone of blockingWait_ from ProcessGroupDICL.
     bool blockingWait_ = false;
 
+    // The vendor calls of a timed op, ops in a group are not timed
+    struct Timing {
+      OpType opType = OpType::UNKNOWN;
+      uint64_t bytes = 0;
+      DIPUEvent start;
+      DIPUEvent end;
+      std::chrono::steady_clock::time_point queued;
+      // When the comm stream reached the op in steady clock nanoseconds, set
+      // by a host callback if the vendor supports them, 0 until then
+      std::shared_ptr<std::atomic<int64_t>> startedNs =
+          std::make_shared<std::atomic<int64_t>>(0);
+    };
+    // Set if collective stats are on when the op is queued
+    std::unique_ptr<Timing> timing_;
+
+    // In the flight recorder of the process group, 0 if not recorded
+    uint64_t flightRecordId_ = 0;
+
     // Clone of opTimeout_ from ProcessGroupHCCL.
     std::chrono::milliseconds opTimeout_;
 
@@ -158,7 +245,8 @@ class DIPU_API ProcessGroupDICL : public Backend {
   // on-demand when a collective runs. If another collective is executed later,
   // against a different set of devices, the process group creates another DICL
   // communicator. These DICL communicators are cached and reused if possible.
-  ProcessGroupDICL(const c10::intrusive_ptr<Store>& store, int rank, int size);
+  ProcessGroupDICL(const c10::intrusive_ptr<Store>& store, int rank, int size,
+                   std::chrono::milliseconds timeout = kBackendDefaultTimeout);
 
   ~ProcessGroupDICL() override;
 
@@ -184,6 +272,11 @@ class DIPU_API ProcessGroupDICL : public Backend {
       std::vector<at::Tensor>& inputs,
       const GatherOptions& opts /* = GatherOptions() */) override;
 
+  c10::intrusive_ptr<Work> scatter(
+      std::vector<at::Tensor>& outputs,
+      std::vector<std::vector<at::Tensor>>& inputs,
+      const ScatterOptions& opts /* = ScatterOptions() */) override;
+
   c10::intrusive_ptr<Work> allgather(
       std::vector<std::vector<at::Tensor>>& outputs,
       std::vector<at::Tensor>& inputs,
@@ -202,6 +295,17 @@ class DIPU_API ProcessGroupDICL : public Backend {
       at::Tensor& output, at::Tensor& input,
       const ReduceScatterOptions& opts /* = ReduceScatterOptions() */) override;
 
+  c10::intrusive_ptr<Work> alltoall_base(
+      at::Tensor& outputTensor, at::Tensor& inputTensor,
+      std::vector<int64_t>& outputSplitSizes,
+      std::vector<int64_t>& inputSplitSizes,
+      const AllToAllOptions& opts /* = AllToAllOptions() */) override;
+
+  c10::intrusive_ptr<Work> alltoall(
+      std::vector<at::Tensor>& outputTensors,
+      std::vector<at::Tensor>& inputTensors,
+      const AllToAllOptions& opts /* = AllToAllOptions() */) override;
+
   c10::intrusive_ptr<Work> send(std::vector<at::Tensor>& tensors, int dstRank,
                                 int tag) override;
 
@@ -211,12 +315,98 @@ class DIPU_API ProcessGroupDICL : public Backend {
   c10::intrusive_ptr<Work> barrier(
       const BarrierOptions& opts /* = BarrierOptions() */) override;
 
+  c10::intrusive_ptr<Work> allreduce_coalesced(
+      std::vector<at::Tensor>& tensors,
+      const AllreduceCoalescedOptions& opts /* = AllreduceCoalescedOptions() */)
+      override;
+
+  c10::intrusive_ptr<Work> allgather_into_tensor_coalesced(
+      std::vector<at::Tensor>& outputs, std::vector<at::Tensor>& inputs,
+      const AllgatherOptions& opts /* = AllgatherOptions() */) override;
+
+#if DIPU_TORCH_VERSION != 20000
+  c10::intrusive_ptr<Work> reduce_scatter_tensor_coalesced(
+      std::vector<at::Tensor>& outputs, std::vector<at::Tensor>& inputs,
+      const ReduceScatterOptions& opts /* = ReduceScatterOptions() */) override;
+
+  void startCoalescing() override;
+
+  c10::intrusive_ptr<Work> endCoalescing() override;
+#endif
+
   c10::intrusive_ptr<Store> getStore() { return this->store_; }
 
+  // Creates the collective communicators on `devices`, instead of at the
+  // first collective, for every comm stream and the hierarchical allreduce.
+  // With `warmup` a one element allreduce on each of them sets up their
+  // connections. All ranks must call it at the same point.
+  void eagerInit(const std::vector<at::Device>& devices, bool warmup);
+
+  // Splits the collective communicators of this group on the current device
+  // into those of `child`, instead of `child` exchanging unique ids through
+  // its store. The ranks passing the same `color` share communicators, in
+  // the order of `key`. All ranks of this group must call it at the same
+  // point, those in no new group with a null `child` and a negative `color`.
+  void splitInto(ProcessGroupDICL* child, int color, int key);
+
+  // As allreduce, but the caller keeps `tensors` alive until the work is
+  // done, so their use on the comm stream isn't recorded with the allocator
+  c10::intrusive_ptr<Work> allreduceOwned(std::vector<at::Tensor>& tensors,
+                                          const AllreduceOptions& opts);
+
+  // Allgathers `input` into `output`, rank i contributing splitSizes[i] rows.
+  // `output` has the rows of all ranks, in rank order.
+  c10::intrusive_ptr<Work> allgatherV(at::Tensor& output, at::Tensor& input,
+                                      const std::vector<int64_t>& splitSizes);
+
+  // Reduces `input` over the ranks and keeps the splitSizes[rank] rows of
+  // this rank in `output`. The rows of the rank are gathered from every rank
+  // and reduced on the comm stream.
+  c10::intrusive_ptr<Work> reduceScatterV(
+      at::Tensor& output, at::Tensor& input,
+      const std::vector<int64_t>& splitSizes, const ReduceScatterOptions& opts);
+
+  // Allgathers `input` of [m, k] into `gathered` of [size * m, k] and sets
+  // `output` to gathered @ `weight`. Each rank's rows go in `chunks` pieces,
+  // lowered until it divides m, and the matmul of a piece runs on the current
+  // stream while the next one is gathered.
+  c10::intrusive_ptr<Work> allgatherMatmul(at::Tensor& gathered,
+                                           at::Tensor& output,
+                                           const at::Tensor& input,
+                                           const at::Tensor& weight,
+                                           int64_t chunks);
+
+  // Reduce-scatters the rows of `input` @ `weight` into `output` of [m, n],
+  // `input` being [size * m, k]. As above, the matmul of each piece of rows
+  // overlaps the reduce-scatter of the previous one.
+  c10::intrusive_ptr<Work> matmulReduceScatter(
+      at::Tensor& output, const at::Tensor& input, const at::Tensor& weight,
+      int64_t chunks, const ReduceScatterOptions& opts);
+
+  // The ops timed so far, see DIPU_DICL_STATS
+  std::vector<CollectiveStats> collectiveStats() const {
+    return collectiveStats_.get();
+  }
+
+  void resetCollectiveStats() { collectiveStats_.reset(); }
+
+  // The last ops queued, see DIPU_DICL_FLIGHT_RECORDER_SIZE
+  std::vector<FlightRecord> flightRecords() const {
+    return flightRecorder_.dump();
+  }
+
  protected:
   // different device may need extend this func to do device specific check
   virtual void checkDeviceTensors(const std::vector<at::Tensor>& tensors);
 
+  // As checkDeviceTensors, but a single strided tensor is allowed too. It is
+  // packed into or unpacked from a contiguous staging buffer on the comm
+  // stream, so the current stream doesn't pay for it.
+  void checkP2PTensors(const std::vector<at::Tensor>& tensors);
+
+  // The staging buffer of a strided send or recv of `tensor` on `comm`
+  at::Tensor p2pStagingBuffer(DICLComm& comm, const at::Tensor& tensor);
+
   // Helper that broadcasts DICL clique ID to all ranks through the store
   virtual void broadcastUniqueID(commUniqueId* uniqueId,
                                  const std::string& storeKey, int commRank);
@@ -227,6 +417,37 @@ class DIPU_API ProcessGroupDICL : public Backend {
       const std::string& localCommsKey, const std::vector<at::Device>& devices,
       int commsRank, OpType opType);
 
+  // Whether allreduce can go through the node sub-communicators, see
+  // DIPU_DICL_HIERARCHICAL_ALLREDUCE
+  bool hierarchicalAllreduceEnabled() const;
+
+  // Creates the sub-communicators of `comm` if it has none yet
+  void initHierarchicalComms(DICLComm& comm);
+
+  // The comm stream of the next collective, it differs by op type or op by op
+  // if DIPU_DICL_COMM_STREAMS is more than 1
+  int collectiveCommStream(OpType opType) const;
+
+  // The communicators of the next collective on `devices`. With one device
+  // they are cached by device and stream, so no key is built for them after
+  // the first call.
+  std::vector<std::shared_ptr<DICLComm>>& collectiveComms(
+      const std::vector<at::Device>& devices, OpType opType);
+
+  // The communicators whose fusion buffers flatten the tensor lists of a
+  // collective on `tensors`, empty if the buffers are off or while coalescing
+  std::vector<std::shared_ptr<DICLComm>> fusionBufferComms(
+      const std::vector<at::Tensor>& tensors, OpType opType);
+
+  // Gets a DICL unique ID from rank 0 of the communicators
+  commUniqueId exchangeUniqueID(const std::string& localCommsKey,
+                                int commsRank, OpType opType);
+
+  // Creates and caches the communicators of `diclID`
+  std::vector<std::shared_ptr<DICLComm>>& createDICLComms(
+      const std::string& localCommsKey, const std::vector<at::Device>& devices,
+      int commsRank, OpType opType, commUniqueId diclID);
+
   template <typename Fn>
   c10::intrusive_ptr<Work> collective(std::vector<at::Tensor>& input,
                                       std::vector<at::Tensor>& output, Fn fn,
@@ -251,6 +472,58 @@ class DIPU_API ProcessGroupDICL : public Backend {
       const std::vector<at::Device>& devices, Fn fn, PreProcess pre,
       PostProcess post, OpType opType);
 
+  // Sets the result of `work`, its future is completed at once or at the end
+  // of the current group
+  void completeWork(const c10::intrusive_ptr<WorkDICL>& work,
+                    const std::vector<at::Tensor>& outputs,
+                    const std::vector<at::Device>& devices);
+
+  // Ops run until endGroup only queue their DICL calls into one group, their
+  // own works are not recorded
+  void beginGroup();
+
+  // Launches the group, the returned work covers all ops of the group
+  c10::intrusive_ptr<WorkDICL> endGroup(
+      const std::vector<at::Tensor>& outputs = {});
+
+  template <typename Fn>
+  c10::intrusive_ptr<Work> coalesced(Fn fn,
+                                     const std::vector<at::Tensor>& outputs);
+
+  // Hands a recorded work to the watchdog
+  void watch(const c10::intrusive_ptr<WorkDICL>& work);
+
+  void watchdogLoop();
+
+  // Fails a timed out work and aborts its communicators
+  void handleTimeout(WorkDICL& work);
+
+  // Fails `work`, whose communicators can't finish it, because of `reason`.
+  // With async error handling its communicators are aborted, and the process
+  // too unless wait() would notice.
+  void handleFailure(WorkDICL& work, const std::string& reason);
+
+  // Why the communicators of an unfinished `work` can't finish it, empty if
+  // they still may. `checked` caches the answers during one watchdog pass.
+  static std::string commFailure(
+      const WorkDICL& work,
+      std::unordered_map<const DICLComm*, std::string>& checked);
+
+  // Adds a finished timed work to collectiveStats_
+  void recordStats(WorkDICL& work);
+
+  // Adds a collective to the hash of this rank, and posts the hash to the
+  // store every DIPU_DICL_DESYNC_CHECK_INTERVAL collectives. Throws once a
+  // check found the ranks out of sync.
+  void trackDesync(const std::vector<at::Tensor>& inputs, OpType opType);
+
+  // Compares the posted hashes which all ranks have added to, called by the
+  // watchdog
+  void checkDesync();
+
+  // Logs the flight recorder, if enabled, with `why` it is dumped
+  void dumpFlightRecorder(const std::string& why) const;
+
   // The store is used to broadcast the DICL unique ID of rank 0.
   c10::intrusive_ptr<Store> store_;
 
@@ -284,6 +557,11 @@ class DIPU_API ProcessGroupDICL : public Backend {
   // Mutex to guard devDICLCommMap_.
   std::mutex devDICLCommMapLock_;
 
+  // The entries of devDICLCommsMap_ used by collectives on one device, at
+  // device index * DIPU_DICL_COMM_STREAMS + stream. Used by the thread
+  // issuing collectives only, as nextCommStream_.
+  std::vector<std::vector<std::shared_ptr<DICLComm>>*> singleDeviceComms_;
+
   // Device Indexes used for all collectives in this group
   std::set<int> usedDeviceIdxs_;
 
@@ -292,6 +570,51 @@ class DIPU_API ProcessGroupDICL : public Backend {
   bool blockingWait_ = false;
 
   std::chrono::milliseconds opTimeout_ = kBackendDefaultTimeout;
+
+  // Used by the next collective with the "roundrobin" stream policy
+  int nextCommStream_ = 0;
+
+  // Set between beginGroup and endGroup
+  bool coalescing_ = false;
+
+  // The communicators used by the ops of the current group
+  std::vector<std::shared_ptr<DICLComm>> coalescedComms_;
+
+  // The works of the ops of the current group, recorded at its end
+  std::vector<c10::intrusive_ptr<WorkDICL>> coalescedWorks_;
+
+  // Unpacks of strided recvs of the current group, queued after the group is
+  // launched
+  std::vector<std::function<void()>> coalescedUnpacks_;
+
+  // Whether failed works abort their communicators
+  bool asyncErrorHandling_ = true;
+
+  std::mutex watchdogMutex_;
+  std::condition_variable watchdogCV_;
+  // Guarded by `watchdogMutex_`
+  std::list<c10::intrusive_ptr<WorkDICL>> watchedWorks_;
+  bool watchdogStop_ = false;
+
+  std::thread watchdogThread_;
+
+  CollectiveStatsTable collectiveStats_;
+  // Only touched by the watchdog
+  std::chrono::steady_clock::time_point lastStatsLog_;
+
+  std::mutex desyncMutex_;
+  // Guarded by `desyncMutex_`. The collectives tracked so far and the hash of
+  // those since the last check.
+  uint64_t desyncOps_ = 0;
+  size_t desyncHash_ = 0;
+  // Guarded by `desyncMutex_`. The posted checks and the hash of this rank.
+  std::deque<std::pair<uint64_t, int64_t>> pendingDesyncChecks_;
+  // Guarded by `desyncMutex_`. Set once a check fails.
+  std::string desyncError_;
+
+  FlightRecorder flightRecorder_{flightRecorderSize()};
+  // Dump requests from the signal handler handled so far
+  uint64_t flightRecorderDumps_ = 0;
 };
 
 namespace dicl_hook {
@@ -143,6 +143,63 @@ std::tuple<at::Tensor, c10::intrusive_ptr<Work>> _reduce_scatter_base_dipu_(
   return {output_tensor, std::move(work)};
 }
 
+std::tuple<std::vector<at::Tensor>, c10::intrusive_ptr<Work>> alltoall_dipu_(
+    const at::TensorList& output_tensors, const at::TensorList& input_tensors,
+    const c10::intrusive_ptr<ProcessGroup>& process_group, int64_t timeout) {
+  auto output_tensors_vec = output_tensors.vec();
+  auto input_tensors_vec = input_tensors.vec();
+  auto work =
+      process_group->getBackend(dipu::DIPU_DEVICE_TYPE)
+          ->alltoall(output_tensors_vec, input_tensors_vec,
+                     AllToAllOptions{std::chrono::milliseconds(timeout)});
+  return {std::move(output_tensors_vec), std::move(work)};
+}
+
+c10::intrusive_ptr<Work> alltoall_base_dipu_(
+    at::Tensor& output, at::Tensor& input,
+    const c10::intrusive_ptr<ProcessGroup>& process_group,
+    std::vector<int64_t> output_split_sizes,
+    std::vector<int64_t> input_split_sizes, int64_t timeout) {
+  return process_group->getBackend(dipu::DIPU_DEVICE_TYPE)
+      ->alltoall_base(output, input, output_split_sizes, input_split_sizes,
+                      AllToAllOptions{std::chrono::milliseconds(timeout)});
+}
+
+c10::intrusive_ptr<Work> allreduce_coalesced_dipu_(
+    at::TensorList tensors,
+    const c10::intrusive_ptr<ProcessGroup>& process_group,
+    const c10::intrusive_ptr<ReduceOp>& reduce_op, int64_t timeout) {
+  auto tensor_vec = tensors.vec();
+  AllreduceCoalescedOptions opts;
+  opts.reduceOp = *reduce_op;
+  opts.timeout = std::chrono::milliseconds(timeout);
+  return process_group->getBackend(dipu::DIPU_DEVICE_TYPE)
+      ->allreduce_coalesced(tensor_vec, opts);
+}
+
+c10::intrusive_ptr<Work> allgather_into_tensor_coalesced_dipu_(
+    at::TensorList outputs, at::TensorList inputs,
+    const c10::intrusive_ptr<ProcessGroup>& process_group) {
+  auto output_vec = outputs.vec();
+  auto input_vec = inputs.vec();
+  return process_group->getBackend(dipu::DIPU_DEVICE_TYPE)
+      ->allgather_into_tensor_coalesced(output_vec, input_vec);
+}
+
+#if DIPU_TORCH_VERSION != 20000
+c10::intrusive_ptr<Work> reduce_scatter_tensor_coalesced_dipu_(
+    at::TensorList outputs, at::TensorList inputs,
+    const c10::intrusive_ptr<ProcessGroup>& process_group,
+    const c10::intrusive_ptr<ReduceOp>& reduce_op, int64_t timeout) {
+  auto output_vec = outputs.vec();
+  auto input_vec = inputs.vec();
+  return process_group->getBackend(dipu::DIPU_DEVICE_TYPE)
+      ->reduce_scatter_tensor_coalesced(
+          output_vec, input_vec,
+          ReduceScatterOptions{*reduce_op, std::chrono::milliseconds(timeout)});
+}
+#endif
+
 c10::intrusive_ptr<Work> gather_dipu_(
     const std::vector<std::vector<at::Tensor>>& output_tensors,
     const at::TensorList& input_tensors,
@@ -204,6 +261,15 @@ TORCH_LIBRARY_IMPL(c10d, DIPU_DEVICE_TYPE_MACRO, m) {
   m.impl("scatter_", scatter_dipu_);
   m.impl("reduce_scatter_", reduce_scatter_dipu_);
   m.impl("_reduce_scatter_base_", _reduce_scatter_base_dipu_);
+  m.impl("alltoall_", alltoall_dipu_);
+  m.impl("alltoall_base_", alltoall_base_dipu_);
+  m.impl("allreduce_coalesced_", allreduce_coalesced_dipu_);
+  m.impl("allgather_into_tensor_coalesced_",
+         allgather_into_tensor_coalesced_dipu_);
+#if DIPU_TORCH_VERSION != 20000
+  m.impl("reduce_scatter_tensor_coalesced_",
+         reduce_scatter_tensor_coalesced_dipu_);
+#endif
   m.impl("barrier", barrier_dipu);
 
   // not implement
@@ -1,11 +1,16 @@
 // Copyright (c) 2023, DeepLink.
 #include "csrc_dipu/base/basedef.h"
+#include "csrc_dipu/runtime/core/DIPUAffinity.h"
 #include "csrc_dipu/runtime/core/DIPUDeviceInfo.h"
 #include "csrc_dipu/runtime/core/DIPUEvent.h"
 #include "csrc_dipu/runtime/core/DIPUGeneratorImpl.h"
+#include "csrc_dipu/runtime/core/DIPUGraph.h"
 #include "csrc_dipu/runtime/core/DIPUGuard.h"
+#include "csrc_dipu/runtime/core/DIPUIpc.h"
+#include "csrc_dipu/runtime/core/DIPUPinnedStaging.h"
 #include "csrc_dipu/runtime/core/DIPUStream.h"
 #include "csrc_dipu/runtime/core/allocator/DIPUCachingAllocator.h"
 #include "csrc_dipu/runtime/devproxy/deviceproxy.h"
 #include "csrc_dipu/runtime/devproxy/diclproxy.h"
+#include "csrc_dipu/runtime/distributed/DICLBucketScheduler.hpp"
 #include "csrc_dipu/runtime/distributed/ProcessGroupDICL.h"
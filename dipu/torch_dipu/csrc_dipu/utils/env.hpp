@@ -1,6 +1,15 @@
 // Copyright (c) 2024, DeepLink.
 #pragma once
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 namespace dipu {
 
@@ -15,4 +24,118 @@ T get_env_or_default(const char* env_name, const T& default_value) {
   return value;
 }
 
+// Parses the whole of `str` into `value`. Unsigned integers are read as
+// signed and negative ones rejected, istream would wrap "-1" to the maximum.
+template <typename T>
+bool parse_config_value(const std::string& str, T& value) {
+  std::istringstream in(str);
+  if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T> &&
+                !std::is_same_v<T, bool>) {
+    long long signed_value = 0;
+    if (!(in >> signed_value) || signed_value < 0) {
+      return false;
+    }
+    value = static_cast<T>(signed_value);
+  } else if (!(in >> value)) {
+    return false;
+  }
+  return (in >> std::ws).eof();
+}
+
+// The settings which can be changed while running, by the name of the env
+// they start from. Values are passed as strings.
+class RuntimeConfigRegistry {
+ public:
+  struct Entry {
+    std::function<std::string()> get;
+    std::function<void(const std::string&)> set;
+  };
+
+  static RuntimeConfigRegistry& instance() {
+    static RuntimeConfigRegistry registry;
+    return registry;
+  }
+
+  void add(const std::string& name, Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[name] = std::move(entry);
+  }
+
+  std::string get(const std::string& name) const {
+    return find(name).get();
+  }
+
+  void set(const std::string& name, const std::string& value) const {
+    find(name).set(value);
+  }
+
+  std::map<std::string, std::string> values() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, std::string> result;
+    for (const auto& [name, entry] : entries_) {
+      result[name] = entry.get();
+    }
+    return result;
+  }
+
+ private:
+  Entry find(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(name);
+    if (it == entries_.end()) {
+      throw std::invalid_argument("unknown runtime config " + name);
+    }
+    return it->second;
+  }
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+};
+
+// A setting read from env `name` at start and changeable through the
+// registry later, get() is a relaxed atomic load and fine on hot paths.
+// Define it as a global, it must outlive the registry users.
+template <typename T>
+class RuntimeConfig {
+ public:
+  RuntimeConfig(const char* name, T default_value)
+      : value_(read_env(name, default_value)) {
+    RuntimeConfigRegistry::instance().add(
+        name, {[this]() {
+                 std::ostringstream out;
+                 out << get();
+                 return out.str();
+               },
+               [this, name](const std::string& str) {
+                 T value{};
+                 if (!parse_config_value(str, value)) {
+                   throw_invalid(name, str);
+                 }
+                 set(value);
+               }});
+  }
+  RuntimeConfig(const RuntimeConfig&) = delete;
+  RuntimeConfig& operator=(const RuntimeConfig&) = delete;
+
+  T get() const { return value_.load(std::memory_order_relaxed); }
+  void set(T value) { value_.store(value, std::memory_order_relaxed); }
+
+ private:
+  static T read_env(const char* name, T default_value) {
+    const char* env = std::getenv(name);
+    T value = default_value;
+    if (env != nullptr && !parse_config_value(env, value)) {
+      throw_invalid(name, env);
+    }
+    return value;
+  }
+
+  [[noreturn]] static void throw_invalid(const char* name,
+                                         const std::string& str) {
+    throw std::invalid_argument("invalid value " + str + " for " + name);
+  }
+
+  std::atomic<T> value_;
+};
+
 }  // namespace dipu
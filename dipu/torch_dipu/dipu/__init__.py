@@ -15,9 +15,20 @@ from .device import *
 from .random_dipu import *
 from .memory import *
 from .streams import *
+from .graphs import *
 from .tensor import *
 from .storages import *
+from .fallback import *
+from .op_latency import *
+from .runtime_config import *
+from .native_format import *
+from .dataloader import DevicePrefetcher
+from .kv_cache import PagedKVCache
+from .offload import offload_activations
+from .varlen import PackedSequences, varlen_attention
 from . import amp
+from . import serialization
+from . import metrics
 import torch_dipu
 from torch_dipu._C import NativeMemoryFormat
 from torch_dipu._C import native_memory_format_cast
@@ -39,6 +50,9 @@ __all__ = [
     "get_device_name",
     "get_device_properties",
     "get_device_capability",
+    "get_device_link",
+    "get_device_numa_node",
+    "get_device_topology",
     "is_available",
     "is_initialized",
     "set_device",
@@ -54,6 +68,7 @@ __all__ = [
     "stream",
     "StreamContext",
     "Stream",
+    "ExternalStream",
     "Event",
     "is_current_stream_capturing",
     # random
@@ -75,15 +90,51 @@ __all__ = [
     "memory_reserved",
     "max_memory_allocated",
     "max_memory_reserved",
+    "MemPool",
+    "use_mem_pool",
+    "PagedKVCache",
+    "offload_activations",
+    "PackedSequences",
+    "varlen_attention",
+    "set_per_process_memory_fraction",
+    "set_per_process_memory_limit",
+    "get_per_process_memory_limit",
     "mem_get_info",  # "caching_allocator_alloc", "caching_allocator_delete", "memory_summary", "memory_stats"
+    # copy
+    "copy_many",
+    "pin_memory_batch",
+    "item_async",
+    "AsyncScalar",
+    "DevicePrefetcher",
+    # fallback
+    "fallback_stats",
+    "reset_fallback_stats",
+    # op latency
+    "op_latency_enabled",
+    "set_op_latency_enabled",
+    "op_latency_stats",
+    "reset_op_latency_stats",
+    # runtime config
+    "runtime_configs",
+    "get_runtime_config",
+    "set_runtime_config",
     # custom api
     "NativeMemoryFormat",
     "native_memory_format_cast",
     "get_native_memory_format",
-    # not support mock cuda_graph now
+    "cache_native_formats",
+    "clear_native_format_cache",
+    "LazyNativeFormatMode",
+    # graph
+    "CUDAGraph",
+    "graph",
+    "graph_pool_handle",
+    "is_graph_supported",
     "nvtx",
 ]
 
 import atexit
 
 atexit.register(release_all_resources)
+
+metrics._start_from_env()
@@ -35,6 +35,111 @@ def set_autocast_dipu_dtype(dtype):
     return _C.set_autocast_dipu_dtype(dtype)
 
 
+def set_persistent_cast_cache(enabled: bool) -> None:
+    r"""Keep the lower precision casts of the weights across autocast regions
+    run under ``torch.no_grad()`` or ``torch.inference_mode()``, so an inference
+    server casts them once rather than on every request. A weight is cast again
+    once it is modified in place. Disabling it drops the cached casts."""
+    _C._dipu_set_persistent_cast_cache_enabled(enabled)
+
+
+def is_persistent_cast_cache_enabled() -> bool:
+    return _C._dipu_persistent_cast_cache_enabled()
+
+
+def clear_persistent_cast_cache() -> None:
+    r"""Drop the casts kept by :func:`set_persistent_cast_cache`."""
+    _C._dipu_clear_persistent_cast_cache()
+
+
+def set_autocast_fp8_enabled(enabled: bool) -> None:
+    r"""Run ``mm`` and ``linear`` in float8 within autocast regions when the
+    vendor marks them fp8 (``kFp8``) and :func:`is_fp8_supported`. Each input
+    is cast to e4m3 with a scale from its own amax, see
+    :class:`Fp8DelayedScaling` for scales from the amax history instead.
+
+    ``torch._scaled_mm`` has no backward, so calls with an input that
+    requires grad while grad mode is on run in the lower precision type
+    instead, i.e. float8 only speeds up inference."""
+    _C._dipu_set_fp8_autocast_enabled(enabled)
+
+
+def is_autocast_fp8_enabled() -> bool:
+    return _C._dipu_fp8_autocast_enabled()
+
+
+def is_fp8_supported() -> bool:
+    r"""Whether the device runs float8 matmuls, i.e. ``torch._scaled_mm``."""
+    return _C._dipu_is_fp8_matmul_supported()
+
+
+class Fp8DelayedScaling:
+    r"""Scale of the float8 casts of one tensor, e.g. the input or the weight
+    of a linear layer, from the largest amax of its last ``history_len``
+    casts, so that casting needs no sync and no extra pass over the tensor.
+    ``margin`` leaves room for growth, as a power of 2.
+
+    Example::
+
+        x_scaling, w_scaling = Fp8DelayedScaling(), Fp8DelayedScaling()
+        for x in batches:
+            y = scaled_mm(x, weight.t(), x_scaling, w_scaling)
+    """
+
+    def __init__(
+        self,
+        dtype: torch.dtype = None,
+        history_len: int = 16,
+        margin: int = 0,
+        device=None,
+    ):
+        self.dtype = torch.float8_e4m3fn if dtype is None else dtype
+        self.fp8_max = torch.finfo(self.dtype).max
+        self.margin = margin
+        device = torch.device(dipu.diputype) if device is None else device
+        self.amax_history = torch.zeros(history_len, device=device)
+        self.scale = torch.ones((), device=device)
+
+    def update(self, amax: torch.Tensor) -> None:
+        self.amax_history = torch.roll(self.amax_history, 1)
+        self.amax_history[0] = amax
+        amax = self.amax_history.max()
+        scale = self.fp8_max / amax / 2**self.margin
+        # keeps the last scale until a non-zero amax is seen
+        self.scale = torch.where(amax > 0, scale, self.scale)
+
+    def cast(self, x: torch.Tensor):
+        r"""``x`` in float8 and the inverse of its scale, updating the
+        history with the amax of ``x``."""
+        inv_scale = self.scale.reciprocal()
+        y = (x.float() * self.scale).clamp(-self.fp8_max, self.fp8_max)
+        self.update(x.abs().max().float())
+        return y.to(self.dtype), inv_scale
+
+
+def scaled_mm(
+    a: torch.Tensor,
+    b: torch.Tensor,
+    a_scaling: Fp8DelayedScaling,
+    b_scaling: Fp8DelayedScaling,
+    bias: torch.Tensor = None,
+    out_dtype: torch.dtype = torch.float16,
+) -> torch.Tensor:
+    r"""``a @ b + bias`` in float8 by ``torch._scaled_mm``, with the scales of
+    ``a`` and ``b`` tracked by ``a_scaling`` and ``b_scaling``."""
+    a, scale_a = a_scaling.cast(a)
+    b, scale_b = b_scaling.cast(b)
+    out, _ = torch._scaled_mm(
+        a,
+        b.t().contiguous().t(),
+        bias=bias,
+        out_dtype=out_dtype,
+        scale_a=scale_a,
+        scale_b=scale_b,
+    )
+    return out
+
+
 # bf16 is not supported by default.
 # This function needs to be improved in the future and customized for different device.
 def is_bf16_supported():
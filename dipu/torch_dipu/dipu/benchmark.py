@@ -0,0 +1,97 @@
+# Copyright (c) 2024, DeepLink.
+import json
+import os
+import time
+from typing import Any, Dict, List
+
+import torch
+
+from .device import synchronize
+from .fallback import fallback_stats
+from .memory import max_memory_allocated, max_memory_reserved
+
+# Set by the CI benchmark mode, see scripts/ci/ci_run_one_iter.py. Steps are
+# counted by optimizer steps, a model without optimizer is not timed.
+_ITERS_ENV = "DIPU_BENCHMARK_ITERS"
+_WARMUP_ENV = "DIPU_BENCHMARK_WARMUP"
+_REPORT_ENV = "DIPU_BENCHMARK_REPORT"
+_BATCH_SIZE_ENV = "DIPU_BENCHMARK_BATCH_SIZE"
+
+
+def _percentile(sorted_values: List[float], q: float) -> float:
+    index = min(int(q * len(sorted_values)), len(sorted_values) - 1)
+    return sorted_values[index]
+
+
+def _rank() -> int:
+    for name in ("RANK", "SLURM_PROCID"):
+        if name in os.environ:
+            return int(os.environ[name])
+    return 0
+
+
+def step_report(
+    step_times: List[float], warmup: int, startup: float, batch_size: int = 0
+) -> Dict[str, Any]:
+    r"""Metrics of a run from the wall time of each step, the first
+    ``warmup`` steps are left out of the timing. ``startup`` is the time from
+    loading torch_dipu to the end of the first step, which also counts as the
+    first step in ``step_times``.
+    """
+    timed = sorted(step_times[warmup:])
+    mean = sum(timed) / len(timed)
+    p50 = _percentile(timed, 0.5)
+    report = {
+        "steps": len(timed),
+        "step_time_mean_s": mean,
+        "step_time_p50_s": p50,
+        "step_time_p90_s": _percentile(timed, 0.9),
+        "step_time_p99_s": _percentile(timed, 0.99),
+        "steps_per_s": 1.0 / mean,
+        "startup_s": startup,
+        # Time of the warm-up steps after the first beyond normal steps,
+        # mostly compiling graphs and growing the allocator cache
+        "compile_s": max(
+            0.0, sum(step_times[1:warmup]) - max(warmup - 1, 0) * p50
+        ),
+        "peak_allocated_bytes": max_memory_allocated(),
+        "peak_reserved_bytes": max_memory_reserved(),
+        "fallback_calls": sum(item["calls"] for item in fallback_stats()),
+    }
+    if batch_size > 0:
+        report["samples_per_s"] = batch_size / mean
+    return report
+
+
+def apply_benchmark_patch():
+    r"""Time ``DIPU_BENCHMARK_WARMUP`` (3 by default) plus
+    ``DIPU_BENCHMARK_ITERS`` optimizer steps, write :func:`step_report` of
+    them as JSON to ``DIPU_BENCHMARK_REPORT`` on rank 0 and exit. It does
+    nothing unless ``DIPU_BENCHMARK_ITERS`` is set.
+    """
+    iters = int(os.environ.get(_ITERS_ENV, "0"))
+    if iters <= 0:
+        return
+    warmup = int(os.environ.get(_WARMUP_ENV, "3"))
+    batch_size = int(os.environ.get(_BATCH_SIZE_ENV, "0"))
+    report_path = os.environ.get(_REPORT_ENV, "benchmark.json")
+    start = time.perf_counter()
+    step_times = []
+    last_end = [start]
+
+    def hook(optimizer, args, kwargs):
+        # The step is done once the device is
+        synchronize()
+        now = time.perf_counter()
+        step_times.append(now - last_end[0])
+        last_end[0] = now
+        if len(step_times) < warmup + iters:
+            return
+        if _rank() == 0:
+            report = step_report(step_times, warmup, step_times[0], batch_size)
+            with open(report_path, "w") as f:
+                json.dump(report, f, indent=2)
+        # Every rank stops at the same step, so no collective is left waiting
+        raise SystemExit(0)
+
+    torch.optim.optimizer.register_optimizer_step_post_hook(hook)
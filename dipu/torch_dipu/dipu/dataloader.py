@@ -1,5 +1,13 @@
+import collections
+import os
+import threading
+
 import torch
-from torch.utils.data import DataLoader, Sampler, Dataset
+from torch.utils._pytree import tree_flatten, tree_unflatten
+from torch.utils.data import DataLoader, Sampler, Dataset, _utils
+
+from torch_dipu import _C
+from .tensor import pin_memory_batch
 
 from typing import Any, Callable, Iterable, TypeVar, Sequence, List, Optional, Union
 
@@ -69,5 +77,115 @@ class DIPUDataLoader(DataLoader):
         )
 
 
+_torch_pin_memory_loop = _utils.pin_memory._pin_memory_loop
+
+
+def _pin_memory_threads():
+    return max(int(os.environ.get("DIPU_PIN_MEMORY_THREADS", "1")), 1)
+
+
+def _pin_memory_loop(in_queue, out_queue, device_id, *args, **kwargs):
+    def loop():
+        # the batches are pinned on the NUMA node of the device when
+        # DIPU_HOST_NUMA_LOCAL is set, DIPU_BIND_THREAD_AFFINITY also keeps the
+        # thread next to them
+        if isinstance(device_id, int):
+            _C._dipu_bind_thread_to_device(device_id)
+        _torch_pin_memory_loop(in_queue, out_queue, device_id, *args, **kwargs)
+
+    # DIPU_PIN_MEMORY_THREADS threads pin batches from the same queue, the
+    # DataLoader puts the batches back in order as it does for the workers
+    helpers = [
+        threading.Thread(target=loop, daemon=True)
+        for _ in range(_pin_memory_threads() - 1)
+    ]
+    for helper in helpers:
+        helper.start()
+    try:
+        loop()
+    finally:
+        # they all stop once the DataLoader sets the done event
+        for helper in helpers:
+            helper.join()
+
+
+class DevicePrefetcher:
+    r"""Iterates over ``loader`` with the tensors of each batch already on
+    ``device``, the current device by default. The copies of the next
+    ``depth`` batches run on a high priority side stream while the current
+    one is used, so that a model doesn't wait for its inputs.
+
+    CPU tensors not pinned yet, e.g. of a loader without ``pin_memory=True``,
+    are pinned together first, since copies from pageable memory block the
+    host. The device memory is allocated on the side stream, and handed to
+    the current stream once it waited for the copies.
+
+    Example::
+
+        for inputs, targets in DevicePrefetcher(loader):
+            loss = criterion(model(inputs), targets)
+    """
+
+    def __init__(self, loader, device=None, depth=1):
+        from torch_dipu import dipu
+
+        self.loader = loader
+        if device is None:
+            device = torch.device(dipu.diputype, dipu.current_device())
+        self.device = torch.device(device)
+        self.depth = max(depth, 1)
+
+    def __len__(self):
+        return len(self.loader)
+
+    def _copy(self, batch, stream):
+        from torch_dipu import dipu
+
+        if any(
+            isinstance(leaf, torch.Tensor)
+            and leaf.device.type == "cpu"
+            and not leaf.is_pinned()
+            for leaf in tree_flatten(batch)[0]
+        ):
+            batch = pin_memory_batch(batch)
+        leaves, spec = tree_flatten(batch)
+        with dipu.stream(stream):
+            leaves = [
+                leaf.to(self.device, non_blocking=True)
+                if isinstance(leaf, torch.Tensor)
+                else leaf
+                for leaf in leaves
+            ]
+        return tree_unflatten(leaves, spec), stream.record_event()
+
+    def _ready(self, batch, event):
+        from torch_dipu import dipu
+
+        current = dipu.current_stream(self.device)
+        current.wait_event(event)
+        for leaf in tree_flatten(batch)[0]:
+            if isinstance(leaf, torch.Tensor) and leaf.device == self.device:
+                # not reused by the side stream before the model is done
+                leaf.record_stream(current)
+        return batch
+
+    def __iter__(self):
+        from torch_dipu import dipu
+
+        with dipu.devicectx(self.device):
+            stream = dipu.Stream(priority=-1)
+        pending = collections.deque()
+        for batch in self.loader:
+            pending.append(self._copy(batch, stream))
+            if len(pending) > self.depth:
+                yield self._ready(*pending.popleft())
+        while pending:
+            yield self._ready(*pending.popleft())
+
+
 def apply_dataloader_patch():
     torch.utils.data.DataLoader = DIPUDataLoader
+    # the DataLoader looks the loop up when it starts the pin_memory thread
+    _utils.pin_memory._pin_memory_loop = _pin_memory_loop
+    # the pin_memory thread pins each batch into a single pinned region
+    _utils.pin_memory.pin_memory = pin_memory_batch
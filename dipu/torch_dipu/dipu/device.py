@@ -1,6 +1,6 @@
 # Copyright (c) 2023, DeepLink.
 from functools import partial
-from typing import Optional, Tuple, Union
+from typing import Any, Dict, Optional, Tuple, Union
 
 import torch
 
@@ -263,8 +263,48 @@ class device_of(devicectx):
 
 
 # device properties.
-def can_device_access_peer():
-    return False
+def can_device_access_peer(device: _device_t, peer_device: _device_t) -> bool:
+    r"""Checks if peer access between two devices is possible."""
+    _lazy_init()
+    device = _get_device_index(device, optional=True)
+    peer_device = _get_device_index(peer_device)
+    if device < 0 or device >= device_count():
+        raise AssertionError("Invalid device id")
+    if peer_device < 0 or peer_device >= device_count():
+        raise AssertionError("Invalid peer device id")
+    return _C._dipu_can_device_access_peer(device, peer_device)
+
+
+def get_device_link(device: _device_t, peer_device: _device_t) -> Tuple[str, float]:
+    r"""How ``device`` reaches memory on ``peer_device``: the link type, one of
+    "unknown", "host", "pcie", "device_link" (e.g. NVLink, HCCS or MLU-Link)
+    and "same_device", and its one way bandwidth in GB/s, 0 if unknown.
+    """
+    _lazy_init()
+    device = _get_device_index(device, optional=True)
+    peer_device = _get_device_index(peer_device)
+    if device < 0 or device >= device_count():
+        raise AssertionError("Invalid device id")
+    if peer_device < 0 or peer_device >= device_count():
+        raise AssertionError("Invalid peer device id")
+    return _C._dipu_get_device_link(device, peer_device)
+
+
+def get_device_numa_node(device: Optional[_device_t] = None) -> int:
+    r"""The NUMA node of the host ``device`` is attached to, -1 if unknown."""
+    _lazy_init()
+    return _C._dipu_get_device_numa_node(_get_device_index(device, optional=True))
+
+
+def get_device_topology() -> Dict[str, Any]:
+    r"""The ``numa_nodes`` of all local devices, and the ``links`` between
+    them as a matrix of :func:`get_device_link` results.
+    """
+    count = device_count()
+    return {
+        "numa_nodes": [get_device_numa_node(i) for i in range(count)],
+        "links": [[get_device_link(i, j) for j in range(count)] for i in range(count)],
+    }
 
 
 def get_device_name(device: Optional[_device_t] = None) -> str:
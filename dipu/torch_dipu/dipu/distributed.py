@@ -9,7 +9,11 @@ from torch.distributed import (
     ProcessGroup,
     ProcessGroupGloo,
 )
-from typing import Any, Optional, Union
+from typing import Any, Dict, List, Optional, Union
+import functools
+import inspect
+import os
+import zlib
 
 from torch_dipu import mockcuda
 from torch_dipu import dipu
@@ -19,8 +23,28 @@ dicl_backend = _C.dicl_backend
 ProcessGroupDICL = _C.ProcessGroupDICL
 
 
+# 1 creates the communicators of every new dicl process group at once instead
+# of at its first collective, 2 also runs a warm-up allreduce on them
+_eager_init = int(os.environ.get("DIPU_DICL_EAGER_INIT", "0"))
+
+
+# 0 makes new groups exchange unique ids through their stores even if the
+# vendor can split communicators
+_comm_split = int(os.environ.get("DIPU_DICL_COMM_SPLIT", "1"))
+
+# The default dicl backend and the color of the group new_group creates from
+# it by splitting
+_split_parent: Optional[ProcessGroupDICL] = None
+_split_color = -1
+
+
 def reg_dicl(store, rank, size, timeout):
-    return ProcessGroupDICL(store, rank, size, timeout)
+    global _split_parent
+    pg = ProcessGroupDICL(store, rank, size, timeout)
+    if _split_parent is not None:
+        parent, _split_parent = _split_parent, None
+        parent._split_into(pg, _split_color, dist.get_rank())
+    return pg
 
 
 if dipu.get_dipu_torch_version() == dipu.torch_ver_200:
@@ -31,6 +55,228 @@ else:
     )
 
 
+def dicl_stats_enabled() -> bool:
+    r"""Whether dicl process groups time their ops, ``DIPU_DICL_STATS`` at
+    start.
+    """
+    return _C._dipu_dicl_stats_enabled()
+
+
+def set_dicl_stats_enabled(enabled: bool) -> None:
+    r"""Start or stop timing the ops of all dicl process groups, the stats
+    recorded so far are kept. Ops queued while it's off are not timed.
+    """
+    _C._dipu_set_dicl_stats_enabled(enabled)
+
+
+def dicl_buffer_registration_enabled() -> bool:
+    r"""Whether the device memory is registered with the dicl communicators,
+    set by ``DIPU_DICL_REGISTER_BUFFERS=1`` if the vendor supports it.
+    """
+    return _C._dipu_dicl_buffer_registration_enabled()
+
+
+def dicl_comm_split_supported() -> bool:
+    r"""Whether the vendor can split communicators. New dicl groups are then
+    split from the default group without store round trips, unless
+    ``DIPU_DICL_COMM_SPLIT=0``.
+    """
+    return _C._dipu_dicl_comm_split_supported()
+
+
+def _dicl_of(group: Optional[ProcessGroup]) -> ProcessGroupDICL:
+    pg = group or dist.distributed_c10d._get_default_group()
+    return pg._get_backend(torch.device("cuda" if mockcuda else dipu.diputype))
+
+
+def collective_stats(
+    group: Optional[ProcessGroup] = None, gather_skew: bool = False
+) -> List[Dict[str, Any]]:
+    r"""Stats of the ops of the dicl backend of ``group`` timed on this rank,
+    the default group if None. Each item has the ``op``, its ``calls``, total
+    ``bytes``, ``device_ms`` and ``max_device_ms`` timed by events on the
+    comm stream, ``algbw_gbps`` and ``busbw_gbps`` as nccl-tests computes
+    them, and ``queue_ms`` / ``max_queue_ms`` from queueing to the comm
+    stream reaching the ops, summed over ``queued_calls`` (0 if the vendor
+    can't run host callbacks).
+
+    With ``gather_skew`` all ranks of ``group`` must call it together. It
+    adds ``rank_device_ms``, the ``device_ms`` of every rank, and ``skew_ms``,
+    how much longer this rank took than the fastest one. Ranks arriving early
+    wait inside the collectives, so the straggler has the least skew.
+    """
+    stats = _dicl_of(group).collective_stats()
+    if gather_skew:
+        gathered = [None] * dist.get_world_size(group)
+        local = {item["op"]: item["device_ms"] for item in stats}
+        dist.all_gather_object(gathered, local, group=group)
+        for item in stats:
+            per_rank = [times.get(item["op"], 0.0) for times in gathered]
+            item["rank_device_ms"] = per_rank
+            item["skew_ms"] = item["device_ms"] - min(per_rank)
+    return stats
+
+
+def reset_collective_stats(group: Optional[ProcessGroup] = None) -> None:
+    r"""Clear the stats returned by :func:`collective_stats`."""
+    _dicl_of(group).reset_collective_stats()
+
+
+def flight_records(group: Optional[ProcessGroup] = None) -> List[Dict[str, Any]]:
+    r"""The last ops the dicl backend of ``group`` queued on this rank, oldest
+    first, up to ``DIPU_DICL_FLIGHT_RECORDER_SIZE``. Each item has the ``id``
+    of the op, the same on all ranks, the ``op``, ``numel`` and ``dtype`` of
+    its first input, ``bytes``, ``queued_us`` since the epoch, the ``comm``
+    key and its ``state``: queued, started, completed or failed. Compare the
+    last completed ids of all ranks to find the ones stuck.
+    """
+    return _dicl_of(group).flight_records()
+
+
+def all_gather_v(
+    input: torch.Tensor,
+    split_sizes: List[int],
+    group: Optional[ProcessGroup] = None,
+    async_op: bool = False,
+):
+    r"""``all_gather_into_tensor`` of inputs with a different number of rows
+    on each rank, rank i having ``split_sizes[i]`` of them, without padding.
+    Returns the rows of all ranks in rank order, and the work too if
+    ``async_op``.
+    """
+    output = input.new_empty((sum(split_sizes), *input.shape[1:]))
+    work = _dicl_of(group).allgather_v(output, input, split_sizes)
+    if async_op:
+        return output, work
+    work.wait()
+    return output
+
+
+def reduce_scatter_v(
+    input: torch.Tensor,
+    split_sizes: List[int],
+    op=dist.ReduceOp.SUM,
+    group: Optional[ProcessGroup] = None,
+    async_op: bool = False,
+):
+    r"""``reduce_scatter_tensor`` of ``input`` into a different number of rows
+    on each rank, rank i keeping ``split_sizes[i]`` rows of the reduced
+    ``input``, which has all of them. Returns the rows of this rank, and the
+    work too if ``async_op``.
+    """
+    rank = dist.get_rank(group)
+    output = input.new_empty((split_sizes[rank], *input.shape[1:]))
+    work = _dicl_of(group).reduce_scatter_v(output, input, split_sizes, op)
+    if async_op:
+        return output, work
+    work.wait()
+    return output
+
+
+def allgather_matmul(
+    input: torch.Tensor,
+    weight: torch.Tensor,
+    chunks: int = 4,
+    group: Optional[ProcessGroup] = None,
+    async_op: bool = False,
+):
+    r"""``all_gather_into_tensor`` of ``input`` of [m, k] followed by a matmul
+    with ``weight`` of [k, n], as sequence parallel layers do. The rows of
+    each rank go in ``chunks`` pieces, and the matmul of a piece runs on the
+    current stream while the dicl backend of ``group`` gathers the next one.
+
+    Returns the gathered input of [world_size * m, k] and the product of
+    [world_size * m, n], and the work too if ``async_op``.
+    """
+    world_size = dist.get_world_size(group)
+    gathered = input.new_empty((world_size * input.size(0), input.size(1)))
+    output = input.new_empty((gathered.size(0), weight.size(1)))
+    work = _dicl_of(group).allgather_matmul(gathered, output, input, weight, chunks)
+    if async_op:
+        return gathered, output, work
+    work.wait()
+    return gathered, output
+
+
+def matmul_reduce_scatter(
+    input: torch.Tensor,
+    weight: torch.Tensor,
+    chunks: int = 4,
+    op=dist.ReduceOp.SUM,
+    group: Optional[ProcessGroup] = None,
+    async_op: bool = False,
+):
+    r"""The matmul of ``input`` of [world_size * m, k] with ``weight`` of
+    [k, n] followed by ``reduce_scatter_tensor`` of its rows. The matmul of
+    each of the ``chunks`` pieces of rows overlaps the reduce-scatter of the
+    previous one in the dicl backend of ``group``.
+
+    Returns the reduced rows of this rank, [m, n], and the work too if
+    ``async_op``.
+    """
+    world_size = dist.get_world_size(group)
+    output = input.new_empty((input.size(0) // world_size, weight.size(1)))
+    work = _dicl_of(group).matmul_reduce_scatter(output, input, weight, chunks, op)
+    if async_op:
+        return output, work
+    work.wait()
+    return output
+
+
+class GradBucketScheduler:
+    r"""Averages the gradients of ``params`` over ``group`` in buckets of up
+    to ``bucket_cap_mb``, as DDP does without its per bucket ``recordStream``.
+    The gradients become views of flat buckets in a memory pool of their own,
+    and each bucket is allreduced by the dicl backend as soon as all its
+    gradients are accumulated. Call :meth:`finalize` after each backward,
+    before the optimizer step.
+    """
+
+    def __init__(
+        self,
+        params,
+        group: Optional[ProcessGroup] = None,
+        bucket_cap_mb: float = 25,
+    ):
+        self.params = list(params)
+        self._scheduler = _C._DICLGradBucketScheduler(
+            _dicl_of(group), self.params, int(bucket_cap_mb * 1024 * 1024)
+        )
+        self._handles = []
+        # the hooks of torch 2.0 go on the grad accumulators, kept alive here
+        self._accumulators = []
+        for index, param in enumerate(self.params):
+            if param.requires_grad:
+                self._handles.append(self._register_ready_hook(param, index))
+
+    def _register_ready_hook(self, param, index):
+        mark_ready = self._scheduler.mark_ready
+        if hasattr(param, "register_post_accumulate_grad_hook"):
+            return param.register_post_accumulate_grad_hook(
+                lambda _: mark_ready(index)
+            )
+        accumulator = param.view_as(param).grad_fn.next_functions[0][0]
+        self._accumulators.append(accumulator)
+        return accumulator.register_hook(lambda *_: mark_ready(index))
+
+    def finalize(self) -> None:
+        r"""Zero the gradients not computed by the last backward, queue the
+        buckets left and make the current stream wait for all of them.
+        """
+        self._scheduler.finalize()
+
+    def bucket_indices(self) -> List[List[int]]:
+        r"""Indices in ``params`` of each bucket, in allreduce order."""
+        return self._scheduler.bucket_indices()
+
+    def remove(self) -> None:
+        r"""Remove the hooks, the gradients keep viewing the buckets."""
+        for handle in self._handles:
+            handle.remove()
+        self._handles.clear()
+        self._accumulators.clear()
+
+
 # distributed.BackendConfig has no power to do suitable 'device_backend_map' setting
 # so we use this patch to let cpu use gloo backend.
 _raw_register_backend = ProcessGroup._register_backend
@@ -51,6 +297,9 @@ def _wrapped_register_backend(self, device, backend_type, backend):
     # the original meaning of gloo pg which not support device tensor.
     _raw_register_backend(self, device, backend_type, backend)
 
+    if _eager_init > 0 and isinstance(backend, ProcessGroupDICL):
+        backend.eager_init(warmup=_eager_init > 1)
+
 
 # change nccl to internal used dicl, so existing model can keep nccl as backend name.
 _raw_init_process_group = dist.init_process_group
@@ -113,6 +362,45 @@ def _wrap_new_group(
     return _raw_new_group(ranks, timeout, backend, pg_options)
 
 
+def _wrap_new_group_split(raw_new_group):
+    # The split is collective over the default group: members split in
+    # reg_dicl and the other ranks before new_group, so that all of them
+    # split ahead of the barrier of new_group. The color comes from the
+    # ranks, as ranks may each pass different ones at once.
+    signature = inspect.signature(raw_new_group)
+
+    @functools.wraps(raw_new_group)
+    def new_group(*args, **kwargs):
+        global _split_parent, _split_color
+        bound = signature.bind(*args, **kwargs)
+        ranks = bound.arguments.get("ranks")
+        backend = bound.arguments.get("backend")
+        if (
+            ranks is None
+            or backend not in (None, dicl_backend)
+            or bound.arguments.get("use_local_synchronization", False)
+        ):
+            return raw_new_group(*args, **kwargs)
+        try:
+            parent = _dicl_of(None)
+        except RuntimeError:
+            parent = None
+        if not isinstance(parent, ProcessGroupDICL):
+            return raw_new_group(*args, **kwargs)
+        if dist.get_rank() not in ranks:
+            parent._split_into(None, -1, dist.get_rank())
+            return raw_new_group(*args, **kwargs)
+        members = ",".join(str(rank) for rank in sorted(set(ranks)))
+        _split_parent = parent
+        _split_color = zlib.crc32(members.encode()) & 0x7FFFFFFF
+        try:
+            return raw_new_group(*args, **kwargs)
+        finally:
+            _split_parent = None
+
+    return new_group
+
+
 def apply_dist_patch():
     dist.get_backend = _wrap_get_backend
     dist.init_process_group = _wrap_init_process_groups
@@ -123,3 +411,6 @@ def apply_dist_patch():
 
     if dipu.get_dipu_torch_version() == dipu.torch_ver_200:
         dist.new_group = _wrap_new_group
+    # torch 2.0 creates a dicl backend for the cpu too
+    elif _comm_split and dicl_comm_split_supported():
+        dist.new_group = _wrap_new_group_split(dist.new_group)
@@ -0,0 +1,20 @@
+# Copyright (c) 2024, DeepLink.
+from typing import Any, Dict, List
+
+from torch_dipu import _C
+
+__all__ = ["fallback_stats", "reset_fallback_stats"]
+
+
+def fallback_stats() -> List[Dict[str, Any]]:
+    r"""Per-op statistics of the CPU fallbacks so far, the most time consuming
+    first. Each item has the ``op`` name, the number of ``calls``, the
+    ``d2h_bytes`` and ``h2d_bytes`` moved between the device and the host, and
+    the wall time in ``seconds`` spent in the fallback.
+    """
+    return _C._dipu_fallback_stats()
+
+
+def reset_fallback_stats() -> None:
+    r"""Clear the statistics returned by :func:`fallback_stats`."""
+    _C._dipu_reset_fallback_stats()
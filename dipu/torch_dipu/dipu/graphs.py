@@ -0,0 +1,118 @@
+# Copyright (c) 2023, DeepLink.
+
+import gc
+from typing import Optional, Union
+
+from torch_dipu import _C
+from .device import synchronize
+from .memory import MemPool, empty_cache
+from .streams import Stream, StreamContext
+
+__all__ = [
+    "DIPUGraph",
+    "CUDAGraph",
+    "graph",
+    "graph_pool_handle",
+    "is_graph_supported",
+]
+
+
+def _pool_id(pool: Union[None, int, MemPool]) -> int:
+    if pool is None:
+        return 0
+    if isinstance(pool, MemPool):
+        return pool.id
+    return int(pool)
+
+
+def is_graph_supported() -> bool:
+    r"""Returns whether the vendor implements stream capture."""
+    return _C._dipu_is_stream_capture_supported()
+
+
+def graph_pool_handle() -> int:
+    r"""Returns an opaque token of a memory pool that can be shared between
+    graphs, see :class:`graph`."""
+    return _C._dipu_create_mem_pool()
+
+
+class DIPUGraph(_C._DIPUGraph):
+    r"""Wrapper around a dipu graph, see ``torch.cuda.CUDAGraph``.
+
+    .. warning::
+        Only vendors implementing the stream capture hooks support graphs,
+        check :func:`is_graph_supported` first.
+    """
+
+    def capture_begin(self, pool: Union[None, int, MemPool] = None):
+        r"""Begins capturing the work of the current stream, which must not be
+        the default stream. Memory allocated during capture comes from
+        ``pool`` when given, otherwise from a private pool of this graph.
+        """
+        super().capture_begin(pool=_pool_id(pool))
+
+    def capture_end(self):
+        super().capture_end()
+
+    def replay(self):
+        r"""Replays the captured work on the current stream."""
+        super().replay()
+
+    def reset(self):
+        r"""Deletes the graph, its pool is released when no graph uses it."""
+        super().reset()
+
+    def pool(self) -> int:
+        r"""Returns the token of this graph's memory pool, which can be passed
+        to another capture to share it."""
+        return super().pool()
+
+
+CUDAGraph = DIPUGraph
+
+
+class graph:
+    r"""Context-manager that captures the dipu work into a
+    :class:`DIPUGraph` for later replay, see ``torch.cuda.graph``.
+
+    Arguments:
+        dipu_graph (DIPUGraph): graph object used for capture.
+        pool (optional): token returned by :func:`graph_pool_handle` or
+            :meth:`DIPUGraph.pool` to share memory with other graphs.
+        stream (Stream, optional): the capture stream, a side stream shared
+            by all captures is used if not given.
+    """
+
+    default_capture_stream: Optional[Stream] = None
+
+    def __init__(
+        self,
+        dipu_graph: DIPUGraph,
+        pool: Union[None, int, MemPool] = None,
+        stream: Optional[Stream] = None,
+    ):
+        if self.__class__.default_capture_stream is None:
+            self.__class__.default_capture_stream = Stream()
+
+        self.pool = _pool_id(pool)
+        self.capture_stream = (
+            stream if stream is not None else self.__class__.default_capture_stream
+        )
+        assert self.capture_stream is not None
+        self.stream_ctx = StreamContext(self.capture_stream)
+        self.dipu_graph = dipu_graph
+
+    def __enter__(self):
+        # Free as much memory as we can before the graph takes its own pool
+        synchronize()
+        gc.collect()
+        empty_cache()
+
+        self.stream_ctx.__enter__()
+        self.dipu_graph.capture_begin(pool=self.pool)
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.dipu_graph.capture_end()
+        self.stream_ctx.__exit__(exc_type, exc_value, traceback)
+        # returning None should propagate exceptions from either capture_end
+        # or stream_ctx.__exit__()
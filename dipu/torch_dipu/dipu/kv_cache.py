@@ -0,0 +1,168 @@
+# Copyright (c) 2024, DeepLink.
+from typing import Dict, List, Optional, Sequence
+
+import torch
+
+from .device import __diputype__
+from .memory import MemPool, use_mem_pool
+
+
+class PagedKVCache:
+    r"""KV cache of LLM serving in blocks of ``block_size`` tokens. The
+    blocks of all layers are allocated at once from a private pool and handed
+    to the sequences from a free list, so that variable-length sequences
+    neither fragment the caching allocator nor reserve memory for their
+    longest possible length.
+
+    The keys of layer ``l`` are ``key_cache(l)`` of shape
+    ``[num_blocks, block_size, num_heads, head_dim]``, token ``i`` of a
+    sequence is in block ``block_table(seq)[i // block_size]`` at offset
+    ``i % block_size``. Blocks shared by :meth:`fork`, e.g. between the beams
+    of beam search, are copied when a sequence writes to them.
+
+    Example::
+
+        cache = PagedKVCache(num_layers, 1024, 16, num_heads, head_dim)
+        cache.allocate(seq, len(prompt))
+        slots = cache.slots(seq)  # where the keys of the prompt go
+        ...
+        slot = cache.append_slot(seq)  # where the next token goes
+        tables = cache.block_tables([seq, ...])
+        cache.free(seq)
+    """
+
+    def __init__(
+        self,
+        num_layers: int,
+        num_blocks: int,
+        block_size: int,
+        num_heads: int,
+        head_dim: int,
+        dtype: torch.dtype = torch.float16,
+        device=None,
+    ):
+        self.num_blocks = num_blocks
+        self.block_size = block_size
+        self.device = torch.device(__diputype__) if device is None else device
+        self.pool = MemPool()
+        with use_mem_pool(self.pool):
+            self.cache = torch.empty(
+                (num_layers, 2, num_blocks, block_size, num_heads, head_dim),
+                dtype=dtype,
+                device=self.device,
+            )
+        # Taken from the end, low blocks are handed out first
+        self._free_blocks = list(reversed(range(num_blocks)))
+        self._ref_counts = [0] * num_blocks
+        self._block_tables: Dict[int, List[int]] = {}
+        self._seq_lens: Dict[int, int] = {}
+
+    def key_cache(self, layer: int) -> torch.Tensor:
+        return self.cache[layer, 0]
+
+    def value_cache(self, layer: int) -> torch.Tensor:
+        return self.cache[layer, 1]
+
+    @property
+    def num_free_blocks(self) -> int:
+        return len(self._free_blocks)
+
+    def blocks_needed(self, num_tokens: int) -> int:
+        return -(-num_tokens // self.block_size)
+
+    def can_allocate(self, num_tokens: int) -> bool:
+        return self.blocks_needed(num_tokens) <= len(self._free_blocks)
+
+    def _take_block(self) -> int:
+        if not self._free_blocks:
+            raise RuntimeError("PagedKVCache: out of blocks")
+        block = self._free_blocks.pop()
+        self._ref_counts[block] = 1
+        return block
+
+    def _release_block(self, block: int):
+        self._ref_counts[block] -= 1
+        if self._ref_counts[block] == 0:
+            self._free_blocks.append(block)
+
+    def allocate(self, seq_id: int, num_tokens: int):
+        r"""Takes the blocks of a new sequence of ``num_tokens`` tokens."""
+        if seq_id in self._block_tables:
+            raise ValueError(f"PagedKVCache: sequence {seq_id} exists")
+        if not self.can_allocate(num_tokens):
+            raise RuntimeError("PagedKVCache: out of blocks")
+        self._block_tables[seq_id] = [
+            self._take_block() for _ in range(self.blocks_needed(num_tokens))
+        ]
+        self._seq_lens[seq_id] = num_tokens
+
+    def append_slot(self, seq_id: int) -> int:
+        r"""Adds a token to the sequence and returns its slot, the index of
+        its row in ``key_cache(l).view(-1, num_heads, head_dim)``. A new
+        block is taken when the last one is full, and the last block is
+        copied first when it is shared with other sequences."""
+        table = self._block_tables[seq_id]
+        length = self._seq_lens[seq_id]
+        offset = length % self.block_size
+        if offset == 0 and length // self.block_size == len(table):
+            table.append(self._take_block())
+        else:
+            last = table[-1]
+            if self._ref_counts[last] > 1:
+                block = self._take_block()
+                self.cache[:, :, block].copy_(self.cache[:, :, last])
+                self._release_block(last)
+                table[-1] = block
+        self._seq_lens[seq_id] = length + 1
+        return table[-1] * self.block_size + offset
+
+    def fork(self, parent_id: int, child_id: int):
+        r"""Makes ``child_id`` a copy of ``parent_id`` sharing its blocks."""
+        if child_id in self._block_tables:
+            raise ValueError(f"PagedKVCache: sequence {child_id} exists")
+        table = self._block_tables[parent_id]
+        for block in table:
+            self._ref_counts[block] += 1
+        self._block_tables[child_id] = list(table)
+        self._seq_lens[child_id] = self._seq_lens[parent_id]
+
+    def free(self, seq_id: int):
+        r"""Returns the blocks of the sequence not shared with others."""
+        for block in self._block_tables.pop(seq_id):
+            self._release_block(block)
+        del self._seq_lens[seq_id]
+
+    def seq_len(self, seq_id: int) -> int:
+        return self._seq_lens[seq_id]
+
+    def slots(self, seq_id: int) -> List[int]:
+        r"""Slots of all tokens of the sequence, see :meth:`append_slot`."""
+        table = self._block_tables[seq_id]
+        return [
+            table[i // self.block_size] * self.block_size + i % self.block_size
+            for i in range(self._seq_lens[seq_id])
+        ]
+
+    def block_tables(
+        self,
+        seq_ids: Sequence[int],
+        max_blocks: Optional[int] = None,
+        pad: int = 0,
+    ) -> torch.Tensor:
+        r"""The block tables of the sequences as an int32 tensor of shape
+        ``[len(seq_ids), max_blocks]`` on the device, padded with ``pad``,
+        e.g. for the ``block_table`` of paged attention kernels."""
+        tables = [self._block_tables[seq_id] for seq_id in seq_ids]
+        if max_blocks is None:
+            max_blocks = max((len(table) for table in tables), default=0)
+        rows = [table + [pad] * (max_blocks - len(table)) for table in tables]
+        return torch.tensor(rows, dtype=torch.int32).to(
+            self.device, non_blocking=True
+        )
+
+    def seq_lens(self, seq_ids: Sequence[int]) -> torch.Tensor:
+        r"""The lengths of the sequences as an int32 tensor on the device."""
+        lens = [self._seq_lens[seq_id] for seq_id in seq_ids]
+        return torch.tensor(lens, dtype=torch.int32).to(
+            self.device, non_blocking=True
+        )
@@ -1,6 +1,9 @@
 # Copyright (c) 2023, DeepLink.
 
 import collections
+import contextlib
+import json
+import pickle
 from typing import Union, Tuple
 from torch_dipu import _C
 from .device import (
@@ -125,6 +128,41 @@ def max_memory_allocated(device=None):
     return _C.max_memory_allocated(device)
 
 
+def set_per_process_memory_fraction(fraction, device=None) -> None:
+    r"""Limits the device memory the caching allocator of ``device`` may
+    hold to ``fraction`` of the device memory, which must be in (0, 1].
+    ``set_per_process_memory_limit(0)`` removes the limit.
+
+    Above ``DIPU_MEMORY_LIMIT_SOFT_RATIO`` (0.9 by default) of the limit the
+    allocator gives back idle cached memory, allocations which still don't
+    fit fail with an out of memory error. ``DIPU_PER_PROCESS_MEMORY_FRACTION``
+    sets the fraction of all devices at start.
+    """
+    if device is None:
+        device = current_device()
+    device = _get_device_index(device)
+    if not isinstance(fraction, float):
+        raise TypeError("Invalid type for fraction argument, must be `float`")
+    _C._dipu_set_memory_fraction(fraction, torch.device(__dipu__ + ":" + str(device)))
+
+
+def set_per_process_memory_limit(limit: int, device=None) -> None:
+    r"""Like :func:`set_per_process_memory_fraction`, with the limit in
+    bytes, 0 removes the limit."""
+    if device is None:
+        device = current_device()
+    device = _get_device_index(device)
+    _C._dipu_set_memory_limit(limit, torch.device(__dipu__ + ":" + str(device)))
+
+
+def get_per_process_memory_limit(device=None) -> int:
+    r"""Returns the memory limit in bytes of ``device``, 0 if there is none."""
+    if device is None:
+        device = current_device()
+    device = _get_device_index(device)
+    return _C._dipu_memory_limit(torch.device(__dipu__ + ":" + str(device)))
+
+
 def mem_get_info(device: Union[Device, int] = None) -> Tuple[int, int]:
     r"""Returns the global free and total DIPU memory occupied for a given
     device
@@ -148,23 +186,23 @@ def mem_get_info(device: Union[Device, int] = None) -> Tuple[int, int]:
     return (free, total)
 
 
-## just an empty shell now
 def memory_stats(device=None):
-    result = []
-
-    def _recurse_add_to_result(prefix, obj):
-        if isinstance(obj, dict):
-            if len(prefix) > 0:
-                prefix += "."
-            for k, v in obj.items():
-                _recurse_add_to_result(prefix + k, v)
-        else:
-            result.append((prefix, obj))
-
-    ## stats = memory_stats_as_nested_dict(device=device)
-    ## _recurse_add_to_result("", stats)
-    result.sort()
-    return collections.OrderedDict(result)
+    r"""Returns a dictionary of dipu memory allocator statistics for a
+    given device.
+
+    Besides the ``allocated_bytes``, ``reserved_bytes`` and ``allocation``
+    metrics shared with ``torch.cuda.memory_stats``, it contains the cache
+    hit/miss, split/merge, ``empty_cache`` and segment counters, the largest
+    free chunk and an allocation size histogram (``size_histogram.<lower
+    bound in bytes>.allocated/freed``).
+    """
+    if device is None:
+        device = current_device()
+    device = _get_device_index(device)
+    if not is_initialized():
+        return collections.OrderedDict()
+    stats = _C.memory_stats(torch.device(__dipu__ + ":" + str(device)))
+    return collections.OrderedDict(sorted(stats.items()))
 
 
 def _create_metrics_to_display():
@@ -254,10 +292,10 @@ def memory_summary(device=None, abbreviated=False):
         for submetric_key, submetric_name in submetrics:
             prefix = metric_key + "." + submetric_key + "."
 
-            current = stats[prefix + "current"]
-            peak = stats[prefix + "peak"]
-            allocated = stats[prefix + "allocated"]
-            freed = stats[prefix + "freed"]
+            current = stats.get(prefix + "current", 0)
+            peak = stats.get(prefix + "peak", current)
+            allocated = stats.get(prefix + "allocated", 0)
+            freed = stats.get(prefix + "freed", 0)
 
             if current_prefval is None:
                 current_prefval = current
@@ -283,5 +321,165 @@ def memory_summary(device=None, abbreviated=False):
     return "|" + "|\n|".join(lines).format(**fmt_dict) + "|\n"
 
 
+class MemPool:
+    r"""A private pool of the caching allocator. Device memory allocated
+    under :func:`use_mem_pool` is cached separately from the default pool
+    and can be released as a unit by :meth:`empty_cache`.
+
+    .. note::
+        Only the ``BF`` allocator supports private pools, other allocators
+        always use the default pool.
+    """
+
+    def __init__(self):
+        self._id = _C._dipu_create_mem_pool()
+
+    @property
+    def id(self) -> int:
+        return self._id
+
+    def empty_cache(self):
+        r"""Releases the unoccupied cached memory of this pool."""
+        if is_initialized():
+            _C._dipu_empty_mem_pool(self._id)
+
+
+@contextlib.contextmanager
+def use_mem_pool(pool: MemPool):
+    r"""A context manager routing the allocations of the current thread to
+    ``pool``."""
+    prev = _C._dipu_exchange_mem_pool(pool.id)
+    try:
+        yield
+    finally:
+        _C._dipu_exchange_mem_pool(prev)
+
+
+class AllocatorProfile:
+    r"""Peak bytes in use of each allocation size bin of the caching
+    allocator, recorded over e.g. one training step. Reserving memory for a
+    recorded profile by :meth:`warm_up` lets the following runs skip the
+    slow start where the allocator grows its segments step by step.
+
+    Example::
+
+        with AllocatorProfile() as profile:
+            train_step()
+        profile.save("profile.json")
+
+        # in a later run, before the first step
+        AllocatorProfile.load("profile.json").warm_up()
+
+    .. note::
+        Only the ``BF`` allocator reserves memory for a profile.
+    """
+
+    _VERSION = 1
+
+    def __init__(self, peak_bytes=None):
+        self.peak_bytes = list(peak_bytes or [])
+        self._device = None
+
+    def start(self, device=None):
+        self._device = _profile_device(device)
+        _C._dipu_start_allocator_profile(self._device)
+
+    def stop(self):
+        self.peak_bytes = _C._dipu_stop_allocator_profile(self._device)
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop()
+
+    def warm_up(self, device=None):
+        r"""Reserves the memory not cached yet for this profile."""
+        _C._dipu_reserve_for_allocator_profile(
+            _profile_device(device), self.peak_bytes
+        )
+
+    def save(self, path):
+        with open(path, "w") as f:
+            json.dump({"version": self._VERSION, "peak_bytes": self.peak_bytes}, f)
+
+    @classmethod
+    def load(cls, path):
+        with open(path) as f:
+            data = json.load(f)
+        if data.get("version") != cls._VERSION:
+            raise ValueError(f"unsupported allocator profile version in {path}")
+        return cls(data["peak_bytes"])
+
+
+def _profile_device(device):
+    if device is None:
+        device = current_device()
+    if isinstance(device, int):
+        device = torch.device(__dipu__ + ":" + str(device))
+    return torch.device(device)
+
+
+def _record_memory_history(enabled="all", stacks=None, max_entries=100000):
+    r"""Enables recording of allocator events (alloc, free and segment
+    map/unmap) into a ring buffer keeping the latest ``max_entries`` ones.
+
+    Arguments:
+        enabled: ``None`` or ``False`` stops recording, ``"state"`` too, as
+            only the segments and blocks :func:`_snapshot` always returns are
+            kept then, without the events or the stacks of the blocks. Any
+            other value starts a new recording.
+        stacks: whether to record the C++ backtrace of each event, which is
+            slow and should only be used for debugging.
+        max_entries (int): size of the ring buffer.
+    """
+    _C._dipu_record_memory_history(
+        bool(enabled) and enabled != "state", bool(stacks), max_entries
+    )
+
+
+def _snapshot(device=None):
+    r"""Returns a snapshot of all segments and blocks held by the dipu
+    allocators together with the recorded events, in the format of
+    ``torch.cuda.memory._snapshot()``, so that it can be viewed by
+    https://pytorch.org/memory_viz.
+    """
+    return _C._dipu_memory_snapshot()
+
+
+def _dump_snapshot(filename="dump_snapshot.pickle"):
+    r"""Saves :func:`_snapshot` to ``filename`` as a pickle."""
+    with open(filename, "wb") as f:
+        pickle.dump(_snapshot(), f)
+
+
+def _dump_allocation_trace(filename="allocation_trace.txt", device=None):
+    r"""Saves the allocations and frees recorded by
+    :func:`_record_memory_history` on ``device`` to ``filename`` as lines of
+    ``alloc <stream> <addr> <size>`` and ``free <addr>``, oldest first, which
+    ``tests/cpp/bench_allocator`` replays against the caching allocators.
+    """
+    device = _profile_device(device)
+    trace = _snapshot()["device_traces"][device.index]
+    with open(filename, "w") as f:
+        for event in trace:
+            if event["action"] == "alloc":
+                f.write(f"alloc {event['stream']} {event['addr']} {event['size']}\n")
+            elif event["action"] == "free_requested":
+                f.write(f"free {event['addr']}\n")
+
+
+def _attach_out_of_memory_observer(observer):
+    r"""Registers ``observer`` to be called as
+    ``observer(device, size, allocated, reserved)`` when the allocator is
+    about to fail an allocation of ``size`` bytes on ``device``, after it gave
+    back its cache. The observer may free memory, e.g. drop caches or offload
+    tensors, and the allocation is retried after it returns, up to
+    ``DIPU_OOM_RETRIES`` times (1 by default). Observers can't be removed.
+    """
+    _C._dipu_attach_out_of_memory_observer(observer)
+
+
 def reset_peak_memory_stats(device: Union[Device, int] = None) -> None:
     pass
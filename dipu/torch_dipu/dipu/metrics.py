@@ -0,0 +1,440 @@
+# Copyright (c) 2024, DeepLink.
+import http.server
+import math
+import os
+import re
+import threading
+import warnings
+from typing import Any, Callable, Dict, Iterable, List, Optional, Sequence, Tuple
+
+__all__ = [
+    "Counter",
+    "Gauge",
+    "Histogram",
+    "counter",
+    "gauge",
+    "histogram",
+    "register_collector",
+    "collect_metrics",
+    "metrics_text",
+    "start_metrics_server",
+]
+
+# A metric family as collect_metrics returns it: the ``name``, ``type``
+# (counter, gauge or histogram), ``help`` and ``samples``, each a tuple of
+# the sample name, its labels and its value, as in the Prometheus text format
+Family = Dict[str, Any]
+
+_lock = threading.Lock()
+_metrics: Dict[str, "_Metric"] = {}
+_collectors: List[Callable[[], Iterable[Family]]] = []
+
+
+def _family(name: str, type: str, help: str) -> Family:
+    return {"name": name, "type": type, "help": help, "samples": []}
+
+
+class _Metric:
+    type = ""
+
+    def __init__(self, name: str, help: str, labelnames: Sequence[str]):
+        self.name = name
+        self.help = help
+        self.labelnames = tuple(labelnames)
+        self._lock = threading.Lock()
+        self._values: Dict[Tuple[str, ...], Any] = {}
+
+    def _key(self, labels: Dict[str, Any]) -> Tuple[str, ...]:
+        if set(labels) != set(self.labelnames):
+            raise ValueError(
+                f"{self.name} takes the labels {self.labelnames}, got {tuple(labels)}"
+            )
+        return tuple(str(labels[name]) for name in self.labelnames)
+
+    def _labels(self, key: Tuple[str, ...]) -> Dict[str, str]:
+        return dict(zip(self.labelnames, key))
+
+    def _add(self, amount: float, labels: Dict[str, Any]) -> None:
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = self._values.get(key, 0) + amount
+
+    def collect(self) -> Family:
+        family = _family(self.name, self.type, self.help)
+        with self._lock:
+            for key, value in self._values.items():
+                family["samples"].append((self.name, self._labels(key), value))
+        return family
+
+
+class Counter(_Metric):
+    r"""A value that only goes up, e.g. the number of skipped steps."""
+
+    type = "counter"
+
+    def inc(self, amount: float = 1, **labels) -> None:
+        if amount < 0:
+            raise ValueError(f"{self.name} can't decrease")
+        self._add(amount, labels)
+
+
+class Gauge(_Metric):
+    r"""A value that goes up and down, e.g. the tokens per second."""
+
+    type = "gauge"
+
+    def set(self, value: float, **labels) -> None:
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = value
+
+    def inc(self, amount: float = 1, **labels) -> None:
+        self._add(amount, labels)
+
+    def dec(self, amount: float = 1, **labels) -> None:
+        self.inc(-amount, **labels)
+
+
+class Histogram(_Metric):
+    r"""Counts of observed values in ``buckets``, each by its upper bound."""
+
+    type = "histogram"
+
+    def __init__(self, name, help, labelnames, buckets: Sequence[float]):
+        super().__init__(name, help, labelnames)
+        self.buckets = sorted(buckets)
+
+    def observe(self, value: float, **labels) -> None:
+        key = self._key(labels)
+        with self._lock:
+            counts, total, count = self._values.get(
+                key, ([0] * len(self.buckets), 0.0, 0)
+            )
+            for i, bound in enumerate(self.buckets):
+                if value <= bound:
+                    counts[i] += 1
+                    break
+            self._values[key] = (counts, total + value, count + 1)
+
+    def collect(self) -> Family:
+        family = _family(self.name, self.type, self.help)
+        with self._lock:
+            for key, (counts, total, count) in self._values.items():
+                _add_histogram(
+                    family,
+                    self._labels(key),
+                    zip(self.buckets, list(counts)),
+                    total,
+                    count,
+                )
+        return family
+
+
+def _add_histogram(
+    family: Family,
+    labels: Dict[str, str],
+    buckets: Iterable[Tuple[float, int]],
+    total: float,
+    count: Optional[int] = None,
+) -> None:
+    # buckets are (upper bound, count in the bucket), in increasing order
+    name = family["name"]
+    seen = 0
+    for bound, n in buckets:
+        seen += n
+        family["samples"].append((name + "_bucket", {**labels, "le": bound}, seen))
+    count = seen if count is None else count
+    family["samples"].append((name + "_bucket", {**labels, "le": math.inf}, count))
+    family["samples"].append((name + "_sum", labels, total))
+    family["samples"].append((name + "_count", labels, count))
+
+
+def _register(cls, name: str, *args) -> Any:
+    with _lock:
+        metric = _metrics.get(name)
+        if metric is None:
+            metric = _metrics[name] = cls(name, *args)
+        elif type(metric) is not cls:
+            raise ValueError(f"{name} is already a {metric.type}")
+        return metric
+
+
+def counter(name: str, help: str = "", labelnames: Sequence[str] = ()) -> Counter:
+    r"""The :class:`Counter` of ``name``, created at the first call."""
+    return _register(Counter, name, help, labelnames)
+
+
+def gauge(name: str, help: str = "", labelnames: Sequence[str] = ()) -> Gauge:
+    r"""The :class:`Gauge` of ``name``, created at the first call."""
+    return _register(Gauge, name, help, labelnames)
+
+
+def histogram(
+    name: str,
+    help: str = "",
+    labelnames: Sequence[str] = (),
+    buckets: Sequence[float] = (0.001, 0.01, 0.1, 1, 10, 100),
+) -> Histogram:
+    r"""The :class:`Histogram` of ``name``, created at the first call with
+    ``buckets``."""
+    return _register(Histogram, name, help, labelnames, buckets)
+
+
+def register_collector(collector: Callable[[], Iterable[Family]]) -> None:
+    r"""Adds ``collector``, called by :func:`collect_metrics` for metric
+    families computed at collection, e.g. from stats kept elsewhere."""
+    with _lock:
+        _collectors.append(collector)
+
+
+def _allocator_metrics() -> Iterable[Family]:
+    from .device import device_count
+    from .memory import memory_stats
+
+    families = {}
+
+    def add(name, type, help, sample_labels, value):
+        if name not in families:
+            families[name] = _family(name, type, help)
+        families[name]["samples"].append((name, sample_labels, value))
+
+    # the server thread has no device of its own, so every device the process
+    # allocated on is reported, labeled by its index
+    for device in range(device_count()):
+        stats = memory_stats(device)
+        if not stats.get("reserved_bytes.all.peak", 0):
+            continue
+        _add_allocator_stats(add, {"device": str(device)}, stats)
+    return families.values()
+
+
+def _add_allocator_stats(add, labels: Dict[str, str], stats: Dict[str, int]):
+    for key, value in stats.items():
+        if key.startswith("size_histogram."):
+            _, lower, event = key.split(".")
+            add(
+                "dipu_allocator_size_histogram_total",
+                "counter",
+                "Device allocations and frees by the lower bound of their size",
+                {**labels, "lower_bytes": lower, "event": event},
+                value,
+            )
+            continue
+        name = "dipu_allocator_" + key.replace(".", "_")
+        if key.endswith((".current", ".peak")) or key in (
+            "largest_free_chunk",
+            "cache_hit_rate_per_mille",
+        ):
+            add(name, "gauge", f"memory_stats()['{key}']", labels, value)
+        else:
+            add(name + "_total", "counter", f"memory_stats()['{key}']", labels, value)
+
+
+def _fallback_metrics() -> Iterable[Family]:
+    from .fallback import fallback_stats
+
+    families = [
+        _family("dipu_fallback_calls_total", "counter", "CPU fallback calls"),
+        _family("dipu_fallback_d2h_bytes_total", "counter", "Bytes copied to the host"),
+        _family("dipu_fallback_h2d_bytes_total", "counter", "Bytes copied back"),
+        _family("dipu_fallback_seconds_total", "counter", "Wall time of the fallback"),
+    ]
+    for item in fallback_stats():
+        labels = {"op": item["op"]}
+        for family, key in zip(
+            families, ("calls", "d2h_bytes", "h2d_bytes", "seconds")
+        ):
+            family["samples"].append((family["name"], labels, item[key]))
+    return families
+
+
+def _op_latency_metrics() -> Iterable[Family]:
+    from torch_dipu import _C
+
+    family = _family(
+        "dipu_op_latency_seconds",
+        "histogram",
+        "Host latency of the generated op wrappers by phase",
+    )
+    for item in _C._dipu_op_latency_stats():
+        for phase in ("prologue", "call"):
+            stats = item[phase]
+            # bucket i holds [2^(i-1), 2^i) ns
+            buckets = [
+                ((1 << i) / 1e9, n) for i, n in enumerate(stats["buckets"])
+            ]
+            _add_histogram(
+                family,
+                {"op": item["op"], "phase": phase},
+                buckets,
+                stats["seconds"],
+                item["calls"],
+            )
+    return [family]
+
+
+def _collective_metrics() -> Iterable[Family]:
+    from torch import distributed as dist
+
+    if not dist.is_available() or not dist.is_initialized():
+        return []
+    from .distributed import ProcessGroupDICL, _dicl_of
+
+    try:
+        backend = _dicl_of(None)
+    except RuntimeError:
+        return []
+    if not isinstance(backend, ProcessGroupDICL):
+        return []
+    families = [
+        _family("dipu_collective_calls_total", "counter", "DICL ops of the default group"),
+        _family("dipu_collective_bytes_total", "counter", "Bytes of the DICL ops"),
+        _family(
+            "dipu_collective_device_seconds_total",
+            "counter",
+            "Device time of the DICL ops on the comm stream",
+        ),
+        _family(
+            "dipu_collective_queue_seconds_total",
+            "counter",
+            "Time from queueing the DICL ops to the comm stream reaching them",
+        ),
+        _family(
+            "dipu_collective_busbw_gbps",
+            "gauge",
+            "Bus bandwidth of the DICL ops as nccl-tests computes it",
+        ),
+    ]
+    for item in backend.collective_stats():
+        labels = {"op": item["op"]}
+        values = (
+            item["calls"],
+            item["bytes"],
+            item["device_ms"] / 1e3,
+            item["queue_ms"] / 1e3,
+            item["busbw_gbps"],
+        )
+        for family, value in zip(families, values):
+            family["samples"].append((family["name"], labels, value))
+    return families
+
+
+_builtin_collectors = [
+    _allocator_metrics,
+    _fallback_metrics,
+    _op_latency_metrics,
+    _collective_metrics,
+]
+
+
+def collect_metrics() -> List[Family]:
+    r"""The metric families of DIPU and those added through :func:`counter`,
+    :func:`gauge`, :func:`histogram` and :func:`register_collector`, each a
+    dict of the ``name``, ``type``, ``help`` and ``samples`` as tuples of the
+    sample name, its labels and its value.
+
+    DIPU reports the caching allocator stats of each device allocated on,
+    labeled by ``device``, the CPU fallbacks, the op latency histograms while
+    ``DIPU_OP_LATENCY`` or :func:`set_op_latency_enabled` time the ops, and the
+    collectives of the default dicl process group while ``DIPU_DICL_STATS`` is
+    on. A collector
+    raising is skipped.
+    """
+    with _lock:
+        metrics = list(_metrics.values())
+        collectors = _builtin_collectors + _collectors
+    families = [metric.collect() for metric in metrics]
+    for collector in collectors:
+        try:
+            families.extend(collector())
+        except Exception:
+            continue
+    return families
+
+
+_INVALID_NAME = re.compile(r"[^a-zA-Z0-9_:]")
+
+
+def _format_value(value) -> str:
+    value = float(value)
+    if math.isinf(value):
+        return "+Inf" if value > 0 else "-Inf"
+    if math.isnan(value):
+        return "NaN"
+    return repr(int(value)) if value.is_integer() else repr(value)
+
+
+def _escape(value: str) -> str:
+    return value.replace("\\", r"\\").replace("\n", r"\n").replace('"', r"\"")
+
+
+def metrics_text() -> str:
+    r"""The metrics of :func:`collect_metrics` in the Prometheus text format."""
+    lines = []
+    for family in collect_metrics():
+        name = _INVALID_NAME.sub("_", family["name"])
+        lines.append(f"# HELP {name} {_escape(family['help'])}")
+        lines.append(f"# TYPE {name} {family['type']}")
+        for sample, labels, value in family["samples"]:
+            sample = _INVALID_NAME.sub("_", sample)
+            if labels:
+                pairs = ",".join(
+                    f'{_INVALID_NAME.sub("_", k)}="'
+                    + _escape(_format_value(v) if k == "le" else str(v))
+                    + '"'
+                    for k, v in labels.items()
+                )
+                sample = f"{sample}{{{pairs}}}"
+            lines.append(f"{sample} {_format_value(value)}")
+    return "\n".join(lines) + "\n"
+
+
+class _MetricsHandler(http.server.BaseHTTPRequestHandler):
+    def do_GET(self):
+        if self.path.split("?")[0] not in ("/", "/metrics"):
+            self.send_error(404)
+            return
+        body = metrics_text().encode("utf-8")
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        # scrapes would flood the training log
+        pass
+
+
+def start_metrics_server(
+    port: int, addr: str = "0.0.0.0"
+) -> http.server.ThreadingHTTPServer:
+    r"""Serves :func:`metrics_text` at ``http://addr:port/metrics`` from a
+    daemon thread, for Prometheus to scrape. Returns the server, call its
+    ``shutdown()`` to stop it.
+
+    ``DIPU_METRICS_PORT`` starts it when torch_dipu is imported, on that port
+    plus ``LOCAL_RANK``, so that the ranks of a node don't collide.
+    """
+    server = http.server.ThreadingHTTPServer((addr, port), _MetricsHandler)
+    server.daemon_threads = True
+    thread = threading.Thread(
+        target=server.serve_forever, name="dipu_metrics", daemon=True
+    )
+    thread.start()
+    return server
+
+
+def _start_from_env() -> None:
+    port = os.environ.get("DIPU_METRICS_PORT")
+    if not port:
+        return
+    try:
+        port = int(port) + int(os.environ.get("LOCAL_RANK", "0"))
+    except ValueError:
+        warnings.warn(
+            f"DIPU_METRICS_PORT={port} or LOCAL_RANK is not an integer, "
+            "the metrics server is not started"
+        )
+        return
+    start_metrics_server(port)
@@ -0,0 +1,265 @@
+# Copyright (c) 2024, DeepLink.
+import functools
+from typing import Dict, Iterable, Optional, Type
+
+import torch
+from torch import nn
+from torch.utils._python_dispatch import TorchDispatchMode
+from torch.utils._pytree import tree_flatten, tree_unflatten
+from torch.utils.weak import WeakTensorKeyDictionary
+
+from torch_dipu import _C
+from .device import __vendor__
+
+__all__ = [
+    "cache_native_formats",
+    "clear_native_format_cache",
+    "LazyNativeFormatMode",
+]
+
+_F = _C.NativeMemoryFormat
+aten = torch.ops.aten
+
+# The weight formats the Ascend matmul and conv kernels compute in, weights
+# in other formats are cast by a TransData at every call
+_ascend_weight_formats = {
+    nn.Linear: _C.NativeMemoryFormat.FRACTAL_NZ,
+    nn.Conv2d: _C.NativeMemoryFormat.FRACTAL_Z,
+}
+
+_CACHE_ATTR = "_dipu_native_weight"
+
+
+def _native_weight(module: nn.Module, weight: torch.Tensor, format):
+    # An in-place update bumps the version, assigning `.data` moves the storage
+    key = (weight._version, weight.data_ptr())
+    cached = module.__dict__.get(_CACHE_ATTR)
+    if cached is None or cached[0] != key:
+        with torch.no_grad():
+            cached = (key, _C.native_memory_format_cast(weight.detach(), format))
+        module.__dict__[_CACHE_ATTR] = cached
+    return cached[1]
+
+
+def _forward_with_native_weight(module: nn.Module, format, forward):
+    @functools.wraps(forward)
+    def wrapper(*args, **kwargs):
+        weight = module._parameters.get("weight")
+        # The cast has no backward, weights being trained are used as they are
+        if (
+            weight is None
+            or not weight.is_dipu
+            or (weight.requires_grad and torch.is_grad_enabled())
+        ):
+            return forward(*args, **kwargs)
+        module._parameters["weight"] = _native_weight(module, weight, format)
+        try:
+            return forward(*args, **kwargs)
+        finally:
+            module._parameters["weight"] = weight
+
+    wrapper._dipu_native_format = True
+    return wrapper
+
+
+def cache_native_formats(
+    module: nn.Module, formats: Optional[Dict[Type[nn.Module], object]] = None
+) -> int:
+    r"""Make the submodules of ``module`` of the types in ``formats`` run
+    with their weight cast to the native format of the type once, instead of
+    the kernels casting it at every call. The cast copy is kept with the
+    version of the weight and made again after the weight is updated.
+
+    ``formats`` maps module types to a ``NativeMemoryFormat``, by default
+    FRACTAL_NZ for ``nn.Linear`` and FRACTAL_Z for ``nn.Conv2d`` on Ascend.
+    It does nothing on vendors without native formats unless ``formats`` is
+    given. Returns the number of submodules changed.
+
+    The copies double the device memory of the weights. Modules run with
+    grad enabled on weights requiring grad use the weight as it is.
+    """
+    if formats is None:
+        if __vendor__ != "NPU":
+            return 0
+        formats = _ascend_weight_formats
+    count = 0
+    for submodule in module.modules():
+        format = next(
+            (f for cls, f in formats.items() if type(submodule) is cls), None
+        )
+        if format is None or "forward" in submodule.__dict__:
+            continue
+        submodule.forward = _forward_with_native_weight(
+            submodule, format, submodule.forward
+        )
+        count += 1
+    return count
+
+
+def clear_native_format_cache(module: nn.Module) -> None:
+    r"""Undo ``cache_native_formats`` on ``module`` and free the copies."""
+    for submodule in module.modules():
+        submodule.__dict__.pop(_CACHE_ATTR, None)
+        if getattr(submodule.__dict__.get("forward"), "_dipu_native_format", False):
+            del submodule.forward
+
+
+# Formats tensors of the ops without native formats are in
+_BASE_FORMATS = (_F.UNDEFINED, _F.ND, _F.NCHW, _F.NCDHW)
+
+
+def _overloads(*names):
+    # some overloads only exist in later torch versions
+    ops = []
+    for name in names:
+        packet, _, overload = name.partition(".")
+        op = getattr(getattr(aten, packet, None), overload or "default", None)
+        if op is not None:
+            ops.append(op)
+    return ops
+
+
+# The ops computing in NC1HWC0 on Ascend, their 4-d inputs are cast to it
+_ascend_activation_formats = {
+    op: _F.NC1HWC0
+    for op in _overloads(
+        "convolution",
+        "native_batch_norm",
+        "_native_batch_norm_legit_no_training",
+        "max_pool2d_with_indices",
+        "avg_pool2d",
+    )
+}
+
+# Elementwise ops computing in the format of their inputs when they all have
+# the same format and shape
+_ascend_format_agnostic_ops = set(
+    _overloads(
+        "relu",
+        "relu_",
+        "hardtanh",
+        "hardtanh_",
+        "silu",
+        "silu_",
+        "sigmoid",
+        "add.Tensor",
+        "add_.Tensor",
+        "mul.Tensor",
+        "mul_.Tensor",
+    )
+)
+
+
+def _written_tensors(func, args, kwargs):
+    written = []
+    for i, arg in enumerate(func._schema.arguments):
+        if arg.alias_info is not None and arg.alias_info.is_write:
+            value = args[i] if i < len(args) else kwargs.get(arg.name)
+            if isinstance(value, torch.Tensor):
+                written.append(value)
+    return written
+
+
+class LazyNativeFormatMode(TorchDispatchMode):
+    r"""Keeps the device tensors produced in native formats in them until an
+    op needs another format, instead of casting them back after each op, so
+    that chains like conv, batch norm and relu stay in NC1HWC0 on Ascend.
+
+    The 4-d inputs of the ops of ``preferred`` are cast to the format it maps
+    them to, the ops of ``agnostic`` keep the format of inputs which all have
+    the same one, and inputs of other ops are cast back to NCHW or ND. By
+    default these are the conv, batch norm and pooling ops and the common
+    activations and elementwise ops on Ascend, nothing on other vendors.
+
+    A tensor read by several ops is cast once, tensors written by an op are
+    cast in place. Example::
+
+        with torch_dipu.LazyNativeFormatMode():
+            output = model(input)
+    """
+
+    def __init__(
+        self,
+        preferred: Optional[Dict[object, object]] = None,
+        agnostic: Optional[Iterable[object]] = None,
+    ):
+        super().__init__()
+        npu = __vendor__ == "NPU"
+        if preferred is None:
+            preferred = _ascend_activation_formats if npu else {}
+        if agnostic is None:
+            agnostic = _ascend_format_agnostic_ops if npu else ()
+        self.preferred = dict(preferred)
+        self.agnostic = set(agnostic)
+        # Tensors in formats other than the base ones
+        self.formats = WeakTensorKeyDictionary()
+        # The base format copies of the tensors above, cast for an op
+        self.base_copies = WeakTensorKeyDictionary()
+
+    def _record(self, tensor):
+        format = _C.get_native_memory_format(tensor)
+        if format in _BASE_FORMATS:
+            self.formats.pop(tensor, None)
+        else:
+            self.formats[tensor] = format
+
+    def _base(self, tensor):
+        copy = self.base_copies.get(tensor)
+        if copy is None:
+            format = _F.NCHW if tensor.dim() == 4 else _F.ND
+            copy = _C.native_memory_format_cast(tensor, format)
+            self.base_copies[tensor] = copy
+        return copy
+
+    def __torch_dispatch__(self, func, types, args=(), kwargs=None):
+        kwargs = kwargs or {}
+        flat, spec = tree_flatten((args, kwargs))
+        tensors = [
+            a for a in flat if isinstance(a, torch.Tensor) and a in self.formats
+        ]
+        preferred = self.preferred.get(func)
+        kept = None
+        if preferred is not None:
+
+            def convert(a):
+                if (
+                    not isinstance(a, torch.Tensor)
+                    or a.dim() != 4
+                    or not a.is_dipu
+                    or self.formats.get(a) == preferred
+                ):
+                    return a
+                return _C.native_memory_format_cast(a, preferred)
+
+            flat = [convert(a) for a in flat]
+            args, kwargs = tree_unflatten(flat, spec)
+        elif tensors:
+            if func in self.agnostic:
+                inputs = [a for a in flat if isinstance(a, torch.Tensor)]
+                formats = {self.formats.get(a) for a in inputs}
+                if len(formats) == 1 and len({a.shape for a in inputs}) == 1:
+                    kept = formats.pop()
+            if kept is None:
+                for tensor in _written_tensors(func, args, kwargs):
+                    if tensor in self.formats:
+                        # other ops may hold it, it is cast where it is
+                        tensor.set_(self._base(tensor))
+                        del self.formats[tensor]
+                flat = [
+                    self._base(a)
+                    if isinstance(a, torch.Tensor) and a in self.formats
+                    else a
+                    for a in flat
+                ]
+                args, kwargs = tree_unflatten(flat, spec)
+
+        out = func(*args, **kwargs)
+        for tensor in tree_flatten(out)[0]:
+            if not isinstance(tensor, torch.Tensor):
+                continue
+            self.base_copies.pop(tensor, None)
+            if kept is not None:
+                self.formats[tensor] = kept
+            elif preferred is not None and tensor.dim() == 4 and tensor.is_dipu:
+                self._record(tensor)
+        return out
@@ -1,5 +1,7 @@
 from contextlib import contextmanager
 
+from torch_dipu import _C
+
 try:
     from torch._C import _nvtx
 except ImportError:
@@ -16,6 +18,17 @@ except ImportError:
 
     _nvtx = _NVTXStub()  # type: ignore[assignment]
 
+
+class _VendorMarkers:
+    # range_push, range_pop and mark go to the tracing tools of the vendor,
+    # e.g. msTX on Ascend and cnpx on Camb, if it implements the markers
+    rangePushA = _C._dipu_trace_range_push
+    rangePop = _C._dipu_trace_range_pop
+    markA = _C._dipu_trace_mark
+
+
+_markers = _VendorMarkers if _C._dipu_has_trace_markers() else _nvtx
+
 # THE FOLLOWING CODE ARE DIRECTLY FROM PYTORCH, DO NOT MODIFY THEM EXCEPT FOR A SPECIFIC REASON
 __all__ = ["range_push", "range_pop", "range_start", "range_end", "mark", "range"]
 
@@ -28,7 +41,7 @@ def range_push(msg):
     Args:
         msg (str): ASCII message to associate with range
     """
-    return _nvtx.rangePushA(msg)
+    return _markers.rangePushA(msg)
 
 
 def range_pop():
@@ -36,7 +49,7 @@ def range_pop():
     Pops a range off of a stack of nested range spans.  Returns the
     zero-based depth of the range that is ended.
     """
-    return _nvtx.rangePop()
+    return _markers.rangePop()
 
 
 def range_start(msg) -> int:
@@ -73,7 +86,7 @@ def mark(msg):
     Args:
         msg (str): ASCII message to associate with the event.
     """
-    return _nvtx.markA(msg)
+    return _markers.markA(msg)
 
 
 @contextmanager
@@ -0,0 +1,155 @@
+# Copyright (c) 2024, DeepLink.
+import collections
+import weakref
+from typing import Callable, Optional
+
+import torch
+
+from .device import __diputype__
+
+
+class _Offloaded:
+    # A saved activation in pinned host memory, and its copy back to the
+    # device once prefetched. order holds weak references to the activations
+    # of the same forward, this one at index.
+    __slots__ = (
+        "host",
+        "device",
+        "d2h_event",
+        "prefetched",
+        "order",
+        "index",
+        "__weakref__",
+    )
+
+    def __init__(self, host, device, d2h_event, order):
+        self.host = host
+        self.device = device
+        self.d2h_event = d2h_event
+        self.prefetched = None
+        self.order = order
+        self.index = len(order)
+        order.append(weakref.ref(self))
+
+
+class offload_activations(torch.autograd.graph.saved_tensors_hooks):
+    r"""Context manager moving the activations saved for backward by the
+    forward pass to pinned host memory, and back before backward uses them,
+    for the device memory they take between forward and backward, e.g. in
+    long-context training where recompute costs too much.
+
+    Tensors of at least ``min_bytes`` accepted by ``filter``, if given, are
+    copied to the host on a side stream once the op saving them is done, so
+    that the copies overlap with the rest of forward. The weights, i.e. leaves
+    requiring grad and their views, stay on the device. When backward unpacks
+    an activation, the copies of the ``prefetch`` activations saved before it,
+    which backward needs next, are started on another side stream, so that
+    they overlap with the backward of the current op.
+
+    The device memory of the activations is released for the current stream
+    only after their copies to the host, and that of the copies back is handed
+    to the current stream once it waited for them. The pinned memory comes
+    from the host caching allocator and is kept until the copies reading it
+    are done.
+
+    Example::
+
+        with offload_activations(min_bytes=1 << 20):
+            loss = model(inputs).sum()
+        loss.backward()
+    """
+
+    def __init__(
+        self,
+        min_bytes: int = 1 << 20,
+        filter: Optional[Callable[[torch.Tensor], bool]] = None,
+        prefetch: int = 2,
+    ):
+        self.min_bytes = min_bytes
+        self.filter = filter
+        self.prefetch = max(prefetch, 0)
+        # The activations of the current forward, see _Offloaded.order
+        self._packed = []
+        # Pinned host buffers of copies still in flight
+        self._in_flight = collections.deque()
+        self._streams = {}
+        super().__init__(self._pack, self._unpack)
+
+    def __enter__(self):
+        self._packed = []
+        return super().__enter__()
+
+    def _side_streams(self, device):
+        from torch_dipu import dipu
+
+        if device not in self._streams:
+            with dipu.devicectx(device):
+                self._streams[device] = (dipu.Stream(), dipu.Stream(priority=-1))
+        return self._streams[device]
+
+    def _should_offload(self, tensor):
+        if tensor.device.type != __diputype__ or tensor.is_sparse:
+            return False
+        if tensor.numel() * tensor.element_size() < self.min_bytes:
+            return False
+        base = tensor if tensor._base is None else tensor._base
+        if base.is_leaf and base.requires_grad:
+            return False
+        return self.filter is None or self.filter(tensor)
+
+    def _release_host_buffers(self):
+        while self._in_flight and self._in_flight[0][1].query():
+            self._in_flight.popleft()
+
+    def _pack(self, tensor):
+        from torch_dipu import dipu
+
+        if not self._should_offload(tensor):
+            return tensor
+        self._release_host_buffers()
+        d2h_stream, _ = self._side_streams(tensor.device)
+        host = torch.empty(
+            tensor.size(), dtype=tensor.dtype, layout=tensor.layout, pin_memory=True
+        )
+        d2h_stream.wait_stream(dipu.current_stream(tensor.device))
+        with dipu.stream(d2h_stream):
+            host.copy_(tensor, non_blocking=True)
+        # not reused by the current stream before the copy read it
+        tensor.record_stream(d2h_stream)
+        event = d2h_stream.record_event()
+        # nor is the host memory if the activation is dropped before
+        self._in_flight.append((host, event))
+        return _Offloaded(host, tensor.device, event, self._packed)
+
+    def _start_prefetch(self, packed):
+        from torch_dipu import dipu
+
+        if packed.prefetched is not None:
+            return
+        _, h2d_stream = self._side_streams(packed.device)
+        h2d_stream.wait_event(packed.d2h_event)
+        with dipu.stream(h2d_stream):
+            tensor = packed.host.to(packed.device, non_blocking=True)
+        event = h2d_stream.record_event()
+        packed.prefetched = (tensor, event)
+        self._in_flight.append((packed.host, event))
+
+    def _unpack(self, packed):
+        from torch_dipu import dipu
+
+        if not isinstance(packed, _Offloaded):
+            return packed
+        self._start_prefetch(packed)
+        start = max(packed.index - self.prefetch, 0)
+        for ref in reversed(packed.order[start : packed.index]):
+            earlier = ref()
+            if earlier is not None:
+                self._start_prefetch(earlier)
+        tensor, event = packed.prefetched
+        # copied again if backward unpacks it once more, with retain_graph
+        packed.prefetched = None
+        current = dipu.current_stream(packed.device)
+        current.wait_event(event)
+        tensor.record_stream(current)
+        self._release_host_buffers()
+        return tensor
@@ -0,0 +1,77 @@
+# Copyright (c) 2024, DeepLink.
+from typing import Any, Dict, List
+
+from torch_dipu import _C
+
+__all__ = [
+    "op_latency_enabled",
+    "set_op_latency_enabled",
+    "op_latency_stats",
+    "reset_op_latency_stats",
+]
+
+
+def op_latency_enabled() -> bool:
+    r"""Whether the generated op wrappers time themselves, ``DIPU_OP_LATENCY``
+    at start.
+    """
+    return _C._dipu_op_latency_enabled()
+
+
+def set_op_latency_enabled(enabled: bool) -> None:
+    r"""Start or stop timing the generated op wrappers, it can be switched at
+    any time and the histograms recorded so far are kept.
+    """
+    _C._dipu_set_op_latency_enabled(enabled)
+
+
+def _percentile_us(buckets: List[int], q: float) -> float:
+    # upper bound of the bucket holding the percentile, bucket i > 0 holds
+    # [2^(i-1), 2^i) ns
+    count = sum(buckets)
+    if count == 0:
+        return 0.0
+    rank = q * count
+    seen = 0
+    for i, n in enumerate(buckets):
+        seen += n
+        if seen >= rank:
+            return (1 << i) / 1e3 if i > 0 else 0.0
+    return (1 << (len(buckets) - 1)) / 1e3
+
+
+def _summarize(histogram: Dict[str, Any], calls: int) -> Dict[str, Any]:
+    buckets = histogram["buckets"]
+    return {
+        "mean_us": histogram["seconds"] * 1e6 / calls,
+        "p50_us": _percentile_us(buckets, 0.5),
+        "p99_us": _percentile_us(buckets, 0.99),
+        "buckets": buckets,
+    }
+
+
+def op_latency_stats() -> List[Dict[str, Any]]:
+    r"""Host latency of the generated op wrappers timed so far, merged over
+    all threads, the most time consuming first. Each item has the ``op``, its
+    number of ``calls``, and for the ``prologue`` (custom code, output
+    allocation and handle conversion) and the DIOPI ``call`` the ``mean_us``,
+    ``p50_us``, ``p99_us`` and the log2 nanosecond histogram ``buckets``,
+    and the total ``seconds`` of both. Percentiles are bucket upper bounds.
+    """
+    result = [
+        {
+            "op": item["op"],
+            "calls": item["calls"],
+            "prologue": _summarize(item["prologue"], item["calls"]),
+            "call": _summarize(item["call"], item["calls"]),
+            "seconds": item["prologue"]["seconds"] + item["call"]["seconds"],
+        }
+        for item in _C._dipu_op_latency_stats()
+    ]
+    result.sort(key=lambda item: item["seconds"], reverse=True)
+    return result
+
+
+def reset_op_latency_stats() -> None:
+    r"""Clear the histograms returned by :func:`op_latency_stats`."""
+    _C._dipu_reset_op_latency_stats()
@@ -0,0 +1,36 @@
+# Copyright (c) 2024, DeepLink.
+from typing import Dict, Union
+
+from torch_dipu import _C
+
+__all__ = [
+    "runtime_configs",
+    "get_runtime_config",
+    "set_runtime_config",
+]
+
+
+def runtime_configs() -> Dict[str, str]:
+    r"""The settings which can be changed while running, by the name of the
+    env var they start from, with their current values.
+
+    These are ``DIPU_ALLOCATOR_GC_THRESHOLD``,
+    ``DIPU_MAX_ASYNC_RESOURCE_POOL_LENGTH``,
+    ``DIPU_ASYNC_RESOURCE_POOL_FLUSH_INTERVAL``,
+    ``DIPU_FLUSH_READY_EVENT_INTERVAL``, ``DIPU_MEM_CHECK_BACKTRACE_SAMPLE``,
+    ``DIPU_AUTOCOMPARE_SAMPLE_INTERVAL`` and ``DIPU_AUTOCOMPARE_SAMPLE_RATE``.
+    """
+    return _C._dipu_runtime_configs()
+
+
+def get_runtime_config(name: str) -> str:
+    r"""The current value of the setting ``name`` as a string."""
+    return _C._dipu_get_runtime_config(name)
+
+
+def set_runtime_config(name: str, value: Union[int, float, str]) -> None:
+    r"""Change the setting ``name`` of the whole process, it applies from the
+    next time the setting is read. Raises ``ValueError`` for unknown names
+    or values which don't parse as the type of the setting.
+    """
+    _C._dipu_set_runtime_config(name, str(value))
@@ -0,0 +1,299 @@
+# Copyright (c) 2024, DeepLink.
+import concurrent.futures
+import json
+import mmap
+import os
+import struct
+import warnings
+from typing import Any, Dict, List, Optional
+
+import torch
+from torch.utils._pytree import tree_map
+
+from .device import _get_device_index, __diputype__, devicectx, synchronize
+from .streams import Stream, current_stream, stream
+from .utils import get_dipu_torch_version, torch_ver_200
+
+__all__ = ["load_to_device", "load_safetensors", "save_async", "load_sharded"]
+
+_SAFETENSORS_DTYPES = {
+    "F64": torch.float64,
+    "F32": torch.float32,
+    "F16": torch.float16,
+    "BF16": torch.bfloat16,
+    "I64": torch.int64,
+    "I32": torch.int32,
+    "I16": torch.int16,
+    "I8": torch.int8,
+    "U8": torch.uint8,
+    "BOOL": torch.bool,
+}
+
+
+def _target_device(device) -> torch.device:
+    return torch.device(__diputype__, _get_device_index(device, optional=True))
+
+
+def _to_device(tensor: torch.Tensor, device: torch.device) -> torch.Tensor:
+    # Host tensors backed by the mapped file are copied with non_blocking, so
+    # that the copy engine streams them through pinned staging buffers chunk
+    # by chunk instead of holding the whole checkpoint in host memory.
+    result = torch.empty_like(tensor, device=device)
+    result.copy_(tensor, non_blocking=True)
+    return result
+
+
+def load_safetensors(
+    path: str, device: Optional[Any] = None
+) -> Dict[str, torch.Tensor]:
+    r"""Load a safetensors file into tensors on ``device`` (the current device
+    by default). The file is memory mapped and read straight into the device,
+    without materializing the tensors in host memory.
+    """
+    device = _target_device(device)
+    result = {}
+    with open(path, "rb") as f:
+        (header_size,) = struct.unpack("<Q", f.read(8))
+        header = json.loads(f.read(header_size))
+        header.pop("__metadata__", None)
+        if not header:
+            return result
+        data_begin = 8 + header_size
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as buffer:
+            with warnings.catch_warnings():
+                # tensors are only read from, the mapping is read only
+                warnings.simplefilter("ignore", UserWarning)
+                for name, info in header.items():
+                    dtype = _SAFETENSORS_DTYPES.get(info["dtype"])
+                    if dtype is None:
+                        raise ValueError(
+                            f"tensor {name} of {path} has the unsupported dtype "
+                            f"{info['dtype']}"
+                        )
+                    begin, end = info["data_offsets"]
+                    if begin == end:
+                        # frombuffer rejects empty buffers
+                        result[name] = torch.empty(
+                            info["shape"], dtype=dtype, device=device
+                        )
+                        continue
+                    host = torch.frombuffer(
+                        buffer,
+                        dtype=torch.uint8,
+                        count=end - begin,
+                        offset=data_begin + begin,
+                    )
+                    host = host.view(dtype).reshape(info["shape"])
+                    result[name] = _to_device(host, device)
+                    del host
+            # the mapping must outlive the copies reading from it
+            synchronize(device)
+    return result
+
+
+def load_to_device(f, device: Optional[Any] = None, **kwargs) -> Any:
+    r"""Same as ``torch.load(f, map_location=device)``, but the checkpoint is
+    memory mapped and its tensors are streamed to ``device`` (the current
+    device by default) one by one, so host memory never holds the whole
+    model. Tensors sharing storage in the checkpoint are loaded as separate
+    tensors.
+    """
+    device = _target_device(device)
+    if get_dipu_torch_version() == torch_ver_200:
+        warnings.warn("torch 2.0 can't mmap checkpoints, load them as a whole")
+        return torch.load(f, map_location=device, **kwargs)
+
+    state = torch.load(f, map_location="cpu", mmap=True, **kwargs)
+
+    def to_device(obj):
+        if isinstance(obj, torch.Tensor) and obj.device.type == "cpu":
+            return _to_device(obj, device)
+        return obj
+
+    result = tree_map(to_device, state)
+    del state
+    synchronize(device)
+    return result
+
+
+# Side streams snapshotting checkpoints, one per device
+_snapshot_streams = {}
+
+
+def _snapshot_stream(device: torch.device) -> Stream:
+    if device not in _snapshot_streams:
+        with devicectx(device):
+            _snapshot_streams[device] = Stream()
+    return _snapshot_streams[device]
+
+
+def _snapshot(state: Any) -> Any:
+    # Copies the tensors of ``state`` to the host, those on the device into
+    # pinned buffers on a side stream, without waiting for the copies. The
+    # current streams wait for them before overwriting the tensors, e.g. in
+    # the next optimizer step, so that the snapshot sees the current values.
+    copied = {}
+    streams = {}
+
+    def copy(obj):
+        if not isinstance(obj, torch.Tensor):
+            return obj
+        if id(obj) in copied:
+            return copied[id(obj)][1]
+        tensor = obj.detach()
+        if tensor.device.type != __diputype__ or tensor.layout != torch.strided:
+            host = tensor.cpu()
+            host = host.clone() if host is tensor else host
+        else:
+            side = streams.get(tensor.device)
+            if side is None:
+                side = _snapshot_stream(tensor.device)
+                side.wait_stream(current_stream(tensor.device))
+                streams[tensor.device] = side
+            host = torch.empty(tensor.size(), dtype=tensor.dtype, pin_memory=True)
+            with stream(side):
+                host.copy_(tensor, non_blocking=True)
+            # not reused by the current stream before the copy read it
+            tensor.record_stream(side)
+        # keeps obj alive, so that its id is not taken by another tensor
+        copied[id(obj)] = (obj, host)
+        return host
+
+    snapshot = tree_map(copy, state)
+    events = []
+    for device, side in streams.items():
+        current_stream(device).wait_stream(side)
+        events.append(side.record_event())
+    return snapshot, events
+
+
+def _write(obj: Any, path: str, events) -> None:
+    for event in events:
+        event.synchronize()
+    # a crash while writing leaves the previous checkpoint in place
+    tmp_path = path + ".tmp"
+    torch.save(obj, tmp_path)
+    os.replace(tmp_path, path)
+
+
+def _shard_bytes(obj: Any) -> int:
+    total = 0
+
+    def count(leaf):
+        nonlocal total
+        if isinstance(leaf, torch.Tensor):
+            total += leaf.numel() * leaf.element_size()
+        return leaf
+
+    tree_map(count, obj)
+    return total
+
+
+def _split(snapshot: Dict[Any, Any], num_shards: int) -> List[Dict[Any, Any]]:
+    # largest entries first, each into the smallest shard so far
+    shards = [{} for _ in range(num_shards)]
+    sizes = [0] * num_shards
+    entries = sorted(
+        snapshot.items(), key=lambda item: _shard_bytes(item[1]), reverse=True
+    )
+    for key, value in entries:
+        i = sizes.index(min(sizes))
+        shards[i][key] = value
+        sizes[i] += _shard_bytes(value)
+    return shards
+
+
+def _shard_path(path: str, index: int, num_shards: int) -> str:
+    return os.path.join(path, f"shard-{index:05d}-of-{num_shards:05d}.pt")
+
+
+class AsyncCheckpoint:
+    r"""A checkpoint being written by :func:`save_async`."""
+
+    def __init__(self, futures):
+        self._futures = futures
+
+    def done(self) -> bool:
+        r"""Whether all shards are written, without blocking."""
+        return all(future.done() for future in self._futures)
+
+    def wait(self) -> None:
+        r"""Blocks until all shards are written, raises what writing one of
+        them raised."""
+        for future in self._futures:
+            future.result()
+
+
+def save_async(
+    state: Any, path: str, num_shards: int = 1, num_workers: Optional[int] = None
+) -> AsyncCheckpoint:
+    r"""Saves ``state``, e.g. a state dict, to ``path`` like ``torch.save``,
+    but returns once its device tensors are being copied to the host, so that
+    training goes on while the checkpoint is written.
+
+    The tensors are copied on a side stream into pinned host buffers from the
+    host caching allocator. The current stream only waits for the copies
+    before work queued after this call, so the checkpoint holds the values of
+    this call even if the next optimizer step updates them in place. Tensors
+    sharing storage but not the same tensor are saved separately.
+
+    With ``num_shards`` above 1 ``state`` must be a dict, and ``path`` is a
+    directory its entries are split into by size, one file per shard, read
+    back by :func:`load_sharded`. ``num_workers`` threads, one per shard by
+    default, serialize and write the shards in parallel once the copies are
+    done. Files are written under a temporary name and renamed when complete.
+
+    Call :meth:`AsyncCheckpoint.wait` before relying on the files, e.g. at
+    exit, the host memory of the snapshot is held until then.
+
+    Example::
+
+        checkpoint = save_async(model.state_dict(), "ckpt", num_shards=8)
+        ...  # train on
+        checkpoint.wait()
+    """
+    if num_shards < 1:
+        raise ValueError(f"save_async expects num_shards >= 1, got {num_shards}")
+    if num_shards > 1 and not isinstance(state, dict):
+        raise ValueError("save_async saves only dicts in shards")
+    snapshot, events = _snapshot(state)
+    if num_shards == 1:
+        jobs = [(snapshot, path)]
+    else:
+        os.makedirs(path, exist_ok=True)
+        jobs = [
+            (shard, _shard_path(path, i, num_shards))
+            for i, shard in enumerate(_split(snapshot, num_shards))
+        ]
+    del snapshot
+    executor = concurrent.futures.ThreadPoolExecutor(
+        max_workers=num_workers or len(jobs), thread_name_prefix="dipu_save"
+    )
+    futures = [executor.submit(_write, obj, file, events) for obj, file in jobs]
+    # the threads exit once the shards are written
+    executor.shutdown(wait=False)
+    return AsyncCheckpoint(futures)
+
+
+def load_sharded(path: str, device: Optional[Any] = None, **kwargs) -> Dict:
+    r"""Loads the dict saved in shards by :func:`save_async` into ``device``
+    (the current device by default), see :func:`load_to_device`."""
+    names = sorted(
+        name
+        for name in os.listdir(path)
+        if name.startswith("shard-") and name.endswith(".pt")
+    )
+    if not names:
+        raise FileNotFoundError(f"no checkpoint shards in {path}")
+    counts = {int(name[: -len(".pt")].rsplit("-", 1)[1]) for name in names}
+    if len(counts) > 1:
+        raise ValueError(f"{path} holds shards of several checkpoints")
+    (num_shards,) = counts
+    if len(names) != num_shards:
+        raise FileNotFoundError(
+            f"{path} holds {len(names)} of {num_shards} checkpoint shards"
+        )
+    result = {}
+    for name in names:
+        result.update(load_to_device(os.path.join(path, name), device, **kwargs))
+    return result
@@ -1,5 +1,8 @@
 # Copyright (c) 2023, DeepLink.
+from multiprocessing.reduction import ForkingPickler
+
 import torch
+import torch.multiprocessing.reductions as _reductions
 from torch.serialization import register_package
 from torch.storage import UntypedStorage
 from torch_dipu import mockcuda
@@ -101,3 +104,62 @@ UntypedStorage.resize_ = _resize
 UntypedStorage.__new__ = GetDeviceProxy(
     torch.UntypedStorage.__new__, pos=-1, caller="class_new"
 )
+
+
+def _share_device_(self):
+    r"""Returns a handle another process opens the memory of this device
+    storage by, with :meth:`UntypedStorage._new_shared_device`. The memory is
+    not reused until every receiver released it. Work queued on the current
+    stream so far is waited for."""
+    return _C._dipu_share_device_storage(self)
+
+
+def _new_shared_device(handle):
+    return _C._dipu_open_shared_device_storage(handle)
+
+
+UntypedStorage._share_device_ = _share_device_
+UntypedStorage._new_shared_device = staticmethod(_new_shared_device)
+
+
+def _rebuild_dipu_tensor(
+    cls, handle, dtype, storage_offset, size, stride, requires_grad
+):
+    storage = torch.storage.TypedStorage(
+        wrap_storage=_new_shared_device(handle), dtype=dtype, _internal=True
+    )
+    tensor = torch._utils._rebuild_tensor(storage, storage_offset, size, stride)
+    if cls == torch.nn.parameter.Parameter:
+        # requires_grad of a Parameter must be set by its constructor
+        return torch.nn.parameter.Parameter(tensor, requires_grad=requires_grad)
+    tensor.requires_grad = requires_grad
+    return tensor
+
+
+# torch would share device tensors as cuda ones, by _share_cuda_
+def _reduce_tensor(tensor):
+    if tensor.device.type != __diputype__:
+        return _reductions.reduce_tensor(tensor)
+    if tensor.requires_grad and not tensor.is_leaf:
+        raise RuntimeError(
+            "Cowardly refusing to serialize non-leaf tensor which requires_grad, "
+            "since autograd does not support crossing process boundaries.  "
+            "If you just want to transfer the data, call detach() on the tensor "
+            "before serializing (e.g., putting it on the queue)."
+        )
+    return (
+        _rebuild_dipu_tensor,
+        (
+            type(tensor),
+            tensor.untyped_storage()._share_device_(),
+            tensor.dtype,
+            tensor.storage_offset(),
+            tensor.size(),
+            tensor.stride(),
+            tensor.requires_grad,
+        ),
+    )
+
+
+ForkingPickler.register(torch.Tensor, _reduce_tensor)
+ForkingPickler.register(torch.nn.parameter.Parameter, _reduce_tensor)
@@ -27,7 +27,9 @@ class Stream(_C._DIPUStreamBase):
             the stream. If :attr:`device` is ``None`` (default) or a negative
             integer, this will use the current device.
         priority(int, optional): priority of the stream. Lower numbers
-                                 represent higher priorities.
+                                 represent higher priorities, any negative
+                                 value takes a stream from the high priority
+                                 pool.
     """
 
     def __init__(self, device=None, priority=0, **kwargs):
@@ -115,10 +117,29 @@ class Stream(_C._DIPUStreamBase):
             self.device, self.dipu_stream
         )
 
-    # mock
-    @property
-    def priority(self):
-        return 0
+
+class ExternalStream(Stream):
+    r"""Wrapper around an externally allocated dipu stream.
+
+    This class is used to wrap streams allocated in other libraries in order
+    to facilitate data exchange and multi-library interactions.
+
+    .. note:: This class doesn't manage the stream life-cycle, it is the user
+       responsibility to keep the referenced stream alive while this class is
+       being used.
+
+    Arguments:
+        stream_ptr(int): Integer representation of the raw stream value
+            allocated externally.
+        device(torch.device or int, optional): the device where the stream
+            was originally allocated. If device is specified incorrectly,
+            subsequent launches using this stream may fail.
+    """
+
+    def __init__(self, stream_ptr, device=None, **kwargs):
+        super(ExternalStream, self).__init__(
+            device=device, stream_ptr=stream_ptr, **kwargs
+        )
 
 
 def _dipu_set_stream(
@@ -152,6 +173,22 @@ def set_stream(stream: Stream):
     _dipu_set_stream(stream_id=stream.stream_id, device_index=stream.device_index)
 
 
+# Stream objects by (stream_id, device_index, device_type), they wrap a
+# stream of a pool and never change
+_streams = {}
+
+
+def _cached_stream(key):
+    stream = _streams.get(key)
+    if stream is None:
+        stream_id, device_index, device_type = key
+        stream = Stream(
+            stream_id=stream_id, device_index=device_index, device_type=device_type
+        )
+        _streams[key] = stream
+    return stream
+
+
 def current_stream(device=None):
     r"""Returns the currently selected :class:`Stream` for a given device.
 
@@ -162,10 +199,9 @@ def current_stream(device=None):
             (default).
     """
     _lazy_init()
-    st = _C._dipu_getCurrentStream(_get_device_index(device, optional=True))
-    return Stream(
-        stream_id=st.stream_id, device_index=st.device_index, device_type=st.device_type
-    )
+    if device is not None:
+        device = _get_device_index(device, optional=True)
+    return _cached_stream(_C._dipu_currentStreamKey(device))
 
 
 def default_stream(device=None):
@@ -180,14 +216,10 @@ def set_sync_debug_mode(debug_mode: Union[int, str]) -> None:
     pass
 
 
-original_is_current_stream_capturing = torch.cuda.is_current_stream_capturing
-
-
 def is_current_stream_capturing() -> bool:
-    # cuda.is_available is patched and we can't use it here
-    if dipu.vendor_type == "CUDA":
-        return original_is_current_stream_capturing()
-    return False
+    r"""Returns True if the current dipu stream is being captured by a
+    :class:`DIPUGraph`."""
+    return _C._dipu_is_current_stream_capturing()
 
 
 class StreamContext:
@@ -275,9 +307,7 @@ class Event(_C._DIPUEventBase):
         Uses ``torch_dipu.dipu.current_stream()`` if no stream is specified. The
         stream's device must match the event's device.
         """
-        if stream is None:
-            stream = current_stream()
-        super(Event, self).record(stream)
+        _C._dipu_eventRecord(self, stream)
 
     def wait(self, stream=None):
         r"""Makes all future work submitted to the given stream wait for this
@@ -285,9 +315,7 @@ class Event(_C._DIPUEventBase):
 
         Use ``torch_dipu.dipu.current_stream()`` if no stream is specified.
         """
-        if stream is None:
-            stream = current_stream()
-        super(Event, self).wait(stream)
+        _C._dipu_eventWait(self, stream)
 
     def query(self):
         r"""Checks if all work currently captured by event has completed.
@@ -296,7 +324,7 @@ class Event(_C._DIPUEventBase):
             A boolean indicating if all work currently captured by event has
             completed.
         """
-        return super(Event, self).query()
+        return _C._dipu_eventQuery(self)
 
     def elapsed_time(self, end_event):
         r"""Returns the time elapsed in milliseconds after the event was
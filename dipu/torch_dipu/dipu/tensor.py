@@ -1,7 +1,10 @@
 # Copyright (c) 2023, DeepLink.
 import torch
+from torch.utils._pytree import tree_flatten, tree_unflatten
+from torch.utils.data._utils.pin_memory import pin_memory as _torch_pin_memory
 
 from .device import __diputype__, __dipu_device_type__
+from .streams import Event, current_stream
 from torch_dipu import _C, mockcuda
 
 
@@ -27,6 +30,98 @@ def _wrap_tensor_type(self, *args, **kwargs):
         return ret
 
 
+def copy_many(dsts, srcs, non_blocking=False):
+    r"""Copy each tensor in ``srcs`` into the tensor at the same position in
+    ``dsts``, same as ``dst.copy_(src, non_blocking)`` for every pair.
+
+    Small contiguous host-to-device and device-to-host pairs are packed into
+    one staging buffer, so copying many small tensors (e.g. optimizer states)
+    costs a single transfer and sync instead of one per tensor.
+    """
+    dsts = list(dsts)
+    srcs = list(srcs)
+    if len(dsts) != len(srcs):
+        raise ValueError(
+            f"copy_many got {len(dsts)} dst tensors but {len(srcs)} src tensors"
+        )
+    with torch.no_grad():
+        _C._dipu_copy_many(dsts, srcs, non_blocking)
+
+
+def pin_memory_batch(data, device=None):
+    r"""Same as ``torch.utils.data._utils.pin_memory.pin_memory(data)``, but
+    all CPU tensors in ``data`` (e.g. a collated batch of nested lists, tuples
+    and dicts) are pinned into one pinned region as views of it, instead of
+    one pinned allocation and copy per tensor.
+    """
+    leaves, spec = tree_flatten(data)
+    indices = [
+        i
+        for i, leaf in enumerate(leaves)
+        if isinstance(leaf, torch.Tensor) and leaf.device.type == "cpu"
+    ]
+    if not indices:
+        return _torch_pin_memory(data, device)
+    pinned = _C._dipu_pin_memory_batch([leaves[i] for i in indices])
+    for i, tensor in zip(indices, pinned):
+        leaves[i] = tensor
+    pinned_indices = set(indices)
+    for i, leaf in enumerate(leaves):
+        if i not in pinned_indices:
+            leaves[i] = _torch_pin_memory(leaf, device)
+    return tree_unflatten(leaves, spec)
+
+
+class AsyncScalar:
+    r"""The value of a one-element device tensor, read back by
+    :func:`item_async` without synchronizing the stream.
+
+    :meth:`item` waits only for the event recorded after the copy, so work
+    queued after :func:`item_async` keeps the device busy meanwhile.
+    """
+
+    def __init__(self, tensor: torch.Tensor):
+        if tensor.numel() != 1:
+            raise ValueError(
+                f"item_async expects a tensor with one element, got {tensor.numel()}"
+            )
+        tensor = tensor.detach().reshape(())
+        self._event = None
+        if tensor.device.type == "cpu":
+            self._host = tensor
+            return
+        self._host = torch.empty((), dtype=tensor.dtype).pin_memory()
+        self._host.copy_(tensor, non_blocking=True)
+        self._event = Event()
+        self._event.record(current_stream(tensor.device))
+
+    def done(self) -> bool:
+        r"""Whether the value arrived, without blocking."""
+        return self._event is None or self._event.query()
+
+    def wait(self) -> None:
+        r"""Blocks until the value arrived."""
+        if self._event is not None:
+            self._event.synchronize()
+
+    def item(self):
+        r"""The value as a Python number, same as ``tensor.item()``."""
+        self.wait()
+        return self._host.item()
+
+    def __bool__(self):
+        return bool(self.item())
+
+
+def item_async(tensor: torch.Tensor) -> AsyncScalar:
+    r"""Starts copying the value of the one-element ``tensor`` to the host on
+    the current stream and returns an :class:`AsyncScalar` for it. Unlike
+    ``tensor.item()`` this does not wait for the stream, e.g. read a stop flag
+    of beam search a step later, or wait for it once the next step is queued.
+    """
+    return AsyncScalar(tensor)
+
+
 # need enhance, seems change tensor define is need
 def apply_tensor_type_patch():
     torch.set_default_tensor_type = __set_default_tensor_type
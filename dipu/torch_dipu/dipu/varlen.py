@@ -0,0 +1,112 @@
+# Copyright (c) 2024, DeepLink.
+from typing import Callable, List, Optional, Sequence
+
+import torch
+
+
+class PackedSequences:
+    r"""Sequences of different lengths packed back to back along the first
+    dim of ``values``, without padding, as varlen kernels take them. Sequence
+    ``i`` is ``values[cu_seqlens[i]:cu_seqlens[i + 1]]``.
+
+    Batching requests of different lengths this way spends no compute on
+    padding. Token-wise layers, e.g. linear layers, layer norms and
+    activations, run on ``values`` as they are, by :meth:`map`, and
+    :func:`varlen_attention` keeps the tokens of each sequence apart.
+
+    ``cu_seqlens`` is int32 on the device of ``values``. The lengths are also
+    kept on the host, so that neither the kernels nor :meth:`unbind` sync.
+
+    Example::
+
+        x = PackedSequences.from_sequences([a, b, c])  # each [len, hidden]
+        h = x.map(norm)
+        q = h.map(lambda t: q_proj(t).view(-1, heads, head_dim))
+        k = h.map(lambda t: k_proj(t).view(-1, kv_heads, head_dim))
+        v = h.map(lambda t: v_proj(t).view(-1, kv_heads, head_dim))
+        out = varlen_attention(q, k, v, causal=True)
+    """
+
+    def __init__(self, values: torch.Tensor, lengths: Sequence[int]):
+        lengths = [int(n) for n in lengths]
+        if sum(lengths) != values.size(0):
+            raise ValueError(
+                f"{values.size(0)} packed tokens, but the lengths add up to "
+                f"{sum(lengths)}"
+            )
+        self.values = values
+        self.lengths = lengths
+        self.max_seqlen = max(lengths, default=0)
+        offsets = [0]
+        for n in lengths:
+            offsets.append(offsets[-1] + n)
+        self.cu_seqlens = torch.tensor(offsets, dtype=torch.int32).to(
+            values.device, non_blocking=True
+        )
+
+    @classmethod
+    def from_sequences(cls, sequences: Sequence[torch.Tensor]) -> "PackedSequences":
+        return cls(torch.cat(list(sequences)), [s.size(0) for s in sequences])
+
+    @classmethod
+    def from_padded(
+        cls, padded: torch.Tensor, lengths: Sequence[int]
+    ) -> "PackedSequences":
+        r"""Packs the first ``lengths[i]`` tokens of row ``i`` of ``padded``,
+        of shape ``[batch, max_len, ...]``."""
+        return cls.from_sequences([padded[i, :n] for i, n in enumerate(lengths)])
+
+    def to_padded(self, padding_value: float = 0.0) -> torch.Tensor:
+        r"""The sequences padded to ``[batch, max_seqlen, ...]``."""
+        return torch.nn.utils.rnn.pad_sequence(
+            self.unbind(), batch_first=True, padding_value=padding_value
+        )
+
+    def unbind(self) -> List[torch.Tensor]:
+        return list(self.values.split(self.lengths))
+
+    def map(self, fn: Callable[[torch.Tensor], torch.Tensor]) -> "PackedSequences":
+        r"""``fn`` applied to ``values``, keeping the sequences. ``fn`` must
+        map each token to one token."""
+        values = fn(self.values)
+        if values.size(0) != self.values.size(0):
+            raise ValueError(
+                f"fn maps {self.values.size(0)} tokens to {values.size(0)}"
+            )
+        packed = PackedSequences.__new__(PackedSequences)
+        packed.values = values
+        packed.lengths = self.lengths
+        packed.max_seqlen = self.max_seqlen
+        packed.cu_seqlens = self.cu_seqlens
+        return packed
+
+    def __len__(self) -> int:
+        return len(self.lengths)
+
+
+def varlen_attention(
+    q: PackedSequences,
+    k: PackedSequences,
+    v: PackedSequences,
+    causal: bool = False,
+    scale: Optional[float] = None,
+) -> PackedSequences:
+    r"""Attention of each sequence of ``q`` over the same sequence of ``k``
+    and ``v``, by ``dipu::varlen_attention``. The values are of shape
+    ``[tokens, heads, head_dim]``, the heads of ``q`` being a multiple of
+    those of ``k`` and ``v`` for grouped query attention. ``scale`` is
+    ``1 / sqrt(head_dim)`` by default."""
+    if len(q) != len(k) or k.lengths != v.lengths:
+        raise ValueError("q, k and v must hold the same sequences")
+    out = torch.ops.dipu.varlen_attention(
+        q.values,
+        k.values,
+        v.values,
+        q.cu_seqlens,
+        k.cu_seqlens,
+        q.max_seqlen,
+        k.max_seqlen,
+        scale,
+        causal,
+    )
+    return q.map(lambda _: out)
@@ -1 +1,9 @@
 from .profiler import NativeProfile
+from .sampling import SamplingProfiler
+from .trace_stream import TraceStream
+from .clock import align_time_base, reset_time_base
+from .memory import memory_peak_attribution, memory_peak_table
+from .counters import rank_kernels, set_counters, supported_counters
+from .python_stack import skip_python_frames, skipped_python_prefixes
+from .summary import diff_summaries, summarize_trace
+from .overlap import analyze_overlap, annotate_trace
@@ -0,0 +1,41 @@
+# Copyright (c) 2024, DeepLink.
+import statistics
+from typing import Optional
+
+import torch
+import torch.distributed as dist
+
+from torch_dipu import _C
+
+
+def align_time_base(group: Optional[dist.ProcessGroup] = None, rounds: int = 5) -> int:
+    r"""Shift the times of the traces exported by this rank onto the clock of
+    rank 0 of ``group``, so that the traces of all ranks line up in one view,
+    e.g. to find stragglers.
+
+    Each of ``rounds`` exchanges samples the host clocks of all ranks right
+    after a barrier and gathers them through the process group. The median
+    difference to rank 0 is kept as the offset, in nanoseconds, which is
+    returned. Every rank of ``group`` must call it, before the profiled
+    region is exported.
+    """
+    world_size = dist.get_world_size(group)
+    device = torch.device("cuda", torch.cuda.current_device())
+    offsets = []
+    for _ in range(rounds):
+        dist.barrier(group)
+        local = torch.tensor([_C._dipu_profiler_time_ns()], dtype=torch.int64)
+        gathered = [
+            torch.empty(1, dtype=torch.int64, device=device)
+            for _ in range(world_size)
+        ]
+        dist.all_gather(gathered, local.to(device), group=group)
+        offsets.append(gathered[0].item() - local.item())
+    offset = int(statistics.median(offsets))
+    _C._dipu_set_profiler_time_offset(offset)
+    return offset
+
+
+def reset_time_base() -> None:
+    r"""Export the times of this rank on its own clock again."""
+    _C._dipu_set_profiler_time_offset(0)
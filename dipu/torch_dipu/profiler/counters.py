@@ -0,0 +1,42 @@
+# Copyright (c) 2024, DeepLink.
+import json
+from collections import defaultdict
+from typing import Dict, List
+
+from torch_dipu import _C
+
+
+def supported_counters() -> List[str]:
+    r"""The hardware counters the profiling library of the vendor can attach
+    to the kernels of a :class:`torch.profiler.profile` trace."""
+    return _C._dipu_profiler_counters()
+
+
+def set_counters(counters: List[str]) -> None:
+    r"""Collect ``counters``, a subset of :func:`supported_counters`, in the
+    next traces. Their values show up as the args of the kernels."""
+    _C._dipu_set_profiler_counters(list(counters))
+
+
+def rank_kernels(trace_path: str, counter: str) -> List[Dict[str, float]]:
+    r"""Rank the kernels of an exported chrome trace by the mean of
+    ``counter``, lowest first, e.g. to find the kernels furthest from the
+    roofline. Each item has the kernel ``name``, its ``calls``, ``total_us``
+    and ``mean`` counter value."""
+    with open(trace_path) as f:
+        events = json.load(f)["traceEvents"]
+    kernels: Dict[str, List[float]] = defaultdict(lambda: [0, 0.0, 0.0])
+    for event in events:
+        args = event.get("args", {})
+        if event.get("cat") != "kernel" or counter not in args:
+            continue
+        stats = kernels[event["name"]]
+        stats[0] += 1
+        stats[1] += event.get("dur", 0)
+        stats[2] += float(args[counter])
+    ranked = [
+        {"name": name, "calls": calls, "total_us": total, "mean": value / calls}
+        for name, (calls, total, value) in kernels.items()
+    ]
+    ranked.sort(key=lambda item: item["mean"])
+    return ranked
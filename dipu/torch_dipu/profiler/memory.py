@@ -0,0 +1,104 @@
+# Copyright (c) 2024, DeepLink.
+from collections import defaultdict
+from typing import Any, Dict, List, Optional, Tuple
+
+from torch._C._profiler import _EventType
+
+
+def _walk(roots):
+    stack = list(roots)
+    while stack:
+        node = stack.pop()
+        yield node
+        stack.extend(node.children)
+
+
+def _origin(node) -> Tuple[str, Tuple[str, ...]]:
+    # the innermost torch op above an allocation and the python frames above it
+    op = ""
+    frames = []
+    parent = node.parent
+    while parent is not None:
+        if parent.tag == _EventType.TorchOp and not op:
+            op = parent.name
+        elif parent.tag in (_EventType.PyCall, _EventType.PyCCall):
+            frames.append(parent.name)
+        parent = parent.parent
+    return op, tuple(reversed(frames))
+
+
+def memory_peak_attribution(prof, device: Optional[str] = None) -> Dict[str, Any]:
+    r"""Attribute the memory in use at the peak of ``device``, by default the
+    device with the highest peak, to the ops and python stacks that allocated
+    it.
+
+    ``prof`` is a finished :class:`torch.profiler.profile` run with
+    ``profile_memory=True``, and ``with_stack=True`` for the python stacks.
+    Returns the ``device``, its ``peak_bytes`` and the ``allocations`` live at
+    the peak, grouped by ``op`` and ``stack`` (outermost frame first) with
+    their ``bytes`` and ``count``, largest first.
+    """
+    roots = prof.profiler.kineto_results.experimental_event_tree()
+    events: Dict[str, List] = defaultdict(list)
+    for node in _walk(roots):
+        if node.tag != _EventType.Allocation:
+            continue
+        fields = node.extra_fields
+        # the segment events of the DIPU allocators have no size
+        if fields.alloc_size != 0:
+            events[str(fields.device)].append(node)
+
+    best = None
+    for dev, nodes in events.items():
+        if device is not None and dev != str(device):
+            continue
+        nodes.sort(key=lambda n: n.start_time_ns)
+        total = peak = 0
+        peak_index = -1
+        for i, node in enumerate(nodes):
+            total += node.extra_fields.alloc_size
+            if total > peak:
+                peak, peak_index = total, i
+        if best is None or peak > best[1]:
+            best = (dev, peak, nodes[: peak_index + 1])
+    if best is None:
+        return {"device": device, "peak_bytes": 0, "allocations": []}
+
+    dev, peak, nodes = best
+    # replay up to the peak, the allocations not freed by then are live
+    live: Dict[int, Any] = {}
+    for node in nodes:
+        fields = node.extra_fields
+        if fields.alloc_size > 0:
+            live[fields.ptr] = node
+        else:
+            live.pop(fields.ptr, None)
+    groups: Dict[Tuple[str, Tuple[str, ...]], List[int]] = defaultdict(
+        lambda: [0, 0]
+    )
+    for node in live.values():
+        group = groups[_origin(node)]
+        group[0] += node.extra_fields.alloc_size
+        group[1] += 1
+    allocations = [
+        {"op": op, "stack": list(stack), "bytes": nbytes, "count": count}
+        for (op, stack), (nbytes, count) in groups.items()
+    ]
+    allocations.sort(key=lambda item: item["bytes"], reverse=True)
+    return {"device": dev, "peak_bytes": peak, "allocations": allocations}
+
+
+def memory_peak_table(
+    prof, device: Optional[str] = None, row_limit: int = 20, stack_depth: int = 3
+) -> str:
+    r"""Format :func:`memory_peak_attribution` as a table, with the innermost
+    ``stack_depth`` python frames of each row."""
+    result = memory_peak_attribution(prof, device)
+    lines = [f"peak of {result['device']}: {result['peak_bytes']} bytes"]
+    lines.append(f"{'bytes':>14}  {'count':>6}  {'op':<40}  stack")
+    for item in result["allocations"][:row_limit]:
+        stack = " <- ".join(reversed(item["stack"][-stack_depth:]))
+        lines.append(
+            f"{item['bytes']:>14}  {item['count']:>6}  {item['op'] or '-':<40}  {stack}"
+        )
+    return "\n".join(lines)
@@ -0,0 +1,479 @@
+# Copyright (c) 2024, DeepLink.
+r"""How well the streams of each step overlap, from the device records of an
+exported chrome trace: the critical path of the step, the busy time of each
+stream, how much of the communication is hidden under compute, and what the
+streams waited for when idle::
+
+    python -m torch_dipu.profiler.overlap trace.json
+    python -m torch_dipu.profiler.overlap trace.json --annotate annotated.json
+
+The device records of DIPU are on track ``(device, stream id)``. Steps are the
+``ProfilerStep#N`` ranges of :func:`torch.profiler.profile.step`, the whole
+trace if there are none. Idle time before a kernel is attributed to
+
+- ``sync``, while the host blocked in a synchronization;
+- ``host_launch``, the rest of the time until the host launched the kernel;
+- ``event_wait``, when it waited for a kernel of another stream that ended
+  right before it started, which is how event waits show on the timeline;
+- ``other``, the remaining idle time.
+"""
+import argparse
+import bisect
+import json
+import re
+import sys
+from collections import defaultdict
+from typing import Any, Dict, List, Optional, Pattern, Tuple
+
+from .summary import _DEVICE_CATEGORIES, _load
+
+__all__ = ["analyze_overlap", "annotate_trace", "format_overlap"]
+
+GAP_KINDS = ("host_launch", "sync", "event_wait", "other")
+COMM_PATTERN = re.compile(
+    r"^dicl|nccl|hccl|cncl|all_?reduce|all_?gather|reduce_?scatter|"
+    r"all_?to_?all|broadcast|send|recv",
+    re.IGNORECASE,
+)
+SYNC_PATTERN = re.compile(
+    r"synchronize|_local_scalar_dense|aten::item$", re.IGNORECASE
+)
+_HOST_CATEGORIES = ("cpu_op", "cuda_runtime", "cuda_driver", "user_annotation")
+_STEP_PREFIX = "ProfilerStep#"
+# the track of the critical paths, on the pid of each device
+_CRITICAL_PATH_TID = 0x7FFFFFFF
+_ANNOTATION_CAT = "dipu_overlap"
+
+
+class _Kernel:
+    __slots__ = ("event", "start", "end", "stream", "comm", "launch", "prev", "dep")
+
+    def __init__(self, event, comm):
+        self.event = event
+        self.start = event["ts"]
+        self.end = event["ts"] + event.get("dur", 0)
+        self.stream = event.get("tid")
+        self.comm = comm
+        # host time of the launch, if linked in the trace
+        self.launch: Optional[float] = None
+        # the previous kernel on the stream, and the kernel of another stream
+        # it seemingly waited for
+        self.prev: Optional["_Kernel"] = None
+        self.dep: Optional["_Kernel"] = None
+
+
+def _union(intervals) -> List[Tuple[float, float]]:
+    merged: List[Tuple[float, float]] = []
+    for lo, hi in sorted(intervals):
+        if merged and lo <= merged[-1][1]:
+            merged[-1] = (merged[-1][0], max(merged[-1][1], hi))
+        elif hi > lo:
+            merged.append((lo, hi))
+    return merged
+
+
+def _length(merged) -> float:
+    return sum(hi - lo for lo, hi in merged)
+
+
+def _intersect(a, b) -> List[Tuple[float, float]]:
+    result = []
+    i = j = 0
+    while i < len(a) and j < len(b):
+        lo, hi = max(a[i][0], b[j][0]), min(a[i][1], b[j][1])
+        if lo < hi:
+            result.append((lo, hi))
+        if a[i][1] < b[j][1]:
+            i += 1
+        else:
+            j += 1
+    return result
+
+
+def _covered(merged, lo: float, hi: float) -> float:
+    return _length(_intersect(merged, [(lo, hi)])) if hi > lo else 0.0
+
+
+def _launch_times(events) -> Dict[Tuple[Any, Any, Any], float]:
+    # kernel track and start -> host launch time, by the correlation ids of
+    # the runtime calls or by the launch flows of the DIPU records
+    runtime = {}
+    for event in events:
+        if event.get("ph") == "X" and event.get("cat") == "cuda_runtime":
+            correlation = event.get("args", {}).get("correlation")
+            if correlation is not None:
+                runtime[correlation] = event["ts"]
+    flow_starts = {}
+    flow_ends = {}
+    for event in events:
+        if event.get("cat") != "ac2g":
+            continue
+        if event.get("ph") == "s":
+            flow_starts[event.get("id")] = event["ts"]
+        elif event.get("ph") == "f":
+            track = (event.get("pid"), event.get("tid"), event["ts"])
+            flow_ends[event.get("id")] = track
+    launches = {}
+    for event in events:
+        if event.get("ph") != "X" or event.get("cat") not in _DEVICE_CATEGORIES:
+            continue
+        correlation = event.get("args", {}).get("correlation")
+        if correlation in runtime:
+            key = (event.get("pid"), event.get("tid"), event["ts"])
+            launches[key] = runtime[correlation]
+    for flow_id, key in flow_ends.items():
+        if flow_id in flow_starts:
+            launches.setdefault(key, flow_starts[flow_id])
+    return launches
+
+
+def _steps(events) -> List[Tuple[str, float, float]]:
+    steps = [
+        (event["name"], event["ts"], event["ts"] + event.get("dur", 0))
+        for event in events
+        if event.get("ph") == "X" and event.get("name", "").startswith(_STEP_PREFIX)
+    ]
+    steps.sort(key=lambda step: step[1])
+    return steps
+
+
+def _link(kernels: List[_Kernel], tolerance_us: float) -> None:
+    by_stream = defaultdict(list)
+    for kernel in kernels:
+        by_stream[kernel.stream].append(kernel)
+    for stream_kernels in by_stream.values():
+        for prev, kernel in zip(stream_kernels, stream_kernels[1:]):
+            kernel.prev = prev
+    ends = sorted(kernels, key=lambda k: k.end)
+    end_times = [k.end for k in ends]
+    for kernel in kernels:
+        # the last kernel of another stream ending around its start
+        i = bisect.bisect_right(end_times, kernel.start + tolerance_us)
+        while i > 0 and ends[i - 1].end >= kernel.start - tolerance_us:
+            candidate = ends[i - 1]
+            if candidate.stream != kernel.stream and candidate.start < kernel.start:
+                kernel.dep = candidate
+                break
+            i -= 1
+
+
+def _gap(lo, hi, launch, waited, sync) -> Dict[str, float]:
+    # [lo, hi) idle before a kernel launched at launch
+    parts = dict.fromkeys(GAP_KINDS, 0.0)
+    if hi <= lo:
+        return parts
+    parts["sync"] = _covered(sync, lo, hi)
+    rest = hi - lo - parts["sync"]
+    if launch is not None and launch > lo:
+        until = min(launch, hi)
+        parts["host_launch"] = until - lo - _covered(sync, lo, until)
+        rest -= parts["host_launch"]
+    parts["event_wait" if waited else "other"] += max(rest, 0.0)
+    return parts
+
+
+def _critical_path(kernels, begin, end, sync):
+    # walks back from the last kernel to what each one waited for, splitting
+    # [begin, end) into kernels and the gaps between them
+    path = dict.fromkeys(("compute", "comm") + GAP_KINDS, 0.0)
+    segments = []
+
+    def add_gap(lo, hi, launch, waited):
+        lo = max(lo, begin)
+        parts = _gap(lo, hi, launch, waited, sync)
+        for kind, us in parts.items():
+            path[kind] += us
+        if hi > lo:
+            kind = max(parts, key=parts.get)
+            segments.append(
+                {"name": kind, "kind": kind, "stream": None, "ts": lo, "dur": hi - lo}
+            )
+
+    by_end = sorted(kernels, key=lambda k: k.end)
+    end_times = [k.end for k in by_end]
+    cur = by_end[-1] if by_end else None
+    t = end
+    seen = set()
+    while cur is not None and t > begin and id(cur) not in seen:
+        seen.add(id(cur))
+        start = max(cur.start, begin)
+        if min(cur.end, t) > start:
+            kind = "comm" if cur.comm else "compute"
+            path[kind] += min(cur.end, t) - start
+            segments.append(
+                {
+                    "name": cur.event["name"],
+                    "kind": kind,
+                    "stream": cur.stream,
+                    "ts": start,
+                    "dur": min(cur.end, t) - start,
+                }
+            )
+        t = start
+        if t <= begin:
+            break
+        ready = []
+        if cur.prev is not None:
+            ready.append((cur.prev.end, 1, cur.prev))
+        if cur.dep is not None:
+            ready.append((cur.dep.end, 2, cur.dep))
+        if cur.launch is not None:
+            ready.append((cur.launch, 0, None))
+        if not ready:
+            add_gap(begin, t, None, False)
+            break
+        ready_at, reason, nxt = max(ready, key=lambda r: (r[0], r[1]))
+        ready_at = min(ready_at, t)
+        if nxt is None:
+            # launched late, the host held up the device since its last kernel
+            i = bisect.bisect_right(end_times, ready_at)
+            nxt = by_end[i - 1] if i > 0 else None
+            lo = nxt.end if nxt is not None else begin
+            add_gap(lo, t, t, False)
+            t = max(lo, begin)
+        else:
+            add_gap(ready_at, t, None, reason == 2)
+            t = ready_at
+        cur = nxt
+    if (cur is None or id(cur) in seen) and t > begin:
+        add_gap(begin, t, None, False)
+    segments.reverse()
+    return path, segments
+
+
+def analyze_overlap(
+    trace,
+    comm_pattern: Optional[Pattern] = None,
+    sync_pattern: Optional[Pattern] = None,
+    tolerance_us: float = 2.0,
+) -> List[Dict[str, Any]]:
+    r"""Analyze the stream scheduling of ``trace``, the path or the loaded
+    json of a trace exported by
+    :meth:`torch.profiler.profile.export_chrome_trace`.
+
+    Returns an item per step and device with the ``step`` name, the
+    ``device``, the ``begin_us`` and ``wall_us`` of the step on it, from the
+    start of the step on the host to the end of its last kernel, and
+
+    - ``critical_path``: ``compute``, ``comm`` and the idle kinds of
+      :data:`GAP_KINDS` in us, adding up to ``wall_us``;
+    - ``streams``: per stream id, its ``busy_us``, ``utilization`` and
+      ``idle`` us by kind;
+    - ``compute_us`` and ``comm_us``, the time any stream computed or
+      communicated, their ``overlap_us``, ``exposed_comm_us`` and the
+      ``overlap`` fraction of the communication hidden under compute;
+    - ``idle_us``, the time no stream was busy;
+    - ``critical_path_events``: the kernels and idle gaps on the critical
+      path, each with its ``name``, ``kind``, ``stream``, ``ts`` and ``dur``.
+
+    Kernels are communication if their name matches ``comm_pattern``, by
+    default the DICL and vendor collective names, and the host
+    synchronizes in the ops and runtime calls matching ``sync_pattern``.
+    Kernels belong to the step that launched them, or that they started in
+    if the trace lacks the launch. ``tolerance_us`` bounds the gap between
+    a kernel and the one of another stream it waited for.
+    """
+    comm_pattern = comm_pattern or COMM_PATTERN
+    sync_pattern = sync_pattern or SYNC_PATTERN
+    events = _load(trace)
+    launches = _launch_times(events)
+    steps = _steps(events)
+    sync = _union(
+        (event["ts"], event["ts"] + event.get("dur", 0))
+        for event in events
+        if event.get("ph") == "X"
+        and event.get("cat") in _HOST_CATEGORIES
+        and sync_pattern.search(event.get("name", ""))
+    )
+
+    devices = defaultdict(list)
+    for event in events:
+        if event.get("ph") != "X" or event.get("cat") not in _DEVICE_CATEGORIES:
+            continue
+        kernel = _Kernel(event, bool(comm_pattern.search(event.get("name", ""))))
+        kernel.launch = launches.get((event.get("pid"), event.get("tid"), event["ts"]))
+        devices[event.get("pid")].append(kernel)
+    if not steps:
+        starts = [k.start for ks in devices.values() for k in ks]
+        ends = [k.end for ks in devices.values() for k in ks]
+        if starts:
+            steps = [("all", min(starts), max(ends))]
+    step_starts = [step[1] for step in steps]
+
+    result = []
+    for device, kernels in sorted(devices.items(), key=lambda item: str(item[0])):
+        kernels.sort(key=lambda k: k.start)
+        by_step = defaultdict(list)
+        for kernel in kernels:
+            at = kernel.launch if kernel.launch is not None else kernel.start
+            i = bisect.bisect_right(step_starts, at) - 1
+            if i >= 0:
+                by_step[i].append(kernel)
+        for i, (name, step_begin, step_end) in enumerate(steps):
+            step_kernels = by_step.get(i)
+            if not step_kernels:
+                continue
+            _link(step_kernels, tolerance_us)
+            begin = min(step_begin, step_kernels[0].start)
+            end = max(k.end for k in step_kernels)
+            path, segments = _critical_path(step_kernels, begin, end, sync)
+
+            streams = {}
+            for stream in sorted({k.stream for k in step_kernels}, key=str):
+                on_stream = [k for k in step_kernels if k.stream == stream]
+                busy = _length(_union((k.start, k.end) for k in on_stream))
+                idle = dict.fromkeys(GAP_KINDS, 0.0)
+                lo = begin
+                for kernel in on_stream:
+                    waited = kernel.dep is not None
+                    for kind, us in _gap(
+                        lo, kernel.start, kernel.launch, waited, sync
+                    ).items():
+                        idle[kind] += us
+                    lo = max(lo, kernel.end)
+                idle["other"] += end - lo
+                streams[stream] = {
+                    "busy_us": busy,
+                    "utilization": busy / (end - begin) if end > begin else 0.0,
+                    "idle": idle,
+                }
+
+            comm = _union((k.start, k.end) for k in step_kernels if k.comm)
+            compute = _union((k.start, k.end) for k in step_kernels if not k.comm)
+            overlap = _length(_intersect(comm, compute))
+            comm_us = _length(comm)
+            result.append(
+                {
+                    "step": name,
+                    "device": device,
+                    "begin_us": begin,
+                    "wall_us": end - begin,
+                    "critical_path": path,
+                    "streams": streams,
+                    "compute_us": _length(compute),
+                    "comm_us": comm_us,
+                    "overlap_us": overlap,
+                    "exposed_comm_us": comm_us - overlap,
+                    "overlap": overlap / comm_us if comm_us else 0.0,
+                    "idle_us": end - begin - _length(_union(comm + compute)),
+                    "critical_path_events": segments,
+                }
+            )
+    return result
+
+
+def annotate_trace(trace, analysis: List[Dict[str, Any]], path: str) -> None:
+    r"""Write ``trace`` to ``path`` with ``analysis``, the result of
+    :func:`analyze_overlap` on it, as a "critical path" track on each device
+    holding a range per step with its metrics, and the kernels and idle gaps
+    on its critical path."""
+    if isinstance(trace, str):
+        with open(trace) as f:
+            trace = json.load(f)
+    events = trace["traceEvents"] if isinstance(trace, dict) else trace
+    annotations = []
+    for device in {item["device"] for item in analysis}:
+        annotations.append(
+            {
+                "ph": "M",
+                "name": "thread_name",
+                "pid": device,
+                "tid": _CRITICAL_PATH_TID,
+                "args": {"name": "critical path"},
+            }
+        )
+    for item in analysis:
+        track = {"pid": item["device"], "tid": _CRITICAL_PATH_TID}
+        metrics = {
+            key: value
+            for key, value in item.items()
+            if key not in ("streams", "critical_path_events")
+        }
+        metrics["streams"] = {str(s): v for s, v in item["streams"].items()}
+        annotations.append(
+            dict(
+                track,
+                ph="X",
+                cat=_ANNOTATION_CAT,
+                name=f"{item['step']} overlap {item['overlap']:.0%}",
+                ts=item["begin_us"],
+                dur=item["wall_us"],
+                args=metrics,
+            )
+        )
+        for segment in item["critical_path_events"]:
+            annotations.append(
+                dict(
+                    track,
+                    ph="X",
+                    cat=_ANNOTATION_CAT,
+                    name=segment["name"],
+                    ts=segment["ts"],
+                    dur=segment["dur"],
+                    args={"kind": segment["kind"], "stream": segment["stream"]},
+                )
+            )
+    events = events + annotations
+    if isinstance(trace, dict):
+        trace = dict(trace, traceEvents=events)
+    else:
+        trace = events
+    with open(path, "w") as f:
+        json.dump(trace, f)
+
+
+def format_overlap(analysis: List[Dict[str, Any]]) -> str:
+    r"""A table of the steps of ``analysis`` and of their streams."""
+    lines = [
+        f"{'step':<20} {'dev':>4} {'wall(ms)':>9} {'overlap':>8} "
+        f"{'exposed(ms)':>11} {'idle(ms)':>9}  critical path(ms)"
+    ]
+    for item in analysis:
+        path = "  ".join(
+            f"{kind}={us / 1e3:.3f}" for kind, us in item["critical_path"].items() if us
+        )
+        lines.append(
+            f"{item['step'][:20]:<20} {str(item['device']):>4} "
+            f"{item['wall_us'] / 1e3:>9.3f} {item['overlap']:>8.1%} "
+            f"{item['exposed_comm_us'] / 1e3:>11.3f} "
+            f"{item['idle_us'] / 1e3:>9.3f}  {path}"
+        )
+        for stream, stats in item["streams"].items():
+            idle = "  ".join(
+                f"{kind}={us / 1e3:.3f}" for kind, us in stats["idle"].items() if us
+            )
+            lines.append(
+                f"{'':<20} {'':>4}   stream {str(stream):<8} busy "
+                f"{stats['busy_us'] / 1e3:.3f}ms ({stats['utilization']:.0%})  "
+                f"idle {idle}"
+            )
+    return "\n".join(lines)
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(
+        description="Analyze the stream overlap of each step of a DIPU "
+        "profiler trace."
+    )
+    parser.add_argument("trace", help="chrome trace exported by the profiler")
+    parser.add_argument(
+        "--annotate", help="write the trace with the critical paths to this path"
+    )
+    parser.add_argument(
+        "--tolerance-us",
+        type=float,
+        default=2.0,
+        help="largest gap between a kernel and the one it waited for",
+    )
+    args = parser.parse_args(argv)
+
+    trace = _load(args.trace)
+    analysis = analyze_overlap(trace, tolerance_us=args.tolerance_us)
+    print(format_overlap(analysis))
+    if args.annotate:
+        annotate_trace(args.trace, analysis, args.annotate)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
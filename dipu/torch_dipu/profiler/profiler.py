@@ -23,6 +23,13 @@ def dipu_kineto_available():
     return True
 
 
+def _dipu_device_type():
+    # the DIPU allocators report their memory events on it
+    from torch_dipu.dipu.device import __dipu_device_type__
+
+    return getattr(DeviceType, __dipu_device_type__.upper())
+
+
 class TorchProfile(torch.autograd.profiler.profile):
     def _parse_kineto_results(self, result):
         # result.events() has most of the events - PyTorch op-level and device-level events
@@ -47,7 +54,8 @@ class TorchProfile(torch.autograd.profiler.profile):
         def _cuda_memory_usage(mem_record):
             return (
                 mem_record.nbytes()
-                if mem_record.device_type() in [DeviceType.CUDA, DeviceType.HIP]
+                if mem_record.device_type()
+                in [DeviceType.CUDA, DeviceType.HIP, _dipu_device_type()]
                 else 0
             )
 
@@ -497,11 +505,14 @@ class NativeProfile(object):
         with_stack=False,
         record_shapes=False,
         profile_memory=False,
+        counters=None,
     ):
         self.result_path = profiler_result_path
         self.with_stack = with_stack
         self.record_shapes = record_shapes
         self.profile_memory = profile_memory
+        # the hardware counters of the vendor profiler, None for its defaults
+        self.counters = counters
         self.entered = False
         try:
             os.makedirs(self.result_path, exist_ok=True)
@@ -513,6 +524,8 @@ class NativeProfile(object):
             raise RuntimeError("native profile traces are not reentrant")
 
         self.entered = True
+        if self.counters is not None:
+            _C._set_profiler_api_counters(list(self.counters))
         _C._enable_profiler_api(
             self.result_path, self.with_stack, self.record_shapes, self.profile_memory
         )
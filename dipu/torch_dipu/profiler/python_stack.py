@@ -0,0 +1,57 @@
+# Copyright (c) 2024, DeepLink.
+import os
+import sysconfig
+from typing import Iterable, List, Optional
+
+import torch
+
+from torch_dipu import _C
+
+
+def library_prefixes() -> List[str]:
+    r"""The directories of torch, torch_dipu and the Python standard library,
+    whose frames rarely matter in the stacks of a trace."""
+    import torch_dipu
+
+    prefixes = [
+        os.path.dirname(torch.__file__),
+        os.path.dirname(torch_dipu.__file__),
+    ]
+    paths = sysconfig.get_paths()
+    for stdlib in {paths["stdlib"], paths["platstdlib"]}:
+        # site-packages often lives in the stdlib directory, so the modules
+        # of the stdlib are listed one by one
+        if os.path.isdir(stdlib):
+            prefixes += [
+                os.path.join(stdlib, name)
+                for name in os.listdir(stdlib)
+                if name not in ("site-packages", "dist-packages")
+            ]
+    result = set()
+    for prefix in prefixes:
+        for path in (os.path.abspath(prefix), os.path.realpath(prefix)):
+            # A trailing separator keeps e.g. torchvision out of torch/
+            if os.path.isdir(path):
+                path = os.path.join(path, "")
+            result.add(path)
+    return sorted(result)
+
+
+def skip_python_frames(
+    skip_libraries: bool = True, prefixes: Optional[Iterable[str]] = None
+) -> None:
+    r"""Leave the frames of files under ``prefixes``, and of
+    :func:`library_prefixes` if ``skip_libraries``, out of the stacks of the
+    next traces with ``with_stack=True``. The call and return events of those
+    frames are then dropped right away, which makes the tracer much cheaper on
+    deep library stacks. nn.Module and optimizer calls are always kept.
+    ``skip_python_frames(False)`` records every frame again."""
+    skipped = list(prefixes or [])
+    if skip_libraries:
+        skipped += library_prefixes()
+    _C._dipu_set_python_tracer_skip_prefixes(skipped)
+
+
+def skipped_python_prefixes() -> List[str]:
+    r"""The prefixes set by :func:`skip_python_frames`."""
+    return _C._dipu_python_tracer_skip_prefixes()
@@ -0,0 +1,82 @@
+# Copyright (c) 2024, DeepLink.
+import json
+import threading
+import time
+from typing import Any, Callable, Dict, List, Optional
+
+from torch_dipu import _C
+
+
+class SamplingProfiler:
+    r"""Always-on telemetry of the ops run through DIOPI and the dicl backend.
+
+    One step out of every ``every_n_steps`` is sampled, counted by
+    :meth:`step`, and ``op_fraction`` of the ops of it. Only per op totals of
+    host and device time are kept, no trace. Up to ``ring_size`` sampled ops
+    wait for their device times at once. Every ``interval_s`` seconds the
+    totals since the last flush are appended as one json line to ``path``
+    and / or passed to ``callback``, a list of dicts with the op ``name``,
+    its ``calls``, ``host_ms``, and ``device_ms`` / ``max_device_ms`` over
+    ``device_calls``.
+    """
+
+    def __init__(
+        self,
+        every_n_steps: int = 100,
+        op_fraction: float = 1.0,
+        interval_s: float = 60.0,
+        path: Optional[str] = None,
+        callback: Optional[Callable[[List[Dict[str, Any]]], None]] = None,
+        ring_size: int = 1024,
+    ):
+        self.every_n_steps = every_n_steps
+        self.op_fraction = op_fraction
+        self.interval_s = interval_s
+        self.path = path
+        self.callback = callback
+        self.ring_size = ring_size
+        self._stop = threading.Event()
+        self._thread = None
+
+    def start(self) -> None:
+        _C._dipu_start_sampling(self.every_n_steps, self.op_fraction, self.ring_size)
+        self._stop.clear()
+        self._thread = threading.Thread(target=self._loop, daemon=True)
+        self._thread.start()
+
+    def stop(self) -> None:
+        r"""Flush the totals left and stop sampling."""
+        if self._thread is None:
+            return
+        self._stop.set()
+        self._thread.join()
+        self._thread = None
+        self.flush()
+        _C._dipu_stop_sampling()
+
+    def step(self) -> None:
+        r"""Mark the start of a step, ops of every ``every_n_steps``-th are sampled."""
+        _C._dipu_sampling_step()
+
+    def flush(self) -> List[Dict[str, Any]]:
+        r"""Report and return the totals since the last flush."""
+        summary = _C._dipu_sampling_summary(True)
+        if not summary:
+            return summary
+        if self.path is not None:
+            with open(self.path, "a") as f:
+                f.write(json.dumps({"time": time.time(), "ops": summary}) + "\n")
+        if self.callback is not None:
+            self.callback(summary)
+        return summary
+
+    def _loop(self) -> None:
+        while not self._stop.wait(self.interval_s):
+            self.flush()
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop()
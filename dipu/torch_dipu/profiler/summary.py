@@ -0,0 +1,252 @@
+# Copyright (c) 2024, DeepLink.
+r"""Per-op summaries of exported chrome traces, and the regressions between
+two of them, e.g. before and after a DIOPI upgrade::
+
+    python -m torch_dipu.profiler.summary trace.json
+    python -m torch_dipu.profiler.summary trace.json --baseline old.json \
+        --fail-above 0.1
+"""
+import argparse
+import json
+import sys
+from collections import Counter, defaultdict
+from typing import Any, Dict, List, Optional
+
+__all__ = ["summarize_trace", "diff_summaries", "format_summary", "format_diff"]
+
+_FALLBACK = "dipu_cpu_fallback"
+_DEVICE_CATEGORIES = ("kernel", "gpu_memcpy", "gpu_memset")
+
+
+class _Op:
+    __slots__ = ("event", "end", "children", "device_us", "bytes", "fallback")
+
+    def __init__(self, event):
+        self.event = event
+        self.end = event["ts"] + event.get("dur", 0)
+        self.children = []
+        self.device_us = 0.0
+        self.bytes = 0
+        self.fallback = False
+
+
+def _load(trace) -> List[Dict[str, Any]]:
+    if isinstance(trace, str):
+        with open(trace) as f:
+            trace = json.load(f)
+    if isinstance(trace, dict):
+        trace = trace["traceEvents"]
+    return trace
+
+
+def _build_trees(events) -> List[_Op]:
+    threads = defaultdict(list)
+    for event in events:
+        if event.get("ph") == "X" and event.get("cat") == "cpu_op":
+            threads[(event.get("pid"), event.get("tid"))].append(_Op(event))
+    roots = []
+    for ops in threads.values():
+        # parents first when two ops start at the same time
+        ops.sort(key=lambda op: (op.event["ts"], -op.end))
+        stack: List[_Op] = []
+        for op in ops:
+            while stack and stack[-1].end < op.end:
+                stack.pop()
+            (stack[-1].children if stack else roots).append(op)
+            stack.append(op)
+    return roots
+
+
+def _accumulate(op: _Op) -> None:
+    # device time and bytes of the descendants, iteratively for deep traces
+    order = []
+    stack = [op]
+    while stack:
+        node = stack.pop()
+        order.append(node)
+        stack.extend(node.children)
+    for node in reversed(order):
+        for child in node.children:
+            node.device_us += child.device_us
+            node.bytes += child.bytes
+            if child.event["name"] == _FALLBACK:
+                node.fallback = True
+
+
+def summarize_trace(trace) -> Dict[str, Dict[str, Any]]:
+    r"""Aggregate the ops of ``trace``, the path or the loaded json of a trace
+    exported by :meth:`torch.profiler.profile.export_chrome_trace`.
+
+    Returns a dict from op name to its ``calls``, ``host_us`` and ``device_us``
+    (both including nested ops), the ``bytes`` copied or set by it on the
+    device, the number of ``fallback_calls`` that ran on the CPU, and the
+    ``shapes`` of its inputs with their call counts, if recorded.
+    """
+    events = _load(trace)
+    roots = _build_trees(events)
+    by_id = {}
+    all_ops = []
+    stack = list(roots)
+    while stack:
+        op = stack.pop()
+        all_ops.append(op)
+        stack.extend(op.children)
+        external_id = op.event.get("args", {}).get("External id")
+        if external_id is not None:
+            by_id[external_id] = op
+
+    for event in events:
+        if event.get("ph") != "X" or event.get("cat") not in _DEVICE_CATEGORIES:
+            continue
+        args = event.get("args", {})
+        op = by_id.get(args.get("External id"))
+        if op is not None:
+            op.device_us += event.get("dur", 0)
+            op.bytes += int(args.get("bytes", 0))
+    for root in roots:
+        _accumulate(root)
+
+    summary: Dict[str, Dict[str, Any]] = {}
+    for op in all_ops:
+        name = op.event["name"]
+        if name == _FALLBACK:
+            continue
+        stats = summary.setdefault(
+            name,
+            {
+                "calls": 0,
+                "host_us": 0.0,
+                "device_us": 0.0,
+                "bytes": 0,
+                "fallback_calls": 0,
+                "shapes": Counter(),
+            },
+        )
+        stats["calls"] += 1
+        stats["host_us"] += op.event.get("dur", 0)
+        stats["device_us"] += op.device_us
+        stats["bytes"] += op.bytes
+        stats["fallback_calls"] += int(op.fallback)
+        dims = op.event.get("args", {}).get("Input Dims")
+        if dims is not None:
+            stats["shapes"][str(dims)] += 1
+    return summary
+
+
+def _cost(stats: Dict[str, Any]) -> float:
+    # device time where there is any, as host time mostly waits for it then
+    return stats["device_us"] or stats["host_us"]
+
+
+def diff_summaries(
+    baseline: Dict[str, Dict[str, Any]], current: Dict[str, Dict[str, Any]]
+) -> List[Dict[str, Any]]:
+    r"""Compare two :func:`summarize_trace` results op by op. Each item has the
+    op ``name``, its ``baseline_us`` and ``current_us`` per call (device time,
+    host time for ops without device activity), the ``delta_us`` per call and
+    the relative ``change``, and whether its ``fallback`` state changed. Ops
+    are ranked by the change of their total time, largest regression first.
+    """
+    result = []
+    for name in set(baseline) | set(current):
+        old, new = baseline.get(name), current.get(name)
+        old_us = _cost(old) / old["calls"] if old else 0.0
+        new_us = _cost(new) / new["calls"] if new else 0.0
+        old_total = _cost(old) if old else 0.0
+        new_total = _cost(new) if new else 0.0
+        old_fallback = bool(old and old["fallback_calls"])
+        new_fallback = bool(new and new["fallback_calls"])
+        fallback = ""
+        if old_fallback != new_fallback:
+            fallback = "new" if new_fallback else "fixed"
+        change = (new_us - old_us) / old_us if old_us else 0.0
+        if not old_us and new_us:
+            change = float("inf")
+        result.append(
+            {
+                "name": name,
+                "baseline_us": old_us,
+                "current_us": new_us,
+                "delta_us": new_us - old_us,
+                "change": change,
+                "total_delta_us": new_total - old_total,
+                "fallback": fallback,
+            }
+        )
+    result.sort(key=lambda item: item["total_delta_us"], reverse=True)
+    return result
+
+
+def format_summary(summary: Dict[str, Dict[str, Any]], top: int = 30) -> str:
+    r"""A table of the ``top`` most expensive ops of ``summary``."""
+    rows = sorted(summary.items(), key=lambda item: _cost(item[1]), reverse=True)
+    lines = [
+        f"{'op':<50} {'calls':>8} {'host(ms)':>10} {'device(ms)':>11} "
+        f"{'MB':>9} {'fallback':>8}  top shape"
+    ]
+    for name, stats in rows[:top]:
+        shape = stats["shapes"].most_common(1)
+        lines.append(
+            f"{name[:50]:<50} {stats['calls']:>8} {stats['host_us'] / 1e3:>10.3f} "
+            f"{stats['device_us'] / 1e3:>11.3f} {stats['bytes'] / 2**20:>9.2f} "
+            f"{stats['fallback_calls']:>8}  {shape[0][0] if shape else ''}"
+        )
+    return "\n".join(lines)
+
+
+def format_diff(diff: List[Dict[str, Any]], top: int = 30) -> str:
+    r"""A table of the ``top`` largest regressions of ``diff``."""
+    lines = [
+        f"{'op':<50} {'base(us)':>10} {'cur(us)':>10} {'change':>8} "
+        f"{'total(ms)':>10}  fallback"
+    ]
+    for item in diff[:top]:
+        lines.append(
+            f"{item['name'][:50]:<50} {item['baseline_us']:>10.2f} "
+            f"{item['current_us']:>10.2f} {item['change']:>8.1%} "
+            f"{item['total_delta_us'] / 1e3:>10.3f}  {item['fallback']}"
+        )
+    return "\n".join(lines)
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(
+        description="Summarize a DIPU profiler trace, or diff it against a "
+        "baseline."
+    )
+    parser.add_argument("trace", help="chrome trace exported by the profiler")
+    parser.add_argument("--baseline", help="trace of the reference run")
+    parser.add_argument("--top", type=int, default=30, help="rows to print")
+    parser.add_argument(
+        "--fail-above",
+        type=float,
+        help="exit with 1 if an op present in both runs got slower per call "
+        "by more than this fraction, or newly falls back to the CPU",
+    )
+    args = parser.parse_args(argv)
+
+    current = summarize_trace(args.trace)
+    if args.baseline is None:
+        print(format_summary(current, args.top))
+        return 0
+    diff = diff_summaries(summarize_trace(args.baseline), current)
+    print(format_diff(diff, args.top))
+    if args.fail_above is None:
+        return 0
+    failed = [
+        item
+        for item in diff
+        if item["fallback"] == "new"
+        or (
+            item["baseline_us"]
+            and item["current_us"]
+            and item["change"] > args.fail_above
+        )
+    ]
+    for item in failed:
+        print(f"regression: {item['name']}", file=sys.stderr)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
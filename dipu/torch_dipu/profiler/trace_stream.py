@@ -0,0 +1,43 @@
+# Copyright (c) 2024, DeepLink.
+from typing import Dict
+
+from torch_dipu import _C
+
+
+class TraceStream:
+    r"""Streams a trace of the torch ops, the DIOPI calls and their device
+    kernels to ``path`` in the perfetto protobuf format, for profiles too long
+    for :class:`torch.profiler.profile` to keep in memory.
+
+    The records are written as chunks by a background thread, every
+    ``flush_interval_s`` seconds or once a thread buffered ``chunk_records``
+    of them, so that memory stays bounded and the file is a valid trace,
+    readable by ui.perfetto.dev or trace_processor, after each chunk. It can't
+    run along with :class:`torch.profiler.profile`.
+    """
+
+    def __init__(
+        self, path: str, flush_interval_s: float = 1.0, chunk_records: int = 65536
+    ):
+        self.path = path
+        self.flush_interval_s = flush_interval_s
+        self.chunk_records = chunk_records
+        self.stats: Dict[str, int] = {}
+
+    def start(self) -> None:
+        _C._dipu_start_trace_stream(
+            self.path, int(self.flush_interval_s * 1000), self.chunk_records
+        )
+
+    def stop(self) -> Dict[str, int]:
+        r"""Write the records left and close the file. Returns the number of
+        ``records``, ``bytes`` and ``chunks`` written."""
+        self.stats = _C._dipu_stop_trace_stream()
+        return self.stats
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop()